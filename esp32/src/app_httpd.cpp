@@ -18,106 +18,73 @@
 #include "fb_gfx.h"
 #include "esp32-hal-ledc.h"
 #include "sdkconfig.h"
-#include "camera_index.h"
+#include "web_assets.h"
 #include "board_config.h"
 #include "uploader_settings.h"
 #include "uploader.h"
+#include "stream_broadcaster.h"
+#include "upload_abr.h"
+#include "upload_trace.h"
+#include "frame_clock.h"
+#include "frame_bus.h"
+#include "led_flash.h"
+#include "bmp_stream.h"
 #include "wifi_settings.h"
+#include "wifi_manager.h"
+#include "boot_graph.h"
+#include "async_log.h"
+#include "camera_control.h"
+#include "metrics.h"
 #include "cJSON.h"
 #include <WiFi.h>
 
+// Pages at fixed URLs (/setup) may be reused without asking for this long
+#define WEB_ASSET_CACHE_CONTROL "public, max-age=86400"
+
 #ifndef httpd_resp_send_400
 #define httpd_resp_send_400(req) httpd_resp_send_err((req), 400, "Bad Request")
 #endif
 
-#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
-#include "esp32-hal-log.h"
-#endif
-
-// LED FLASH setup
-#if defined(LED_GPIO_NUM)
-#define CONFIG_LED_MAX_INTENSITY 255
-
-int led_duty = 0;
-bool isStreaming = false;
-
-#endif
-
 typedef struct {
   httpd_req_t *req;
   size_t len;
 } jpg_chunking_t;
 
-#define PART_BOUNDARY "123456789000000000000987654321"
-static const char *_STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char *_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %d.%06d\r\n\r\n";
-
 httpd_handle_t stream_httpd = NULL;
 httpd_handle_t camera_httpd = NULL;
 
+// Timestamp and identity headers of a frame. The strings live in `hdr`, which must
+// outlive the response (httpd keeps the pointers until the headers are sent).
 typedef struct {
-  size_t size;   //number of values used for filtering
-  size_t index;  //current value index
-  size_t count;  //value count
-  int sum;
-  int *values;  //array to be filled with values
-} ra_filter_t;
-
-static ra_filter_t ra_filter;
-
-static ra_filter_t *ra_filter_init(ra_filter_t *filter, size_t sample_size) {
-  memset(filter, 0, sizeof(ra_filter_t));
-
-  filter->values = (int *)malloc(sample_size * sizeof(int));
-  if (!filter->values) {
-    return NULL;
-  }
-  memset(filter->values, 0, sample_size * sizeof(int));
-
-  filter->size = sample_size;
-  return filter;
-}
-
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-static int ra_filter_run(ra_filter_t *filter, int value) {
-  if (!filter->values) {
-    return value;
-  }
-  filter->sum -= filter->values[filter->index];
-  filter->values[filter->index] = value;
-  filter->sum += filter->values[filter->index];
-  filter->index++;
-  filter->index = filter->index % filter->size;
-  if (filter->count < filter->size) {
-    filter->count++;
-  }
-  return filter->sum / filter->count;
+  char ts[32];
+  char seq[12];
+  char when[24];
+} frame_headers_t;
+
+static void set_frame_headers(httpd_req_t *req, const frame_ref_t *ref, frame_headers_t *hdr) {
+  const camera_fb_t *fb = ref->frame->fb;
+  snprintf(hdr->ts, sizeof(hdr->ts), "%lld.%06ld", (long long)fb->timestamp.tv_sec, (long)fb->timestamp.tv_usec);
+  httpd_resp_set_hdr(req, "X-Timestamp", hdr->ts);
+  snprintf(hdr->seq, sizeof(hdr->seq), "%u", (unsigned)ref->frame->seq);
+  httpd_resp_set_hdr(req, "X-Frame-Seq", hdr->seq);
+  frame_clock_format(&fb->timestamp, hdr->when, sizeof(hdr->when));
+  if (hdr->when[0]) httpd_resp_set_hdr(req, "X-Capture-Time", hdr->when);
 }
-#endif
 
-#if defined(LED_GPIO_NUM)
-void enable_led(bool en) {  // Turn LED On or Off
-  int duty = en ? led_duty : 0;
-  if (en && isStreaming && (led_duty > CONFIG_LED_MAX_INTENSITY)) {
-    duty = CONFIG_LED_MAX_INTENSITY;
-  }
-  ledcWrite(LED_GPIO_NUM, duty);
-  //ledc_set_duty(CONFIG_LED_LEDC_SPEED_MODE, CONFIG_LED_LEDC_CHANNEL, duty);
-  //ledc_update_duty(CONFIG_LED_LEDC_SPEED_MODE, CONFIG_LED_LEDC_CHANNEL);
-  log_i("Set LED intensity to %d", duty);
+static bool bmp_send_chunk(void *arg, const uint8_t *data, size_t len) {
+  jpg_chunking_t *j = (jpg_chunking_t *)arg;
+  if (httpd_resp_send_chunk(j->req, (const char *)data, len) != ESP_OK) return false;
+  j->len += len;
+  return true;
 }
-#endif
 
 static esp_err_t bmp_handler(httpd_req_t *req) {
-  camera_fb_t *fb = NULL;
   esp_err_t res = ESP_OK;
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
   uint64_t fr_start = esp_timer_get_time();
-#endif
-  fb = esp_camera_fb_get();
-  if (!fb) {
-    log_e("Camera capture failed");
+  frame_ref_t ref;
+  frame_bus_guard guard(&ref);
+  if (!frame_bus_take(FRAME_BUS_CAPTURE, 0, pdMS_TO_TICKS(1000), &ref)) {
+    ALOGE(ALOG_CAMERA, "Camera capture failed");
     httpd_resp_send_500(req);
     return ESP_FAIL;
   }
@@ -126,25 +93,21 @@ static esp_err_t bmp_handler(httpd_req_t *req) {
   httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.bmp");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-  char ts[32];
-  snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
-  httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
+  frame_headers_t hdr;
+  set_frame_headers(req, &ref, &hdr);
 
-  uint8_t *buf = NULL;
-  size_t buf_len = 0;
-  bool converted = frame2bmp(fb, &buf, &buf_len);
-  esp_camera_fb_return(fb);
-  if (!converted) {
-    log_e("BMP Conversion failed");
-    httpd_resp_send_500(req);
+  // Decoded and sent strip by strip, so the frame is held until the last one is out
+  jpg_chunking_t chunk = {req, 0};
+  if (!bmp_stream_encode(ref.frame->fb, bmp_send_chunk, &chunk)) {
+    ALOGE(ALOG_CAMERA, "BMP Conversion failed after %uB", (unsigned)chunk.len);
+    // Nothing sent yet: a proper error; otherwise failing the handler drops the connection
+    if (!chunk.len) httpd_resp_send_500(req);
     return ESP_FAIL;
   }
-  res = httpd_resp_send(req, (const char *)buf, buf_len);
-  free(buf);
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+  res = httpd_resp_send_chunk(req, NULL, 0);
+  frame_bus_release(&ref);
   uint64_t fr_end = esp_timer_get_time();
-#endif
-  log_i("BMP: %llums, %uB", (uint64_t)((fr_end - fr_start) / 1000), buf_len);
+  ALOGI(ALOG_CAMERA, "BMP: %llums, %uB", (uint64_t)((fr_end - fr_start) / 1000), (unsigned)chunk.len);
   return res;
 }
 
@@ -160,151 +123,113 @@ static size_t jpg_encode_stream(void *arg, size_t index, const void *data, size_
   return len;
 }
 
+// /capture[?max_age_ms=N][&fresh=1]
+//  - max_age_ms: serve the newest frame the bus already has if it is at most N ms
+//    old, without waiting for (or triggering) an exposure. Polling clients should
+//    set it to their poll period so they ride along with /stream and the uploader.
+//  - fresh=1: only accept a frame exposed after the request arrived.
+// Otherwise the next frame the bus publishes is served; it is shared with any
+// other consumer waiting at the same time, so nothing is acquired twice.
 static esp_err_t capture_handler(httpd_req_t *req) {
-  camera_fb_t *fb = NULL;
   esp_err_t res = ESP_OK;
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
   int64_t fr_start = esp_timer_get_time();
-#endif
 
-#if defined(LED_GPIO_NUM)
-  enable_led(true);
-  vTaskDelay(150 / portTICK_PERIOD_MS);  // The LED needs to be turned on ~150ms before the call to esp_camera_fb_get()
-  fb = esp_camera_fb_get();              // or it won't be visible in the frame. A better way to do this is needed.
-  enable_led(false);
-#else
-  fb = esp_camera_fb_get();
-#endif
+  int max_age_ms = -1;
+  bool fresh = false;
+  char query[48], value[12];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "max_age_ms", value, sizeof(value)) == ESP_OK) {
+      max_age_ms = atoi(value);
+    }
+    if (httpd_query_key_value(query, "fresh", value, sizeof(value)) == ESP_OK) {
+      fresh = atoi(value) != 0;
+    }
+  }
+
+  frame_ref_t ref;
+  frame_bus_guard guard(&ref);
+  bool got = false;
+  if (!fresh && max_age_ms >= 0) {
+    got = frame_bus_latest(FRAME_BUS_CAPTURE, (int64_t)max_age_ms * 1000, &ref);
+    // With a flash, only a frame exposed while the LED was already on will do
+    int64_t lit = led_flash_cutoff_us();
+    if (got && led_flash_intensity() > 0 && (!lit || frame_capture_us(ref.frame->fb) < lit)) {
+      frame_bus_release(&ref);
+      got = false;
+    }
+  }
+  if (!got) {
+    got = led_flash_take(FRAME_BUS_CAPTURE, fresh ? fr_start : 0, pdMS_TO_TICKS(1000), &ref);
+  }
 
-  if (!fb) {
-    log_e("Camera capture failed");
+  if (!got) {
+    ALOGE(ALOG_CAMERA, "Camera capture failed");
     httpd_resp_send_500(req);
     return ESP_FAIL;
   }
+  camera_fb_t *fb = ref.frame->fb;
 
   httpd_resp_set_type(req, "image/jpeg");
   httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-  char ts[32];
-  snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
-  httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
+  frame_headers_t hdr;
+  set_frame_headers(req, &ref, &hdr);
+  char age[12];
+  snprintf(age, sizeof(age), "%u", (unsigned)((ref.taken_us - ref.frame->published_us) / 1000));
+  httpd_resp_set_hdr(req, "X-Frame-Age-Ms", age);
+  char flash[12];
+  if (led_flash_intensity() > 0) {
+    snprintf(flash, sizeof(flash), "%u", (unsigned)led_flash_last_latency_ms());
+    httpd_resp_set_hdr(req, "X-Flash-Latency-Ms", flash);
+  }
 
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
   size_t fb_len = 0;
-#endif
   if (fb->format == PIXFORMAT_JPEG) {
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
     fb_len = fb->len;
-#endif
     res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
   } else {
     jpg_chunking_t jchunk = {req, 0};
     res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk) ? ESP_OK : ESP_FAIL;
     httpd_resp_send_chunk(req, NULL, 0);
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
     fb_len = jchunk.len;
-#endif
   }
-  esp_camera_fb_return(fb);
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+  frame_bus_release(&ref);
   int64_t fr_end = esp_timer_get_time();
-#endif
-  log_i("JPG: %uB %ums", (uint32_t)(fb_len), (uint32_t)((fr_end - fr_start) / 1000));
+  ALOGI(ALOG_CAMERA, "JPG: %uB %ums", (uint32_t)(fb_len), (uint32_t)((fr_end - fr_start) / 1000));
   return res;
 }
 
-static esp_err_t stream_handler(httpd_req_t *req) {
-  camera_fb_t *fb = NULL;
-  struct timeval _timestamp;
-  esp_err_t res = ESP_OK;
-  size_t _jpg_buf_len = 0;
-  uint8_t *_jpg_buf = NULL;
-  char *part_buf[128];
+static void stream_active_changed(bool active) {
+  led_flash_hold(LED_FLASH_STREAM, active);
+}
 
-  log_i("Stream handler started - client connected");
+// /stream hands the socket to the broadcaster and returns; frames are written by its sender tasks
+static esp_err_t stream_handler(httpd_req_t *req) {
+  ALOGI(ALOG_HTTP, "Stream handler started - client connected");
 
-  static int64_t last_frame = 0;
-  if (!last_frame) {
-    last_frame = esp_timer_get_time();
+  esp_err_t res = stream_broadcaster_subscribe(req);
+  if (res == ESP_ERR_NO_MEM) {
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_sendstr(req, "Too many stream clients");
   }
-
-  res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
   if (res != ESP_OK) {
-    return res;
+    ALOGE(ALOG_HTTP, "Stream subscribe failed");
+    return ESP_FAIL;
   }
+  return ESP_OK;
+}
 
+static esp_err_t stream_stats_handler(httpd_req_t *req) {
+  cJSON *root = cJSON_CreateObject();
+  stream_broadcaster_to_json(root);
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_set_type(req, "application/json");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  httpd_resp_set_hdr(req, "X-Framerate", "60");
-
-#if defined(LED_GPIO_NUM)
-  isStreaming = true;
-  enable_led(true);
-#endif
-
-  while (true) {
-    fb = esp_camera_fb_get();
-    if (!fb) {
-      log_e("Camera capture failed - no frame buffer");
-      res = ESP_FAIL;
-    } else {
-      _timestamp.tv_sec = fb->timestamp.tv_sec;
-      _timestamp.tv_usec = fb->timestamp.tv_usec;
-      if (fb->format != PIXFORMAT_JPEG) {
-        bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-        esp_camera_fb_return(fb);
-        fb = NULL;
-        if (!jpeg_converted) {
-          log_e("JPEG compression failed");
-          res = ESP_FAIL;
-        }
-      } else {
-        _jpg_buf_len = fb->len;
-        _jpg_buf = fb->buf;
-      }
-    }
-    if (res == ESP_OK) {
-      res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-    }
-    if (res == ESP_OK) {
-      size_t hlen = snprintf((char *)part_buf, 128, _STREAM_PART, _jpg_buf_len, _timestamp.tv_sec, _timestamp.tv_usec);
-      res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
-    }
-    if (res == ESP_OK) {
-      res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
-    }
-    if (fb) {
-      esp_camera_fb_return(fb);
-      fb = NULL;
-      _jpg_buf = NULL;
-    } else if (_jpg_buf) {
-      free(_jpg_buf);
-      _jpg_buf = NULL;
-    }
-    if (res != ESP_OK) {
-      log_e("Send frame failed");
-      break;
-    }
-    int64_t fr_end = esp_timer_get_time();
-
-    int64_t frame_time = fr_end - last_frame;
-    last_frame = fr_end;
-
-    frame_time /= 1000;
-#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
-    uint32_t avg_frame_time = ra_filter_run(&ra_filter, frame_time);
-#endif
-    log_i(
-      "MJPG: %uB %ums (%.1ffps), AVG: %ums (%.1ffps)", (uint32_t)(_jpg_buf_len), (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time, avg_frame_time,
-      1000.0 / avg_frame_time
-    );
-  }
-
-#if defined(LED_GPIO_NUM)
-  isStreaming = false;
-  enable_led(false);
-#endif
-
+  esp_err_t res = httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
   return res;
 }
 
@@ -329,6 +254,23 @@ static esp_err_t parse_get(httpd_req_t *req, char **obuf) {
   return ESP_FAIL;
 }
 
+// /status snapshot. Reading it costs dozens of SCCB transactions, so it is built
+// once and reused until a control handler writes to the sensor; register values
+// (including live AEC/AGC ones) are as of the last rebuild. Clients revalidate with
+// If-None-Match and get 304 while nothing was written.
+static char status_json[1024];
+static size_t status_len = 0;
+static char status_etag[12];
+static bool status_valid = false;
+static SemaphoreHandle_t status_lock = NULL;
+
+static void status_invalidate() {
+  if (!status_lock) return;
+  xSemaphoreTake(status_lock, portMAX_DELAY);
+  status_valid = false;
+  xSemaphoreGive(status_lock);
+}
+
 static esp_err_t cmd_handler(httpd_req_t *req) {
   char *buf = NULL;
   char variable[32];
@@ -345,75 +287,16 @@ static esp_err_t cmd_handler(httpd_req_t *req) {
   free(buf);
 
   int val = atoi(value);
-  log_i("%s = %d", variable, val);
+  ALOGI(ALOG_CAMERA, "%s = %d", variable, val);
   sensor_t *s = esp_camera_sensor_get();
-  int res = 0;
+  camera_control_result_t res = camera_control_set(s, variable, val);
+  status_invalidate();
 
-  if (!strcmp(variable, "framesize")) {
-    if (s->pixformat == PIXFORMAT_JPEG) {
-      res = s->set_framesize(s, (framesize_t)val);
-    }
-  } else if (!strcmp(variable, "quality")) {
-    res = s->set_quality(s, val);
-  } else if (!strcmp(variable, "contrast")) {
-    res = s->set_contrast(s, val);
-  } else if (!strcmp(variable, "brightness")) {
-    res = s->set_brightness(s, val);
-  } else if (!strcmp(variable, "saturation")) {
-    res = s->set_saturation(s, val);
-  } else if (!strcmp(variable, "gainceiling")) {
-    res = s->set_gainceiling(s, (gainceiling_t)val);
-  } else if (!strcmp(variable, "colorbar")) {
-    res = s->set_colorbar(s, val);
-  } else if (!strcmp(variable, "awb")) {
-    res = s->set_whitebal(s, val);
-  } else if (!strcmp(variable, "agc")) {
-    res = s->set_gain_ctrl(s, val);
-  } else if (!strcmp(variable, "aec")) {
-    res = s->set_exposure_ctrl(s, val);
-  } else if (!strcmp(variable, "hmirror")) {
-    res = s->set_hmirror(s, val);
-  } else if (!strcmp(variable, "vflip")) {
-    res = s->set_vflip(s, val);
-  } else if (!strcmp(variable, "awb_gain")) {
-    res = s->set_awb_gain(s, val);
-  } else if (!strcmp(variable, "agc_gain")) {
-    res = s->set_agc_gain(s, val);
-  } else if (!strcmp(variable, "aec_value")) {
-    res = s->set_aec_value(s, val);
-  } else if (!strcmp(variable, "aec2")) {
-    res = s->set_aec2(s, val);
-  } else if (!strcmp(variable, "dcw")) {
-    res = s->set_dcw(s, val);
-  } else if (!strcmp(variable, "bpc")) {
-    res = s->set_bpc(s, val);
-  } else if (!strcmp(variable, "wpc")) {
-    res = s->set_wpc(s, val);
-  } else if (!strcmp(variable, "raw_gma")) {
-    res = s->set_raw_gma(s, val);
-  } else if (!strcmp(variable, "lenc")) {
-    res = s->set_lenc(s, val);
-  } else if (!strcmp(variable, "special_effect")) {
-    res = s->set_special_effect(s, val);
-  } else if (!strcmp(variable, "wb_mode")) {
-    res = s->set_wb_mode(s, val);
-  } else if (!strcmp(variable, "ae_level")) {
-    res = s->set_ae_level(s, val);
-  }
-#if defined(LED_GPIO_NUM)
-  else if (!strcmp(variable, "led_intensity")) {
-    led_duty = val;
-    if (isStreaming) {
-      enable_led(true);
-    }
-  }
-#endif
-  else {
-    log_i("Unknown command: %s", variable);
-    res = -1;
+  if (res == CAMERA_CONTROL_RANGE) {
+    return httpd_resp_send_400(req);
   }
-
-  if (res < 0) {
+  if (res != CAMERA_CONTROL_OK) {
+    ALOGW(ALOG_CAMERA, "%s: %s", variable, camera_control_result_name(res));
     return httpd_resp_send_500(req);
   }
 
@@ -421,13 +304,58 @@ static esp_err_t cmd_handler(httpd_req_t *req) {
   return httpd_resp_send(req, NULL, 0);
 }
 
+// Body: {"<control>": <value>, ...}. All keys are applied in one request, mode
+// changes first; the response has a result per key.
+static esp_err_t control_batch_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  char buf[1024];
+  int len = req->content_len;
+  if (len <= 0 || len >= (int)sizeof(buf)) {
+    httpd_resp_set_status(req, "400 Bad Request");
+    httpd_resp_send(req, "Bad Request", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+  }
+  int got = 0;
+  while (got < len) {
+    int ret = httpd_req_recv(req, buf + got, len - got);
+    if (ret <= 0) {
+      return httpd_resp_send_500(req);
+    }
+    got += ret;
+  }
+  buf[got] = 0;
+
+  cJSON *root = cJSON_Parse(buf);
+  if (!root || !cJSON_IsObject(root)) {
+    cJSON_Delete(root);
+    httpd_resp_set_status(req, "400 Bad Request");
+    httpd_resp_send(req, "Bad Request - expected a JSON object", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+  }
+
+  cJSON *out = cJSON_CreateObject();
+  cJSON *results = cJSON_CreateObject();
+  int applied = camera_control_apply_json(esp_camera_sensor_get(), root, results);
+  cJSON_Delete(root);
+  status_invalidate();
+  ALOGI(ALOG_CAMERA, "HTTP /control/batch: %d control(s) applied", applied);
+
+  cJSON_AddNumberToObject(out, "applied", applied);
+  cJSON_AddItemToObject(out, "results", results);
+  char *sout = cJSON_PrintUnformatted(out);
+  httpd_resp_send(req, sout, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(sout);
+  cJSON_Delete(out);
+  return ESP_OK;
+}
+
 static int print_reg(char *p, sensor_t *s, uint16_t reg, uint32_t mask) {
   return sprintf(p, "\"0x%x\":%u,", reg, s->get_reg(s, reg, mask));
 }
 
-static esp_err_t status_handler(httpd_req_t *req) {
-  static char json_response[1024];
-
+static size_t build_status(char *json_response) {
   sensor_t *s = esp_camera_sensor_get();
   char *p = json_response;
   *p++ = '{';
@@ -488,16 +416,40 @@ static esp_err_t status_handler(httpd_req_t *req) {
   p += sprintf(p, "\"vflip\":%u,", s->status.vflip);
   p += sprintf(p, "\"dcw\":%u,", s->status.dcw);
   p += sprintf(p, "\"colorbar\":%u", s->status.colorbar);
-#if defined(LED_GPIO_NUM)
-  p += sprintf(p, ",\"led_intensity\":%u", led_duty);
-#else
-  p += sprintf(p, ",\"led_intensity\":%d", -1);
-#endif
+  p += sprintf(p, ",\"led_intensity\":%d", led_flash_intensity());
+  p += sprintf(p, ",\"stream_quality\":%d", stream_broadcaster_quality());
   *p++ = '}';
-  *p++ = 0;
+  *p = 0;
+  return p - json_response;
+}
+
+static esp_err_t status_handler(httpd_req_t *req) {
   httpd_resp_set_type(req, "application/json");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  return httpd_resp_send(req, json_response, strlen(json_response));
+  // Let browsers keep the body but always ask first
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  xSemaphoreTake(status_lock, portMAX_DELAY);
+  if (!status_valid) {
+    status_len = build_status(status_json);
+    // Content hash (FNV-1a): stays valid across reboots that restore the same settings
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < status_len; i++) h = (h ^ (uint8_t)status_json[i]) * 16777619u;
+    snprintf(status_etag, sizeof(status_etag), "\"%08x\"", (unsigned)h);
+    status_valid = true;
+  }
+  httpd_resp_set_hdr(req, "ETag", status_etag);
+
+  esp_err_t ret;
+  char inm[64];
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) == ESP_OK && (strstr(inm, status_etag) || strcmp(inm, "*") == 0)) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    ret = httpd_resp_send(req, NULL, 0);
+  } else {
+    ret = httpd_resp_send(req, status_json, status_len);
+  }
+  xSemaphoreGive(status_lock);
+  return ret;
 }
 
 static esp_err_t xclk_handler(httpd_req_t *req) {
@@ -515,10 +467,11 @@ static esp_err_t xclk_handler(httpd_req_t *req) {
   free(buf);
 
   int xclk = atoi(_xclk);
-  log_i("Set XCLK: %d MHz", xclk);
+  ALOGI(ALOG_CAMERA, "Set XCLK: %d MHz", xclk);
 
   sensor_t *s = esp_camera_sensor_get();
   int res = s->set_xclk(s, LEDC_TIMER_0, xclk);
+  status_invalidate();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -547,10 +500,11 @@ static esp_err_t reg_handler(httpd_req_t *req) {
   int reg = atoi(_reg);
   int mask = atoi(_mask);
   int val = atoi(_val);
-  log_i("Set Register: reg: 0x%02x, mask: 0x%02x, value: 0x%02x", reg, mask, val);
+  ALOGI(ALOG_CAMERA, "Set Register: reg: 0x%02x, mask: 0x%02x, value: 0x%02x", reg, mask, val);
 
   sensor_t *s = esp_camera_sensor_get();
   int res = s->set_reg(s, reg, mask, val);
+  status_invalidate();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -581,7 +535,7 @@ static esp_err_t greg_handler(httpd_req_t *req) {
   if (res < 0) {
     return httpd_resp_send_500(req);
   }
-  log_i("Get Register: reg: 0x%02x, mask: 0x%02x, value: 0x%02x", reg, mask, res);
+  ALOGI(ALOG_CAMERA, "Get Register: reg: 0x%02x, mask: 0x%02x, value: 0x%02x", reg, mask, res);
 
   char buffer[20];
   const char *val = itoa(res, buffer, 10);
@@ -614,9 +568,10 @@ static esp_err_t pll_handler(httpd_req_t *req) {
   int pclk = parse_get_var(buf, "pclk", 0);
   free(buf);
 
-  log_i("Set Pll: bypass: %d, mul: %d, sys: %d, root: %d, pre: %d, seld5: %d, pclken: %d, pclk: %d", bypass, mul, sys, root, pre, seld5, pclken, pclk);
+  ALOGI(ALOG_CAMERA, "Set Pll: bypass: %d, mul: %d, sys: %d, root: %d, pre: %d, seld5: %d, pclken: %d, pclk: %d", bypass, mul, sys, root, pre, seld5, pclken, pclk);
   sensor_t *s = esp_camera_sensor_get();
   int res = s->set_pll(s, bypass, mul, sys, root, pre, seld5, pclken, pclk);
+  status_invalidate();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -646,12 +601,14 @@ static esp_err_t win_handler(httpd_req_t *req) {
   bool binning = parse_get_var(buf, "binning", 0) == 1;
   free(buf);
 
-  log_i(
+  ALOGI(
+    ALOG_CAMERA,
     "Set Window: Start: %d %d, End: %d %d, Offset: %d %d, Total: %d %d, Output: %d %d, Scale: %u, Binning: %u", startX, startY, endX, endY, offsetX, offsetY,
     totalX, totalY, outputX, outputY, scale, binning  // codespell:ignore totaly
   );
   sensor_t *s = esp_camera_sensor_get();
   int res = s->set_res_raw(s, startX, startY, endX, endY, offsetX, offsetY, totalX, totalY, outputX, outputY, scale, binning);  // codespell:ignore totaly
+  status_invalidate();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -661,23 +618,13 @@ static esp_err_t win_handler(httpd_req_t *req) {
 }
 
 static esp_err_t uploader_get_handler(httpd_req_t *req) {
-  log_i("HTTP: /uploader GET requested");
+  ALOGI(ALOG_HTTP, "HTTP: /uploader GET requested");
   httpd_resp_set_type(req, "application/json");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-  uploader_settings_init();
-  String url = uploader_get_url();
-  String api = uploader_get_api_key();
-  uint32_t interval = uploader_get_interval_ms();
-
   cJSON *root = cJSON_CreateObject();
-  cJSON_AddStringToObject(root, "url", url.c_str());
-  cJSON_AddStringToObject(root, "gateway", uploader_get_gateway().c_str());
-  cJSON_AddStringToObject(root, "api_key", api.c_str());
-  cJSON_AddNumberToObject(root, "interval_ms", interval);
-  // include device id and (optional) public stream URL
-  cJSON_AddStringToObject(root, "device_id", uploader_get_device_id().c_str());
-  cJSON_AddStringToObject(root, "stream_url", uploader_get_stream_url().c_str());
+  uploader_settings_to_json(root);
+  cJSON_AddNumberToObject(root, "version", uploader_settings_version());
 
   char *out = cJSON_PrintUnformatted(root);
   httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
@@ -687,12 +634,12 @@ static esp_err_t uploader_get_handler(httpd_req_t *req) {
 }
 
 static esp_err_t uploader_post_handler(httpd_req_t *req) {
-  log_i("HTTP: /uploader POST requested (len=%d)", req->content_len);
+  ALOGI(ALOG_HTTP, "HTTP: /uploader POST requested (len=%d)", req->content_len);
   httpd_resp_set_type(req, "application/json");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
   int len = req->content_len;
-  Serial.printf("[uploader] handler entered; content_len=%d\n", len);
+  ALOGD(ALOG_HTTP, "[uploader] handler entered; content_len=%d", len);
   if (len <= 0) {
     httpd_resp_set_status(req, "400 Bad Request");
     httpd_resp_send(req, "Bad Request", HTTPD_RESP_USE_STRLEN);
@@ -700,60 +647,40 @@ static esp_err_t uploader_post_handler(httpd_req_t *req) {
   }
   char *buf = (char*)malloc(len + 1);
   if (!buf) {
-    Serial.println("[uploader] malloc failed");
+    ALOGE(ALOG_HTTP, "[uploader] malloc failed");
     return httpd_resp_send_500(req);
   }
   int ret = httpd_req_recv(req, buf, len);
   if (ret <= 0) {
-    Serial.printf("[uploader] httpd_req_recv failed ret=%d\n", ret);
+    ALOGW(ALOG_HTTP, "[uploader] httpd_req_recv failed ret=%d", ret);
     free(buf);
     return httpd_resp_send_500(req);
   }
   buf[len] = 0;
-  Serial.printf("[uploader] body=%s\n", buf);
+  ALOGD(ALOG_HTTP, "[uploader] body=%s", buf);
 
   cJSON *root = cJSON_Parse(buf);
   free(buf);
   if (!root) {
-    Serial.println("[uploader] JSON parse failed");
+    ALOGW(ALOG_HTTP, "[uploader] JSON parse failed");
     httpd_resp_set_status(req, "400 Bad Request");
     httpd_resp_send(req, "Bad Request - invalid JSON", HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
   }
 
-  cJSON *jurl = cJSON_GetObjectItem(root, "url");
-  cJSON *jgateway = cJSON_GetObjectItem(root, "gateway");
-  cJSON *japi = cJSON_GetObjectItem(root, "api_key");
-  cJSON *jinterval = cJSON_GetObjectItem(root, "interval_ms");
-  cJSON *jdevice = cJSON_GetObjectItem(root, "device_id");
-  cJSON *jstream = cJSON_GetObjectItem(root, "stream_url");
-
-  if (jurl && cJSON_IsString(jurl)) {
-    uploader_set_url(jurl->valuestring);
-    Serial.printf("HTTP /uploader: saved url='%s'\n", jurl->valuestring);
-  }
-  if (jgateway && cJSON_IsString(jgateway)) {
-    uploader_set_gateway(jgateway->valuestring);
-    Serial.printf("HTTP /uploader: saved gateway='%s'\n", jgateway->valuestring);
-  }
-  if (japi && cJSON_IsString(japi)) {
-    uploader_set_api_key(japi->valuestring);
-    Serial.printf("HTTP /uploader: saved api_key_len=%d\n", (int)strlen(japi->valuestring));
-  }
-  if (jinterval && cJSON_IsNumber(jinterval)) {
-    uploader_set_interval_ms((uint32_t)jinterval->valuedouble);
-    Serial.printf("HTTP /uploader: saved interval_ms=%u\n", (uint32_t)jinterval->valuedouble);
-  }
-  if (jdevice && cJSON_IsString(jdevice)) {
-    uploader_set_device_id(jdevice->valuestring);
-    Serial.printf("HTTP /uploader: saved device_id='%s'\n", jdevice->valuestring);
-  }
-  if (jstream && cJSON_IsString(jstream)) {
-    uploader_set_stream_url(jstream->valuestring);
-    Serial.printf("HTTP /uploader: saved stream_url='%s'\n", jstream->valuestring);
-  }
-
+  // Validated against the settings schema and stored in one commit
+  char err[64];
+  int changed = uploader_settings_apply_json(root, SETTING_JSON, err, sizeof(err));
   cJSON_Delete(root);
+  if (changed < 0) {
+    ALOGW(ALOG_HTTP, "HTTP /uploader: rejected (%s)", err);
+    httpd_resp_set_status(req, "400 Bad Request");
+    httpd_resp_send(req, err, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+  }
+  ALOGI(ALOG_HTTP, "HTTP /uploader: %d setting(s) saved", changed);
+  // A new NTP server takes effect now (no-op when it did not change)
+  if (WiFi.status() == WL_CONNECTED) frame_clock_begin(uploader_get_ntp_server().c_str());
 
   cJSON *out = cJSON_CreateObject();
   cJSON_AddBoolToObject(out, "ok", true);
@@ -766,18 +693,123 @@ static esp_err_t uploader_post_handler(httpd_req_t *req) {
   return ESP_OK;
 }
 
-static esp_err_t wifi_get_handler(httpd_req_t *req) {
-  log_i("HTTP: /wifi GET requested");
+static esp_err_t uploader_status_handler(httpd_req_t *req) {
   httpd_resp_set_type(req, "application/json");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-  wifi_settings_init();
-  String ssid = wifi_get_ssid();
-  bool prov = wifi_is_provisioned();
+  cJSON *root = cJSON_CreateObject();
+  uploader_status_to_json(root);
+
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
+  return ESP_OK;
+}
+
+// Clock mapping used for X-Capture-Time, so the server can check its offset to the device
+static esp_err_t time_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+  cJSON *root = cJSON_CreateObject();
+  frame_clock_to_json(root);
+
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
+  return ESP_OK;
+}
+
+// Frame bus: driver buffers held and per-consumer frames, drops, wait and hold times
+static esp_err_t bus_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+  cJSON *root = cJSON_CreateObject();
+  frame_bus_to_json(root);
+
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
+  return ESP_OK;
+}
+
+// Flash LED: holders, measured frame period and LED-on to lit frame latency
+static esp_err_t flash_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+  cJSON *root = cJSON_CreateObject();
+  led_flash_to_json(root);
+
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
+  return ESP_OK;
+}
+
+// Upload latency spans: per-phase percentiles and the newest records (?recent=N, default 8)
+static esp_err_t uploader_trace_handler(httpd_req_t *req) {
+  int recent = 8;
+  char query[32], value[8];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK && httpd_query_key_value(query, "recent", value, sizeof(value)) == ESP_OK) {
+    recent = atoi(value);
+  }
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  cJSON *root = cJSON_CreateObject();
+  upload_trace_to_json(root, recent);
+
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
+  return ESP_OK;
+}
+
+static esp_err_t uploader_abr_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  cJSON *root = cJSON_CreateObject();
+  upload_abr_to_json(root);
+
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
+  return ESP_OK;
+}
+
+// Reply to a request that queued a Wi-Fi join: {"ok":true,"token":N,...current state}
+static esp_err_t send_connect_token(httpd_req_t *req, uint32_t token) {
+  cJSON *root = cJSON_CreateObject();
+  cJSON_AddBoolToObject(root, "ok", true);
+  wifi_manager_to_json(root, token);
+
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
+  return ESP_OK;
+}
+
+static esp_err_t wifi_get_handler(httpd_req_t *req) {
+  ALOGI(ALOG_HTTP, "HTTP: /wifi GET requested");
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
   cJSON *root = cJSON_CreateObject();
-  cJSON_AddStringToObject(root, "ssid", ssid.c_str());
-  cJSON_AddBoolToObject(root, "provisioned", prov);
+  wifi_settings_to_json(root);
 
   char *out = cJSON_PrintUnformatted(root);
   httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
@@ -787,7 +819,7 @@ static esp_err_t wifi_get_handler(httpd_req_t *req) {
 }
 
 static esp_err_t wifi_post_handler(httpd_req_t *req) {
-  log_i("HTTP: /wifi POST requested (len=%d)", req->content_len);
+  ALOGI(ALOG_HTTP, "HTTP: /wifi POST requested (len=%d)", req->content_len);
   httpd_resp_set_type(req, "application/json");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
@@ -807,7 +839,7 @@ static esp_err_t wifi_post_handler(httpd_req_t *req) {
   buf[len] = 0;
 
   // Debug: log raw request body to help diagnose provisioning issues
-  Serial.printf("HTTP: /wifi POST body: %s\n", buf);
+  ALOGD(ALOG_HTTP, "HTTP: /wifi POST body: %s", buf);
 
   cJSON *root = cJSON_Parse(buf);
   free(buf);
@@ -817,118 +849,144 @@ static esp_err_t wifi_post_handler(httpd_req_t *req) {
     return ESP_OK;
   }
 
-  cJSON *jssid = cJSON_GetObjectItem(root, "ssid");
-  cJSON *jpass = cJSON_GetObjectItem(root, "password");
-
-  // Accept SSID even when password is empty/missing (open Wi‑Fi networks or when user leaves password blank).
   // Save only SSID & password if provided
-  if (jssid && cJSON_IsString(jssid)) {
-    const char *ssidstr = jssid->valuestring;
-    const char *passstr = (jpass && cJSON_IsString(jpass)) ? jpass->valuestring : "";
-    wifi_set_credentials(ssidstr, passstr);
-    Serial.printf("HTTP /wifi: provisioning saved (decoded) ssid='%s' pass_len=%d\n", ssidstr, (int)strlen(passstr));
+  char err[64];
+  int changed = wifi_settings_apply_json(root, SETTING_JSON, err, sizeof(err));
+  cJSON_Delete(root);
+  if (changed < 0) {
+    httpd_resp_set_status(req, "400 Bad Request");
+    httpd_resp_send(req, err, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
   }
 
-  cJSON_Delete(root);
+  // Joining happens in the Wi-Fi manager task; poll GET /wifi/status?token=N for the outcome
+  return send_connect_token(req, wifi_manager_connect());
+}
 
-  const char *ok = "{\"ok\":true}";
-  httpd_resp_send(req, ok, strlen(ok));
+static esp_err_t reconnect_handler(httpd_req_t *req) {
+  ALOGI(ALOG_HTTP, "HTTP: /reconnect POST requested");
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-  // Attempt to reconnect in background (non-blocking short task)
-  xTaskCreatePinnedToCore([](void *param) {
-    (void)param;
-    String ssid = wifi_get_ssid();
-    String pass = wifi_get_pass();
-    if (ssid.length() == 0) vTaskDelete(NULL);
+  if (!wifi_is_provisioned()) {
+    const char *err = "{\"ok\":false, \"error\": \"no_credentials\"}";
+    httpd_resp_send(req, err, strlen(err));
+    return ESP_OK;
+  }
+  return send_connect_token(req, wifi_manager_connect());
+}
 
-    Serial.printf("[provision] Attempting reconnection to SSID: '%s' (len=%d) pass_len=%d\n", ssid.c_str(), (int)ssid.length(), (int)pass.length());
+static esp_err_t wifi_status_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-    int n = WiFi.scanNetworks();
-    Serial.printf("[provision] Scan found %d networks\n", n);
-    for (int i = 0; i < n; i++) {
-      Serial.printf("  %d: '%s' (%d dBm)\n", i, WiFi.SSID(i).c_str(), WiFi.RSSI(i));
-    }
+  uint32_t token = 0;
+  char query[32], value[12];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK && httpd_query_key_value(query, "token", value, sizeof(value)) == ESP_OK) {
+    token = strtoul(value, NULL, 10);
+  }
 
-    // Keep AP active during connect attempts
-    WiFi.disconnect(false); // don't erase stored AP config
-    WiFi.mode(WIFI_AP_STA);
-    WiFi.begin(ssid.c_str(), pass.c_str());
+  cJSON *root = cJSON_CreateObject();
+  wifi_manager_to_json(root, token);
 
-    unsigned long start = millis();
-    while (millis() - start < 10000) {
-      if (WiFi.status() == WL_CONNECTED) break;
-      vTaskDelay(pdMS_TO_TICKS(500));
-    }
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
+  return ESP_OK;
+}
 
-    if (WiFi.status() == WL_CONNECTED) {
-      Serial.printf("[provision] Reconnected: %s\n", WiFi.localIP().toString().c_str());
-      // re-enable SoftAP so provisioning UI remains available
-      const char* apName = "NutriCycle-Setup";
-      WiFi.softAP(apName);
-      Serial.printf("[provision] SoftAP '%s' ensured for provisioning\n", apName);
-    } else {
-      Serial.println("[provision] Reconnect attempt failed");
-    }
+// Cached scan results; a stale cache (or ?refresh=1) starts a background scan and
+// the fresh list shows up on a later request
+static esp_err_t wifi_scan_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-    vTaskDelete(NULL);
-  }, "reconnect", 4 * 1024, NULL, 1, NULL, 1);
+  bool force = false;
+  char query[32], value[4];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK && httpd_query_key_value(query, "refresh", value, sizeof(value)) == ESP_OK) {
+    force = atoi(value) != 0;
+  }
+  wifi_manager_scan(force);
+
+  cJSON *root = cJSON_CreateObject();
+  wifi_manager_scan_to_json(root);
 
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
   return ESP_OK;
 }
 
-static esp_err_t reconnect_handler(httpd_req_t *req) {
-  log_i("HTTP: /reconnect POST requested");
+// Deferred logger: per-module levels and ring counters
+static esp_err_t log_get_handler(httpd_req_t *req) {
   httpd_resp_set_type(req, "application/json");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-  wifi_settings_init();
-  String ssid = wifi_get_ssid();
-  String pass = wifi_get_pass();
+  cJSON *root = cJSON_CreateObject();
+  alog_to_json(root);
 
-  if (ssid.length() == 0) {
-    const char *err = "{\"ok\":false, \"error\": \"no_credentials\"}";
-    httpd_resp_send(req, err, strlen(err));
-    return ESP_OK;
-  }
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
+  return ESP_OK;
+}
 
-  // Attempt to connect (blocking up to 8s) to report immediate status
-  Serial.printf("[reconnect] Attempting connect to SSID: '%s' (len=%d) pass_len=%d\n", ssid.c_str(), (int)ssid.length(), (int)pass.length());
+// Body: {"<module>": "none|error|warn|info|debug|verbose", ...}
+static esp_err_t log_post_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-  int n = WiFi.scanNetworks();
-  Serial.printf("[reconnect] Scan found %d networks\n", n);
-  for (int i = 0; i < n; i++) {
-    Serial.printf("  %d: '%s' (%d dBm)\n", i, WiFi.SSID(i).c_str(), WiFi.RSSI(i));
+  char buf[256];
+  int len = req->content_len;
+  if (len <= 0 || len >= (int)sizeof(buf)) {
+    httpd_resp_set_status(req, "400 Bad Request");
+    httpd_resp_send(req, "Bad Request", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
   }
-
-  WiFi.disconnect(false); // do not erase credentials
-  // Keep AP active while attempting to connect so provisioning UI stays available
-  WiFi.mode(WIFI_AP_STA);
-  WiFi.begin(ssid.c_str(), pass.c_str());
-
-  unsigned long start = millis();
-  while (millis() - start < 8000) {
-    if (WiFi.status() == WL_CONNECTED) break;
-    vTaskDelay(pdMS_TO_TICKS(250));
+  int ret = httpd_req_recv(req, buf, len);
+  if (ret <= 0) {
+    return httpd_resp_send_500(req);
   }
+  buf[ret] = 0;
 
-  char out[256];
-  if (WiFi.status() == WL_CONNECTED) {
-    // Ensure SoftAP is still available for provisioning use
-    const char* apName = "NutriCycle-Setup";
-    WiFi.softAP(apName);
-    Serial.printf("[reconnect] Reconnected: %s; SoftAP '%s' ensured\n", WiFi.localIP().toString().c_str(), apName);
-    snprintf(out, sizeof(out), "{\"ok\":true, \"connected\":true, \"ip\":\"%s\"}", WiFi.localIP().toString().c_str());
-  } else {
-    Serial.println("[reconnect] Reconnect attempt failed");
-    snprintf(out, sizeof(out), "{\"ok\":true, \"connected\":false}");
+  cJSON *root = cJSON_Parse(buf);
+  if (!root) {
+    httpd_resp_set_status(req, "400 Bad Request");
+    httpd_resp_send(req, "Bad Request - invalid JSON", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+  }
+  char err[80];
+  int changed = alog_apply_json(root, err, sizeof(err));
+  cJSON_Delete(root);
+  if (changed < 0) {
+    httpd_resp_set_status(req, "400 Bad Request");
+    httpd_resp_send(req, err, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
   }
+  ALOGI(ALOG_HTTP, "HTTP /log: %d level(s) changed", changed);
+  return log_get_handler(req);
+}
+
+// Boot timeline: per-stage start/end times and the time to the first upload
+static esp_err_t boot_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  cJSON *root = cJSON_CreateObject();
+  boot_to_json(root);
 
-  httpd_resp_send(req, out, strlen(out));
+  char *out = cJSON_PrintUnformatted(root);
+  httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+  cJSON_free(out);
+  cJSON_Delete(root);
   return ESP_OK;
 }
 
 static esp_err_t provision_post_handler(httpd_req_t *req) {
-  log_i("HTTP: /provision POST requested");
+  ALOGI(ALOG_HTTP, "HTTP: /provision POST requested");
   httpd_resp_set_type(req, "application/json");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
@@ -944,7 +1002,7 @@ static esp_err_t provision_post_handler(httpd_req_t *req) {
   if (ret <= 0) { free(buf); return httpd_resp_send_500(req); }
   buf[len] = 0;
 
-  Serial.printf("HTTP: /provision POST body: %s\n", buf);
+  ALOGD(ALOG_HTTP, "HTTP: /provision POST body: %s", buf);
   cJSON *root = cJSON_Parse(buf);
   free(buf);
   if (!root) {
@@ -953,337 +1011,159 @@ static esp_err_t provision_post_handler(httpd_req_t *req) {
     return ESP_OK;
   }
 
-  cJSON *jssid = cJSON_GetObjectItem(root, "ssid");
-  cJSON *jpass = cJSON_GetObjectItem(root, "password");
-  cJSON *jurl = cJSON_GetObjectItem(root, "url");
-  cJSON *jgateway = cJSON_GetObjectItem(root, "gateway");
-  cJSON *japi = cJSON_GetObjectItem(root, "api_key");
-  cJSON *jinterval = cJSON_GetObjectItem(root, "interval_ms");
-  cJSON *jdevice = cJSON_GetObjectItem(root, "device_id");
-  cJSON *jstream = cJSON_GetObjectItem(root, "stream_url");
-
-  if (jssid && cJSON_IsString(jssid)) {
-    const char *ssidstr = jssid->valuestring;
-    const char *passstr = (jpass && cJSON_IsString(jpass)) ? jpass->valuestring : "";
-    wifi_set_credentials(ssidstr, passstr);
-    Serial.printf("/provision saved wifi (decoded) ssid='%s' pass_len=%d\n", ssidstr, (int)strlen(passstr));
+  // Wi-Fi and uploader settings each go to flash in a single commit
+  char err[64];
+  int changed = wifi_settings_apply_json(root, SETTING_PROVISION, err, sizeof(err));
+  if (changed >= 0) changed = uploader_settings_apply_json(root, SETTING_PROVISION, err, sizeof(err));
+  cJSON_Delete(root);
+  if (changed < 0) {
+    ALOGW(ALOG_HTTP, "/provision rejected (%s)", err);
+    httpd_resp_set_status(req, "400 Bad Request");
+    httpd_resp_send(req, err, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
   }
 
-  if (jurl && cJSON_IsString(jurl)) {
-    uploader_set_url(jurl->valuestring);
-    Serial.printf("/provision saved uploader url='%s'\n", jurl->valuestring);
-  }
-  if (jgateway && cJSON_IsString(jgateway)) {
-    uploader_set_gateway(jgateway->valuestring);
-    Serial.printf("/provision saved uploader gateway='%s'\n", jgateway->valuestring);
-  }
-  if (japi && cJSON_IsString(japi)) {
-    uploader_set_api_key(japi->valuestring);
-    Serial.printf("/provision saved uploader api_key_len=%d\n", (int)strlen(japi->valuestring));
-  }
-  if (jinterval && cJSON_IsNumber(jinterval)) {
-    uploader_set_interval_ms((uint32_t)jinterval->valuedouble);
-    Serial.printf("/provision saved uploader interval_ms=%u\n", (uint32_t)jinterval->valuedouble);
-  }
-  if (jdevice && cJSON_IsString(jdevice)) {
-    uploader_set_device_id(jdevice->valuestring);
-    Serial.printf("/provision saved uploader device_id='%s'\n", jdevice->valuestring);
+  // Background reconnect; the manager keeps the AP on and starts the uploader once joined.
+  // Unchanged credentials on a live link keep the current connection.
+  uint32_t token = wifi_manager_connect();
+  if (WiFi.status() == WL_CONNECTED && uploader_is_configured()) {
+    ALOGI(ALOG_HTTP, "[provision] Uploader configured; attempting to start uploader task");
+    startUploaderTask();
   }
-  if (jstream && cJSON_IsString(jstream)) {
-    uploader_set_stream_url(jstream->valuestring);
-    Serial.printf("/provision saved uploader stream_url='%s'\n", jstream->valuestring);
-  }
-
-  cJSON_Delete(root);
-
-  const char *ok = "{\"ok\":true}";
-  httpd_resp_send(req, ok, strlen(ok));
-
-  // Background reconnect + ensure AP stays on
-  xTaskCreatePinnedToCore([](void *param) {
-    (void)param;
-    String ssid = wifi_get_ssid();
-    String pass = wifi_get_pass();
-    if (ssid.length() == 0) vTaskDelete(NULL);
-
-    Serial.printf("[provision] Starting reconnection attempt to '%s'\n", ssid.c_str());
-
-    int n = WiFi.scanNetworks();
-    Serial.printf("[provision] Scan found %d networks\n", n);
-    for (int i = 0; i < n; ++i) {
-      Serial.printf("[provision] scan[%d] SSID='%s' RSSI=%d secure=%d\n", i, WiFi.SSID(i).c_str(), WiFi.RSSI(i), WiFi.encryptionType(i));
-    }
-
-    WiFi.disconnect(false);
-    WiFi.mode(WIFI_AP_STA);
-    WiFi.begin(ssid.c_str(), pass.c_str());
-
-    unsigned long start = millis();
-    unsigned long last_log = 0;
-    while (millis() - start < 15000) {
-      if (WiFi.status() == WL_CONNECTED) break;
-      if (millis() - last_log >= 2000) {
-        Serial.printf("[provision] waiting for connect... status=%d elapsed=%lums\n", WiFi.status(), millis() - start);
-        last_log = millis();
-      }
-      vTaskDelay(pdMS_TO_TICKS(500));
-    }
-
-    if (WiFi.status() == WL_CONNECTED) {
-      Serial.printf("[provision] Reconnected: %s\n", WiFi.localIP().toString().c_str());
-      const char* apName = "NutriCycle-Setup";
-      WiFi.softAP(apName);
-      Serial.printf("[provision] SoftAP '%s' ensured for provisioning\n", apName);
-
-      // If uploader configured and wifi connected, start uploader task
-      uploader_settings_init();
-      if (uploader_is_configured()) {
-        Serial.println("[provision] Uploader configured; attempting to start uploader task");
-        startUploaderTask();
-      }
-    } else {
-      Serial.println("[provision] Reconnect attempt failed");
-    }
-
-    vTaskDelete(NULL);
-  }, "provision_reconnect", 6 * 1024, NULL, 1, NULL, 1);
-
-  Serial.println("[provision] Background reconnect task started");
-  return ESP_OK;
+  return send_connect_token(req, token);
 }
 
 static esp_err_t start_ap_handler(httpd_req_t *req) {
-  log_i("HTTP: /start_ap POST requested");
+  ALOGI(ALOG_HTTP, "HTTP: /start_ap POST requested");
   httpd_resp_set_type(req, "application/json");
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
   WiFi.mode(WIFI_AP_STA);
-  const char* apName = "NutriCycle-Setup";
+  const char* apName = WIFI_AP_NAME;
   WiFi.softAP(apName);
-  log_i("SoftAP '%s' started for provisioning", apName);
-  Serial.printf("HTTP /start_ap: SoftAP '%s' started\n", apName);
+  ALOGI(ALOG_HTTP, "SoftAP '%s' started for provisioning", apName);
 
   const char *ok = "{\"ok\":true}";
   return httpd_resp_send(req, ok, strlen(ok));
 }
 
-static const char *setup_html = R"rawliteral(<!doctype html><html><head><meta charset=\"utf-8\"><meta name=\"viewport\" content=\"width=device-width,initial-scale=1\"><title>NutriCycle Setup</title></head><body style=\"font-family:Arial,sans-serif;padding:12px\"> 
-<h2>NutriCycle - Device Setup</h2>
-<p>Use this page to configure Wi‑Fi and Node gateway settings. Enter the gateway host or full URL (e.g. <code>example.ngrok.io</code> or <code>https://example.ngrok.io</code>). The API key is optional and used if your gateway requires it. Leave Gateway blank to rely on direct MJPEG streaming and device mapping on the gateway. Recommended: use the uploader mode (enter gateway) so the device can POST frames to the gateway which forwards detection requests.</p>
-<form id="provisionForm">
-  <h3>Wi-Fi</h3>
-  <label>SSID: <input id="ssid" name="ssid" /></label><br/><br/>
-  <label>Password: <input id="password" name="password" type="password" /></label><br/><br/>
-
-  <h3>Uploader</h3>
-  <label>Gateway host or URL: <input id="gateway" name="gateway" style="width:80%" placeholder="example.ngrok.io or https://example.ngrok.io" /></label>
-  <small>Enter the Node gateway host (e.g. <code>192.168.1.50:3000</code>) or full URL (e.g. <code>https://example.ngrok.io</code>). The device will post frames to <code>&lt;gateway&gt;/upload</code>. Use the API key below if your gateway requires it (header <code>X-API-KEY</code>).</small><br/><br/>
-  <label>API Key: <input id="api_key" name="api_key" /></label><br/><br/>
-  <label>Device ID: <input id="device_id" name="device_id" /></label>
-  <small>(defaults to device MAC address; used to register the stream on the gateway)</small><br/><br/>
-  <label>Stream URL (optional): <input id="stream_url" name="stream_url" style="width:80%" placeholder="https://your-ngrok-url.ngrok.io/stream" /></label>
-  <small>Optional public MJPEG stream URL (ngrok or router). If provided, the device will attempt to register this URL with the Node gateway on save.</small><br/><br/>
-  <label>Interval (ms): <input id="interval_ms" name="interval_ms" type="number" /></label>
-  <small>Uploader frame POST interval (default 500ms). If you want live MJPEG via Node proxy, leave Gateway blank and ensure Node has device mapping.</small><br/><br/>
-
-  <button type="button" onclick="saveUploaderOnly()">Save Uploader Only</button>
-  <button type="button" onclick="saveProvision()">Save & Apply</button>
-</form>
-<hr/>
-<div id="msg"></div>
-<script>
-async function load() {
-  try {
-    const r1 = await fetch('/wifi');
-    const w = await r1.json();
-    document.getElementById('ssid').value = w.ssid || '';
-
-    const r2 = await fetch('/uploader');
-    const u = await r2.json();
-    document.getElementById('gateway').value = u.gateway || u.url || '';
-    document.getElementById('api_key').value = u.api_key||'';
-    document.getElementById('device_id').value = u.device_id||'';
-    document.getElementById('stream_url').value = u.stream_url||'';
-    document.getElementById('interval_ms').value = u.interval_ms||500;
-
-    // NOTE: single-button provision function is available: saveProvision()
-  } catch (e) { console.error(e); }
-}
-async function saveWifi() {
-  const ssid = document.getElementById('ssid').value;
-  const password = document.getElementById('password').value;
-  await fetch('/wifi', { method: 'POST', headers:{'Content-Type':'application/json'}, body: JSON.stringify({ssid,password}) });
-  document.getElementById('msg').innerText = 'Wi-Fi saved. Device will try to connect.';
+
+// Per-route request counters for /metrics. Routes registered through
+// register_route() go via a trampoline that counts the request and forwards it.
+#define HTTP_ROUTES_MAX 40
+
+typedef struct {
+  const char *uri;
+  httpd_method_t method;
+  esp_err_t (*handler)(httpd_req_t *req);
+  std::atomic<uint32_t> hits;
+} http_route_t;
+
+static http_route_t routes[HTTP_ROUTES_MAX];
+static int route_count = 0;  // only grows during startCameraServer()
+
+static esp_err_t counted_handler(httpd_req_t *req) {
+  http_route_t *r = (http_route_t *)req->user_ctx;
+  r->hits.fetch_add(1, std::memory_order_relaxed);
+  return r->handler(req);
 }
-async function saveUploader() {
-  const gateway = document.getElementById('gateway').value;
-  const api_key = document.getElementById('api_key').value;
-  const device_id = document.getElementById('device_id').value;
-  const stream_url = document.getElementById('stream_url').value;
-  const interval_ms = Number(document.getElementById('interval_ms').value) || 500;
-  try {
-    const r = await fetch('/uploader', { method: 'POST', headers:{'Content-Type':'application/json'}, body: JSON.stringify({gateway,api_key,device_id,stream_url,interval_ms}) });
-    const text = await r.text();
-    if (!r.ok) {
-      document.getElementById('msg').innerText = `Uploader save failed: ${r.status} ${text}`;
-      return {ok:false, status:r.status, text};
-    }
-    document.getElementById('msg').innerText = 'Uploader settings saved: ' + text;
-    return {ok:true, status:r.status, text};
-  } catch (e) {
-    document.getElementById('msg').innerText = 'Uploader save error: ' + e.toString();
-    return {ok:false, status:0, text:e.toString()};
-  }
+
+static esp_err_t register_route(httpd_handle_t hd, const httpd_uri_t *uri) {
+  if (route_count >= HTTP_ROUTES_MAX) {
+    return httpd_register_uri_handler(hd, uri);
+  }
+  http_route_t *r = &routes[route_count++];
+  r->uri = uri->uri;
+  r->method = uri->method;
+  r->handler = uri->handler;
+  httpd_uri_t counted = *uri;
+  counted.handler = counted_handler;
+  counted.user_ctx = r;
+  return httpd_register_uri_handler(hd, &counted);
 }
-async function saveUploaderOnly() {
-  document.getElementById('msg').innerText = 'Saving uploader (no wifi change)...';
-  await saveUploader();
+
+static void metrics_send_chunk(void *ctx, const char *buf, size_t len) {
+  httpd_resp_send_chunk((httpd_req_t *)ctx, buf, len);
 }
-async function reconnect() {
-  document.getElementById('msg').innerText = 'Attempting reconnect...';
-  try {
-    const r = await fetch('/reconnect', { method: 'POST' });
-    const j = await r.json();
-    if (j && j.connected) {
-      document.getElementById('msg').innerText = 'Reconnected! IP: ' + (j.ip || '');
-    } else {
-      document.getElementById('msg').innerText = 'Reconnect failed. Status: ' + (j && j.connected ? 'connected' : 'not connected');
-    }
-  } catch (e) {
-    document.getElementById('msg').innerText = 'Reconnect error';
+
+static esp_err_t metrics_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  metrics_out_t out;
+  out.write = metrics_send_chunk;
+  out.ctx = req;
+  out.len = 0;
+  metrics_write(&out);
+
+  metrics_family(&out, "http_requests_total", "counter", "Requests handled per route");
+  for (int i = 0; i < route_count; i++) {
+    metrics_printf(&out, METRICS_PREFIX "http_requests_total{method=\"%s\",uri=\"%s\"} %u\n", http_method_str((enum http_method)routes[i].method),
+                   routes[i].uri, (unsigned)routes[i].hits.load(std::memory_order_relaxed));
   }
+  metrics_flush(&out);
+  return httpd_resp_send_chunk(req, NULL, 0);
 }
-// Single-button provision function (JS)
-async function saveProvision() {
-  const ssid = document.getElementById('ssid').value;
-  const password = document.getElementById('password').value;
-  const gateway = document.getElementById('gateway').value;
-  const api_key = document.getElementById('api_key').value;
-  const device_id = document.getElementById('device_id').value;
-  const stream_url = document.getElementById('stream_url').value;
-  const interval_ms = Number(document.getElementById('interval_ms').value) || 500;
-
-  document.getElementById('msg').innerText = 'Saving uploader settings...';
-  try {
-    // First save uploader settings (so they persist even if reconnect interrupts the AP)
-    const up = await saveUploader();
-    if (!up.ok) {
-      document.getElementById('msg').innerText = `Uploader save failed: ${up.status} ${up.text}`;
-      return;
-    }
 
-    document.getElementById('msg').innerText = 'Uploader saved. Saving Wi‑Fi and applying...';
-
-    // Then save wifi (this will trigger reconnect) — send minimal body to /provision
-    try {
-      const provResp = await fetch('/provision', { method: 'POST', headers:{'Content-Type':'application/json'}, body: JSON.stringify({ssid,password}) });
-      let provText = '';
-      try { provText = await provResp.text(); } catch(e) {}
-      if (!provResp.ok) {
-        document.getElementById('msg').innerText = `Provision save failed: ${provResp.status} ${provText}`;
-        return;
-      }
-
-      // provision responded ok; now check reconnect status
-      document.getElementById('msg').innerText = 'Saved. Attempting reconnect...';
-      try {
-        const r2 = await fetch('/reconnect', { method: 'POST' });
-        const j2 = await r2.json();
-        if (j2 && j2.connected) {
-          document.getElementById('msg').innerText = 'Reconnected! IP: ' + (j2.ip || '');
-        } else {
-          document.getElementById('msg').innerText = 'Saved. Reconnect failed or pending; SoftAP remains active for provisioning.';
-        }
-      } catch (e) { document.getElementById('msg').innerText = 'Saved, but reconnect probe failed'; }
-
-      // Attempt stream registration (best-effort) using saved gateway
-      if (gateway && stream_url && device_id) {
-        try {
-          let base = gateway;
-          if (!/^https?:\/\//.test(base)) base = 'http://' + base;
-          base = (new URL(base)).origin;
-          const regUrl = `${base}/devices/${encodeURIComponent(device_id)}/register_stream`;
-          const rreg = await fetch(regUrl, { method: 'POST', headers: {'Content-Type':'application/json', 'X-API-KEY': api_key || ''}, body: JSON.stringify({ url: stream_url }) });
-          if (rreg.ok) {
-            document.getElementById('msg').innerText += ' Stream registered with gateway.';
-          } else {
-            document.getElementById('msg').innerText += ' Stream registration failed.';
-          }
-        } catch (e) {
-          document.getElementById('msg').innerText += ' Stream registration error.';
-        }
-      }
-
-    } catch (e) {
-      document.getElementById('msg').innerText = 'Error saving provisioning: ' + e.toString();
-      return;
-    }
-
-  } catch (e) {
-    document.getElementById('msg').innerText = 'Error saving uploader settings: ' + e.toString();
+// Embedded pages are stored gzipped with a strong ETag (see tools/build_web_assets.py)
+static const web_asset_t *find_asset(const char *name) {
+  for (size_t i = 0; i < WEB_ASSET_COUNT; i++) {
+    if (strcmp(web_assets[i].name, name) == 0) return &web_assets[i];
   }
+  return NULL;
 }
 
-async function startAP() {
-    document.getElementById('msg').innerText = 'Starting AP...';
-    try {
-      const r = await fetch('/start_ap', { method: 'POST' });
-      const j = await r.json();
-      if (j && j.ok) document.getElementById('msg').innerText = 'AP started. Connect to 192.168.4.1';
-      else document.getElementById('msg').innerText = 'Failed to start AP';
-    } catch (e) { document.getElementById('msg').innerText = 'Error starting AP'; }
-  }
-  function injectOpenAPButton() {
-    if (!document.getElementById('openApBtn')) {
-      let b = document.createElement('button');
-      b.type = 'button';
-      b.id = 'openApBtn';
-      b.innerText = 'Open Setup AP';
-      b.style.marginLeft = '8px';
-      b.onclick = startAP;
-      let wf = document.getElementById('wifiForm'); if (wf) wf.appendChild(b);
-    }
+static esp_err_t send_asset(httpd_req_t *req, const char *name, const char *cache_control) {
+  const web_asset_t *a = find_asset(name);
+  if (!a) {
+    return httpd_resp_send_404(req);
   }
-  window.addEventListener('load', () => { load(); injectOpenAPButton(); });
-</script>
-</body>
-</html>)rawliteral";
+  httpd_resp_set_type(req, a->type);
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Cache-Control", cache_control);
+  httpd_resp_set_hdr(req, "ETag", a->etag);
+
+  char inm[64];
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) == ESP_OK && strstr(inm, a->etag)) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+  }
+  httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+  return httpd_resp_send(req, (const char *)a->gz, a->gz_len);
+}
 
 static esp_err_t setup_handler(httpd_req_t *req) {
-  log_i("HTTP: /setup requested");
-  httpd_resp_set_type(req, "text/html");
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  return httpd_resp_send(req, setup_html, strlen(setup_html));
+  ALOGI(ALOG_HTTP, "HTTP: /setup requested");
+  return send_asset(req, "setup", WEB_ASSET_CACHE_CONTROL);
 }
 
 static esp_err_t index_handler(httpd_req_t *req) {
-  // If device is not provisioned, redirect to the setup page to make provisioning UX easier
-  wifi_settings_init();
+  // "/" shows the setup page until the device is provisioned, so browsers must
+  // revalidate it (a 304 costs a few bytes) rather than reuse it for max-age
   if (!wifi_is_provisioned()) {
-    log_i("Index requested while not provisioned - serving setup page");
-    return setup_handler(req);
+    ALOGI(ALOG_HTTP, "Index requested while not provisioned - serving setup page");
+    return send_asset(req, "setup", "no-cache");
   }
 
-  httpd_resp_set_type(req, "text/html");
-  httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
   sensor_t *s = esp_camera_sensor_get();
   if (s != NULL) {
     if (s->id.PID == OV3660_PID) {
-      return httpd_resp_send(req, (const char *)index_ov3660_html_gz, index_ov3660_html_gz_len);
+      return send_asset(req, "index_ov3660", "no-cache");
     } else if (s->id.PID == OV5640_PID) {
-      return httpd_resp_send(req, (const char *)index_ov5640_html_gz, index_ov5640_html_gz_len);
+      return send_asset(req, "index_ov5640", "no-cache");
     } else {
-      return httpd_resp_send(req, (const char *)index_ov2640_html_gz, index_ov2640_html_gz_len);
+      return send_asset(req, "index_ov2640", "no-cache");
     }
   } else {
-    log_e("Camera sensor not found");
+    ALOGE(ALOG_HTTP, "Camera sensor not found");
     return httpd_resp_send_500(req);
   }
 }
 
 void startCameraServer() {
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-  config.max_uri_handlers = 32; // allow extra handlers for settings
+  config.max_uri_handlers = HTTP_ROUTES_MAX; // allow extra handlers for settings
+  if (!status_lock) status_lock = xSemaphoreCreateMutex();
 
   httpd_uri_t index_uri = {
     .uri = "/",
@@ -1422,6 +1302,62 @@ void startCameraServer() {
     .user_ctx = NULL
   };
 
+  // Adaptive upload profile: current operating point, bounds and recent decisions
+  httpd_uri_t uploader_abr_uri = {
+    .uri = "/uploader/abr",
+    .method = HTTP_GET,
+    .handler = uploader_abr_handler,
+    .user_ctx = NULL
+  };
+
+  // Per-phase upload latency (capture, DNS, connect, TLS, write, TTFB, response)
+  httpd_uri_t uploader_trace_uri = {
+    .uri = "/uploader/trace",
+    .method = HTTP_GET,
+    .handler = uploader_trace_handler,
+    .user_ctx = NULL
+  };
+
+  // SNTP state and the monotonic-to-wall-clock mapping
+  httpd_uri_t time_uri = {
+    .uri = "/time",
+    .method = HTTP_GET,
+    .handler = time_handler,
+    .user_ctx = NULL
+  };
+
+  // Frame bus consumers and driver buffer usage
+  httpd_uri_t bus_uri = {
+    .uri = "/bus",
+    .method = HTTP_GET,
+    .handler = bus_handler,
+    .user_ctx = NULL
+  };
+
+  // Flash LED state and snapshot latency
+  httpd_uri_t flash_uri = {
+    .uri = "/flash",
+    .method = HTTP_GET,
+    .handler = flash_handler,
+    .user_ctx = NULL
+  };
+
+  // Per-client /stream statistics (fps, bytes, dropped frames)
+  httpd_uri_t stream_stats_uri = {
+    .uri = "/stream/stats",
+    .method = HTTP_GET,
+    .handler = stream_stats_handler,
+    .user_ctx = NULL
+  };
+
+  // Uploader pipeline state: frame ring depth/drops and capture/upload counters
+  httpd_uri_t uploader_status_uri = {
+    .uri = "/uploader/status",
+    .method = HTTP_GET,
+    .handler = uploader_status_handler,
+    .user_ctx = NULL
+  };
+
   // Wi-Fi endpoints (GET returns stored SSID/provision state, POST saves credentials)
   httpd_uri_t wifi_get_uri = {
     .uri = "/wifi",
@@ -1437,6 +1373,58 @@ void startCameraServer() {
     .user_ctx = NULL
   };
 
+  // Wi-Fi manager state (and the outcome of a join token) and cached scan results
+  httpd_uri_t wifi_status_uri = {
+    .uri = "/wifi/status",
+    .method = HTTP_GET,
+    .handler = wifi_status_handler,
+    .user_ctx = NULL
+  };
+
+  httpd_uri_t wifi_scan_uri = {
+    .uri = "/wifi/scan",
+    .method = HTTP_GET,
+    .handler = wifi_scan_handler,
+    .user_ctx = NULL
+  };
+
+  httpd_uri_t log_get_uri = {
+    .uri = "/log",
+    .method = HTTP_GET,
+    .handler = log_get_handler,
+    .user_ctx = NULL
+  };
+
+  httpd_uri_t log_post_uri = {
+    .uri = "/log",
+    .method = HTTP_POST,
+    .handler = log_post_handler,
+    .user_ctx = NULL
+  };
+
+  // Prometheus text format, for the monitoring stack
+  httpd_uri_t metrics_uri = {
+    .uri = "/metrics",
+    .method = HTTP_GET,
+    .handler = metrics_handler,
+    .user_ctx = NULL
+  };
+
+  // Several camera controls in one request
+  httpd_uri_t control_batch_uri = {
+    .uri = "/control/batch",
+    .method = HTTP_POST,
+    .handler = control_batch_handler,
+    .user_ctx = NULL
+  };
+
+  httpd_uri_t boot_uri = {
+    .uri = "/boot",
+    .method = HTTP_GET,
+    .handler = boot_handler,
+    .user_ctx = NULL
+  };
+
   // Register uploader and wifi endpoints
   httpd_register_uri_handler(camera_httpd, &uploader_get_uri);
   httpd_register_uri_handler(camera_httpd, &uploader_post_uri);
@@ -1505,45 +1493,51 @@ void startCameraServer() {
 #endif
   };
 
-  ra_filter_init(&ra_filter, 20);
+  stream_broadcaster_begin(stream_active_changed);
 
-  log_i("Starting web server on port: '%d'", config.server_port);
+  ALOGI(ALOG_HTTP, "Starting web server on port: '%d'", config.server_port);
   if (httpd_start(&camera_httpd, &config) == ESP_OK) {
-    httpd_register_uri_handler(camera_httpd, &index_uri);
-    httpd_register_uri_handler(camera_httpd, &cmd_uri);
-    httpd_register_uri_handler(camera_httpd, &status_uri);
-    httpd_register_uri_handler(camera_httpd, &capture_uri);
-    httpd_register_uri_handler(camera_httpd, &bmp_uri);
-
-    httpd_register_uri_handler(camera_httpd, &xclk_uri);
-    httpd_register_uri_handler(camera_httpd, &reg_uri);
-    httpd_register_uri_handler(camera_httpd, &greg_uri);
-    httpd_register_uri_handler(camera_httpd, &pll_uri);
-    httpd_register_uri_handler(camera_httpd, &win_uri);
+    register_route(camera_httpd, &index_uri);
+    register_route(camera_httpd, &cmd_uri);
+    register_route(camera_httpd, &control_batch_uri);
+    register_route(camera_httpd, &status_uri);
+    register_route(camera_httpd, &capture_uri);
+    register_route(camera_httpd, &bmp_uri);
+
+    register_route(camera_httpd, &xclk_uri);
+    register_route(camera_httpd, &reg_uri);
+    register_route(camera_httpd, &greg_uri);
+    register_route(camera_httpd, &pll_uri);
+    register_route(camera_httpd, &win_uri);
 
     // Ensure uploader, wifi & provisioning endpoints are registered after server start
-    httpd_register_uri_handler(camera_httpd, &uploader_get_uri);
-    httpd_register_uri_handler(camera_httpd, &uploader_post_uri);
-    httpd_register_uri_handler(camera_httpd, &wifi_get_uri);
-    httpd_register_uri_handler(camera_httpd, &wifi_post_uri);
-    httpd_register_uri_handler(camera_httpd, &provision_post_uri);
-    httpd_register_uri_handler(camera_httpd, &setup_uri);
-    httpd_register_uri_handler(camera_httpd, &reconnect_uri);
-    httpd_register_uri_handler(camera_httpd, &startap_uri);
+    register_route(camera_httpd, &uploader_get_uri);
+    register_route(camera_httpd, &uploader_post_uri);
+    register_route(camera_httpd, &uploader_status_uri);
+    register_route(camera_httpd, &uploader_abr_uri);
+    register_route(camera_httpd, &uploader_trace_uri);
+    register_route(camera_httpd, &time_uri);
+    register_route(camera_httpd, &bus_uri);
+    register_route(camera_httpd, &flash_uri);
+    register_route(camera_httpd, &stream_stats_uri);
+    register_route(camera_httpd, &wifi_get_uri);
+    register_route(camera_httpd, &wifi_post_uri);
+    register_route(camera_httpd, &wifi_status_uri);
+    register_route(camera_httpd, &wifi_scan_uri);
+    register_route(camera_httpd, &boot_uri);
+    register_route(camera_httpd, &log_get_uri);
+    register_route(camera_httpd, &log_post_uri);
+    register_route(camera_httpd, &provision_post_uri);
+    register_route(camera_httpd, &setup_uri);
+    register_route(camera_httpd, &reconnect_uri);
+    register_route(camera_httpd, &startap_uri);
+    register_route(camera_httpd, &metrics_uri);
   }
 
   config.server_port += 1;
   config.ctrl_port += 1;
-  log_i("Starting stream server on port: '%d'", config.server_port);
+  ALOGI(ALOG_HTTP, "Starting stream server on port: '%d'", config.server_port);
   if (httpd_start(&stream_httpd, &config) == ESP_OK) {
-    httpd_register_uri_handler(stream_httpd, &stream_uri);
+    register_route(stream_httpd, &stream_uri);
   }
 }
-
-void setupLedFlash() {
-#if defined(LED_GPIO_NUM)
-  ledcAttach(LED_GPIO_NUM, 5000, 8);
-#else
-  log_i("LED flash is disabled -> LED_GPIO_NUM undefined");
-#endif
-}
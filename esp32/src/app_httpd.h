@@ -2,6 +2,5 @@
 #define APP_HTTPD_H
 
 void startCameraServer();
-void setupLedFlash();
 
 #endif  // APP_HTTPD_H
@@ -0,0 +1,328 @@
+#include "async_log.h"
+#include <atomic>
+#include <stdarg.h>
+
+static const char *const module_names[ALOG_MODULE_COUNT] = {
+  "uploader", "capture", "queue", "conn", "http", "stream", "camera",
+};
+static const char *const level_names[] = {"none", "error", "warn", "info", "debug", "verbose"};
+static const char level_chars[] = "-EWIDV";
+
+volatile uint8_t alog_levels[ALOG_MODULE_COUNT] = {
+  ALOG_DEFAULT_LEVEL, ALOG_DEFAULT_LEVEL, ALOG_DEFAULT_LEVEL, ALOG_DEFAULT_LEVEL,
+  ALOG_DEFAULT_LEVEL, ALOG_DEFAULT_LEVEL, ALOG_DEFAULT_LEVEL,
+};
+
+typedef struct {
+  // Ring position minus slot index: equal to (position - index) when free for the
+  // producer at that position, one more once filled. Zero-initialised = all free.
+  std::atomic<uint32_t> seq;
+  uint32_t ms;
+  const char *fmt;
+  uint8_t module;
+  uint8_t level;
+  uint32_t words[ALOG_MAX_ARGS_WORDS];
+  char str[ALOG_STR_BYTES];
+} alog_slot_t;
+
+// Bounded multi-producer ring (one sequence number per slot); the writer task is
+// the only consumer
+static alog_slot_t slots[ALOG_RING_SLOTS];
+static std::atomic<uint32_t> enqueue_pos(0);
+static uint32_t dequeue_pos = 0;
+
+static std::atomic<uint32_t> written(0);
+static std::atomic<uint32_t> dropped(0);
+static std::atomic<uint32_t> truncated(0);
+static TaskHandle_t writer_task = NULL;
+
+// ---- Format parsing, shared by the producer (capture) and the writer (render) ----
+
+typedef enum {
+  ARG_NONE = 0,  // literal %%
+  ARG_INT,       // int and smaller
+  ARG_LONG,
+  ARG_LLONG,
+  ARG_SIZE,
+  ARG_DOUBLE,
+  ARG_STR,
+  ARG_PTR,
+  ARG_BAD,       // unsupported: rest of the format is printed as is
+} arg_kind_t;
+
+typedef struct {
+  const char *start;  // '%'
+  size_t len;
+  arg_kind_t kind;
+} spec_t;
+
+// Parse the conversion starting at `p` (pointing at '%')
+static void parse_spec(const char *p, spec_t *s) {
+  s->start = p;
+  const char *q = p + 1;
+  if (*q == '%') {
+    s->len = 2;
+    s->kind = ARG_NONE;
+    return;
+  }
+  while (*q && strchr("-+ #0", *q)) q++;
+  while (*q >= '0' && *q <= '9') q++;
+  if (*q == '.') {
+    q++;
+    while (*q >= '0' && *q <= '9') q++;
+  }
+  arg_kind_t len_kind = ARG_INT;
+  if (*q == 'h') {
+    q++;
+    if (*q == 'h') q++;
+  } else if (*q == 'l') {
+    q++;
+    len_kind = ARG_LONG;
+    if (*q == 'l') {
+      q++;
+      len_kind = ARG_LLONG;
+    }
+  } else if (*q == 'j') {
+    q++;
+    len_kind = ARG_LLONG;
+  } else if (*q == 'z' || *q == 't') {
+    q++;
+    len_kind = ARG_SIZE;
+  }
+  char c = *q;
+  s->kind = ARG_BAD;
+  if (c && strchr("diuxXoc", c)) s->kind = len_kind;
+  else if (c && strchr("feEgGaAF", c)) s->kind = ARG_DOUBLE;
+  else if (c == 's') s->kind = ARG_STR;
+  else if (c == 'p') s->kind = ARG_PTR;
+  s->len = (s->kind == ARG_BAD) ? 1 : (size_t)(q + 1 - p);
+}
+
+static size_t kind_words(arg_kind_t kind) {
+  switch (kind) {
+    case ARG_INT: return 1;
+    case ARG_LONG: return (sizeof(long) + 3) / 4;
+    case ARG_LLONG: return 2;
+    case ARG_SIZE: return (sizeof(size_t) + 3) / 4;
+    case ARG_DOUBLE: return 2;
+    case ARG_PTR: return (sizeof(void *) + 3) / 4;
+    default: return 0;
+  }
+}
+
+// ---- Producer ----
+
+static void capture_args(alog_slot_t *slot, const char *fmt, va_list ap) {
+  size_t w = 0, sp = 0;
+  for (const char *p = fmt; *p; p++) {
+    if (*p != '%') continue;
+    spec_t s;
+    parse_spec(p, &s);
+    p += s.len - 1;
+    if (s.kind == ARG_NONE) continue;
+    if (s.kind == ARG_BAD) break;
+    if (s.kind == ARG_STR) {
+      const char *v = va_arg(ap, const char *);
+      if (!v) v = "(null)";
+      size_t room = sizeof(slot->str) - sp;
+      size_t n = strnlen(v, room ? room - 1 : 0);
+      if (room == 0 || v[n]) truncated.fetch_add(1, std::memory_order_relaxed);
+      if (room) {
+        memcpy(slot->str + sp, v, n);
+        slot->str[sp + n] = 0;
+        sp += n + 1;
+      }
+      continue;
+    }
+    size_t n = kind_words(s.kind);
+    if (w + n > ALOG_MAX_ARGS_WORDS) {
+      truncated.fetch_add(1, std::memory_order_relaxed);
+      break;
+    }
+    switch (s.kind) {
+      case ARG_INT: { unsigned v = va_arg(ap, unsigned); memcpy(&slot->words[w], &v, sizeof(v)); break; }
+      case ARG_LONG: { unsigned long v = va_arg(ap, unsigned long); memcpy(&slot->words[w], &v, sizeof(v)); break; }
+      case ARG_LLONG: { unsigned long long v = va_arg(ap, unsigned long long); memcpy(&slot->words[w], &v, sizeof(v)); break; }
+      case ARG_SIZE: { size_t v = va_arg(ap, size_t); memcpy(&slot->words[w], &v, sizeof(v)); break; }
+      case ARG_DOUBLE: { double v = va_arg(ap, double); memcpy(&slot->words[w], &v, sizeof(v)); break; }
+      case ARG_PTR: { void *v = va_arg(ap, void *); memcpy(&slot->words[w], &v, sizeof(v)); break; }
+      default: break;
+    }
+    w += n;
+  }
+}
+
+static inline uint32_t slot_seq(uint32_t idx) {
+  return slots[idx].seq.load(std::memory_order_acquire) + idx;
+}
+
+static inline void set_slot_seq(uint32_t idx, uint32_t seq) {
+  slots[idx].seq.store(seq - idx, std::memory_order_release);
+}
+
+void alog_write(alog_module_t module, alog_level_t level, const char *fmt, ...) {
+  uint32_t pos = enqueue_pos.load(std::memory_order_relaxed);
+  uint32_t idx;
+  while (true) {
+    idx = pos & (ALOG_RING_SLOTS - 1);
+    int32_t diff = (int32_t)(slot_seq(idx) - pos);
+    if (diff == 0) {
+      if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+    } else if (diff < 0) {
+      // The writer has not freed this slot yet: ring full
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+
+  alog_slot_t *slot = &slots[idx];
+  slot->ms = millis();
+  slot->fmt = fmt;
+  slot->module = module;
+  slot->level = level;
+  va_list ap;
+  va_start(ap, fmt);
+  capture_args(slot, fmt, ap);
+  va_end(ap);
+  set_slot_seq(idx, pos + 1);
+}
+
+// ---- Writer ----
+
+// Render one conversion with its captured argument
+static int render_arg(char *out, size_t room, const spec_t *s, const alog_slot_t *slot, size_t *w, size_t *sp) {
+  char spec[24];
+  size_t len = s->len < sizeof(spec) ? s->len : sizeof(spec) - 1;
+  memcpy(spec, s->start, len);
+  spec[len] = 0;
+  const uint32_t *src = &slot->words[*w];
+  *w += kind_words(s->kind);
+  switch (s->kind) {
+    case ARG_INT: { unsigned v; memcpy(&v, src, sizeof(v)); return snprintf(out, room, spec, v); }
+    case ARG_LONG: { unsigned long v; memcpy(&v, src, sizeof(v)); return snprintf(out, room, spec, v); }
+    case ARG_LLONG: { unsigned long long v; memcpy(&v, src, sizeof(v)); return snprintf(out, room, spec, v); }
+    case ARG_SIZE: { size_t v; memcpy(&v, src, sizeof(v)); return snprintf(out, room, spec, v); }
+    case ARG_DOUBLE: { double v; memcpy(&v, src, sizeof(v)); return snprintf(out, room, spec, v); }
+    case ARG_PTR: { void *v; memcpy(&v, src, sizeof(v)); return snprintf(out, room, spec, v); }
+    case ARG_STR: {
+      const char *v = (*sp < sizeof(slot->str)) ? slot->str + *sp : "";
+      *sp += strlen(v) + 1;
+      return snprintf(out, room, spec, v);
+    }
+    default: return 0;
+  }
+}
+
+static size_t render(const alog_slot_t *slot, char *line, size_t cap) {
+  size_t n = snprintf(line, cap, "[%lu][%c] ", (unsigned long)slot->ms, level_chars[slot->level]);
+  size_t w = 0, sp = 0;
+  const char *p = slot->fmt;
+  while (*p && n < cap - 1) {
+    if (*p != '%') {
+      line[n++] = *p++;
+      continue;
+    }
+    spec_t s;
+    parse_spec(p, &s);
+    if (s.kind == ARG_BAD || (s.kind != ARG_NONE && s.kind != ARG_STR && w + kind_words(s.kind) > ALOG_MAX_ARGS_WORDS)) {
+      // Nothing was captured from here on: print the rest of the format as is
+      while (*p && n < cap - 1) line[n++] = *p++;
+      break;
+    }
+    p += s.len;
+    if (s.kind == ARG_NONE) {
+      line[n++] = '%';
+      continue;
+    }
+    int r = render_arg(line + n, cap - n, &s, slot, &w, &sp);
+    if (r > 0) n += ((size_t)r < cap - n) ? (size_t)r : cap - n - 1;
+  }
+  if (n > cap - 2) n = cap - 2;
+  line[n++] = '\n';
+  line[n] = 0;
+  return n;
+}
+
+static void writerTask(void *pvParameters) {
+  (void) pvParameters;
+  static char line[ALOG_LINE_BYTES];
+  uint32_t reported_drops = 0;
+  while (true) {
+    uint32_t idx = dequeue_pos & (ALOG_RING_SLOTS - 1);
+    if ((int32_t)(slot_seq(idx) - (dequeue_pos + 1)) < 0) {
+      uint32_t d = dropped.load(std::memory_order_relaxed);
+      if (d != reported_drops) {
+        Serial.printf("[log] %u record(s) dropped (ring full)\n", (unsigned)(d - reported_drops));
+        reported_drops = d;
+      }
+      vTaskDelay(pdMS_TO_TICKS(ALOG_IDLE_POLL_MS));
+      continue;
+    }
+    size_t n = render(&slots[idx], line, sizeof(line));
+    set_slot_seq(idx, dequeue_pos + ALOG_RING_SLOTS);
+    dequeue_pos++;
+    written.fetch_add(1, std::memory_order_relaxed);
+    Serial.write((const uint8_t *)line, n);
+  }
+}
+
+void alog_begin() {
+  if (writer_task) return;
+  // Lowest useful priority: console output only uses time nothing else wants
+  xTaskCreatePinnedToCore(writerTask, "alog", 4 * 1024, NULL, tskIDLE_PRIORITY + 1, &writer_task, 0);
+}
+
+// ---- Runtime levels ----
+
+static int find_name(const char *const *names, int count, const char *name) {
+  for (int i = 0; i < count; i++) {
+    if (strcmp(names[i], name) == 0) return i;
+  }
+  return -1;
+}
+
+bool alog_set_level(const char *module, const char *level) {
+  int m = find_name(module_names, ALOG_MODULE_COUNT, module);
+  int l = find_name(level_names, sizeof(level_names) / sizeof(level_names[0]), level);
+  if (m < 0 || l < 0) return false;
+  alog_levels[m] = (uint8_t)l;
+  return true;
+}
+
+int alog_apply_json(const cJSON *obj, char *err, size_t err_len) {
+  // Validate everything first so a bad entry changes nothing
+  const cJSON *it;
+  cJSON_ArrayForEach(it, obj) {
+    if (find_name(module_names, ALOG_MODULE_COUNT, it->string) < 0) {
+      snprintf(err, err_len, "unknown module '%s'", it->string);
+      return -1;
+    }
+    if (!cJSON_IsString(it) || find_name(level_names, sizeof(level_names) / sizeof(level_names[0]), it->valuestring) < 0) {
+      snprintf(err, err_len, "%s: level must be none, error, warn, info, debug or verbose", it->string);
+      return -1;
+    }
+  }
+  int changed = 0;
+  cJSON_ArrayForEach(it, obj) {
+    int m = find_name(module_names, ALOG_MODULE_COUNT, it->string);
+    uint8_t before = alog_levels[m];
+    alog_set_level(it->string, it->valuestring);
+    if (alog_levels[m] != before) changed++;
+  }
+  return changed;
+}
+
+void alog_to_json(cJSON *obj) {
+  cJSON *levels = cJSON_AddObjectToObject(obj, "levels");
+  for (int i = 0; i < ALOG_MODULE_COUNT; i++) {
+    cJSON_AddStringToObject(levels, module_names[i], level_names[alog_levels[i]]);
+  }
+  uint32_t head = enqueue_pos.load(std::memory_order_relaxed);
+  cJSON_AddNumberToObject(obj, "written", written.load(std::memory_order_relaxed));
+  cJSON_AddNumberToObject(obj, "dropped", dropped.load(std::memory_order_relaxed));
+  cJSON_AddNumberToObject(obj, "truncated", truncated.load(std::memory_order_relaxed));
+  cJSON_AddNumberToObject(obj, "pending", head - dequeue_pos);
+  cJSON_AddNumberToObject(obj, "slots", ALOG_RING_SLOTS);
+}
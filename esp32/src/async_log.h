@@ -0,0 +1,66 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <Arduino.h>
+#include "cJSON.h"
+
+// Deferred logging for hot paths. A log call checks the module's runtime level,
+// then stores the format-string pointer and the raw arguments in a fixed-size
+// record of a lock-free ring (strings passed for %s are copied, truncated to the
+// record's string space). A low-priority task formats records and writes them to
+// Serial, so callers never wait on the console. When the ring is full the record
+// is dropped and counted.
+//
+// The format must be a string literal (only its pointer is kept). Supported
+// conversions: d i u x X o c (with hh h l ll z j t), f e g a, s, p. No '*' width.
+// A trailing newline is added by the writer.
+
+#define ALOG_RING_SLOTS 64      // power of two
+#define ALOG_MAX_ARGS_WORDS 12  // 32-bit words of arguments per record (64-bit values take two)
+#define ALOG_STR_BYTES 80       // bytes for copied %s arguments per record
+#define ALOG_LINE_BYTES 256
+#define ALOG_IDLE_POLL_MS 20    // writer sleep when the ring is empty
+#define ALOG_DEFAULT_LEVEL ALOG_INFO
+
+typedef enum {
+  ALOG_NONE = 0,
+  ALOG_ERROR,
+  ALOG_WARN,
+  ALOG_INFO,
+  ALOG_DEBUG,     // request bodies, gateway responses, per-frame detail
+  ALOG_VERBOSE,
+} alog_level_t;
+
+typedef enum {
+  ALOG_UPLOADER = 0,
+  ALOG_CAPTURE,
+  ALOG_QUEUE,
+  ALOG_CONN,
+  ALOG_HTTP,
+  ALOG_STREAM,
+  ALOG_CAMERA,
+  ALOG_MODULE_COUNT,
+} alog_module_t;
+
+extern volatile uint8_t alog_levels[ALOG_MODULE_COUNT];
+
+#define ALOG(mod, lvl, fmt, ...) do { \
+    if (alog_levels[mod] >= (lvl)) alog_write((mod), (lvl), fmt, ##__VA_ARGS__); \
+  } while (0)
+#define ALOGE(mod, fmt, ...) ALOG(mod, ALOG_ERROR, fmt, ##__VA_ARGS__)
+#define ALOGW(mod, fmt, ...) ALOG(mod, ALOG_WARN, fmt, ##__VA_ARGS__)
+#define ALOGI(mod, fmt, ...) ALOG(mod, ALOG_INFO, fmt, ##__VA_ARGS__)
+#define ALOGD(mod, fmt, ...) ALOG(mod, ALOG_DEBUG, fmt, ##__VA_ARGS__)
+
+// Start the writer task. Records logged before this are kept until it runs.
+void alog_begin();
+void alog_write(alog_module_t module, alog_level_t level, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+// Runtime levels, by module and level name ("uploader", "debug"). Returns false for unknown names.
+bool alog_set_level(const char *module, const char *level);
+// Apply {"<module>": "<level>", ...}; returns the number of modules changed, or -1 with `err` set
+int alog_apply_json(const cJSON *obj, char *err, size_t err_len);
+// Levels and counters (written, dropped, truncated)
+void alog_to_json(cJSON *obj);
+
+#endif // ASYNC_LOG_H
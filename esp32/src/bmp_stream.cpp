@@ -0,0 +1,112 @@
+#include "bmp_stream.h"
+#include "esp_heap_caps.h"
+#include "esp_jpg_decode.h"
+#include "img_converters.h"
+
+typedef struct {
+  const camera_fb_t *fb;
+  bmp_stream_out_cb out;
+  void *arg;
+  uint8_t *strip;
+  size_t stride;      // bytes per output row
+  bool mismatch;      // decoded size differs from the header
+} strip_ctx_t;
+
+static void put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  put_u16(p, v & 0xffff);
+  put_u16(p + 2, v >> 16);
+}
+
+size_t bmp_stream_size(const camera_fb_t *fb) {
+  return BMP_STREAM_HEADER_LEN + (size_t)fb->width * fb->height * 3;
+}
+
+// Same header frame2bmp() writes: no palette, negative height (rows top-down)
+static void bmp_header(const camera_fb_t *fb, uint8_t *h) {
+  memset(h, 0, BMP_STREAM_HEADER_LEN);
+  h[0] = 'B';
+  h[1] = 'M';
+  put_u32(h + 2, bmp_stream_size(fb));
+  put_u32(h + 10, BMP_STREAM_HEADER_LEN);  // pixel array offset
+  put_u32(h + 14, 40);                     // BITMAPINFOHEADER
+  put_u32(h + 18, fb->width);
+  put_u32(h + 22, (uint32_t)(-(int32_t)fb->height));
+  put_u16(h + 26, 1);                      // planes
+  put_u16(h + 28, 24);                     // bits per pixel
+  put_u32(h + 34, (uint32_t)fb->width * fb->height * 3);
+  put_u32(h + 38, 0x0B13);                 // 72 dpi
+  put_u32(h + 42, 0x0B13);
+}
+
+static size_t strip_read(void *arg, size_t index, uint8_t *buf, size_t len) {
+  const camera_fb_t *fb = ((strip_ctx_t *)arg)->fb;
+  if (index >= fb->len) return 0;
+  if (index + len > fb->len) len = fb->len - index;
+  if (buf) memcpy(buf, fb->buf + index, len);
+  return len;
+}
+
+// Blocks of one MCU row share y and h and arrive left to right, so only x
+// matters; the row is sent once its last block is in
+static bool strip_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+  strip_ctx_t *c = (strip_ctx_t *)arg;
+  if (!data) {
+    if (x == 0 && y == 0 && (w != c->fb->width || h != c->fb->height)) {
+      c->mismatch = true;
+      return false;
+    }
+    return true;
+  }
+  if (h > BMP_STREAM_STRIP_ROWS) return false;
+
+  // Decoder blocks are RGB; BMP wants BGR
+  for (uint16_t iy = 0; iy < h; iy++) {
+    uint8_t *o = c->strip + iy * c->stride + (size_t)x * 3;
+    for (uint16_t ix = 0; ix < w; ix++) {
+      o[0] = data[2];
+      o[1] = data[1];
+      o[2] = data[0];
+      o += 3;
+      data += 3;
+    }
+  }
+  if (x + w < c->fb->width) return true;
+  return c->out(c->arg, c->strip, h * c->stride);
+}
+
+// Uncompressed formats are row-major, so fmt2rgb888() converts any run of whole rows
+static bool raw_strips(strip_ctx_t *c) {
+  const camera_fb_t *fb = c->fb;
+  size_t in_row = fb->len / fb->height;
+  for (size_t y = 0; y < fb->height; y += BMP_STREAM_STRIP_ROWS) {
+    size_t rows = fb->height - y < BMP_STREAM_STRIP_ROWS ? fb->height - y : BMP_STREAM_STRIP_ROWS;
+    if (!fmt2rgb888(fb->buf + y * in_row, rows * in_row, fb->format, c->strip)) return false;
+    if (!c->out(c->arg, c->strip, rows * c->stride)) return false;
+  }
+  return true;
+}
+
+bool bmp_stream_encode(const camera_fb_t *fb, bmp_stream_out_cb out, void *arg) {
+  if (!fb->width || !fb->height) return false;
+  strip_ctx_t c = {fb, out, arg, NULL, (size_t)fb->width * 3, false};
+  size_t strip_len = c.stride * BMP_STREAM_STRIP_ROWS;
+  c.strip = (uint8_t *)heap_caps_malloc(strip_len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (!c.strip) c.strip = (uint8_t *)heap_caps_malloc(strip_len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!c.strip) return false;
+
+  uint8_t header[BMP_STREAM_HEADER_LEN];
+  bmp_header(fb, header);
+  bool ok = out(arg, header, sizeof(header));
+  if (ok && fb->format == PIXFORMAT_JPEG) {
+    ok = esp_jpg_decode(fb->len, JPG_SCALE_NONE, strip_read, strip_write, &c) == ESP_OK;
+  } else if (ok) {
+    ok = raw_strips(&c);
+  }
+  free(c.strip);
+  return ok && !c.mismatch;
+}
@@ -0,0 +1,29 @@
+#ifndef BMP_STREAM_H
+#define BMP_STREAM_H
+
+#include <Arduino.h>
+#include "esp_camera.h"
+
+// Streaming BMP encoder for /bmp. frame2bmp() builds the whole 24-bit BMP in one
+// allocation (5.7 MB at UXGA). This produces the same bytes (54-byte header,
+// then top-down BGR rows) in strips through a callback: a JPEG is decoded one
+// MCU row (8 or 16 lines) at a time, other formats are converted
+// BMP_STREAM_STRIP_ROWS rows at a time. The only buffer is one strip of
+// width * 16 * 3 bytes (77 KB at UXGA, 38 KB at SVGA), plus the decoder's own.
+
+#define BMP_STREAM_HEADER_LEN 54
+// Tallest strip: a JPEG MCU row with 4:2:0 subsampling
+#define BMP_STREAM_STRIP_ROWS 16
+
+// Receives the header and then each strip in order; returning false aborts the encode
+typedef bool (*bmp_stream_out_cb)(void *arg, const uint8_t *data, size_t len);
+
+// Total BMP size for a frame, as in the header
+size_t bmp_stream_size(const camera_fb_t *fb);
+
+// Encode `fb` through `out`. Returns false if a buffer could not be allocated,
+// the frame did not decode, or `out` aborted; `out` may already have been
+// called by then.
+bool bmp_stream_encode(const camera_fb_t *fb, bmp_stream_out_cb out, void *arg);
+
+#endif // BMP_STREAM_H
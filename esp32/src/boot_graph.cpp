@@ -0,0 +1,124 @@
+#include "boot_graph.h"
+#include "esp_timer.h"
+#include "freertos/event_groups.h"
+
+typedef struct {
+  const boot_stage_def_t *def;
+  boot_status_t status;
+  int64_t start_us;
+  int64_t end_us;
+} boot_entry_t;
+
+static boot_entry_t entries[BOOT_STAGE_COUNT];
+static EventGroupHandle_t done_bits = NULL;
+static int64_t run_us = 0;  // boot_run() called
+static portMUX_TYPE boot_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *status_name(boot_status_t st) {
+  switch (st) {
+    case BOOT_RUNNING: return "running";
+    case BOOT_DONE: return "done";
+    case BOOT_FAILED: return "failed";
+    case BOOT_SKIPPED: return "skipped";
+    default: return "pending";
+  }
+}
+
+static void set_status(boot_entry_t *e, boot_status_t st, int64_t now) {
+  portENTER_CRITICAL(&boot_mux);
+  if (st == BOOT_RUNNING) e->start_us = now;
+  else e->end_us = now;
+  e->status = st;
+  portEXIT_CRITICAL(&boot_mux);
+}
+
+static void stageTask(void *pvParameters) {
+  boot_entry_t *e = (boot_entry_t *)pvParameters;
+  const boot_stage_def_t *d = e->def;
+  uint32_t wait = d->requires | d->after;
+  if (wait) xEventGroupWaitBits(done_bits, wait, pdFALSE, pdTRUE, portMAX_DELAY);
+
+  bool ready = true;
+  for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+    if ((d->requires & BOOT_BIT(i)) && entries[i].status != BOOT_DONE) ready = false;
+  }
+
+  int64_t now = esp_timer_get_time();
+  if (!ready) {
+    e->start_us = now;
+    set_status(e, BOOT_SKIPPED, now);
+    Serial.printf("[boot] %s skipped (a required stage did not complete)\n", d->name);
+  } else {
+    set_status(e, BOOT_RUNNING, now);
+    boot_status_t st = d->fn();
+    now = esp_timer_get_time();
+    set_status(e, st, now);
+    Serial.printf("[boot] %s %s at %u ms (took %u ms)\n", d->name, status_name(st), (unsigned)(now / 1000), (unsigned)((now - e->start_us) / 1000));
+  }
+  xEventGroupSetBits(done_bits, BOOT_BIT(d->id));
+  vTaskDelete(NULL);
+}
+
+void boot_run(const boot_stage_def_t *defs, size_t count) {
+  if (done_bits) return;
+  done_bits = xEventGroupCreate();
+  run_us = esp_timer_get_time();
+  for (size_t i = 0; i < count; i++) {
+    entries[defs[i].id].def = &defs[i];
+  }
+  for (size_t i = 0; i < count; i++) {
+    boot_entry_t *e = &entries[defs[i].id];
+    if (!defs[i].fn) continue;
+    xTaskCreatePinnedToCore(stageTask, defs[i].name, defs[i].stack, e, 2, NULL, defs[i].core);
+  }
+}
+
+void boot_mark(boot_stage_t stage) {
+  boot_entry_t *e = &entries[stage];
+  if (e->status != BOOT_PENDING) return;
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&boot_mux);
+  e->start_us = e->end_us = now;
+  e->status = BOOT_DONE;
+  portEXIT_CRITICAL(&boot_mux);
+  if (done_bits) xEventGroupSetBits(done_bits, BOOT_BIT(stage));
+  Serial.printf("[boot] %s at %u ms\n", e->def ? e->def->name : "milestone", (unsigned)(now / 1000));
+}
+
+boot_status_t boot_status(boot_stage_t stage) {
+  return entries[stage].status;
+}
+
+void boot_to_json(cJSON *obj) {
+  boot_entry_t snap[BOOT_STAGE_COUNT];
+  portENTER_CRITICAL(&boot_mux);
+  memcpy(snap, entries, sizeof(snap));
+  portEXIT_CRITICAL(&boot_mux);
+
+  // All times are microseconds since power-on (esp_timer)
+  cJSON_AddNumberToObject(obj, "now_us", (double)esp_timer_get_time());
+  cJSON_AddNumberToObject(obj, "setup_us", (double)run_us);
+  int64_t ready_us = 0;
+  cJSON *stages = cJSON_AddArrayToObject(obj, "stages");
+  for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+    const boot_entry_t *e = &snap[i];
+    if (!e->def) continue;
+    cJSON *s = cJSON_CreateObject();
+    cJSON_AddStringToObject(s, "name", e->def->name);
+    cJSON_AddStringToObject(s, "status", status_name(e->status));
+    cJSON *deps = cJSON_AddArrayToObject(s, "requires");
+    for (int j = 0; j < BOOT_STAGE_COUNT; j++) {
+      if ((e->def->requires & BOOT_BIT(j)) && snap[j].def) cJSON_AddItemToArray(deps, cJSON_CreateString(snap[j].def->name));
+    }
+    if (e->status != BOOT_PENDING) cJSON_AddNumberToObject(s, "start_us", (double)e->start_us);
+    if (e->status >= BOOT_DONE) {
+      cJSON_AddNumberToObject(s, "end_us", (double)e->end_us);
+      cJSON_AddNumberToObject(s, "duration_us", (double)(e->end_us - e->start_us));
+      if (e->def->fn && e->end_us > ready_us) ready_us = e->end_us;
+    }
+    cJSON_AddItemToArray(stages, s);
+  }
+  // Last init stage to finish, and the time-to-first-upload milestone
+  if (ready_us) cJSON_AddNumberToObject(obj, "ready_us", (double)ready_us);
+  if (snap[BOOT_FIRST_UPLOAD].status == BOOT_DONE) cJSON_AddNumberToObject(obj, "first_upload_us", (double)snap[BOOT_FIRST_UPLOAD].end_us);
+}
@@ -0,0 +1,53 @@
+#ifndef BOOT_GRAPH_H
+#define BOOT_GRAPH_H
+
+#include <Arduino.h>
+#include "cJSON.h"
+
+// Boot as a dependency graph. Every stage runs in its own short-lived task as soon
+// as the stages it waits for have finished, so independent work (camera init, Wi-Fi
+// association, flash mount) overlaps. Each stage is timestamped with
+// esp_timer_get_time(); milestones reached later (first upload) are marked into
+// the same timeline, which GET /boot reports.
+
+typedef enum {
+  BOOT_SETTINGS = 0,   // NVS settings loaded into RAM
+  BOOT_CAMERA,
+  BOOT_RADIO,          // Wi-Fi driver and network stack up (station mode)
+  BOOT_STORAGE,        // persistent upload queue mounted
+  BOOT_WIFI,           // station joined (or given up)
+  BOOT_HTTP,           // control and stream servers listening
+  BOOT_SOFTAP,
+  BOOT_UPLOADER,       // capture/upload tasks started
+  BOOT_FIRST_UPLOAD,   // milestone: first frame accepted by the gateway
+  BOOT_STAGE_COUNT,
+} boot_stage_t;
+
+#define BOOT_BIT(stage) (1u << (stage))
+
+typedef enum {
+  BOOT_PENDING = 0,
+  BOOT_RUNNING,
+  BOOT_DONE,
+  BOOT_FAILED,
+  BOOT_SKIPPED,  // not needed, or a required stage did not complete
+} boot_status_t;
+
+typedef struct {
+  boot_stage_t id;
+  const char *name;
+  uint32_t requires;   // BOOT_BITs that must end BOOT_DONE, otherwise this stage is skipped
+  uint32_t after;      // BOOT_BITs that only have to finish first
+  boot_status_t (*fn)();  // NULL for milestones marked with boot_mark()
+  uint32_t stack;
+  int core;
+} boot_stage_def_t;
+
+// Start every stage of `defs`; returns at once
+void boot_run(const boot_stage_def_t *defs, size_t count);
+// Record a milestone (first call only)
+void boot_mark(boot_stage_t stage);
+boot_status_t boot_status(boot_stage_t stage);
+void boot_to_json(cJSON *obj);
+
+#endif // BOOT_GRAPH_H
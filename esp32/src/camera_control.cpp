@@ -0,0 +1,249 @@
+#include "camera_control.h"
+#include "board_config.h"
+#include "led_flash.h"
+#include "stream_broadcaster.h"
+
+// Apply stages, lowest first
+enum {
+  STAGE_MODE = 0,  // output window and scaling: rewrites many sensor registers
+  STAGE_ORIENT,
+  STAGE_AUTO,      // enable/disable automatic exposure, gain and white balance
+  STAGE_MANUAL,    // values those loops would otherwise override
+  STAGE_IMAGE,
+  STAGE_LED,
+};
+
+typedef struct {
+  const char *name;
+  int (*set)(sensor_t *s, int value);
+  int (*get)(sensor_t *s);  // current value; only consulted for STAGE_MODE
+  int16_t min;
+  int16_t max;
+  uint8_t stage;
+} camera_control_t;
+
+// One setter/getter pair per control: CTL(name, sensor setter, status field)
+#define CTL(name, setter, field) \
+  static int set_##name(sensor_t *s, int v) { return s->setter(s, v); } \
+  static int get_##name(sensor_t *s) { return s->status.field; }
+
+static int set_framesize(sensor_t *s, int v) { return s->set_framesize(s, (framesize_t)v); }
+static int get_framesize(sensor_t *s) { return s->status.framesize; }
+static int set_gainceiling(sensor_t *s, int v) { return s->set_gainceiling(s, (gainceiling_t)v); }
+static int get_gainceiling(sensor_t *s) { return s->status.gainceiling; }
+CTL(dcw, set_dcw, dcw)
+CTL(hmirror, set_hmirror, hmirror)
+CTL(vflip, set_vflip, vflip)
+CTL(awb, set_whitebal, awb)
+CTL(agc, set_gain_ctrl, agc)
+CTL(aec, set_exposure_ctrl, aec)
+CTL(aec2, set_aec2, aec2)
+CTL(awb_gain, set_awb_gain, awb_gain)
+CTL(wb_mode, set_wb_mode, wb_mode)
+CTL(agc_gain, set_agc_gain, agc_gain)
+CTL(aec_value, set_aec_value, aec_value)
+CTL(ae_level, set_ae_level, ae_level)
+CTL(quality, set_quality, quality)
+CTL(contrast, set_contrast, contrast)
+CTL(brightness, set_brightness, brightness)
+CTL(saturation, set_saturation, saturation)
+CTL(special_effect, set_special_effect, special_effect)
+CTL(colorbar, set_colorbar, colorbar)
+CTL(bpc, set_bpc, bpc)
+CTL(wpc, set_wpc, wpc)
+CTL(raw_gma, set_raw_gma, raw_gma)
+CTL(lenc, set_lenc, lenc)
+#undef CTL
+
+// Software encoder quality for /stream in non-JPEG pixel formats
+static int set_stream_quality(sensor_t *s, int v) {
+  (void) s;
+  stream_broadcaster_set_quality(v);
+  return 0;
+}
+static int get_stream_quality(sensor_t *s) {
+  (void) s;
+  return stream_broadcaster_quality();
+}
+
+#if defined(LED_GPIO_NUM)
+static int set_led_intensity(sensor_t *s, int v) {
+  (void) s;
+  led_flash_set_intensity(v);
+  return 0;
+}
+static int get_led_intensity(sensor_t *s) {
+  (void) s;
+  return led_flash_intensity();
+}
+#endif
+
+#define ENTRY(name, min, max, stage) {#name, set_##name, get_##name, min, max, stage}
+
+static constexpr camera_control_t controls[] = {
+  ENTRY(framesize, 0, FRAMESIZE_INVALID - 1, STAGE_MODE),
+  ENTRY(dcw, 0, 1, STAGE_MODE),
+  ENTRY(hmirror, 0, 1, STAGE_ORIENT),
+  ENTRY(vflip, 0, 1, STAGE_ORIENT),
+  ENTRY(awb, 0, 1, STAGE_AUTO),
+  ENTRY(agc, 0, 1, STAGE_AUTO),
+  ENTRY(aec, 0, 1, STAGE_AUTO),
+  ENTRY(aec2, 0, 1, STAGE_AUTO),
+  ENTRY(awb_gain, 0, 1, STAGE_MANUAL),
+  ENTRY(wb_mode, 0, 4, STAGE_MANUAL),
+  ENTRY(agc_gain, 0, 30, STAGE_MANUAL),
+  ENTRY(gainceiling, 0, 6, STAGE_MANUAL),
+  ENTRY(aec_value, 0, 1200, STAGE_MANUAL),
+  ENTRY(ae_level, -2, 2, STAGE_MANUAL),
+  ENTRY(quality, 0, 63, STAGE_IMAGE),
+  ENTRY(contrast, -2, 2, STAGE_IMAGE),
+  ENTRY(brightness, -2, 2, STAGE_IMAGE),
+  ENTRY(saturation, -2, 2, STAGE_IMAGE),
+  ENTRY(special_effect, 0, 6, STAGE_IMAGE),
+  ENTRY(colorbar, 0, 1, STAGE_IMAGE),
+  ENTRY(bpc, 0, 1, STAGE_IMAGE),
+  ENTRY(wpc, 0, 1, STAGE_IMAGE),
+  ENTRY(raw_gma, 0, 1, STAGE_IMAGE),
+  ENTRY(lenc, 0, 1, STAGE_IMAGE),
+  ENTRY(stream_quality, 1, 100, STAGE_IMAGE),
+#if defined(LED_GPIO_NUM)
+  ENTRY(led_intensity, 0, 255, STAGE_LED),
+#endif
+};
+#undef ENTRY
+
+#define CONTROL_COUNT (sizeof(controls) / sizeof(controls[0]))
+#define HASH_SLOTS 128  // power of two, a few times the number of controls
+
+// ---- Perfect hash (single-return constexpr functions, recursion instead of loops) ----
+
+static constexpr uint32_t fnv1a(const char *p, uint32_t h) {
+  return *p ? fnv1a(p + 1, (h ^ (uint8_t)*p) * 16777619u) : h;
+}
+
+static constexpr uint32_t slot_of(const char *name, uint32_t seed) {
+  return fnv1a(name, 2166136261u ^ seed) & (HASH_SLOTS - 1);
+}
+
+// No control j > i lands in the same slot as control i
+static constexpr bool unique_from(uint32_t seed, size_t i, size_t j) {
+  return j >= CONTROL_COUNT ? true
+    : slot_of(controls[i].name, seed) != slot_of(controls[j].name, seed) && unique_from(seed, i, j + 1);
+}
+
+static constexpr bool collision_free(uint32_t seed, size_t i) {
+  return i >= CONTROL_COUNT ? true : unique_from(seed, i, i + 1) && collision_free(seed, i + 1);
+}
+
+static constexpr uint32_t find_seed(uint32_t seed) {
+  return collision_free(seed, 0) ? seed : find_seed(seed + 1);
+}
+
+static constexpr uint32_t hash_seed = find_seed(0);
+static_assert(collision_free(hash_seed, 0), "camera control names collide");
+
+static constexpr int8_t control_at(uint32_t slot, size_t i) {
+  return i >= CONTROL_COUNT ? -1 : slot_of(controls[i].name, hash_seed) == slot ? (int8_t)i : control_at(slot, i + 1);
+}
+
+// slot -> index into controls[], or -1; filled in at compile time
+#define S1(n) control_at(n, 0)
+#define S8(n) S1(n), S1(n + 1), S1(n + 2), S1(n + 3), S1(n + 4), S1(n + 5), S1(n + 6), S1(n + 7)
+#define S32(n) S8(n), S8(n + 8), S8(n + 16), S8(n + 24)
+static constexpr int8_t slots[HASH_SLOTS] = {S32(0), S32(32), S32(64), S32(96)};
+#undef S32
+#undef S8
+#undef S1
+static_assert(HASH_SLOTS == 128, "slots[] initialiser assumes 128 entries");
+
+static const camera_control_t *find_control(const char *name) {
+  if (!name) return NULL;
+  int8_t i = slots[slot_of(name, hash_seed)];
+  if (i < 0 || strcmp(controls[i].name, name) != 0) return NULL;
+  return &controls[i];
+}
+
+// ---- Apply ----
+
+static camera_control_result_t check(const camera_control_t *c, int value) {
+  if (!c) return CAMERA_CONTROL_UNKNOWN;
+  if (value < c->min || value > c->max) return CAMERA_CONTROL_RANGE;
+  return CAMERA_CONTROL_OK;
+}
+
+static camera_control_result_t apply(sensor_t *s, const camera_control_t *c, int value) {
+  if (c->stage == STAGE_MODE) {
+    // Only JPEG output can change resolution on the fly
+    if (c->set == set_framesize && s->pixformat != PIXFORMAT_JPEG) return CAMERA_CONTROL_UNSUPPORTED;
+    // Switching the mode is the expensive part: skip it when nothing changes
+    if (c->get(s) == value) return CAMERA_CONTROL_UNCHANGED;
+  }
+  return c->set(s, value) < 0 ? CAMERA_CONTROL_FAILED : CAMERA_CONTROL_OK;
+}
+
+camera_control_result_t camera_control_set(sensor_t *s, const char *name, int value) {
+  const camera_control_t *c = find_control(name);
+  camera_control_result_t r = check(c, value);
+  if (r != CAMERA_CONTROL_OK) return r;
+  // framesize outside JPEG keeps the old behaviour of the single-value endpoint: accepted, no-op
+  if (c->set == set_framesize && s->pixformat != PIXFORMAT_JPEG) return CAMERA_CONTROL_OK;
+  return c->set(s, value) < 0 ? CAMERA_CONTROL_FAILED : CAMERA_CONTROL_OK;
+}
+
+int camera_control_apply_json(sensor_t *s, const cJSON *obj, cJSON *results) {
+  typedef struct {
+    const camera_control_t *c;
+    const char *key;
+    int value;
+  } pending_t;
+  pending_t pending[CONTROL_COUNT];
+  size_t count = 0;
+
+  // Resolve and validate every key first; duplicates keep the last value
+  const cJSON *it;
+  cJSON_ArrayForEach(it, obj) {
+    const camera_control_t *c = find_control(it->string);
+    camera_control_result_t r = check(c, it->valueint);
+    if (r == CAMERA_CONTROL_OK && !cJSON_IsNumber(it)) r = CAMERA_CONTROL_NOT_NUMBER;
+    if (r != CAMERA_CONTROL_OK) {
+      cJSON_AddStringToObject(results, it->string, camera_control_result_name(r));
+      continue;
+    }
+    size_t k = 0;
+    while (k < count && pending[k].c != c) k++;
+    if (k == count) count++;
+    pending[k] = {c, it->string, it->valueint};
+  }
+
+  // Stable sort by stage, then table order
+  for (size_t i = 1; i < count; i++) {
+    pending_t p = pending[i];
+    size_t j = i;
+    while (j > 0 && (pending[j - 1].c->stage > p.c->stage || (pending[j - 1].c->stage == p.c->stage && pending[j - 1].c > p.c))) {
+      pending[j] = pending[j - 1];
+      j--;
+    }
+    pending[j] = p;
+  }
+
+  int applied = 0;
+  for (size_t i = 0; i < count; i++) {
+    camera_control_result_t r = apply(s, pending[i].c, pending[i].value);
+    if (r == CAMERA_CONTROL_OK) applied++;
+    cJSON_AddStringToObject(results, pending[i].key, camera_control_result_name(r));
+  }
+  return applied;
+}
+
+const char *camera_control_result_name(camera_control_result_t r) {
+  switch (r) {
+    case CAMERA_CONTROL_OK:          return "ok";
+    case CAMERA_CONTROL_UNCHANGED:   return "unchanged";
+    case CAMERA_CONTROL_UNKNOWN:     return "unknown control";
+    case CAMERA_CONTROL_NOT_NUMBER:  return "value must be a number";
+    case CAMERA_CONTROL_RANGE:       return "value out of range";
+    case CAMERA_CONTROL_UNSUPPORTED: return "not supported in this pixel format";
+    case CAMERA_CONTROL_FAILED:      return "sensor rejected the value";
+  }
+  return "?";
+}
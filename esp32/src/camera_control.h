@@ -0,0 +1,33 @@
+#ifndef CAMERA_CONTROL_H
+#define CAMERA_CONTROL_H
+
+#include <Arduino.h>
+#include "esp_camera.h"
+#include "cJSON.h"
+
+// Camera controls exposed over /control, looked up through a perfect hash whose
+// seed is found at compile time. Each entry carries its setter, accepted range
+// and apply stage; a batch is applied stage by stage so the sensor mode
+// (framesize, downsizing) is switched at most once, before the settings that
+// depend on it, and automatic loops are toggled before their manual values.
+
+typedef enum {
+  CAMERA_CONTROL_OK = 0,
+  CAMERA_CONTROL_UNCHANGED,    // mode control already at that value: skipped
+  CAMERA_CONTROL_UNKNOWN,
+  CAMERA_CONTROL_NOT_NUMBER,
+  CAMERA_CONTROL_RANGE,
+  CAMERA_CONTROL_UNSUPPORTED,  // e.g. framesize while not streaming JPEG
+  CAMERA_CONTROL_FAILED,       // the sensor driver returned an error
+} camera_control_result_t;
+
+// Apply a single control (GET /control?var=&val=)
+camera_control_result_t camera_control_set(sensor_t *s, const char *name, int value);
+
+// Apply every member of `obj` ({"<control>": <number>, ...}) in stage order and
+// add a per-key result to `results`. Returns the number of controls applied.
+int camera_control_apply_json(sensor_t *s, const cJSON *obj, cJSON *results);
+
+const char *camera_control_result_name(camera_control_result_t r);
+
+#endif // CAMERA_CONTROL_H
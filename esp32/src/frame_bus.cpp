@@ -0,0 +1,295 @@
+#include "frame_bus.h"
+#include "frame_clock.h"
+#include "async_log.h"
+#include "esp_timer.h"
+#include "freertos/event_groups.h"
+#include <new>
+
+typedef struct {
+  uint32_t frames;     // frames taken
+  uint32_t cached;     // of which served from the latest frame (frame_bus_latest)
+  uint32_t drops;      // frames replaced in the mailbox before they were taken (subscribed only)
+  uint32_t last_seq;
+  uint32_t wait_avg_us;  // published -> taken (smoothed)
+  uint32_t wait_max_us;
+  uint32_t hold_avg_us;  // taken -> released (smoothed)
+  uint32_t hold_max_us;
+} consumer_stats_t;
+
+static const char *const consumer_names[FRAME_BUS_CONSUMERS] = {"stream", "uploader", "capture"};
+
+static bus_frame_t *mailbox[FRAME_BUS_CONSUMERS];
+static bus_frame_t *latest = NULL;  // newest published frame, one reference
+static uint8_t waiting[FRAME_BUS_CONSUMERS];
+static uint32_t subscribed = 0;  // bit per consumer
+static consumer_stats_t cstats[FRAME_BUS_CONSUMERS];
+static uint32_t published = 0;
+static uint32_t capture_failures = 0;
+static portMUX_TYPE bus_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static std::atomic<int> held(0);  // frames alive (each one owns a driver buffer)
+static int driver_buffers = 1;
+static EventGroupHandle_t bus_events = NULL;  // bit per consumer: mailbox filled
+static TaskHandle_t bus_task = NULL;
+
+static void frame_unref(bus_frame_t *f) {
+  if (f && f->refs.fetch_sub(1) == 1) {
+    esp_camera_fb_return(f->fb);
+    delete f;
+    held--;
+  }
+}
+
+// Smoothed mean over roughly the last 8 samples
+static void add_sample(uint32_t *avg, uint32_t *max, uint32_t v) {
+  *avg = *avg ? *avg - (*avg >> 3) + (v >> 3) : v;
+  if (v > *max) *max = v;
+}
+
+static void bus_task_fn(void *arg) {
+  (void)arg;
+  while (true) {
+    portENTER_CRITICAL(&bus_mux);
+    uint32_t wanted = subscribed;
+    for (int c = 0; c < FRAME_BUS_CONSUMERS; c++) {
+      if (waiting[c]) wanted |= 1u << c;
+    }
+    portEXIT_CRITICAL(&bus_mux);
+    if (!wanted) {
+      // Keep the newest frame around for snapshots for a while, then hand it back
+      if (!ulTaskNotifyTake(pdTRUE, latest ? pdMS_TO_TICKS(FRAME_BUS_LATEST_KEEP_MS) : portMAX_DELAY)) {
+        portENTER_CRITICAL(&bus_mux);
+        bus_frame_t *stale = latest;
+        latest = NULL;
+        portEXIT_CRITICAL(&bus_mux);
+        frame_unref(stale);
+      }
+      continue;
+    }
+
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (!fb) {
+      ALOGE(ALOG_CAMERA, "[bus] camera capture failed");
+      portENTER_CRITICAL(&bus_mux);
+      capture_failures++;
+      portEXIT_CRITICAL(&bus_mux);
+      vTaskDelay(pdMS_TO_TICKS(10));
+      continue;
+    }
+    bus_frame_t *f = new (std::nothrow) bus_frame_t;
+    if (!f) {
+      esp_camera_fb_return(fb);
+      vTaskDelay(pdMS_TO_TICKS(10));
+      continue;
+    }
+    f->fb = fb;
+    f->seq = frame_clock_next_seq();
+    f->published_us = esp_timer_get_time();
+    f->refs = 1;  // the bus's own, kept as `latest` until the next frame
+    held++;
+
+    // Fill the mailbox of everyone who wants frames now; untaken frames are replaced
+    bus_frame_t *replaced[FRAME_BUS_CONSUMERS] = {NULL};
+    EventBits_t bits = 0;
+    portENTER_CRITICAL(&bus_mux);
+    bus_frame_t *previous = latest;
+    latest = f;  // takes over the bus's own reference
+    for (int c = 0; c < FRAME_BUS_CONSUMERS; c++) {
+      bool sub = subscribed & (1u << c);
+      if (!sub && !waiting[c]) continue;
+      replaced[c] = mailbox[c];
+      if (replaced[c] && sub) cstats[c].drops++;
+      f->refs++;
+      mailbox[c] = f;
+      bits |= 1u << c;
+    }
+    published++;
+    portEXIT_CRITICAL(&bus_mux);
+
+    for (int c = 0; c < FRAME_BUS_CONSUMERS; c++) frame_unref(replaced[c]);
+    frame_unref(previous);
+    xEventGroupSetBits(bus_events, bits);
+  }
+}
+
+bool frame_bus_begin(int fb_count) {
+  if (bus_task) return true;
+  driver_buffers = fb_count > 0 ? fb_count : 1;
+  bus_events = xEventGroupCreate();
+  if (!bus_events) return false;
+  return xTaskCreatePinnedToCore(bus_task_fn, "frame_bus", 4 * 1024, NULL, 2, &bus_task, 1) == pdPASS;
+}
+
+void frame_bus_subscribe(frame_bus_consumer_t consumer, bool on) {
+  bus_frame_t *stale = NULL;
+  portENTER_CRITICAL(&bus_mux);
+  if (on) {
+    subscribed |= 1u << consumer;
+  } else {
+    subscribed &= ~(1u << consumer);
+    if (!waiting[consumer]) {
+      stale = mailbox[consumer];
+      mailbox[consumer] = NULL;
+    }
+  }
+  portEXIT_CRITICAL(&bus_mux);
+  frame_unref(stale);
+  if (on && bus_task) xTaskNotifyGive(bus_task);
+}
+
+bool frame_bus_take(frame_bus_consumer_t consumer, int64_t not_before_us, TickType_t wait, frame_ref_t *out) {
+  out->frame = NULL;
+  out->consumer = consumer;
+  if (!bus_task) return false;
+  const EventBits_t bit = 1u << consumer;
+
+  portENTER_CRITICAL(&bus_mux);
+  waiting[consumer]++;
+  portEXIT_CRITICAL(&bus_mux);
+  xTaskNotifyGive(bus_task);
+
+  TickType_t start = xTaskGetTickCount();
+  bus_frame_t *f = NULL;
+  while (true) {
+    xEventGroupClearBits(bus_events, bit);
+    bus_frame_t *old = NULL;
+    portENTER_CRITICAL(&bus_mux);
+    f = mailbox[consumer];
+    mailbox[consumer] = NULL;
+    if (f && frame_capture_us(f->fb) < not_before_us) {
+      old = f;  // exposed before the caller's cut-off: wait for the next one
+      f = NULL;
+    }
+    portEXIT_CRITICAL(&bus_mux);
+    frame_unref(old);
+    if (f) break;
+
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    if (elapsed >= wait) break;
+    xEventGroupWaitBits(bus_events, bit, pdTRUE, pdFALSE, wait - elapsed);
+  }
+
+  int64_t now = esp_timer_get_time();
+  bus_frame_t *leftover = NULL;
+  portENTER_CRITICAL(&bus_mux);
+  waiting[consumer]--;
+  // A frame that arrived after a timeout would otherwise pin a driver buffer until the next call
+  if (!waiting[consumer] && !(subscribed & bit)) {
+    leftover = mailbox[consumer];
+    mailbox[consumer] = NULL;
+  }
+  if (f) {
+    consumer_stats_t *s = &cstats[consumer];
+    s->frames++;
+    s->last_seq = f->seq;
+    add_sample(&s->wait_avg_us, &s->wait_max_us, (uint32_t)(now - f->published_us));
+  }
+  portEXIT_CRITICAL(&bus_mux);
+  frame_unref(leftover);
+
+  if (!f) return false;
+  // The mailbox reference becomes the caller's
+  out->frame = f;
+  out->taken_us = now;
+  return true;
+}
+
+bool frame_bus_latest(frame_bus_consumer_t consumer, int64_t max_age_us, frame_ref_t *out) {
+  out->frame = NULL;
+  out->consumer = consumer;
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&bus_mux);
+  bus_frame_t *f = latest;
+  if (f && now - f->published_us <= max_age_us) {
+    f->refs++;
+    consumer_stats_t *s = &cstats[consumer];
+    s->frames++;
+    s->cached++;
+    s->last_seq = f->seq;
+  } else {
+    f = NULL;
+  }
+  portEXIT_CRITICAL(&bus_mux);
+
+  if (!f) return false;
+  out->frame = f;
+  out->taken_us = now;
+  return true;
+}
+
+void frame_bus_release(frame_ref_t *ref) {
+  if (!ref || !ref->frame) return;
+  uint32_t hold = (uint32_t)(esp_timer_get_time() - ref->taken_us);
+  portENTER_CRITICAL(&bus_mux);
+  consumer_stats_t *s = &cstats[ref->consumer];
+  add_sample(&s->hold_avg_us, &s->hold_max_us, hold);
+  portEXIT_CRITICAL(&bus_mux);
+  frame_unref(ref->frame);
+  ref->frame = NULL;
+}
+
+bool frame_bus_spare() {
+  return held.load() < driver_buffers;
+}
+
+void frame_bus_to_json(cJSON *obj) {
+  consumer_stats_t s[FRAME_BUS_CONSUMERS];
+  portENTER_CRITICAL(&bus_mux);
+  memcpy(s, cstats, sizeof(s));
+  uint32_t sub = subscribed, pub = published, fails = capture_failures;
+  portEXIT_CRITICAL(&bus_mux);
+
+  cJSON_AddNumberToObject(obj, "driver_buffers", driver_buffers);
+  cJSON_AddNumberToObject(obj, "held", held.load());
+  cJSON_AddNumberToObject(obj, "published", pub);
+  cJSON_AddNumberToObject(obj, "capture_failures", fails);
+  cJSON *consumers = cJSON_AddObjectToObject(obj, "consumers");
+  for (int c = 0; c < FRAME_BUS_CONSUMERS; c++) {
+    cJSON *o = cJSON_AddObjectToObject(consumers, consumer_names[c]);
+    cJSON_AddBoolToObject(o, "subscribed", sub & (1u << c));
+    cJSON_AddNumberToObject(o, "frames", s[c].frames);
+    cJSON_AddNumberToObject(o, "cached", s[c].cached);
+    cJSON_AddNumberToObject(o, "drops", s[c].drops);
+    cJSON_AddNumberToObject(o, "last_seq", s[c].last_seq);
+    cJSON_AddNumberToObject(o, "wait_avg_us", s[c].wait_avg_us);
+    cJSON_AddNumberToObject(o, "wait_max_us", s[c].wait_max_us);
+    cJSON_AddNumberToObject(o, "hold_avg_us", s[c].hold_avg_us);
+    cJSON_AddNumberToObject(o, "hold_max_us", s[c].hold_max_us);
+  }
+}
+
+void frame_bus_metrics(metrics_out_t *out) {
+  consumer_stats_t s[FRAME_BUS_CONSUMERS];
+  portENTER_CRITICAL(&bus_mux);
+  memcpy(s, cstats, sizeof(s));
+  uint32_t pub = published, fails = capture_failures;
+  portEXIT_CRITICAL(&bus_mux);
+
+  metrics_family(out, "frame_bus_published_total", "counter", "Frames taken from the camera driver");
+  metrics_printf(out, METRICS_PREFIX "frame_bus_published_total %u\n", (unsigned)pub);
+  metrics_family(out, "frame_bus_capture_failures_total", "counter", "esp_camera_fb_get calls that returned no frame");
+  metrics_printf(out, METRICS_PREFIX "frame_bus_capture_failures_total %u\n", (unsigned)fails);
+  metrics_family(out, "frame_bus_held", "gauge", "Driver buffers currently held by consumers");
+  metrics_printf(out, METRICS_PREFIX "frame_bus_held %d\n", held.load());
+
+  metrics_family(out, "frame_bus_frames_total", "counter", "Frames taken per consumer");
+  for (int c = 0; c < FRAME_BUS_CONSUMERS; c++) {
+    metrics_printf(out, METRICS_PREFIX "frame_bus_frames_total{consumer=\"%s\"} %u\n", consumer_names[c], (unsigned)s[c].frames);
+  }
+  metrics_family(out, "frame_bus_cached_total", "counter", "Frames served from the latest frame without a new acquisition");
+  for (int c = 0; c < FRAME_BUS_CONSUMERS; c++) {
+    metrics_printf(out, METRICS_PREFIX "frame_bus_cached_total{consumer=\"%s\"} %u\n", consumer_names[c], (unsigned)s[c].cached);
+  }
+  metrics_family(out, "frame_bus_dropped_total", "counter", "Frames a subscribed consumer did not take in time");
+  for (int c = 0; c < FRAME_BUS_CONSUMERS; c++) {
+    metrics_printf(out, METRICS_PREFIX "frame_bus_dropped_total{consumer=\"%s\"} %u\n", consumer_names[c], (unsigned)s[c].drops);
+  }
+  metrics_family(out, "frame_bus_wait_seconds", "gauge", "Smoothed time from publish to take");
+  for (int c = 0; c < FRAME_BUS_CONSUMERS; c++) {
+    metrics_printf(out, METRICS_PREFIX "frame_bus_wait_seconds{consumer=\"%s\"} %.6f\n", consumer_names[c], s[c].wait_avg_us / 1e6);
+  }
+  metrics_family(out, "frame_bus_hold_seconds", "gauge", "Smoothed time a consumer holds a frame");
+  for (int c = 0; c < FRAME_BUS_CONSUMERS; c++) {
+    metrics_printf(out, METRICS_PREFIX "frame_bus_hold_seconds{consumer=\"%s\"} %.6f\n", consumer_names[c], s[c].hold_avg_us / 1e6);
+  }
+}
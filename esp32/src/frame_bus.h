@@ -0,0 +1,86 @@
+#ifndef FRAME_BUS_H
+#define FRAME_BUS_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_camera.h"
+#include "cJSON.h"
+#include "metrics.h"
+
+// Single owner of esp_camera_fb_get(). One acquisition task grabs frames while
+// any consumer wants them and hands each consumer a reference to the same
+// camera_fb_t; nothing is copied, and the driver buffer goes back to the camera
+// when the last reference is released. Each consumer has a one-frame mailbox: a
+// frame it has not taken yet is replaced by the next one (and counted as dropped
+// for subscribed consumers), so a slow consumer never queues up driver buffers.
+//
+// Held references keep driver buffers away from the camera: a consumer that
+// holds frames for long (network sends) should copy once frame_bus_spare() is false.
+//
+// The bus also keeps a reference to the newest frame so a snapshot can be served
+// without a new exposure (frame_bus_latest). It follows every publish, so while
+// frames flow it pins nothing extra; once the bus goes idle it is dropped after
+// FRAME_BUS_LATEST_KEEP_MS to give the buffer back.
+
+#define FRAME_BUS_LATEST_KEEP_MS 2000
+
+typedef enum {
+  FRAME_BUS_STREAM = 0,  // /stream broadcaster (subscribed while clients are connected)
+  FRAME_BUS_UPLOADER,    // capture task of the uploader (one frame per interval)
+  FRAME_BUS_CAPTURE,     // /capture and /bmp handlers
+  FRAME_BUS_CONSUMERS,
+} frame_bus_consumer_t;
+
+typedef struct {
+  camera_fb_t *fb;          // read-only
+  uint32_t seq;             // device-wide frame sequence number
+  int64_t published_us;     // esp_timer time the bus got the frame from the driver
+  std::atomic<int> refs;
+} bus_frame_t;
+
+// Capture time the driver stamped on a frame, esp_timer microseconds
+static inline int64_t frame_capture_us(const camera_fb_t *fb) {
+  return (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+}
+
+// A consumer's reference. Each consumer id is used by one task at a time.
+typedef struct {
+  bus_frame_t *frame;       // NULL when empty
+  frame_bus_consumer_t consumer;
+  int64_t taken_us;
+} frame_ref_t;
+
+// `fb_count` is the driver's frame buffer count (camera_config_t.fb_count)
+bool frame_bus_begin(int fb_count);
+
+// Continuous consumers subscribe; one-shot consumers just call frame_bus_take()
+void frame_bus_subscribe(frame_bus_consumer_t consumer, bool on);
+
+// Take the consumer's next frame captured (fb->timestamp) at or after
+// `not_before_us` (esp_timer time, 0 = any new frame), waiting up to `wait` ticks.
+bool frame_bus_take(frame_bus_consumer_t consumer, int64_t not_before_us, TickType_t wait, frame_ref_t *out);
+// Reference the newest published frame if it is at most `max_age_us` old.
+// Never waits and never triggers an acquisition.
+bool frame_bus_latest(frame_bus_consumer_t consumer, int64_t max_age_us, frame_ref_t *out);
+// Drop the reference (no-op on an empty ref); the last one returns the driver buffer
+void frame_bus_release(frame_ref_t *ref);
+
+// True while a driver buffer is left for the camera besides the frames held now
+bool frame_bus_spare();
+
+void frame_bus_to_json(cJSON *obj);
+void frame_bus_metrics(metrics_out_t *out);
+
+// Releases a reference when it goes out of scope, for handlers with several exits
+class frame_bus_guard {
+ public:
+  explicit frame_bus_guard(frame_ref_t *ref) : ref_(ref) {}
+  ~frame_bus_guard() { frame_bus_release(ref_); }
+  frame_bus_guard(const frame_bus_guard &) = delete;
+  frame_bus_guard &operator=(const frame_bus_guard &) = delete;
+
+ private:
+  frame_ref_t *ref_;
+};
+
+#endif // FRAME_BUS_H
@@ -0,0 +1,153 @@
+#include "frame_clock.h"
+#include "async_log.h"
+#include "esp_timer.h"
+#include "esp_sntp.h"
+#include "nvs.h"
+#include <atomic>
+
+static char server_name[64];   // lwIP keeps a pointer to this
+static bool started = false;
+
+// Mapping: wall = mono + base_offset + (mono - base_mono) * drift_ppm / 1e6
+static bool synced = false;
+static int64_t base_mono = 0;
+static int64_t base_offset = 0;
+static float drift_ppm = 0;
+static int64_t last_correction = 0;  // wall time reported by SNTP minus the mapped one
+static uint32_t syncs = 0;
+static portMUX_TYPE clock_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static std::atomic<uint32_t> frame_seq(0);
+static std::atomic<uint32_t> seq_reserved(0);  // numbers below this are covered by the stored mark
+
+#define SEQ_NAMESPACE "frame"
+#define SEQ_KEY "seq_hw"
+
+static int64_t map_locked(int64_t mono_us) {
+  return mono_us + base_offset + (int64_t)((float)(mono_us - base_mono) * drift_ppm / 1e6f);
+}
+
+// Runs on the lwIP task after SNTP set the system time to `tv`
+static void on_sync(struct timeval *tv) {
+  int64_t mono = esp_timer_get_time();
+  int64_t wall = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+
+  portENTER_CRITICAL(&clock_mux);
+  if (synced) {
+    last_correction = wall - map_locked(mono);
+    int64_t dt = mono - base_mono;
+    if (dt > 60 * 1000000LL) {
+      float measured = (float)((wall - mono) - base_offset) * 1e6f / (float)dt;
+      if (measured > -FRAME_CLOCK_MAX_DRIFT_PPM && measured < FRAME_CLOCK_MAX_DRIFT_PPM) {
+        drift_ppm = syncs > 1 ? drift_ppm * 0.5f + measured * 0.5f : measured;
+      }
+    }
+  }
+  base_mono = mono;
+  base_offset = wall - mono;
+  synced = true;
+  syncs++;
+  int64_t correction = last_correction;
+  float drift = drift_ppm;
+  portEXIT_CRITICAL(&clock_mux);
+
+  ALOGI(ALOG_CONN, "[clock] synced via %s, correction %lld us, drift %.1f ppm", server_name, (long long)correction, drift);
+}
+
+void frame_clock_begin(const char *server) {
+  if (!server || !server[0]) server = FRAME_CLOCK_DEFAULT_SERVER;
+  if (started && !strcmp(server, server_name)) return;
+
+  strlcpy(server_name, server, sizeof(server_name));
+  sntp_set_time_sync_notification_cb(on_sync);
+  sntp_set_sync_interval(FRAME_CLOCK_SYNC_INTERVAL_MS);
+  // UTC; restarts SNTP if it was already running
+  configTime(0, 0, server_name);
+  started = true;
+  ALOGI(ALOG_CONN, "[clock] SNTP server %s", server_name);
+}
+
+bool frame_clock_synced() {
+  portENTER_CRITICAL(&clock_mux);
+  bool s = synced;
+  portEXIT_CRITICAL(&clock_mux);
+  return s;
+}
+
+bool frame_clock_wall_us(int64_t mono_us, int64_t *wall_us) {
+  portENTER_CRITICAL(&clock_mux);
+  bool s = synced;
+  if (s) *wall_us = map_locked(mono_us);
+  portEXIT_CRITICAL(&clock_mux);
+  return s;
+}
+
+bool frame_clock_wall_tv(const struct timeval *mono, struct timeval *wall) {
+  int64_t us;
+  if (!frame_clock_wall_us((int64_t)mono->tv_sec * 1000000 + mono->tv_usec, &us)) return false;
+  wall->tv_sec = (time_t)(us / 1000000);
+  wall->tv_usec = (suseconds_t)(us % 1000000);
+  return true;
+}
+
+void frame_clock_format(const struct timeval *mono, char *buf, size_t len) {
+  struct timeval wall;
+  if (frame_clock_wall_tv(mono, &wall)) {
+    snprintf(buf, len, "%lld.%06ld", (long long)wall.tv_sec, (long)wall.tv_usec);
+  } else if (len) {
+    buf[0] = 0;
+  }
+}
+
+static void seq_store(uint32_t mark) {
+  nvs_handle_t h;
+  if (nvs_open(SEQ_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) return;
+  if (nvs_set_u32(h, SEQ_KEY, mark) == ESP_OK) nvs_commit(h);
+  nvs_close(h);
+}
+
+void frame_clock_seq_begin() {
+  uint32_t mark = 0;
+  nvs_handle_t h;
+  if (nvs_open(SEQ_NAMESPACE, NVS_READONLY, &h) == ESP_OK) {
+    nvs_get_u32(h, SEQ_KEY, &mark);
+    nvs_close(h);
+  }
+  frame_seq.store(mark);
+  seq_reserved.store(mark + FRAME_CLOCK_SEQ_BLOCK);
+  seq_store(mark + FRAME_CLOCK_SEQ_BLOCK);
+}
+
+uint32_t frame_clock_next_seq() {
+  uint32_t seq = frame_seq.fetch_add(1, std::memory_order_relaxed) + 1;
+  // Halfway through a block, reserve the next one so the stored mark stays ahead
+  // of every number handed out. Exactly one caller sees this value.
+  uint32_t reserved = seq_reserved.load(std::memory_order_relaxed);
+  if (seq == reserved - FRAME_CLOCK_SEQ_BLOCK / 2) {
+    seq_reserved.store(reserved + FRAME_CLOCK_SEQ_BLOCK, std::memory_order_relaxed);
+    seq_store(reserved + FRAME_CLOCK_SEQ_BLOCK);
+  }
+  return seq;
+}
+
+void frame_clock_to_json(cJSON *obj) {
+  int64_t mono = esp_timer_get_time();
+  portENTER_CRITICAL(&clock_mux);
+  bool s = synced;
+  int64_t offset = base_offset, at = base_mono, correction = last_correction, wall = s ? map_locked(mono) : 0;
+  float drift = drift_ppm;
+  uint32_t n = syncs;
+  portEXIT_CRITICAL(&clock_mux);
+
+  cJSON_AddStringToObject(obj, "server", started ? server_name : "");
+  cJSON_AddBoolToObject(obj, "synced", s);
+  cJSON_AddNumberToObject(obj, "syncs", n);
+  cJSON_AddNumberToObject(obj, "mono_us", (double)mono);
+  cJSON_AddNumberToObject(obj, "frame_seq", frame_seq.load(std::memory_order_relaxed));
+  if (!s) return;
+  cJSON_AddNumberToObject(obj, "wall_us", (double)wall);
+  cJSON_AddNumberToObject(obj, "offset_us", (double)offset);
+  cJSON_AddNumberToObject(obj, "drift_ppm", drift);
+  cJSON_AddNumberToObject(obj, "last_sync_age_ms", (double)((mono - at) / 1000));
+  cJSON_AddNumberToObject(obj, "last_correction_us", (double)correction);
+}
@@ -0,0 +1,49 @@
+#ifndef FRAME_CLOCK_H
+#define FRAME_CLOCK_H
+
+#include <Arduino.h>
+#include <sys/time.h>
+#include "cJSON.h"
+
+// Wall-clock capture times for frames. The camera driver stamps each frame with
+// esp_timer time (microseconds since boot). SNTP runs against the configured
+// server (a gateway-side NTP stand-in works as well as a public pool); every
+// sync records a (monotonic, wall) pair, and frame times are mapped from the
+// latest pair, corrected by the drift measured between syncs. Frames also get a
+// device-wide sequence number, shared by uploads, /stream and /capture, that
+// keeps counting up across reboots.
+//
+// Frames carry X-Frame-Seq and, once the clock is synced, X-Capture-Time
+// (Unix seconds.microseconds). GET /time reports the mapping so the server can
+// check its own offset against the device.
+
+#define FRAME_CLOCK_DEFAULT_SERVER "pool.ntp.org"
+#define FRAME_CLOCK_SYNC_INTERVAL_MS (15 * 60 * 1000)
+// Drift estimates beyond this are treated as clock steps, not drift
+#define FRAME_CLOCK_MAX_DRIFT_PPM 500
+// Timestamps at or after this Unix time are wall clock, earlier ones boot-relative
+#define FRAME_CLOCK_MIN_EPOCH 1600000000
+// Sequence numbers are reserved in NVS this many at a time (one flash write per
+// block); numbers left unused at a reboot are skipped, never reissued.
+#define FRAME_CLOCK_SEQ_BLOCK 1024
+
+// Start SNTP against `server` (NULL or empty = FRAME_CLOCK_DEFAULT_SERVER).
+// Calling again with the same server does nothing; a new server restarts SNTP.
+void frame_clock_begin(const char *server);
+bool frame_clock_synced();
+
+// esp_timer microseconds -> Unix microseconds. False until the first sync.
+bool frame_clock_wall_us(int64_t mono_us, int64_t *wall_us);
+// Same for a camera_fb_t timestamp
+bool frame_clock_wall_tv(const struct timeval *mono, struct timeval *wall);
+// "seconds.microseconds" of the wall time of `mono`; empty string while unsynced
+void frame_clock_format(const struct timeval *mono, char *buf, size_t len);
+
+// Load the sequence high-water mark from NVS and reserve the first block. Call
+// once at boot before any frame is numbered.
+void frame_clock_seq_begin();
+uint32_t frame_clock_next_seq();
+
+void frame_clock_to_json(cJSON *obj);
+
+#endif // FRAME_CLOCK_H
@@ -0,0 +1,191 @@
+#include "frame_ring.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+static frame_slot_t *slots = NULL;
+static uint8_t *ready = NULL;       // FIFO of slot indices waiting for the consumer
+static uint8_t *free_list = NULL;   // stack of unused slot indices
+static uint32_t ready_head = 0;
+static uint32_t ready_count = 0;
+static uint32_t free_count = 0;
+static int in_flight = -1;          // slot index borrowed by the consumer
+
+static frame_ring_stats_t stats;
+static portMUX_TYPE ring_mux = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t ready_sem = NULL;
+
+static void *ring_alloc(size_t len, bool *in_psram) {
+  void *p = NULL;
+  if (psramFound()) {
+    p = heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  }
+  if (p) {
+    *in_psram = true;
+    return p;
+  }
+  *in_psram = false;
+  return malloc(len);
+}
+
+// Undo a failed frame_ring_init() so a later call starts from scratch
+static void ring_free(size_t nslots) {
+  for (size_t i = 0; slots && i < nslots; i++) free(slots[i].buf);
+  free(slots);
+  free(ready);
+  free(free_list);
+  if (ready_sem) vSemaphoreDelete(ready_sem);
+  slots = NULL;
+  ready = NULL;
+  free_list = NULL;
+  ready_sem = NULL;
+  free_count = 0;
+}
+
+bool frame_ring_init(size_t nslots, size_t slot_bytes, frame_ring_policy_t policy) {
+  if (slots) return true;
+  if (nslots < 2) nslots = 2;     // one slot may be in flight, keep at least one for the producer
+  if (nslots > 255) nslots = 255;
+
+  slots = (frame_slot_t *)calloc(nslots, sizeof(frame_slot_t));
+  ready = (uint8_t *)calloc(nslots, 1);
+  free_list = (uint8_t *)calloc(nslots, 1);
+  ready_sem = xSemaphoreCreateBinary();
+  if (!slots || !ready || !free_list || !ready_sem) {
+    Serial.println("[ring] failed to allocate ring bookkeeping");
+    ring_free(nslots);
+    return false;
+  }
+
+  bool psram = false;
+  size_t allocated = 0;
+  for (size_t i = 0; i < nslots; i++) {
+    slots[i].buf = (uint8_t *)ring_alloc(slot_bytes, &psram);
+    if (!slots[i].buf) break;
+    free_list[free_count++] = (uint8_t)(allocated++);
+  }
+  if (allocated < 2) {
+    Serial.printf("[ring] only %u slot(s) of %u bytes could be allocated\n", (unsigned)allocated, (unsigned)slot_bytes);
+    ring_free(nslots);
+    return false;
+  }
+
+  memset(&stats, 0, sizeof(stats));
+  stats.capacity = allocated;
+  stats.slot_bytes = slot_bytes;
+  stats.in_psram = psram;
+  stats.policy = policy;
+  Serial.printf("[ring] %u slots x %u bytes in %s, policy=%s\n", (unsigned)allocated, (unsigned)slot_bytes, psram ? "PSRAM" : "DRAM",
+                frame_ring_policy_name(policy));
+  return true;
+}
+
+bool frame_ring_push(const camera_fb_t *fb, uint32_t seq, int64_t capture_us) {
+  if (!slots || !fb) return false;
+
+  if (fb->len > stats.slot_bytes) {
+    portENTER_CRITICAL(&ring_mux);
+    stats.oversize++;
+    stats.dropped++;
+    portEXIT_CRITICAL(&ring_mux);
+    return false;
+  }
+
+  int idx = -1;
+  portENTER_CRITICAL(&ring_mux);
+  if (free_count > 0) {
+    idx = free_list[--free_count];
+  } else if (stats.policy == FRAME_RING_DROP_OLDEST && ready_count > 0) {
+    // Recycle the oldest queued frame; the slot in flight is never in the ready FIFO
+    idx = ready[ready_head];
+    ready_head = (ready_head + 1) % stats.capacity;
+    ready_count--;
+    stats.dropped++;
+  } else {
+    stats.dropped++;
+  }
+  portEXIT_CRITICAL(&ring_mux);
+  if (idx < 0) return false;
+
+  // Copy outside the lock; the slot is owned by the producer until it is queued
+  frame_slot_t *slot = &slots[idx];
+  memcpy(slot->buf, fb->buf, fb->len);
+  slot->len = fb->len;
+  slot->width = fb->width;
+  slot->height = fb->height;
+  slot->format = fb->format;
+  slot->timestamp = fb->timestamp;
+  slot->seq = seq;
+  slot->capture_us = capture_us;
+  slot->ready_us = esp_timer_get_time();
+
+  portENTER_CRITICAL(&ring_mux);
+  ready[(ready_head + ready_count) % stats.capacity] = (uint8_t)idx;
+  ready_count++;
+  stats.pushed++;
+  if (ready_count > stats.high_water) stats.high_water = ready_count;
+  portEXIT_CRITICAL(&ring_mux);
+
+  xSemaphoreGive(ready_sem);
+  return true;
+}
+
+static frame_slot_t *ring_take_ready() {
+  frame_slot_t *slot = NULL;
+  portENTER_CRITICAL(&ring_mux);
+  if (ready_count > 0 && in_flight < 0) {
+    in_flight = ready[ready_head];
+    ready_head = (ready_head + 1) % stats.capacity;
+    ready_count--;
+    stats.popped++;
+    slot = &slots[in_flight];
+  }
+  portEXIT_CRITICAL(&ring_mux);
+  return slot;
+}
+
+frame_slot_t *frame_ring_acquire(TickType_t wait) {
+  if (!slots) return NULL;
+  frame_slot_t *slot = ring_take_ready();
+  if (slot) return slot;
+  if (xSemaphoreTake(ready_sem, wait) != pdTRUE) return NULL;
+  return ring_take_ready();
+}
+
+void frame_ring_release(frame_slot_t *slot) {
+  if (!slots || !slot) return;
+  int idx = (int)(slot - slots);
+  portENTER_CRITICAL(&ring_mux);
+  if (idx == in_flight) {
+    free_list[free_count++] = (uint8_t)idx;
+    in_flight = -1;
+  }
+  portEXIT_CRITICAL(&ring_mux);
+}
+
+void frame_ring_get_stats(frame_ring_stats_t *out) {
+  portENTER_CRITICAL(&ring_mux);
+  *out = stats;
+  out->depth = ready_count;
+  out->in_flight = in_flight >= 0 ? 1 : 0;
+  portEXIT_CRITICAL(&ring_mux);
+}
+
+const char *frame_ring_policy_name(frame_ring_policy_t policy) {
+  return policy == FRAME_RING_DROP_NEWEST ? "drop_newest" : "drop_oldest";
+}
+
+void frame_ring_to_json(cJSON *obj) {
+  frame_ring_stats_t st;
+  frame_ring_get_stats(&st);
+  cJSON_AddNumberToObject(obj, "capacity", st.capacity);
+  cJSON_AddNumberToObject(obj, "depth", st.depth);
+  cJSON_AddNumberToObject(obj, "in_flight", st.in_flight);
+  cJSON_AddNumberToObject(obj, "high_water", st.high_water);
+  cJSON_AddNumberToObject(obj, "slot_bytes", st.slot_bytes);
+  cJSON_AddBoolToObject(obj, "psram", st.in_psram);
+  cJSON_AddStringToObject(obj, "policy", frame_ring_policy_name(st.policy));
+  cJSON_AddNumberToObject(obj, "pushed", st.pushed);
+  cJSON_AddNumberToObject(obj, "popped", st.popped);
+  cJSON_AddNumberToObject(obj, "dropped", st.dropped);
+  cJSON_AddNumberToObject(obj, "oversize", st.oversize);
+}
@@ -0,0 +1,62 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <Arduino.h>
+#include <sys/time.h>
+#include "esp_camera.h"
+#include "cJSON.h"
+
+// Fixed-capacity ring of PSRAM frame slots shared by the capture task (producer)
+// and the upload task (consumer). The producer copies each JPEG into a free slot
+// and returns the camera frame buffer immediately; the consumer borrows the oldest
+// ready slot for as long as the upload takes and hands it back when done.
+
+typedef enum {
+  FRAME_RING_DROP_OLDEST = 0,  // full ring: recycle the oldest frame not being uploaded
+  FRAME_RING_DROP_NEWEST = 1,  // full ring: discard the incoming frame
+} frame_ring_policy_t;
+
+typedef struct {
+  uint8_t *buf;            // slot storage (slot_bytes capacity)
+  size_t len;              // bytes used by the current frame
+  size_t width;
+  size_t height;
+  pixformat_t format;
+  struct timeval timestamp;  // copied from camera_fb_t
+  uint32_t seq;            // capture sequence number
+  int64_t capture_us;      // esp_timer time the driver stamped the frame
+  int64_t ready_us;        // esp_timer time the copy was queued
+} frame_slot_t;
+
+typedef struct {
+  uint32_t capacity;    // number of slots
+  uint32_t depth;       // frames waiting to be uploaded
+  uint32_t in_flight;   // frames currently borrowed by the consumer (0 or 1)
+  uint32_t high_water;  // max depth observed
+  uint32_t pushed;      // frames accepted
+  uint32_t popped;      // frames handed to the consumer
+  uint32_t dropped;     // frames lost to the drop policy
+  uint32_t oversize;    // frames larger than a slot
+  size_t slot_bytes;
+  bool in_psram;
+  frame_ring_policy_t policy;
+} frame_ring_stats_t;
+
+// Allocate the slots (PSRAM when available). Safe to call more than once; a failed
+// call frees what it allocated and leaves the ring uninitialised, so it can be retried.
+bool frame_ring_init(size_t slots, size_t slot_bytes, frame_ring_policy_t policy);
+
+// Producer: copy a frame into the ring. `capture_us` is the frame's capture time
+// (frame_capture_us, esp_timer clock). Returns false if the frame was dropped.
+bool frame_ring_push(const camera_fb_t *fb, uint32_t seq, int64_t capture_us);
+
+// Consumer: borrow the oldest ready frame, waiting up to `wait` ticks.
+// Returns NULL on timeout. The slot must be handed back with frame_ring_release().
+frame_slot_t *frame_ring_acquire(TickType_t wait);
+void frame_ring_release(frame_slot_t *slot);
+
+void frame_ring_get_stats(frame_ring_stats_t *out);
+const char *frame_ring_policy_name(frame_ring_policy_t policy);
+void frame_ring_to_json(cJSON *obj);
+
+#endif // FRAME_RING_H
@@ -0,0 +1,244 @@
+#include "frame_scaler.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_jpg_decode.h"
+#include "img_converters.h"
+
+// Timings are kept per (source size -> output size) pair so the cost of each
+// stream/upload combination can be read back from /uploader/status.
+#define SCALER_PROFILES 6
+// Largest frame that is re-encoded without downscaling (quality-only change)
+#define SCALER_REENCODE_MAX_PIXELS (640 * 480)
+
+typedef struct {
+  uint16_t src_w, src_h;
+  uint16_t out_w, out_h;
+  uint8_t scale;  // decoder divisor: 1 (quality-only re-encode), 2, 4 or 8
+  uint32_t frames;
+  uint64_t decode_us;
+  uint64_t encode_us;
+  uint32_t decode_max_us;
+  uint32_t encode_max_us;
+  uint64_t in_bytes;
+  uint64_t out_bytes;
+} scaler_profile_t;
+
+static scaler_profile_t profiles[SCALER_PROFILES];
+static int profile_count = 0;
+static uint32_t passthrough = 0;
+static uint32_t failures = 0;
+static portMUX_TYPE scaler_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t *out_buf = NULL;  // re-encoded JPEG
+static size_t out_cap = 0;
+static uint8_t *rgb_buf = NULL;  // decoded, scaled BGR888 frame (grown on demand)
+static size_t rgb_cap = 0;
+
+typedef struct {
+  const uint8_t *src;
+  size_t src_len;
+  uint16_t width;   // decoded (scaled) size
+  uint16_t height;
+} decode_ctx_t;
+
+typedef struct {
+  size_t len;
+  bool overflow;
+} encode_ctx_t;
+
+static uint8_t *scaler_alloc(size_t len) {
+  uint8_t *p = (uint8_t *)heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return p ? p : (uint8_t *)malloc(len);
+}
+
+bool frame_scaler_init(size_t cap) {
+  if (out_buf) return true;
+  out_buf = scaler_alloc(cap);
+  if (!out_buf) {
+    Serial.printf("[scaler] could not allocate %u byte output buffer, uploads will use full frames\n", (unsigned)cap);
+    return false;
+  }
+  out_cap = cap;
+  return true;
+}
+
+static size_t jpg_read(void *arg, size_t index, uint8_t *buf, size_t len) {
+  decode_ctx_t *d = (decode_ctx_t *)arg;
+  if (index >= d->src_len) return 0;
+  if (index + len > d->src_len) len = d->src_len - index;
+  if (buf) memcpy(buf, d->src + index, len);
+  return len;
+}
+
+// Decoder blocks arrive as RGB; store them BGR, the order fmt2jpg() expects for PIXFORMAT_RGB888
+static bool rgb_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+  decode_ctx_t *d = (decode_ctx_t *)arg;
+  if (!data) {
+    if (x == 0 && y == 0) {
+      // start of frame: w/h are the scaled output size
+      size_t need = (size_t)w * h * 3;
+      if (need > rgb_cap) {
+        free(rgb_buf);
+        rgb_buf = scaler_alloc(need);
+        rgb_cap = rgb_buf ? need : 0;
+      }
+      if (!rgb_buf) return false;
+      d->width = w;
+      d->height = h;
+    }
+    return true;
+  }
+
+  size_t stride = (size_t)d->width * 3;
+  for (uint16_t iy = 0; iy < h; iy++) {
+    uint8_t *o = rgb_buf + (size_t)(y + iy) * stride + (size_t)x * 3;
+    for (uint16_t ix = 0; ix < w; ix++) {
+      o[0] = data[2];
+      o[1] = data[1];
+      o[2] = data[0];
+      o += 3;
+      data += 3;
+    }
+  }
+  return true;
+}
+
+static size_t jpg_out(void *arg, size_t index, const void *data, size_t len) {
+  encode_ctx_t *e = (encode_ctx_t *)arg;
+  if (index + len > out_cap) {
+    e->overflow = true;
+    return 0;
+  }
+  memcpy(out_buf + index, data, len);
+  e->len = index + len;
+  return len;
+}
+
+// Sensor quality runs 0 (best) .. 63 (worst); the software encoder takes 100 (best) .. 1
+static uint8_t encoder_quality(int q) {
+  if (q < 0) q = 0;
+  if (q > 63) q = 63;
+  return (uint8_t)(100 - q * 90 / 63);
+}
+
+static void record_profile(uint16_t sw, uint16_t sh, uint16_t ow, uint16_t oh, uint8_t scale, uint32_t dec_us, uint32_t enc_us, size_t in, size_t out) {
+  portENTER_CRITICAL(&scaler_mux);
+  scaler_profile_t *p = NULL;
+  for (int i = 0; i < profile_count; i++) {
+    if (profiles[i].src_w == sw && profiles[i].src_h == sh && profiles[i].out_w == ow && profiles[i].out_h == oh) {
+      p = &profiles[i];
+      break;
+    }
+  }
+  if (!p) {
+    // Table full: the last entry is recycled for the new combination
+    p = &profiles[profile_count < SCALER_PROFILES ? profile_count++ : SCALER_PROFILES - 1];
+    memset(p, 0, sizeof(*p));
+    p->src_w = sw;
+    p->src_h = sh;
+    p->out_w = ow;
+    p->out_h = oh;
+    p->scale = scale;
+  }
+  p->frames++;
+  p->decode_us += dec_us;
+  p->encode_us += enc_us;
+  if (dec_us > p->decode_max_us) p->decode_max_us = dec_us;
+  if (enc_us > p->encode_max_us) p->encode_max_us = enc_us;
+  p->in_bytes += in;
+  p->out_bytes += out;
+  portEXIT_CRITICAL(&scaler_mux);
+}
+
+bool frame_scaler_run(const uint8_t *jpg, size_t len, uint16_t width, uint16_t height, int framesize, int quality, scaled_frame_t *out) {
+  out->buf = jpg;
+  out->len = len;
+  out->width = width;
+  out->height = height;
+  out->scaled = false;
+
+  if (!out_buf || framesize < 0 || framesize >= FRAMESIZE_INVALID) {
+    passthrough++;
+    return true;
+  }
+
+  // Largest power-of-two reduction that still covers the requested upload size
+  uint16_t tw = resolution[framesize].width;
+  uint16_t th = resolution[framesize].height;
+  int scale = JPG_SCALE_NONE;
+  for (int s = JPG_SCALE_8X; s > JPG_SCALE_NONE; s--) {
+    if ((width >> s) >= tw && (height >> s) >= th) {
+      scale = s;
+      break;
+    }
+  }
+  if (scale == JPG_SCALE_NONE) {
+    // Same size: only worth a re-encode if a coarser quality than the sensor's was asked for
+    // (and the full-size RGB frame stays reasonably small)
+    sensor_t *sensor = esp_camera_sensor_get();
+    int sensor_quality = sensor ? sensor->status.quality : 63;
+    if (quality <= sensor_quality || (uint32_t)width * height > SCALER_REENCODE_MAX_PIXELS) {
+      passthrough++;
+      return true;
+    }
+  }
+
+  decode_ctx_t d = {jpg, len, 0, 0};
+  int64_t t0 = esp_timer_get_time();
+  if (esp_jpg_decode(len, (jpg_scale_t)scale, jpg_read, rgb_write, &d) != ESP_OK || !d.width) {
+    failures++;
+    return false;
+  }
+  int64_t t1 = esp_timer_get_time();
+
+  encode_ctx_t e = {0, false};
+  bool ok = fmt2jpg_cb(rgb_buf, (size_t)d.width * d.height * 3, d.width, d.height, PIXFORMAT_RGB888, encoder_quality(quality), jpg_out, &e);
+  int64_t t2 = esp_timer_get_time();
+  if (e.overflow) {
+    passthrough++;
+    return true;
+  }
+  if (!ok || !e.len) {
+    failures++;
+    return false;
+  }
+
+  record_profile(width, height, d.width, d.height, 1 << scale, (uint32_t)(t1 - t0), (uint32_t)(t2 - t1), len, e.len);
+  out->buf = out_buf;
+  out->len = e.len;
+  out->width = d.width;
+  out->height = d.height;
+  out->scaled = true;
+  return true;
+}
+
+void frame_scaler_to_json(cJSON *obj) {
+  scaler_profile_t snap[SCALER_PROFILES];
+  portENTER_CRITICAL(&scaler_mux);
+  int n = profile_count;
+  memcpy(snap, profiles, sizeof(snap));
+  portEXIT_CRITICAL(&scaler_mux);
+
+  cJSON_AddNumberToObject(obj, "passthrough", passthrough);
+  cJSON_AddNumberToObject(obj, "failures", failures);
+  cJSON *list = cJSON_AddArrayToObject(obj, "profiles");
+  char dims[24];
+  for (int i = 0; i < n; i++) {
+    const scaler_profile_t *p = &snap[i];
+    if (!p->frames) continue;
+    cJSON *jp = cJSON_CreateObject();
+    snprintf(dims, sizeof(dims), "%ux%u", p->src_w, p->src_h);
+    cJSON_AddStringToObject(jp, "source", dims);
+    snprintf(dims, sizeof(dims), "%ux%u", p->out_w, p->out_h);
+    cJSON_AddStringToObject(jp, "output", dims);
+    cJSON_AddNumberToObject(jp, "scale", p->scale);
+    cJSON_AddNumberToObject(jp, "frames", p->frames);
+    cJSON_AddNumberToObject(jp, "decode_us_avg", (double)(p->decode_us / p->frames));
+    cJSON_AddNumberToObject(jp, "decode_us_max", p->decode_max_us);
+    cJSON_AddNumberToObject(jp, "encode_us_avg", (double)(p->encode_us / p->frames));
+    cJSON_AddNumberToObject(jp, "encode_us_max", p->encode_max_us);
+    cJSON_AddNumberToObject(jp, "in_bytes_avg", (double)(p->in_bytes / p->frames));
+    cJSON_AddNumberToObject(jp, "out_bytes_avg", (double)(p->out_bytes / p->frames));
+    cJSON_AddItemToArray(list, jp);
+  }
+}
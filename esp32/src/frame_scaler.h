@@ -0,0 +1,35 @@
+#ifndef FRAME_SCALER_H
+#define FRAME_SCALER_H
+
+#include <Arduino.h>
+#include "esp_camera.h"
+#include "cJSON.h"
+
+// Software upload profile. The sensor keeps running at the streaming resolution;
+// the uploader derives its smaller frame from the captured JPEG with a scaled
+// decode (1/2, 1/4 or 1/8) followed by a re-encode at the upload quality, so no
+// consumer ever has to switch the sensor mode.
+
+typedef struct {
+  const uint8_t *buf;  // the source JPEG (passthrough) or the scaler's output buffer
+  size_t len;
+  uint16_t width;
+  uint16_t height;
+  bool scaled;         // false when the source was passed through unchanged
+} scaled_frame_t;
+
+// Allocate the output buffer (PSRAM when available). Encoded frames larger than
+// out_cap fall back to the unscaled source.
+bool frame_scaler_init(size_t out_cap);
+
+// Derive the upload frame for `framesize` / `quality` (sensor scale: 0 best .. 63 worst).
+// Picks the largest decoder scale that keeps the frame at least as big as `framesize`;
+// when no downscale applies the source is passed through unless a coarser quality
+// than the sensor's is requested. The output stays valid
+// until the next call. Returns false only if a scaled frame was needed but failed.
+bool frame_scaler_run(const uint8_t *jpg, size_t len, uint16_t width, uint16_t height, int framesize, int quality, scaled_frame_t *out);
+
+// Per-profile decode/encode timings and byte counts
+void frame_scaler_to_json(cJSON *obj);
+
+#endif // FRAME_SCALER_H
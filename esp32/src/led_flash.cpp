@@ -0,0 +1,213 @@
+#include "led_flash.h"
+#include "board_config.h"
+#include "async_log.h"
+#include "esp_timer.h"
+
+#if defined(LED_GPIO_NUM)
+
+static int duty = 0;
+static uint32_t holders = 0;     // bit per led_flash_user_t
+static int64_t lit_since = 0;    // esp_timer time the LED came on, 0 while off
+static uint32_t frame_us = 0;    // measured frame period, smoothed
+static portMUX_TYPE led_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Flash snapshot statistics
+static uint32_t flashes = 0;     // takes that had to light the LED
+static uint32_t prelit = 0;      // takes that found the LED already on
+static uint32_t discarded = 0;   // partly lit frames skipped (earlier ones never reach us)
+static uint32_t last_latency_us = 0;
+static uint32_t avg_latency_us = 0;
+static uint32_t max_latency_us = 0;
+
+// Drive the pin from the current holders; called after every change
+static void led_apply() {
+  portENTER_CRITICAL(&led_mux);
+  int d = holders ? duty : 0;
+  if (d > LED_FLASH_STREAM_MAX_INTENSITY && (holders & (1u << LED_FLASH_STREAM))) {
+    d = LED_FLASH_STREAM_MAX_INTENSITY;
+  }
+  portEXIT_CRITICAL(&led_mux);
+  ledcWrite(LED_GPIO_NUM, d);
+}
+
+void led_flash_begin() {
+  ledcAttach(LED_GPIO_NUM, 5000, 8);
+  led_apply();
+}
+
+bool led_flash_available() {
+  return true;
+}
+
+void led_flash_hold(led_flash_user_t user, bool on) {
+  portENTER_CRITICAL(&led_mux);
+  uint32_t was = holders;
+  if (on) {
+    holders |= 1u << user;
+  } else {
+    holders &= ~(1u << user);
+  }
+  bool lit = holders != 0;
+  bool changed = (was != 0) != lit;
+  if (changed) lit_since = lit ? esp_timer_get_time() : 0;
+  portEXIT_CRITICAL(&led_mux);
+  if (changed) {
+    led_apply();
+    ALOGD(ALOG_CAMERA, "LED %s", lit ? "on" : "off");
+  }
+}
+
+void led_flash_set_intensity(int d) {
+  portENTER_CRITICAL(&led_mux);
+  duty = d;
+  portEXIT_CRITICAL(&led_mux);
+  led_apply();
+  ALOGI(ALOG_CAMERA, "Set LED intensity to %d", d);
+}
+
+int led_flash_intensity() {
+  return duty;
+}
+
+int64_t led_flash_cutoff_us() {
+  portENTER_CRITICAL(&led_mux);
+  int64_t cut = lit_since && duty > 0 ? lit_since + (frame_us ? frame_us : LED_FLASH_DEFAULT_FRAME_US) : 0;
+  portEXIT_CRITICAL(&led_mux);
+  return cut;
+}
+
+bool led_flash_take(frame_bus_consumer_t consumer, int64_t not_before_us, TickType_t wait, frame_ref_t *out) {
+  // At intensity 0 there is no light to wait for
+  if (led_flash_intensity() <= 0) {
+    portENTER_CRITICAL(&led_mux);
+    last_latency_us = 0;
+    portEXIT_CRITICAL(&led_mux);
+    return frame_bus_take(consumer, not_before_us, wait, out);
+  }
+  TickType_t start = xTaskGetTickCount();
+  int64_t called_us = esp_timer_get_time();
+  led_flash_hold(LED_FLASH_CAPTURE, true);
+  portENTER_CRITICAL(&led_mux);
+  int64_t on_us = lit_since;
+  uint32_t period = frame_us ? frame_us : LED_FLASH_DEFAULT_FRAME_US;
+  portEXIT_CRITICAL(&led_mux);
+  bool was_lit = on_us < called_us;
+
+  // First frame started after the LED came on (and after the caller's cut-off)
+  bool got = frame_bus_take(consumer, not_before_us > on_us ? not_before_us : on_us, wait, out);
+  bool partial = got && frame_capture_us(out->frame->fb) - on_us < (int64_t)period;
+  int64_t partial_us = 0;
+  if (partial) {
+    // Possibly lit only in part; the next frame was exposed entirely after this
+    // one's readout started, so it is lit whatever the exposure time
+    partial_us = frame_capture_us(out->frame->fb);
+    frame_bus_release(out);
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    got = elapsed < wait && frame_bus_take(consumer, partial_us + 1, wait - elapsed, out);
+  }
+  led_flash_hold(LED_FLASH_CAPTURE, false);
+
+  portENTER_CRITICAL(&led_mux);
+  if (partial) {
+    discarded++;
+    if (got) {
+      uint32_t p = (uint32_t)(frame_capture_us(out->frame->fb) - partial_us);
+      frame_us = frame_us ? frame_us - (frame_us >> 2) + (p >> 2) : p;
+    }
+  }
+  if (got && was_lit) {
+    prelit++;
+    last_latency_us = 0;
+  } else if (got) {
+    flashes++;
+    last_latency_us = (uint32_t)(out->taken_us - on_us);
+    avg_latency_us = avg_latency_us ? avg_latency_us - (avg_latency_us >> 3) + (last_latency_us >> 3) : last_latency_us;
+    if (last_latency_us > max_latency_us) max_latency_us = last_latency_us;
+  }
+  portEXIT_CRITICAL(&led_mux);
+  return got;
+}
+
+uint32_t led_flash_last_latency_ms() {
+  return last_latency_us / 1000;
+}
+
+void led_flash_to_json(cJSON *obj) {
+  portENTER_CRITICAL(&led_mux);
+  uint32_t h = holders, f = flashes, p = prelit, d = discarded, period = frame_us;
+  uint32_t last = last_latency_us, avg = avg_latency_us, max = max_latency_us;
+  int64_t on = lit_since;
+  portEXIT_CRITICAL(&led_mux);
+
+  cJSON_AddBoolToObject(obj, "available", true);
+  cJSON_AddNumberToObject(obj, "intensity", duty);
+  cJSON_AddBoolToObject(obj, "lit", h != 0);
+  cJSON_AddBoolToObject(obj, "stream", h & (1u << LED_FLASH_STREAM));
+  cJSON_AddBoolToObject(obj, "keep_lit", h & (1u << LED_FLASH_UPLOAD));
+  if (on) cJSON_AddNumberToObject(obj, "lit_ms", (double)((esp_timer_get_time() - on) / 1000));
+  cJSON_AddNumberToObject(obj, "frame_us", period);
+  cJSON_AddNumberToObject(obj, "flashes", f);
+  cJSON_AddNumberToObject(obj, "prelit", p);
+  cJSON_AddNumberToObject(obj, "discarded", d);
+  cJSON_AddNumberToObject(obj, "last_latency_us", last);
+  cJSON_AddNumberToObject(obj, "avg_latency_us", avg);
+  cJSON_AddNumberToObject(obj, "max_latency_us", max);
+}
+
+void led_flash_metrics(metrics_out_t *out) {
+  portENTER_CRITICAL(&led_mux);
+  uint32_t f = flashes, d = discarded, avg = avg_latency_us;
+  portEXIT_CRITICAL(&led_mux);
+
+  metrics_family(out, "led_flash_total", "counter", "Snapshots that turned the LED on");
+  metrics_printf(out, METRICS_PREFIX "led_flash_total %u\n", (unsigned)f);
+  metrics_family(out, "led_flash_discarded_total", "counter", "Partly lit frames skipped after the LED came on");
+  metrics_printf(out, METRICS_PREFIX "led_flash_discarded_total %u\n", (unsigned)d);
+  metrics_family(out, "led_flash_latency_seconds", "gauge", "Smoothed LED-on to lit frame latency");
+  metrics_printf(out, METRICS_PREFIX "led_flash_latency_seconds %.6f\n", avg / 1e6);
+}
+
+#else
+
+void led_flash_begin() {
+  ALOGI(ALOG_HTTP, "LED flash is disabled -> LED_GPIO_NUM undefined");
+}
+
+bool led_flash_available() {
+  return false;
+}
+
+void led_flash_hold(led_flash_user_t user, bool on) {
+  (void)user;
+  (void)on;
+}
+
+void led_flash_set_intensity(int duty) {
+  (void)duty;
+}
+
+int led_flash_intensity() {
+  return -1;
+}
+
+int64_t led_flash_cutoff_us() {
+  return 0;
+}
+
+bool led_flash_take(frame_bus_consumer_t consumer, int64_t not_before_us, TickType_t wait, frame_ref_t *out) {
+  return frame_bus_take(consumer, not_before_us, wait, out);
+}
+
+uint32_t led_flash_last_latency_ms() {
+  return 0;
+}
+
+void led_flash_to_json(cJSON *obj) {
+  cJSON_AddBoolToObject(obj, "available", false);
+}
+
+void led_flash_metrics(metrics_out_t *out) {
+  (void)out;
+}
+
+#endif
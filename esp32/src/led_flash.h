@@ -0,0 +1,52 @@
+#ifndef LED_FLASH_H
+#define LED_FLASH_H
+
+#include <Arduino.h>
+#include "cJSON.h"
+#include "frame_bus.h"
+#include "metrics.h"
+
+// Flash LED (boards that define LED_GPIO_NUM; everything here is a no-op
+// otherwise). /stream, /capture and the uploader each hold the LED while they
+// need light, and it stays lit while anyone holds it.
+//
+// Flash snapshots do not sleep a fixed warm-up: the camera stamps each frame
+// (fb->timestamp) when its readout starts, and rows are exposed for at most one
+// frame period before that. So the first frame started after the LED came on can
+// be partly dark, and any frame started a frame period later is fully lit. Frames
+// before the cut-off are discarded; the period is measured from those frames.
+
+typedef enum {
+  LED_FLASH_STREAM = 0,  // while /stream has clients
+  LED_FLASH_CAPTURE,     // during a flash snapshot
+  LED_FLASH_UPLOAD,      // keep-lit mode while the uploader is running
+} led_flash_user_t;
+
+// Intensity cap while streaming, so a long-lit LED does not overheat
+#define LED_FLASH_STREAM_MAX_INTENSITY 255
+// Frame period assumed until one has been measured
+#define LED_FLASH_DEFAULT_FRAME_US 100000
+
+// Attach the LED pin; call once at boot
+void led_flash_begin();
+bool led_flash_available();
+
+void led_flash_hold(led_flash_user_t user, bool on);
+void led_flash_set_intensity(int duty);
+int led_flash_intensity();
+
+// First capture time (esp_timer us) of a fully lit frame, or 0 while the LED is off
+// or its intensity is 0
+int64_t led_flash_cutoff_us();
+
+// Take a fully lit frame captured at or after `not_before_us`, lighting the LED
+// for the duration if nobody else holds it. Without an LED, or at intensity 0, this
+// is frame_bus_take().
+bool led_flash_take(frame_bus_consumer_t consumer, int64_t not_before_us, TickType_t wait, frame_ref_t *out);
+// Latency of the last led_flash_take(): LED on -> frame handed over, ms (0 if the LED was already lit)
+uint32_t led_flash_last_latency_ms();
+
+void led_flash_to_json(cJSON *obj);
+void led_flash_metrics(metrics_out_t *out);
+
+#endif // LED_FLASH_H
@@ -8,6 +8,12 @@
 #include "uploader.h"
 #include "uploader_settings.h"
 #include "wifi_settings.h"
+#include "wifi_manager.h"
+#include "boot_graph.h"
+#include "async_log.h"
+#include "frame_clock.h"
+#include "frame_bus.h"
+#include "led_flash.h"
 
 // ===========================
 // Enter your WiFi credentials
@@ -19,16 +25,26 @@ const char *password = "0909123jab";
 // const char* password = "12345678";
 
 void startCameraServer();
-void setupLedFlash();
 void startUploaderTask();
 
 
 
-void setup() {
-  Serial.begin(115200);
-  Serial.setDebugOutput(true);
-  Serial.println();
+// ===========================
+// Boot stages
+// ===========================
+// Each stage runs in its own task once the stages it waits for have finished (see
+// boot_graph.h), so camera init, the Wi-Fi join and the flash mount overlap.
 
+static boot_status_t boot_settings() {
+  // Load WiFi and uploader settings into RAM once; handlers and tasks read the cached copies
+  wifi_settings_init();
+  uploader_settings_init();
+  // Frame numbering continues from the last boot
+  frame_clock_seq_begin();
+  return BOOT_DONE;
+}
+
+static boot_status_t boot_camera() {
   camera_config_t config;
   config.ledc_channel = LEDC_CHANNEL_0;
   config.ledc_timer = LEDC_TIMER_0;
@@ -61,7 +77,9 @@ void setup() {
   if (config.pixel_format == PIXFORMAT_JPEG) {
     if (psramFound()) {
       config.jpeg_quality = 10;
-      config.fb_count = 2;
+      // Consumers hold frames from the frame bus while they send them; the third
+      // buffer keeps the camera running while two are out
+      config.fb_count = 3;
       config.grab_mode = CAMERA_GRAB_LATEST;
     } else {
       // Limit the frame size when PSRAM is not available
@@ -79,8 +97,8 @@ void setup() {
   // camera init
   esp_err_t err = esp_camera_init(&config);
   if (err != ESP_OK) {
-    Serial.printf("Camera init failed with error 0x%x", err);
-    return;
+    Serial.printf("Camera init failed with error 0x%x\n", err);
+    return BOOT_FAILED;
   }
 
   sensor_t *s = esp_camera_sensor_get();
@@ -94,73 +112,96 @@ void setup() {
   if (config.pixel_format == PIXFORMAT_JPEG) {
     s->set_framesize(s, FRAMESIZE_QVGA);
   }
+  // From here on only the frame bus calls esp_camera_fb_get()
+  if (!frame_bus_begin(config.fb_count)) {
+    Serial.println("Frame bus task could not be started");
+    return BOOT_FAILED;
+  }
+  led_flash_begin();
+  return BOOT_DONE;
+}
 
-  // Initialize WiFi provisioning settings storage
-  wifi_settings_init();
+static boot_status_t boot_radio() {
+  // Bring up the driver and network stack so the HTTP server can bind while the join runs
+  WiFi.mode(WIFI_STA);
+  WiFi.setSleep(false);
+  return BOOT_DONE;
+}
 
-  // Attempt to connect using stored or hard-coded credentials
-  String storedSsid = wifi_get_ssid();
-  String storedPass = wifi_get_pass();
+static boot_status_t boot_storage() {
+  return uploader_storage_begin() ? BOOT_DONE : BOOT_SKIPPED;
+}
 
-  if (storedSsid.length() > 0) {
-    Serial.printf("Connecting using stored SSID: '%s' (len=%d) pass_len=%d\n", storedSsid.c_str(), (int)storedSsid.length(), (int)storedPass.length());
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(storedSsid.c_str(), storedPass.c_str());
-  } else {
-    Serial.printf("Connecting using hard-coded SSID: '%s'\n", ssid);
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(ssid, password);
-  }
+static boot_status_t boot_wifi() {
+  // Attempt to connect using stored or hard-coded credentials (cached access point first)
+  wifi_manager_boot_connect(ssid, password);
 
-  WiFi.setSleep(false);
+  // Later joins (provisioning, /reconnect) and scans run in the Wi-Fi manager task
+  wifi_manager_begin(WiFi.status() == WL_CONNECTED);
+  return WiFi.status() == WL_CONNECTED ? BOOT_DONE : BOOT_FAILED;
+}
 
-  unsigned long startAttempt = millis();
-  while (WiFi.status() != WL_CONNECTED && millis() - startAttempt < 15000) {
-    delay(500);
-    Serial.print(".");
-  }
-  Serial.println("");
+static boot_status_t boot_http() {
+  // Start web server so setup is reachable over the LAN and the SoftAP
+  startCameraServer();
+  return BOOT_DONE;
+}
 
+static boot_status_t boot_softap() {
+  const char* apName = WIFI_AP_NAME;
   if (WiFi.status() == WL_CONNECTED) {
     Serial.println("WiFi connected");
-
-    // Start web server so setup is reachable over the LAN
-    startCameraServer();
-
     Serial.print("Camera Ready! Use 'http://");
     Serial.print(WiFi.localIP());
     Serial.println("' to connect");
 
-    // If uploader settings are missing, keep the SoftAP available for provisioning
-    uploader_settings_init();
     // Ensure SoftAP is available for provisioning while STA is active (keeps AP on even when uploader is configured)
     WiFi.mode(WIFI_AP_STA);
-    const char* apName = "NutriCycle-Setup";
-    WiFi.softAP(apName);
-    Serial.printf("SoftAP '%s' started. Connect to http://192.168.4.1 to configure.\n", apName);
-
-    uploader_settings_init();
-    if (!uploader_is_configured()) {
-      Serial.println("Uploader not configured; waiting for uploader settings (AP active)");
-    } else {
-      // Start optional uploader task which posts captured frames to the Node.js gateway
-      // (uploader can be configured in src/uploader_config.h or via the web UI)
-      Serial.println("Uploader configured; starting uploader task (AP remains active)");
-      startUploaderTask();
-    }
   } else {
     Serial.println("WiFi connection failed, starting SoftAP for provisioning...");
-    // Start Soft AP for provisioning
     WiFi.mode(WIFI_AP);
-    const char* apName = "NutriCycle-Setup";
-    WiFi.softAP(apName);
-    Serial.printf("SoftAP '%s' started. Connect to http://192.168.4.1 to configure.\n", apName);
-
-    // Start web server to allow uploader and wifi settings updates
-    startCameraServer();
+  }
+  WiFi.softAP(apName);
+  Serial.printf("SoftAP '%s' started. Connect to http://192.168.4.1 to configure.\n", apName);
+  return BOOT_DONE;
+}
 
-    // Do not start uploader until configured
+static boot_status_t boot_uploader() {
+  // If uploader settings are missing, keep the SoftAP available for provisioning
+  if (!uploader_is_configured()) {
+    Serial.println("Uploader not configured; waiting for uploader settings (AP active)");
+    return BOOT_SKIPPED;
   }
+  // Start optional uploader task which posts captured frames to the Node.js gateway
+  // (uploader can be configured in src/uploader_config.h or via the web UI)
+  Serial.println("Uploader configured; starting uploader task (AP remains active)");
+  startUploaderTask();
+  return BOOT_DONE;
+}
+
+#define B(stage) BOOT_BIT(stage)
+static const boot_stage_def_t boot_stages[] = {
+  // id, name, requires, after, fn, stack, core
+  {BOOT_SETTINGS, "settings", 0, 0, boot_settings, 4 * 1024, 1},
+  {BOOT_CAMERA, "camera", 0, 0, boot_camera, 8 * 1024, 1},
+  {BOOT_RADIO, "radio", 0, 0, boot_radio, 4 * 1024, 0},
+  {BOOT_STORAGE, "storage", B(BOOT_SETTINGS), 0, boot_storage, 8 * 1024, 1},
+  {BOOT_WIFI, "wifi", B(BOOT_SETTINGS) | B(BOOT_RADIO), 0, boot_wifi, 6 * 1024, 0},
+  {BOOT_HTTP, "http", B(BOOT_SETTINGS) | B(BOOT_CAMERA) | B(BOOT_RADIO), 0, boot_http, 6 * 1024, 1},
+  {BOOT_SOFTAP, "softap", B(BOOT_RADIO), B(BOOT_WIFI), boot_softap, 4 * 1024, 0},
+  {BOOT_UPLOADER, "uploader", B(BOOT_SETTINGS) | B(BOOT_CAMERA) | B(BOOT_WIFI), B(BOOT_STORAGE), boot_uploader, 4 * 1024, 1},
+  {BOOT_FIRST_UPLOAD, "first_upload", B(BOOT_UPLOADER), 0, NULL, 0, 0},
+};
+#undef B
+
+void setup() {
+  Serial.begin(115200);
+  Serial.setDebugOutput(true);
+  Serial.println();
+  // Hot paths log through the ring; the writer task owns the console from here on
+  alog_begin();
+
+  boot_run(boot_stages, sizeof(boot_stages) / sizeof(boot_stages[0]));
 }
 
 void loop() {
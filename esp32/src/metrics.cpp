@@ -0,0 +1,95 @@
+#include "metrics.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "frame_bus.h"
+#include "led_flash.h"
+#include "stream_broadcaster.h"
+#include "upload_queue.h"
+#include "wifi_manager.h"
+#include <stdarg.h>
+
+std::atomic<uint32_t> metric_counters[METRIC_COUNT];
+
+static const uint32_t upload_bounds_ms[] = METRICS_UPLOAD_BUCKETS_MS;
+#define UPLOAD_BUCKETS (sizeof(upload_bounds_ms) / sizeof(upload_bounds_ms[0]))
+// Non-cumulative counts per bucket (the last one is +Inf); summed when rendering
+static std::atomic<uint32_t> upload_buckets[UPLOAD_BUCKETS + 1];
+static std::atomic<uint32_t> upload_sum_ms(0);
+
+void metrics_observe_upload_ms(uint32_t ms) {
+  size_t i = 0;
+  while (i < UPLOAD_BUCKETS && ms > upload_bounds_ms[i]) i++;
+  upload_buckets[i].fetch_add(1, std::memory_order_relaxed);
+  upload_sum_ms.fetch_add(ms, std::memory_order_relaxed);
+}
+
+void metrics_flush(metrics_out_t *out) {
+  if (out->len) out->write(out->ctx, out->buf, out->len);
+  out->len = 0;
+}
+
+void metrics_printf(metrics_out_t *out, const char *fmt, ...) {
+  char line[160];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  if (n <= 0) return;
+  if ((size_t)n >= sizeof(line)) n = sizeof(line) - 1;
+  if (out->len + n > sizeof(out->buf)) metrics_flush(out);
+  memcpy(out->buf + out->len, line, n);
+  out->len += n;
+}
+
+void metrics_family(metrics_out_t *out, const char *name, const char *type, const char *help) {
+  metrics_printf(out, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n", name, help, name, type);
+}
+
+static void write_heap(metrics_out_t *out) {
+  metrics_family(out, "heap_free_bytes", "gauge", "Free heap");
+  metrics_printf(out, METRICS_PREFIX "heap_free_bytes{region=\"internal\"} %u\n", (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+  metrics_printf(out, METRICS_PREFIX "heap_free_bytes{region=\"psram\"} %u\n", (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+  metrics_family(out, "heap_largest_free_block_bytes", "gauge", "Largest allocatable block");
+  metrics_printf(out, METRICS_PREFIX "heap_largest_free_block_bytes{region=\"internal\"} %u\n", (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+  metrics_printf(out, METRICS_PREFIX "heap_largest_free_block_bytes{region=\"psram\"} %u\n", (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM));
+  metrics_family(out, "heap_min_free_bytes", "gauge", "Lowest free internal heap since boot");
+  metrics_printf(out, METRICS_PREFIX "heap_min_free_bytes %u\n", (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+}
+
+static void write_uploads(metrics_out_t *out) {
+  metrics_family(out, "captures_total", "counter", "Frames captured for upload");
+  metrics_printf(out, METRICS_PREFIX "captures_total %u\n", (unsigned)metrics_get(METRIC_CAPTURES));
+  metrics_family(out, "capture_failures_total", "counter", "Upload captures that returned no frame");
+  metrics_printf(out, METRICS_PREFIX "capture_failures_total %u\n", (unsigned)metrics_get(METRIC_CAPTURE_FAILURES));
+
+  metrics_family(out, "uploads_total", "counter", "Live frames by outcome");
+  metrics_printf(out, METRICS_PREFIX "uploads_total{result=\"ok\"} %u\n", (unsigned)metrics_get(METRIC_UPLOADS_OK));
+  metrics_printf(out, METRICS_PREFIX "uploads_total{result=\"failed\"} %u\n", (unsigned)metrics_get(METRIC_UPLOADS_FAILED));
+  metrics_printf(out, METRICS_PREFIX "uploads_total{result=\"deferred\"} %u\n", (unsigned)metrics_get(METRIC_UPLOADS_DEFERRED));
+  metrics_printf(out, METRICS_PREFIX "uploads_total{result=\"shed\"} %u\n", (unsigned)metrics_get(METRIC_UPLOADS_SHED));
+
+  metrics_family(out, "upload_duration_seconds", "histogram", "Gateway POST round trip");
+  uint32_t cumulative = 0;
+  for (size_t i = 0; i < UPLOAD_BUCKETS; i++) {
+    cumulative += upload_buckets[i].load(std::memory_order_relaxed);
+    metrics_printf(out, METRICS_PREFIX "upload_duration_seconds_bucket{le=\"%u.%03u\"} %u\n", (unsigned)(upload_bounds_ms[i] / 1000),
+                   (unsigned)(upload_bounds_ms[i] % 1000), (unsigned)cumulative);
+  }
+  cumulative += upload_buckets[UPLOAD_BUCKETS].load(std::memory_order_relaxed);
+  metrics_printf(out, METRICS_PREFIX "upload_duration_seconds_bucket{le=\"+Inf\"} %u\n", (unsigned)cumulative);
+  uint32_t sum = upload_sum_ms.load(std::memory_order_relaxed);
+  metrics_printf(out, METRICS_PREFIX "upload_duration_seconds_sum %u.%03u\n", (unsigned)(sum / 1000), (unsigned)(sum % 1000));
+  metrics_printf(out, METRICS_PREFIX "upload_duration_seconds_count %u\n", (unsigned)cumulative);
+}
+
+void metrics_write(metrics_out_t *out) {
+  metrics_family(out, "uptime_seconds", "gauge", "Time since boot");
+  metrics_printf(out, METRICS_PREFIX "uptime_seconds %u\n", (unsigned)(esp_timer_get_time() / 1000000));
+  write_heap(out);
+  write_uploads(out);
+  upload_queue_metrics(out);
+  stream_broadcaster_metrics(out);
+  frame_bus_metrics(out);
+  led_flash_metrics(out);
+  wifi_manager_metrics(out);
+}
@@ -0,0 +1,56 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include <atomic>
+
+// Device-wide counters for GET /metrics (Prometheus text format). Hot paths only
+// do relaxed atomic increments; everything else (heap, queue depth, RSSI, stream
+// clients) is read when the endpoint is scraped. Rendering goes through a small
+// fixed buffer that is flushed in chunks, so a scrape allocates nothing.
+
+#define METRICS_PREFIX "nutricycle_"
+// Upload latency histogram bucket bounds, milliseconds (+Inf is implicit)
+#define METRICS_UPLOAD_BUCKETS_MS {50, 100, 250, 500, 1000, 2500, 5000, 10000}
+#define METRICS_OUT_BYTES 512
+
+typedef enum {
+  METRIC_CAPTURES = 0,
+  METRIC_CAPTURE_FAILURES,
+  METRIC_UPLOADS_OK,
+  METRIC_UPLOADS_FAILED,
+  METRIC_UPLOADS_DEFERRED,  // queued for a later attempt
+  METRIC_UPLOADS_SHED,      // lost: queue disabled or full
+  METRIC_COUNT,
+} metric_t;
+
+extern std::atomic<uint32_t> metric_counters[METRIC_COUNT];
+
+static inline void metrics_inc(metric_t m) {
+  metric_counters[m].fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline uint32_t metrics_get(metric_t m) {
+  return metric_counters[m].load(std::memory_order_relaxed);
+}
+
+// Record one gateway POST round trip
+void metrics_observe_upload_ms(uint32_t ms);
+
+// Text sink: `write` receives each full buffer and the final partial one
+typedef struct {
+  void (*write)(void *ctx, const char *buf, size_t len);
+  void *ctx;
+  char buf[METRICS_OUT_BYTES];
+  size_t len;
+} metrics_out_t;
+
+void metrics_printf(metrics_out_t *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+// "# HELP" and "# TYPE" lines for a metric family (name without the prefix)
+void metrics_family(metrics_out_t *out, const char *name, const char *type, const char *help);
+void metrics_flush(metrics_out_t *out);
+
+// Heap, counters, upload histogram, then every module's own metrics
+void metrics_write(metrics_out_t *out);
+
+#endif // METRICS_H
@@ -0,0 +1,151 @@
+#include "motion_gate.h"
+#include "esp_timer.h"
+#include "esp_jpg_decode.h"
+
+#define SIG_CELLS (MOTION_SIG_W * MOTION_SIG_H)
+
+typedef struct {
+  const uint8_t *src;
+  size_t src_len;
+  uint16_t width;  // decoded (1/8) size
+  uint16_t height;
+  uint32_t sum[SIG_CELLS];
+  uint16_t count[SIG_CELLS];
+} sig_ctx_t;
+
+static uint8_t ref_sig[SIG_CELLS];
+static bool have_ref = false;
+static uint32_t last_sent_ms = 0;
+
+static uint32_t checked = 0;
+static uint32_t sent_changed = 0;
+static uint32_t sent_heartbeat = 0;
+static uint32_t sent_ungated = 0;
+static uint32_t skipped = 0;
+static uint32_t decode_failures = 0;
+static uint32_t last_changed_pct = 0;
+static uint32_t last_analyse_us = 0;
+
+static sig_ctx_t ctx;  // only used by the upload task; kept off its stack
+
+static size_t sig_read(void *arg, size_t index, uint8_t *buf, size_t len) {
+  sig_ctx_t *c = (sig_ctx_t *)arg;
+  if (index >= c->src_len) return 0;
+  if (index + len > c->src_len) len = c->src_len - index;
+  if (buf) memcpy(buf, c->src + index, len);
+  return len;
+}
+
+// Fold each decoded RGB block into the luminance grid
+static bool sig_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+  sig_ctx_t *c = (sig_ctx_t *)arg;
+  if (!data) {
+    if (x == 0 && y == 0) {
+      c->width = w;
+      c->height = h;
+    }
+    return true;
+  }
+  if (!c->width || !c->height) return false;
+  for (uint16_t iy = 0; iy < h; iy++) {
+    int cy = (int)(y + iy) * MOTION_SIG_H / c->height;
+    for (uint16_t ix = 0; ix < w; ix++) {
+      int cx = (int)(x + ix) * MOTION_SIG_W / c->width;
+      int cell = cy * MOTION_SIG_W + cx;
+      c->sum[cell] += (77 * data[0] + 150 * data[1] + 29 * data[2]) >> 8;
+      c->count[cell]++;
+      data += 3;
+    }
+  }
+  return true;
+}
+
+static bool signature(const uint8_t *jpg, size_t len, uint8_t *sig) {
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.src = jpg;
+  ctx.src_len = len;
+  if (esp_jpg_decode(len, JPG_SCALE_8X, sig_read, sig_write, &ctx) != ESP_OK) return false;
+  for (int i = 0; i < SIG_CELLS; i++) {
+    sig[i] = ctx.count[i] ? (uint8_t)(ctx.sum[i] / ctx.count[i]) : 0;
+  }
+  return true;
+}
+
+// Percentage of cells that moved by more than `threshold`, after removing the
+// global brightness shift so auto-exposure steps do not count as change
+static uint32_t changed_percent(const uint8_t *cur, const uint8_t *ref, int threshold) {
+  int32_t cur_sum = 0, ref_sum = 0;
+  for (int i = 0; i < SIG_CELLS; i++) {
+    cur_sum += cur[i];
+    ref_sum += ref[i];
+  }
+  int32_t shift = (cur_sum - ref_sum) / SIG_CELLS;
+  uint32_t changed = 0;
+  for (int i = 0; i < SIG_CELLS; i++) {
+    int32_t d = (int32_t)cur[i] - ref[i] - shift;
+    if (d > threshold || d < -threshold) changed++;
+  }
+  return changed * 100 / SIG_CELLS;
+}
+
+motion_decision_t motion_gate_check(const uint8_t *jpg, size_t len, uint32_t now_ms, const motion_gate_config_t *cfg) {
+  if (!cfg->enabled) {
+    sent_ungated++;
+    have_ref = false;
+    return MOTION_SEND_UNGATED;
+  }
+
+  checked++;
+  uint8_t sig[SIG_CELLS];
+  int64_t start = esp_timer_get_time();
+  bool ok = signature(jpg, len, sig);
+  last_analyse_us = (uint32_t)(esp_timer_get_time() - start);
+  if (!ok) {
+    decode_failures++;
+    sent_ungated++;
+    return MOTION_SEND_UNGATED;
+  }
+
+  motion_decision_t d;
+  if (!have_ref) {
+    d = MOTION_SEND_FIRST;
+  } else {
+    last_changed_pct = changed_percent(sig, ref_sig, cfg->pixel_threshold);
+    if (last_changed_pct > 0 && last_changed_pct >= cfg->area_percent) {
+      d = MOTION_SEND_CHANGED;
+      sent_changed++;
+    } else if (now_ms - last_sent_ms >= cfg->heartbeat_ms) {
+      d = MOTION_SEND_HEARTBEAT;
+      sent_heartbeat++;
+    } else {
+      skipped++;
+      return MOTION_SKIP;
+    }
+  }
+
+  memcpy(ref_sig, sig, sizeof(ref_sig));
+  have_ref = true;
+  last_sent_ms = now_ms;
+  return d;
+}
+
+const char *motion_gate_decision_name(motion_decision_t d) {
+  switch (d) {
+    case MOTION_SEND_FIRST: return "first";
+    case MOTION_SEND_CHANGED: return "changed";
+    case MOTION_SEND_HEARTBEAT: return "heartbeat";
+    case MOTION_SEND_UNGATED: return "ungated";
+    default: return "skip";
+  }
+}
+
+void motion_gate_to_json(cJSON *obj) {
+  cJSON_AddNumberToObject(obj, "checked", checked);
+  cJSON_AddNumberToObject(obj, "sent_changed", sent_changed);
+  cJSON_AddNumberToObject(obj, "sent_heartbeat", sent_heartbeat);
+  cJSON_AddNumberToObject(obj, "sent_ungated", sent_ungated);
+  cJSON_AddNumberToObject(obj, "skipped", skipped);
+  cJSON_AddNumberToObject(obj, "decode_failures", decode_failures);
+  cJSON_AddNumberToObject(obj, "last_changed_pct", last_changed_pct);
+  cJSON_AddNumberToObject(obj, "last_analyse_us", last_analyse_us);
+}
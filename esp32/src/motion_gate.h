@@ -0,0 +1,35 @@
+#ifndef MOTION_GATE_H
+#define MOTION_GATE_H
+
+#include <Arduino.h>
+#include "cJSON.h"
+
+// Change detector for the uploader. Each JPEG is decoded at 1/8 scale and reduced
+// to a small grid of mean luminance values; a frame is uploaded only if enough
+// cells differ from the last uploaded frame, or when the heartbeat is due.
+
+#define MOTION_SIG_W 16
+#define MOTION_SIG_H 12
+
+typedef struct {
+  bool enabled;
+  uint8_t pixel_threshold;  // per-cell luminance change that counts (0-255)
+  uint8_t area_percent;     // share of changed cells that makes a frame "changed"
+  uint32_t heartbeat_ms;    // upload at least this often even without change
+} motion_gate_config_t;
+
+typedef enum {
+  MOTION_SEND_FIRST = 0,   // no reference frame yet
+  MOTION_SEND_CHANGED,
+  MOTION_SEND_HEARTBEAT,
+  MOTION_SEND_UNGATED,     // gating disabled or the frame could not be analysed
+  MOTION_SKIP,
+} motion_decision_t;
+
+// Decide whether this frame should be uploaded. Every decision other than
+// MOTION_SKIP makes this frame the new reference.
+motion_decision_t motion_gate_check(const uint8_t *jpg, size_t len, uint32_t now_ms, const motion_gate_config_t *cfg);
+const char *motion_gate_decision_name(motion_decision_t d);
+void motion_gate_to_json(cJSON *obj);
+
+#endif // MOTION_GATE_H
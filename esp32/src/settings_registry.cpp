@@ -0,0 +1,303 @@
+#include "settings_registry.h"
+#include "nvs.h"
+
+// Publishing a new cache runs in a critical section so the writer cannot be
+// preempted halfway through the copy while a reader spins on the sequence.
+static portMUX_TYPE publish_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *VERSION_KEY = "ver";
+
+// Simple percent-encoding (URL encode) helpers to avoid storing problematic raw control characters
+static String pct_encode(const char *s) {
+  String out;
+  out.reserve(strlen(s) * 3);
+  for (; *s; ++s) {
+    char c = *s;
+    if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '-' || c == '_' || c == '.' || c == '~') {
+      out += c;
+    } else {
+      char buf[4];
+      snprintf(buf, sizeof(buf), "%%%02X", (unsigned char)c);
+      out += buf;
+    }
+  }
+  return out;
+}
+
+static String pct_decode(const String &s) {
+  String out;
+  out.reserve(s.length());
+  for (size_t i = 0; i < s.length(); ++i) {
+    char c = s[i];
+    if (c == '%' && i + 2 < s.length()) {
+      char hi = s[i+1];
+      char lo = s[i+2];
+      int v = 0;
+      auto hex = [](char ch)->int { if (ch >= '0' && ch <= '9') return ch - '0'; if (ch >= 'A' && ch <= 'F') return 10 + ch - 'A'; if (ch >= 'a' && ch <= 'f') return 10 + ch - 'a'; return 0; };
+      v = (hex(hi) << 4) | hex(lo);
+      out += (char)v;
+      i += 2;
+    } else if (c == '+') {
+      out += ' ';
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+static uint32_t clamp_u32(const setting_field_t *f, double v) {
+  if (v < (double)f->min) return f->min;
+  if (v > (double)f->max) return f->max;
+  return (uint32_t)v;
+}
+
+static void fill_default(const setting_field_t *f, uint8_t *values) {
+  uint8_t *p = values + f->offset;
+  switch (f->type) {
+    case SETTING_TYPE_STR:  strlcpy((char *)p, f->def_str ? f->def_str() : "", f->size); break;
+    case SETTING_TYPE_U32:  *(uint32_t *)p = f->def; break;
+    case SETTING_TYPE_BOOL: *(bool *)p = f->def != 0; break;
+  }
+}
+
+static void load_field(nvs_handle_t h, const setting_field_t *f, uint8_t *values) {
+  fill_default(f, values);
+  uint8_t *p = values + f->offset;
+  if (f->type == SETTING_TYPE_STR) {
+    size_t len = 0;
+    if (nvs_get_str(h, f->key, NULL, &len) != ESP_OK || len <= 1) return;
+    char *tmp = (char *)malloc(len);
+    if (!tmp) return;
+    if (nvs_get_str(h, f->key, tmp, &len) == ESP_OK) {
+      String v = (f->flags & SETTING_PCT_ENCODED) ? pct_decode(String(tmp)) : String(tmp);
+      if (v.length() >= f->size) Serial.printf("[settings] %s truncated to %u bytes\n", f->key, (unsigned)(f->size - 1));
+      strlcpy((char *)p, v.c_str(), f->size);
+    }
+    free(tmp);
+  } else {
+    uint32_t v;
+    if (nvs_get_u32(h, f->key, &v) != ESP_OK) return;
+    if (f->type == SETTING_TYPE_U32) {
+      *(uint32_t *)p = clamp_u32(f, v);
+    } else {
+      *(bool *)p = v != 0;
+    }
+  }
+}
+
+static bool field_changed(const setting_field_t *f, const uint8_t *a, const uint8_t *b) {
+  if (f->type == SETTING_TYPE_STR) return strcmp((const char *)a + f->offset, (const char *)b + f->offset) != 0;
+  return memcmp(a + f->offset, b + f->offset, f->type == SETTING_TYPE_U32 ? sizeof(uint32_t) : sizeof(bool)) != 0;
+}
+
+static esp_err_t store_field(nvs_handle_t h, const setting_field_t *f, const uint8_t *values) {
+  const uint8_t *p = values + f->offset;
+  switch (f->type) {
+    case SETTING_TYPE_STR:
+      if (f->flags & SETTING_PCT_ENCODED) return nvs_set_str(h, f->key, pct_encode((const char *)p).c_str());
+      return nvs_set_str(h, f->key, (const char *)p);
+    case SETTING_TYPE_U32:
+      return nvs_set_u32(h, f->key, *(const uint32_t *)p);
+    case SETTING_TYPE_BOOL:
+      return nvs_set_u32(h, f->key, *(const bool *)p ? 1 : 0);
+  }
+  return ESP_ERR_INVALID_ARG;
+}
+
+static void log_field(settings_store_t *s, const setting_field_t *f, const uint8_t *values) {
+  const uint8_t *p = values + f->offset;
+  if (f->type == SETTING_TYPE_STR) {
+    if (f->flags & SETTING_SECRET) {
+      Serial.printf("[settings] %s.%s saved (len=%d)\n", s->ns, f->key, (int)strlen((const char *)p));
+    } else {
+      Serial.printf("[settings] %s.%s saved '%s'\n", s->ns, f->key, (const char *)p);
+    }
+  } else if (f->type == SETTING_TYPE_U32) {
+    Serial.printf("[settings] %s.%s saved %u\n", s->ns, f->key, (unsigned)*(const uint32_t *)p);
+  } else {
+    Serial.printf("[settings] %s.%s saved %d\n", s->ns, f->key, *(const bool *)p ? 1 : 0);
+  }
+}
+
+// Replace the cache; readers that overlap the copy see an odd or changed sequence and retry
+static void publish(settings_store_t *s, const uint8_t *values) {
+  portENTER_CRITICAL(&publish_mux);
+  uint32_t q = s->seq.load(std::memory_order_relaxed);
+  s->seq.store(q + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(s->values, values, s->size);
+  s->seq.store(q + 2, std::memory_order_release);
+  portEXIT_CRITICAL(&publish_mux);
+}
+
+void settings_load(settings_store_t *s) {
+  if (s->load_state.load(std::memory_order_acquire) == SETTINGS_LOADED) return;
+  uint8_t expected = SETTINGS_UNLOADED;
+  if (!s->load_state.compare_exchange_strong(expected, SETTINGS_LOADING, std::memory_order_acquire)) {
+    // Another task is loading; the cache and the write lock are usable once it is done
+    while (s->load_state.load(std::memory_order_acquire) != SETTINGS_LOADED) vTaskDelay(1);
+    return;
+  }
+  s->write_lock = xSemaphoreCreateMutex();
+
+  uint8_t *values = (uint8_t *)s->values;
+  nvs_handle_t h;
+  bool open = nvs_open(s->ns, NVS_READONLY, &h) == ESP_OK;  // missing namespace = all defaults
+  for (size_t i = 0; i < s->count; i++) {
+    if (open) {
+      load_field(h, &s->fields[i], values);
+    } else {
+      fill_default(&s->fields[i], values);
+    }
+  }
+  s->version = 0;
+  if (open) {
+    nvs_get_u32(h, VERSION_KEY, &s->version);
+    nvs_close(h);
+  }
+  s->load_state.store(SETTINGS_LOADED, std::memory_order_release);
+  Serial.printf("[settings] %s loaded (%u fields, version %u)\n", s->ns, (unsigned)s->count, (unsigned)s->version);
+}
+
+void settings_read(settings_store_t *s, size_t offset, void *dst, size_t len) {
+  uint32_t q0, q1;
+  do {
+    q0 = s->seq.load(std::memory_order_acquire);
+    memcpy(dst, (const uint8_t *)s->values + offset, len);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    q1 = s->seq.load(std::memory_order_relaxed);
+  } while ((q0 & 1) || q0 != q1);
+}
+
+// Write the fields that differ between `staged` and the cache in one commit, then publish
+static int commit(settings_store_t *s, const uint8_t *staged, bool erase, char *err, size_t err_len) {
+  const uint8_t *current = (const uint8_t *)s->values;  // only writers modify it and we hold the lock
+  int changed = 0;
+  for (size_t i = 0; i < s->count; i++) {
+    if (erase || field_changed(&s->fields[i], staged, current)) changed++;
+  }
+  if (changed == 0) return 0;
+
+  nvs_handle_t h;
+  esp_err_t rc = nvs_open(s->ns, NVS_READWRITE, &h);
+  if (rc == ESP_OK) {
+    for (size_t i = 0; i < s->count && rc == ESP_OK; i++) {
+      const setting_field_t *f = &s->fields[i];
+      if (erase) {
+        rc = nvs_erase_key(h, f->key);
+        if (rc == ESP_ERR_NVS_NOT_FOUND) rc = ESP_OK;
+      } else if (field_changed(f, staged, current)) {
+        rc = store_field(h, f, staged);
+      }
+    }
+    if (rc == ESP_OK) rc = nvs_set_u32(h, VERSION_KEY, s->version + 1);
+    if (rc == ESP_OK) rc = nvs_commit(h);
+    nvs_close(h);
+  }
+  if (rc != ESP_OK) {
+    Serial.printf("[settings] %s commit failed: %s\n", s->ns, esp_err_to_name(rc));
+    if (err) snprintf(err, err_len, "flash write failed");
+    return -1;
+  }
+
+  if (!erase) {
+    for (size_t i = 0; i < s->count; i++) {
+      if (field_changed(&s->fields[i], staged, current)) log_field(s, &s->fields[i], staged);
+    }
+  }
+  publish(s, staged);
+  s->version++;
+  return changed;
+}
+
+int settings_apply_json(settings_store_t *s, const cJSON *obj, uint8_t flags, char *err, size_t err_len) {
+  settings_load(s);
+  xSemaphoreTake(s->write_lock, portMAX_DELAY);
+  uint8_t *staged = (uint8_t *)malloc(s->size);
+  if (!staged) {
+    xSemaphoreGive(s->write_lock);
+    if (err) snprintf(err, err_len, "out of memory");
+    return -1;
+  }
+  memcpy(staged, s->values, s->size);
+
+  // Validate the whole request before anything reaches flash
+  const char *bad = NULL;
+  for (size_t i = 0; i < s->count && !bad; i++) {
+    const setting_field_t *f = &s->fields[i];
+    if (!(f->flags & flags) || !f->json) continue;
+    cJSON *j = cJSON_GetObjectItem(obj, f->json);
+    if (!j) continue;
+    uint8_t *p = staged + f->offset;
+    switch (f->type) {
+      case SETTING_TYPE_STR:
+        if (!cJSON_IsString(j)) {
+          bad = "must be a string";
+        } else if (strlen(j->valuestring) >= f->size) {
+          bad = "is too long";
+        } else if (j->valuestring[0] || !(f->flags & SETTING_KEEP_IF_EMPTY)) {
+          strcpy((char *)p, j->valuestring);
+        }
+        break;
+      case SETTING_TYPE_U32:
+        if (!cJSON_IsNumber(j)) {
+          bad = "must be a number";
+        } else {
+          *(uint32_t *)p = clamp_u32(f, j->valuedouble);
+        }
+        break;
+      case SETTING_TYPE_BOOL:
+        if (!cJSON_IsBool(j)) {
+          bad = "must be true or false";
+        } else {
+          *(bool *)p = cJSON_IsTrue(j);
+        }
+        break;
+    }
+    if (bad && err) snprintf(err, err_len, "%s %s", f->json, bad);
+  }
+
+  int changed = bad ? -1 : commit(s, staged, false, err, err_len);
+  free(staged);
+  xSemaphoreGive(s->write_lock);
+  return changed;
+}
+
+int settings_store_values(settings_store_t *s, const void *values) {
+  settings_load(s);
+  xSemaphoreTake(s->write_lock, portMAX_DELAY);
+  int changed = commit(s, (const uint8_t *)values, false, NULL, 0);
+  xSemaphoreGive(s->write_lock);
+  return changed;
+}
+
+void settings_to_json(settings_store_t *s, cJSON *obj, uint8_t flags) {
+  settings_load(s);
+  uint8_t *values = (uint8_t *)malloc(s->size);
+  if (!values) return;
+  settings_read(s, 0, values, s->size);
+  for (size_t i = 0; i < s->count; i++) {
+    const setting_field_t *f = &s->fields[i];
+    if (!(f->flags & flags) || (f->flags & SETTING_WRITE_ONLY) || !f->json) continue;
+    const uint8_t *p = values + f->offset;
+    switch (f->type) {
+      case SETTING_TYPE_STR:  cJSON_AddStringToObject(obj, f->json, (const char *)p); break;
+      case SETTING_TYPE_U32:  cJSON_AddNumberToObject(obj, f->json, *(const uint32_t *)p); break;
+      case SETTING_TYPE_BOOL: cJSON_AddBoolToObject(obj, f->json, *(const bool *)p); break;
+    }
+  }
+  free(values);
+}
+
+void settings_reset(settings_store_t *s) {
+  settings_load(s);
+  xSemaphoreTake(s->write_lock, portMAX_DELAY);
+  uint8_t *staged = (uint8_t *)malloc(s->size);
+  if (staged) {
+    for (size_t i = 0; i < s->count; i++) fill_default(&s->fields[i], staged);
+    commit(s, staged, true, NULL, 0);
+    free(staged);
+  }
+  xSemaphoreGive(s->write_lock);
+}
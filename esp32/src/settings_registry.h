@@ -0,0 +1,93 @@
+#ifndef SETTINGS_REGISTRY_H
+#define SETTINGS_REGISTRY_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <stddef.h>
+#include "cJSON.h"
+
+// Schema-driven settings stored in one NVS namespace. Each module lists its
+// settings once (key, type, default, clamp, JSON name) as an X-macro; the same list
+// generates the typed values struct and the field table the registry works from.
+// Values are read from flash once into a cached struct. Readers copy it without
+// locks (a seqlock retries the copy if a write landed meanwhile); writers validate
+// a whole JSON object first and then store every changed value in one NVS commit.
+
+typedef enum {
+  SETTING_TYPE_STR = 0,
+  SETTING_TYPE_U32,
+  SETTING_TYPE_BOOL,  // stored as u32 0/1 (same layout as the old Preferences keys)
+} setting_type_t;
+
+// Field flags
+#define SETTING_JSON 0x01           // read and written by the module's JSON endpoint
+#define SETTING_PROVISION 0x02      // also accepted by POST /provision
+#define SETTING_KEEP_IF_EMPTY 0x04  // an empty string leaves the stored value alone
+#define SETTING_PCT_ENCODED 0x08    // stored percent-encoded in NVS
+#define SETTING_SECRET 0x10         // only the length is logged
+#define SETTING_WRITE_ONLY 0x20     // never returned by settings_to_json
+
+typedef struct {
+  const char *key;   // NVS key (15 chars max)
+  const char *json;  // JSON member name
+  setting_type_t type;
+  uint8_t flags;
+  uint16_t offset;   // into the values struct
+  uint16_t size;     // string capacity including the terminator
+  uint32_t def, min, max;
+  const char *(*def_str)();  // default for an unset string (NULL = "")
+} setting_field_t;
+
+// Member and field-table generators for the X-macro lists. The field generators
+// expect SETTINGS_STRUCT to name the values struct at the point of expansion.
+#define SETTING_STR_MEMBER(name, key, json, size, def_fn, flags) char name[size];
+#define SETTING_U32_MEMBER(name, key, json, def, lo, hi, flags) uint32_t name;
+#define SETTING_BOOL_MEMBER(name, key, json, def, flags) bool name;
+
+#define SETTING_STR_FIELD(name, key, json, size, def_fn, flags) \
+  {key, json, SETTING_TYPE_STR, (uint8_t)(flags), offsetof(SETTINGS_STRUCT, name), size, 0, 0, 0, def_fn},
+#define SETTING_U32_FIELD(name, key, json, def, lo, hi, flags) \
+  {key, json, SETTING_TYPE_U32, (uint8_t)(flags), offsetof(SETTINGS_STRUCT, name), sizeof(uint32_t), (uint32_t)(def), (uint32_t)(lo), (uint32_t)(hi), NULL},
+#define SETTING_BOOL_FIELD(name, key, json, def, flags) \
+  {key, json, SETTING_TYPE_BOOL, (uint8_t)(flags), offsetof(SETTINGS_STRUCT, name), sizeof(bool), (uint32_t)(def), 0, 1, NULL},
+
+typedef struct {
+  const char *ns;
+  const setting_field_t *fields;
+  size_t count;
+  void *values;  // cached snapshot, sized `size`
+  size_t size;
+  std::atomic<uint32_t> seq;  // odd while a write is being published
+  uint32_t version;           // persisted commit counter ("ver" key)
+  std::atomic<uint8_t> load_state;  // SETTINGS_UNLOADED/LOADING/LOADED
+  SemaphoreHandle_t write_lock;     // created by the one settings_load() that does the load
+} settings_store_t;
+
+#define SETTINGS_UNLOADED 0
+#define SETTINGS_LOADING 1
+#define SETTINGS_LOADED 2
+
+// Read the namespace into the cache. Exactly one caller loads; concurrent callers
+// wait until it is done and later calls return immediately.
+void settings_load(settings_store_t *store);
+
+// Lock-free copy of `len` bytes of the cache starting at `offset`
+void settings_read(settings_store_t *store, size_t offset, void *dst, size_t len);
+
+// Validate every member of `obj` that matches a field carrying one of `flags`,
+// then write the changed values in a single NVS commit and publish the new cache.
+// Nothing is written if a member has the wrong type or is too long; `err` then
+// names the offending member. Returns the number of changed settings, or -1.
+int settings_apply_json(settings_store_t *store, const cJSON *obj, uint8_t flags, char *err, size_t err_len);
+
+// Store a complete values struct (e.g. a modified snapshot) in a single commit.
+// Only fields that differ from the cache are written. Returns the number changed, or -1.
+int settings_store_values(settings_store_t *store, const void *values);
+
+// Add every field carrying one of `flags` (and not SETTING_WRITE_ONLY) to `obj`
+void settings_to_json(settings_store_t *store, cJSON *obj, uint8_t flags);
+
+// Erase every field of the store from flash (one commit) and reset the cache to the defaults
+void settings_reset(settings_store_t *store);
+
+#endif // SETTINGS_REGISTRY_H
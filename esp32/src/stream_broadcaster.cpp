@@ -0,0 +1,627 @@
+#include "stream_broadcaster.h"
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "async_log.h"
+#include "frame_clock.h"
+#include "frame_bus.h"
+#include "esp_heap_caps.h"
+#include "img_converters.h"
+#include "lwip/sockets.h"
+#include <atomic>
+#include <new>
+
+#define PART_BOUNDARY "123456789000000000000987654321"
+static const char *_STREAM_HEADER = "HTTP/1.1 200 OK\r\n"
+                                    "Content-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\n"
+                                    "Access-Control-Allow-Origin: *\r\n"
+                                    "Cache-Control: no-cache\r\n"
+                                    "X-Framerate: 60\r\n\r\n";
+static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
+static const char *_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %d.%06d\r\nX-Frame-Seq: %u\r\n";
+static const char *_STREAM_PART_TIME = "X-Capture-Time: %s\r\n";
+
+// One captured frame shared by all subscribers; freed when the last reference drops
+typedef struct {
+  std::atomic<int> refs;
+  frame_ref_t bus;             // set when buf points into the driver buffer
+  int8_t slot;                 // encoder pool slot holding buf, -1 if none
+  uint8_t *buf;
+  size_t len;
+  struct timeval timestamp;
+  uint32_t seq;                // device-wide frame sequence number
+  char capture_time[24];       // wall clock, empty until SNTP has synced
+} stream_frame_t;
+
+typedef struct {
+  bool in_use;
+  bool session_open;    // httpd still owns the socket
+  bool sender_running;  // sender task alive
+  volatile bool closing;
+  uint32_t id;
+  int fd;               // valid only while session_open
+  httpd_handle_t hd;
+  SemaphoreHandle_t send_lock;  // held by the sender around each send on fd
+  QueueHandle_t queue;  // stream_frame_t* waiting to be sent
+  char peer[48];
+  int64_t connected_us;
+  int64_t last_frame_us;
+  float fps;
+  uint32_t frames;
+  uint32_t drops;
+  uint64_t bytes;
+  uint32_t send_avg_us;  // boundary, part header and JPEG of one frame (smoothed)
+  uint32_t send_max_us;
+} stream_client_t;
+
+// Encoder output buffer; `cap` only ever grows
+typedef struct {
+  uint8_t *buf;
+  size_t cap;
+  bool busy;
+} encode_slot_t;
+
+typedef struct {
+  encode_slot_t *slot;
+  size_t len;
+  bool overflow;
+} encode_ctx_t;
+
+static stream_client_t clients[STREAM_MAX_CLIENTS];
+static SemaphoreHandle_t clients_lock = NULL;
+static int active_clients = 0;
+static uint32_t next_client_id = 0;
+static TaskHandle_t capture_task = NULL;
+static TaskHandle_t encode_task = NULL;
+static QueueHandle_t encode_queue = NULL;  // raw frame_ref_t waiting for the encoder
+static void (*active_cb)(bool) = NULL;
+
+static std::atomic<uint32_t> frames_published(0);
+static std::atomic<uint32_t> capture_failures(0);
+static std::atomic<uint32_t> encode_failures(0);
+static std::atomic<uint32_t> encode_skips(0);  // raw frames replaced before the encoder got to them
+static std::atomic<int> encode_quality(STREAM_ENCODE_QUALITY);
+
+static encode_slot_t pool[STREAM_ENCODE_SLOTS];
+static portMUX_TYPE pool_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Encoder and publish statistics, guarded by pool_mux
+static uint32_t encoded = 0;
+static uint32_t encode_avg_us = 0;
+static uint32_t encode_max_us = 0;
+static uint32_t pool_misses = 0;     // frames skipped because every slot was still being sent
+static uint32_t pool_grows = 0;      // slot (re)allocations
+static int64_t last_publish_us = 0;
+static float publish_fps = 0;
+
+static void add_sample(uint32_t *avg, uint32_t *max, uint32_t v) {
+  *avg = *avg ? *avg - (*avg >> 3) + (v >> 3) : v;
+  if (v > *max) *max = v;
+}
+
+static void frame_release(stream_frame_t *f) {
+  if (f && f->refs.fetch_sub(1) == 1) {
+    if (f->bus.frame) {
+      frame_bus_release(&f->bus);
+    } else if (f->slot >= 0) {
+      portENTER_CRITICAL(&pool_mux);
+      pool[f->slot].busy = false;
+      portEXIT_CRITICAL(&pool_mux);
+    } else {
+      free(f->buf);
+    }
+    delete f;
+  }
+}
+
+// A stream frame carrying the identity and timestamps of a bus frame, no data yet
+static stream_frame_t *frame_new(const frame_ref_t *ref) {
+  camera_fb_t *fb = ref->frame->fb;
+  stream_frame_t *f = new (std::nothrow) stream_frame_t;
+  if (!f) return NULL;
+  f->refs = 1;
+  f->bus.frame = NULL;
+  f->slot = -1;
+  f->buf = NULL;
+  f->len = 0;
+  f->timestamp = fb->timestamp;
+  f->seq = ref->frame->seq;
+  frame_clock_format(&fb->timestamp, f->capture_time, sizeof(f->capture_time));
+  return f;
+}
+
+// Wrap a JPEG bus frame for the clients. It is shared in place while the camera has
+// a spare buffer; otherwise it is copied and the bus reference dropped straight
+// away. Takes over `ref` in every case.
+static stream_frame_t *frame_from_bus(frame_ref_t *ref) {
+  camera_fb_t *fb = ref->frame->fb;
+  stream_frame_t *f = frame_new(ref);
+  if (!f) {
+    frame_bus_release(ref);
+    return NULL;
+  }
+
+  if (frame_bus_spare()) {
+    f->bus = *ref;
+    ref->frame = NULL;
+    f->buf = fb->buf;
+    f->len = fb->len;
+    return f;
+  }
+
+  f->buf = (uint8_t *)heap_caps_malloc(fb->len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!f->buf) f->buf = (uint8_t *)malloc(fb->len);
+  if (f->buf) {
+    memcpy(f->buf, fb->buf, fb->len);
+    f->len = fb->len;
+  }
+  frame_bus_release(ref);
+
+  if (!f->buf) {
+    delete f;
+    return NULL;
+  }
+  return f;
+}
+
+static int pool_get() {
+  int found = -1;
+  portENTER_CRITICAL(&pool_mux);
+  for (int i = 0; i < STREAM_ENCODE_SLOTS; i++) {
+    if (!pool[i].busy) {
+      pool[i].busy = true;
+      found = i;
+      break;
+    }
+  }
+  if (found < 0) pool_misses++;
+  portEXIT_CRITICAL(&pool_mux);
+  return found;
+}
+
+// Make a (free, owned) slot hold at least `need` bytes
+static bool pool_reserve(encode_slot_t *s, size_t need) {
+  if (s->cap >= need) return true;
+  free(s->buf);
+  s->buf = (uint8_t *)heap_caps_malloc(need, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!s->buf) s->buf = (uint8_t *)malloc(need);
+  s->cap = s->buf ? need : 0;
+  portENTER_CRITICAL(&pool_mux);
+  pool_grows++;
+  portEXIT_CRITICAL(&pool_mux);
+  return s->buf != NULL;
+}
+
+static size_t encode_out(void *arg, size_t index, const void *data, size_t len) {
+  encode_ctx_t *e = (encode_ctx_t *)arg;
+  if (index + len > e->slot->cap) {
+    e->overflow = true;
+    return 0;
+  }
+  memcpy(e->slot->buf + index, data, len);
+  e->len = index + len;
+  return len;
+}
+
+// Encode a raw bus frame into a pool slot. The driver buffer is released as soon
+// as the JPEG is out. Takes over `ref` in every case.
+static stream_frame_t *frame_encode(frame_ref_t *ref) {
+  camera_fb_t *fb = ref->frame->fb;
+  stream_frame_t *f = frame_new(ref);
+  int slot = f ? pool_get() : -1;
+  if (slot < 0) {
+    delete f;
+    frame_bus_release(ref);
+    return NULL;
+  }
+  f->slot = slot;
+  encode_slot_t *s = &pool[slot];
+
+  // About 4 bits per pixel is plenty below quality 90; a frame that does not fit
+  // doubles the slot and is encoded again
+  int64_t start = esp_timer_get_time();
+  encode_ctx_t e = {s, 0, false};
+  bool ok = pool_reserve(s, (size_t)fb->width * fb->height / 2)
+            && frame2jpg_cb(fb, (uint8_t)encode_quality.load(std::memory_order_relaxed), encode_out, &e);
+  if (!ok && e.overflow && pool_reserve(s, s->cap * 2)) {
+    e.len = 0;
+    e.overflow = false;
+    ok = frame2jpg_cb(fb, (uint8_t)encode_quality.load(std::memory_order_relaxed), encode_out, &e);
+  }
+  uint32_t took = (uint32_t)(esp_timer_get_time() - start);
+  frame_bus_release(ref);
+
+  if (!ok) {
+    ALOGE(ALOG_STREAM, "JPEG compression failed");
+    encode_failures.fetch_add(1, std::memory_order_relaxed);
+    frame_release(f);
+    return NULL;
+  }
+  f->buf = s->buf;
+  f->len = e.len;
+  portENTER_CRITICAL(&pool_mux);
+  encoded++;
+  add_sample(&encode_avg_us, &encode_max_us, took);
+  portEXIT_CRITICAL(&pool_mux);
+  return f;
+}
+
+// Called with clients_lock held: recycle the slot once both the socket and the sender are gone
+static bool client_try_free(stream_client_t *c) {
+  if (!c->in_use || c->session_open || c->sender_running) return false;
+  stream_frame_t *f = NULL;
+  while (xQueueReceive(c->queue, &f, 0) == pdTRUE) {
+    frame_release(f);
+  }
+  c->in_use = false;
+  active_clients--;
+  return active_clients == 0;
+}
+
+static void notify_active(bool active) {
+  if (active_cb) active_cb(active);
+}
+
+// httpd frees the session context when the socket closes (client went away or we
+// triggered it), before it closes the fd. Waiting for the sender's send in flight
+// (at most the socket's send timeout) keeps httpd from closing, and reusing, the
+// fd under it.
+static void client_session_closed(void *ctx) {
+  stream_client_t *c = (stream_client_t *)ctx;
+  c->closing = true;
+  xSemaphoreTake(c->send_lock, portMAX_DELAY);
+  xSemaphoreTake(clients_lock, portMAX_DELAY);
+  c->session_open = false;
+  bool idle = client_try_free(c);
+  xSemaphoreGive(clients_lock);
+  xSemaphoreGive(c->send_lock);
+  if (idle) notify_active(false);
+}
+
+static bool client_send(stream_client_t *c, const char *buf, size_t len) {
+  bool ok = true;
+  xSemaphoreTake(c->send_lock, portMAX_DELAY);
+  while (ok && len > 0) {
+    // session_open only goes false under send_lock, so fd is still this client's
+    if (c->closing || !c->session_open) {
+      ok = false;
+      break;
+    }
+    int n = httpd_socket_send(c->hd, c->fd, buf, len, 0);
+    if (n <= 0) {
+      ok = false;
+      break;
+    }
+    buf += n;
+    len -= n;
+  }
+  xSemaphoreGive(c->send_lock);
+  return ok;
+}
+
+static void client_sender_task(void *arg) {
+  stream_client_t *c = (stream_client_t *)arg;
+  char part_buf[192];
+
+  while (!c->closing) {
+    stream_frame_t *f = NULL;
+    if (xQueueReceive(c->queue, &f, pdMS_TO_TICKS(1000)) != pdTRUE || !f) {
+      continue;
+    }
+    size_t hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, f->len, (int)f->timestamp.tv_sec, (int)f->timestamp.tv_usec, (unsigned)f->seq);
+    if (f->capture_time[0]) hlen += snprintf(part_buf + hlen, sizeof(part_buf) - hlen, _STREAM_PART_TIME, f->capture_time);
+    hlen += snprintf(part_buf + hlen, sizeof(part_buf) - hlen, "\r\n");
+    int64_t send_start = esp_timer_get_time();
+    bool ok = client_send(c, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY)) && client_send(c, part_buf, hlen)
+              && client_send(c, (const char *)f->buf, f->len);
+    size_t sent = f->len + hlen;
+    frame_release(f);
+    if (!ok) {
+      ALOGW(ALOG_STREAM, "Stream client %u: send failed, closing", c->id);
+      c->closing = true;
+      break;
+    }
+
+    int64_t now = esp_timer_get_time();
+    add_sample(&c->send_avg_us, &c->send_max_us, (uint32_t)(now - send_start));
+    if (c->last_frame_us) {
+      float inst = 1000000.0f / (float)(now - c->last_frame_us);
+      c->fps = c->fps == 0 ? inst : c->fps * 0.9f + inst * 0.1f;
+    }
+    c->last_frame_us = now;
+    c->frames++;
+    c->bytes += sent;
+  }
+
+  xSemaphoreTake(clients_lock, portMAX_DELAY);
+  c->sender_running = false;
+  // Ask httpd to close the socket; it then calls client_session_closed() to recycle the
+  // slot. Decided and queued under the lock, which client_session_closed() needs before
+  // httpd closes the fd, so the fd cannot belong to another session yet.
+  if (c->session_open) httpd_sess_trigger_close(c->hd, c->fd);
+  bool idle = client_try_free(c);
+  xSemaphoreGive(clients_lock);
+  if (idle) notify_active(false);
+  vTaskDelete(NULL);
+}
+
+static bool any_client_has_room() {
+  bool room = false;
+  xSemaphoreTake(clients_lock, portMAX_DELAY);
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    if (clients[i].in_use && !clients[i].closing && uxQueueSpacesAvailable(clients[i].queue) > 0) {
+      room = true;
+      break;
+    }
+  }
+  xSemaphoreGive(clients_lock);
+  return room;
+}
+
+static void publish(stream_frame_t *f) {
+  xSemaphoreTake(clients_lock, portMAX_DELAY);
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    stream_client_t *c = &clients[i];
+    if (!c->in_use || c->closing) continue;
+    f->refs++;
+    if (xQueueSend(c->queue, &f, 0) != pdTRUE) {
+      // Slow client: its queue is full, so it skips this frame
+      f->refs--;
+      c->drops++;
+    }
+  }
+  frames_published.fetch_add(1, std::memory_order_relaxed);
+  xSemaphoreGive(clients_lock);
+
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&pool_mux);
+  if (last_publish_us) {
+    float inst = 1000000.0f / (float)(now - last_publish_us);
+    publish_fps = publish_fps == 0 ? inst : publish_fps * 0.9f + inst * 0.1f;
+  }
+  last_publish_us = now;
+  portEXIT_CRITICAL(&pool_mux);
+}
+
+static void stream_encode_task(void *arg) {
+  (void)arg;
+  while (true) {
+    frame_ref_t ref;
+    if (xQueueReceive(encode_queue, &ref, portMAX_DELAY) != pdTRUE) continue;
+    stream_frame_t *f = frame_encode(&ref);
+    if (!f) continue;
+    publish(f);
+    frame_release(f);
+  }
+}
+
+static void stream_capture_task(void *arg) {
+  (void)arg;
+  bool subscribed = false;
+  while (true) {
+    if (active_clients == 0) {
+      if (subscribed) frame_bus_subscribe(FRAME_BUS_STREAM, false);
+      subscribed = false;
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    if (!subscribed) frame_bus_subscribe(FRAME_BUS_STREAM, true);
+    subscribed = true;
+    // Don't take frames nobody can send
+    if (!any_client_has_room()) {
+      vTaskDelay(pdMS_TO_TICKS(5));
+      continue;
+    }
+
+    frame_ref_t ref;
+    if (!frame_bus_take(FRAME_BUS_STREAM, 0, pdMS_TO_TICKS(1000), &ref)) {
+      ALOGE(ALOG_STREAM, "No frame from the frame bus");
+      capture_failures.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    if (ref.frame->fb->format != PIXFORMAT_JPEG) {
+      // Never wait with a frame in hand: with the encoder's frame and the bus's
+      // latest that would hold every driver buffer. A frame still queued when the
+      // next one arrives is stale, so it is replaced; at most two are held here.
+      frame_ref_t stale;
+      if (xQueueReceive(encode_queue, &stale, 0) == pdTRUE) {
+        frame_bus_release(&stale);
+        encode_skips.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (xQueueSend(encode_queue, &ref, 0) != pdTRUE) frame_bus_release(&ref);
+      continue;
+    }
+    stream_frame_t *f = frame_from_bus(&ref);
+    if (!f) {
+      vTaskDelay(pdMS_TO_TICKS(10));
+      continue;
+    }
+    publish(f);
+    frame_release(f);
+  }
+}
+
+bool stream_broadcaster_begin(void (*on_active)(bool active)) {
+  if (capture_task) return true;
+  active_cb = on_active;
+  clients_lock = xSemaphoreCreateMutex();
+  if (!clients_lock) return false;
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    clients[i].queue = xQueueCreate(STREAM_CLIENT_QUEUE_DEPTH, sizeof(stream_frame_t *));
+    clients[i].send_lock = xSemaphoreCreateMutex();
+    if (!clients[i].queue || !clients[i].send_lock) return false;
+  }
+  encode_queue = xQueueCreate(1, sizeof(frame_ref_t));
+  if (!encode_queue) return false;
+  // Senders run on core 0 with the network stack; the encoder gets core 1
+  if (xTaskCreatePinnedToCore(stream_encode_task, "stream_enc", 6 * 1024, NULL, 2, &encode_task, 1) != pdPASS) return false;
+  return xTaskCreatePinnedToCore(stream_capture_task, "stream_cap", 4 * 1024, NULL, 2, &capture_task, 1) == pdPASS;
+}
+
+esp_err_t stream_broadcaster_subscribe(httpd_req_t *req) {
+  if (!capture_task) return ESP_ERR_INVALID_STATE;
+  int fd = httpd_req_to_sockfd(req);
+
+  stream_client_t *c = NULL;
+  xSemaphoreTake(clients_lock, portMAX_DELAY);
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    if (!clients[i].in_use) {
+      c = &clients[i];
+      break;
+    }
+  }
+  if (c) {
+    c->in_use = true;
+    c->session_open = true;
+    c->sender_running = false;
+    c->closing = false;
+    c->id = ++next_client_id;
+    c->fd = fd;
+    c->hd = req->handle;
+    c->connected_us = esp_timer_get_time();
+    c->last_frame_us = 0;
+    c->fps = 0;
+    c->frames = 0;
+    c->drops = 0;
+    c->bytes = 0;
+    c->send_avg_us = 0;
+    c->send_max_us = 0;
+    active_clients++;
+  }
+  xSemaphoreGive(clients_lock);
+  if (!c) return ESP_ERR_NO_MEM;
+
+  struct sockaddr_in6 addr;
+  socklen_t addr_len = sizeof(addr);
+  c->peer[0] = 0;
+  if (getpeername(fd, (struct sockaddr *)&addr, &addr_len) == 0) {
+    if (addr.sin6_family == AF_INET) {
+      inet_ntop(AF_INET, &((struct sockaddr_in *)&addr)->sin_addr, c->peer, sizeof(c->peer));
+    } else {
+      inet_ntop(AF_INET6, &addr.sin6_addr, c->peer, sizeof(c->peer));
+    }
+  }
+
+  // The socket now belongs to the broadcaster: httpd tells us when it closes
+  req->sess_ctx = c;
+  req->free_ctx = client_session_closed;
+
+  bool ok = httpd_send(req, _STREAM_HEADER, strlen(_STREAM_HEADER)) > 0;
+  if (ok) {
+    c->sender_running = true;
+    ok = xTaskCreatePinnedToCore(client_sender_task, "stream_tx", 4 * 1024, c, 2, NULL, 0) == pdPASS;
+    if (!ok) c->sender_running = false;
+  }
+  if (!ok) {
+    // Give the socket back to httpd (it closes it when we return ESP_FAIL) and recycle the slot
+    req->sess_ctx = NULL;
+    req->free_ctx = NULL;
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    c->session_open = false;
+    client_try_free(c);
+    xSemaphoreGive(clients_lock);
+    return ESP_FAIL;
+  }
+
+  ALOGI(ALOG_STREAM, "Stream client %u subscribed from %s (%d active)", c->id, c->peer, active_clients);
+  if (active_clients == 1) notify_active(true);
+  xTaskNotifyGive(capture_task);
+  return ESP_OK;
+}
+
+int stream_broadcaster_client_count() {
+  return active_clients;
+}
+
+void stream_broadcaster_set_quality(int quality) {
+  encode_quality.store(constrain(quality, 1, 100), std::memory_order_relaxed);
+}
+
+int stream_broadcaster_quality() {
+  return encode_quality.load(std::memory_order_relaxed);
+}
+
+void stream_broadcaster_to_json(cJSON *obj) {
+  int64_t now = esp_timer_get_time();
+  cJSON_AddNumberToObject(obj, "max_clients", STREAM_MAX_CLIENTS);
+  cJSON_AddNumberToObject(obj, "queue_depth", STREAM_CLIENT_QUEUE_DEPTH);
+  cJSON_AddNumberToObject(obj, "frames_published", frames_published.load());
+  cJSON_AddNumberToObject(obj, "capture_failures", capture_failures.load());
+  cJSON_AddNumberToObject(obj, "encode_failures", encode_failures.load());
+
+  portENTER_CRITICAL(&pool_mux);
+  float fps = publish_fps;
+  uint32_t enc = encoded, enc_avg = encode_avg_us, enc_max = encode_max_us, misses = pool_misses, grows = pool_grows;
+  size_t pool_bytes = 0;
+  for (int i = 0; i < STREAM_ENCODE_SLOTS; i++) pool_bytes += pool[i].cap;
+  portEXIT_CRITICAL(&pool_mux);
+  cJSON_AddNumberToObject(obj, "fps", fps);
+  cJSON *je = cJSON_AddObjectToObject(obj, "encoder");
+  cJSON_AddNumberToObject(je, "quality", encode_quality.load());
+  cJSON_AddNumberToObject(je, "frames", enc);
+  cJSON_AddNumberToObject(je, "avg_us", enc_avg);
+  cJSON_AddNumberToObject(je, "max_us", enc_max);
+  cJSON_AddNumberToObject(je, "skipped", encode_skips.load());
+  cJSON_AddNumberToObject(je, "pool_slots", STREAM_ENCODE_SLOTS);
+  cJSON_AddNumberToObject(je, "pool_bytes", pool_bytes);
+  cJSON_AddNumberToObject(je, "pool_misses", misses);
+  cJSON_AddNumberToObject(je, "pool_grows", grows);
+
+  cJSON *list = cJSON_AddArrayToObject(obj, "clients");
+  xSemaphoreTake(clients_lock, portMAX_DELAY);
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    stream_client_t *c = &clients[i];
+    if (!c->in_use) continue;
+    cJSON *jc = cJSON_CreateObject();
+    cJSON_AddNumberToObject(jc, "id", c->id);
+    cJSON_AddStringToObject(jc, "peer", c->peer);
+    cJSON_AddNumberToObject(jc, "fps", c->fps);
+    cJSON_AddNumberToObject(jc, "frames", c->frames);
+    cJSON_AddNumberToObject(jc, "bytes", (double)c->bytes);
+    cJSON_AddNumberToObject(jc, "drops", c->drops);
+    cJSON_AddNumberToObject(jc, "send_avg_us", c->send_avg_us);
+    cJSON_AddNumberToObject(jc, "send_max_us", c->send_max_us);
+    cJSON_AddNumberToObject(jc, "queued", uxQueueMessagesWaiting(c->queue));
+    cJSON_AddNumberToObject(jc, "connected_ms", (double)((now - c->connected_us) / 1000));
+    cJSON_AddItemToArray(list, jc);
+  }
+  xSemaphoreGive(clients_lock);
+}
+
+void stream_broadcaster_metrics(metrics_out_t *out) {
+  metrics_family(out, "stream_frames_total", "counter", "Frames published to /stream clients");
+  metrics_printf(out, METRICS_PREFIX "stream_frames_total %u\n", (unsigned)frames_published.load(std::memory_order_relaxed));
+  metrics_family(out, "stream_capture_failures_total", "counter", "Stream captures that returned no frame");
+  metrics_printf(out, METRICS_PREFIX "stream_capture_failures_total %u\n", (unsigned)capture_failures.load(std::memory_order_relaxed));
+  metrics_family(out, "stream_clients", "gauge", "Connected /stream clients");
+  metrics_printf(out, METRICS_PREFIX "stream_clients %d\n", active_clients);
+
+  portENTER_CRITICAL(&pool_mux);
+  float fps = publish_fps;
+  uint32_t enc = encoded, enc_avg = encode_avg_us;
+  portEXIT_CRITICAL(&pool_mux);
+  metrics_family(out, "stream_fps", "gauge", "Frames per second published to /stream clients (smoothed)");
+  metrics_printf(out, METRICS_PREFIX "stream_fps %.2f\n", fps);
+  metrics_family(out, "stream_encoded_total", "counter", "Non-JPEG frames encoded for /stream");
+  metrics_printf(out, METRICS_PREFIX "stream_encoded_total %u\n", (unsigned)enc);
+  metrics_family(out, "stream_encode_seconds", "gauge", "Smoothed JPEG encode time per frame");
+  metrics_printf(out, METRICS_PREFIX "stream_encode_seconds %.6f\n", enc_avg / 1e6);
+
+  // Per-client series, labelled by client id (ids are not reused until reboot)
+  metrics_family(out, "stream_client_fps", "gauge", "Frames per second sent to the client (smoothed)");
+  xSemaphoreTake(clients_lock, portMAX_DELAY);
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    const stream_client_t *c = &clients[i];
+    if (c->in_use) metrics_printf(out, METRICS_PREFIX "stream_client_fps{client=\"%u\",peer=\"%s\"} %.2f\n", (unsigned)c->id, c->peer, c->fps);
+  }
+  metrics_family(out, "stream_client_send_seconds", "gauge", "Smoothed time to write one frame to the client");
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    const stream_client_t *c = &clients[i];
+    if (c->in_use) metrics_printf(out, METRICS_PREFIX "stream_client_send_seconds{client=\"%u\",peer=\"%s\"} %.6f\n", (unsigned)c->id, c->peer, c->send_avg_us / 1e6);
+  }
+  metrics_family(out, "stream_client_dropped_total", "counter", "Frames skipped because the client's queue was full");
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    const stream_client_t *c = &clients[i];
+    if (c->in_use) metrics_printf(out, METRICS_PREFIX "stream_client_dropped_total{client=\"%u\",peer=\"%s\"} %u\n", (unsigned)c->id, c->peer, (unsigned)c->drops);
+  }
+  xSemaphoreGive(clients_lock);
+}
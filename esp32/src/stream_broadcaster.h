@@ -0,0 +1,44 @@
+#ifndef STREAM_BROADCASTER_H
+#define STREAM_BROADCASTER_H
+
+#include <Arduino.h>
+#include "esp_http_server.h"
+#include "cJSON.h"
+#include "metrics.h"
+
+// MJPEG fan-out for /stream. One loop takes each frame from the frame bus and
+// publishes it once; every subscribed socket gets a reference through its own
+// bounded send queue and is written by its own sender task, so a slow client
+// drops frames instead of stalling the others. JPEG frames are sent straight from
+// the driver buffer while the bus has buffers to spare, and copied otherwise so
+// slow sends never keep the camera without a buffer.
+//
+// Other pixel formats go through an encoder task on the other core from the
+// senders: the loop hands it the next raw frame through a one-deep queue, so frame
+// N+1 is encoded while N is on the wire. The loop never waits on that queue; a
+// newer frame replaces one the encoder has not picked up yet. JPEG output goes into a pool of PSRAM
+// buffers that grow to the largest frame seen and are then reused.
+
+#define STREAM_MAX_CLIENTS 4
+#define STREAM_CLIENT_QUEUE_DEPTH 2
+// Encoder quality for non-JPEG formats (1-100), adjustable as control "stream_quality"
+#define STREAM_ENCODE_QUALITY 80
+// Encoded frames alive at once: one being encoded, a full client queue, one being sent
+#define STREAM_ENCODE_SLOTS (STREAM_CLIENT_QUEUE_DEPTH + 2)
+
+// Start the publishing loop. `on_active` (may be NULL) is called with true when the
+// first client subscribes and false when the last one leaves (e.g. to drive the LED).
+bool stream_broadcaster_begin(void (*on_active)(bool active));
+
+// Take over the socket of a /stream request: sends the multipart response header
+// and registers the socket as a subscriber. Returns ESP_OK when subscribed; the
+// handler must then return without sending anything else.
+esp_err_t stream_broadcaster_subscribe(httpd_req_t *req);
+
+int stream_broadcaster_client_count();
+void stream_broadcaster_set_quality(int quality);
+int stream_broadcaster_quality();
+void stream_broadcaster_to_json(cJSON *obj);
+void stream_broadcaster_metrics(metrics_out_t *out);
+
+#endif // STREAM_BROADCASTER_H
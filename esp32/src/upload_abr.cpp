@@ -0,0 +1,189 @@
+#include "upload_abr.h"
+#include "uploader_config.h"
+
+// Framesizes the controller moves through, smallest first
+static const framesize_t ladder[] = {FRAMESIZE_QQVGA, FRAMESIZE_HQVGA, FRAMESIZE_QVGA, FRAMESIZE_CIF, FRAMESIZE_HVGA, FRAMESIZE_VGA, FRAMESIZE_SVGA};
+#define LADDER_LEN (int)(sizeof(ladder) / sizeof(ladder[0]))
+
+typedef struct {
+  uint32_t at_ms;
+  uint8_t from_step, to_step;
+  uint8_t from_quality, to_quality;
+  uint32_t latency_ms;  // smoothed latency that triggered the decision
+  const char *reason;
+} abr_decision_t;
+
+static int step_min = 0;
+static int step_max = LADDER_LEN - 1;
+static int quality_best = UPLOAD_JPEG_QUALITY;
+static int step = -1;  // current ladder index (-1 = not initialised)
+static int quality = UPLOAD_JPEG_QUALITY;
+
+static float latency_ewma = 0;     // ms, send + response
+static float throughput_ewma = 0;  // bytes per ms while sending
+static float bytes_ewma = 0;
+static uint32_t samples_in_window = 0;
+static uint32_t samples = 0;
+static uint32_t target_ms = UPLOAD_ABR_TARGET_LATENCY_MS;
+
+static abr_decision_t history[UPLOAD_ABR_HISTORY];
+static uint32_t history_count = 0;
+static portMUX_TYPE abr_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Highest ladder index whose width fits in `fs` (0 if none does)
+static int ladder_index(int fs) {
+  if (fs < 0 || fs >= FRAMESIZE_INVALID) return 0;
+  int idx = 0;
+  for (int i = 0; i < LADDER_LEN; i++) {
+    if (resolution[ladder[i]].width <= resolution[fs].width) idx = i;
+  }
+  return idx;
+}
+
+void upload_abr_set_ceiling(int framesize, int q) {
+  portENTER_CRITICAL(&abr_mux);
+  step_max = ladder_index(framesize);
+  step_min = min(ladder_index(UPLOAD_ABR_MIN_FRAME_SIZE), step_max);
+  quality_best = constrain(q, 0, UPLOAD_ABR_WORST_QUALITY);
+  if (step < 0) {
+    // Start from the configured profile
+    step = step_max;
+    quality = quality_best;
+  }
+  step = constrain(step, step_min, step_max);
+  quality = constrain(quality, quality_best, UPLOAD_ABR_WORST_QUALITY);
+  portEXIT_CRITICAL(&abr_mux);
+}
+
+int upload_abr_framesize() {
+#if UPLOAD_ABR_ENABLED
+  return step < 0 ? UPLOAD_FRAME_SIZE : ladder[step];
+#else
+  return step < 0 ? UPLOAD_FRAME_SIZE : ladder[step_max];
+#endif
+}
+
+int upload_abr_quality() {
+#if UPLOAD_ABR_ENABLED
+  return quality;
+#else
+  return quality_best;
+#endif
+}
+
+static void log_decision(uint8_t from_step, uint8_t from_q, const char *reason) {
+  abr_decision_t *d = &history[history_count % UPLOAD_ABR_HISTORY];
+  d->at_ms = millis();
+  d->from_step = from_step;
+  d->to_step = step;
+  d->from_quality = from_q;
+  d->to_quality = quality;
+  d->latency_ms = (uint32_t)latency_ewma;
+  d->reason = reason;
+  history_count++;
+}
+
+// Called with abr_mux held
+static void decide() {
+  int from_step = step;
+  int from_q = quality;
+  const char *reason = NULL;
+
+  if (latency_ewma > target_ms * 1.2f) {
+    // Too slow: cheaper quality first, then a smaller frame (restarting from the best quality)
+    if (quality < UPLOAD_ABR_WORST_QUALITY) {
+      quality = min(quality + UPLOAD_ABR_QUALITY_STEP, UPLOAD_ABR_WORST_QUALITY);
+      reason = "slow: lower quality";
+    } else if (step > step_min) {
+      step--;
+      quality = quality_best;
+      reason = "slow: smaller frame";
+    }
+  } else if (latency_ewma < target_ms * 0.5f) {
+    // Clear headroom: better quality first, then a larger frame at the worst quality
+    if (quality > quality_best) {
+      quality = max(quality - UPLOAD_ABR_QUALITY_STEP, quality_best);
+      reason = "headroom: higher quality";
+    } else if (step < step_max) {
+      step++;
+      quality = UPLOAD_ABR_WORST_QUALITY;
+      reason = "headroom: larger frame";
+    }
+  }
+
+  if (reason) {
+    log_decision(from_step, from_q, reason);
+    // Judge the new operating point on fresh samples only
+    latency_ewma = target_ms;
+  }
+}
+
+void upload_abr_record(size_t bytes, uint32_t send_ms, uint32_t wait_ms, bool ok, uint32_t interval_ms) {
+  uint32_t latency = ok ? send_ms + wait_ms : UPLOAD_RESPONSE_TIMEOUT_MS;
+
+  portENTER_CRITICAL(&abr_mux);
+  // Uploads must also keep up with the capture interval to hold the frame rate
+  target_ms = min((uint32_t)UPLOAD_ABR_TARGET_LATENCY_MS, interval_ms * 8 / 10);
+  latency_ewma = samples ? latency_ewma * 0.7f + latency * 0.3f : latency;
+  if (ok) {
+    bytes_ewma = samples ? bytes_ewma * 0.7f + bytes * 0.3f : bytes;
+    if (send_ms > 0) throughput_ewma = throughput_ewma ? throughput_ewma * 0.7f + (float)bytes / send_ms * 0.3f : (float)bytes / send_ms;
+  }
+  samples++;
+#if UPLOAD_ABR_ENABLED
+  if (step >= 0 && ++samples_in_window >= UPLOAD_ABR_WINDOW) {
+    samples_in_window = 0;
+    decide();
+  }
+#endif
+  portEXIT_CRITICAL(&abr_mux);
+}
+
+static void profile_to_json(cJSON *obj, int s, int q) {
+  cJSON_AddNumberToObject(obj, "framesize", ladder[s]);
+  cJSON_AddNumberToObject(obj, "width", resolution[ladder[s]].width);
+  cJSON_AddNumberToObject(obj, "height", resolution[ladder[s]].height);
+  cJSON_AddNumberToObject(obj, "quality", q);
+}
+
+void upload_abr_to_json(cJSON *obj) {
+  abr_decision_t hist[UPLOAD_ABR_HISTORY];
+  portENTER_CRITICAL(&abr_mux);
+  int cur_step = step < 0 ? ladder_index(UPLOAD_FRAME_SIZE) : step;
+  int cur_q = quality;
+  int smin = step_min, smax = step_max, qbest = quality_best;
+  float lat = latency_ewma, thr = throughput_ewma, by = bytes_ewma;
+  uint32_t n = history_count, target = target_ms, total = samples;
+  memcpy(hist, history, sizeof(hist));
+  portEXIT_CRITICAL(&abr_mux);
+
+  cJSON_AddBoolToObject(obj, "enabled", UPLOAD_ABR_ENABLED);
+  cJSON *current = cJSON_AddObjectToObject(obj, "current");
+  profile_to_json(current, cur_step, cur_q);
+  cJSON *lo = cJSON_AddObjectToObject(obj, "min");
+  profile_to_json(lo, smin, UPLOAD_ABR_WORST_QUALITY);
+  cJSON *hi = cJSON_AddObjectToObject(obj, "max");
+  profile_to_json(hi, smax, qbest);
+
+  cJSON_AddNumberToObject(obj, "target_latency_ms", target);
+  cJSON_AddNumberToObject(obj, "latency_ms", (int)lat);
+  cJSON_AddNumberToObject(obj, "throughput_kbps", (int)(thr * 8));  // bytes/ms * 8 = kbit/s
+  cJSON_AddNumberToObject(obj, "frame_bytes", (int)by);
+  cJSON_AddNumberToObject(obj, "samples", total);
+
+  // Most recent decision first
+  cJSON *list = cJSON_AddArrayToObject(obj, "history");
+  uint32_t kept = min(n, (uint32_t)UPLOAD_ABR_HISTORY);
+  for (uint32_t i = 0; i < kept; i++) {
+    const abr_decision_t *d = &hist[(n - 1 - i) % UPLOAD_ABR_HISTORY];
+    cJSON *jd = cJSON_CreateObject();
+    cJSON_AddNumberToObject(jd, "at_ms", d->at_ms);
+    cJSON_AddStringToObject(jd, "reason", d->reason);
+    cJSON_AddNumberToObject(jd, "latency_ms", d->latency_ms);
+    cJSON *from = cJSON_AddObjectToObject(jd, "from");
+    profile_to_json(from, d->from_step, d->from_quality);
+    cJSON *to = cJSON_AddObjectToObject(jd, "to");
+    profile_to_json(to, d->to_step, d->to_quality);
+    cJSON_AddItemToArray(list, jd);
+  }
+}
@@ -0,0 +1,25 @@
+#ifndef UPLOAD_ABR_H
+#define UPLOAD_ABR_H
+
+#include <Arduino.h>
+#include "esp_camera.h"
+#include "cJSON.h"
+
+// Closed-loop upload profile. Every upload reports its frame size in bytes and
+// how long the send and the gateway's response took; after each window of
+// samples the controller steps JPEG quality and framesize down when uploads are
+// slower than the target, and back up when there is clear headroom. The stored
+// uploader framesize/quality act as the ceiling (best profile allowed).
+
+#define UPLOAD_ABR_HISTORY 16
+
+// Recompute the bounds from the stored settings; cheap enough to call per frame
+void upload_abr_set_ceiling(int framesize, int quality);
+// Profile to use for the next upload
+int upload_abr_framesize();
+int upload_abr_quality();
+// Feed one upload result. `ok` false (timeouts, errors) counts as a slow upload.
+void upload_abr_record(size_t bytes, uint32_t send_ms, uint32_t wait_ms, bool ok, uint32_t interval_ms);
+void upload_abr_to_json(cJSON *obj);
+
+#endif // UPLOAD_ABR_H
@@ -0,0 +1,104 @@
+#include "upload_breaker.h"
+#include "uploader_config.h"
+
+static upload_breaker_state_t state = UPLOAD_BREAKER_CLOSED;
+static uint32_t consecutive_failures = 0;
+static uint32_t next_attempt_ms = 0;  // no request before this time
+static uint32_t backoff_ms = 0;       // last backoff, input to the next jittered one
+static bool backoff_pending = false;
+
+static uint32_t trips = 0;
+static uint32_t probes = 0;
+static uint32_t recoveries = 0;
+static portMUX_TYPE breaker_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Decorrelated jitter: random in [base, 3 * previous], capped
+static uint32_t next_backoff(uint32_t base, uint32_t cap, uint32_t prev) {
+  uint32_t hi = prev < base ? base : prev;
+  hi = hi > cap / 3 ? cap : hi * 3;
+  uint32_t v = base + (hi > base ? esp_random() % (hi - base + 1) : 0);
+  return v > cap ? cap : v;
+}
+
+void upload_breaker_init() {
+  portENTER_CRITICAL(&breaker_mux);
+  state = UPLOAD_BREAKER_CLOSED;
+  consecutive_failures = 0;
+  backoff_ms = 0;
+  backoff_pending = false;
+  portEXIT_CRITICAL(&breaker_mux);
+}
+
+bool upload_breaker_allow(uint32_t now_ms) {
+  bool allow = false;
+  portENTER_CRITICAL(&breaker_mux);
+  bool due = !backoff_pending || (int32_t)(now_ms - next_attempt_ms) >= 0;
+  if (state == UPLOAD_BREAKER_CLOSED) {
+    allow = due;
+  } else if (state == UPLOAD_BREAKER_OPEN && due) {
+    state = UPLOAD_BREAKER_HALF_OPEN;
+    probes++;
+    allow = true;
+  }
+  portEXIT_CRITICAL(&breaker_mux);
+  return allow;
+}
+
+void upload_breaker_success(uint32_t now_ms) {
+  (void)now_ms;
+  portENTER_CRITICAL(&breaker_mux);
+  if (state != UPLOAD_BREAKER_CLOSED) recoveries++;
+  state = UPLOAD_BREAKER_CLOSED;
+  consecutive_failures = 0;
+  backoff_ms = 0;
+  backoff_pending = false;
+  portEXIT_CRITICAL(&breaker_mux);
+}
+
+void upload_breaker_failure(uint32_t now_ms) {
+  portENTER_CRITICAL(&breaker_mux);
+  consecutive_failures++;
+  if (state == UPLOAD_BREAKER_HALF_OPEN || consecutive_failures >= UPLOAD_BREAKER_THRESHOLD) {
+    if (state == UPLOAD_BREAKER_CLOSED) {
+      trips++;
+      backoff_ms = 0;
+    }
+    state = UPLOAD_BREAKER_OPEN;
+    backoff_ms = next_backoff(UPLOAD_BREAKER_PROBE_MIN_MS, UPLOAD_BREAKER_PROBE_MAX_MS, backoff_ms);
+  } else {
+    backoff_ms = next_backoff(UPLOAD_RETRY_BASE_MS, UPLOAD_RETRY_CAP_MS, backoff_ms);
+  }
+  next_attempt_ms = now_ms + backoff_ms;
+  backoff_pending = true;
+  portEXIT_CRITICAL(&breaker_mux);
+}
+
+uint32_t upload_breaker_wait_ms(uint32_t now_ms) {
+  portENTER_CRITICAL(&breaker_mux);
+  int32_t left = backoff_pending ? (int32_t)(next_attempt_ms - now_ms) : 0;
+  if (state == UPLOAD_BREAKER_HALF_OPEN) left = 0;
+  portEXIT_CRITICAL(&breaker_mux);
+  return left > 0 ? (uint32_t)left : 0;
+}
+
+upload_breaker_state_t upload_breaker_state() {
+  return state;
+}
+
+const char *upload_breaker_state_name(upload_breaker_state_t st) {
+  switch (st) {
+    case UPLOAD_BREAKER_OPEN: return "open";
+    case UPLOAD_BREAKER_HALF_OPEN: return "half_open";
+    default: return "closed";
+  }
+}
+
+void upload_breaker_to_json(cJSON *obj, uint32_t now_ms) {
+  cJSON_AddStringToObject(obj, "state", upload_breaker_state_name(state));
+  cJSON_AddNumberToObject(obj, "consecutive_failures", consecutive_failures);
+  cJSON_AddNumberToObject(obj, "backoff_ms", backoff_ms);
+  cJSON_AddNumberToObject(obj, "next_attempt_in_ms", upload_breaker_wait_ms(now_ms));
+  cJSON_AddNumberToObject(obj, "trips", trips);
+  cJSON_AddNumberToObject(obj, "probes", probes);
+  cJSON_AddNumberToObject(obj, "recoveries", recoveries);
+}
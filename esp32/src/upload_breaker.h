@@ -0,0 +1,30 @@
+#ifndef UPLOAD_BREAKER_H
+#define UPLOAD_BREAKER_H
+
+#include <Arduino.h>
+#include "cJSON.h"
+
+// Retry scheduler and circuit breaker for gateway requests. The upload task asks
+// before every request instead of sleeping between retries: while a backoff is
+// pending (or the gateway is marked down) frames are queued rather than sent.
+// Time is passed in by the caller so the state machine has no hidden clock.
+
+typedef enum {
+  UPLOAD_BREAKER_CLOSED = 0,     // gateway healthy, failures are retried after a jittered backoff
+  UPLOAD_BREAKER_OPEN = 1,       // gateway down, nothing is sent until the probe time
+  UPLOAD_BREAKER_HALF_OPEN = 2,  // one probe request in flight
+} upload_breaker_state_t;
+
+void upload_breaker_init();
+// True if a request may go out at `now_ms`. An OPEN breaker whose probe time has
+// come turns HALF_OPEN and lets exactly this one request through.
+bool upload_breaker_allow(uint32_t now_ms);
+void upload_breaker_success(uint32_t now_ms);
+void upload_breaker_failure(uint32_t now_ms);
+// Milliseconds until the next request is allowed (0 = now)
+uint32_t upload_breaker_wait_ms(uint32_t now_ms);
+upload_breaker_state_t upload_breaker_state();
+const char *upload_breaker_state_name(upload_breaker_state_t state);
+void upload_breaker_to_json(cJSON *obj, uint32_t now_ms);
+
+#endif // UPLOAD_BREAKER_H
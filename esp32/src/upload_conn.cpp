@@ -0,0 +1,475 @@
+#include "upload_conn.h"
+#include "uploader_config.h"
+#include "async_log.h"
+#include "esp_timer.h"
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <atomic>
+#include <strings.h>
+#include "lwip/dns.h"
+#include "lwip/priv/tcpip_priv.h"
+
+// Internal marker: the request failed before any response byte on a reused socket
+#define CONN_STALE (-100)
+
+// TLS client that connects to an address resolved by conn_resolve(); the host name
+// is only used for SNI, so the library does not look it up a second time
+class upload_tls_client : public WiFiClientSecure {
+ public:
+  int connect_addr(IPAddress ip, uint16_t port, const char *host, int32_t timeout_ms) {
+    _timeout = timeout_ms;
+    return WiFiClientSecure::connect(ip, port, host, NULL, NULL, NULL);
+  }
+};
+
+bool upload_target_parse(const char *url, upload_target_t *out) {
+  if (!url || !out) return false;
+  memset(out, 0, sizeof(*out));
+
+  const char *p = url;
+  if (!strncasecmp(p, "https://", 8)) {
+    out->tls = true;
+    p += 8;
+  } else if (!strncasecmp(p, "http://", 7)) {
+    p += 7;
+  }
+  out->port = out->tls ? 443 : 80;
+
+  // host[:port] runs until the first '/'
+  const char *slash = strchr(p, '/');
+  size_t hostport_len = slash ? (size_t)(slash - p) : strlen(p);
+  const char *colon = (const char *)memchr(p, ':', hostport_len);
+  size_t host_len = colon ? (size_t)(colon - p) : hostport_len;
+  if (host_len == 0 || host_len >= sizeof(out->host)) return false;
+  memcpy(out->host, p, host_len);
+  out->host[host_len] = 0;
+
+  if (colon) {
+    int port = atoi(colon + 1);
+    if (port <= 0 || port > 65535) return false;
+    out->port = (uint16_t)port;
+  }
+
+  const char *path = slash ? slash : "/";
+  if (strlen(path) >= sizeof(out->path)) return false;
+  strcpy(out->path, path);
+  return true;
+}
+
+void upload_conn_init(upload_conn_t *c) {
+  memset(c, 0, sizeof(*c));
+}
+
+void upload_conn_close(upload_conn_t *c) {
+  if (c->client) {
+    c->client->stop();
+  }
+  c->open = false;
+}
+
+bool upload_conn_set_url(upload_conn_t *c, const char *url) {
+  if (c->target_valid && !strcmp(c->url, url)) return true;
+
+  upload_conn_close(c);
+  c->target_valid = false;
+  c->addr = 0;
+  if (strlen(url) >= sizeof(c->url)) return false;
+  strcpy(c->url, url);
+  c->target_valid = upload_target_parse(url, &c->target);
+  if (c->target_valid) {
+    ALOGI(ALOG_CONN, "[conn] target %s://%s:%u%s", c->target.tls ? "https" : "http", c->target.host, c->target.port, c->target.path);
+  } else {
+    ALOGW(ALOG_CONN, "[conn] could not parse upload URL '%s'", url);
+  }
+  return c->target_valid;
+}
+
+static void conn_phase(upload_conn_t *c, upload_phase_t phase, int64_t begin_us) {
+  if (c->span) upload_span_phase(c->span, phase, begin_us, esp_timer_get_time());
+}
+
+// One lookup, shared by the waiting task and the lwIP callback. Whichever lets go
+// last frees it, so a lookup that outlives its deadline completes harmlessly.
+typedef struct {
+  SemaphoreHandle_t done;
+  std::atomic<int> refs;
+  uint32_t addr;  // 0 = not found
+} dns_wait_t;
+
+typedef struct {
+  struct tcpip_api_call_data call;  // must be first
+  const char *host;
+  dns_wait_t *wait;
+  ip_addr_t addr;
+  err_t err;
+} dns_call_t;
+
+static void dns_wait_put(dns_wait_t *w) {
+  if (w->refs.fetch_sub(1) == 1) {
+    vSemaphoreDelete(w->done);
+    delete w;
+  }
+}
+
+static void dns_found(const char *name, const ip_addr_t *ipaddr, void *arg) {
+  (void)name;
+  dns_wait_t *w = (dns_wait_t *)arg;
+  if (ipaddr && IP_IS_V4(ipaddr)) w->addr = ip4_addr_get_u32(ip_2_ip4(ipaddr));
+  xSemaphoreGive(w->done);
+  dns_wait_put(w);
+}
+
+// Runs in the lwIP thread
+static err_t dns_start(struct tcpip_api_call_data *data) {
+  dns_call_t *d = (dns_call_t *)data;
+  d->err = dns_gethostbyname_addrtype(d->host, &d->addr, dns_found, d->wait, LWIP_DNS_ADDRTYPE_IPV4);
+  return d->err;
+}
+
+// Look `host` up, giving up after `timeout_ms` (lwIP itself retries for much longer)
+static uint32_t dns_lookup(const char *host, uint32_t timeout_ms) {
+  dns_wait_t *w = new dns_wait_t;
+  w->done = xSemaphoreCreateBinary();
+  if (!w->done) {
+    delete w;
+    return 0;
+  }
+  w->refs.store(2);
+  w->addr = 0;
+  dns_call_t d = {};
+  d.host = host;
+  d.wait = w;
+  tcpip_api_call(dns_start, &d.call);
+
+  uint32_t addr = 0;
+  if (d.err == ERR_OK) {
+    // Answered from the cache; the callback will not run
+    if (IP_IS_V4(&d.addr)) addr = ip4_addr_get_u32(ip_2_ip4(&d.addr));
+    dns_wait_put(w);
+  } else if (d.err == ERR_INPROGRESS) {
+    if (xSemaphoreTake(w->done, pdMS_TO_TICKS(timeout_ms)) == pdTRUE) addr = w->addr;
+  } else {
+    dns_wait_put(w);
+  }
+  dns_wait_put(w);
+  return addr;
+}
+
+// Resolve the gateway once and keep the address until it expires or a connect fails
+static bool conn_resolve(upload_conn_t *c) {
+  if (c->addr && millis() - c->resolved_at < UPLOAD_DNS_TTL_MS) return true;
+  IPAddress ip;
+  if (!ip.fromString(c->target.host)) {
+    unsigned long start = millis();
+    int64_t start_us = esp_timer_get_time();
+    c->stats.dns_lookups++;
+    ip = IPAddress(dns_lookup(c->target.host, UPLOAD_DNS_TIMEOUT_MS));
+    conn_phase(c, UPLOAD_PHASE_DNS, start_us);
+    if ((uint32_t)ip == 0) {
+      c->stats.dns_failures++;
+      ALOGW(ALOG_CONN, "[conn] DNS lookup for %s failed after %u ms", c->target.host, (unsigned)(millis() - start));
+      return false;
+    }
+  }
+  c->addr = (uint32_t)ip;
+  c->resolved_at = millis();
+  return true;
+}
+
+static int conn_open(upload_conn_t *c) {
+  if (c->client && c->client_tls != c->target.tls) {
+    delete c->client;
+    c->client = NULL;
+  }
+  if (!c->client) {
+    if (c->target.tls) {
+      upload_tls_client *sc = new upload_tls_client();
+      // NOTE: setInsecure() is convenient for testing but not recommended for production
+      sc->setInsecure();
+      sc->setHandshakeTimeout((UPLOAD_TLS_TIMEOUT_MS + 999) / 1000);
+      c->client = sc;
+    } else {
+      c->client = new WiFiClient();
+    }
+    c->client_tls = c->target.tls;
+  }
+
+  if (c->target.tls) {
+    // Connect to the address resolved here (with its own deadline and DNS error);
+    // the host name only goes into SNI. TCP connect and handshake are one call.
+    if (!conn_resolve(c)) return UPLOAD_CONN_ERR_DNS;
+    upload_tls_client *sc = static_cast<upload_tls_client *>(c->client);
+    int64_t tls_start = esp_timer_get_time();
+    bool connected = sc->connect_addr(IPAddress(c->addr), c->target.port, c->target.host, UPLOAD_CONNECT_TIMEOUT_MS);
+    conn_phase(c, UPLOAD_PHASE_TLS, tls_start);
+    if (!connected) {
+      char err[64];
+      bool tls_err = sc->lastError(err, sizeof(err)) != 0;
+      upload_conn_close(c);
+      c->addr = 0;
+      if (tls_err) {
+        c->stats.tls_failures++;
+        ALOGW(ALOG_CONN, "[conn] TLS handshake with %s failed: %s", c->target.host, err);
+        return UPLOAD_CONN_ERR_TLS;
+      }
+      c->stats.connect_failures++;
+      return UPLOAD_CONN_ERR_CONNECT;
+    }
+  } else {
+    if (!conn_resolve(c)) return UPLOAD_CONN_ERR_DNS;
+    int64_t connect_start = esp_timer_get_time();
+    bool connected = c->client->connect(IPAddress(c->addr), c->target.port, UPLOAD_CONNECT_TIMEOUT_MS);
+    conn_phase(c, UPLOAD_PHASE_CONNECT, connect_start);
+    if (!connected) {
+      upload_conn_close(c);
+      c->addr = 0;  // the address may have moved: resolve again next time
+      c->stats.connect_failures++;
+      return UPLOAD_CONN_ERR_CONNECT;
+    }
+    c->client->setNoDelay(true);
+  }
+  c->open = true;
+
+  c->stats.connects++;
+  if (c->was_connected) c->stats.reconnects++;
+  c->was_connected = true;
+  return 0;
+}
+
+// Read one byte, waiting until `deadline` (millis). -1 = closed, -2 = timed out.
+static int conn_read_byte(WiFiClient *cl, unsigned long deadline) {
+  while (!cl->available()) {
+    if (!cl->connected()) return -1;
+    if ((long)(millis() - deadline) >= 0) return -2;
+    vTaskDelay(1);
+  }
+  return cl->read();
+}
+
+// Read a CRLF-terminated line (without the terminator). Returns its length or a negative read error.
+static int conn_read_line(WiFiClient *cl, char *line, size_t cap, unsigned long deadline) {
+  size_t n = 0;
+  while (true) {
+    int ch = conn_read_byte(cl, deadline);
+    if (ch < 0) return ch;
+    if (ch == '\n') break;
+    if (ch != '\r' && n + 1 < cap) line[n++] = (char)ch;
+  }
+  line[n] = 0;
+  return (int)n;
+}
+
+// Read `len` body bytes, keeping what fits into resp. Returns false on timeout/close.
+static bool conn_read_body(WiFiClient *cl, size_t len, char *resp, size_t resp_cap, size_t *resp_len, unsigned long deadline) {
+  uint8_t scratch[128];
+  while (len > 0) {
+    int avail = cl->available();
+    if (avail <= 0) {
+      if (!cl->connected()) return false;
+      if ((long)(millis() - deadline) >= 0) return false;
+      vTaskDelay(1);
+      continue;
+    }
+    size_t want = min(len, min((size_t)avail, sizeof(scratch)));
+    int got = cl->read(scratch, want);
+    if (got <= 0) return false;
+    if (resp && *resp_len + 1 < resp_cap) {
+      size_t keep = min((size_t)got, resp_cap - 1 - *resp_len);
+      memcpy(resp + *resp_len, scratch, keep);
+      *resp_len += keep;
+    }
+    len -= got;
+  }
+  return true;
+}
+
+// Whether a final response carries a body at all (RFC 9112 6.3)
+static bool response_has_body(const char *method, int status) {
+  if (!strcmp(method, "HEAD")) return false;
+  return status != 204 && status != 304;
+}
+
+static int conn_exchange(upload_conn_t *c, const char *path, const char *content_type, const upload_header_t *headers, size_t nheaders,
+                         const uint8_t *body, size_t len, char *resp, size_t resp_cap, bool *keep_alive) {
+  WiFiClient *cl = c->client;
+  *keep_alive = true;
+
+  static const char *const method = "POST";
+  char hdr[1280];
+  char port_suffix[8] = "";
+  if (c->target.port != (c->target.tls ? 443 : 80)) snprintf(port_suffix, sizeof(port_suffix), ":%u", c->target.port);
+  int n = snprintf(hdr, sizeof(hdr),
+                   "%s %s HTTP/1.1\r\nHost: %s%s\r\nConnection: keep-alive\r\nContent-Type: %s\r\nContent-Length: %u\r\n",
+                   method, path, c->target.host, port_suffix, content_type, (unsigned)len);
+  for (size_t i = 0; i < nheaders && n > 0 && n < (int)sizeof(hdr); i++) {
+    if (!headers[i].value || !headers[i].value[0]) continue;
+    n += snprintf(hdr + n, sizeof(hdr) - n, "%s: %s\r\n", headers[i].name, headers[i].value);
+  }
+  if (n <= 0 || n + 2 >= (int)sizeof(hdr)) return UPLOAD_CONN_ERR_WRITE;
+  hdr[n++] = '\r';
+  hdr[n++] = '\n';
+
+  // Headers then the body straight from the caller's buffer, in chunks so the send deadline is checked
+  unsigned long send_start = millis();
+  int64_t send_start_us = esp_timer_get_time();
+  if (cl->write((const uint8_t *)hdr, n) != (size_t)n) return CONN_STALE;
+  unsigned long send_deadline = millis() + UPLOAD_SEND_TIMEOUT_MS;
+  size_t sent = 0;
+  while (sent < len) {
+    if ((long)(millis() - send_deadline) >= 0) {
+      c->stats.send_timeouts++;
+      return UPLOAD_CONN_ERR_TIMEOUT;
+    }
+    size_t w = cl->write(body + sent, min(len - sent, (size_t)UPLOAD_SEND_CHUNK_BYTES));
+    if (w == 0) return sent == 0 ? CONN_STALE : UPLOAD_CONN_ERR_WRITE;
+    sent += w;
+  }
+  c->stats.bytes_sent += n + len;
+  unsigned long wait_start = millis();
+  c->last_send_ms = wait_start - send_start;
+  int64_t wait_start_us = esp_timer_get_time();
+  conn_phase(c, UPLOAD_PHASE_WRITE, send_start_us);
+
+  unsigned long deadline = millis() + UPLOAD_RESPONSE_TIMEOUT_MS;
+  char line[160];
+  int r;
+  int status = 0;
+  int64_t status_us = 0;
+  long content_length = -1;
+  bool chunked = false;
+  bool close_delimited = false;  // server announced it will close after this response
+  // Interim 1xx responses (e.g. 100 Continue) carry no body; the final one follows
+  do {
+    r = conn_read_line(cl, line, sizeof(line), deadline);
+    if (!status_us) {
+      status_us = esp_timer_get_time();
+      if (r >= 0) conn_phase(c, UPLOAD_PHASE_TTFB, wait_start_us);
+      if (r == -1) return CONN_STALE;  // peer closed before answering: the kept-alive socket was dead
+    }
+    if (r < 0) {
+      c->stats.response_timeouts++;
+      return UPLOAD_CONN_ERR_TIMEOUT;
+    }
+    if (strncmp(line, "HTTP/1.", 7) != 0) return UPLOAD_CONN_ERR_PROTOCOL;
+    const char *sp = strchr(line, ' ');
+    status = sp ? atoi(sp + 1) : 0;
+    if (status <= 0) return UPLOAD_CONN_ERR_PROTOCOL;
+    bool http10 = !strncmp(line, "HTTP/1.0", 8);
+    *keep_alive = !http10;
+    close_delimited = http10;
+
+    content_length = -1;
+    chunked = false;
+    while (true) {
+      r = conn_read_line(cl, line, sizeof(line), deadline);
+      if (r < 0) return UPLOAD_CONN_ERR_TIMEOUT;
+      if (r == 0) break;
+      if (!strncasecmp(line, "Content-Length:", 15)) {
+        content_length = atol(line + 15);
+      } else if (!strncasecmp(line, "Transfer-Encoding:", 18) && strcasestr(line + 18, "chunked")) {
+        chunked = true;
+      } else if (!strncasecmp(line, "Connection:", 11)) {
+        if (strcasestr(line + 11, "close")) {
+          *keep_alive = false;
+          close_delimited = true;
+        }
+        if (strcasestr(line + 11, "keep-alive")) *keep_alive = true;
+      }
+    }
+  } while (status >= 100 && status < 200);
+
+  size_t resp_len = 0;
+  if (!response_has_body(method, status)) {
+    // 204, 304 and HEAD responses end with the headers, whatever they announce (RFC 9112 6.3)
+  } else if (chunked) {
+    while (true) {
+      r = conn_read_line(cl, line, sizeof(line), deadline);
+      if (r < 0) return UPLOAD_CONN_ERR_TIMEOUT;
+      size_t chunk = strtoul(line, NULL, 16);
+      if (chunk == 0) {
+        // skip trailers up to the terminating empty line
+        do {
+          r = conn_read_line(cl, line, sizeof(line), deadline);
+        } while (r > 0);
+        if (r < 0) return UPLOAD_CONN_ERR_TIMEOUT;
+        break;
+      }
+      if (!conn_read_body(cl, chunk, resp, resp_cap, &resp_len, deadline)) return UPLOAD_CONN_ERR_TIMEOUT;
+      if (conn_read_line(cl, line, sizeof(line), deadline) < 0) return UPLOAD_CONN_ERR_TIMEOUT;
+    }
+  } else if (content_length >= 0) {
+    if (!conn_read_body(cl, (size_t)content_length, resp, resp_cap, &resp_len, deadline)) return UPLOAD_CONN_ERR_TIMEOUT;
+  } else if (close_delimited) {
+    // No length: body runs until the server closes the connection
+    *keep_alive = false;
+    conn_read_body(cl, SIZE_MAX, resp, resp_cap, &resp_len, deadline);
+  } else {
+    // No length on a connection the server keeps open: the end of the body cannot
+    // be found, so take none and drop the socket rather than wait for the deadline
+    *keep_alive = false;
+  }
+  if (resp && resp_cap > 0) resp[resp_len] = 0;
+  c->last_wait_ms = millis() - wait_start;
+  conn_phase(c, UPLOAD_PHASE_RESPONSE, status_us);
+  return status;
+}
+
+int upload_conn_post(upload_conn_t *c, const char *path, const char *content_type, const upload_header_t *headers, size_t nheaders,
+                     const uint8_t *body, size_t len, char *resp, size_t resp_cap) {
+  if (resp && resp_cap > 0) resp[0] = 0;
+  if (!c->target_valid) return UPLOAD_CONN_ERR_URL;
+  if (!path) path = c->target.path;
+  c->stats.requests++;
+
+  // A kept-alive socket may have been closed by the gateway while idle; in that
+  // case reconnect and resend once before reporting a failure.
+  for (int pass = 0; pass < 2; pass++) {
+    bool reused = c->open && c->client->connected();
+    if (c->span) c->span->reused = reused;
+    if (reused) {
+      c->stats.reused++;
+    } else {
+      int err = conn_open(c);
+      if (err < 0) {
+        c->stats.failures++;
+        return err;
+      }
+    }
+
+    bool keep_alive = false;
+    int rc = conn_exchange(c, path, content_type, headers, nheaders, body, len, resp, resp_cap, &keep_alive);
+    if (rc == CONN_STALE && reused && pass == 0) {
+      c->stats.stale_retries++;
+      upload_conn_close(c);
+      continue;
+    }
+    if (rc == CONN_STALE) rc = UPLOAD_CONN_ERR_WRITE;
+    if (rc < 0) {
+      c->stats.failures++;
+      upload_conn_close(c);
+    } else if (!keep_alive) {
+      upload_conn_close(c);
+    }
+    return rc;
+  }
+  return UPLOAD_CONN_ERR_CONNECT;
+}
+
+void upload_conn_stats_to_json(const upload_conn_t *c, cJSON *obj) {
+  cJSON_AddStringToObject(obj, "host", c->target_valid ? c->target.host : "");
+  cJSON_AddBoolToObject(obj, "tls", c->target.tls);
+  cJSON_AddBoolToObject(obj, "connected", c->open);
+  cJSON_AddNumberToObject(obj, "requests", c->stats.requests);
+  cJSON_AddNumberToObject(obj, "reused", c->stats.reused);
+  cJSON_AddNumberToObject(obj, "connects", c->stats.connects);
+  cJSON_AddNumberToObject(obj, "reconnects", c->stats.reconnects);
+  cJSON_AddNumberToObject(obj, "stale_retries", c->stats.stale_retries);
+  cJSON_AddNumberToObject(obj, "failures", c->stats.failures);
+  cJSON_AddNumberToObject(obj, "bytes_sent", c->stats.bytes_sent);
+  cJSON_AddNumberToObject(obj, "dns_lookups", c->stats.dns_lookups);
+  cJSON_AddNumberToObject(obj, "dns_failures", c->stats.dns_failures);
+  cJSON_AddNumberToObject(obj, "connect_failures", c->stats.connect_failures);
+  cJSON_AddNumberToObject(obj, "tls_failures", c->stats.tls_failures);
+  cJSON_AddNumberToObject(obj, "send_timeouts", c->stats.send_timeouts);
+  cJSON_AddNumberToObject(obj, "response_timeouts", c->stats.response_timeouts);
+}
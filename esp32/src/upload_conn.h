@@ -0,0 +1,80 @@
+#ifndef UPLOAD_CONN_H
+#define UPLOAD_CONN_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include "cJSON.h"
+#include "upload_trace.h"
+
+// Minimal HTTP/1.1 client that keeps one keep-alive connection per gateway.
+// The URL is parsed once (and again only when it changes); request bodies are
+// written straight from the caller's buffer, so a frame is never copied into a String.
+// Every phase has its own deadline (UPLOAD_DNS/CONNECT/TLS/SEND/RESPONSE_TIMEOUT_MS)
+// and fails with its own error code, so a dead gateway is detected quickly.
+
+#define UPLOAD_CONN_ERR_URL      (-1)  // URL could not be parsed
+#define UPLOAD_CONN_ERR_CONNECT  (-2)  // TCP/TLS connection failed
+#define UPLOAD_CONN_ERR_WRITE    (-3)  // request headers or body could not be written
+#define UPLOAD_CONN_ERR_TIMEOUT  (-4)  // no (complete) response before the deadline
+#define UPLOAD_CONN_ERR_PROTOCOL (-5)  // malformed response
+#define UPLOAD_CONN_ERR_DNS      (-6)  // host name did not resolve in time
+#define UPLOAD_CONN_ERR_TLS      (-7)  // TCP connected but the TLS handshake failed
+
+typedef struct {
+  bool tls;
+  char host[96];
+  uint16_t port;
+  char path[128];
+} upload_target_t;
+
+typedef struct {
+  const char *name;
+  const char *value;
+} upload_header_t;
+
+typedef struct {
+  uint32_t requests;     // requests attempted
+  uint32_t reused;       // requests sent on an already-open connection
+  uint32_t connects;     // new TCP/TLS connections opened
+  uint32_t reconnects;   // connections reopened after the previous one dropped
+  uint32_t stale_retries;  // requests resent because a kept-alive socket had gone stale
+  uint32_t failures;     // requests that ended with an error code
+  uint32_t bytes_sent;
+  uint32_t dns_lookups;  // resolver calls (the address is cached for UPLOAD_DNS_TTL_MS)
+  uint32_t dns_failures;
+  uint32_t connect_failures;
+  uint32_t tls_failures;
+  uint32_t send_timeouts;
+  uint32_t response_timeouts;
+} upload_conn_stats_t;
+
+typedef struct {
+  char url[256];
+  upload_target_t target;
+  bool target_valid;
+  WiFiClient *client;   // WiFiClientSecure when target.tls
+  bool client_tls;
+  bool open;            // socket currently established (tracked by the owning task)
+  bool was_connected;   // a connection existed before, so the next connect is a reconnect
+  uint32_t addr;        // cached IPv4 address of target.host (0 = resolve again)
+  unsigned long resolved_at;
+  upload_conn_stats_t stats;
+  uint32_t last_send_ms;  // last request: writing headers + body
+  uint32_t last_wait_ms;  // last request: body written -> response complete
+  upload_span_t *span;    // when set, the next requests record their phase timings here
+} upload_conn_t;
+
+bool upload_target_parse(const char *url, upload_target_t *out);
+
+void upload_conn_init(upload_conn_t *c);
+// Point the connection at `url`. Re-parses and drops the socket only if the URL changed.
+bool upload_conn_set_url(upload_conn_t *c, const char *url);
+// POST `body` to `path` (NULL = path of the configured URL). Returns the HTTP status
+// code or a negative UPLOAD_CONN_ERR_*. Up to resp_cap-1 bytes of the response body
+// are copied to `resp` (may be NULL); the rest is drained so the socket can be reused.
+int upload_conn_post(upload_conn_t *c, const char *path, const char *content_type, const upload_header_t *headers, size_t nheaders,
+                     const uint8_t *body, size_t len, char *resp, size_t resp_cap);
+void upload_conn_close(upload_conn_t *c);
+void upload_conn_stats_to_json(const upload_conn_t *c, cJSON *obj);
+
+#endif // UPLOAD_CONN_H
@@ -0,0 +1,534 @@
+#include "upload_queue.h"
+#include "uploader_config.h"
+#include "async_log.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include <LittleFS.h>
+#include <algorithm>
+
+#define QUEUE_DIR "/uploadq"
+#define SEG_MAGIC 0x5351434EUL  // "NCQS"
+#define SEG_VERSION 2     // version 1 records have no CRC; such segments are still read
+#define REC_MAGIC 0xA55A
+#define REC_LIVE 0xFF
+#define REC_CONSUMED 0x00  // only clears bits, so marking a record is a plain flash write
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t id;
+  uint32_t reserved2;
+} seg_header_t;
+
+typedef struct __attribute__((packed)) {
+  uint16_t magic;
+  uint8_t state;  // REC_LIVE until drained
+  uint8_t flags;
+  uint32_t len;
+  uint32_t lsn;   // append order, kept when a record is compacted
+  uint32_t seq;
+  uint32_t ts_sec;
+  uint32_t ts_usec;
+  uint32_t crc;   // over len..ts_usec and the payload
+} rec_header_t;
+
+#define REC_V1_BYTES offsetof(rec_header_t, crc)
+
+typedef struct {
+  uint32_t id;
+  uint32_t file_bytes;
+  uint32_t live_bytes;
+  uint16_t live_count;
+  uint16_t rec_hdr;  // record header bytes in this segment (by version)
+} seg_info_t;
+
+typedef struct {
+  uint32_t seg;
+  uint32_t offset;  // record header offset within the segment file
+  uint32_t len;
+  uint32_t lsn;
+  uint32_t seq;
+  uint32_t ts_sec;
+  uint32_t ts_usec;
+  uint32_t crc;
+} rec_info_t;
+
+static bool attempted = false;
+static bool ready = false;
+static size_t budget = 0;
+static size_t segment_bytes = 0;
+static upload_queue_policy_t policy = UPLOAD_QUEUE_FIFO;
+static int max_frames = UPLOAD_QUEUE_MAX_FRAMES;
+
+static seg_info_t *segs = NULL;  // ascending id
+static int seg_count = 0;
+static int seg_cap = 0;
+static rec_info_t *recs = NULL;  // live records, ascending lsn
+static int rec_count = 0;
+static uint32_t active_seg = 0;  // segment receiving appends (0 = start a new one)
+static uint32_t next_seg = 1;
+static uint32_t next_lsn = 1;
+
+static uint8_t *io_buf = NULL;
+static size_t io_cap = 0;
+
+static upload_queue_stats_t stats;
+
+static void seg_path(char *out, size_t cap, uint32_t id) {
+  snprintf(out, cap, QUEUE_DIR "/%08x.seg", (unsigned)id);
+}
+
+static uint32_t rec_crc(const rec_header_t *h, const uint8_t *payload) {
+  const uint8_t *fields = (const uint8_t *)h + offsetof(rec_header_t, len);
+  uint32_t crc = esp_rom_crc32_le(0, fields, offsetof(rec_header_t, crc) - offsetof(rec_header_t, len));
+  return esp_rom_crc32_le(crc, payload, h->len);
+}
+
+static int seg_find(uint32_t id) {
+  for (int i = 0; i < seg_count; i++) {
+    if (segs[i].id == id) return i;
+  }
+  return -1;
+}
+
+static uint32_t disk_bytes() {
+  uint32_t total = 0;
+  for (int i = 0; i < seg_count; i++) total += segs[i].file_bytes;
+  return total;
+}
+
+static void seg_delete(int idx) {
+  char path[32];
+  seg_path(path, sizeof(path), segs[idx].id);
+  LittleFS.remove(path);
+  if (segs[idx].id == active_seg) active_seg = 0;
+  memmove(&segs[idx], &segs[idx + 1], (seg_count - idx - 1) * sizeof(seg_info_t));
+  seg_count--;
+  stats.segments_deleted++;
+}
+
+static void rec_remove(int i) {
+  memmove(&recs[i], &recs[i + 1], (rec_count - i - 1) * sizeof(rec_info_t));
+  rec_count--;
+}
+
+static bool rec_insert(const rec_info_t *r) {
+  if (rec_count >= UPLOAD_QUEUE_MAX_FRAMES) return false;
+  int pos = rec_count;
+  while (pos > 0 && recs[pos - 1].lsn > r->lsn) pos--;
+  memmove(&recs[pos + 1], &recs[pos], (rec_count - pos) * sizeof(rec_info_t));
+  recs[pos] = *r;
+  rec_count++;
+  return true;
+}
+
+// Clear the live flag of a record on flash and update its segment's accounting
+static void rec_mark_consumed(const rec_info_t *r) {
+  char path[32];
+  seg_path(path, sizeof(path), r->seg);
+  File f = LittleFS.open(path, "r+");
+  if (f) {
+    uint8_t state = REC_CONSUMED;
+    f.seek(r->offset + offsetof(rec_header_t, state));
+    f.write(&state, 1);
+    f.close();
+  }
+
+  int si = seg_find(r->seg);
+  if (si < 0) return;
+  segs[si].live_count--;
+  segs[si].live_bytes -= segs[si].rec_hdr + r->len;
+  if (segs[si].live_count == 0) seg_delete(si);
+}
+
+static void rec_consume(int i) {
+  rec_info_t r = recs[i];
+  rec_remove(i);
+  rec_mark_consumed(&r);
+}
+
+// Drop the oldest segment wholesale; its live records are lost
+static void evict_oldest_segment() {
+  uint32_t id = segs[0].id;
+  for (int i = rec_count - 1; i >= 0; i--) {
+    if (recs[i].seg == id) {
+      rec_remove(i);
+      stats.evicted++;
+    }
+  }
+  seg_delete(0);
+}
+
+static bool seg_create() {
+  if (seg_count >= seg_cap) return false;
+  seg_header_t h = {SEG_MAGIC, SEG_VERSION, 0, next_seg, 0};
+  char path[32];
+  seg_path(path, sizeof(path), h.id);
+  File f = LittleFS.open(path, "w");
+  if (!f) return false;
+  bool ok = f.write((const uint8_t *)&h, sizeof(h)) == sizeof(h);
+  f.close();
+  if (!ok) {
+    LittleFS.remove(path);
+    return false;
+  }
+  seg_info_t *s = &segs[seg_count++];
+  s->id = next_seg++;
+  s->file_bytes = sizeof(h);
+  s->live_bytes = 0;
+  s->live_count = 0;
+  s->rec_hdr = sizeof(rec_header_t);
+  active_seg = s->id;
+  return true;
+}
+
+// Append one record to the active segment (opening a new one when it is full).
+// On success r->seg / r->offset point at the new copy.
+static bool write_record(rec_info_t *r, const uint8_t *buf) {
+  size_t rec_bytes = sizeof(rec_header_t) + r->len;
+  int si = active_seg ? seg_find(active_seg) : -1;
+  if (si >= 0 && segs[si].file_bytes > sizeof(seg_header_t) && segs[si].file_bytes + rec_bytes > segment_bytes) si = -1;
+  if (si < 0) {
+    if (!seg_create()) return false;
+    si = seg_count - 1;
+  }
+
+  seg_info_t *s = &segs[si];
+  rec_header_t h = {REC_MAGIC, REC_LIVE, 0, r->len, r->lsn, r->seq, r->ts_sec, r->ts_usec, 0};
+  h.crc = r->crc = rec_crc(&h, buf);
+  char path[32];
+  seg_path(path, sizeof(path), s->id);
+  File f = LittleFS.open(path, "a");
+  if (!f) return false;
+  bool ok = f.write((const uint8_t *)&h, sizeof(h)) == sizeof(h) && f.write(buf, r->len) == r->len;
+  size_t end = f.size();
+  f.close();
+  if (!ok) {
+    // Seal the segment; the torn tail is ignored when the segment is scanned again
+    s->file_bytes = end;
+    active_seg = 0;
+    return false;
+  }
+
+  r->seg = s->id;
+  r->offset = s->file_bytes;
+  s->file_bytes += rec_bytes;
+  s->live_bytes += rec_bytes;
+  s->live_count++;
+  return true;
+}
+
+// Read a record's payload into io_buf; false if it is unreadable or fails its CRC
+static bool read_record(const rec_info_t *r) {
+  int si = seg_find(r->seg);
+  if (si < 0 || r->len > io_cap) return false;
+  char path[32];
+  seg_path(path, sizeof(path), r->seg);
+  File f = LittleFS.open(path, "r");
+  if (!f) return false;
+  bool ok = f.seek(r->offset + segs[si].rec_hdr) && f.read(io_buf, r->len) == r->len;
+  f.close();
+  if (ok && segs[si].rec_hdr == sizeof(rec_header_t)) {
+    rec_header_t h = {REC_MAGIC, REC_LIVE, 0, r->len, r->lsn, r->seq, r->ts_sec, r->ts_usec, 0};
+    ok = rec_crc(&h, io_buf) == r->crc;
+  }
+  return ok;
+}
+
+// Rebuild the index for one segment. Scanning stops at the first torn or foreign
+// record; a live record whose CRC does not match is skipped. Every live payload is
+// read once here, so a corrupt frame never reaches the drain.
+static void scan_segment(uint32_t id) {
+  char path[32];
+  seg_path(path, sizeof(path), id);
+  File f = LittleFS.open(path, "r");
+  if (!f) return;
+  seg_header_t sh;
+  size_t size = f.size();
+  if (f.read((uint8_t *)&sh, sizeof(sh)) != sizeof(sh) || sh.magic != SEG_MAGIC || sh.version < 1 || sh.version > SEG_VERSION ||
+      seg_count >= seg_cap) {
+    f.close();
+    LittleFS.remove(path);
+    return;
+  }
+
+  seg_info_t *s = &segs[seg_count++];
+  s->id = id;
+  s->live_bytes = 0;
+  s->live_count = 0;
+  s->rec_hdr = sh.version == 1 ? REC_V1_BYTES : sizeof(rec_header_t);
+  uint32_t off = sizeof(sh);
+  rec_header_t h = {};
+  while (off + s->rec_hdr <= size) {
+    if (!f.seek(off) || f.read((uint8_t *)&h, s->rec_hdr) != s->rec_hdr) break;
+    if (h.magic != REC_MAGIC || off + s->rec_hdr + h.len > size) {
+      stats.corrupt++;
+      break;
+    }
+    if (h.state == REC_LIVE) {
+      bool intact = s->rec_hdr == REC_V1_BYTES ||
+                    (h.len <= io_cap && f.read(io_buf, h.len) == h.len && rec_crc(&h, io_buf) == h.crc);
+      rec_info_t r = {id, off, h.len, h.lsn, h.seq, h.ts_sec, h.ts_usec, h.crc};
+      if (!intact) {
+        stats.corrupt++;
+      } else if (rec_insert(&r)) {
+        s->live_count++;
+        s->live_bytes += s->rec_hdr + h.len;
+      } else {
+        stats.evicted++;
+      }
+    }
+    if (h.lsn >= next_lsn) next_lsn = h.lsn + 1;
+    off += s->rec_hdr + h.len;
+  }
+  f.close();
+  s->file_bytes = off;
+  if (id >= next_seg) next_seg = id + 1;
+  if (s->live_count == 0) seg_delete(seg_count - 1);
+}
+
+static bool fs_mount() {
+  if (LittleFS.begin()) return true;
+  ALOGW(ALOG_QUEUE, "[uploader][queue] LittleFS.begin() failed, attempting format...");
+  // Try to salvage by formatting once (this will erase any queued frames)
+  if (!LittleFS.format()) {
+    ALOGW(ALOG_QUEUE, "[uploader][queue] LittleFS.format() failed");
+    return false;
+  }
+  if (!LittleFS.begin()) {
+    ALOGW(ALOG_QUEUE, "[uploader][queue] LittleFS.begin() still failed after format");
+    return false;
+  }
+  ALOGI(ALOG_QUEUE, "[uploader][queue] LittleFS mounted after format");
+  return true;
+}
+
+bool upload_queue_begin(size_t budget_bytes, size_t seg_bytes, size_t max_frame_bytes, upload_queue_policy_t drain_policy) {
+  if (attempted) return ready;
+  attempted = true;
+
+  budget = budget_bytes;
+  segment_bytes = seg_bytes;
+  policy = drain_policy;
+  seg_cap = budget / segment_bytes + 2;  // an oversized record gets a segment to itself
+  segs = (seg_info_t *)calloc(seg_cap, sizeof(seg_info_t));
+  recs = (rec_info_t *)calloc(UPLOAD_QUEUE_MAX_FRAMES, sizeof(rec_info_t));
+  io_buf = (uint8_t *)heap_caps_malloc(max_frame_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!io_buf) io_buf = (uint8_t *)malloc(max_frame_bytes);
+  io_cap = max_frame_bytes;
+  if (!segs || !recs || !io_buf) {
+    ALOGW(ALOG_QUEUE, "[uploader][queue] failed to allocate queue index");
+    return false;
+  }
+
+  if (!fs_mount()) return false;
+  if (!LittleFS.exists(QUEUE_DIR)) LittleFS.mkdir(QUEUE_DIR);
+
+  // Collect segment ids (and legacy N.bin slots) before touching any file
+  uint32_t *ids = NULL;  // grows: every segment file is either indexed or removed
+  int nids = 0;
+  int ids_cap = 0;
+  int legacy[UPLOAD_QUEUE_MAX_FRAMES];
+  int nlegacy = 0;
+  File dir = LittleFS.open(QUEUE_DIR);
+  if (dir && dir.isDirectory()) {
+    for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+      const char *name = f.name();
+      const char *base = strrchr(name, '/');
+      base = base ? base + 1 : name;
+      const char *dot = strchr(base, '.');
+      if (dot && !strcmp(dot, ".seg")) {
+        if (nids == ids_cap) {
+          uint32_t *grown = (uint32_t *)realloc(ids, (ids_cap + seg_cap) * sizeof(uint32_t));
+          if (grown) {
+            ids = grown;
+            ids_cap += seg_cap;
+          }
+        }
+        if (nids < ids_cap) ids[nids++] = strtoul(base, NULL, 16);
+      } else if (dot && !strcmp(dot, ".bin") && nlegacy < UPLOAD_QUEUE_MAX_FRAMES) {
+        legacy[nlegacy++] = atoi(base);
+      }
+      f.close();
+    }
+    dir.close();
+  }
+  std::sort(ids, ids + nids);
+  std::sort(legacy, legacy + nlegacy);
+  for (int i = 0; i < nids; i++) scan_segment(ids[i]);
+  free(ids);
+
+  // Appends after boot go to a fresh segment so a torn tail is never appended to
+  active_seg = 0;
+  ready = true;
+
+  // Frames queued by the old one-file-per-frame layout are carried over in slot order
+  for (int i = 0; i < nlegacy; i++) {
+    char path[32];
+    snprintf(path, sizeof(path), QUEUE_DIR "/%d.bin", legacy[i]);
+    File f = LittleFS.open(path, "r");
+    size_t len = f ? f.size() : 0;
+    if (f && len > 0 && len <= io_cap && f.read(io_buf, len) == len) {
+      struct timeval ts = {0, 0};
+      f.close();
+      upload_queue_append(io_buf, len, 0, &ts);
+    } else if (f) {
+      f.close();
+    }
+    LittleFS.remove(path);
+  }
+
+  ALOGI(ALOG_QUEUE, "[uploader][queue] LittleFS ready: %d frames in %d segments (%u/%u bytes), policy=%s", rec_count, seg_count,
+                (unsigned)disk_bytes(), (unsigned)budget, policy == UPLOAD_QUEUE_NEWEST_FIRST ? "newest_first" : "fifo");
+  return true;
+}
+
+bool upload_queue_ready() {
+  return ready;
+}
+
+void upload_queue_set_max_frames(int frames) {
+  if (frames < 1) frames = 1;
+  if (frames > UPLOAD_QUEUE_MAX_FRAMES) frames = UPLOAD_QUEUE_MAX_FRAMES;
+  max_frames = frames;
+}
+
+bool upload_queue_append(const uint8_t *buf, size_t len, uint32_t seq, const struct timeval *timestamp) {
+  if (!ready || !buf || len == 0) return false;
+  size_t rec_bytes = sizeof(rec_header_t) + len;
+  if (rec_bytes + sizeof(seg_header_t) > budget || len > io_cap) {
+    stats.rejected++;
+    return false;
+  }
+
+  // Make room: frame limit first (oldest record), then byte budget (oldest segment)
+  while (rec_count >= max_frames) {
+    rec_consume(0);
+    stats.evicted++;
+  }
+  while (seg_count > 0 && (disk_bytes() + rec_bytes + sizeof(seg_header_t) > budget || seg_count >= seg_cap)) {
+    evict_oldest_segment();
+  }
+
+  rec_info_t r = {0, 0, (uint32_t)len, next_lsn, seq, (uint32_t)timestamp->tv_sec, (uint32_t)timestamp->tv_usec, 0};
+  if (!write_record(&r, buf)) {
+    ALOGW(ALOG_QUEUE, "[uploader][queue] failed to write frame");
+    stats.rejected++;
+    return false;
+  }
+  next_lsn++;
+  rec_insert(&r);
+  stats.appended++;
+  ALOGI(ALOG_QUEUE, "[uploader][queue] saved frame %u (%u bytes), %d queued", (unsigned)seq, (unsigned)len, rec_count);
+  return true;
+}
+
+bool upload_queue_peek(upload_queue_frame_t *out) {
+  while (ready && rec_count > 0) {
+    int i = policy == UPLOAD_QUEUE_NEWEST_FIRST ? rec_count - 1 : 0;
+    const rec_info_t *r = &recs[i];
+    if (read_record(r)) {
+      out->buf = io_buf;
+      out->len = r->len;
+      out->seq = r->seq;
+      out->timestamp.tv_sec = r->ts_sec;
+      out->timestamp.tv_usec = r->ts_usec;
+      out->lsn = r->lsn;
+      return true;
+    }
+    // Unreadable: drop it so the drain does not stall on it
+    ALOGW(ALOG_QUEUE, "[uploader][queue] skipping unreadable record %u", (unsigned)r->lsn);
+    stats.corrupt++;
+    rec_consume(i);
+  }
+  return false;
+}
+
+void upload_queue_ack(const upload_queue_frame_t *frame) {
+  for (int i = 0; i < rec_count; i++) {
+    if (recs[i].lsn == frame->lsn) {
+      rec_consume(i);
+      stats.drained++;
+      return;
+    }
+  }
+}
+
+bool upload_queue_compact_step() {
+  if (!ready) return false;
+
+  // Sealed segment with the least live data, if less than half of it is still live
+  int best = -1;
+  for (int i = 0; i < seg_count; i++) {
+    const seg_info_t *s = &segs[i];
+    if (s->id == active_seg || s->live_bytes * 2 >= s->file_bytes) continue;
+    if (best < 0 || s->live_bytes < segs[best].live_bytes) best = i;
+  }
+  if (best < 0) return false;
+
+  int ri = -1;
+  for (int i = 0; i < rec_count; i++) {
+    if (recs[i].seg == segs[best].id) {
+      ri = i;
+      break;
+    }
+  }
+  if (ri < 0) {
+    seg_delete(best);
+    return true;
+  }
+
+  rec_info_t old = recs[ri];
+  if (disk_bytes() + sizeof(rec_header_t) + old.len + sizeof(seg_header_t) > budget) return false;
+  if (!read_record(&old)) {
+    stats.corrupt++;
+    rec_consume(ri);
+    return true;
+  }
+  rec_info_t moved = old;
+  if (!write_record(&moved, io_buf)) return false;
+  // Same lsn, new location: drain order is unchanged
+  recs[ri].seg = moved.seg;
+  recs[ri].offset = moved.offset;
+  rec_mark_consumed(&old);
+  stats.compacted++;
+  return true;
+}
+
+size_t upload_queue_count() {
+  return rec_count;
+}
+
+void upload_queue_metrics(metrics_out_t *out) {
+  uint32_t live = 0;
+  for (int i = 0; i < seg_count; i++) live += segs[i].live_bytes;
+  metrics_family(out, "upload_queue_frames", "gauge", "Frames waiting in the persistent queue");
+  metrics_printf(out, METRICS_PREFIX "upload_queue_frames %d\n", rec_count);
+  metrics_family(out, "upload_queue_bytes", "gauge", "Queued frame bytes (live) and flash used by segments (disk)");
+  metrics_printf(out, METRICS_PREFIX "upload_queue_bytes{kind=\"live\"} %u\n", (unsigned)live);
+  metrics_printf(out, METRICS_PREFIX "upload_queue_bytes{kind=\"disk\"} %u\n", (unsigned)disk_bytes());
+  metrics_printf(out, METRICS_PREFIX "upload_queue_bytes{kind=\"budget\"} %u\n", (unsigned)budget);
+  metrics_family(out, "upload_queue_evicted_total", "counter", "Queued frames dropped to stay within the limits");
+  metrics_printf(out, METRICS_PREFIX "upload_queue_evicted_total %u\n", (unsigned)stats.evicted);
+}
+
+void upload_queue_to_json(cJSON *obj) {
+  uint32_t live = 0;
+  for (int i = 0; i < seg_count; i++) live += segs[i].live_bytes;
+  cJSON_AddBoolToObject(obj, "ready", ready);
+  cJSON_AddStringToObject(obj, "policy", policy == UPLOAD_QUEUE_NEWEST_FIRST ? "newest_first" : "fifo");
+  cJSON_AddNumberToObject(obj, "frames", rec_count);
+  cJSON_AddNumberToObject(obj, "max_frames", max_frames);
+  cJSON_AddNumberToObject(obj, "segments", seg_count);
+  cJSON_AddNumberToObject(obj, "live_bytes", live);
+  cJSON_AddNumberToObject(obj, "disk_bytes", disk_bytes());
+  cJSON_AddNumberToObject(obj, "budget_bytes", budget);
+  cJSON_AddNumberToObject(obj, "appended", stats.appended);
+  cJSON_AddNumberToObject(obj, "drained", stats.drained);
+  cJSON_AddNumberToObject(obj, "evicted", stats.evicted);
+  cJSON_AddNumberToObject(obj, "rejected", stats.rejected);
+  cJSON_AddNumberToObject(obj, "compacted", stats.compacted);
+  cJSON_AddNumberToObject(obj, "corrupt", stats.corrupt);
+  cJSON_AddNumberToObject(obj, "segments_deleted", stats.segments_deleted);
+}
@@ -0,0 +1,59 @@
+#ifndef UPLOAD_QUEUE_H
+#define UPLOAD_QUEUE_H
+
+#include <Arduino.h>
+#include <sys/time.h>
+#include "cJSON.h"
+#include "metrics.h"
+
+// Persistent upload queue on LittleFS, stored as an append-only log of segment
+// files (/uploadq/<id>.seg). Each segment starts with a small header and holds
+// back-to-back records (header with a CRC + JPEG); records that fail their CRC at
+// mount or when drained are skipped. Drained records are marked consumed in
+// place and a segment file is deleted once nothing in it is live; sparse sealed
+// segments are compacted one record at a time. An in-RAM index built at mount
+// time means enqueue/drain never probe the filesystem.
+
+typedef enum {
+  UPLOAD_QUEUE_FIFO = 0,          // drain oldest frame first
+  UPLOAD_QUEUE_NEWEST_FIRST = 1,  // drain most recent frame first
+} upload_queue_policy_t;
+
+typedef struct {
+  const uint8_t *buf;  // valid until the next upload_queue_* call
+  size_t len;
+  uint32_t seq;        // capture sequence number
+  struct timeval timestamp;
+  uint32_t lsn;        // log sequence number (identifies the record)
+} upload_queue_frame_t;
+
+typedef struct {
+  uint32_t appended;
+  uint32_t drained;
+  uint32_t evicted;    // dropped to stay within the frame limit or byte budget
+  uint32_t rejected;   // larger than the budget or failed to write
+  uint32_t compacted;  // records moved out of sparse segments
+  uint32_t corrupt;    // unreadable records skipped
+  uint32_t segments_deleted;
+} upload_queue_stats_t;
+
+// Mount LittleFS (once), load the index from existing segments and import frames
+// left in the old /uploadq/N.bin files. max_frame_bytes sizes the single read buffer.
+bool upload_queue_begin(size_t budget_bytes, size_t segment_bytes, size_t max_frame_bytes, upload_queue_policy_t policy);
+bool upload_queue_ready();
+// Oldest frames are evicted beyond this many queued frames
+void upload_queue_set_max_frames(int frames);
+
+bool upload_queue_append(const uint8_t *buf, size_t len, uint32_t seq, const struct timeval *timestamp);
+// Next frame to send according to the drain policy
+bool upload_queue_peek(upload_queue_frame_t *out);
+// The frame was delivered: remove it from the queue
+void upload_queue_ack(const upload_queue_frame_t *frame);
+// Move at most one record out of a sparse segment. Returns true if work was done.
+bool upload_queue_compact_step();
+
+size_t upload_queue_count();
+void upload_queue_to_json(cJSON *obj);
+void upload_queue_metrics(metrics_out_t *out);
+
+#endif // UPLOAD_QUEUE_H
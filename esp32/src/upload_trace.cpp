@@ -0,0 +1,128 @@
+#include "upload_trace.h"
+#include "esp_timer.h"
+
+static upload_span_t ring[UPLOAD_TRACE_RECORDS];
+static uint32_t ring_head = 0;   // next slot to write
+static uint32_t ring_count = 0;
+static uint32_t committed = 0;
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *const phase_names[UPLOAD_PHASE_COUNT] = {
+  "capture", "queue", "dns", "connect", "tls", "write", "ttfb", "response",
+};
+
+const char *upload_phase_name(upload_phase_t phase) {
+  return phase < UPLOAD_PHASE_COUNT ? phase_names[phase] : "?";
+}
+
+void upload_span_begin(upload_span_t *span, uint32_t seq, int64_t start_us) {
+  memset(span, 0, sizeof(*span));
+  span->seq = seq;
+  span->start_us = start_us;
+  for (int i = 0; i < UPLOAD_PHASE_COUNT; i++) span->dur_us[i] = UPLOAD_SPAN_SKIPPED;
+}
+
+void upload_span_phase(upload_span_t *span, upload_phase_t phase, int64_t begin_us, int64_t end_us) {
+  if (!span || phase >= UPLOAD_PHASE_COUNT) return;
+  span->at_us[phase] = (uint32_t)(begin_us - span->start_us);
+  span->dur_us[phase] = (uint32_t)(end_us - begin_us);
+}
+
+void upload_trace_commit(upload_span_t *span, int result, size_t bytes) {
+  span->total_us = (uint32_t)(esp_timer_get_time() - span->start_us);
+  span->result = (int16_t)result;
+  span->bytes = (uint32_t)bytes;
+
+  portENTER_CRITICAL(&trace_mux);
+  ring[ring_head] = *span;
+  ring_head = (ring_head + 1) % UPLOAD_TRACE_RECORDS;
+  if (ring_count < UPLOAD_TRACE_RECORDS) ring_count++;
+  committed++;
+  portEXIT_CRITICAL(&trace_mux);
+}
+
+// Copy one column out of the ring (newest last); phase == UPLOAD_PHASE_COUNT means total_us
+static int collect(upload_phase_t phase, uint32_t *out) {
+  int n = 0;
+  portENTER_CRITICAL(&trace_mux);
+  for (uint32_t i = 0; i < ring_count; i++) {
+    const upload_span_t *s = &ring[(ring_head + UPLOAD_TRACE_RECORDS - ring_count + i) % UPLOAD_TRACE_RECORDS];
+    uint32_t v = phase == UPLOAD_PHASE_COUNT ? s->total_us : s->dur_us[phase];
+    if (v != UPLOAD_SPAN_SKIPPED) out[n++] = v;
+  }
+  portEXIT_CRITICAL(&trace_mux);
+  return n;
+}
+
+static void sort_u32(uint32_t *v, int n) {
+  for (int i = 1; i < n; i++) {
+    uint32_t x = v[i];
+    int j = i - 1;
+    while (j >= 0 && v[j] > x) {
+      v[j + 1] = v[j];
+      j--;
+    }
+    v[j + 1] = x;
+  }
+}
+
+// Nearest-rank percentile of a sorted array
+static uint32_t percentile(const uint32_t *v, int n, int pct) {
+  int rank = (pct * n + 99) / 100;
+  if (rank < 1) rank = 1;
+  return v[rank - 1];
+}
+
+static void summary_to_json(cJSON *obj, upload_phase_t phase) {
+  uint32_t v[UPLOAD_TRACE_RECORDS];
+  int n = collect(phase, v);
+  cJSON_AddNumberToObject(obj, "count", n);
+  if (n == 0) return;
+  sort_u32(v, n);
+  cJSON_AddNumberToObject(obj, "p50_us", percentile(v, n, 50));
+  cJSON_AddNumberToObject(obj, "p90_us", percentile(v, n, 90));
+  cJSON_AddNumberToObject(obj, "p99_us", percentile(v, n, 99));
+  cJSON_AddNumberToObject(obj, "max_us", v[n - 1]);
+}
+
+void upload_trace_to_json(cJSON *obj, int recent) {
+  portENTER_CRITICAL(&trace_mux);
+  uint32_t total = committed, count = ring_count;
+  portEXIT_CRITICAL(&trace_mux);
+  cJSON_AddNumberToObject(obj, "uploads", total);
+  cJSON_AddNumberToObject(obj, "records", count);
+
+  cJSON *phases = cJSON_AddObjectToObject(obj, "phases");
+  for (int p = 0; p < UPLOAD_PHASE_COUNT; p++) {
+    summary_to_json(cJSON_AddObjectToObject(phases, phase_names[p]), (upload_phase_t)p);
+  }
+  summary_to_json(cJSON_AddObjectToObject(obj, "total"), UPLOAD_PHASE_COUNT);
+
+  // Newest first; each record is copied out of the ring before it is formatted
+  cJSON *list = cJSON_AddArrayToObject(obj, "recent");
+  if (recent > (int)UPLOAD_TRACE_RECORDS) recent = UPLOAD_TRACE_RECORDS;
+  for (int i = 0; i < recent; i++) {
+    upload_span_t s;
+    portENTER_CRITICAL(&trace_mux);
+    bool have = (uint32_t)i < ring_count;
+    if (have) s = ring[(ring_head + UPLOAD_TRACE_RECORDS - 1 - i) % UPLOAD_TRACE_RECORDS];
+    portEXIT_CRITICAL(&trace_mux);
+    if (!have) break;
+
+    cJSON *rec = cJSON_CreateObject();
+    cJSON_AddNumberToObject(rec, "seq", s.seq);
+    cJSON_AddNumberToObject(rec, "start_us", (double)s.start_us);
+    cJSON_AddNumberToObject(rec, "result", s.result);
+    cJSON_AddNumberToObject(rec, "bytes", s.bytes);
+    cJSON_AddBoolToObject(rec, "reused", s.reused);
+    cJSON_AddNumberToObject(rec, "total_us", s.total_us);
+    cJSON *ph = cJSON_AddObjectToObject(rec, "phases");
+    for (int p = 0; p < UPLOAD_PHASE_COUNT; p++) {
+      if (s.dur_us[p] == UPLOAD_SPAN_SKIPPED) continue;
+      cJSON *e = cJSON_AddObjectToObject(ph, phase_names[p]);
+      cJSON_AddNumberToObject(e, "at_us", s.at_us[p]);
+      cJSON_AddNumberToObject(e, "dur_us", s.dur_us[p]);
+    }
+    cJSON_AddItemToArray(list, rec);
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef UPLOAD_TRACE_H
+#define UPLOAD_TRACE_H
+
+#include <Arduino.h>
+#include "cJSON.h"
+
+// Per-upload latency spans. Every live upload carries one record with the start
+// offset and duration (microseconds, esp_timer clock) of each phase, from the
+// camera capture to the end of the gateway's response. The last
+// UPLOAD_TRACE_RECORDS records are kept in a ring and summarised as percentiles
+// by GET /uploader/trace, so a slow upload can be pinned on the device, the
+// network path or the gateway.
+
+#define UPLOAD_TRACE_RECORDS 32
+#define UPLOAD_SPAN_SKIPPED UINT32_MAX  // phase did not run (e.g. connection reused)
+
+typedef enum {
+  UPLOAD_PHASE_CAPTURE = 0,  // esp_camera_fb_get + copy into the frame ring
+  UPLOAD_PHASE_QUEUE,        // waiting in the ring, change detection, scaling
+  UPLOAD_PHASE_DNS,          // resolver call (cached addresses skip it)
+  UPLOAD_PHASE_CONNECT,      // TCP connect (plain HTTP)
+  UPLOAD_PHASE_TLS,          // TCP connect + TLS handshake (WiFiClientSecure does both)
+  UPLOAD_PHASE_WRITE,        // request headers and body written
+  UPLOAD_PHASE_TTFB,         // body written -> status line received
+  UPLOAD_PHASE_RESPONSE,     // status line -> response complete
+  UPLOAD_PHASE_COUNT,
+} upload_phase_t;
+
+typedef struct {
+  uint32_t seq;                           // capture sequence number
+  int64_t start_us;                       // esp_timer time the capture started
+  uint32_t at_us[UPLOAD_PHASE_COUNT];     // phase start, relative to start_us
+  uint32_t dur_us[UPLOAD_PHASE_COUNT];    // UPLOAD_SPAN_SKIPPED if the phase did not run
+  uint32_t total_us;                      // capture start -> request finished
+  uint32_t bytes;
+  int16_t result;                         // HTTP status or UPLOAD_CONN_ERR_*
+  bool reused;                            // request went out on a kept-alive socket
+} upload_span_t;
+
+void upload_span_begin(upload_span_t *span, uint32_t seq, int64_t start_us);
+// Record one phase from esp_timer times; a phase recorded twice (retried request) keeps the last
+void upload_span_phase(upload_span_t *span, upload_phase_t phase, int64_t begin_us, int64_t end_us);
+// Close the span and copy it into the ring
+void upload_trace_commit(upload_span_t *span, int result, size_t bytes);
+
+const char *upload_phase_name(upload_phase_t phase);
+// Per-phase p50/p90/p99/max over the ring, plus the `recent` newest records in full
+void upload_trace_to_json(cJSON *obj, int recent);
+
+#endif // UPLOAD_TRACE_H
@@ -1,388 +1,446 @@
 #include "uploader.h"
 #include "uploader_config.h"
 #include "uploader_settings.h"
-#include <HTTPClient.h>
+#include "frame_ring.h"
+#include "upload_conn.h"
+#include "frame_scaler.h"
+#include "upload_queue.h"
+#include "upload_breaker.h"
+#include "motion_gate.h"
+#include "upload_abr.h"
+#include "boot_graph.h"
+#include "async_log.h"
+#include "metrics.h"
+#include "upload_trace.h"
+#include "frame_clock.h"
+#include "frame_bus.h"
+#include "led_flash.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
 #include <WiFi.h>
-#include <WiFiClientSecure.h>
-#include <LittleFS.h>
 #include "esp_camera.h"
+#include <atomic>
+
+// Capture and upload run as two tasks joined by the PSRAM frame ring:
+//  - captureTask takes a frame from the frame bus every interval, copies it into the
+//    ring and releases it straight away so /stream and /capture are never starved.
+//  - uploadTask drains the ring on the other core and owns all network work
+//    (connection, retry scheduling, persistent queue), so network latency never holds a fb.
+//    It never sleeps on a failure: while a backoff is pending or the gateway is down
+//    frames go to the persistent queue and are sent once a probe succeeds.
+//    It also scales each frame down to the upload profile, so the sensor is never
+//    switched away from the resolution /stream and /capture are using.
+
+// Capture and upload counters live in metrics.h (atomic, also served by /metrics)
+
+// Settings snapshot the upload task refreshes once per frame (a RAM copy, no flash reads)
+static uploader_settings_t cfg;
+
+// Resolve the upload endpoint from the stored URL or, failing that, the gateway host
+static String resolve_upload_url() {
+  String uploadUrl = cfg.url;
+  if (uploadUrl.length() == 0) {
+    String gw = cfg.gateway;
+    if (gw.length() > 0) {
+      // Special debug/test token: POST to httpbin.org to verify TLS from the device
+      if (gw == String("TEST_HTTPBIN")) {
+        uploadUrl = String("https://httpbin.org/post");
+        ALOGI(ALOG_UPLOADER, "[uploader][test] using TEST_HTTPBIN -> https://httpbin.org/post");
+      } else {
+        if (!gw.startsWith("http://") && !gw.startsWith("https://")) gw = String("http://") + gw;
+        if (gw.endsWith("/")) gw = gw.substring(0, gw.length()-1);
+        uploadUrl = gw + "/upload";
+      }
+    }
+  }
+  return uploadUrl;
+}
 
-static void uploaderTask(void *pvParameters) {
-  (void) pvParameters;
+// Mount the persistent queue once; later calls return immediately
+static void queue_begin() {
+  if (!cfg.queue_enabled) return;
+  upload_queue_begin(UPLOAD_QUEUE_BUDGET_BYTES, UPLOAD_QUEUE_SEGMENT_BYTES, UPLOAD_RING_SLOT_BYTES, (upload_queue_policy_t)UPLOAD_QUEUE_DRAIN_POLICY);
+}
 
-  HTTPClient http;
+// Keep-alive connection to the gateway, shared by live uploads, queue drains and
+// stream registration so a frame costs no extra TCP/TLS handshakes.
+static upload_conn_t gateway_conn;
+static bool stream_registered = false;
+
+// Attempt to register public stream URL once (if available and gateway exists)
+static void register_stream_once() {
+  if (stream_registered) return;
+  String gw = cfg.gateway;
+  String sUrl = cfg.stream_url;
+  String devId = cfg.device_id;
+  const char *apiKeyLocal = cfg.api_key;
+  if (gw.length() == 0 || sUrl.length() == 0 || devId.length() == 0) return;
+
+  if (!gw.startsWith("http://") && !gw.startsWith("https://")) gw = String("http://") + gw;
+  if (gw.endsWith("/")) gw = gw.substring(0, gw.length()-1);
+  String regUrl = gw + "/devices/" + devId + "/register_stream";
+
+  upload_target_t regTarget;
+  if (!upload_target_parse(regUrl.c_str(), &regTarget)) {
+    ALOGW(ALOG_UPLOADER, "[uploader] Stream register URL invalid -> %s", regUrl.c_str());
+    return;
+  }
 
-  // Initialize settings (Preferences)
-  uploader_settings_init();
+  // Reuse the upload connection when the gateway is the same host, else open a one-off connection
+  upload_conn_t oneOff;
+  upload_conn_t *conn = &gateway_conn;
+  bool sameHost = gateway_conn.target_valid && regTarget.tls == gateway_conn.target.tls && regTarget.port == gateway_conn.target.port
+                  && !strcmp(regTarget.host, gateway_conn.target.host);
+  if (!sameHost) {
+    upload_conn_init(&oneOff);
+    upload_conn_set_url(&oneOff, regUrl.c_str());
+    conn = &oneOff;
+  }
 
-  while (true) {
-    if (WiFi.status() == WL_CONNECTED) {
-      // Ensure camera capture parameters optimized for uploads (may be changed via web UI)
-      sensor_t *s = esp_camera_sensor_get();
-      int targetFrame = uploader_get_frame_size();
-      int targetQuality = uploader_get_jpeg_quality();
-      if (s) {
-        if (s->pixformat == PIXFORMAT_JPEG) {
-          if (s->status.framesize != targetFrame) {
-            s->set_framesize(s, (framesize_t)targetFrame);
-            Serial.printf("[uploader] adjusted framesize to %d for upload\n", targetFrame);
-          }
-          s->set_quality(s, targetQuality);
-          Serial.printf("[uploader] set jpeg quality to %d for upload\n", targetQuality);
-        }
-      }
+  String body = String("{\"url\":\"") + sUrl + String("\"}");
+  upload_header_t hdrs[] = {{"X-API-KEY", apiKeyLocal}};
+  int rc = upload_conn_post(conn, regTarget.path, "application/json", hdrs, 1, (const uint8_t *)body.c_str(), body.length(), NULL, 0);
+  if (rc >= 200 && rc < 300) {
+    ALOGI(ALOG_UPLOADER, "[uploader] Stream registered (%d) -> %s", rc, regUrl.c_str());
+    stream_registered = true;
+  } else {
+    ALOGW(ALOG_UPLOADER, "[uploader] Stream register failed (%d) -> %s", rc, regUrl.c_str());
+  }
 
-      camera_fb_t *fb = esp_camera_fb_get();
-      if (!fb) {
-        Serial.println("[uploader] Camera capture failed");
-      } else {
-        String uploadUrl = uploader_get_url();
-        String apiKey = uploader_get_api_key();
-        uint32_t interval = uploader_get_interval_ms();
-
-        // If upload URL is not configured, try to build it from stored gateway host
-        if (uploadUrl.length() == 0) {
-          String gw = uploader_get_gateway();
-          if (gw.length() > 0) {
-            // Special debug/test token: POST to httpbin.org to verify TLS from the device
-            if (gw == String("TEST_HTTPBIN")) {
-              uploadUrl = String("https://httpbin.org/post");
-              Serial.println("[uploader][test] using TEST_HTTPBIN -> https://httpbin.org/post");
-            } else {
-              if (!gw.startsWith("http://") && !gw.startsWith("https://")) gw = String("http://") + gw;
-              if (gw.endsWith("/")) gw = gw.substring(0, gw.length()-1);
-              uploadUrl = gw + "/upload";
-            }
-          }
-        }
+  if (!sameHost) {
+    upload_conn_close(&oneOff);
+    delete oneOff.client;
+  }
+}
 
-        // If upload URL is still not configured, skip upload and keep AP available for provisioning
-        if (uploadUrl.length() == 0) {
-          Serial.println("[uploader] upload URL not configured, skipping upload");
-          esp_camera_fb_return(fb);
-          vTaskDelay(pdMS_TO_TICKS(interval));
-          continue;
-        }
+// A status line arrived but the gateway (or a tunnel in front of it) reported a server error
+static bool gateway_ok(int rc) {
+  return rc > 0 && rc < 500;
+}
 
-        // Queue initialization - LittleFS
-  if (uploader_is_queue_enabled()) {
-    if (!LittleFS.begin()) {
-      Serial.println("[uploader][queue] LittleFS.begin() failed, attempting format...");
-      // Try to salvage by formatting once (this will erase any queued frames)
-      if (LittleFS.format()) {
-        Serial.println("[uploader][queue] LittleFS formatted, attempting mount...");
-        if (LittleFS.begin()) {
-          Serial.println("[uploader][queue] LittleFS mounted after format");
-        } else {
-          Serial.println("[uploader][queue] LittleFS.begin() still failed after format");
-        }
-      } else {
-        Serial.println("[uploader][queue] LittleFS.format() failed");
-      }
+// Identity of an uploaded frame. Live sends, stale-socket resends and queue replays
+// (also after a reboot) of the same frame carry the same values, so the gateway can
+// drop a duplicate before running detection on it. Sequence numbers are device-wide
+// and persistent; the hash is CRC-32 of the bytes actually sent.
+typedef struct {
+  char seq[12];
+  char hash[12];
+  char when[24];   // capture wall-clock time, filled in by the caller (may stay empty)
+  char key[80];    // Idempotency-Key: "<device id>/<seq>-<hash>"
+} frame_ident_t;
+
+static void frame_ident(frame_ident_t *id, const uint8_t *buf, size_t len, uint32_t seq) {
+  uint32_t crc = esp_rom_crc32_le(0, buf, len);
+  snprintf(id->seq, sizeof(id->seq), "%u", (unsigned)seq);
+  snprintf(id->hash, sizeof(id->hash), "%08x", (unsigned)crc);
+  snprintf(id->key, sizeof(id->key), "%s/%u-%08x", cfg.device_id, (unsigned)seq, (unsigned)crc);
+  id->when[0] = 0;
+}
+
+// Send up to `max_frames` queued frames over the kept-alive connection, in the configured order.
+// Each request asks the breaker first, so a drain can also be the probe of a down gateway.
+static void queue_drain(int max_frames) {
+  if (!upload_queue_ready() || upload_queue_count() == 0) return;
+  upload_queue_frame_t qf;
+  for (int n = 0; n < max_frames && upload_queue_peek(&qf); n++) {
+    if (!upload_breaker_allow(millis())) break;
+    // Same identity as the live attempt; the capture time is only sent if it was stored as wall clock
+    frame_ident_t id;
+    frame_ident(&id, qf.buf, qf.len, qf.seq);
+    if (qf.timestamp.tv_sec >= FRAME_CLOCK_MIN_EPOCH) {
+      snprintf(id.when, sizeof(id.when), "%lld.%06ld", (long long)qf.timestamp.tv_sec, (long)qf.timestamp.tv_usec);
+    }
+    upload_header_t hdrs[] = {
+      {"X-API-KEY", cfg.api_key},
+      {"X-DEVICE-ID", cfg.device_id},
+      {"X-Frame-Seq", id.seq},
+      {"X-Frame-Hash", id.hash},
+      {"X-Capture-Time", id.when},
+      {"Idempotency-Key", id.key},
+    };
+
+    // attempt to POST queued frame (single try)
+    unsigned long qstart = millis();
+    int rc = upload_conn_post(&gateway_conn, NULL, "application/octet-stream", hdrs, sizeof(hdrs) / sizeof(hdrs[0]), qf.buf, qf.len, NULL, 0);
+    ALOGI(ALOG_QUEUE, "[uploader][queue] POST took %u ms, result=%d", (unsigned int)(millis() - qstart), rc);
+
+    if (gateway_ok(rc)) {
+      upload_breaker_success(millis());
+      upload_queue_ack(&qf);
+      ALOGI(ALOG_QUEUE, "[uploader][queue] drained frame %u, %u left", (unsigned)qf.seq, (unsigned)upload_queue_count());
     } else {
-      Serial.println("[uploader][queue] LittleFS ready");
-      // ensure directory exists
-      if (!LittleFS.exists("/uploadq")) {
-        LittleFS.mkdir("/uploadq");
-      }
+      // stop if a queued upload failed to avoid burning cycles
+      upload_breaker_failure(millis());
+      ALOGW(ALOG_QUEUE, "[uploader][queue] POST failed (%d) -> %s", rc, gateway_conn.url);
+      break;
     }
   }
+}
 
-  // POST buffer to gateway (with DNS check, TLS support and retries)
-  {
-    const int maxAttempts = 5; // longer for remote unreliable networks
-    int attempt = 0;
-    int backoffMs = 1000;
-    bool uploaded = false;
-
-    // Persistent secure client to reduce TLS handshake overhead across attempts
-    static WiFiClientSecure persistentSecureClient;
-    static bool persistentSecureInited = false;
-
-    String host = uploadUrl;
-    host.replace("https://", ""); host.replace("http://", "");
-    int idx = host.indexOf('/'); if (idx >= 0) host = host.substring(0, idx);
-    int cidx = host.indexOf(':'); if (cidx >= 0) host = host.substring(0, cidx);
-
-    Serial.printf("[uploader] DNS precheck for %s -> host=%s RSSI=%d\n", uploadUrl.c_str(), host.c_str(), WiFi.RSSI());
-
-    for (attempt = 1; attempt <= maxAttempts && !uploaded; attempt++) {
-      // DNS check with extended retries
-      IPAddress resolved;
-      bool ok = false;
-      for (int r=0; r<3; r++) {
-        if (WiFi.hostByName(host.c_str(), resolved)) { ok = true; break; }
-        Serial.printf("[uploader] DNS lookup attempt %d failed for %s, retrying...\n", r+1, host.c_str());
-        delay(200 * (r+1));
-      }
-      if (!ok) {
-        Serial.printf("[uploader] DNS lookup failed for %s (attempt %d)\n", host.c_str(), attempt);
-        delay(backoffMs);
-        backoffMs = min(backoffMs * 2, 15000);
-        continue;
-      }
+// Keep a frame that could not be sent now; it goes out with a later drain.
+// The capture time is stored as wall clock when known, since the boot-relative
+// one means nothing once the device has rebooted.
+static void defer_frame(const uint8_t *buf, size_t len, uint32_t seq, const struct timeval *timestamp) {
+  if (cfg.queue_enabled && upload_queue_ready()) {
+    upload_queue_set_max_frames((int)cfg.queue_size);
+    struct timeval stored = *timestamp;
+    frame_clock_wall_tv(timestamp, &stored);
+    if (upload_queue_append(buf, len, seq, &stored)) {
+      metrics_inc(METRIC_UPLOADS_DEFERRED);
+      return;
+    }
+  }
+  metrics_inc(METRIC_UPLOADS_SHED);
+}
 
-      // Determine if TLS is required
-      bool isTls = uploadUrl.startsWith("https://");
-      // Quick TCP-level connect test to detect network / firewall issues before TLS/HTTP
-      uint16_t port = isTls ? 443 : 80;
-      WiFiClient tc;
-      Serial.printf("[uploader] TCP connect test to %s:%u\n", resolved.toString().c_str(), port);
-      if (!tc.connect(resolved, port)) {
-        Serial.printf("[uploader] TCP connect to %s:%u failed (attempt %d) - network or remote host refusing connections\n", resolved.toString().c_str(), port, attempt);
-        tc.stop();
-        delay(backoffMs);
-        backoffMs = min(backoffMs * 2, 15000);
-        continue;
-      } else {
-        Serial.printf("[uploader] TCP connect to %s:%u succeeded\n", resolved.toString().c_str(), port);
-        tc.stop();
-      }
+// One POST of a live frame over the kept-alive connection. Failures are not retried
+// here: the breaker schedules the next attempt (decorrelated jitter) and the frame is
+// queued, so the upload task never sleeps while the gateway is unreachable.
+// The request's phase timings complete `span`, which is committed to the trace ring.
+static bool upload_frame(const uint8_t *buf, size_t len, uint32_t seq, const struct timeval *timestamp, upload_span_t *span) {
+  if (!upload_breaker_allow(millis())) {
+    defer_frame(buf, len, seq, timestamp);
+    return false;
+  }
 
-      WiFiClientSecure *secureClient = nullptr;
-      bool began = false;
+  // Capture time (wall clock once SNTP has synced, boot-relative always) so the
+  // gateway can measure how old the frame is by the time detection runs
+  frame_ident_t id;
+  frame_ident(&id, buf, len, seq);
+  frame_clock_format(timestamp, id.when, sizeof(id.when));
+  char mono[24];
+  snprintf(mono, sizeof(mono), "%lld.%06ld", (long long)timestamp->tv_sec, (long)timestamp->tv_usec);
+
+  // Include optional headers to help Node register or resolve the device stream
+  upload_header_t hdrs[] = {
+    {"X-API-KEY", cfg.api_key},
+    {"X-STREAM-URL", cfg.stream_url},
+    {"X-DEVICE-ID", cfg.device_id},
+    {"X-Frame-Seq", id.seq},
+    {"X-Frame-Hash", id.hash},
+    {"X-Capture-Time", id.when},
+    {"X-Timestamp", mono},
+    {"Idempotency-Key", id.key},
+  };
+  char resp[256];
+
+  unsigned long start = millis();
+  gateway_conn.span = span;
+  int httpCode = upload_conn_post(&gateway_conn, NULL, "application/octet-stream", hdrs, sizeof(hdrs) / sizeof(hdrs[0]), buf, len, resp, sizeof(resp));
+  gateway_conn.span = NULL;
+  upload_trace_commit(span, httpCode, len);
+  metrics_observe_upload_ms(millis() - start);
+  ALOGI(ALOG_UPLOADER, "[uploader] POST took %u ms, result=%d (reused=%u reconnects=%u)", (unsigned int)(millis() - start), httpCode,
+                (unsigned)gateway_conn.stats.reused, (unsigned)gateway_conn.stats.reconnects);
+
+  // Feed the adaptive profile; only slow answers say something about the link
+  if (gateway_ok(httpCode)) {
+    upload_abr_record(len, gateway_conn.last_send_ms, gateway_conn.last_wait_ms, true, cfg.interval_ms);
+  } else if (httpCode == UPLOAD_CONN_ERR_TIMEOUT) {
+    upload_abr_record(len, 0, 0, false, cfg.interval_ms);
+  }
 
-      if (isTls) {
-        if (!persistentSecureInited) {
-          // NOTE: setInsecure() is convenient for testing but not recommended for production
-          Serial.println("[uploader] initializing persistent secure client (setInsecure)");
-          persistentSecureClient.setInsecure();
-          persistentSecureInited = true;
-        }
-        secureClient = &persistentSecureClient;
-        // Explicitly pass host, port and path so SNI/Host are set correctly for TLS
-        String pathOnly = "/";
-        int hostPos = uploadUrl.indexOf(host);
-        if (hostPos >= 0) {
-          pathOnly = uploadUrl.substring(hostPos + host.length());
-          if (pathOnly.length() == 0) pathOnly = "/";
-        } else {
-          int slashPos = uploadUrl.indexOf('/');
-          if (slashPos >= 0) pathOnly = uploadUrl.substring(slashPos);
-        }
-        Serial.printf("[uploader] TLS begin host=%s path=%s port=%u\n", host.c_str(), pathOnly.c_str(), port);
-        began = http.begin(*secureClient, uploadUrl.c_str());
+  if (!gateway_ok(httpCode)) {
+    upload_breaker_failure(millis());
+    ALOGW(ALOG_UPLOADER, "[uploader] POST failed (%d) -> %s, breaker %s, next attempt in %u ms", httpCode, gateway_conn.url,
+                  upload_breaker_state_name(upload_breaker_state()), (unsigned)upload_breaker_wait_ms(millis()));
+    defer_frame(buf, len, seq, timestamp);
+    return false;
+  }
+
+  upload_breaker_success(millis());
+  ALOGD(ALOG_UPLOADER, "[uploader] POST %d -> %s", httpCode, gateway_conn.url);
+  ALOGD(ALOG_UPLOADER, "[uploader] Response: %s", resp);
+
+  register_stream_once();
+
+  // On success, send a few queued frames; the rest follow while the task is idle
+  if (cfg.queue_enabled) {
+    queue_drain(UPLOAD_QUEUE_DRAIN_BATCH);
+  }
+  return true;
+}
+
+static void captureTask(void *pvParameters) {
+  (void) pvParameters;
+
+  TickType_t lastWake = xTaskGetTickCount();
+  while (true) {
+    // Use dynamic interval in case user updated settings via web UI
+    TickType_t period = pdMS_TO_TICKS(uploader_get_interval_ms());
+
+    bool connected = WiFi.status() == WL_CONNECTED;
+    // Keep-lit: the LED stays on for the whole upload session; frames from before
+    // it came on are skipped
+    bool keep_lit = connected && uploader_get_flash_keep_lit();
+    led_flash_hold(LED_FLASH_UPLOAD, keep_lit);
+
+    if (connected) {
+      // The sensor stays at the streaming profile; uploadTask derives the upload size in software
+      frame_ref_t ref;
+      if (!frame_bus_take(FRAME_BUS_UPLOADER, keep_lit ? led_flash_cutoff_us() : 0, pdMS_TO_TICKS(1000), &ref)) {
+        metrics_inc(METRIC_CAPTURE_FAILURES);
+        ALOGW(ALOG_CAPTURE, "[capture] Camera capture failed");
       } else {
-        began = http.begin(uploadUrl.c_str());
+        uint32_t seq = ref.frame->seq;
+        metrics_inc(METRIC_CAPTURES);
+        // The capture phase starts when the driver stamped the frame, not when we
+        // started waiting for it
+        bool queued = frame_ring_push(ref.frame->fb, seq, frame_capture_us(ref.frame->fb));
+        // Hand the buffer back before any network work happens
+        frame_bus_release(&ref);
+        if (!queued) {
+          ALOGW(ALOG_CAPTURE, "[capture] ring full, dropped frame %u", (unsigned)seq);
+        }
       }
+    } else {
+      ALOGW(ALOG_CAPTURE, "[capture] WiFi not connected, skipping capture");
+    }
 
-      if (!began) {
-        Serial.printf("[uploader] http.begin failed for %s (attempt %d)\n", uploadUrl.c_str(), attempt);
-        delay(backoffMs);
-        backoffMs = min(backoffMs * 2, 15000);
-        continue;
-      }
+    // Keep a steady cadence; if we fell behind (e.g. interval shortened) restart from now
+    if (xTaskGetTickCount() - lastWake > period) lastWake = xTaskGetTickCount();
+    vTaskDelayUntil(&lastWake, period);
+  }
+}
 
-      http.addHeader("Content-Type", "application/octet-stream");
-      if (apiKey.length() > 0) {
-        http.addHeader("X-API-KEY", apiKey.c_str());
-      }
-      // Include optional headers to help Node register or resolve the device stream
-      String streamUrl = uploader_get_stream_url();
-      String deviceId = uploader_get_device_id();
-      if (streamUrl.length() > 0) http.addHeader("X-STREAM-URL", streamUrl.c_str());
-      if (deviceId.length() > 0) http.addHeader("X-DEVICE-ID", deviceId.c_str());
-
-      // Ensure HTTPClient has a sensible timeout for network operations (seconds)
-      http.setTimeout(60); // seconds
-      unsigned long start = millis();
-      int httpCode = http.sendRequest("POST", fb->buf, fb->len);
-      Serial.printf("[uploader] sendRequest took %u ms, result=%d\n", (unsigned int)(millis() - start), httpCode);
-
-      static bool stream_registered = false;
-      if (httpCode > 0) {
-        String payload = http.getString();
-        Serial.printf("[uploader] POST %d -> %s\n", httpCode, uploadUrl.c_str());
-        Serial.printf("[uploader] Response: %s\n", payload.c_str());
-
-        // Attempt to register public stream URL once (if available and gateway exists)
-        if (!stream_registered) {
-          String gw = uploader_get_gateway();
-          String sUrl = uploader_get_stream_url();
-          String devId = uploader_get_device_id();
-          String apiKeyLocal = uploader_get_api_key();
-          if (gw.length() > 0 && sUrl.length() > 0 && devId.length() > 0) {
-            if (!gw.startsWith("http://") && !gw.startsWith("https://")) gw = String("http://") + gw;
-            if (gw.endsWith("/")) gw = gw.substring(0, gw.length()-1);
-            String regUrl = gw + "/devices/" + devId + "/register_stream";
-
-            // Use TLS-aware registration too
-            HTTPClient rh;
-            if (regUrl.startsWith("https://")) {
-              WiFiClientSecure *rclient = new WiFiClientSecure();
-              rclient->setInsecure();
-              if (rh.begin(*rclient, regUrl.c_str())) {
-                rh.addHeader("Content-Type", "application/json");
-                if (apiKeyLocal.length() > 0) rh.addHeader("X-API-KEY", apiKeyLocal.c_str());
-                String body = String("{\"url\":\"") + sUrl + String("\"}");
-                int rc = rh.POST((uint8_t*)body.c_str(), body.length());
-                if (rc > 0 && (rc >= 200 && rc < 300)) {
-                  Serial.printf("[uploader] Stream registered (%d) -> %s\n", rc, regUrl.c_str());
-                  stream_registered = true;
-                } else {
-                  Serial.printf("[uploader] Stream register failed (%d) -> %s\n", rc, regUrl.c_str());
-                }
-              } else {
-                Serial.printf("[uploader] Stream register http.begin failed -> %s\n", regUrl.c_str());
-              }
-              rh.end();
-              delete rclient;
-            } else {
-              if (rh.begin(regUrl.c_str())) {
-                rh.addHeader("Content-Type", "application/json");
-                if (apiKeyLocal.length() > 0) rh.addHeader("X-API-KEY", apiKeyLocal.c_str());
-                String body = String("{\"url\":\"") + sUrl + String("\"}");
-                int rc = rh.POST((uint8_t*)body.c_str(), body.length());
-                if (rc > 0 && (rc >= 200 && rc < 300)) {
-                  Serial.printf("[uploader] Stream registered (%d) -> %s\n", rc, regUrl.c_str());
-                  stream_registered = true;
-                } else {
-                  Serial.printf("[uploader] Stream register failed (%d) -> %s\n", rc, regUrl.c_str());
-                }
-              } else {
-                Serial.printf("[uploader] Stream register http.begin failed -> %s\n", regUrl.c_str());
-              }
-              rh.end();
-            }
-          }
-        }
+static void uploadTask(void *pvParameters) {
+  (void) pvParameters;
 
-        uploaded = true;
-
-        // On success, attempt to drain queue if enabled
-        if (uploader_is_queue_enabled()) {
-          Serial.println("[uploader][queue] Upload succeeded, attempting to drain queue");
-          // Drain loop: iterate files /uploadq/0..N-1 and upload sequentially
-          int cap = uploader_get_queue_size();
-          for (int i=0; i<cap; i++) {
-            String path = String("/uploadq/") + String(i) + String(".bin");
-            if (!LittleFS.exists(path)) continue;
-            File f = LittleFS.open(path, "r");
-            if (!f) { Serial.printf("[uploader][queue] failed to open %s\n", path.c_str()); continue; }
-            size_t len = f.size();
-            uint8_t *buf = (uint8_t*)malloc(len);
-            if (!buf) { Serial.println("[uploader][queue] OOM reading queued frame"); f.close(); continue; }
-            f.read(buf, len);
-            f.close();
-
-            // attempt to POST queued frame (single try)
-            HTTPClient qhttp;
-            bool qOk = false;
-            if (uploadUrl.startsWith("https://")) {
-              // Reuse persistent secure client created above to reduce TLS overhead
-              if (qhttp.begin(persistentSecureClient, uploadUrl.c_str())) {
-                qhttp.addHeader("Content-Type", "application/octet-stream");
-                qhttp.setTimeout(60); // seconds
-                unsigned long qstart = millis();
-                int rc = qhttp.sendRequest("POST", buf, len);
-                Serial.printf("[uploader][queue] sendRequest took %u ms, result=%d\n", (unsigned int)(millis() - qstart), rc);
-                if (rc > 0) {
-                  Serial.printf("[uploader][queue] POST %d -> %s\n", rc, uploadUrl.c_str());
-                  qOk = true;
-                } else {
-                  Serial.printf("[uploader][queue] POST failed (%d) -> %s\n", rc, uploadUrl.c_str());
-                }
-              }
-              qhttp.end();
-            } else {
-              if (qhttp.begin(uploadUrl.c_str())) {
-                qhttp.addHeader("Content-Type", "application/octet-stream");
-                qhttp.setTimeout(60); // seconds
-                unsigned long qstart = millis();
-                int rc = qhttp.sendRequest("POST", buf, len);
-                Serial.printf("[uploader][queue] sendRequest took %u ms, result=%d\n", (unsigned int)(millis() - qstart), rc);
-                if (rc > 0) {
-                  Serial.printf("[uploader][queue] POST %d -> %s\n", rc, uploadUrl.c_str());
-                  qOk = true;
-                } else {
-                  Serial.printf("[uploader][queue] POST failed (%d) -> %s\n", rc, uploadUrl.c_str());
-                }
-              }
-              qhttp.end();
-            }
-
-            if (qOk) {
-              // delete queued file
-              LittleFS.remove(path);
-              Serial.printf("[uploader][queue] drained and removed %s\n", path.c_str());
-            } else {
-              // stop if a queued upload failed to avoid burning cycles
-              free(buf);
-              break;
-            }
-            free(buf);
-          }
-        }
+  upload_conn_init(&gateway_conn);
+  upload_breaker_init();
+  uploader_settings_snapshot(&cfg);
 
+  while (true) {
+    // With frames queued, wake up in time for the next allowed attempt so a recovered
+    // gateway is drained within one probe interval
+    uint32_t waitMs = 1000;
+    if (upload_queue_count() > 0) waitMs = constrain(upload_breaker_wait_ms(millis()), 10, 1000);
+
+    frame_slot_t *slot = frame_ring_acquire(pdMS_TO_TICKS(waitMs));
+    if (!slot) {
+      // Idle: catch up on queued frames, or tidy up one queued record at a time
+      if (gateway_conn.target_valid && upload_queue_count() > 0 && upload_breaker_wait_ms(millis()) == 0) {
+        queue_drain(UPLOAD_QUEUE_DRAIN_BATCH);
       } else {
-        Serial.printf("[uploader] POST failed (%d) -> %s (attempt %d)\n", httpCode, uploadUrl.c_str(), attempt);
+        upload_queue_compact_step();
       }
+      continue;
+    }
 
-      http.end();
-      // Keep persistent secure client around to avoid repeated allocations and TLS re-handshakes
+    // Pick up settings changed from the web UI
+    uploader_settings_snapshot(&cfg);
+    String uploadUrl = resolve_upload_url();
 
-      if (!uploaded) {
-        delay(backoffMs);
-        backoffMs = min(backoffMs * 2, 30000);
-      }
+    // If upload URL is still not configured, skip upload and keep AP available for provisioning
+    if (uploadUrl.length() == 0) {
+      ALOGW(ALOG_UPLOADER, "[uploader] upload URL not configured, skipping upload");
+      frame_ring_release(slot);
+      continue;
     }
 
-    if (!uploaded) {
-      Serial.printf("[uploader] giving up after %d attempts to %s\n", maxAttempts, uploadUrl.c_str());
-      // Save frame to persistent queue if enabled
-      if (uploader_is_queue_enabled()) {
-        int cap = uploader_get_queue_size();
-        // store in first available slot
-        bool stored = false;
-        for (int i=0; i<cap; i++) {
-          String path = String("/uploadq/") + String(i) + String(".bin");
-          if (!LittleFS.exists(path)) {
-            File f = LittleFS.open(path, "w");
-            if (!f) { Serial.printf("[uploader][queue] failed to open %s for write\n", path.c_str()); break; }
-            f.write(fb->buf, fb->len);
-            f.close();
-            Serial.printf("[uploader][queue] saved frame to %s\n", path.c_str());
-            stored = true;
-            break;
-          }
-        }
-        if (!stored) {
-          // ring: overwrite oldest
-          String path = String("/uploadq/0.bin");
-          File f = LittleFS.open(path, "w");
-          if (f) { f.write(fb->buf, fb->len); f.close(); Serial.printf("[uploader][queue] overwritten %s\n", path.c_str()); }
-        }
+    // Skip frames that show no change since the last uploaded one (heartbeat aside)
+    if (slot->format == PIXFORMAT_JPEG) {
+      motion_gate_config_t gate = {cfg.motion_enabled, (uint8_t)cfg.motion_threshold, (uint8_t)cfg.motion_area, cfg.heartbeat_ms};
+      if (motion_gate_check(slot->buf, slot->len, millis(), &gate) == MOTION_SKIP) {
+        frame_ring_release(slot);
+        continue;
       }
     }
-  }
 
-        esp_camera_fb_return(fb);
+    // Parsed once; only re-parsed (and the socket dropped) when the URL changes
+    upload_conn_set_url(&gateway_conn, uploadUrl.c_str());
 
-        // Use dynamic interval in case user updated settings via web UI
-        vTaskDelay(pdMS_TO_TICKS(interval));
-        continue; // Skip the static delay at bottom
-      }
+    queue_begin();
+
+    scaled_frame_t frame;
+    if (slot->format != PIXFORMAT_JPEG) {
+      frame.buf = slot->buf;
+      frame.len = slot->len;
     } else {
-      Serial.println("[uploader] WiFi not connected, skipping upload");
+      // The adaptive controller picks the profile, bounded by the stored settings
+      upload_abr_set_ceiling((int)cfg.frame_size, (int)cfg.jpeg_quality);
+      if (!frame_scaler_run(slot->buf, slot->len, slot->width, slot->height, upload_abr_framesize(), upload_abr_quality(), &frame)) {
+        ALOGW(ALOG_UPLOADER, "[uploader] scaling frame %u failed, uploading it at %ux%u", (unsigned)slot->seq, (unsigned)slot->width, (unsigned)slot->height);
+      }
     }
 
-    // If not connected use default interval
-    vTaskDelay(pdMS_TO_TICKS(uploader_get_interval_ms()));
+    upload_span_t span;
+    upload_span_begin(&span, slot->seq, slot->capture_us);
+    upload_span_phase(&span, UPLOAD_PHASE_CAPTURE, slot->capture_us, slot->ready_us);
+    upload_span_phase(&span, UPLOAD_PHASE_QUEUE, slot->ready_us, esp_timer_get_time());
+
+    if (upload_frame(frame.buf, frame.len, slot->seq, &slot->timestamp, &span)) {
+      if (metrics_get(METRIC_UPLOADS_OK) == 0) boot_mark(BOOT_FIRST_UPLOAD);
+      metrics_inc(METRIC_UPLOADS_OK);
+    } else {
+      metrics_inc(METRIC_UPLOADS_FAILED);
+    }
+    frame_ring_release(slot);
   }
 }
 
-static bool uploader_started = false;
+bool uploader_storage_begin() {
+  uploader_settings_t s;
+  uploader_settings_snapshot(&s);
+  if (!s.queue_enabled) return false;
+  return upload_queue_begin(UPLOAD_QUEUE_BUDGET_BYTES, UPLOAD_QUEUE_SEGMENT_BYTES, UPLOAD_RING_SLOT_BYTES, (upload_queue_policy_t)UPLOAD_QUEUE_DRAIN_POLICY);
+}
+
+// Claimed on entry so the boot stage and the Wi-Fi manager cannot both start the tasks
+static std::atomic<bool> uploader_started(false);
 
 void startUploaderTask() {
 #if UPLOAD_ENABLED
-  if (uploader_started) {
-    Serial.println("[uploader] uploader task already started");
+  bool expected = false;
+  if (!uploader_started.compare_exchange_strong(expected, true)) {
+    ALOGI(ALOG_UPLOADER, "[uploader] uploader task already started");
+    return;
+  }
+  // Load settings into RAM (no-op once main has done it)
+  uploader_settings_init();
+  if (!frame_ring_init(UPLOAD_RING_SLOTS, UPLOAD_RING_SLOT_BYTES, (frame_ring_policy_t)UPLOAD_RING_DROP_POLICY)) {
+    ALOGE(ALOG_UPLOADER, "[uploader] frame ring allocation failed, uploader not started");
+    uploader_started = false;
     return;
   }
-  xTaskCreatePinnedToCore(uploaderTask, "uploader", 12 * 1024, NULL, 1, NULL, 1);
-  uploader_started = true;
-  Serial.println("[uploader] uploader task started");
+  frame_scaler_init(UPLOAD_SCALED_MAX_BYTES);
+  // Capture stays next to the camera on the app core, network work goes to the protocol core
+  xTaskCreatePinnedToCore(captureTask, "capture", 4 * 1024, NULL, 2, NULL, 1);
+  xTaskCreatePinnedToCore(uploadTask, "uploader", 12 * 1024, NULL, 1, NULL, 0);
+  ALOGI(ALOG_UPLOADER, "[uploader] capture and uploader tasks started");
 #else
-  Serial.println("[uploader] uploader is disabled (UPLOAD_ENABLED=false)");
+  ALOGI(ALOG_UPLOADER, "[uploader] uploader is disabled (UPLOAD_ENABLED=false)");
 #endif
 }
+
+void uploader_status_to_json(cJSON *root) {
+  cJSON_AddBoolToObject(root, "running", uploader_started.load());
+
+  cJSON *ring = cJSON_AddObjectToObject(root, "ring");
+  frame_ring_to_json(ring);
+
+  cJSON *capture = cJSON_AddObjectToObject(root, "capture");
+  cJSON_AddNumberToObject(capture, "frames", metrics_get(METRIC_CAPTURES));
+  cJSON_AddNumberToObject(capture, "failures", metrics_get(METRIC_CAPTURE_FAILURES));
+
+  cJSON *upload = cJSON_AddObjectToObject(root, "upload");
+  cJSON_AddNumberToObject(upload, "ok", metrics_get(METRIC_UPLOADS_OK));
+  cJSON_AddNumberToObject(upload, "failed", metrics_get(METRIC_UPLOADS_FAILED));
+  cJSON_AddNumberToObject(upload, "deferred", metrics_get(METRIC_UPLOADS_DEFERRED));
+  cJSON_AddNumberToObject(upload, "shed", metrics_get(METRIC_UPLOADS_SHED));
+
+  cJSON *motion = cJSON_AddObjectToObject(root, "motion");
+  motion_gate_to_json(motion);
+
+  cJSON *breaker = cJSON_AddObjectToObject(root, "breaker");
+  upload_breaker_to_json(breaker, millis());
+
+  cJSON *scaler = cJSON_AddObjectToObject(root, "scaler");
+  frame_scaler_to_json(scaler);
+
+  cJSON *queue = cJSON_AddObjectToObject(root, "queue");
+  upload_queue_to_json(queue);
+
+  cJSON *conn = cJSON_AddObjectToObject(root, "connection");
+  upload_conn_stats_to_json(&gateway_conn, conn);
+}
@@ -2,7 +2,15 @@
 #define UPLOADER_H
 
 #include <Arduino.h>
+#include "cJSON.h"
 
 void startUploaderTask();
 
+// Mount the persistent upload queue ahead of the uploader so boot can overlap it
+// with Wi-Fi and camera init. Returns false if the queue is disabled or failed.
+bool uploader_storage_begin();
+
+// Adds uploader pipeline state (ring occupancy, capture/upload counters) to `root`
+void uploader_status_to_json(cJSON *root);
+
 #endif // UPLOADER_H
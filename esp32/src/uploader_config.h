@@ -13,9 +13,39 @@
 
 // Default frame size and JPEG quality to reduce bandwidth for uploads
 // FRAMESIZE_QQVGA (160x120) is recommended for slow links. Adjust if higher-res is needed.
+// Uploads are scaled down in software from the streaming resolution (1/2, 1/4 or 1/8,
+// never below this size); the sensor itself is not reconfigured.
 #define UPLOAD_FRAME_SIZE FRAMESIZE_QQVGA
 // JPEG quality: 0 = best quality, 63 = worst. Higher numbers reduce bandwidth. Default: 24
 #define UPLOAD_JPEG_QUALITY 24
+// Largest re-encoded upload frame; bigger results are uploaded unscaled
+#define UPLOAD_SCALED_MAX_BYTES (48 * 1024)
+
+// Change detection: skip frames that look like the last uploaded one (empty or
+// stopped belt). A frame counts as changed when at least UPLOAD_MOTION_AREA_PERCENT
+// of a 16x12 luminance grid moved by more than UPLOAD_MOTION_PIXEL_THRESHOLD levels
+// (0-255). A heartbeat frame is uploaded every UPLOAD_HEARTBEAT_MS regardless.
+#define UPLOAD_MOTION_ENABLED 1
+#define UPLOAD_MOTION_PIXEL_THRESHOLD 12
+#define UPLOAD_MOTION_AREA_PERCENT 2
+#define UPLOAD_HEARTBEAT_MS 30000
+
+// Keep the flash LED on while the uploader runs, so uploads and /capture need no
+// flash warm-up (boards with an LED only)
+#define UPLOAD_FLASH_KEEP_LIT 0
+
+// Adaptive upload profile. The stored upload framesize/quality are the best profile
+// allowed; the controller lowers quality (by UPLOAD_ABR_QUALITY_STEP, down to
+// UPLOAD_ABR_WORST_QUALITY) and then framesize (down to UPLOAD_ABR_MIN_FRAME_SIZE)
+// while send + response time stays above the target, and steps back up when uploads
+// take less than half of it. The target is also capped at 80% of the upload interval.
+// Decisions are taken every UPLOAD_ABR_WINDOW uploads.
+#define UPLOAD_ABR_ENABLED 1
+#define UPLOAD_ABR_TARGET_LATENCY_MS 1000
+#define UPLOAD_ABR_MIN_FRAME_SIZE FRAMESIZE_QQVGA
+#define UPLOAD_ABR_WORST_QUALITY 40
+#define UPLOAD_ABR_QUALITY_STEP 6
+#define UPLOAD_ABR_WINDOW 4
 
 // URL of the Node gateway upload endpoint
 // Replace with your machine's LAN IP or ngrok URL during testing
@@ -24,8 +54,45 @@
 // API key expected by the gateway (if used). Keep empty if not used.
 #define UPLOAD_API_KEY "changeme"
 
+// Gateway connection deadlines, one per phase (the connection itself is kept alive across uploads).
+// The resolved gateway address is cached for UPLOAD_DNS_TTL_MS.
+#define UPLOAD_DNS_TIMEOUT_MS 3000
+#define UPLOAD_DNS_TTL_MS (10 * 60 * 1000)
+#define UPLOAD_CONNECT_TIMEOUT_MS 5000
+#define UPLOAD_TLS_TIMEOUT_MS 8000
+#define UPLOAD_SEND_TIMEOUT_MS 10000
+#define UPLOAD_SEND_CHUNK_BYTES 4096
+#define UPLOAD_RESPONSE_TIMEOUT_MS 10000
+
+// Retry scheduling. After a failed request the next one waits a decorrelated-jitter
+// backoff between UPLOAD_RETRY_BASE_MS and UPLOAD_RETRY_CAP_MS. After
+// UPLOAD_BREAKER_THRESHOLD consecutive failures the gateway is marked down: frames
+// go straight to the persistent queue and a single probe request is let through
+// every UPLOAD_BREAKER_PROBE_MIN_MS..UPLOAD_BREAKER_PROBE_MAX_MS (jittered).
+#define UPLOAD_RETRY_BASE_MS 500
+#define UPLOAD_RETRY_CAP_MS 8000
+#define UPLOAD_BREAKER_THRESHOLD 3
+#define UPLOAD_BREAKER_PROBE_MIN_MS 2000
+#define UPLOAD_BREAKER_PROBE_MAX_MS 30000
+
 // Persistent upload queue (LittleFS) settings
 #define UPLOAD_QUEUE_ENABLED 1
 #define UPLOAD_QUEUE_SIZE 10  // number of frames to persist
+// The queue is a log of segment files under /uploadq. The byte budget bounds its
+// flash use (oldest segments are evicted first); UPLOAD_QUEUE_MAX_FRAMES caps the
+// in-RAM index. Drain order: 0 = oldest first (FIFO), 1 = newest first.
+#define UPLOAD_QUEUE_BUDGET_BYTES (512 * 1024)
+#define UPLOAD_QUEUE_SEGMENT_BYTES (64 * 1024)
+#define UPLOAD_QUEUE_MAX_FRAMES 256
+#define UPLOAD_QUEUE_DRAIN_POLICY 0
+// Queued frames sent after each successful live upload (more are sent while idle)
+#define UPLOAD_QUEUE_DRAIN_BATCH 4
+
+// In-RAM frame ring between the capture task and the upload task.
+// Each slot holds one JPEG copy (allocated in PSRAM when available); frames larger
+// than a slot are dropped. Drop policy when full: 0 = drop oldest, 1 = drop newest.
+#define UPLOAD_RING_SLOTS 4
+#define UPLOAD_RING_SLOT_BYTES (96 * 1024)
+#define UPLOAD_RING_DROP_POLICY 0
 
 #endif // UPLOADER_CONFIG_H
@@ -1,128 +1,99 @@
 #include "uploader_settings.h"
-#include <Preferences.h>
 #include "uploader_config.h"
 #include <WiFi.h>
 
-static Preferences prefs;
-static const char *NS = "uploader";
-
-void uploader_settings_init() {
-  prefs.begin(NS, false);
-}
-
-String uploader_get_url() {
-  // Return empty if not explicitly set, so the firmware can detect 'not configured'
-  String s = prefs.getString("url", String(""));
-  return s;
-}
-
-String uploader_get_api_key() {
-  String s = prefs.getString("api", String(""));
-  return s;
-}
-
-uint32_t uploader_get_interval_ms() {
-  uint32_t v = prefs.getUInt("interval", UPLOAD_INTERVAL_MS);
-  return v;
-}
-
-// Device ID stored or default to MAC address
-String uploader_get_device_id() {
-  String s = prefs.getString("device_id", String(""));
-  if (s.length() == 0) {
+// Device ID defaults to the station MAC address
+static const char *uploader_default_device_id() {
+  static char buf[18];
+  if (!buf[0]) {
     byte mac[6];
     esp_read_mac(mac, ESP_MAC_WIFI_STA);
-    char buf[32];
-    sprintf(buf, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    return String(buf);
+    snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
   }
-  return s;
+  return buf;
 }
 
-String uploader_get_stream_url() {
-  String s = prefs.getString("stream_url", String(""));
-  return s;
-}
+#define SETTINGS_STRUCT uploader_settings_t
+static const setting_field_t fields[] = {
+  UPLOADER_SETTINGS(SETTING_STR_FIELD, SETTING_U32_FIELD, SETTING_BOOL_FIELD)
+};
+#undef SETTINGS_STRUCT
 
-bool uploader_is_configured() {
-  // Consider uploader configured if gateway or url is set
-  String gw = prefs.getString("gateway", String(""));
-  if (gw.length() > 0) return true;
-  
-  String url = prefs.getString("url", String(""));
-  return url.length() > 0;
-}
+static uploader_settings_t cache;
+static settings_store_t store = {"uploader", fields, sizeof(fields) / sizeof(fields[0]), &cache, sizeof(cache)};
+
+#define READ(member, dst) settings_read(&store, offsetof(uploader_settings_t, member), &(dst), sizeof(dst))
+#define READ_STRING(member) read_string(offsetof(uploader_settings_t, member), sizeof(cache.member))
 
-void uploader_set_url(const char *url) {
-  if (url && strlen(url) > 0) prefs.putString("url", String(url));
+static String read_string(size_t offset, size_t size) {
+  char v[256];
+  if (size > sizeof(v)) size = sizeof(v);
+  settings_read(&store, offset, v, size);
+  v[size - 1] = 0;
+  return String(v);
 }
 
-void uploader_set_api_key(const char *key) {
-  if (key) prefs.putString("api", String(key));
+void uploader_settings_init() {
+  settings_load(&store);
 }
 
-void uploader_set_interval_ms(uint32_t ms) {
-  if (ms < 100) ms = 100; // clamp
-  prefs.putUInt("interval", ms);
+void uploader_settings_snapshot(uploader_settings_t *out) {
+  settings_read(&store, 0, out, sizeof(*out));
 }
 
-// Queue settings
-bool uploader_is_queue_enabled() {
-  return prefs.getUInt("queue_en", UPLOAD_QUEUE_ENABLED) ? true : false;
+uint32_t uploader_settings_version() {
+  return store.version;
 }
 
-void uploader_set_queue_enabled(bool en) {
-  prefs.putUInt("queue_en", en ? 1 : 0);
+int uploader_settings_apply_json(const cJSON *obj, uint8_t flags, char *err, size_t err_len) {
+  return settings_apply_json(&store, obj, flags, err, err_len);
 }
 
-int uploader_get_queue_size() {
-  int v = (int)prefs.getUInt("queue_sz", UPLOAD_QUEUE_SIZE);
-  if (v < 1) v = 1;
-  return v;
+void uploader_settings_to_json(cJSON *obj) {
+  settings_to_json(&store, obj, SETTING_JSON);
 }
 
-void uploader_set_queue_size(int size) {
-  if (size < 1) size = 1;
-  prefs.putUInt("queue_sz", (uint32_t)size);
+String uploader_get_url() {
+  // Empty if not explicitly set, so the firmware can detect 'not configured'
+  return READ_STRING(url);
 }
 
-void uploader_set_device_id(const char *id) {
-  if (id && strlen(id) > 0) prefs.putString("device_id", String(id));
+String uploader_get_api_key() {
+  return READ_STRING(api_key);
 }
 
-void uploader_set_stream_url(const char *url) {
-  if (url && strlen(url) > 0) prefs.putString("stream_url", String(url));
+uint32_t uploader_get_interval_ms() {
+  uint32_t v;
+  READ(interval_ms, v);
+  return v;
 }
 
-// Frame size and JPEG quality for uploads
-int uploader_get_frame_size() {
-  // Defaults to UPLOAD_FRAME_SIZE from uploader_config.h
-  return (int)prefs.getUInt("frame_sz", (uint32_t)UPLOAD_FRAME_SIZE);
+String uploader_get_device_id() {
+  return READ_STRING(device_id);
 }
 
-void uploader_set_frame_size(int framesize) {
-  if (framesize < 0) framesize = UPLOAD_FRAME_SIZE;
-  prefs.putUInt("frame_sz", (uint32_t)framesize);
+String uploader_get_stream_url() {
+  return READ_STRING(stream_url);
 }
 
-int uploader_get_jpeg_quality() {
-  int q = (int)prefs.getUInt("jpeg_q", (uint32_t)UPLOAD_JPEG_QUALITY);
-  if (q < 0) q = 0;
-  if (q > 63) q = 63;
-  return q;
+String uploader_get_gateway() {
+  return READ_STRING(gateway);
 }
 
-void uploader_set_jpeg_quality(int q) {
-  if (q < 0) q = 0;
-  if (q > 63) q = 63;
-  prefs.putUInt("jpeg_q", (uint32_t)q);
+String uploader_get_ntp_server() {
+  return READ_STRING(ntp_server);
 }
 
-String uploader_get_gateway() {
-  String s = prefs.getString("gateway", String(""));
-  return s;
+bool uploader_get_flash_keep_lit() {
+  bool v;
+  READ(flash_keep_lit, v);
+  return v;
 }
 
-void uploader_set_gateway(const char *gateway) {
-  if (gateway && strlen(gateway) > 0) prefs.putString("gateway", String(gateway));
-} 
+bool uploader_is_configured() {
+  // Consider uploader configured if gateway or url is set
+  char first[2];
+  READ(gateway, first[0]);
+  READ(url, first[1]);
+  return first[0] || first[1];
+}
@@ -2,38 +2,64 @@
 #define UPLOADER_SETTINGS_H
 
 #include <Arduino.h>
+#include "cJSON.h"
+#include "settings_registry.h"
 
+// Uploader settings, NVS namespace "uploader". Defaults come from uploader_config.h.
+//   STR(member, nvs key, json name, capacity, default fn, flags)
+//   U32(member, nvs key, json name, default, min, max, flags)
+//   BOOL(member, nvs key, json name, default, flags)
+// Change detection: frames whose luminance signature differs from the last uploaded
+// frame by less than motion_threshold levels in fewer than motion_area percent of
+// the cells are skipped; a heartbeat frame is still sent every heartbeat_ms.
+// ntp_server: SNTP source for frame capture times (empty = FRAME_CLOCK_DEFAULT_SERVER).
+// flash_keep_lit: keep the flash LED on while the uploader is capturing (boards with an LED).
+#define UPLOADER_SETTINGS(STR, U32, BOOL) \
+  STR(url, "url", "url", 256, NULL, SETTING_JSON | SETTING_PROVISION | SETTING_KEEP_IF_EMPTY) \
+  STR(gateway, "gateway", "gateway", 256, NULL, SETTING_JSON | SETTING_PROVISION | SETTING_KEEP_IF_EMPTY) \
+  STR(api_key, "api", "api_key", 128, NULL, SETTING_JSON | SETTING_PROVISION | SETTING_SECRET) \
+  U32(interval_ms, "interval", "interval_ms", UPLOAD_INTERVAL_MS, 100, UINT32_MAX, SETTING_JSON | SETTING_PROVISION) \
+  STR(device_id, "device_id", "device_id", 64, uploader_default_device_id, SETTING_JSON | SETTING_PROVISION | SETTING_KEEP_IF_EMPTY) \
+  STR(stream_url, "stream_url", "stream_url", 256, NULL, SETTING_JSON | SETTING_PROVISION | SETTING_KEEP_IF_EMPTY) \
+  U32(frame_size, "frame_sz", NULL, UPLOAD_FRAME_SIZE, 0, FRAMESIZE_INVALID - 1, 0) \
+  U32(jpeg_quality, "jpeg_q", NULL, UPLOAD_JPEG_QUALITY, 0, 63, 0) \
+  BOOL(queue_enabled, "queue_en", NULL, UPLOAD_QUEUE_ENABLED, 0) \
+  U32(queue_size, "queue_sz", NULL, UPLOAD_QUEUE_SIZE, 1, INT32_MAX, 0) \
+  BOOL(motion_enabled, "motion_en", "motion_enabled", UPLOAD_MOTION_ENABLED, SETTING_JSON) \
+  U32(motion_threshold, "motion_thr", "motion_threshold", UPLOAD_MOTION_PIXEL_THRESHOLD, 1, 255, SETTING_JSON) \
+  U32(motion_area, "motion_area", "motion_area_pct", UPLOAD_MOTION_AREA_PERCENT, 0, 100, SETTING_JSON) \
+  U32(heartbeat_ms, "heartbeat", "heartbeat_ms", UPLOAD_HEARTBEAT_MS, 1000, UINT32_MAX, SETTING_JSON) \
+  STR(ntp_server, "ntp", "ntp_server", 64, NULL, SETTING_JSON | SETTING_PROVISION) \
+  BOOL(flash_keep_lit, "flash_lit", "flash_keep_lit", UPLOAD_FLASH_KEEP_LIT, SETTING_JSON)
+
+typedef struct {
+  UPLOADER_SETTINGS(SETTING_STR_MEMBER, SETTING_U32_MEMBER, SETTING_BOOL_MEMBER)
+} uploader_settings_t;
+
+// Load the namespace into RAM; later calls return immediately
 void uploader_settings_init();
+// Consistent copy of every setting; no locks and no flash access
+void uploader_settings_snapshot(uploader_settings_t *out);
+// Number of commits ever made to the namespace
+uint32_t uploader_settings_version();
+// Validate and store the members of `obj` allowed by `flags` (SETTING_JSON or
+// SETTING_PROVISION) in one commit. Returns the number changed, or -1 with `err` set.
+int uploader_settings_apply_json(const cJSON *obj, uint8_t flags, char *err, size_t err_len);
+void uploader_settings_to_json(cJSON *obj);
+
+// Single-value getters, served from the cache
 String uploader_get_url();
 String uploader_get_api_key();
 uint32_t uploader_get_interval_ms();
-void uploader_set_url(const char *url);
-void uploader_set_api_key(const char *key);
-void uploader_set_interval_ms(uint32_t ms);
-
-// Device identifiers and optional public stream URL
+// Stored device id, or the station MAC address when none was set
 String uploader_get_device_id();
 String uploader_get_stream_url();
-void uploader_set_device_id(const char *id);
-void uploader_set_stream_url(const char *url);
-
-// Optional upload capture parameters
-int uploader_get_frame_size();
-void uploader_set_frame_size(int framesize);
-int uploader_get_jpeg_quality();
-void uploader_set_jpeg_quality(int q);
-
-// Upload queue settings
-bool uploader_is_queue_enabled();
-void uploader_set_queue_enabled(bool en);
-int uploader_get_queue_size();
-void uploader_set_queue_size(int size);
-
 // Gateway host (host or full URL) used to construct upload endpoint
 String uploader_get_gateway();
-void uploader_set_gateway(const char *gateway);
+String uploader_get_ntp_server();
+bool uploader_get_flash_keep_lit();
 
-// Returns true if an explicit uploader URL is saved in preferences
+// Returns true if an explicit uploader URL or gateway is saved in preferences
 bool uploader_is_configured();
 
 #endif // UPLOADER_SETTINGS_H
@@ -0,0 +1,1694 @@
+// Generated by tools/build_web_assets.py from web/ - do not edit.
+#ifndef WEB_ASSETS_H
+#define WEB_ASSETS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+  const char *name;
+  const char *type;
+  const uint8_t *gz;  // gzip-compressed body
+  size_t gz_len;
+  const char *etag;   // quoted, strong
+} web_asset_t;
+
+// index_ov2640.html: 42079 bytes, 6465 gzipped
+static const uint8_t web_index_ov2640_gz[] = {
+  0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xED, 0x3D, 0x6B, 0x73, 0xD3, 0x48,
+  0xB6, 0xDF, 0xF3, 0x2B, 0x84, 0x66, 0x16, 0xDB, 0x95, 0xD8, 0xB1, 0x1D, 0x27, 0x84, 0x90, 0x98,
+  0x85, 0x90, 0x01, 0x6A, 0x61, 0x86, 0x25, 0x33, 0x0C, 0x5B, 0x53, 0x53, 0x20, 0x4B, 0x6D, 0x5B,
+  0x83, 0x2C, 0x79, 0x25, 0x39, 0xB6, 0x87, 0xCA, 0xEF, 0xB8, 0x3F, 0xE8, 0xFE, 0xB1, 0x7B, 0x4E,
+  0x77, 0x4B, 0x6A, 0x49, 0xAD, 0xA7, 0x13, 0x9B, 0x9D, 0xBD, 0x40, 0x61, 0x3D, 0xBA, 0x4F, 0x9F,
+  0x77, 0x9F, 0xD3, 0x2F, 0x9D, 0x3F, 0x30, 0x1C, 0xDD, 0x5F, 0xCF, 0x89, 0x32, 0xF5, 0x67, 0xD6,
+  0x70, 0xEF, 0x9C, 0xFD, 0x28, 0xF0, 0xE7, 0x7C, 0x4A, 0x34, 0x83, 0x5D, 0xD2, 0xDB, 0x19, 0xF1,
+  0x35, 0x45, 0x9F, 0x6A, 0xAE, 0x47, 0xFC, 0x0B, 0x75, 0xE1, 0x8F, 0xDB, 0xA7, 0x6A, 0xF2, 0xB5,
+  0xAD, 0xCD, 0xC8, 0x85, 0x7A, 0x63, 0x92, 0xE5, 0xDC, 0x71, 0x7D, 0x55, 0xD1, 0x1D, 0xDB, 0x27,
+  0x36, 0x14, 0x5F, 0x9A, 0x86, 0x3F, 0xBD, 0x30, 0xC8, 0x8D, 0xA9, 0x93, 0x36, 0xBD, 0x39, 0x30,
+  0x6D, 0xD3, 0x37, 0x35, 0xAB, 0xED, 0xE9, 0x9A, 0x45, 0x2E, 0x7A, 0x22, 0x2C, 0xDF, 0xF4, 0x2D,
+  0x32, 0xBC, 0xBA, 0x7E, 0x77, 0xD4, 0x57, 0x7E, 0xFA, 0xD0, 0x3F, 0x19, 0x74, 0xCF, 0x0F, 0xD9,
+  0xB3, 0xA8, 0x8C, 0xE7, 0xAF, 0xC5, 0x7B, 0xFC, 0x33, 0x72, 0x8C, 0xB5, 0xF2, 0x35, 0xF6, 0x08,
+  0xFF, 0x8C, 0x01, 0x89, 0xF6, 0x58, 0x9B, 0x99, 0xD6, 0xFA, 0x4C, 0x79, 0xE6, 0x42, 0x9B, 0x07,
+  0xAF, 0x88, 0x75, 0x43, 0x7C, 0x53, 0xD7, 0x0E, 0x3C, 0xCD, 0xF6, 0xDA, 0x1E, 0x71, 0xCD, 0xF1,
+  0x93, 0x54, 0xC5, 0x91, 0xA6, 0x7F, 0x99, 0xB8, 0xCE, 0xC2, 0x36, 0xCE, 0x94, 0xEF, 0x7A, 0xA7,
+  0xF8, 0x37, 0x5D, 0x48, 0x77, 0x2C, 0xC7, 0x85, 0xF7, 0x57, 0x3F, 0xE0, 0xDF, 0x27, 0xF2, 0xD6,
+  0x3D, 0xF3, 0x4F, 0x72, 0xA6, 0xF4, 0x4E, 0xE6, 0xAB, 0xD8, 0xFB, 0xDB, 0xBD, 0xD8, 0xED, 0xB4,
+  0x9F, 0x85, 0x3D, 0xAF, 0x7F, 0x9A, 0x5F, 0xDF, 0x23, 0xBA, 0x6F, 0x3A, 0x76, 0x67, 0xA6, 0x99,
+  0xB6, 0x04, 0x92, 0x61, 0x7A, 0x73, 0x4B, 0x03, 0x1E, 0x8C, 0x2D, 0x92, 0x0B, 0xE7, 0xBB, 0x19,
+  0xB1, 0x17, 0x07, 0x05, 0xD0, 0x10, 0x48, 0xDB, 0x30, 0x5D, 0x56, 0xEA, 0x0C, 0xF9, 0xB0, 0x98,
+  0xD9, 0x85, 0x60, 0xF3, 0xF0, 0xB2, 0x1D, 0x9B, 0x3C, 0x91, 0x37, 0xB4, 0x74, 0xB5, 0x39, 0x16,
+  0xC0, 0xDF, 0x74, 0x91, 0x99, 0x69, 0x33, 0xA5, 0x3A, 0x53, 0x8E, 0x06, 0xDD, 0xF9, 0xAA, 0x40,
+  0x94, 0x47, 0x27, 0xF8, 0x37, 0x5D, 0x68, 0xAE, 0x19, 0x86, 0x69, 0x4F, 0xCE, 0x94, 0x53, 0x29,
+  0x08, 0xC7, 0x35, 0x88, 0xDB, 0x76, 0x35, 0xC3, 0x5C, 0x78, 0x67, 0xCA, 0x40, 0x56, 0x66, 0xA6,
+  0xB9, 0x13, 0xC0, 0xC5, 0x77, 0x00, 0xD9, 0x76, 0xAF, 0x9B, 0x53, 0xC4, 0x35, 0x27, 0x53, 0x1F,
+  0x44, 0x9A, 0x2A, 0x93, 0x64, 0x1A, 0x37, 0xA1, 0x22, 0x79, 0xE6, 0xF2, 0x4D, 0xCE, 0x35, 0xCD,
+  0x32, 0x27, 0x76, 0xDB, 0xF4, 0xC9, 0x0C, 0xC8, 0xF1, 0x7C, 0x97, 0xF8, 0xFA, 0x34, 0x0F, 0x95,
+  0xB1, 0x39, 0x59, 0xB8, 0x44, 0x82, 0x48, 0xC8, 0xB7, 0x1C, 0x82, 0xE1, 0x65, 0xFA, 0x55, 0x7B,
+  0x49, 0x46, 0x5F, 0x4C, 0xBF, 0xCD, 0x79, 0x32, 0x22, 0x63, 0xC7, 0x25, 0xD2, 0x92, 0x41, 0x09,
+  0xCB, 0xD1, 0xBF, 0xB4, 0x3D, 0x5F, 0x73, 0xFD, 0x32, 0x00, 0xB5, 0xB1, 0x4F, 0xDC, 0x62, 0x78,
+  0x04, 0xB5, 0xA2, 0x18, 0x5A, 0x76, 0xB3, 0xBC, 0x80, 0x69, 0x5B, 0xA6, 0x4D, 0xCA, 0xA3, 0x97,
+  0xD5, 0x6E, 0x1C, 0x1C, 0x2B, 0x55, 0x42, 0x30, 0xE6, 0x6C, 0x92, 0xA7, 0x25, 0x94, 0xD6, 0x74,
+  0x63, 0xDC, 0x6E, 0x7A, 0xDD, 0xEE, 0xDF, 0xD2, 0x2F, 0xA7, 0x84, 0xA9, 0xA9, 0xB6, 0xF0, 0x9D,
+  0xCD, 0x2D, 0xE2, 0xB4, 0x40, 0xD7, 0xFF, 0x3E, 0x23, 0x86, 0xA9, 0x29, 0x4D, 0xC1, 0x9C, 0x4F,
+  0xBB, 0xA0, 0x53, 0x2D, 0x45, 0xB3, 0x0D, 0xA5, 0xE9, 0xB8, 0x26, 0x18, 0x82, 0x46, 0xDD, 0x8D,
+  0x05, 0x4F, 0xA0, 0xE3, 0x98, 0x93, 0x96, 0x84, 0xE4, 0x1C, 0x9B, 0x11, 0x39, 0x22, 0x37, 0x9B,
+  0x92, 0x2E, 0xA7, 0x94, 0x01, 0x49, 0x68, 0x2C, 0x94, 0x57, 0x19, 0x99, 0x31, 0xC6, 0xAE, 0xDA,
+  0xB9, 0xB2, 0x0B, 0x0A, 0x05, 0x32, 0x84, 0x6E, 0x56, 0x6F, 0x42, 0xD1, 0x9B, 0xA9, 0xD2, 0x56,
+  0xD0, 0x4B, 0xB6, 0xE4, 0x75, 0x38, 0x50, 0xB9, 0xC8, 0x93, 0x4A, 0x51, 0x81, 0x5C, 0x39, 0xA9,
+  0x91, 0xEF, 0x60, 0x7F, 0xE7, 0xAB, 0x2C, 0x4A, 0x32, 0xBD, 0x48, 0x35, 0x4F, 0x52, 0xC1, 0x9B,
+  0x54, 0xF2, 0x28, 0xA5, 0xBD, 0x4A, 0x25, 0xCF, 0x52, 0xC5, 0xBB, 0x54, 0xF0, 0x30, 0xA5, 0xBC,
+  0x0C, 0x13, 0x67, 0x71, 0xBC, 0xF1, 0xDD, 0x68, 0xE1, 0xFB, 0x8E, 0xED, 0x6D, 0xD4, 0x45, 0x65,
+  0xD9, 0xD9, 0x1F, 0x0B, 0xCF, 0x37, 0xC7, 0xEB, 0x36, 0x37, 0x69, 0xB0, 0xB3, 0xB9, 0x06, 0x21,
+  0xE4, 0x88, 0xF8, 0x4B, 0x42, 0xF2, 0xC3, 0x0D, 0x5B, 0xBB, 0x01, 0xBF, 0x33, 0x99, 0x58, 0x32,
+  0xDD, 0xD3, 0x17, 0xAE, 0x87, 0x71, 0xDB, 0xDC, 0x31, 0x01, 0xB0, 0xFB, 0xA4, 0xC0, 0x6F, 0x96,
+  0x6C, 0xA8, 0xAD, 0x8F, 0x24, 0x6D, 0x39, 0x0B, 0x1F, 0x79, 0x2C, 0x95, 0x84, 0x03, 0xE4, 0x98,
+  0xFE, 0x5A, 0xFA, 0x8E, 0x5B, 0x62, 0x37, 0xDB, 0x2F, 0x77, 0xCB, 0xE3, 0x75, 0xA6, 0x4F, 0x89,
+  0xFE, 0x85, 0x18, 0xFB, 0x85, 0x61, 0x58, 0x51, 0x78, 0xD8, 0x31, 0xED, 0xF9, 0xC2, 0x6F, 0x63,
+  0x38, 0x35, 0xBF, 0x17, 0x99, 0x53, 0x85, 0x0C, 0x48, 0xEC, 0xF7, 0xF3, 0x82, 0x8A, 0xE3, 0xF9,
+  0x2A, 0x9F, 0x09, 0x22, 0xB2, 0x43, 0x4B, 0x1B, 0x11, 0x2B, 0x0F, 0x65, 0x6E, 0x0C, 0x19, 0x6E,
+  0x97, 0xFB, 0xAA, 0xEC, 0xD8, 0x2D, 0x11, 0x8B, 0x0E, 0x1E, 0xFD, 0xAD, 0x34, 0x1F, 0xE9, 0xF5,
+  0x41, 0xEC, 0x91, 0x47, 0x2C, 0x30, 0xB0, 0xAC, 0xD0, 0x1B, 0xCA, 0x2C, 0x01, 0x87, 0xDC, 0x06,
+  0x5C, 0xCD, 0x9E, 0x10, 0xF0, 0x05, 0xAB, 0x83, 0xE0, 0x32, 0x3F, 0x31, 0x28, 0x45, 0x3E, 0xBA,
+  0xEA, 0xE3, 0xFC, 0x44, 0x84, 0x39, 0x84, 0x03, 0xA5, 0xC3, 0x2E, 0x6A, 0x44, 0x25, 0x82, 0x7C,
+  0x73, 0x11, 0xE9, 0xF5, 0xB3, 0x43, 0x75, 0xA9, 0xE5, 0xC4, 0x75, 0x4B, 0x1A, 0xE8, 0x17, 0xBA,
+  0x86, 0x20, 0xE5, 0x1B, 0x8F, 0x8B, 0x92, 0xC6, 0xF1, 0xF8, 0xA8, 0x7B, 0x34, 0x28, 0x8C, 0x9C,
+  0xA4, 0x54, 0x26, 0x12, 0xC7, 0x27, 0x39, 0x6E, 0x25, 0x57, 0x09, 0x3C, 0xED, 0x46, 0x1A, 0xB4,
+  0x3B, 0x9E, 0xC9, 0x32, 0x37, 0x6D, 0xE4, 0x41, 0xEE, 0xE6, 0x4B, 0x52, 0x2F, 0xAE, 0xE8, 0x7D,
+  0x29, 0x7E, 0x34, 0xA4, 0x93, 0x9A, 0x40, 0xC0, 0x5E, 0x39, 0xDA, 0x31, 0x09, 0xC8, 0x8B, 0x08,
+  0x02, 0x96, 0x06, 0x95, 0x3E, 0x59, 0xF9, 0x6D, 0x83, 0xE8, 0x8E, 0xCB, 0xA2, 0xC1, 0x8C, 0xCC,
+  0x31, 0x21, 0xC8, 0x62, 0x8D, 0x3D, 0x9B, 0x3A, 0x37, 0xC4, 0x95, 0x30, 0x2B, 0x21, 0xD4, 0xC1,
+  0xE3, 0x81, 0x51, 0x02, 0x9A, 0x06, 0xDD, 0xA3, 0x94, 0xF7, 0x71, 0x70, 0xFD, 0x9E, 0xDE, 0xEF,
+  0x15, 0x83, 0xEB, 0x80, 0xCD, 0x68, 0x23, 0x8B, 0x18, 0x39, 0xBD, 0x99, 0x41, 0xC6, 0xDA, 0xC2,
+  0xF2, 0x0B, 0xB4, 0x52, 0xEB, 0xE2, 0xDF, 0xBC, 0x16, 0xA9, 0x1B, 0xFA, 0x0D, 0xC7, 0x85, 0x2E,
+  0xA8, 0xE3, 0xF8, 0x5D, 0xD2, 0x66, 0x10, 0x6A, 0x68, 0xF3, 0x39, 0xD1, 0xA0, 0x94, 0x4E, 0xB2,
+  0xE4, 0x50, 0x2A, 0xC5, 0x90, 0xFB, 0xF9, 0x52, 0x79, 0x7B, 0xA1, 0xC1, 0x86, 0xC1, 0x63, 0x25,
+  0x9A, 0xCF, 0xC6, 0x8E, 0xBE, 0xF0, 0x72, 0xFB, 0xF3, 0x6A, 0xF0, 0xCE, 0x02, 0x96, 0x79, 0x96,
+  0x49, 0xCD, 0x7F, 0x61, 0xDB, 0x28, 0xD1, 0xB6, 0xEF, 0x02, 0x99, 0x92, 0x86, 0xCA, 0x31, 0xAE,
+  0x96, 0x0F, 0x8B, 0x31, 0x36, 0x6B, 0xEC, 0x2A, 0xE1, 0xA6, 0xBA, 0x39, 0x9E, 0x56, 0x01, 0x1F,
+  0x62, 0x1A, 0x01, 0xA8, 0xCD, 0xF8, 0xE2, 0x4F, 0x17, 0x33, 0x59, 0x1C, 0x15, 0x34, 0xD6, 0x83,
+  0x4E, 0x9F, 0x35, 0xE7, 0x4E, 0x46, 0x5A, 0xB3, 0x7B, 0xD0, 0x3D, 0x38, 0x82, 0xFF, 0x5A, 0x55,
+  0x95, 0x8B, 0xB3, 0xB7, 0xDF, 0x2F, 0x31, 0xDC, 0x73, 0x5C, 0x3C, 0xAC, 0x94, 0xE5, 0xEC, 0x0B,
+  0x65, 0x51, 0xDE, 0x92, 0xE2, 0xE3, 0x4B, 0xBD, 0x4E, 0x41, 0x3F, 0x9C, 0xA1, 0xD2, 0xD5, 0x15,
+  0x51, 0xA2, 0x2D, 0x55, 0x45, 0x3C, 0x73, 0xFE, 0x6C, 0xB3, 0x20, 0xE4, 0xBF, 0x5E, 0xDB, 0x05,
+  0x56, 0xFC, 0xA5, 0x35, 0xBD, 0x32, 0x5F, 0xBC, 0x5D, 0xEB, 0x46, 0x37, 0x5B, 0xEA, 0x6D, 0x1E,
+  0xF5, 0x01, 0x86, 0x36, 0xE4, 0xA0, 0x2E, 0x24, 0xA3, 0x99, 0x91, 0xA1, 0x50, 0xA6, 0x06, 0x0F,
+  0xC6, 0xA6, 0x65, 0xB5, 0x2D, 0x67, 0x59, 0x1C, 0x89, 0xE4, 0x6B, 0x72, 0x4A, 0x4F, 0x8B, 0x55,
+  0xBE, 0x2E, 0xB6, 0x0B, 0xF0, 0x5C, 0xFF, 0x11, 0xD8, 0xFE, 0xB7, 0x75, 0x2D, 0x82, 0x69, 0xD4,
+  0xEB, 0x28, 0x6A, 0xE8, 0xE3, 0x66, 0x0D, 0x95, 0x52, 0x25, 0x16, 0x09, 0xE6, 0xA7, 0x3D, 0x4B,
+  0xD3, 0xD7, 0xA7, 0x35, 0x52, 0xCF, 0x28, 0x31, 0x72, 0x89, 0xA5, 0x61, 0x04, 0x5F, 0x6B, 0x84,
+  0xA2, 0x30, 0x7D, 0x13, 0xAB, 0x97, 0xA1, 0x84, 0xB2, 0xEE, 0xDB, 0x19, 0x5D, 0xEA, 0xB0, 0xD8,
+  0x21, 0xDB, 0x57, 0x1F, 0x77, 0x8B, 0xA8, 0x2E, 0xB4, 0x8C, 0xFE, 0xA6, 0x1E, 0x3D, 0x70, 0xDA,
+  0x13, 0x97, 0xAC, 0x4B, 0x10, 0x73, 0xC0, 0x7F, 0xCF, 0xD8, 0xF8, 0x71, 0xFD, 0xA1, 0x12, 0xDA,
+  0x01, 0x70, 0x2D, 0xEA, 0x0C, 0xBC, 0x12, 0x4D, 0x67, 0x37, 0x59, 0x46, 0x1F, 0xC3, 0xD1, 0x51,
+  0x55, 0x2D, 0xE1, 0x6E, 0xFE, 0x56, 0x35, 0x65, 0x0F, 0x7A, 0x5F, 0x79, 0x3E, 0x4F, 0xC6, 0x7E,
+  0xC6, 0xE4, 0x0F, 0x8D, 0x53, 0x8F, 0xF2, 0xBD, 0x5B, 0x5B, 0x18, 0x4D, 0x29, 0xF4, 0x1C, 0xE1,
+  0x20, 0x66, 0xB6, 0xF6, 0x49, 0x21, 0xA3, 0xF7, 0xAC, 0x0C, 0x3C, 0x5B, 0x24, 0x41, 0xF8, 0x4C,
+  0xC5, 0x0C, 0x65, 0x66, 0xBC, 0xCB, 0x07, 0xF1, 0x90, 0x8F, 0xCD, 0xFE, 0x89, 0x74, 0x6E, 0x25,
+  0xA7, 0x70, 0xFE, 0x20, 0x7B, 0xC6, 0x28, 0x60, 0xBA, 0xCB, 0xCA, 0x4C, 0x90, 0x45, 0x5F, 0x34,
+  0xA8, 0x6E, 0x95, 0x79, 0x1E, 0x26, 0x3D, 0x92, 0x95, 0x3F, 0xE4, 0x39, 0xD3, 0x20, 0xEC, 0x45,
+  0x75, 0xD5, 0x00, 0xA2, 0x5B, 0x53, 0xDD, 0x85, 0x31, 0xD6, 0xDE, 0x49, 0xB7, 0xA0, 0x49, 0xDD,
+  0x72, 0xBC, 0x0D, 0x07, 0xC0, 0xB2, 0xC7, 0xBF, 0x8E, 0x6B, 0x77, 0xDD, 0xB9, 0x36, 0x95, 0x6F,
+  0x8E, 0x09, 0x9E, 0xF7, 0xBA, 0x52, 0x4F, 0x9B, 0x3B, 0x4A, 0x49, 0x47, 0xD0, 0xE8, 0xFC, 0xE5,
+  0x99, 0xA2, 0x13, 0xB9, 0x1B, 0x8D, 0x0F, 0xD4, 0x95, 0x19, 0x2A, 0xCD, 0x95, 0xC3, 0xD4, 0x34,
+  0x0C, 0x62, 0x17, 0xAD, 0xFF, 0x28, 0x19, 0x3C, 0x20, 0xFE, 0xBF, 0x6F, 0xCB, 0x28, 0x72, 0x97,
+  0x35, 0xF4, 0xEE, 0xDB, 0x62, 0x78, 0x47, 0x93, 0x35, 0x92, 0x1E, 0x0F, 0x45, 0x72, 0x51, 0xED,
+  0xE7, 0x8E, 0xB5, 0x22, 0xCB, 0x80, 0x0F, 0x58, 0x2A, 0xED, 0xCD, 0x13, 0x58, 0xD1, 0x89, 0x94,
+  0x0E, 0x9F, 0x5B, 0xE2, 0xD3, 0x80, 0xED, 0xAC, 0xD9, 0x95, 0x3B, 0x9C, 0x6A, 0xA3, 0x1A, 0x90,
+  0x6C, 0x37, 0x93, 0x35, 0x3B, 0x8A, 0x8C, 0x72, 0x90, 0x0C, 0xBB, 0x98, 0x60, 0x71, 0x55, 0xBC,
+  0x54, 0x5D, 0xE3, 0x38, 0x3F, 0x14, 0x56, 0xC3, 0x9D, 0x1F, 0x46, 0x0B, 0xF7, 0xCE, 0x71, 0x49,
+  0x9C, 0xB8, 0x68, 0x8E, 0xB7, 0xA3, 0x5B, 0x9A, 0xE7, 0x5D, 0xA8, 0xB8, 0xB4, 0x4B, 0x8D, 0xAF,
+  0xA1, 0x3B, 0x37, 0xCC, 0x1B, 0xC5, 0x34, 0x2E, 0x54, 0xCB, 0x99, 0x38, 0x89, 0x77, 0xF4, 0x3D,
+  0x93, 0x32, 0xF4, 0x63, 0x17, 0x6A, 0x6C, 0x7E, 0x51, 0xA5, 0xB5, 0xA2, 0x47, 0xEA, 0xF0, 0xE1,
+  0x77, 0x8F, 0x1F, 0x3D, 0x3A, 0x79, 0xF2, 0xD0, 0x1E, 0x79, 0x73, 0xFE, 0xFF, 0xCF, 0x6C, 0x3A,
+  0x96, 0xAD, 0xE9, 0x83, 0xAE, 0xCD, 0xF7, 0x41, 0xF5, 0xBC, 0xF3, 0x43, 0x0A, 0x34, 0x81, 0xC8,
+  0x21, 0x60, 0x92, 0x81, 0x1B, 0x0F, 0x77, 0x64, 0xE8, 0x05, 0x45, 0x3C, 0xE8, 0xC1, 0x47, 0x9A,
+  0x2B, 0x29, 0x42, 0x8B, 0xB1, 0x60, 0x9A, 0xBA, 0x12, 0x95, 0xCA, 0x64, 0xE4, 0xAC, 0x92, 0x14,
+  0x50, 0xA2, 0xB8, 0xC0, 0x78, 0x29, 0x62, 0x64, 0x01, 0x84, 0x6A, 0xB4, 0x3A, 0x4E, 0xAE, 0x42,
+  0x19, 0x69, 0xA1, 0x98, 0x08, 0xB0, 0xF0, 0x4A, 0xB7, 0xBE, 0x04, 0xB2, 0x57, 0x03, 0xA1, 0xD8,
+  0x8E, 0xCF, 0x5C, 0x65, 0x46, 0x53, 0x31, 0x52, 0x79, 0x1D, 0x61, 0xDA, 0x90, 0x51, 0x01, 0xAC,
+  0x6D, 0x53, 0xE8, 0xEC, 0x59, 0x3E, 0xA4, 0xA4, 0x5C, 0x83, 0xCA, 0xEA, 0xF0, 0xE3, 0xE5, 0x9B,
+  0x7F, 0x28, 0x6F, 0x5F, 0xFD, 0x29, 0x95, 0x50, 0x11, 0x52, 0xE8, 0xA3, 0x4B, 0xB4, 0x2C, 0xC8,
+  0x23, 0xE0, 0x89, 0xCA, 0x25, 0x43, 0x21, 0x60, 0x6F, 0x6F, 0x11, 0x7B, 0xE2, 0x4F, 0x2F, 0xD4,
+  0x9E, 0x8A, 0x4B, 0x5A, 0x82, 0xBB, 0xBE, 0xAA, 0xA0, 0xFF, 0xA6, 0x17, 0x37, 0x9A, 0xB5, 0xC0,
+  0xAB, 0x6E, 0x19, 0x5A, 0xD3, 0xAA, 0x25, 0x2D, 0xC6, 0x1D, 0x4B, 0xC8, 0x63, 0xC1, 0x11, 0xC7,
+  0xB9, 0xAC, 0x0E, 0xAF, 0x89, 0x7F, 0x7E, 0xC8, 0x5E, 0x15, 0x48, 0x2D, 0xBF, 0x6D, 0xB0, 0x64,
+  0xA6, 0x0E, 0x79, 0x2A, 0x94, 0x27, 0xF8, 0xB1, 0xAB, 0xCD, 0x08, 0x72, 0xA5, 0x94, 0xE4, 0x45,
+  0xA9, 0x87, 0x35, 0xD5, 0xE1, 0x7B, 0x42, 0x03, 0x22, 0x40, 0xA3, 0x94, 0xE0, 0xCF, 0x79, 0x8C,
+  0x1A, 0x6B, 0x3F, 0xD4, 0x67, 0x3E, 0x27, 0xD5, 0xD6, 0x98, 0x9A, 0x97, 0xE0, 0xFB, 0x83, 0x76,
+  0x5B, 0xE9, 0xBF, 0x7D, 0xA7, 0xB4, 0xDB, 0x25, 0x0A, 0x3B, 0x73, 0x6A, 0x4E, 0x5C, 0xFE, 0xBD,
+  0x63, 0x75, 0xF8, 0xCB, 0xC7, 0x97, 0xCF, 0x9A, 0x10, 0x17, 0x76, 0x57, 0xBD, 0x7E, 0xB7, 0xDB,
+  0x3A, 0x3F, 0x64, 0x45, 0xAA, 0xC3, 0x1A, 0x80, 0x5C, 0x29, 0xAC, 0xFE, 0x29, 0xC0, 0xEA, 0xF6,
+  0x07, 0x1B, 0xC0, 0x3A, 0x52, 0x87, 0xAF, 0x5E, 0x30, 0x48, 0x8F, 0xFA, 0x9B, 0x20, 0xD5, 0x07,
+  0xAB, 0x44, 0x9C, 0x00, 0x9D, 0xD5, 0xA3, 0x93, 0xD3, 0x0D, 0x20, 0xF5, 0x80, 0xBC, 0x0F, 0x00,
+  0xEA, 0x14, 0x38, 0x75, 0xB2, 0x11, 0xA3, 0xC0, 0xE8, 0x10, 0x10, 0xF8, 0xF4, 0xD5, 0xE0, 0x74,
+  0x03, 0x40, 0x8F, 0x81, 0x49, 0x08, 0x08, 0x80, 0xAC, 0x8E, 0x36, 0xE1, 0xD2, 0xA9, 0x3A, 0xBC,
+  0x7C, 0xFD, 0x43, 0x73, 0x00, 0x94, 0xF5, 0x1F, 0x9F, 0x54, 0x81, 0x03, 0xBA, 0x17, 0x07, 0xF5,
+  0x48, 0x1D, 0x02, 0x2A, 0x88, 0x4E, 0x00, 0x05, 0xD4, 0x92, 0xE9, 0xE8, 0x2F, 0xB6, 0xB7, 0x98,
+  0xE3, 0x42, 0x77, 0x62, 0x28, 0x50, 0xC1, 0xB9, 0xA1, 0xBD, 0x5A, 0x0D, 0xAD, 0x3D, 0x51, 0x87,
+  0xFF, 0x44, 0xBA, 0xB1, 0xA1, 0xFE, 0x60, 0x03, 0xBA, 0x41, 0xFB, 0xA1, 0x3E, 0xC2, 0xA8, 0x0D,
+  0x02, 0x94, 0xFE, 0x15, 0x45, 0x06, 0x01, 0xF5, 0x1E, 0x9D, 0xD4, 0x47, 0x06, 0x54, 0xFE, 0x9F,
+  0x28, 0x05, 0x00, 0xB2, 0xEA, 0x0D, 0x36, 0x30, 0x1E, 0x50, 0x79, 0x30, 0x1C, 0xB0, 0xE6, 0xD3,
+  0xFA, 0x2A, 0x0A, 0xB8, 0x50, 0xAA, 0xC0, 0x2F, 0xA0, 0x5B, 0xA8, 0x8F, 0x0C, 0xE8, 0xFA, 0xE3,
+  0x93, 0xD5, 0xE3, 0x93, 0x72, 0x00, 0xD0, 0x9F, 0xA3, 0x6F, 0xCC, 0xF3, 0xF8, 0xF9, 0x1D, 0x42,
+  0x9E, 0xB3, 0xFF, 0xF7, 0x02, 0x52, 0x38, 0x7F, 0x5D, 0xD9, 0xD5, 0xF3, 0x7A, 0xC0, 0x13, 0x76,
+  0x51, 0xCE, 0xCB, 0x0B, 0x98, 0x84, 0xAB, 0x89, 0xD4, 0xE1, 0xA0, 0x44, 0x6F, 0x1A, 0x0B, 0xB7,
+  0x68, 0xDD, 0x18, 0xFE, 0xB4, 0x8B, 0x47, 0xCD, 0xC3, 0xCE, 0x1D, 0xAC, 0xE1, 0x48, 0x15, 0x3C,
+  0x4B, 0xAD, 0x6E, 0x44, 0x82, 0xAB, 0xB6, 0x52, 0x87, 0x27, 0x47, 0x85, 0xDD, 0x6F, 0x7D, 0x61,
+  0x8C, 0xE8, 0x60, 0x81, 0x4D, 0x3C, 0xAF, 0xB2, 0x3C, 0xA2, 0xAA, 0xEA, 0xF0, 0x79, 0x78, 0xBD,
+  0x89, 0x54, 0xDA, 0xFD, 0x0D, 0xC4, 0x22, 0xA0, 0xC3, 0x24, 0xD3, 0xEE, 0x73, 0xD1, 0x44, 0x81,
+  0xD6, 0xDD, 0x0A, 0xA6, 0x7F, 0x8F, 0x72, 0xC1, 0x64, 0xC1, 0xD5, 0x3C, 0xBF, 0xB2, 0x54, 0x82,
+  0x8A, 0xD0, 0x97, 0xF0, 0xAB, 0x9D, 0x49, 0x24, 0x44, 0xE5, 0x2F, 0x20, 0x0F, 0x4F, 0xF3, 0x17,
+  0x6C, 0xDD, 0x56, 0x65, 0x89, 0x44, 0x55, 0x21, 0x74, 0x09, 0xAF, 0x77, 0x26, 0x15, 0x01, 0x9D,
+  0xBF, 0x82, 0x5C, 0xE6, 0x44, 0x37, 0x35, 0xEB, 0x13, 0x19, 0x8F, 0xA1, 0xC3, 0xAA, 0x2E, 0x9B,
+  0x58, 0x75, 0x90, 0x0F, 0xBB, 0x57, 0xAE, 0xE8, 0x7D, 0xE5, 0x3C, 0x22, 0x01, 0xAE, 0x7E, 0x32,
+  0x91, 0xEC, 0xBD, 0xF9, 0x80, 0x3A, 0xA1, 0xE9, 0x1B, 0xBB, 0x52, 0x87, 0x3F, 0x3A, 0x21, 0x9E,
+  0xF5, 0x03, 0x8C, 0x1F, 0xC9, 0x84, 0x8E, 0x57, 0x6F, 0x12, 0xE7, 0xBC, 0x74, 0xB5, 0x35, 0xDD,
+  0x10, 0xB9, 0x49, 0xD4, 0xF5, 0x1E, 0xE2, 0xD1, 0x9F, 0x4D, 0xDB, 0xDF, 0x24, 0x06, 0x7C, 0xE9,
+  0x12, 0x62, 0x6F, 0x06, 0x05, 0x82, 0xD1, 0xE7, 0x70, 0xB1, 0x19, 0x90, 0x13, 0xCC, 0xAD, 0xE7,
+  0xA6, 0xF6, 0x2D, 0x84, 0x5B, 0xDA, 0x72, 0x54, 0xD9, 0x2C, 0xA0, 0x8E, 0x3A, 0x7C, 0xF6, 0xEB,
+  0xF3, 0xCA, 0x4E, 0x8A, 0xCD, 0xFA, 0x96, 0xD1, 0xF0, 0x68, 0xEC, 0x04, 0x1B, 0x4B, 0x0D, 0x6A,
+  0xC9, 0x2D, 0xA7, 0xEC, 0xC0, 0x96, 0x84, 0xAE, 0x00, 0x41, 0x3A, 0x49, 0xA6, 0x0A, 0x64, 0x96,
+  0xA3, 0xF1, 0xFE, 0x3C, 0x18, 0x20, 0xF1, 0x69, 0xA2, 0x99, 0x76, 0x1D, 0x21, 0xD1, 0x8A, 0x54,
+  0x52, 0xCA, 0x4B, 0xB8, 0xDA, 0x96, 0xB8, 0x58, 0xB3, 0x3B, 0x93, 0x19, 0xA7, 0x7A, 0xD7, 0x82,
+  0x03, 0x44, 0x66, 0x8E, 0x51, 0x7D, 0xC8, 0x8A, 0xD7, 0x53, 0x87, 0x20, 0xB5, 0xB7, 0x70, 0x51,
+  0xB9, 0x97, 0x09, 0x00, 0xDC, 0x73, 0xF7, 0xF2, 0x6C, 0xE1, 0x3B, 0x9B, 0xF4, 0x2C, 0xD7, 0x0B,
+  0xDB, 0x5E, 0x6F, 0xD2, 0xAD, 0x5C, 0x5A, 0xCE, 0xC2, 0x58, 0x6F, 0xD2, 0xA7, 0xFC, 0x34, 0x1E,
+  0x9B, 0x3A, 0xD9, 0x68, 0x54, 0xC1, 0x99, 0x91, 0x6F, 0xC2, 0x8B, 0x13, 0xBD, 0xBA, 0x83, 0x20,
+  0x3A, 0x48, 0xF1, 0xEA, 0x52, 0xB9, 0xBE, 0xFA, 0xF1, 0xFA, 0xA7, 0xF7, 0xDB, 0xF1, 0x0E, 0xD0,
+  0xE6, 0x8E, 0x1C, 0x03, 0x52, 0xBB, 0x73, 0x67, 0x4E, 0xF4, 0x7E, 0x1D, 0x39, 0xF5, 0x99, 0xA0,
+  0x5E, 0x5C, 0xBF, 0xDB, 0x96, 0x94, 0xFA, 0xBB, 0x13, 0x53, 0xFF, 0x5B, 0x90, 0xD3, 0x27, 0x8B,
+  0xDC, 0x10, 0xAB, 0x86, 0xAC, 0x58, 0x45, 0x94, 0x97, 0xF2, 0x06, 0xAF, 0x76, 0x96, 0xC8, 0x85,
+  0xA8, 0xFC, 0x05, 0xD2, 0x38, 0xD0, 0x8A, 0x4F, 0x14, 0xE9, 0x3A, 0xC6, 0xC3, 0x6A, 0xAA, 0xC3,
+  0xAB, 0xD5, 0xDC, 0xF1, 0x16, 0x2E, 0xD9, 0x44, 0x22, 0xDD, 0x8D, 0x04, 0x12, 0xA0, 0xC2, 0x24,
+  0xD2, 0xE5, 0x02, 0xC1, 0x09, 0x1D, 0x61, 0xAE, 0x6F, 0x70, 0xA7, 0x52, 0x41, 0xE0, 0xF7, 0x29,
+  0x98, 0x49, 0x8D, 0x7E, 0x67, 0x82, 0xFD, 0xCE, 0xCB, 0xCB, 0xED, 0xB8, 0xB2, 0xC9, 0xCE, 0x3A,
+  0x9C, 0xC9, 0x4E, 0x3B, 0x1C, 0x85, 0xCF, 0xB7, 0x07, 0x5C, 0xA8, 0x99, 0x44, 0xF0, 0x8A, 0x90,
+  0x3B, 0xD7, 0x49, 0x20, 0x04, 0xCB, 0xE9, 0xAD, 0x36, 0x31, 0x9D, 0x00, 0x8D, 0xB8, 0xE5, 0x1C,
+  0x45, 0x76, 0x73, 0x7C, 0xA7, 0x56, 0x73, 0x54, 0x88, 0xED, 0x26, 0x46, 0x83, 0x94, 0xE8, 0xC4,
+  0xB4, 0x70, 0xDB, 0x75, 0x55, 0x81, 0x08, 0x75, 0x99, 0x4C, 0x94, 0x4B, 0x76, 0xB7, 0x89, 0x6C,
+  0xFA, 0x9B, 0xC8, 0x46, 0xC4, 0x28, 0x2E, 0x9E, 0x93, 0x7B, 0xEA, 0x69, 0x70, 0xDE, 0xEC, 0x3E,
+  0xE7, 0x3C, 0xE6, 0xD5, 0x7D, 0x1A, 0xD4, 0x51, 0x87, 0xCF, 0xDF, 0x6D, 0xC7, 0xA7, 0x61, 0x63,
+  0x25, 0x7D, 0xDA, 0x46, 0x1E, 0x8C, 0x12, 0xB5, 0xF3, 0x34, 0xBA, 0x86, 0x34, 0x96, 0x88, 0xF8,
+  0xAF, 0x5B, 0x92, 0xC6, 0x72, 0xBE, 0xAB, 0x1E, 0x66, 0xF9, 0x2D, 0xC8, 0xC7, 0xD5, 0x96, 0x9F,
+  0x26, 0x33, 0xAD, 0xB2, 0x8C, 0x78, 0x3D, 0x75, 0xF8, 0x5E, 0x5B, 0x2A, 0x2F, 0xDF, 0x3E, 0xDB,
+  0x8A, 0xAC, 0x82, 0x46, 0x77, 0x23, 0xAF, 0x90, 0xE4, 0x5D, 0xCB, 0xCC, 0x22, 0x76, 0x75, 0xA3,
+  0xC2, 0x4A, 0xEA, 0xF0, 0x0D, 0xB1, 0x3D, 0xE5, 0xD2, 0x71, 0xF9, 0x11, 0x79, 0x5B, 0x91, 0x1A,
+  0x6D, 0x79, 0x37, 0x22, 0x63, 0x44, 0xEF, 0x5A, 0x5E, 0xD3, 0x99, 0xE9, 0xBA, 0x8E, 0x5B, 0x59,
+  0x64, 0xBC, 0x9E, 0x3A, 0x7C, 0xD5, 0x7E, 0x4B, 0xAF, 0xB6, 0x22, 0xAE, 0xA0, 0xD5, 0xDD, 0x48,
+  0x2C, 0xA4, 0x79, 0xD7, 0x42, 0xBB, 0x19, 0x5B, 0xE6, 0xBC, 0xB2, 0xC8, 0x68, 0x2D, 0x75, 0xF8,
+  0xA1, 0xFD, 0x03, 0xFC, 0x6E, 0x45, 0x5C, 0xAC, 0xC5, 0xDD, 0x08, 0x8B, 0x53, 0xBB, 0x6B, 0x51,
+  0x19, 0xFA, 0xB2, 0xB2, 0xA0, 0xA0, 0x8E, 0x3A, 0x7C, 0x71, 0xF9, 0xAB, 0xD2, 0x7C, 0xE1, 0x2C,
+  0x6D, 0x5C, 0x1C, 0xAA, 0x5C, 0xFD, 0xD8, 0xDA, 0x8A, 0xC4, 0xB0, 0xE9, 0xDD, 0xC8, 0x8B, 0x12,
+  0xBD, 0x6B, 0x69, 0xD1, 0x3D, 0x40, 0x23, 0xCD, 0xAD, 0xB1, 0xF6, 0x85, 0x55, 0xC4, 0xB5, 0x2F,
+  0x70, 0xA5, 0x3C, 0xD7, 0xB6, 0xE3, 0x10, 0xC3, 0x76, 0xB7, 0x11, 0xB4, 0x47, 0x44, 0xEE, 0x3E,
+  0xCA, 0x30, 0x4A, 0x88, 0x28, 0x1E, 0x62, 0x18, 0x9F, 0x70, 0x3B, 0x0D, 0x6E, 0x33, 0x5D, 0x43,
+  0xAC, 0x71, 0xF5, 0x42, 0x79, 0x1D, 0xDC, 0x96, 0xA0, 0xA6, 0xF6, 0x98, 0x5D, 0x56, 0x6A, 0x1B,
+  0xC7, 0x27, 0x9E, 0xDC, 0xF6, 0x8F, 0x8F, 0x37, 0x4B, 0x6F, 0xB3, 0x86, 0x51, 0x8F, 0x8F, 0x37,
+  0x94, 0x89, 0xB8, 0x19, 0x83, 0x9F, 0x62, 0x58, 0x64, 0x24, 0x7C, 0x53, 0x00, 0x4D, 0xE7, 0x89,
+  0xDF, 0xF6, 0x7C, 0xD3, 0xB2, 0xD4, 0xE1, 0x4B, 0xE2, 0x2B, 0xD7, 0x78, 0x59, 0x72, 0x17, 0x80,
+  0x00, 0x25, 0xD8, 0x02, 0xE4, 0xBB, 0x44, 0x9B, 0xA9, 0xC3, 0x6B, 0x3C, 0xDF, 0x11, 0x60, 0xE1,
+  0x5D, 0x31, 0xB0, 0xD2, 0xFB, 0x05, 0xE8, 0x06, 0x21, 0xDC, 0xF1, 0x13, 0x3F, 0x8E, 0x15, 0x54,
+  0x9F, 0x6D, 0xFF, 0x1B, 0x9E, 0x7B, 0x73, 0xCD, 0x0E, 0x8A, 0xD1, 0xBD, 0x71, 0x4B, 0xBE, 0xD9,
+  0x69, 0xE4, 0x58, 0x06, 0x14, 0x7C, 0x66, 0xDC, 0xE0, 0xD1, 0x34, 0x86, 0x72, 0x1D, 0x6E, 0xDB,
+  0xC1, 0x2A, 0x60, 0x3B, 0x01, 0x84, 0x02, 0x66, 0x4F, 0xDD, 0x00, 0x3C, 0xDB, 0x60, 0x85, 0x87,
+  0x79, 0xE4, 0x70, 0x3B, 0x63, 0xA7, 0x91, 0x4B, 0x26, 0xA1, 0x0A, 0xC9, 0x36, 0xA0, 0x49, 0xF7,
+  0x1D, 0xBD, 0x27, 0x13, 0xD3, 0x03, 0x1C, 0x15, 0x90, 0xD3, 0x21, 0xDD, 0xAB, 0xC1, 0x2C, 0xA4,
+  0xDC, 0x3E, 0x20, 0xB1, 0x49, 0xBE, 0x8B, 0x51, 0xBA, 0xBB, 0xAB, 0x52, 0x17, 0x92, 0xDC, 0x8B,
+  0x15, 0x87, 0x58, 0xA4, 0x85, 0x0F, 0xDA, 0xED, 0xE9, 0x00, 0x77, 0x9D, 0x28, 0x01, 0x69, 0xE7,
+  0x87, 0xD3, 0x41, 0xD1, 0xD2, 0xF3, 0xC2, 0x2D, 0x43, 0x40, 0x69, 0xED, 0x1D, 0x43, 0xC8, 0xA5,
+  0x21, 0x60, 0x73, 0xA0, 0xBC, 0xD5, 0xBC, 0x2F, 0x07, 0xCA, 0x07, 0x34, 0xF8, 0x2D, 0x6E, 0x1C,
+  0x42, 0xDC, 0x35, 0xC3, 0x70, 0x33, 0x37, 0x0F, 0x0D, 0x62, 0x9B, 0x87, 0x4E, 0x82, 0xCD, 0x43,
+  0xC2, 0xD0, 0xDB, 0xAA, 0xD7, 0xEB, 0xDD, 0xE1, 0xFE, 0xA1, 0x3B, 0x21, 0x69, 0x06, 0xCC, 0x2C,
+  0x49, 0xD2, 0x20, 0x20, 0x69, 0x20, 0x90, 0x74, 0xDA, 0xFD, 0xD6, 0x28, 0xE2, 0x13, 0x3B, 0xDF,
+  0x08, 0x49, 0xA5, 0x36, 0x79, 0x51, 0xDD, 0xBE, 0xAB, 0x3D, 0x5E, 0x52, 0x67, 0x78, 0x9C, 0xEB,
+  0x0B, 0x05, 0x9B, 0x7F, 0x79, 0x97, 0x36, 0x3F, 0xD9, 0xC0, 0xE6, 0x27, 0x29, 0x9B, 0xDF, 0xA2,
+  0xB1, 0x07, 0x88, 0xFF, 0xC5, 0x0C, 0x3E, 0x20, 0xAB, 0x82, 0xD1, 0x4B, 0xC9, 0xDA, 0xAE, 0x85,
+  0x84, 0x9A, 0xF0, 0xF2, 0x2E, 0x2D, 0x24, 0x43, 0x6F, 0x6B, 0x29, 0x29, 0xF7, 0x39, 0xC3, 0xED,
+  0xF4, 0x49, 0x34, 0x92, 0x12, 0xC5, 0xC9, 0x5B, 0xC7, 0x9D, 0x47, 0x47, 0x03, 0x1E, 0x36, 0xDD,
+  0x85, 0x78, 0xCA, 0x6F, 0x26, 0xBD, 0xE7, 0xA0, 0x0C, 0x37, 0xBE, 0xCD, 0x21, 0x0E, 0xAE, 0x1C,
+  0x98, 0x5D, 0xBE, 0xF9, 0x47, 0xB5, 0x58, 0x2C, 0xD9, 0xD2, 0xF6, 0xE2, 0xB1, 0x7A, 0xDA, 0x2A,
+  0x32, 0x8C, 0xE3, 0x0E, 0x1E, 0x07, 0xB7, 0x55, 0xF7, 0x3F, 0x86, 0x94, 0x4B, 0x92, 0x66, 0xC1,
+  0x29, 0x84, 0xD5, 0xB2, 0x72, 0x62, 0xEA, 0x08, 0xF9, 0x20, 0x06, 0x5C, 0x07, 0x7E, 0x4D, 0x71,
+  0xC6, 0x63, 0xFA, 0xAD, 0x9E, 0x47, 0xE8, 0x30, 0xBC, 0x2F, 0xF8, 0xBC, 0xDB, 0x0B, 0x51, 0x92,
+  0x65, 0xC4, 0x11, 0x86, 0x21, 0x6E, 0x54, 0xC5, 0xB8, 0xA2, 0xDD, 0x19, 0x0B, 0x8E, 0x18, 0x0B,
+  0x5E, 0xBC, 0xFE, 0x20, 0xE3, 0x01, 0xB3, 0xB5, 0x6E, 0x9A, 0x05, 0x47, 0xF5, 0x37, 0x86, 0xF7,
+  0x4A, 0x73, 0xAB, 0x1B, 0x71, 0xEB, 0x68, 0x1C, 0xED, 0x19, 0xDB, 0xC4, 0x65, 0x49, 0x38, 0x70,
+  0xCC, 0x56, 0x85, 0x2A, 0xEF, 0x44, 0x0B, 0x28, 0xA5, 0x07, 0xC7, 0x55, 0xF4, 0xC0, 0x38, 0xDA,
+  0x40, 0x0D, 0x8E, 0x33, 0xD4, 0xE0, 0xAE, 0x78, 0x30, 0x50, 0x87, 0xEF, 0xEA, 0xA8, 0xC1, 0xA0,
+  0xA4, 0x1A, 0x1C, 0x05, 0x6A, 0x10, 0x6D, 0x28, 0x1C, 0x94, 0x65, 0x96, 0xA0, 0x05, 0x8F, 0xC6,
+  0x38, 0x8F, 0xFE, 0xA8, 0x9C, 0x25, 0x6C, 0xCF, 0xE7, 0x2E, 0x4D, 0xBB, 0xBA, 0xBF, 0xFD, 0xD5,
+  0xB4, 0x0D, 0x67, 0x59, 0xCD, 0xE5, 0x8A, 0x0D, 0x7D, 0xEB, 0xEE, 0xB6, 0x5A, 0xD6, 0x8A, 0x43,
+  0x2D, 0xED, 0x15, 0x46, 0xF6, 0xB6, 0xE7, 0xB8, 0x4A, 0xFA, 0xD8, 0x83, 0xD8, 0x8E, 0xA4, 0xA0,
+  0x74, 0xB9, 0x20, 0x20, 0xBD, 0x06, 0xFB, 0xF5, 0x0F, 0x4A, 0x8D, 0x1D, 0xE9, 0x12, 0x60, 0x7C,
+  0xE3, 0xBE, 0x52, 0x63, 0xE7, 0xBE, 0x04, 0x5A, 0xC6, 0x9A, 0x75, 0x3C, 0x45, 0x41, 0xA9, 0x77,
+  0x8C, 0x42, 0xE1, 0xF2, 0x6D, 0x21, 0x76, 0xD9, 0x6C, 0xBC, 0x82, 0x59, 0x2B, 0xC4, 0x58, 0x5E,
+  0x2D, 0x05, 0xE0, 0xD5, 0x57, 0x74, 0x79, 0xBB, 0x47, 0xFC, 0xFB, 0x8E, 0x0C, 0x3F, 0x9E, 0x09,
+  0xCE, 0x2C, 0x6C, 0xBC, 0xA2, 0x33, 0x8B, 0xE2, 0x7C, 0x50, 0xA6, 0x9D, 0x27, 0x2F, 0xFF, 0x92,
+  0x90, 0xB4, 0xAE, 0x4F, 0xD2, 0xD1, 0x5D, 0x91, 0xB4, 0x41, 0x57, 0x15, 0x6A, 0x97, 0xEF, 0xF8,
+  0x9A, 0x55, 0x5B, 0xB9, 0x58, 0x6D, 0xD0, 0x2D, 0xE6, 0x73, 0x95, 0x6B, 0x20, 0x75, 0xAB, 0x0A,
+  0x16, 0x20, 0x50, 0x4E, 0x18, 0x83, 0xB4, 0x30, 0x4E, 0xBF, 0x35, 0xFD, 0x62, 0x14, 0xAD, 0xEB,
+  0x53, 0x74, 0xF2, 0x2D, 0xA9, 0x97, 0xB3, 0xF0, 0xF1, 0x69, 0x6D, 0xE7, 0xC5, 0xAA, 0xA3, 0xF3,
+  0xA2, 0x57, 0xDB, 0x57, 0xB0, 0x10, 0x83, 0xDA, 0xF2, 0x38, 0xEA, 0x7F, 0x6B, 0x1E, 0x8C, 0x91,
+  0xB4, 0x81, 0x8A, 0xF5, 0x07, 0x5B, 0x54, 0x31, 0x61, 0x1A, 0x89, 0xF7, 0x83, 0x3C, 0x80, 0x51,
+  0xF9, 0xDC, 0x40, 0x14, 0xD0, 0x54, 0x99, 0x49, 0x92, 0xF7, 0xCA, 0xE7, 0x87, 0x10, 0x14, 0x4A,
+  0x8E, 0x5C, 0x93, 0xE3, 0x79, 0xCE, 0x3E, 0xFB, 0x96, 0x71, 0x5C, 0x5A, 0x78, 0x4C, 0x1B, 0x9D,
+  0xE7, 0x8A, 0x0E, 0x04, 0x0D, 0x03, 0xCD, 0xE4, 0x41, 0xA1, 0x85, 0x47, 0xA2, 0x9D, 0x6B, 0x7C,
+  0x4F, 0xFE, 0x0D, 0xE1, 0x93, 0x72, 0xCA, 0xD4, 0x25, 0xE3, 0x0B, 0xF5, 0xBB, 0x10, 0x26, 0xE7,
+  0x16, 0x16, 0x51, 0x15, 0x70, 0xC9, 0xB6, 0xE5, 0x68, 0x18, 0xAC, 0x6A, 0x73, 0x1F, 0x30, 0xED,
+  0xFC, 0x31, 0xC7, 0x41, 0x5E, 0x0D, 0x37, 0x70, 0x6B, 0xE5, 0xE6, 0x71, 0xE9, 0xD1, 0xA2, 0x7C,
+  0xA6, 0x1D, 0x2F, 0xC3, 0x49, 0xBC, 0xFF, 0xFD, 0x9F, 0xA2, 0xA1, 0x19, 0xFC, 0xF8, 0x5F, 0xC4,
+  0x00, 0x50, 0x23, 0x57, 0xBF, 0x50, 0x01, 0x53, 0xD7, 0xF1, 0x20, 0x14, 0x35, 0x27, 0x66, 0x86,
+  0xA8, 0xB2, 0xB8, 0x7D, 0x28, 0x63, 0x77, 0xA2, 0xB0, 0x24, 0x37, 0x39, 0xF7, 0x74, 0xD7, 0x9C,
+  0x43, 0xA8, 0x66, 0x38, 0xFA, 0x62, 0x46, 0x6C, 0xBF, 0xA3, 0x19, 0xC6, 0xD5, 0x0D, 0x5C, 0xBC,
+  0xC1, 0x11, 0x66, 0xE0, 0x7C, 0xB3, 0xF1, 0xE2, 0xA7, 0xB7, 0x97, 0xEC, 0xC0, 0xBD, 0x37, 0xC0,
+  0x2F, 0x62, 0x34, 0x0E, 0x94, 0xF1, 0xC2, 0x66, 0xD1, 0x7B, 0x93, 0x60, 0x59, 0xF6, 0x11, 0xC6,
+  0x1B, 0xCD, 0x55, 0x46, 0x9A, 0x47, 0x5E, 0x39, 0x9E, 0xAF, 0x5C, 0x28, 0x21, 0x44, 0xCB, 0xD1,
+  0xE9, 0x21, 0x09, 0x1D, 0x46, 0x17, 0x2F, 0xC9, 0x08, 0xFF, 0xC5, 0xB5, 0xA0, 0x68, 0x58, 0x6B,
+  0x5F, 0x69, 0x9C, 0x9D, 0xF6, 0x1A, 0xA8, 0x7F, 0x61, 0x13, 0x63, 0xFC, 0xAC, 0x22, 0x94, 0x6B,
+  0x2E, 0x5C, 0xEB, 0x40, 0xD1, 0x47, 0x2D, 0x76, 0x48, 0x22, 0x7D, 0x8C, 0xCF, 0x82, 0xD3, 0x73,
+  0x3B, 0xFE, 0x94, 0xD8, 0xCD, 0x08, 0x33, 0x30, 0x86, 0xB9, 0x63, 0x7B, 0xB1, 0x2F, 0x44, 0x9A,
+  0xE3, 0xE8, 0x79, 0x07, 0x02, 0x7A, 0x7F, 0xE1, 0x29, 0x0F, 0x2E, 0x2E, 0x14, 0x0C, 0x70, 0x63,
+  0x87, 0x2F, 0xEA, 0xA3, 0x64, 0xB9, 0x03, 0x25, 0xF1, 0xE0, 0x67, 0x70, 0x0D, 0xC2, 0x31, 0xBF,
+  0xB7, 0x0A, 0xB1, 0x12, 0xE7, 0xCC, 0x86, 0x15, 0xD0, 0x8B, 0x34, 0x5B, 0x71, 0x04, 0x9B, 0x86,
+  0xE6, 0x6B, 0xAD, 0xF8, 0x81, 0x8F, 0xD0, 0x2A, 0x60, 0x72, 0xA0, 0xD0, 0x57, 0xE2, 0xE9, 0x93,
+  0xB7, 0xAD, 0x0E, 0xF0, 0x10, 0xE8, 0x0D, 0x6B, 0x13, 0xD7, 0x4D, 0x7E, 0xFA, 0x12, 0x6A, 0xB7,
+  0x7B, 0x07, 0x0A, 0xBE, 0x89, 0xD7, 0x15, 0x90, 0xDC, 0x0B, 0x9E, 0x05, 0x4C, 0xCB, 0x07, 0x2B,
+  0x01, 0xC9, 0xC0, 0xDD, 0xC6, 0x44, 0x04, 0xBE, 0xE7, 0x3D, 0x99, 0x00, 0xC7, 0x26, 0x07, 0x3C,
+  0x81, 0x3E, 0xA0, 0xD9, 0xF3, 0x01, 0x73, 0x8A, 0x82, 0xD4, 0x0E, 0x0F, 0xC1, 0xA4, 0xC1, 0x29,
+  0x11, 0xD0, 0x8A, 0x49, 0xB3, 0xC1, 0x27, 0x30, 0x41, 0xA3, 0x1A, 0xDD, 0x55, 0x63, 0x1F, 0x00,
+  0x74, 0x7C, 0xE7, 0xDA, 0x77, 0x4D, 0x7B, 0x02, 0xA9, 0x47, 0x2B, 0x82, 0x46, 0x5F, 0x23, 0xC8,
+  0xC4, 0x7B, 0xFA, 0x9C, 0x36, 0x92, 0x7C, 0xD1, 0xE4, 0xCF, 0xF7, 0x1B, 0xAD, 0x06, 0x47, 0x9E,
+  0xDE, 0x83, 0xBA, 0x35, 0xD9, 0xC5, 0x43, 0x8A, 0x63, 0x4B, 0x39, 0x3F, 0xE7, 0xCD, 0xB0, 0x52,
+  0xF8, 0x10, 0x0A, 0xD1, 0x9F, 0xC4, 0xAB, 0x50, 0x15, 0x3F, 0x7F, 0xFF, 0x35, 0xD0, 0xD9, 0xDB,
+  0x43, 0xC0, 0xFA, 0x29, 0x8E, 0x20, 0x7C, 0xFF, 0x15, 0xFE, 0xBF, 0x7D, 0x48, 0x87, 0x0D, 0xBE,
+  0xFF, 0x8A, 0x3F, 0xB7, 0x0F, 0xA1, 0x25, 0xB8, 0xA6, 0xED, 0xDD, 0x7E, 0xA6, 0x7C, 0x48, 0x73,
+  0x6F, 0x92, 0xC9, 0xBD, 0x90, 0x6D, 0x95, 0x71, 0x9A, 0xE4, 0x20, 0xF5, 0x39, 0xB2, 0xDF, 0xA6,
+  0xEE, 0x18, 0x20, 0x1E, 0x1F, 0x34, 0x39, 0x10, 0xBA, 0x05, 0x22, 0x09, 0x18, 0x15, 0x9E, 0x80,
+  0x6A, 0x8E, 0x69, 0x49, 0x85, 0x9B, 0x4A, 0xA4, 0x20, 0x41, 0xC9, 0x39, 0x7E, 0x16, 0xFC, 0xB5,
+  0xED, 0x37, 0xFD, 0x98, 0x51, 0x64, 0x70, 0x7C, 0x38, 0x8C, 0x91, 0x80, 0x7F, 0xA0, 0x1E, 0x94,
+  0x6B, 0x70, 0xA1, 0x85, 0xCA, 0xB6, 0x17, 0xEA, 0x61, 0x84, 0x29, 0x7B, 0x99, 0xA1, 0x87, 0x1F,
+  0x75, 0xEB, 0x4B, 0x13, 0xCF, 0x64, 0x4C, 0xBA, 0x8A, 0x14, 0x8B, 0xB0, 0xD0, 0x53, 0xFC, 0x0F,
+  0xF8, 0x82, 0x3F, 0x99, 0xF2, 0x01, 0xA8, 0x2C, 0x84, 0x6F, 0xD2, 0x21, 0x80, 0x4F, 0xAB, 0x03,
+  0x85, 0x5D, 0xAC, 0xC1, 0x32, 0x6C, 0x03, 0xEF, 0xF1, 0x67, 0x1D, 0x48, 0x0F, 0x1F, 0xF0, 0x2B,
+  0x78, 0x46, 0x63, 0x56, 0x7C, 0xC4, 0x2E, 0xB0, 0x14, 0x8D, 0x31, 0x68, 0x29, 0x76, 0x05, 0xCF,
+  0xF0, 0xCC, 0x0F, 0xD0, 0xDD, 0x03, 0x65, 0x64, 0xDA, 0x36, 0xBD, 0x28, 0xC0, 0x3E, 0xEA, 0xEA,
+  0x9F, 0x7A, 0x2B, 0xA0, 0x80, 0xA3, 0x76, 0xFB, 0xD0, 0x5B, 0x87, 0x77, 0xEB, 0xDB, 0x87, 0x04,
+  0xDF, 0x51, 0x24, 0xE1, 0x7A, 0xCD, 0xAF, 0xE1, 0x39, 0xE0, 0x87, 0x6F, 0x02, 0x84, 0xE9, 0x83,
+  0x75, 0xF4, 0x00, 0x4A, 0xF8, 0xF8, 0x9E, 0x23, 0x0F, 0x77, 0xEB, 0xF0, 0x0E, 0x6B, 0xD3, 0xBA,
+  0x9C, 0x0C, 0xB8, 0x5D, 0x47, 0xB7, 0xF0, 0x96, 0x7D, 0xD0, 0x1D, 0x90, 0x60, 0x34, 0xDD, 0x3E,
+  0xE4, 0x34, 0xC1, 0x23, 0x7E, 0x95, 0x64, 0x35, 0xFA, 0x04, 0x9F, 0x7B, 0x91, 0xE7, 0xAC, 0x93,
+  0x16, 0xFA, 0x0F, 0xB0, 0x8F, 0x2B, 0x8B, 0xE0, 0xE5, 0xF3, 0xF5, 0x6B, 0xA3, 0xD9, 0xE0, 0x13,
+  0xB2, 0x0D, 0xF4, 0x61, 0x62, 0x9D, 0x8E, 0x63, 0xEB, 0x96, 0xA9, 0xA3, 0xA1, 0x34, 0x5B, 0xCA,
+  0xC5, 0x90, 0xFB, 0x31, 0x54, 0x68, 0x28, 0x2E, 0x2A, 0x69, 0x26, 0xE8, 0x60, 0x4A, 0xB1, 0xD1,
+  0xEA, 0x50, 0x3D, 0xE4, 0xBA, 0x86, 0x20, 0xB8, 0x09, 0x96, 0x83, 0x81, 0x85, 0x25, 0x30, 0x52,
+  0xD6, 0x92, 0x0B, 0x84, 0x96, 0x16, 0xA0, 0x50, 0x30, 0xA2, 0xAB, 0xED, 0x26, 0xBC, 0x6C, 0x8E,
+  0x55, 0x07, 0x06, 0xFC, 0x20, 0x69, 0xC0, 0x20, 0x2A, 0xD7, 0x6F, 0x36, 0xAE, 0x70, 0x21, 0xF0,
+  0x6F, 0x8D, 0x7D, 0x2C, 0xB4, 0xDF, 0xF8, 0xFD, 0x4C, 0x69, 0xEC, 0x8B, 0x96, 0x7C, 0x9B, 0x34,
+  0x39, 0x26, 0xB1, 0x49, 0x49, 0x89, 0x4D, 0x04, 0x89, 0x4D, 0xEE, 0x56, 0x62, 0xE2, 0x44, 0xF0,
+  0x26, 0x52, 0x13, 0x67, 0x5E, 0x73, 0x24, 0x57, 0x58, 0x9F, 0x0B, 0x8D, 0x4B, 0x6B, 0x22, 0x93,
+  0x56, 0x1D, 0x31, 0xB1, 0x2E, 0x0E, 0xAC, 0x87, 0xB8, 0xAF, 0x7E, 0x7E, 0xFB, 0x06, 0x5D, 0xA5,
+  0x5C, 0x64, 0xA1, 0xC4, 0x92, 0xE1, 0x88, 0x04, 0x02, 0xF6, 0x9D, 0x31, 0xC7, 0x1D, 0xEB, 0x43,
+  0xF7, 0x1B, 0x4A, 0x93, 0x82, 0xC4, 0x1E, 0xB4, 0x40, 0x11, 0xB8, 0xE3, 0x2D, 0x67, 0xBB, 0xE8,
+  0x6C, 0x03, 0xE3, 0x8D, 0x6A, 0xE5, 0xE8, 0x02, 0x56, 0x28, 0x25, 0x44, 0x06, 0x39, 0x65, 0x30,
+  0x42, 0x9F, 0xB0, 0x75, 0x13, 0xA1, 0xF6, 0xEA, 0x95, 0x75, 0x6A, 0x81, 0x4F, 0x8F, 0x7C, 0x9B,
+  0x57, 0xC8, 0x1D, 0xEE, 0xF9, 0x4B, 0x31, 0x88, 0x8F, 0x61, 0x4B, 0x14, 0x3C, 0xE8, 0x09, 0x4A,
+  0x81, 0x09, 0x86, 0x2E, 0xB3, 0xE1, 0xAC, 0xAB, 0xC0, 0x59, 0x4B, 0xE0, 0xF0, 0x9E, 0xA7, 0x14,
+  0x18, 0x3E, 0xD0, 0x95, 0x09, 0x65, 0x5D, 0x01, 0x8A, 0x0C, 0x97, 0xA0, 0xA7, 0x2B, 0x47, 0x13,
+  0x1F, 0x14, 0xC9, 0x86, 0xB3, 0xAE, 0x02, 0x67, 0x2D, 0xD1, 0xE7, 0x64, 0x34, 0xD2, 0x0D, 0xFE,
+  0xD5, 0x8F, 0x3F, 0xC6, 0x1A, 0x78, 0x8B, 0xE8, 0x67, 0x27, 0x56, 0x32, 0xF9, 0x10, 0x44, 0x8B,
+  0xC4, 0x92, 0xF6, 0x06, 0xC4, 0xEA, 0x68, 0x3E, 0xF8, 0x27, 0xC8, 0xE3, 0x89, 0xD7, 0xC1, 0x08,
+  0x37, 0x64, 0x63, 0xEA, 0x55, 0xC7, 0x06, 0x04, 0x28, 0xC0, 0xD6, 0x59, 0x37, 0xA9, 0x9E, 0x29,
+  0x58, 0xEC, 0x71, 0x16, 0x38, 0xF6, 0x36, 0x03, 0x22, 0xEF, 0x61, 0xE2, 0x35, 0xF0, 0x61, 0x16,
+  0x34, 0x9A, 0xC5, 0x08, 0xB0, 0xFA, 0xC7, 0xC7, 0xE9, 0x7E, 0x86, 0x37, 0xC0, 0x3F, 0xFD, 0x84,
+  0x10, 0x70, 0x3C, 0x2A, 0x4A, 0xCD, 0x74, 0x08, 0x04, 0x95, 0x46, 0x30, 0x65, 0xD7, 0x38, 0x4B,
+  0x45, 0xDC, 0x50, 0x83, 0x4F, 0xC2, 0x29, 0x4F, 0x19, 0x8E, 0xB1, 0x0F, 0x1A, 0x8C, 0x20, 0xF9,
+  0x0E, 0xBF, 0x5B, 0xC4, 0x80, 0xD1, 0x85, 0xD5, 0x21, 0x24, 0xF6, 0x0C, 0x13, 0xD7, 0xC4, 0x23,
+  0x36, 0xB7, 0xD3, 0x76, 0x6C, 0x22, 0x6F, 0x35, 0x16, 0xBF, 0xF3, 0x86, 0xF8, 0x1D, 0x5F, 0xF1,
+  0x1D, 0x55, 0x73, 0x89, 0xBF, 0x70, 0x6D, 0x1E, 0xCF, 0xA7, 0xE3, 0x1B, 0x69, 0x2A, 0xB9, 0x45,
+  0xDD, 0x3C, 0x3C, 0x54, 0x9E, 0xF9, 0xBE, 0x06, 0x02, 0xC0, 0x79, 0xCA, 0x29, 0xF2, 0x47, 0xD1,
+  0xF8, 0xA0, 0x84, 0xE3, 0xA2, 0x52, 0xB2, 0x45, 0xC5, 0x84, 0xD9, 0x2D, 0x7E, 0xE6, 0x29, 0x30,
+  0x67, 0x0A, 0xAA, 0xF3, 0xEF, 0x05, 0x71, 0xD7, 0xD7, 0x94, 0x61, 0x8E, 0xFB, 0xCC, 0xB2, 0x9A,
+  0x8D, 0x4E, 0x34, 0xED, 0xDC, 0x60, 0x39, 0x78, 0x07, 0x40, 0x5D, 0x41, 0x1B, 0x20, 0xE3, 0x48,
+  0xE7, 0x83, 0xB1, 0x0A, 0x2E, 0x77, 0xC8, 0xBB, 0x2E, 0xB8, 0x30, 0x92, 0x49, 0x3F, 0x94, 0x70,
+  0xEC, 0x2F, 0x64, 0xBD, 0x98, 0x03, 0xFB, 0xA3, 0x34, 0xBE, 0x95, 0xFE, 0x92, 0x04, 0x70, 0x87,
+  0x74, 0xA0, 0xE4, 0x25, 0x4F, 0xE4, 0x7A, 0x47, 0x92, 0x42, 0x91, 0x08, 0xA8, 0x76, 0xA2, 0x25,
+  0xA6, 0xBF, 0x82, 0x71, 0xBB, 0x27, 0xBF, 0x93, 0x0C, 0x81, 0x70, 0x04, 0x39, 0xF3, 0x82, 0xCE,
+  0x2B, 0xD1, 0x42, 0x62, 0x78, 0xE2, 0xB6, 0xB5, 0x17, 0x79, 0x86, 0xC5, 0xDC, 0xD0, 0x7C, 0x12,
+  0x77, 0x0E, 0xA1, 0x2E, 0x04, 0x2F, 0x67, 0x8E, 0x4F, 0x12, 0x1E, 0xC3, 0xB4, 0x4D, 0xDF, 0xD4,
+  0xAC, 0x0F, 0x91, 0x36, 0xDE, 0xAB, 0xF9, 0x37, 0x37, 0xB2, 0xFF, 0xD4, 0x18, 0x44, 0xB9, 0xBC,
+  0x39, 0xA5, 0x21, 0xA1, 0x3F, 0x88, 0xB4, 0x44, 0xE4, 0x43, 0xCC, 0x2D, 0xEC, 0xC5, 0x2D, 0xF7,
+  0xC1, 0x03, 0x7A, 0xB5, 0x17, 0x0A, 0x2D, 0xF0, 0x1E, 0x17, 0x4A, 0xF4, 0x22, 0x21, 0xE0, 0x34,
+  0xEC, 0x04, 0x8C, 0x00, 0xB8, 0x00, 0x81, 0xD9, 0x56, 0x28, 0xDE, 0x39, 0x44, 0x9B, 0xA8, 0x0B,
+  0xFF, 0xEF, 0xF5, 0xBF, 0x21, 0xAF, 0x7F, 0x7F, 0x2E, 0xBE, 0xFC, 0x28, 0x1C, 0xAB, 0x27, 0x1F,
+  0x16, 0xDC, 0x6F, 0x40, 0xB4, 0x23, 0x1D, 0xF7, 0xE3, 0xAE, 0x3B, 0xD2, 0xAF, 0xA9, 0x69, 0x30,
+  0xA4, 0x23, 0xCD, 0x42, 0x1E, 0xE1, 0xF0, 0x3D, 0x0E, 0x70, 0xE3, 0x68, 0x77, 0xB3, 0xC1, 0xE6,
+  0x16, 0xA8, 0x3F, 0xBE, 0x8D, 0x42, 0x92, 0xA9, 0xB3, 0xCC, 0xAB, 0xE9, 0x82, 0xD7, 0xB9, 0x21,
+  0x89, 0xCA, 0x61, 0x6D, 0xFE, 0xAD, 0xF6, 0xC2, 0xA6, 0x83, 0x6F, 0xBA, 0xF3, 0xCE, 0x00, 0x0A,
+  0x84, 0x5F, 0x79, 0xBF, 0x50, 0x7C, 0x97, 0x5A, 0x8D, 0x00, 0x96, 0xD8, 0x45, 0x50, 0x03, 0xB4,
+  0x72, 0x01, 0xD3, 0x30, 0x2F, 0x0E, 0x99, 0xB9, 0xD2, 0x0A, 0x4E, 0x56, 0x7C, 0x0C, 0x35, 0xE2,
+  0xB7, 0x17, 0x8A, 0xBD, 0xB0, 0x2C, 0xD0, 0x41, 0x24, 0x01, 0x74, 0x50, 0x7C, 0x2B, 0x75, 0xD1,
+  0xFF, 0xB9, 0xFE, 0x2C, 0xC4, 0x3C, 0xC6, 0x81, 0x87, 0x0F, 0xE3, 0xD0, 0x70, 0x92, 0x81, 0x85,
+  0xF1, 0x61, 0x6B, 0xAC, 0xFC, 0xA5, 0x63, 0x8F, 0xCD, 0x49, 0xD4, 0xCF, 0x72, 0x94, 0xA0, 0xB3,
+  0x7E, 0x10, 0x63, 0xBC, 0x10, 0xE3, 0x00, 0x22, 0xA6, 0x41, 0x19, 0x44, 0x4F, 0xEA, 0x4B, 0x8D,
+  0xC6, 0x3E, 0xA5, 0x5A, 0xDF, 0x24, 0xFC, 0x0C, 0xAF, 0x16, 0xF0, 0x1F, 0x95, 0x39, 0x7A, 0x10,
+  0x1F, 0x22, 0x48, 0x40, 0x9C, 0xC4, 0x20, 0x22, 0x61, 0x09, 0xBC, 0xA9, 0x87, 0x42, 0x78, 0x78,
+  0x9A, 0x0D, 0x3F, 0x51, 0x47, 0xFC, 0x82, 0x21, 0x6D, 0x1C, 0xC0, 0xE0, 0x89, 0x3B, 0xAD, 0xBC,
+  0xD8, 0x80, 0x16, 0xCC, 0x00, 0x42, 0x1B, 0x48, 0x03, 0xC9, 0xC5, 0x3C, 0x38, 0xCE, 0x54, 0xC2,
+  0x10, 0x0A, 0x6E, 0x39, 0x42, 0x56, 0xD0, 0x56, 0xE1, 0x32, 0x13, 0x94, 0x92, 0xD8, 0xCB, 0x98,
+  0x02, 0x37, 0x54, 0xDA, 0xBD, 0x00, 0x26, 0x14, 0x7D, 0x89, 0x73, 0xF7, 0x21, 0xE4, 0xF0, 0x41,
+  0x3C, 0xA8, 0x4C, 0x0D, 0x2A, 0x8B, 0xD2, 0x67, 0x5D, 0xDF, 0xD7, 0x78, 0x77, 0x70, 0x97, 0x3D,
+  0x41, 0x4F, 0x11, 0x3F, 0x59, 0x26, 0xFA, 0xEB, 0x0D, 0x3B, 0x81, 0x1C, 0x98, 0x6C, 0xB2, 0x35,
+  0x09, 0x74, 0x31, 0x9A, 0x99, 0xBE, 0x04, 0x60, 0xA3, 0xD7, 0xA8, 0xD2, 0x9F, 0x88, 0xB6, 0xC7,
+  0xFC, 0x17, 0x0D, 0xB5, 0x01, 0x50, 0x6C, 0x90, 0x9C, 0x1E, 0x9B, 0xEF, 0x58, 0x4F, 0x6F, 0x34,
+  0x17, 0x87, 0xBE, 0x51, 0xC0, 0x89, 0x29, 0x99, 0x3D, 0x61, 0x2E, 0x91, 0x82, 0x88, 0xCF, 0x26,
+  0x06, 0x33, 0x78, 0xF1, 0xC8, 0x5C, 0x9C, 0xC2, 0xFA, 0xEC, 0x12, 0xA8, 0xE7, 0xE1, 0x50, 0x83,
+  0xF2, 0xFD, 0x57, 0x0A, 0xE2, 0x56, 0x19, 0x83, 0xED, 0x7B, 0x53, 0x62, 0xD0, 0x89, 0x02, 0x1F,
+  0xBF, 0xF2, 0x87, 0xD3, 0x30, 0xB1, 0xD9, 0xC3, 0xDB, 0xCF, 0x2D, 0x71, 0x2E, 0x8E, 0xD2, 0x52,
+  0x98, 0x3C, 0xD0, 0x49, 0xE6, 0xFC, 0xBC, 0x81, 0x85, 0xDB, 0x92, 0xA1, 0xA2, 0xD0, 0xE2, 0xA0,
+  0x04, 0xFB, 0x34, 0xF9, 0x8F, 0x10, 0x8D, 0x24, 0xD4, 0xB4, 0xC5, 0xD3, 0x1E, 0x90, 0x80, 0x11,
+  0x38, 0x30, 0x26, 0x23, 0x4C, 0x6E, 0x18, 0x9B, 0x62, 0x1C, 0x66, 0xC4, 0x70, 0x5A, 0x8A, 0x67,
+  0x60, 0x79, 0xAF, 0x1E, 0xF2, 0xE2, 0x0F, 0x0F, 0x92, 0x95, 0xD6, 0x9E, 0x30, 0x25, 0x99, 0x84,
+  0x81, 0x0D, 0x08, 0x00, 0x62, 0x2C, 0xCA, 0x62, 0x53, 0x7C, 0x67, 0x71, 0x23, 0xF2, 0x1F, 0x99,
+  0xB9, 0x96, 0x22, 0xF6, 0x7F, 0xB4, 0xF3, 0xA3, 0xED, 0xFE, 0x46, 0x55, 0xE6, 0x77, 0x3E, 0x2E,
+  0x22, 0xF8, 0xA1, 0x56, 0x15, 0x74, 0x52, 0x29, 0x5F, 0x01, 0x2A, 0x77, 0x18, 0xFC, 0x0A, 0xB9,
+  0x1F, 0x85, 0x07, 0x21, 0x66, 0x2A, 0xE9, 0x13, 0x23, 0x34, 0x79, 0x86, 0x17, 0xCF, 0xC1, 0x04,
+  0xF6, 0x48, 0xA3, 0xB3, 0x4C, 0x76, 0x31, 0xED, 0x62, 0xE6, 0x7A, 0x63, 0x92, 0x65, 0xEE, 0x70,
+  0x28, 0x5D, 0x1D, 0x40, 0xF9, 0x15, 0x55, 0xB8, 0x0C, 0x57, 0x83, 0x14, 0xD6, 0x8C, 0x56, 0x8E,
+  0x08, 0x30, 0xE8, 0xB2, 0x90, 0x72, 0xB3, 0x15, 0xB4, 0x68, 0xAC, 0x2A, 0x42, 0x2D, 0xAE, 0x1B,
+  0xDB, 0xCC, 0x2D, 0xD4, 0xA7, 0x96, 0x5B, 0x5C, 0x5D, 0x5C, 0x45, 0x22, 0xB6, 0xAE, 0xDD, 0x94,
+  0xA8, 0x1C, 0x2D, 0x7D, 0x11, 0xAA, 0x06, 0xFD, 0x51, 0x5E, 0xC5, 0xF0, 0xF4, 0x81, 0x86, 0x20,
+  0x21, 0xCF, 0x77, 0xE6, 0x6C, 0x17, 0x7A, 0xC2, 0x91, 0x2C, 0xE9, 0xE8, 0x63, 0x07, 0xDF, 0x37,
+  0x79, 0xD0, 0x22, 0x72, 0x27, 0x3E, 0xC5, 0x20, 0xEE, 0x66, 0x6F, 0x24, 0xC6, 0xFC, 0xF0, 0x95,
+  0xB4, 0x05, 0x94, 0x75, 0xC7, 0x73, 0x75, 0xE6, 0xCE, 0xC3, 0x85, 0x22, 0xE8, 0x6D, 0xF0, 0xF2,
+  0xF3, 0x5E, 0x18, 0x21, 0xC4, 0xB4, 0xA2, 0x55, 0x88, 0x8B, 0x33, 0x4F, 0xA2, 0x12, 0x0D, 0xF1,
+  0x30, 0x0B, 0xF5, 0xD0, 0x8F, 0xF3, 0x93, 0x00, 0x70, 0x08, 0x3E, 0xD2, 0x98, 0x0C, 0xB7, 0x1A,
+  0xB1, 0x89, 0xFB, 0xB1, 0x38, 0xF2, 0x42, 0x5F, 0xC4, 0x56, 0x19, 0x3D, 0xFD, 0xA4, 0x8F, 0xA0,
+  0xFB, 0x79, 0x01, 0xE6, 0x03, 0xF6, 0xBA, 0x6C, 0xB6, 0x6E, 0xF3, 0xC8, 0x61, 0xEC, 0x8A, 0x74,
+  0xA7, 0x2C, 0x12, 0xD4, 0xD1, 0xCB, 0xA1, 0xC5, 0xF8, 0x23, 0x07, 0x27, 0xAA, 0xFC, 0x95, 0x1D,
+  0x24, 0x0D, 0x59, 0x8C, 0xBD, 0x48, 0xB3, 0x96, 0xC5, 0x8D, 0x31, 0x00, 0x91, 0x0B, 0x4F, 0x21,
+  0x9B, 0x08, 0x0D, 0x05, 0xBD, 0x08, 0x0A, 0x84, 0xB8, 0x87, 0x76, 0x90, 0x81, 0x39, 0x2E, 0x2C,
+  0xD2, 0x35, 0xFB, 0x46, 0xF3, 0x44, 0x7D, 0xD7, 0x01, 0x96, 0x4F, 0xB8, 0xCA, 0x37, 0x55, 0x56,
+  0x40, 0xE5, 0xBA, 0xCB, 0xEE, 0x3A, 0x74, 0x27, 0x06, 0x86, 0xF6, 0x28, 0x3E, 0x7A, 0x13, 0x7B,
+  0xCD, 0x3E, 0xFC, 0x1A, 0xBC, 0x67, 0x77, 0xAC, 0x40, 0xD8, 0x0A, 0x7E, 0x6A, 0xB5, 0xA3, 0xCD,
+  0xE7, 0xC4, 0x36, 0x2E, 0xA7, 0xA6, 0x65, 0x34, 0x59, 0xD5, 0x70, 0xED, 0x89, 0xCB, 0xBE, 0xD2,
+  0x4E, 0xD7, 0x39, 0x70, 0xA8, 0x60, 0x88, 0x97, 0xEC, 0x59, 0xB3, 0xD1, 0x37, 0x82, 0x65, 0x2A,
+  0xBC, 0x58, 0xC7, 0x70, 0xB5, 0xE5, 0x6B, 0x5C, 0x06, 0x47, 0x25, 0x79, 0xD0, 0x3D, 0xE8, 0xF2,
+  0x02, 0x3E, 0x44, 0x3A, 0x5F, 0xC3, 0x7C, 0xC7, 0xA5, 0xCB, 0x85, 0x7E, 0x79, 0xFF, 0x26, 0x82,
+  0xEB, 0x3B, 0x2F, 0xD8, 0xA3, 0x66, 0x83, 0xAE, 0xA3, 0x3B, 0xFC, 0x63, 0x8E, 0xB3, 0xAF, 0x81,
+  0x8F, 0x17, 0xD8, 0x88, 0x4B, 0xE4, 0x90, 0x55, 0xAC, 0xF8, 0x13, 0x11, 0x28, 0x3C, 0xB6, 0xC1,
+  0x49, 0xA3, 0xA6, 0x36, 0x65, 0x55, 0x83, 0x05, 0x74, 0x58, 0x1D, 0x29, 0xF9, 0x01, 0x32, 0xBE,
+  0x7F, 0x11, 0xCD, 0x05, 0x79, 0xEC, 0x2B, 0x4D, 0xB5, 0xAB, 0xEE, 0x37, 0xE9, 0xF3, 0xB7, 0x40,
+  0xCE, 0xB4, 0xD9, 0xDA, 0xEF, 0xB5, 0x5A, 0xF8, 0x61, 0x75, 0x9D, 0x34, 0xDB, 0xFD, 0xA0, 0x08,
+  0xFC, 0xD0, 0x32, 0xAC, 0x91, 0xEC, 0xF7, 0xAF, 0x9C, 0x85, 0xEB, 0xE5, 0x15, 0x78, 0x6B, 0xDA,
+  0xD8, 0x0D, 0xE6, 0x15, 0xB9, 0x26, 0xC0, 0x58, 0x23, 0x55, 0x44, 0xA5, 0xEB, 0xFE, 0x82, 0xE4,
+  0x8B, 0x2E, 0x87, 0x82, 0x78, 0x5B, 0x88, 0xB4, 0x79, 0xB0, 0x47, 0x70, 0xF0, 0xB8, 0x19, 0x4C,
+  0xE7, 0xDC, 0x8A, 0xCA, 0x11, 0x85, 0x53, 0x3C, 0xFD, 0x4E, 0xC9, 0x3F, 0xE1, 0x6B, 0x78, 0x80,
+  0x92, 0x1A, 0x56, 0x2E, 0x13, 0x03, 0x4A, 0x83, 0x9B, 0xDC, 0x60, 0x30, 0x3E, 0xF6, 0x9A, 0x4C,
+  0x3B, 0xE3, 0x81, 0xDF, 0xE5, 0x02, 0xCC, 0x73, 0x16, 0x38, 0x43, 0xF6, 0x0C, 0x73, 0xB0, 0xD0,
+  0x6B, 0x43, 0x4E, 0x96, 0xD7, 0x95, 0xC0, 0x6B, 0xA1, 0xF3, 0xE1, 0x09, 0x5C, 0x41, 0x05, 0xE1,
+  0xB8, 0x5D, 0xA1, 0xAE, 0x90, 0x18, 0xE6, 0x76, 0xD6, 0xC9, 0x03, 0x62, 0x29, 0x08, 0x80, 0x9A,
+  0xA6, 0x5C, 0x1C, 0xB7, 0xE0, 0xF4, 0x43, 0xB9, 0x56, 0xE8, 0xAF, 0xB0, 0x12, 0xCF, 0x99, 0x04,
+  0x6F, 0x95, 0x91, 0xE9, 0xA6, 0xB3, 0xDC, 0x84, 0x1B, 0xCB, 0xCA, 0x6E, 0xD3, 0x99, 0xED, 0xAD,
+  0xA0, 0x20, 0xC1, 0xC1, 0xDB, 0x11, 0x0B, 0x49, 0x3E, 0xBF, 0x89, 0xC8, 0xEF, 0x20, 0xC3, 0x2F,
+  0xA8, 0x21, 0x9E, 0x0F, 0xCE, 0xD8, 0x45, 0x4A, 0xB2, 0x8B, 0x70, 0x76, 0x61, 0x85, 0x28, 0xBD,
+  0x2C, 0x1E, 0x6E, 0x08, 0xF5, 0xFF, 0xD7, 0xE7, 0x11, 0x65, 0xCB, 0x51, 0x2E, 0x9E, 0x3C, 0x9D,
+  0x17, 0xC8, 0xCB, 0xAF, 0x10, 0xFB, 0x88, 0x08, 0x23, 0x6B, 0x39, 0x2A, 0x47, 0x56, 0x30, 0x1C,
+  0x80, 0x15, 0x22, 0xB2, 0xE4, 0x83, 0x06, 0x01, 0x29, 0x2F, 0x88, 0xCF, 0x77, 0xB0, 0x69, 0xB6,
+  0xA1, 0x84, 0x9F, 0xBD, 0x0D, 0x91, 0x0D, 0x9F, 0xE4, 0xE1, 0x1C, 0x16, 0x62, 0x91, 0x57, 0x78,
+  0x5B, 0x0A, 0xED, 0xB0, 0x74, 0xA4, 0xC2, 0x11, 0x80, 0x60, 0xA8, 0xE2, 0x38, 0x39, 0xE0, 0xC4,
+  0x62, 0x78, 0x83, 0x62, 0x9F, 0x88, 0xD4, 0xC5, 0x02, 0x2E, 0x78, 0xCB, 0x89, 0x0D, 0x90, 0x62,
+  0x65, 0x98, 0xAA, 0x32, 0x6F, 0x11, 0xAE, 0x29, 0xE6, 0x2B, 0x88, 0xD9, 0x1D, 0xFB, 0xE0, 0xF8,
+  0xF9, 0xE1, 0xD4, 0x9F, 0x59, 0xC3, 0xBD, 0xFF, 0x03, 0x6E, 0xDA, 0x6F, 0xC1, 0x5F, 0xA4, 0x00,
+  0x00,
+};
+
+// index_ov3660.html: 66774 bytes, 8432 gzipped
+static const uint8_t web_index_ov3660_gz[] = {
+  0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xED, 0x5D, 0xEB, 0x72, 0xDB, 0x46,
+  0xB2, 0xFE, 0xEF, 0xA7, 0x80, 0x91, 0xAC, 0x45, 0x96, 0x45, 0x8A, 0xE0, 0x4D, 0x94, 0x2C, 0xD1,
+  0xC7, 0x96, 0x15, 0x3B, 0xB5, 0x76, 0xD6, 0x6B, 0x27, 0x4E, 0x52, 0x5B, 0x29, 0x07, 0x24, 0x86,
+  0x24, 0x62, 0x10, 0xE0, 0x02, 0xA0, 0x44, 0xAE, 0x4B, 0xCF, 0x71, 0x1E, 0xE8, 0xBC, 0xD8, 0xE9,
+  0x9E, 0x19, 0x5C, 0x89, 0xCB, 0x00, 0x10, 0x41, 0x25, 0xE7, 0x48, 0x55, 0x12, 0x2E, 0x33, 0x3D,
+  0xDD, 0xFD, 0x75, 0xF7, 0xF4, 0x5C, 0x00, 0x5C, 0x3C, 0xD6, 0xAC, 0xA9, 0xBB, 0x5D, 0x11, 0x69,
+  0xE1, 0x2E, 0x8D, 0xF1, 0xA3, 0x0B, 0xF6, 0x4F, 0x82, 0x9F, 0x8B, 0x05, 0x51, 0x35, 0x76, 0x48,
+  0x4F, 0x97, 0xC4, 0x55, 0xA5, 0xE9, 0x42, 0xB5, 0x1D, 0xE2, 0x5E, 0xCA, 0x6B, 0x77, 0xD6, 0x1A,
+  0xC9, 0xF1, 0xDB, 0xA6, 0xBA, 0x24, 0x97, 0xF2, 0x8D, 0x4E, 0x6E, 0x57, 0x96, 0xED, 0xCA, 0xD2,
+  0xD4, 0x32, 0x5D, 0x62, 0x42, 0xF1, 0x5B, 0x5D, 0x73, 0x17, 0x97, 0x1A, 0xB9, 0xD1, 0xA7, 0xA4,
+  0x45, 0x4F, 0x8E, 0x75, 0x53, 0x77, 0x75, 0xD5, 0x68, 0x39, 0x53, 0xD5, 0x20, 0x97, 0x4A, 0x98,
+  0x96, 0xAB, 0xBB, 0x06, 0x19, 0x5F, 0x7F, 0x7C, 0xDF, 0xEB, 0x4A, 0xFF, 0xF8, 0xD4, 0x1B, 0x0E,
+  0x3B, 0x17, 0x27, 0xEC, 0x5A, 0x50, 0xC6, 0x71, 0xB7, 0xE1, 0x73, 0xFC, 0x99, 0x58, 0xDA, 0x56,
+  0xFA, 0x1A, 0xB9, 0x84, 0x3F, 0x33, 0x60, 0xA2, 0x35, 0x53, 0x97, 0xBA, 0xB1, 0x3D, 0x97, 0x5E,
+  0xD8, 0xD0, 0xE6, 0xF1, 0x1B, 0x62, 0xDC, 0x10, 0x57, 0x9F, 0xAA, 0xC7, 0x8E, 0x6A, 0x3A, 0x2D,
+  0x87, 0xD8, 0xFA, 0xEC, 0xD9, 0x4E, 0xC5, 0x89, 0x3A, 0xFD, 0x32, 0xB7, 0xAD, 0xB5, 0xA9, 0x9D,
+  0x4B, 0xDF, 0x28, 0x23, 0xFC, 0xDD, 0x2D, 0x34, 0xB5, 0x0C, 0xCB, 0x86, 0xFB, 0xD7, 0xDF, 0xE1,
+  0xEF, 0xB3, 0xE4, 0xD6, 0x1D, 0xFD, 0x3F, 0xE4, 0x5C, 0x52, 0x86, 0xAB, 0x4D, 0xE4, 0xFE, 0xDD,
+  0xA3, 0xC8, 0xE9, 0xA2, 0x9B, 0xC6, 0x3D, 0xAF, 0x3F, 0xCA, 0xAE, 0xEF, 0x90, 0xA9, 0xAB, 0x5B,
+  0x66, 0x7B, 0xA9, 0xEA, 0x66, 0x02, 0x25, 0x4D, 0x77, 0x56, 0x86, 0x0A, 0x3A, 0x98, 0x19, 0x24,
+  0x93, 0xCE, 0x37, 0x4B, 0x62, 0xAE, 0x8F, 0x73, 0xA8, 0x21, 0x91, 0x96, 0xA6, 0xDB, 0xAC, 0xD4,
+  0x39, 0xEA, 0x61, 0xBD, 0x34, 0x73, 0xC9, 0x66, 0xF1, 0x65, 0x5A, 0x26, 0x79, 0x96, 0xDC, 0xD0,
+  0xAD, 0xAD, 0xAE, 0xB0, 0x00, 0xFE, 0xDF, 0x2D, 0xB2, 0xD4, 0x4D, 0x66, 0x54, 0xE7, 0x52, 0xAF,
+  0xDF, 0x59, 0x6D, 0x72, 0xA0, 0xEC, 0x0D, 0xF1, 0x77, 0xB7, 0xD0, 0x4A, 0xD5, 0x34, 0xDD, 0x9C,
+  0x9F, 0x4B, 0xA3, 0x44, 0x12, 0x96, 0xAD, 0x11, 0xBB, 0x65, 0xAB, 0x9A, 0xBE, 0x76, 0xCE, 0xA5,
+  0x7E, 0x52, 0x99, 0xA5, 0x6A, 0xCF, 0x81, 0x17, 0xD7, 0x02, 0x66, 0x5B, 0x4A, 0x27, 0xA3, 0x88,
+  0xAD, 0xCF, 0x17, 0x2E, 0x40, 0xBA, 0x53, 0x26, 0xAE, 0x34, 0xEE, 0x42, 0x79, 0x78, 0x66, 0xEA,
+  0x2D, 0x59, 0x6B, 0xAA, 0xA1, 0xCF, 0xCD, 0x96, 0xEE, 0x92, 0x25, 0x88, 0xE3, 0xB8, 0x36, 0x71,
+  0xA7, 0x8B, 0x2C, 0x56, 0x66, 0xFA, 0x7C, 0x6D, 0x93, 0x04, 0x46, 0x7C, 0xBD, 0x65, 0x08, 0x0C,
+  0x37, 0x77, 0x6F, 0xB5, 0x6E, 0xC9, 0xE4, 0x8B, 0xEE, 0xB6, 0xB8, 0x4E, 0x26, 0x64, 0x66, 0xD9,
+  0x24, 0xB1, 0xA4, 0x57, 0xC2, 0xB0, 0xA6, 0x5F, 0x5A, 0x8E, 0xAB, 0xDA, 0xAE, 0x08, 0x41, 0x75,
+  0xE6, 0x12, 0x3B, 0x9F, 0x1E, 0x41, 0xAB, 0xC8, 0xA7, 0x96, 0xDE, 0x2C, 0x2F, 0xA0, 0x9B, 0x86,
+  0x6E, 0x12, 0x71, 0xF6, 0xD2, 0xDA, 0x8D, 0x92, 0x63, 0xA5, 0x04, 0x80, 0xD1, 0x97, 0xF3, 0x2C,
+  0x2B, 0xA1, 0xB2, 0xEE, 0x36, 0xC6, 0xFD, 0x46, 0xE9, 0x74, 0xFE, 0xB6, 0x7B, 0x73, 0x41, 0x98,
+  0x99, 0xAA, 0x6B, 0xD7, 0xAA, 0xEE, 0x11, 0xA3, 0x1C, 0x5B, 0xFF, 0xAF, 0x25, 0xD1, 0x74, 0x55,
+  0x6A, 0x84, 0xDC, 0x79, 0xD4, 0x01, 0x9B, 0x6A, 0x4A, 0xAA, 0xA9, 0x49, 0x0D, 0xCB, 0xD6, 0xC1,
+  0x11, 0x54, 0x1A, 0x6E, 0x0C, 0xB8, 0x02, 0x1D, 0xC7, 0x8A, 0x34, 0x13, 0x44, 0xCE, 0xF0, 0x99,
+  0xB0, 0x46, 0x92, 0xDD, 0x46, 0x30, 0xE4, 0x08, 0x39, 0x50, 0x82, 0x8C, 0xB9, 0x78, 0x89, 0x60,
+  0xC6, 0x14, 0xBB, 0x69, 0x65, 0x62, 0xE7, 0x15, 0xF2, 0x30, 0x84, 0x6E, 0x76, 0xDA, 0x80, 0xA2,
+  0x37, 0x0B, 0xA9, 0x25, 0x61, 0x94, 0x6C, 0x26, 0xD7, 0xE1, 0x44, 0x93, 0x21, 0x8F, 0x1B, 0x45,
+  0x01, 0x71, 0x93, 0x45, 0x0D, 0x62, 0x07, 0xFB, 0x5D, 0x6D, 0xD2, 0x24, 0x49, 0x8D, 0x22, 0xC5,
+  0x22, 0x49, 0x81, 0x68, 0x52, 0x28, 0xA2, 0x08, 0x47, 0x95, 0x42, 0x91, 0xA5, 0x48, 0x74, 0x29,
+  0x10, 0x61, 0x84, 0xA2, 0x0C, 0x83, 0x33, 0x3F, 0xDF, 0xF8, 0x66, 0xB2, 0x76, 0x5D, 0xCB, 0x74,
+  0x2A, 0x75, 0x51, 0x69, 0x7E, 0xF6, 0xC7, 0xDA, 0x71, 0xF5, 0xD9, 0xB6, 0xC5, 0x5D, 0x1A, 0xFC,
+  0x6C, 0xA5, 0x42, 0x0A, 0x39, 0x21, 0xEE, 0x2D, 0x21, 0xD9, 0xE9, 0x86, 0xA9, 0xDE, 0x40, 0xDC,
+  0x99, 0xCF, 0x8D, 0x24, 0xDB, 0x9B, 0xAE, 0x6D, 0x07, 0xF3, 0xB6, 0x95, 0xA5, 0x03, 0x61, 0xFB,
+  0x59, 0x4E, 0xDC, 0x14, 0x6C, 0xA8, 0x35, 0x9D, 0x24, 0xB4, 0x65, 0xAD, 0x5D, 0xD4, 0x71, 0x22,
+  0x12, 0x16, 0x88, 0xA3, 0xBB, 0xDB, 0xC4, 0x7B, 0xDC, 0x13, 0x3B, 0xE9, 0x71, 0xB9, 0x23, 0xCE,
+  0xD7, 0xF9, 0x74, 0x41, 0xA6, 0x5F, 0x88, 0xF6, 0x34, 0x37, 0x0D, 0xCB, 0x4B, 0x0F, 0xDB, 0xBA,
+  0xB9, 0x5A, 0xBB, 0x2D, 0x4C, 0xA7, 0x56, 0x7B, 0xC1, 0x9C, 0x1A, 0xA4, 0x27, 0x62, 0xB7, 0x9B,
+  0x95, 0x54, 0x0C, 0x56, 0x9B, 0x6C, 0x25, 0x84, 0x99, 0x1D, 0x1B, 0xEA, 0x84, 0x18, 0x59, 0x2C,
+  0x73, 0x67, 0x48, 0x09, 0xBB, 0x3C, 0x56, 0xA5, 0xE7, 0x6E, 0xB1, 0x5C, 0xB4, 0x7F, 0xFA, 0x37,
+  0x61, 0x3D, 0xD2, 0xE3, 0xE3, 0xC8, 0x25, 0x87, 0x18, 0xE0, 0x60, 0x69, 0xA9, 0x37, 0x94, 0xB9,
+  0x05, 0x1E, 0x32, 0x1B, 0xB0, 0x55, 0x73, 0x4E, 0x20, 0x16, 0x6C, 0x8E, 0xBD, 0xC3, 0xEC, 0x81,
+  0x81, 0x90, 0xF8, 0x18, 0xAA, 0x07, 0xD9, 0x03, 0x11, 0x16, 0x10, 0x8E, 0xA5, 0x36, 0x3B, 0x28,
+  0x91, 0x95, 0x84, 0xF0, 0xCD, 0x64, 0x44, 0xE9, 0xA6, 0xA7, 0xEA, 0x89, 0x9E, 0x13, 0xB5, 0xAD,
+  0xC4, 0x44, 0x3F, 0x37, 0x34, 0x78, 0x43, 0xBE, 0xD9, 0x2C, 0x6F, 0xD0, 0x38, 0x9B, 0xF5, 0x3A,
+  0xBD, 0x7E, 0x6E, 0xE6, 0x94, 0x28, 0x65, 0x6C, 0xE0, 0xF8, 0x2C, 0x23, 0xAC, 0x64, 0x1A, 0x81,
+  0xA3, 0xDE, 0x24, 0x26, 0xED, 0x96, 0xA3, 0xB3, 0x91, 0x9B, 0x3A, 0x71, 0x60, 0xEC, 0xE6, 0x26,
+  0x0C, 0xBD, 0xB8, 0xA1, 0x77, 0x13, 0xF9, 0xA3, 0x29, 0x5D, 0xA2, 0x0B, 0x78, 0xEA, 0x4D, 0x66,
+  0x3B, 0x82, 0x40, 0x72, 0x91, 0x10, 0xC0, 0x89, 0x49, 0xA5, 0x4B, 0x36, 0x6E, 0x4B, 0x23, 0x53,
+  0xCB, 0x66, 0xD9, 0x60, 0xCA, 0xC8, 0x31, 0x06, 0x64, 0xBE, 0xC5, 0x9E, 0x2F, 0xAC, 0x1B, 0x62,
+  0x27, 0x28, 0x2B, 0x06, 0x6A, 0xFF, 0xAC, 0xAF, 0x09, 0x50, 0x53, 0xA1, 0x7B, 0x4C, 0xD4, 0x7D,
+  0x94, 0x5C, 0x57, 0x99, 0x76, 0x95, 0x7C, 0x72, 0x6D, 0xF0, 0x19, 0x75, 0x62, 0x10, 0x2D, 0xA3,
+  0x37, 0xD3, 0xC8, 0x4C, 0x5D, 0x1B, 0x6E, 0x8E, 0x55, 0xAA, 0x1D, 0xFC, 0xCD, 0x6A, 0x91, 0x86,
+  0xA1, 0x7F, 0xE1, 0xBC, 0xD0, 0x25, 0x0D, 0x1C, 0xBF, 0x25, 0xB4, 0xE9, 0xA5, 0x1A, 0xEA, 0x6A,
+  0x45, 0x54, 0x28, 0x35, 0x25, 0x69, 0x38, 0x08, 0x0D, 0x31, 0x92, 0xE3, 0xBC, 0xD0, 0xB8, 0x3D,
+  0xD7, 0x61, 0xFD, 0xE4, 0xB1, 0x90, 0xCC, 0xE7, 0x33, 0x6B, 0xBA, 0x76, 0x32, 0xFB, 0xF3, 0x62,
+  0xF4, 0xCE, 0x3D, 0x95, 0x39, 0x86, 0x4E, 0xDD, 0x7F, 0x6D, 0x9A, 0x88, 0x68, 0xCB, 0xB5, 0x41,
+  0xCC, 0x84, 0x86, 0xC4, 0x14, 0x57, 0x2A, 0x86, 0x45, 0x14, 0x9B, 0x36, 0x77, 0x15, 0x0B, 0x53,
+  0x9D, 0x8C, 0x48, 0x2B, 0x41, 0x0C, 0xD1, 0x35, 0x8F, 0x54, 0x35, 0xBD, 0xB8, 0x8B, 0xF5, 0x32,
+  0x29, 0x8F, 0xF2, 0x1A, 0x53, 0xA0, 0xD3, 0x67, 0xCD, 0xD9, 0xF3, 0x89, 0xDA, 0xE8, 0x1C, 0x77,
+  0x8E, 0x7B, 0xF0, 0xA7, 0x59, 0xD4, 0xB8, 0xB8, 0x7A, 0xBB, 0x5D, 0x81, 0xE9, 0x9E, 0x41, 0xFE,
+  0xB4, 0x52, 0x5A, 0xB0, 0xCF, 0xC5, 0x42, 0xDC, 0x93, 0xA2, 0xF3, 0x4B, 0x4A, 0x3B, 0xA7, 0x1F,
+  0x4E, 0x31, 0xE9, 0xE2, 0x86, 0x98, 0x60, 0x2D, 0x45, 0x21, 0x5E, 0x5A, 0xFF, 0x69, 0xB1, 0x24,
+  0xE4, 0xFF, 0xBC, 0xB5, 0x87, 0x54, 0xF1, 0x97, 0xB6, 0xF4, 0xC2, 0x7A, 0x71, 0x0E, 0x6D, 0x1B,
+  0x9D, 0x74, 0xD4, 0x5B, 0x3C, 0xEB, 0x03, 0x0E, 0x4D, 0x18, 0x83, 0xDA, 0x30, 0x18, 0x4D, 0xCD,
+  0x0C, 0x43, 0x65, 0x4A, 0xE8, 0x60, 0xA6, 0x1B, 0x46, 0xCB, 0xB0, 0x6E, 0xF3, 0x33, 0x91, 0x6C,
+  0x4B, 0xDE, 0xB1, 0xD3, 0x7C, 0x93, 0x2F, 0xCB, 0xED, 0x1A, 0x22, 0xD7, 0x9F, 0x82, 0xDB, 0xFF,
+  0x6B, 0x5D, 0x4B, 0xC8, 0x35, 0xCA, 0x75, 0x14, 0x25, 0xEC, 0xB1, 0x5A, 0x43, 0x42, 0xA6, 0xC4,
+  0x32, 0xC1, 0xEC, 0x61, 0xCF, 0xAD, 0xEE, 0x4E, 0x17, 0x25, 0x86, 0x9E, 0xC1, 0xC0, 0xC8, 0x26,
+  0x86, 0x8A, 0x19, 0x7C, 0xA9, 0x19, 0x8A, 0xDC, 0xE1, 0x5B, 0xB8, 0xBA, 0x88, 0x24, 0x54, 0x75,
+  0x0F, 0x67, 0x76, 0xA9, 0xCD, 0x72, 0x87, 0xF4, 0x58, 0x3D, 0xE8, 0xE4, 0x49, 0x9D, 0xEB, 0x19,
+  0xDD, 0xAA, 0x11, 0xDD, 0x0B, 0xDA, 0x73, 0x9B, 0x6C, 0x05, 0x84, 0x39, 0xE6, 0xFF, 0xCF, 0xD9,
+  0xFC, 0x71, 0xF9, 0xA9, 0x12, 0xDA, 0x01, 0x70, 0x2B, 0x6A, 0xF7, 0x1D, 0x81, 0xA6, 0xD3, 0x9B,
+  0x14, 0xB1, 0x47, 0x7F, 0x76, 0x54, 0x96, 0x05, 0xC2, 0xCD, 0xDF, 0x8A, 0x0E, 0xD9, 0xBD, 0xDE,
+  0x37, 0x79, 0x3C, 0x4F, 0x66, 0x6E, 0xCA, 0xE2, 0x0F, 0xCD, 0x53, 0x7B, 0xD9, 0xD1, 0xAD, 0x15,
+  0x9A, 0x4D, 0xC9, 0x8D, 0x1C, 0xFE, 0x24, 0x66, 0xBA, 0xF5, 0x25, 0x52, 0xC6, 0xE8, 0x59, 0x98,
+  0x78, 0x3A, 0x24, 0x5E, 0xFA, 0x4C, 0x61, 0x86, 0x32, 0x4B, 0xDE, 0xE5, 0x03, 0x3C, 0xE4, 0x97,
+  0x46, 0x77, 0x98, 0xB8, 0xB6, 0x92, 0x51, 0x38, 0x7B, 0x92, 0x3D, 0x65, 0x16, 0x70, 0xB7, 0xCB,
+  0x4A, 0x1D, 0x20, 0x87, 0x63, 0x51, 0xBF, 0xB8, 0x57, 0x66, 0x45, 0x98, 0xDD, 0x99, 0xAC, 0xEC,
+  0x29, 0xCF, 0xA5, 0x0A, 0x69, 0x2F, 0x9A, 0xAB, 0x0A, 0x14, 0xED, 0x92, 0xE6, 0x1E, 0x9A, 0x63,
+  0x55, 0x86, 0x9D, 0x9C, 0x26, 0xA7, 0x86, 0xE5, 0x54, 0x9C, 0x00, 0x4B, 0x9F, 0xFF, 0x1A, 0x94,
+  0xEE, 0xBA, 0x33, 0x7D, 0x2A, 0xDB, 0x1D, 0x63, 0x3A, 0x57, 0x3A, 0x89, 0x91, 0x36, 0x73, 0x96,
+  0x92, 0xCE, 0xA0, 0xD1, 0xF5, 0xCB, 0x73, 0x69, 0x4A, 0x92, 0xC3, 0x68, 0x74, 0xA2, 0x4E, 0x64,
+  0xAA, 0x34, 0x13, 0x87, 0x85, 0xAE, 0x69, 0xC4, 0xCC, 0xDB, 0xFF, 0x21, 0x98, 0x3C, 0x20, 0xFF,
+  0xBF, 0xD5, 0xE5, 0x14, 0x99, 0xDB, 0x1A, 0x94, 0x7D, 0x7B, 0x0C, 0xEF, 0x68, 0xD2, 0x66, 0xD2,
+  0xA3, 0xA9, 0x48, 0x26, 0xAB, 0xDD, 0xCC, 0xB9, 0x56, 0x54, 0x19, 0xE8, 0x01, 0x4B, 0xED, 0x46,
+  0xF3, 0x18, 0x57, 0x74, 0x21, 0xA5, 0xCD, 0xD7, 0x96, 0xF8, 0x32, 0x60, 0x2B, 0x6D, 0x75, 0xE5,
+  0x1E, 0x97, 0xDA, 0xA8, 0x05, 0xC4, 0xDB, 0x4D, 0x55, 0xCD, 0x81, 0x32, 0xA3, 0x0C, 0x26, 0xFD,
+  0x2E, 0xC6, 0xDB, 0x5C, 0x15, 0x2D, 0x55, 0xD4, 0x39, 0x82, 0xDD, 0x70, 0x27, 0xA1, 0xED, 0x70,
+  0x17, 0x27, 0xC1, 0xCE, 0xBD, 0x0B, 0xDC, 0x13, 0x17, 0xDE, 0x35, 0xC7, 0x1B, 0x9A, 0x1A, 0xAA,
+  0xE3, 0x5C, 0xCA, 0xB8, 0xB7, 0x4B, 0x8E, 0x6E, 0xA2, 0xBB, 0xD0, 0xF4, 0x1B, 0x49, 0xD7, 0x2E,
+  0x65, 0xC3, 0x9A, 0x5B, 0xB1, 0x7B, 0xF4, 0x3E, 0x83, 0x19, 0x3A, 0xB2, 0x4B, 0x39, 0xB2, 0xC0,
+  0x28, 0xD3, 0x5A, 0xC1, 0x25, 0x79, 0xFC, 0xE4, 0x9B, 0xB3, 0xD3, 0xD3, 0xE1, 0xB3, 0x27, 0xE6,
+  0xC4, 0x59, 0xF1, 0xBF, 0x3F, 0xB2, 0xF5, 0x58, 0xB6, 0xA9, 0x0F, 0xFA, 0x36, 0xD7, 0x05, 0xDB,
+  0x73, 0x2E, 0x4E, 0x28, 0xD1, 0x18, 0x23, 0x27, 0xC0, 0x49, 0x0A, 0x6F, 0x3C, 0xDF, 0x49, 0x62,
+  0xCF, 0x2B, 0xE2, 0x40, 0x17, 0x3E, 0x51, 0xED, 0x84, 0x22, 0xB4, 0x18, 0xCB, 0xA6, 0x69, 0x2C,
+  0x91, 0x29, 0x28, 0x13, 0x6B, 0x13, 0x97, 0x80, 0x0A, 0xC5, 0x11, 0xE3, 0xA5, 0x88, 0x96, 0x46,
+  0x10, 0xAA, 0xD1, 0xEA, 0xB8, 0xBA, 0x0A, 0x65, 0x12, 0x0B, 0x45, 0x20, 0xC0, 0xC2, 0x9B, 0xA9,
+  0xF1, 0xC5, 0x03, 0x5F, 0xF6, 0x40, 0x31, 0x2D, 0x97, 0xC5, 0xCA, 0x94, 0xA6, 0x22, 0xA2, 0xF2,
+  0x3A, 0xA1, 0x75, 0x43, 0x26, 0x05, 0xA8, 0xB6, 0x45, 0xA9, 0xB3, 0x6B, 0xD9, 0x94, 0xE2, 0xB8,
+  0x7A, 0x95, 0xE5, 0xF1, 0x2F, 0x57, 0x6F, 0xFF, 0x2E, 0xBD, 0x7B, 0xF3, 0x9F, 0x44, 0x84, 0xF2,
+  0x98, 0xC2, 0x20, 0x2D, 0xD0, 0x72, 0x08, 0x0F, 0x4F, 0x27, 0x32, 0x47, 0x86, 0x52, 0xC0, 0xEE,
+  0xDE, 0x20, 0xE6, 0xDC, 0x5D, 0x5C, 0xCA, 0x8A, 0x8C, 0x7B, 0x5A, 0xBC, 0xB3, 0xAE, 0x2C, 0x61,
+  0x00, 0xA7, 0x07, 0x37, 0xAA, 0xB1, 0xC6, 0xA3, 0x8E, 0x88, 0xAC, 0xBB, 0xA6, 0x95, 0x58, 0x8C,
+  0x47, 0x16, 0x5F, 0xC7, 0xA1, 0x48, 0x1C, 0xD5, 0xB2, 0x3C, 0xFE, 0x48, 0xDC, 0x8B, 0x13, 0x76,
+  0x2B, 0x07, 0xB5, 0xEC, 0xB6, 0xC1, 0x93, 0x99, 0x39, 0x64, 0x99, 0x50, 0x16, 0xF0, 0x33, 0x5B,
+  0x5D, 0x12, 0xD4, 0x8A, 0x10, 0xF2, 0x61, 0xD4, 0xFD, 0x9A, 0xF2, 0xF8, 0x03, 0xA1, 0x19, 0x11,
+  0xB0, 0x21, 0x04, 0xFC, 0x05, 0x4F, 0x52, 0x23, 0xED, 0xFB, 0xF6, 0xCC, 0x17, 0xA5, 0x5A, 0x2A,
+  0x33, 0x73, 0x01, 0xBD, 0x3F, 0x6E, 0xB5, 0xA4, 0xDE, 0xBB, 0xF7, 0x52, 0xAB, 0x25, 0x50, 0xD8,
+  0x5A, 0x51, 0x77, 0xE2, 0xF8, 0x2B, 0x67, 0xF2, 0xF8, 0x9F, 0xBF, 0xBC, 0x7E, 0xD1, 0xE8, 0x76,
+  0xFA, 0xA3, 0x8D, 0x32, 0x18, 0xF6, 0x9B, 0x17, 0x27, 0xAC, 0x48, 0x71, 0x5A, 0x23, 0x79, 0xFC,
+  0x1E, 0x19, 0x69, 0x8C, 0x86, 0xFD, 0xAA, 0xB4, 0x4E, 0x91, 0xD6, 0x9B, 0x57, 0x8D, 0xD3, 0x6E,
+  0x67, 0xA3, 0x74, 0x47, 0x9D, 0x0A, 0xA4, 0x86, 0xF2, 0xF8, 0x3B, 0xA0, 0xA4, 0x9C, 0x21, 0xA9,
+  0x4E, 0x31, 0x52, 0xA8, 0xDA, 0x6E, 0x49, 0xD5, 0x0E, 0xE4, 0xF1, 0x4F, 0xA8, 0x5A, 0xC8, 0xB9,
+  0x51, 0x86, 0x4E, 0x15, 0x19, 0xFA, 0xE0, 0x32, 0x94, 0x16, 0xA8, 0x02, 0x84, 0xE8, 0x56, 0x51,
+  0x6D, 0x4F, 0x1E, 0xA3, 0x3A, 0x90, 0x12, 0x68, 0xB7, 0x02, 0xA1, 0x2E, 0x04, 0x3C, 0xE4, 0x09,
+  0xD8, 0xD9, 0x9C, 0x0E, 0x47, 0x15, 0x28, 0x29, 0x20, 0xDE, 0x27, 0x20, 0x35, 0x02, 0x4D, 0x0D,
+  0x2B, 0x29, 0x0A, 0xE2, 0x19, 0x12, 0x1A, 0xF6, 0x3B, 0x9B, 0x7E, 0x15, 0xAB, 0x01, 0xBF, 0x78,
+  0x83, 0x84, 0x80, 0xC8, 0xA6, 0x57, 0x45, 0x4B, 0xE0, 0x14, 0x57, 0xDF, 0x7F, 0xD7, 0xE8, 0x83,
+  0x64, 0xDD, 0xB3, 0x61, 0x79, 0x3A, 0xE0, 0x10, 0xC0, 0x07, 0xF2, 0x52, 0x9A, 0x04, 0x38, 0xC2,
+  0x3F, 0x51, 0x26, 0xA4, 0xD3, 0xED, 0x57, 0x90, 0x09, 0x2C, 0x1B, 0xEA, 0x23, 0x8D, 0xD2, 0x24,
+  0xC0, 0xA0, 0xDF, 0x50, 0x66, 0x90, 0x90, 0x72, 0x5A, 0x41, 0x31, 0x60, 0xCE, 0xFF, 0x44, 0x0D,
+  0x03, 0x91, 0x8D, 0xD2, 0xAF, 0xE0, 0x18, 0x60, 0xCE, 0xE0, 0x14, 0x18, 0x6D, 0xCA, 0x9B, 0x1F,
+  0xF0, 0x42, 0xA5, 0x02, 0x9F, 0x47, 0x97, 0x2F, 0xCF, 0x0C, 0xD8, 0xF1, 0xD9, 0x70, 0x73, 0x36,
+  0x14, 0x23, 0x80, 0xDD, 0x20, 0x76, 0x29, 0x59, 0x1D, 0x65, 0x76, 0x3F, 0x9A, 0xD5, 0x47, 0xFE,
+  0x7B, 0x0D, 0x43, 0x5F, 0x77, 0x5B, 0xB8, 0x87, 0xE4, 0xF5, 0x40, 0x27, 0xEC, 0x40, 0xAC, 0x73,
+  0x0C, 0x71, 0xE2, 0xEF, 0xC2, 0x92, 0xC7, 0x7D, 0x81, 0x24, 0x24, 0x92, 0xA5, 0xD2, 0xBA, 0x11,
+  0xFE, 0x69, 0x66, 0x84, 0x96, 0x87, 0x39, 0x11, 0x78, 0x43, 0x4F, 0x0E, 0x45, 0x8D, 0x52, 0xBD,
+  0x6F, 0x02, 0xAF, 0xEA, 0x46, 0x1E, 0x0F, 0x7B, 0xB9, 0x59, 0x4B, 0x79, 0x30, 0x26, 0x74, 0x92,
+  0xC5, 0x24, 0x8E, 0x53, 0x18, 0x8F, 0xA0, 0xAA, 0x3C, 0x7E, 0xE9, 0x1F, 0x57, 0x41, 0xA5, 0xD5,
+  0xAB, 0x00, 0x4B, 0x88, 0x1D, 0x86, 0x4C, 0xAB, 0xC7, 0xA1, 0x09, 0x90, 0xB9, 0x5F, 0x60, 0xF6,
+  0x89, 0x0B, 0x8E, 0xB1, 0x6C, 0xD5, 0x71, 0x0B, 0xA3, 0xE2, 0x55, 0x84, 0x7E, 0x82, 0x1F, 0x1D,
+  0x0C, 0x11, 0x9F, 0x95, 0xBF, 0x00, 0x1E, 0x8E, 0xEA, 0xAE, 0xD9, 0x7E, 0xB7, 0xC2, 0x88, 0x04,
+  0x55, 0x21, 0x2D, 0xF1, 0x8F, 0x2B, 0xA1, 0x52, 0x25, 0x7C, 0x85, 0xD8, 0xE1, 0xB8, 0x78, 0x21,
+  0xAC, 0xBF, 0x27, 0x5C, 0xFA, 0xFB, 0xC4, 0x65, 0xA1, 0xDA, 0xAB, 0x52, 0xE1, 0xCB, 0xAF, 0x09,
+  0xA8, 0x78, 0x87, 0x07, 0x73, 0x95, 0x80, 0x99, 0xBF, 0x80, 0xAF, 0x68, 0xC4, 0xB4, 0x74, 0xA7,
+  0xF8, 0x10, 0x98, 0xD7, 0x93, 0xC7, 0xAF, 0x48, 0xEB, 0x07, 0x3C, 0xAA, 0x02, 0xC7, 0x8B, 0xB5,
+  0x6B, 0x55, 0x00, 0xC4, 0xE3, 0x85, 0xC1, 0xD1, 0xE1, 0x68, 0x8C, 0xF6, 0x84, 0xC6, 0x68, 0x8F,
+  0x68, 0xA8, 0xE4, 0xB3, 0x41, 0x6E, 0x88, 0x51, 0x18, 0x0E, 0xAF, 0xA2, 0x3C, 0xBE, 0xDE, 0xAC,
+  0x2C, 0x07, 0x9F, 0x22, 0x7A, 0x8B, 0xE7, 0x95, 0x9C, 0x64, 0x50, 0x01, 0x13, 0x9F, 0x21, 0xEE,
+  0x23, 0x03, 0x8E, 0xCA, 0x60, 0x4F, 0xA8, 0x0C, 0xF6, 0x88, 0xCA, 0x5C, 0xD5, 0xCD, 0x29, 0xD1,
+  0x0D, 0x7C, 0xA2, 0xA1, 0x28, 0x30, 0xA1, 0xBA, 0xF2, 0xF8, 0x75, 0x70, 0x52, 0x05, 0x98, 0x4E,
+  0x05, 0x5C, 0xC2, 0xFC, 0x44, 0xFD, 0x65, 0x00, 0x43, 0xF1, 0x3D, 0x61, 0xA3, 0x28, 0xFB, 0xEC,
+  0x55, 0x56, 0x64, 0xAA, 0xAB, 0xC6, 0x67, 0x32, 0x9B, 0xC1, 0x30, 0xA8, 0x78, 0xD7, 0x12, 0xA9,
+  0x0E, 0xFD, 0x0B, 0x3B, 0x97, 0xAE, 0xE9, 0x79, 0xE1, 0x49, 0xBD, 0x18, 0xB9, 0xF2, 0x33, 0x7B,
+  0xF1, 0x31, 0x21, 0x5F, 0xDE, 0x26, 0x74, 0x2E, 0x95, 0x1D, 0xC9, 0xE3, 0x1F, 0x2C, 0x9F, 0xCF,
+  0xF2, 0xC3, 0xD6, 0x1F, 0xC8, 0x9C, 0xAE, 0x1E, 0x57, 0x19, 0x3D, 0xBF, 0xB6, 0xD5, 0x2D, 0x7D,
+  0x3D, 0x41, 0x95, 0xB1, 0xFC, 0x07, 0xA2, 0x49, 0x3F, 0xEA, 0xA6, 0x5B, 0x65, 0x66, 0xE1, 0xB5,
+  0x4D, 0x88, 0x59, 0x8D, 0xCA, 0x00, 0x86, 0x48, 0x70, 0x50, 0x8D, 0xC8, 0x10, 0x27, 0xBA, 0x57,
+  0xBA, 0xFA, 0x10, 0x06, 0xF1, 0xEA, 0xED, 0xA4, 0x78, 0x87, 0x72, 0x3B, 0x81, 0x7E, 0xF9, 0xE7,
+  0x97, 0xD2, 0x35, 0xDD, 0xEF, 0x5C, 0x38, 0x5C, 0xB1, 0xAD, 0x58, 0x22, 0x86, 0x1E, 0xAC, 0x67,
+  0x60, 0x9B, 0x3B, 0x0B, 0x4D, 0xC9, 0x0E, 0x24, 0xBA, 0xD8, 0x94, 0x20, 0x9E, 0xC7, 0x20, 0xDD,
+  0xB9, 0x22, 0x87, 0xA4, 0x15, 0x93, 0x71, 0x8F, 0xA9, 0xD8, 0xF4, 0xB6, 0x78, 0x1A, 0x36, 0xBD,
+  0x05, 0x98, 0xB4, 0x1B, 0xDC, 0x0A, 0xAF, 0x49, 0x80, 0x57, 0x2D, 0x40, 0x61, 0xAB, 0x87, 0x01,
+  0x8A, 0xCA, 0x7B, 0x68, 0xA0, 0xC0, 0x5A, 0x3E, 0x63, 0x3F, 0x5A, 0xC6, 0xA9, 0x68, 0x45, 0x79,
+  0xFC, 0x4E, 0x35, 0xD7, 0xD0, 0xC9, 0xD4, 0x05, 0x98, 0xDF, 0xF0, 0xC1, 0xDC, 0x8B, 0xCB, 0x7D,
+  0x68, 0xE8, 0x80, 0x91, 0xA5, 0xA5, 0x15, 0x1F, 0xEE, 0xF0, 0x7A, 0x2C, 0x24, 0xBE, 0x83, 0xA3,
+  0xC2, 0x89, 0x81, 0x47, 0x61, 0xCF, 0x19, 0x01, 0x1B, 0x4A, 0x95, 0x4F, 0x06, 0x3E, 0xAE, 0x4D,
+  0x73, 0x5B, 0x25, 0x13, 0xB8, 0x32, 0xAC, 0xB5, 0xB6, 0xAD, 0x92, 0x06, 0xFC, 0x63, 0x36, 0xD3,
+  0xA7, 0xA4, 0xD2, 0xF2, 0x82, 0xB5, 0x24, 0x0F, 0xA2, 0xE3, 0x25, 0xD3, 0x12, 0x23, 0xB9, 0x29,
+  0xA0, 0x78, 0x7D, 0x55, 0x6B, 0xC7, 0x0B, 0x6D, 0x1E, 0x28, 0x32, 0xA0, 0xB4, 0x07, 0x8F, 0xE7,
+  0x64, 0xFA, 0x99, 0x1A, 0x4F, 0x19, 0xB0, 0x58, 0x4D, 0x3F, 0xA2, 0x7B, 0xC3, 0xEF, 0x43, 0x8D,
+  0xEF, 0x02, 0x8E, 0xA2, 0xA3, 0x3B, 0x65, 0xD0, 0x1B, 0xFA, 0xC3, 0xBB, 0x5E, 0xF7, 0x7E, 0x07,
+  0x78, 0x48, 0x7C, 0xBF, 0xF8, 0x74, 0xCB, 0x40, 0x03, 0xD1, 0xE8, 0x07, 0x5C, 0x67, 0x28, 0x10,
+  0xB0, 0xAB, 0x3B, 0x52, 0xF7, 0x70, 0x9E, 0xD4, 0x7D, 0x00, 0xAE, 0x34, 0x2F, 0x11, 0xF1, 0xE6,
+  0x18, 0xF1, 0x5E, 0x5F, 0xD5, 0x83, 0xD0, 0xFC, 0x60, 0xA1, 0x6E, 0x7E, 0xD0, 0x50, 0x27, 0xF1,
+  0x9D, 0x72, 0x9E, 0x16, 0x4A, 0x66, 0xB0, 0xBC, 0x22, 0x9B, 0xCB, 0xAA, 0x12, 0xE4, 0x94, 0x4D,
+  0x95, 0x28, 0xE7, 0xB1, 0x11, 0x0D, 0x72, 0xC3, 0x60, 0x55, 0x64, 0x70, 0xBF, 0xCB, 0xBA, 0xFD,
+  0xCD, 0x1E, 0x9D, 0xC6, 0x56, 0x6F, 0x3F, 0xCF, 0x97, 0x6A, 0x61, 0x30, 0x78, 0x3D, 0xC0, 0xE2,
+  0xDD, 0x8B, 0x3A, 0xD3, 0x05, 0xAF, 0xDD, 0xC3, 0xF8, 0x91, 0x2F, 0xF5, 0xA1, 0x63, 0x9D, 0x41,
+  0xCC, 0xE2, 0xC1, 0x0E, 0x2B, 0xC9, 0xE3, 0xB7, 0xC4, 0x74, 0xA4, 0x2B, 0xCB, 0xE6, 0xEF, 0x84,
+  0xAC, 0x05, 0x35, 0xDA, 0xF2, 0x61, 0x20, 0x63, 0x42, 0x1F, 0x1A, 0xAF, 0xC5, 0x52, 0xB7, 0x6D,
+  0xCB, 0x2E, 0x0C, 0x19, 0xAF, 0x07, 0xC3, 0x8A, 0xD6, 0x3B, 0x7A, 0x54, 0x0B, 0x5C, 0x5E, 0xAB,
+  0x87, 0x41, 0xCC, 0x97, 0xF9, 0xD0, 0xA0, 0xDD, 0xCC, 0x0C, 0x7D, 0x55, 0x18, 0x32, 0x5A, 0x4B,
+  0x1E, 0x7F, 0x6A, 0x7D, 0x07, 0xFF, 0x6B, 0x81, 0x8B, 0xB5, 0x78, 0x18, 0xB0, 0xB8, 0xB4, 0x87,
+  0x86, 0x6A, 0xB2, 0x2A, 0x1E, 0x0E, 0xA1, 0x8E, 0x3C, 0x7E, 0xF9, 0xBE, 0x9E, 0xDC, 0x0F, 0x1B,
+  0x13, 0x44, 0xA8, 0x12, 0x1E, 0x54, 0xA8, 0x83, 0xCF, 0x74, 0x95, 0x40, 0xE3, 0x16, 0x19, 0xFF,
+  0xB9, 0x26, 0x34, 0x6E, 0x57, 0x87, 0xEA, 0x8E, 0x6E, 0x1F, 0x02, 0x3E, 0xF4, 0xA1, 0xC3, 0x89,
+  0x6A, 0x97, 0xD8, 0x34, 0xC6, 0x2A, 0xE2, 0xA6, 0x31, 0x38, 0x92, 0x5E, 0xAA, 0xF5, 0x74, 0x48,
+  0x7E, 0xBB, 0x75, 0xB8, 0x50, 0x20, 0xE4, 0xE1, 0xB3, 0x3C, 0xAD, 0x44, 0x92, 0xA7, 0x7D, 0xC6,
+  0x27, 0xF8, 0xF0, 0xC9, 0xF6, 0x2D, 0x64, 0x7B, 0xD7, 0xAF, 0xA4, 0xEF, 0xBD, 0xD3, 0x43, 0x4D,
+  0x0C, 0x45, 0x79, 0x8A, 0x8E, 0x9B, 0xBA, 0x83, 0x7D, 0x6D, 0xCB, 0x00, 0xCA, 0x15, 0xB1, 0x09,
+  0x3F, 0x04, 0xC6, 0x5F, 0x9F, 0x9A, 0xC7, 0x0A, 0x7F, 0x18, 0x89, 0x6E, 0x77, 0x20, 0x6E, 0xCB,
+  0x71, 0x75, 0xC3, 0x80, 0x41, 0x12, 0x71, 0xA5, 0x8F, 0x78, 0x28, 0xF8, 0xF4, 0x51, 0x88, 0x8A,
+  0xF7, 0xEC, 0xA1, 0x6B, 0x13, 0x75, 0x29, 0x8F, 0x3F, 0xE2, 0x8B, 0x65, 0x81, 0x16, 0x9E, 0xE5,
+  0x13, 0x0B, 0x3F, 0xA7, 0x94, 0x6D, 0x82, 0xF4, 0xC9, 0x44, 0x7C, 0xD4, 0x30, 0xFA, 0x22, 0x68,
+  0xF0, 0x01, 0xF6, 0xE0, 0xF1, 0xF8, 0xC2, 0x59, 0xA9, 0xA6, 0x57, 0x8C, 0x3E, 0x95, 0x7B, 0xCB,
+  0x1F, 0xB3, 0x9C, 0x58, 0x86, 0xF6, 0x2C, 0xB4, 0x12, 0xF8, 0xD1, 0x7F, 0x5E, 0x10, 0xAB, 0x80,
+  0x13, 0x79, 0x14, 0x72, 0xB4, 0xBD, 0xB0, 0x3D, 0xF2, 0xEC, 0xD1, 0x4E, 0x7C, 0x8D, 0x50, 0x86,
+  0xBA, 0x53, 0x1E, 0x71, 0xB4, 0xC9, 0xDC, 0xB7, 0xA2, 0xA4, 0x47, 0x5F, 0x13, 0x1F, 0x78, 0xFC,
+  0x40, 0xE6, 0xBA, 0x03, 0x3C, 0x4A, 0x00, 0xD4, 0x09, 0x7D, 0x48, 0x8C, 0x39, 0x8A, 0xD8, 0x03,
+  0x88, 0xE1, 0x26, 0xF9, 0xF3, 0xD3, 0x89, 0xCF, 0x95, 0x16, 0xEA, 0x4B, 0xE2, 0x0F, 0x81, 0x46,
+  0x29, 0xE6, 0x99, 0xE1, 0xE3, 0x56, 0x6B, 0xD1, 0xC7, 0xC7, 0xDD, 0x24, 0x4F, 0xB4, 0x8B, 0x93,
+  0x45, 0x3F, 0xEF, 0x71, 0xA2, 0xDC, 0x67, 0x15, 0x41, 0xD2, 0xD2, 0x8F, 0x2A, 0xA2, 0x96, 0xC6,
+  0xC0, 0xCD, 0xB1, 0xF4, 0x4E, 0x75, 0xBE, 0x1C, 0x4B, 0x9F, 0xD0, 0xE7, 0x6B, 0x7C, 0x62, 0x11,
+  0x79, 0x57, 0x35, 0xCD, 0x4E, 0x7D, 0x6A, 0xB1, 0x1F, 0x79, 0x6A, 0x71, 0xE8, 0x3D, 0xB5, 0x18,
+  0x4C, 0x5D, 0x77, 0x36, 0xBD, 0x4E, 0x67, 0x74, 0x8F, 0x4F, 0x2E, 0xDE, 0x8B, 0x4C, 0x4B, 0xD0,
+  0xA6, 0xA0, 0x4C, 0x7D, 0x4F, 0xA6, 0xD0, 0x0E, 0xDE, 0xCD, 0x6C, 0xF6, 0xD0, 0x24, 0xE2, 0x6B,
+  0x08, 0xE5, 0x45, 0xEA, 0x74, 0xEB, 0x7E, 0xBC, 0x94, 0x1A, 0xF7, 0x7D, 0x3D, 0x5D, 0x9A, 0x18,
+  0x0D, 0x07, 0x99, 0xC1, 0x30, 0xE4, 0xF4, 0xAF, 0xEF, 0xD3, 0xE9, 0xE7, 0x15, 0x9C, 0x7E, 0xBE,
+  0xE3, 0xF4, 0x35, 0x7A, 0xBB, 0xC7, 0xF8, 0x5F, 0xCD, 0xE3, 0x3D, 0xB9, 0x0A, 0x78, 0x7D, 0xA2,
+  0x5C, 0x9D, 0xCE, 0xBD, 0xFA, 0x7D, 0xAE, 0x93, 0xF8, 0xC6, 0xF0, 0xFA, 0x3E, 0x9D, 0x24, 0xC5,
+  0x74, 0x4B, 0xD9, 0x29, 0x0F, 0x3B, 0xE3, 0x7A, 0xFA, 0x25, 0x9A, 0x4D, 0x85, 0x01, 0xE5, 0xAD,
+  0xE3, 0xF3, 0x7B, 0xBD, 0x3E, 0x4F, 0x9D, 0xEE, 0x03, 0x1E, 0xF1, 0x27, 0xD9, 0xF7, 0x9C, 0x98,
+  0xAD, 0x20, 0x11, 0x2E, 0x9C, 0x98, 0xBD, 0x7F, 0xFB, 0xB6, 0x58, 0x2E, 0x16, 0x6E, 0xE5, 0x81,
+  0xE4, 0x62, 0x99, 0xF3, 0x56, 0xDB, 0x15, 0xDC, 0x40, 0xAE, 0x4B, 0x99, 0x6E, 0x50, 0x5D, 0x1E,
+  0xBF, 0xA4, 0xC7, 0x52, 0x48, 0x63, 0x85, 0x8C, 0x57, 0x78, 0x58, 0x1E, 0x9F, 0xD8, 0x0A, 0x58,
+  0x88, 0x63, 0x23, 0x48, 0x2B, 0x63, 0x32, 0x2B, 0x24, 0x9E, 0xB8, 0x50, 0x95, 0x7D, 0x42, 0x28,
+  0x15, 0x5E, 0xAE, 0x8D, 0xD2, 0xB0, 0xF1, 0xBA, 0xF2, 0xF8, 0x1D, 0x8C, 0x71, 0xF5, 0x95, 0xA1,
+  0xC3, 0xC8, 0xA3, 0xD1, 0x91, 0x5A, 0x52, 0x4F, 0x69, 0xD6, 0xD8, 0x47, 0x7A, 0x6C, 0x14, 0x7C,
+  0x8D, 0x87, 0x12, 0x3C, 0xDD, 0xD2, 0xBB, 0xA7, 0xF7, 0x78, 0x54, 0x05, 0xC4, 0xB6, 0x2C, 0xB7,
+  0x34, 0x1A, 0x5E, 0x65, 0x48, 0x54, 0xE0, 0x48, 0x0A, 0x30, 0x11, 0x87, 0x22, 0xB4, 0xD7, 0x2E,
+  0xA0, 0x26, 0x06, 0x87, 0xD0, 0xCE, 0x3A, 0x5C, 0xB0, 0x16, 0xDD, 0x92, 0x96, 0x40, 0x55, 0x91,
+  0xC7, 0xDD, 0x02, 0x14, 0xF2, 0x37, 0xA6, 0xDD, 0x97, 0x13, 0x39, 0xDB, 0xF2, 0xB1, 0x8F, 0xD7,
+  0x85, 0xB4, 0x7B, 0x0B, 0xA9, 0xEE, 0x52, 0x7A, 0x05, 0x6D, 0x51, 0x27, 0x52, 0x06, 0x75, 0x3A,
+  0x91, 0xC7, 0x46, 0x79, 0x27, 0x52, 0xE4, 0x07, 0x13, 0xD4, 0x56, 0x36, 0x29, 0x8D, 0x07, 0xAF,
+  0x2B, 0x8F, 0xDF, 0xDB, 0x04, 0xC1, 0x28, 0xE5, 0x3D, 0x3E, 0x91, 0x72, 0xCE, 0x73, 0x0F, 0x8E,
+  0xA2, 0xB4, 0x07, 0xD5, 0x68, 0x74, 0x8B, 0x39, 0x5B, 0x02, 0x85, 0x5E, 0x72, 0x10, 0xE8, 0x3D,
+  0x4C, 0x17, 0x26, 0x86, 0x36, 0x28, 0xEF, 0xC4, 0x5E, 0x6D, 0x1C, 0x3D, 0xC3, 0x61, 0x69, 0xC3,
+  0x09, 0x11, 0x7A, 0x50, 0x71, 0x57, 0x39, 0xBC, 0x31, 0x8D, 0xBB, 0x85, 0x4C, 0xBA, 0x1E, 0xD3,
+  0x59, 0xE1, 0x5B, 0xCF, 0x88, 0x59, 0x2E, 0xD2, 0xB0, 0xBA, 0x10, 0x69, 0xE8, 0x7B, 0xCF, 0xE8,
+  0xE6, 0xD7, 0x5A, 0x73, 0x5E, 0x8F, 0x81, 0xDD, 0xD5, 0xA8, 0xE2, 0x6B, 0x85, 0x39, 0x29, 0xB0,
+  0x2F, 0xEB, 0x43, 0xCB, 0x7F, 0x29, 0x63, 0xA5, 0xFB, 0x0A, 0x5E, 0x99, 0x43, 0xE8, 0x77, 0xDD,
+  0xF5, 0xE6, 0xBF, 0x3E, 0x17, 0x15, 0xFA, 0xEE, 0x1A, 0x13, 0xE0, 0xD0, 0xA2, 0x10, 0x05, 0x80,
+  0x05, 0x4D, 0x97, 0x8D, 0xF8, 0x0A, 0xAC, 0x04, 0xED, 0x79, 0x9C, 0x7F, 0xAB, 0x9B, 0xC5, 0xC7,
+  0xF9, 0x3F, 0xEB, 0xA6, 0x66, 0xDD, 0x16, 0x1B, 0xEA, 0x87, 0x1B, 0xFA, 0x13, 0x0C, 0xF5, 0x69,
+  0x67, 0x89, 0xAB, 0x77, 0x2D, 0x9B, 0x38, 0xE5, 0x3A, 0x4B, 0x5A, 0x7B, 0x83, 0x4B, 0x6D, 0x40,
+  0xC2, 0x91, 0xE8, 0x5A, 0xE0, 0xBE, 0xFD, 0xE5, 0x97, 0xF3, 0x70, 0xB2, 0xCB, 0x39, 0x10, 0x73,
+  0x98, 0x7E, 0xC2, 0xC4, 0xE3, 0xC1, 0xE7, 0x52, 0x7F, 0xDD, 0x95, 0x67, 0x7B, 0x70, 0x79, 0xEE,
+  0x23, 0x20, 0x13, 0x53, 0x2B, 0x6D, 0x59, 0x58, 0x37, 0xB0, 0xAB, 0x6B, 0x53, 0xAB, 0xD5, 0xAA,
+  0x58, 0xEB, 0xA5, 0x31, 0xE8, 0x76, 0x4E, 0xCF, 0x1E, 0x96, 0x59, 0xA1, 0x40, 0x15, 0x8C, 0x4A,
+  0x19, 0xF4, 0x4F, 0x1F, 0x8E, 0x5D, 0x59, 0xB3, 0x19, 0x5B, 0xE1, 0x2A, 0x67, 0x5A, 0xBC, 0xFA,
+  0x86, 0x3E, 0x5B, 0xE7, 0x90, 0x7A, 0xE3, 0x95, 0xDF, 0xB8, 0x18, 0x16, 0xBD, 0x04, 0x2C, 0x86,
+  0x0F, 0xCB, 0xB4, 0xB8, 0x44, 0xDB, 0xF2, 0x12, 0x0D, 0x1F, 0x8E, 0x69, 0xB9, 0x96, 0xAB, 0x1A,
+  0xA5, 0x2D, 0x8B, 0xD5, 0x06, 0xC3, 0xFA, 0x11, 0x0F, 0xA4, 0x8F, 0x20, 0x67, 0xAD, 0xC6, 0xE5,
+  0xB5, 0x5F, 0x3E, 0x70, 0xF5, 0x3A, 0x0F, 0xAC, 0x3F, 0x64, 0x22, 0x55, 0x0A, 0x5D, 0xC3, 0xFE,
+  0x03, 0x0A, 0x5D, 0x6B, 0x17, 0xAF, 0x96, 0x0E, 0x5D, 0xAC, 0x3A, 0x86, 0x2E, 0x7A, 0x54, 0xBF,
+  0x89, 0xF9, 0x1C, 0x54, 0xE8, 0x1C, 0xFB, 0xA3, 0x07, 0x16, 0xC1, 0x98, 0x4C, 0x95, 0x8C, 0xAC,
+  0xF7, 0x50, 0x82, 0xD8, 0x54, 0x15, 0x7E, 0x33, 0xD3, 0x4E, 0x36, 0xCF, 0xEA, 0xC2, 0x18, 0x8E,
+  0x1D, 0xD4, 0x3A, 0x83, 0xE1, 0x35, 0x7E, 0xEF, 0x4B, 0x76, 0xBE, 0x54, 0x0F, 0x69, 0xBE, 0x62,
+  0xA2, 0x9B, 0x66, 0x59, 0x98, 0x78, 0x5D, 0x79, 0xFC, 0x92, 0x1D, 0xD4, 0xBB, 0xB8, 0xCA, 0x1B,
+  0xBF, 0xFF, 0x95, 0x55, 0x4F, 0xAA, 0xBA, 0x61, 0x8A, 0x4D, 0x62, 0xD8, 0xFE, 0x2B, 0xEC, 0x65,
+  0xBE, 0x5B, 0x31, 0x78, 0xA5, 0xFD, 0xC3, 0x99, 0xD2, 0x98, 0xAB, 0x4B, 0x7C, 0xE4, 0xB0, 0xE8,
+  0xA4, 0xC6, 0x6B, 0xAC, 0x56, 0x6C, 0x4E, 0x23, 0xDA, 0xD2, 0xC3, 0x9E, 0xD5, 0x18, 0x47, 0xDF,
+  0x35, 0x07, 0x8C, 0xB7, 0x26, 0xBA, 0xEA, 0xE0, 0xE3, 0xB9, 0x70, 0x2C, 0xBD, 0x84, 0x63, 0xE9,
+  0xBD, 0xB1, 0xF6, 0x5F, 0x96, 0x99, 0xE4, 0x10, 0xE1, 0x9D, 0x4D, 0x01, 0x85, 0xB4, 0x5D, 0xFE,
+  0x74, 0x43, 0x17, 0x7F, 0x2C, 0x03, 0x8E, 0x71, 0x1F, 0xD3, 0xA0, 0x3F, 0xEA, 0xC8, 0x12, 0xCB,
+  0x8A, 0xF9, 0xA6, 0x72, 0xE7, 0x0B, 0xDD, 0xE0, 0xA4, 0xF8, 0x0C, 0x26, 0x39, 0x40, 0x98, 0x5F,
+  0x9F, 0x41, 0x6A, 0xBF, 0x55, 0xF6, 0x1D, 0xED, 0x6A, 0x44, 0xF1, 0xD4, 0xD1, 0x49, 0x34, 0x84,
+  0xC8, 0xDB, 0xF1, 0x58, 0x79, 0x91, 0xED, 0xF1, 0xC9, 0x8A, 0x50, 0x12, 0x15, 0x81, 0xFB, 0xBC,
+  0xEE, 0x57, 0xA6, 0xAE, 0x27, 0x93, 0x22, 0x26, 0x53, 0xB7, 0x82, 0x4C, 0xDD, 0x9A, 0x64, 0xEA,
+  0x79, 0x32, 0x75, 0xC5, 0x64, 0xEA, 0x55, 0x90, 0xA9, 0x57, 0x93, 0x4C, 0x7D, 0x4F, 0xA6, 0x9E,
+  0x98, 0x4C, 0xFD, 0x0A, 0x32, 0xF5, 0x6B, 0x92, 0x69, 0xE0, 0xC9, 0xD4, 0x17, 0x93, 0x69, 0x50,
+  0x41, 0xA6, 0x41, 0x4D, 0x32, 0x0D, 0x3D, 0x99, 0x06, 0x62, 0x32, 0x0D, 0x2B, 0xC8, 0x34, 0xAC,
+  0x49, 0xA6, 0x53, 0x4F, 0xA6, 0xA1, 0x98, 0x4C, 0xA7, 0x15, 0x64, 0x3A, 0xAD, 0x49, 0xA6, 0x91,
+  0x27, 0xD3, 0xA9, 0x98, 0x4C, 0xA3, 0x0A, 0x32, 0x8D, 0x6A, 0x92, 0xE9, 0xCC, 0x93, 0x69, 0x24,
+  0x26, 0xD3, 0x59, 0x05, 0x99, 0xCE, 0x6A, 0x92, 0x09, 0x17, 0xE5, 0x98, 0x50, 0x67, 0x82, 0x9D,
+  0x6E, 0xA7, 0x82, 0x54, 0x6A, 0x5D, 0x52, 0xF9, 0xA9, 0x84, 0x22, 0x9A, 0x4B, 0x54, 0x49, 0x26,
+  0x26, 0x75, 0x89, 0x15, 0x64, 0x13, 0x82, 0xE9, 0x84, 0x52, 0x25, 0x9F, 0x98, 0xD6, 0x25, 0x96,
+  0x9F, 0x50, 0x28, 0x82, 0x19, 0x85, 0x52, 0x25, 0xA5, 0xD0, 0xEA, 0x12, 0xCB, 0xCF, 0x29, 0x14,
+  0xC1, 0xA4, 0x42, 0xA9, 0x92, 0x55, 0x90, 0xBA, 0xC4, 0xF2, 0xD3, 0x0A, 0x45, 0x30, 0xAF, 0x50,
+  0xAA, 0x24, 0x16, 0xB3, 0xBA, 0xC4, 0xF2, 0x33, 0x0B, 0x45, 0x30, 0xB5, 0x50, 0x2A, 0xE4, 0x16,
+  0x67, 0x9D, 0xFD, 0x8B, 0x45, 0x5C, 0x3E, 0x44, 0x0E, 0x06, 0x6D, 0x42, 0x8F, 0x9E, 0xF0, 0x4A,
+  0xF8, 0x6C, 0x14, 0x53, 0xC8, 0x95, 0x65, 0xCE, 0xF4, 0xB9, 0x3F, 0xC9, 0xF0, 0x60, 0x9E, 0x92,
+  0x70, 0x42, 0xAF, 0xE9, 0x14, 0x9E, 0x68, 0xF8, 0xF8, 0xEA, 0xBA, 0xD8, 0x34, 0x43, 0xB8, 0x95,
+  0x3F, 0xD1, 0x24, 0x03, 0xB0, 0xDD, 0x0D, 0xBF, 0x33, 0x5C, 0x68, 0x5E, 0x81, 0x56, 0x2A, 0x32,
+  0xA3, 0x30, 0x08, 0xCF, 0x28, 0x0C, 0x85, 0x67, 0x14, 0x18, 0x73, 0xFB, 0x99, 0x4B, 0x00, 0xDA,
+  0x3D, 0xF6, 0xA2, 0x73, 0x71, 0xA1, 0x7B, 0xE5, 0x85, 0x1E, 0x14, 0x11, 0xBA, 0x57, 0x46, 0xE8,
+  0x12, 0x4F, 0x37, 0x0A, 0xEA, 0x09, 0xF8, 0xFD, 0x4E, 0xDF, 0x10, 0x4D, 0xFA, 0x55, 0x5C, 0x55,
+  0x4A, 0x79, 0x55, 0x9D, 0x16, 0x51, 0x95, 0xB2, 0x47, 0xFB, 0x18, 0x78, 0x72, 0xFF, 0x24, 0x2E,
+  0xF7, 0xA0, 0xBC, 0xDC, 0xBD, 0x22, 0x72, 0x0F, 0xF6, 0x28, 0x77, 0xDF, 0x93, 0xFB, 0x93, 0xB8,
+  0xDC, 0xFD, 0xF2, 0x72, 0xF7, 0x8B, 0xC8, 0xDD, 0xDF, 0xA3, 0xDC, 0x5D, 0x08, 0x36, 0x3F, 0x7D,
+  0x92, 0x7E, 0x5C, 0xD8, 0xC4, 0x59, 0xE4, 0xCF, 0xC4, 0xB1, 0x1A, 0x65, 0xFB, 0xF6, 0x41, 0x0D,
+  0x63, 0x37, 0xE4, 0xB0, 0x17, 0x96, 0xA9, 0x2B, 0x22, 0x53, 0x4F, 0xE8, 0x4B, 0x22, 0xC9, 0x32,
+  0x25, 0x8F, 0xDC, 0x14, 0x51, 0xA1, 0xF6, 0x17, 0xC3, 0x46, 0xF2, 0xF8, 0xCD, 0xBA, 0x40, 0xFF,
+  0x36, 0x2A, 0x6F, 0xCF, 0x9D, 0x22, 0xF6, 0x3C, 0xDA, 0xA3, 0x3D, 0x9F, 0x51, 0x99, 0x21, 0x2F,
+  0x73, 0x04, 0x60, 0x3F, 0xAB, 0x60, 0xC9, 0x4A, 0x1D, 0x96, 0x8C, 0x1F, 0x12, 0x46, 0x71, 0x7E,
+  0x42, 0x81, 0x24, 0xC8, 0x58, 0x0A, 0x74, 0x46, 0xA7, 0x05, 0xD1, 0x1C, 0x95, 0x8C, 0x4E, 0xC8,
+  0xE3, 0xDE, 0xE0, 0xC4, 0xA1, 0x07, 0x2A, 0xE0, 0x53, 0x09, 0x05, 0x0C, 0xCB, 0x2B, 0xA0, 0x50,
+  0xE6, 0x82, 0x3C, 0xEE, 0x4F, 0x01, 0x1D, 0xA6, 0x80, 0x8F, 0xC1, 0xAB, 0x6A, 0x33, 0x0C, 0xBA,
+  0xC2, 0x0C, 0xD4, 0xA0, 0x86, 0x35, 0x12, 0x8C, 0xB4, 0x8A, 0x67, 0xD1, 0x20, 0x51, 0x31, 0x40,
+  0xBB, 0x4A, 0x79, 0x40, 0x0B, 0xC5, 0xA7, 0xEE, 0x3E, 0x13, 0xAC, 0x6E, 0xC7, 0xB3, 0xE8, 0xE2,
+  0x0A, 0xE8, 0x94, 0x57, 0x80, 0x52, 0x48, 0x01, 0x9D, 0x87, 0x95, 0x8C, 0x0F, 0x77, 0xBF, 0x2E,
+  0x9A, 0xAF, 0xAD, 0x61, 0xF9, 0xDE, 0xAC, 0x5B, 0x44, 0x59, 0x7B, 0xF5, 0xFE, 0x5E, 0x20, 0xB9,
+  0xF4, 0xAB, 0x14, 0xDD, 0xFA, 0x9A, 0x15, 0x07, 0x7A, 0x15, 0xE2, 0xC0, 0xA0, 0x96, 0x9E, 0xED,
+  0x2C, 0x41, 0xB2, 0x82, 0x01, 0xFE, 0xAC, 0xBC, 0x3B, 0x14, 0x42, 0x18, 0x79, 0xDD, 0x1F, 0xC4,
+  0x83, 0x88, 0x22, 0xD8, 0x97, 0x8D, 0x45, 0x20, 0x1E, 0x54, 0x80, 0xF8, 0xB4, 0x16, 0x88, 0x47,
+  0x09, 0x92, 0x15, 0x84, 0x78, 0x54, 0x1E, 0xE2, 0x42, 0x43, 0x4B, 0x65, 0x9F, 0x39, 0x29, 0xCE,
+  0x76, 0x87, 0x14, 0x11, 0x7E, 0xED, 0x7C, 0x16, 0xC0, 0xFD, 0x0A, 0x00, 0x57, 0x5B, 0x9F, 0xDD,
+  0x5F, 0x24, 0x3F, 0x4D, 0xFA, 0x26, 0x71, 0xBE, 0x1D, 0x9C, 0x96, 0x8F, 0xE5, 0x85, 0x3A, 0xBE,
+  0xBD, 0xA6, 0xB2, 0xD0, 0x3A, 0x64, 0x3D, 0xBB, 0xD2, 0x67, 0x98, 0x80, 0x52, 0xC1, 0x04, 0x7A,
+  0xB5, 0xF8, 0x78, 0x57, 0x1E, 0x7F, 0x2A, 0x28, 0x54, 0x95, 0xF9, 0x83, 0xD2, 0xFB, 0x43, 0xEA,
+  0x9B, 0x7A, 0x9F, 0x2E, 0x37, 0xC5, 0xA7, 0xDE, 0xAF, 0xDE, 0xFD, 0x52, 0x6C, 0xEA, 0x3D, 0xDC,
+  0x4A, 0x7D, 0x53, 0xEF, 0x35, 0xBC, 0x46, 0x0B, 0x04, 0xC3, 0xF7, 0x47, 0x4C, 0x75, 0x87, 0x36,
+  0x09, 0x8A, 0x91, 0xDE, 0x7B, 0xA7, 0xBE, 0x8A, 0x42, 0x4F, 0xEC, 0x47, 0xCB, 0x67, 0x59, 0x4F,
+  0x2F, 0x23, 0x2C, 0x94, 0x7D, 0x1D, 0x4A, 0x7B, 0xC8, 0xBF, 0xCC, 0x53, 0xE1, 0xD1, 0xFA, 0xB4,
+  0x97, 0x06, 0xB4, 0x4F, 0x0B, 0xD2, 0xDE, 0xFB, 0x23, 0xF7, 0xE3, 0x18, 0x50, 0x0A, 0xC5, 0x47,
+  0xC1, 0x73, 0xE1, 0x79, 0x72, 0x5A, 0xAD, 0x48, 0x34, 0xEF, 0x85, 0xA7, 0x5A, 0xC4, 0xA3, 0x39,
+  0x63, 0x6F, 0x3F, 0xD1, 0x1C, 0x69, 0x47, 0x64, 0x2F, 0x90, 0xD5, 0xB0, 0xBA, 0xC5, 0x14, 0x30,
+  0x29, 0x33, 0x90, 0xE5, 0x4C, 0x26, 0x6A, 0xE0, 0x5E, 0x54, 0xD0, 0xA5, 0x1A, 0xE8, 0xC6, 0xD0,
+  0x4F, 0x09, 0xFC, 0xB4, 0x7C, 0xD9, 0xB8, 0xDF, 0xAB, 0x61, 0x6E, 0x02, 0xD5, 0x15, 0x91, 0xA8,
+  0x20, 0xA6, 0xDD, 0xF2, 0x98, 0x16, 0x33, 0xEA, 0xEE, 0x1E, 0xAD, 0xBA, 0x47, 0x15, 0xD0, 0x13,
+  0x86, 0xB4, 0x57, 0x01, 0xD2, 0x5E, 0x2D, 0x90, 0x46, 0x24, 0x2A, 0x08, 0x69, 0xAF, 0x3C, 0xA4,
+  0xDD, 0x42, 0x90, 0xF6, 0xF6, 0x08, 0x69, 0x9F, 0x2A, 0xA0, 0x2F, 0x0C, 0x69, 0xBF, 0x02, 0xA4,
+  0xFD, 0x5A, 0x20, 0x8D, 0x48, 0x54, 0x10, 0xD2, 0x7E, 0x79, 0x48, 0x7B, 0x85, 0x20, 0xED, 0xEF,
+  0x11, 0xD2, 0x01, 0x55, 0xC0, 0x40, 0x18, 0xD2, 0x41, 0x05, 0x48, 0x07, 0xB5, 0x40, 0x1A, 0x91,
+  0xA8, 0x20, 0xA4, 0x83, 0xF2, 0x90, 0xF6, 0x0B, 0x41, 0x3A, 0xD8, 0x23, 0xA4, 0x43, 0xAA, 0x80,
+  0xA1, 0x30, 0xA4, 0xC3, 0x0A, 0x90, 0x0E, 0x6B, 0x81, 0x34, 0x22, 0x51, 0x41, 0x48, 0x87, 0xE5,
+  0x21, 0x1D, 0x14, 0x82, 0x74, 0xB8, 0x47, 0x48, 0x4F, 0xA9, 0x02, 0x4E, 0x85, 0x21, 0x3D, 0xAD,
+  0x00, 0xE9, 0x69, 0x2D, 0x90, 0x46, 0x24, 0x2A, 0x08, 0xE9, 0x69, 0x79, 0x48, 0x87, 0x85, 0x20,
+  0x3D, 0xDD, 0x23, 0xA4, 0x23, 0xAA, 0x80, 0x91, 0x30, 0xA4, 0xA3, 0x0A, 0x90, 0x8E, 0x6A, 0x81,
+  0x34, 0x22, 0x51, 0x41, 0x48, 0x47, 0xE5, 0x21, 0x3D, 0x2D, 0x04, 0xE9, 0x68, 0x8F, 0x90, 0x9E,
+  0x51, 0x05, 0x9C, 0x09, 0x43, 0x7A, 0x56, 0x01, 0xD2, 0xB3, 0x5A, 0x20, 0xED, 0x84, 0x25, 0x2A,
+  0x08, 0x69, 0xA7, 0x20, 0xA4, 0x6A, 0xD9, 0x81, 0x69, 0xA7, 0xE8, 0xC0, 0xB4, 0xBE, 0xF9, 0x3B,
+  0xF5, 0x76, 0x52, 0xE2, 0xD3, 0x2F, 0x2F, 0x7E, 0x7E, 0x99, 0x3E, 0xB1, 0x9F, 0x3A, 0x8B, 0x17,
+  0x69, 0xEB, 0xA1, 0x4F, 0xE3, 0x45, 0x3E, 0xA2, 0x0B, 0x8C, 0x2B, 0xFE, 0x17, 0xC3, 0x77, 0x84,
+  0xCF, 0xB6, 0x34, 0x56, 0xB9, 0x80, 0xA5, 0xF5, 0xFA, 0x9D, 0x61, 0x19, 0x4B, 0xE3, 0x5C, 0xEE,
+  0x27, 0x78, 0x20, 0x71, 0x18, 0x8B, 0xA3, 0xEC, 0x1F, 0x84, 0xD6, 0x74, 0x58, 0x85, 0x68, 0xF8,
+  0xE8, 0x77, 0xCE, 0x04, 0xE3, 0x07, 0xE8, 0x20, 0x6D, 0x63, 0xFC, 0x3D, 0x06, 0x10, 0xE4, 0xB1,
+  0xC7, 0x84, 0x7A, 0x2D, 0x2C, 0x54, 0xAF, 0x8A, 0x50, 0xDD, 0x7A, 0x84, 0xEA, 0x33, 0xA1, 0x5E,
+  0x0A, 0x0B, 0xD5, 0xAF, 0x22, 0x54, 0x3F, 0x57, 0xA8, 0x87, 0x10, 0xE8, 0xC8, 0x94, 0x7E, 0x4A,
+  0xBC, 0x70, 0xA8, 0xBB, 0xBE, 0x3A, 0x79, 0xF1, 0xFA, 0x4A, 0xA2, 0x4B, 0x9A, 0x96, 0x51, 0x30,
+  0xE2, 0x45, 0x1B, 0xFD, 0x53, 0xC5, 0x3C, 0xCA, 0x7A, 0x28, 0xEA, 0x05, 0xDF, 0x7B, 0xCF, 0x0B,
+  0x78, 0xBC, 0x66, 0x91, 0x90, 0x37, 0xE8, 0xF4, 0xCA, 0xCC, 0x10, 0xFA, 0x4C, 0xEE, 0x29, 0xE8,
+  0x51, 0xF2, 0xDD, 0x40, 0x07, 0xD7, 0xC5, 0x74, 0xD0, 0x2D, 0xAF, 0x83, 0x4E, 0x41, 0x1D, 0x74,
+  0xF7, 0xAB, 0x03, 0x8C, 0x92, 0xD7, 0x57, 0xD2, 0xFB, 0xBF, 0x4B, 0xD7, 0x9B, 0x95, 0xE5, 0xAC,
+  0x6D, 0x92, 0x1B, 0x55, 0x78, 0xBD, 0xD8, 0x07, 0xDF, 0x07, 0x83, 0x9E, 0x68, 0x60, 0x19, 0xA4,
+  0x77, 0x01, 0xB3, 0x8E, 0x7C, 0xCF, 0x02, 0xF6, 0x7D, 0x01, 0x3F, 0x10, 0x40, 0x5A, 0x28, 0x6E,
+  0xF2, 0x8A, 0x51, 0x09, 0x95, 0x0E, 0x6E, 0xAF, 0x16, 0x14, 0x30, 0x39, 0xA3, 0xEC, 0xDD, 0x6B,
+  0x77, 0x40, 0xB9, 0x1C, 0xF8, 0xE2, 0x7D, 0xFA, 0xF1, 0xA3, 0x98, 0x60, 0x83, 0x4A, 0xD0, 0x4D,
+  0x53, 0xA1, 0xBB, 0x97, 0x4E, 0xE1, 0x51, 0x72, 0x3D, 0x08, 0xBD, 0xBB, 0x75, 0x52, 0x34, 0x79,
+  0x31, 0xD3, 0xE7, 0x60, 0xC7, 0xC9, 0x6D, 0x50, 0xD5, 0xB2, 0x97, 0x9D, 0xE2, 0x47, 0x23, 0x5B,
+  0x53, 0x88, 0xFE, 0x60, 0x12, 0xE8, 0x74, 0x9E, 0xC2, 0x97, 0xEA, 0x9C, 0x04, 0xD7, 0x25, 0x16,
+  0xDB, 0xB3, 0x62, 0xB6, 0xCA, 0x08, 0xAA, 0x37, 0x84, 0x7F, 0xE1, 0x52, 0x5A, 0xD8, 0x64, 0x76,
+  0x29, 0x7F, 0xE3, 0xD3, 0xE4, 0x4F, 0xE5, 0x61, 0x11, 0x59, 0xD2, 0xAC, 0x5B, 0xD3, 0xB0, 0x54,
+  0xEC, 0x0F, 0xD4, 0x95, 0x0B, 0x9C, 0xB6, 0xFF, 0x58, 0xE1, 0x8B, 0xAF, 0x54, 0x7C, 0x88, 0x4B,
+  0x15, 0xFB, 0x38, 0xEA, 0xD4, 0xB0, 0x1C, 0x6F, 0x34, 0x87, 0x87, 0xFE, 0x17, 0x31, 0xFF, 0xE7,
+  0xBF, 0xF3, 0x76, 0x10, 0xE8, 0xCB, 0x79, 0x48, 0x01, 0xB2, 0xE4, 0xD8, 0xD3, 0x4B, 0x19, 0x38,
+  0xB5, 0x2D, 0xC7, 0xB1, 0x6C, 0x7D, 0xAE, 0xA7, 0xA0, 0x93, 0xA6, 0xED, 0x93, 0x24, 0x75, 0xC7,
+  0x0A, 0x27, 0x00, 0x7F, 0xE1, 0x4C, 0x6D, 0x7D, 0xE5, 0x8E, 0x1F, 0x69, 0xD6, 0x74, 0xBD, 0x24,
+  0xA6, 0xDB, 0x56, 0x35, 0xED, 0xFA, 0x06, 0x0E, 0xDE, 0xE2, 0xC7, 0xDA, 0x40, 0xF3, 0x8D, 0xA3,
+  0x57, 0xFF, 0x78, 0x87, 0xBD, 0x33, 0x5E, 0x03, 0x7D, 0x11, 0xED, 0xE8, 0x58, 0x9A, 0xAD, 0x4D,
+  0xD6, 0x41, 0x36, 0x08, 0x96, 0x6D, 0x4A, 0x5F, 0x81, 0xE2, 0x8D, 0x6A, 0x4B, 0x13, 0xD5, 0x21,
+  0x6F, 0x2C, 0xC7, 0x95, 0x2E, 0x25, 0x9F, 0xA2, 0x61, 0x4D, 0xE9, 0x76, 0x8E, 0x36, 0x93, 0x8B,
+  0x97, 0x64, 0x82, 0xFF, 0x64, 0x1B, 0x50, 0xD4, 0xAF, 0xF5, 0x54, 0x3A, 0x3A, 0x1F, 0x29, 0x47,
+  0x68, 0xBB, 0x7E, 0x13, 0x33, 0x02, 0xD1, 0x1F, 0xCA, 0x35, 0xD6, 0xB6, 0x71, 0x2C, 0x4D, 0x27,
+  0xCD, 0xAF, 0x94, 0x7B, 0x7A, 0x19, 0xAF, 0x35, 0xB9, 0x30, 0x6D, 0x77, 0x41, 0xCC, 0x46, 0xC0,
+  0x99, 0x4D, 0x9C, 0x95, 0x65, 0x3A, 0x84, 0x31, 0xC7, 0x7E, 0xF4, 0x59, 0x70, 0xBD, 0xED, 0xB8,
+  0xAA, 0xBB, 0x76, 0xA4, 0xC7, 0x97, 0x97, 0x52, 0xB7, 0xD3, 0x09, 0x17, 0x93, 0xA0, 0x99, 0x78,
+  0xB9, 0x63, 0x29, 0x76, 0xE1, 0x47, 0xB2, 0x71, 0x9B, 0xCF, 0xFC, 0x3A, 0x77, 0x12, 0x31, 0x1C,
+  0x12, 0x21, 0xE2, 0x57, 0xC0, 0xD7, 0xC9, 0x35, 0x9A, 0x51, 0x06, 0x1B, 0x9A, 0xEA, 0xAA, 0xCD,
+  0xAF, 0x11, 0xBC, 0xA0, 0x55, 0xE0, 0xE4, 0x58, 0xA2, 0xB7, 0x9E, 0x85, 0x6E, 0xDD, 0x35, 0xDB,
+  0xA0, 0x43, 0x90, 0xD7, 0xAF, 0x4D, 0x6C, 0x3B, 0xCA, 0x31, 0xAD, 0xDD, 0x52, 0x8E, 0x25, 0xBC,
+  0x13, 0xAD, 0x1B, 0x62, 0xF2, 0x91, 0x77, 0xCD, 0x53, 0x5A, 0x36, 0xD9, 0x04, 0x92, 0x8C, 0xDC,
+  0x5D, 0x04, 0x22, 0x88, 0x43, 0x1F, 0xC8, 0x1C, 0x34, 0x36, 0x3F, 0xE6, 0x61, 0xE9, 0x98, 0xC6,
+  0xA4, 0x63, 0x16, 0xCE, 0x42, 0xA8, 0x81, 0x43, 0x3B, 0x96, 0x41, 0xC0, 0x26, 0xE6, 0x8D, 0x23,
+  0xFE, 0x29, 0x50, 0xB0, 0xA7, 0xA3, 0xCE, 0xE6, 0xE8, 0x29, 0x54, 0x6F, 0xBB, 0xD6, 0x47, 0xD7,
+  0xD6, 0xCD, 0x79, 0x43, 0x19, 0x36, 0x03, 0x5A, 0xF4, 0x36, 0x12, 0x8C, 0xDD, 0xA7, 0xD7, 0x69,
+  0x13, 0xF1, 0x1B, 0x0D, 0x7E, 0xFD, 0xE9, 0x51, 0xF3, 0x88, 0xB3, 0x4E, 0xCF, 0xC1, 0xD8, 0x1A,
+  0xEC, 0xE0, 0x09, 0xE5, 0xB0, 0x29, 0x5D, 0x5C, 0xF0, 0x66, 0x58, 0x29, 0xBC, 0x08, 0x85, 0xE8,
+  0xBF, 0xD8, 0x2D, 0xDF, 0x10, 0x7F, 0xFF, 0xF6, 0xAB, 0x67, 0xB1, 0x77, 0x27, 0xC0, 0xF5, 0x73,
+  0x8C, 0xCB, 0xDF, 0x7E, 0x85, 0xBF, 0x77, 0x4F, 0x68, 0x28, 0xFE, 0xF6, 0x2B, 0xFE, 0xBB, 0x7B,
+  0x02, 0x2D, 0xC1, 0x31, 0x6D, 0xEF, 0xEE, 0x77, 0xAA, 0x85, 0x5D, 0xDD, 0xCD, 0x53, 0x75, 0xE7,
+  0x2B, 0xAD, 0x30, 0x4F, 0xF3, 0x0C, 0xA6, 0x7E, 0x0F, 0xBC, 0xB7, 0x31, 0xB5, 0x34, 0x00, 0xC7,
+  0x05, 0x3B, 0xF6, 0x20, 0x37, 0x00, 0x12, 0x4F, 0x51, 0x1D, 0x0F, 0x72, 0x7D, 0x46, 0x4B, 0x4A,
+  0xDC, 0x51, 0x02, 0xF3, 0xF0, 0x4A, 0xAE, 0x54, 0xDB, 0x21, 0xDF, 0x9B, 0x6E, 0xC3, 0x8D, 0xB8,
+  0x44, 0x8A, 0xC6, 0xC7, 0xE3, 0x88, 0x08, 0xF8, 0x03, 0xF5, 0xA0, 0xDC, 0x11, 0x07, 0xCD, 0x37,
+  0xB5, 0x47, 0xBE, 0x15, 0x06, 0x9C, 0xB2, 0x9B, 0x29, 0x56, 0xF8, 0xCB, 0xD4, 0xF8, 0xD2, 0xD8,
+  0xC0, 0x9F, 0x78, 0xA0, 0xD8, 0x51, 0x11, 0x16, 0x7A, 0x8E, 0x7F, 0x40, 0x2F, 0xF8, 0x2F, 0x15,
+  0x1F, 0xA0, 0xFA, 0xDE, 0x30, 0x1A, 0xEC, 0xB3, 0x5F, 0x00, 0xCD, 0x1A, 0x82, 0x90, 0xB3, 0xC5,
+  0x70, 0x60, 0x59, 0xEE, 0xE7, 0x63, 0x69, 0x65, 0x03, 0x63, 0xF4, 0x4B, 0x1F, 0x70, 0x0C, 0x84,
+  0x88, 0xC9, 0xFE, 0xE7, 0x72, 0xB0, 0x32, 0x8C, 0xE7, 0x8C, 0x2A, 0xB0, 0xC0, 0x0E, 0x00, 0xA9,
+  0x35, 0x5A, 0x0C, 0xFC, 0xBD, 0x7B, 0x02, 0x8D, 0xC0, 0x21, 0xFC, 0xBD, 0x7B, 0x82, 0x4D, 0x21,
+  0x96, 0xD8, 0xE2, 0xDD, 0x13, 0x68, 0x11, 0x4E, 0xE0, 0x2F, 0x94, 0xC1, 0x76, 0xB1, 0x14, 0xFE,
+  0x87, 0x3B, 0xB4, 0x7D, 0xBC, 0x49, 0x0F, 0xD8, 0x05, 0x7E, 0x9A, 0x25, 0x20, 0x7B, 0xD3, 0x7D,
+  0x83, 0xBE, 0x79, 0xFC, 0xF3, 0x06, 0xC4, 0xA1, 0x07, 0x5B, 0x70, 0x7C, 0x53, 0xC3, 0x73, 0xFC,
+  0xB7, 0xF5, 0xCC, 0x13, 0x2F, 0xF0, 0x23, 0xB8, 0x46, 0xDF, 0xCE, 0x8A, 0x97, 0xD8, 0x01, 0x96,
+  0xA2, 0xEF, 0xD2, 0xA4, 0xA5, 0xD8, 0x11, 0x5C, 0xE3, 0x6F, 0x60, 0x3C, 0x96, 0xF8, 0x3B, 0xFE,
+  0x72, 0x95, 0x13, 0xBC, 0x83, 0xEF, 0xB9, 0xB3, 0x41, 0x01, 0x19, 0x6B, 0xA8, 0x15, 0xFF, 0x6C,
+  0x7B, 0xF7, 0x84, 0xE0, 0x3D, 0xCA, 0x24, 0x1C, 0x6F, 0xF9, 0x31, 0x5C, 0x07, 0xFE, 0xF0, 0x8E,
+  0xC7, 0x30, 0xBD, 0xB0, 0x0D, 0x2E, 0x40, 0x09, 0x17, 0xEF, 0x73, 0xE6, 0xE1, 0x6C, 0xEB, 0x9F,
+  0x61, 0x6D, 0x5A, 0x97, 0x8B, 0x01, 0xA7, 0xDB, 0xE0, 0x14, 0xEE, 0xA2, 0x2C, 0x08, 0x00, 0x97,
+  0xE9, 0xEE, 0x09, 0x97, 0x09, 0x51, 0x64, 0x47, 0x71, 0x55, 0x63, 0xD0, 0x73, 0x79, 0x90, 0x7C,
+  0xC9, 0x72, 0x90, 0x50, 0xF7, 0x08, 0x01, 0xE0, 0xDA, 0x20, 0x78, 0xF8, 0x72, 0xFB, 0xBD, 0xD6,
+  0x38, 0xE2, 0x9F, 0x6E, 0x3D, 0xC2, 0x10, 0x1D, 0xAE, 0xD3, 0xB6, 0xCC, 0xA9, 0xA1, 0x4F, 0x31,
+  0x12, 0x34, 0x9A, 0xD2, 0xE5, 0x98, 0x87, 0x69, 0xF4, 0x58, 0x28, 0x1E, 0xF6, 0xC2, 0x54, 0xD2,
+  0xDE, 0xC7, 0x47, 0x8F, 0x9A, 0x6D, 0xEA, 0x68, 0xDC, 0x99, 0x90, 0x04, 0x8F, 0x31, 0x62, 0x34,
+  0xB0, 0x70, 0x02, 0x8D, 0x9D, 0x70, 0x90, 0x49, 0x84, 0x96, 0x0E, 0x51, 0xA1, 0x64, 0xC2, 0x3D,
+  0x49, 0x27, 0xD6, 0x89, 0x64, 0x84, 0x2D, 0x2F, 0x42, 0x3D, 0x8E, 0x47, 0x28, 0x80, 0xCA, 0x76,
+  0x1B, 0x47, 0xD7, 0xB6, 0x6D, 0xD9, 0xFF, 0x3A, 0x7A, 0x8A, 0x85, 0x9E, 0x1E, 0xFD, 0x76, 0x2E,
+  0x1D, 0x3D, 0x0D, 0x87, 0xAA, 0xBB, 0x78, 0x4C, 0x61, 0x88, 0xCD, 0x05, 0x11, 0x9B, 0x87, 0x10,
+  0x9B, 0xDF, 0x2F, 0x62, 0xE1, 0x4F, 0xC6, 0x56, 0x41, 0x2D, 0xFC, 0x89, 0xD6, 0x0C, 0xE4, 0x72,
+  0xEB, 0x73, 0xD0, 0x38, 0x5A, 0xF3, 0x24, 0xB4, 0xCA, 0xC0, 0xC4, 0xFA, 0x70, 0xF0, 0x1E, 0x62,
+  0xBF, 0xF9, 0xF1, 0xDD, 0x5B, 0xEC, 0x0B, 0x92, 0x21, 0xF3, 0x11, 0x8B, 0x67, 0x5B, 0x09, 0x14,
+  0x30, 0x39, 0x88, 0xF4, 0x4C, 0x91, 0x24, 0xE1, 0xE9, 0x91, 0xD4, 0xA0, 0x24, 0x31, 0x45, 0xC8,
+  0x31, 0x04, 0xDE, 0xB3, 0x88, 0xF9, 0x2E, 0xF6, 0x26, 0x9E, 0xF3, 0x06, 0xB5, 0x32, 0x6C, 0x01,
+  0x2B, 0x08, 0x81, 0xC8, 0x28, 0xEF, 0x38, 0x4C, 0xA8, 0xD3, 0xAB, 0xDD, 0x45, 0xA8, 0xBF, 0x3A,
+  0xA2, 0x41, 0xCD, 0x8B, 0xE9, 0x41, 0x6C, 0x73, 0x72, 0xB5, 0xC3, 0x23, 0xBF, 0x90, 0x82, 0xF8,
+  0xA7, 0x40, 0x12, 0x0C, 0x9C, 0xF7, 0x18, 0x05, 0xA8, 0x6C, 0x13, 0xA8, 0xD0, 0x9E, 0x46, 0x88,
+  0x06, 0xFD, 0x7C, 0x44, 0x0A, 0x85, 0xAD, 0x30, 0x85, 0x24, 0x1E, 0xBC, 0x3E, 0x4D, 0x88, 0x88,
+  0xF7, 0xAD, 0x81, 0x74, 0x3A, 0xDB, 0x22, 0x74, 0x92, 0xF8, 0xE1, 0x7D, 0xA8, 0x10, 0x19, 0xFE,
+  0x76, 0xFA, 0x54, 0x2A, 0xDB, 0x02, 0x54, 0x12, 0x75, 0xC3, 0xFB, 0x6C, 0x31, 0x99, 0xF8, 0x7B,
+  0xCC, 0xD3, 0xE9, 0x6C, 0x8B, 0xD0, 0x49, 0xE2, 0x87, 0xA7, 0x08, 0x99, 0x8E, 0xC1, 0x8A, 0x40,
+  0x65, 0x3E, 0x2D, 0xFD, 0x5C, 0x39, 0xEF, 0x04, 0x14, 0x78, 0x46, 0x91, 0x45, 0x81, 0x17, 0x89,
+  0x53, 0xF0, 0xA2, 0xC3, 0x01, 0x72, 0xBB, 0x43, 0x44, 0x21, 0xC8, 0xD1, 0xC5, 0xA2, 0x10, 0xA4,
+  0xDD, 0x5E, 0xF8, 0xF1, 0xEB, 0xA4, 0x84, 0x1F, 0x3A, 0xA1, 0xC1, 0xBE, 0x60, 0x9C, 0xA5, 0x7F,
+  0xFF, 0x83, 0xC0, 0x49, 0x20, 0x22, 0x0D, 0x48, 0xE7, 0x85, 0x2C, 0x89, 0x7F, 0xFB, 0x36, 0x66,
+  0x48, 0x74, 0xB2, 0x64, 0xEB, 0x88, 0x85, 0xAE, 0xAD, 0x93, 0x42, 0x81, 0x8E, 0x1D, 0xC4, 0x72,
+  0x33, 0xFE, 0xB1, 0xD8, 0x04, 0x22, 0x30, 0xE6, 0x10, 0x22, 0xC1, 0xBF, 0x98, 0x99, 0x24, 0x08,
+  0xFD, 0xA0, 0xA2, 0x90, 0x28, 0xDE, 0xC7, 0x13, 0x93, 0xF8, 0xA0, 0xC3, 0x9B, 0x2C, 0x50, 0xF8,
+  0x27, 0xEA, 0xD2, 0x10, 0x59, 0x89, 0x76, 0xB9, 0xDE, 0xE7, 0xD8, 0x12, 0xBA, 0xDD, 0x92, 0xA3,
+  0xC2, 0xC3, 0x74, 0xD1, 0xF3, 0x4F, 0xDE, 0x58, 0x9C, 0x18, 0x89, 0xA9, 0x28, 0x31, 0xDA, 0xAA,
+  0x0B, 0xC9, 0xD1, 0x64, 0xED, 0x12, 0xA7, 0x8D, 0xF3, 0x07, 0xBE, 0x72, 0x76, 0x6E, 0xB5, 0x4D,
+  0x60, 0x80, 0x12, 0x6C, 0x86, 0x63, 0x15, 0x0B, 0x1C, 0x3B, 0xB4, 0xD8, 0xE5, 0x34, 0x72, 0xEC,
+  0x6E, 0x0A, 0x45, 0x9E, 0xDE, 0x46, 0x6B, 0xE0, 0xC5, 0x34, 0x6A, 0x74, 0x8E, 0x28, 0x44, 0xAB,
+  0x3B, 0x18, 0xEC, 0x26, 0xB9, 0xBC, 0x01, 0xB6, 0xAC, 0x84, 0x0A, 0x69, 0xE3, 0x14, 0x7D, 0x30,
+  0xED, 0x35, 0x85, 0x51, 0xA8, 0x74, 0xE4, 0xAD, 0x29, 0x1D, 0x9D, 0xEF, 0xCC, 0x67, 0x40, 0x0D,
+  0x6E, 0x55, 0xD2, 0x73, 0xC6, 0xE3, 0x79, 0x30, 0x59, 0x22, 0x49, 0x13, 0x9B, 0xA8, 0x5F, 0x9E,
+  0x45, 0x88, 0xD1, 0xD9, 0x7F, 0x9F, 0x12, 0xBB, 0x86, 0x93, 0x82, 0xB1, 0x4B, 0xEC, 0x89, 0x9B,
+  0x96, 0x65, 0x92, 0xE4, 0x56, 0x23, 0xB3, 0x23, 0xBC, 0x21, 0x7E, 0xA6, 0x91, 0x99, 0xBA, 0x36,
+  0xDC, 0xA0, 0x9A, 0x4D, 0xDC, 0xB5, 0x6D, 0xF2, 0xD9, 0x92, 0xDD, 0xC1, 0x55, 0xE2, 0x34, 0x5D,
+  0x8D, 0xB6, 0x79, 0x72, 0x22, 0xBD, 0x70, 0x5D, 0x15, 0x00, 0xC0, 0x65, 0xD6, 0x05, 0xEA, 0x47,
+  0x52, 0xF9, 0x84, 0xAF, 0x65, 0xA3, 0x51, 0xE2, 0xFC, 0xB3, 0x0D, 0x52, 0x53, 0x6F, 0x74, 0xA0,
+  0x8A, 0xE7, 0xA4, 0x94, 0x54, 0xFB, 0xDF, 0x6B, 0x62, 0x6F, 0x3F, 0x52, 0x85, 0x59, 0xF6, 0x0B,
+  0xF0, 0xC5, 0xA3, 0x76, 0xB0, 0x54, 0x72, 0xC4, 0xE6, 0x37, 0xDB, 0x40, 0xEA, 0x1A, 0xDA, 0x00,
+  0x8C, 0x03, 0x9B, 0xF7, 0xE6, 0x81, 0x39, 0xEE, 0xD2, 0xE5, 0xE5, 0x25, 0x07, 0x23, 0x3E, 0xA1,
+  0x0A, 0x25, 0x2C, 0xF3, 0x0B, 0xD9, 0xAE, 0x57, 0xA0, 0xFE, 0x60, 0x8A, 0x34, 0x36, 0x69, 0xCB,
+  0xB5, 0x43, 0xDA, 0x50, 0xF2, 0x8A, 0x4F, 0x93, 0x29, 0xBD, 0x84, 0x42, 0x01, 0x04, 0xD4, 0x3A,
+  0xD1, 0x13, 0x9F, 0xED, 0x14, 0xBA, 0x7B, 0x94, 0x7C, 0x96, 0x30, 0xBD, 0xCC, 0x19, 0xE4, 0xCA,
+  0xF3, 0xBA, 0xAE, 0x58, 0x0B, 0xB1, 0xA9, 0xDF, 0xBB, 0xE6, 0xA3, 0x20, 0x32, 0xAC, 0x57, 0x9A,
+  0xEA, 0x92, 0x68, 0x70, 0xF0, 0x6D, 0xC1, 0xBB, 0xB9, 0xB4, 0x5C, 0x12, 0x8B, 0x18, 0xBA, 0xA9,
+  0xBB, 0xBA, 0x6A, 0x7C, 0x0A, 0xAC, 0x71, 0xAF, 0xEE, 0xDF, 0xA8, 0xE4, 0xFF, 0x3B, 0x33, 0xBC,
+  0x62, 0xB3, 0x92, 0x3B, 0x16, 0xE2, 0xC7, 0x83, 0xC0, 0x4A, 0xC2, 0x7A, 0x88, 0x84, 0x85, 0x47,
+  0x51, 0xCF, 0x7D, 0xFC, 0x98, 0x1E, 0x3D, 0xF2, 0x41, 0xF3, 0xA2, 0xC7, 0xA5, 0x14, 0xDC, 0x88,
+  0x01, 0xBC, 0x4B, 0x3B, 0x46, 0xC3, 0x23, 0x1E, 0xA2, 0xC0, 0x7C, 0xCB, 0x87, 0x77, 0x05, 0x43,
+  0x5D, 0xB4, 0x85, 0xFF, 0x8F, 0xFA, 0x0F, 0x28, 0xEA, 0xEF, 0x2F, 0xC4, 0x8B, 0xAF, 0x71, 0xB0,
+  0x7A, 0xC9, 0x8B, 0x2E, 0x4F, 0x8F, 0x8E, 0xA5, 0xE4, 0x55, 0x95, 0x58, 0x5A, 0xB1, 0xD0, 0x35,
+  0xC6, 0x72, 0x60, 0x57, 0xA8, 0x21, 0x5C, 0x18, 0xC5, 0xA5, 0x43, 0x5C, 0x47, 0x6C, 0x1C, 0xB1,
+  0x55, 0x5B, 0x1A, 0x8D, 0xEF, 0x82, 0x84, 0x64, 0x61, 0xDD, 0x66, 0xD5, 0xB4, 0x21, 0xE6, 0xDC,
+  0x90, 0x58, 0x65, 0xBF, 0xB6, 0xA6, 0x3B, 0xEA, 0xC4, 0xC8, 0x6F, 0x9A, 0x97, 0xD3, 0x78, 0x57,
+  0x00, 0x05, 0xBC, 0x2B, 0x50, 0xD5, 0xB5, 0xA9, 0xCF, 0x84, 0xC8, 0x12, 0x33, 0x8F, 0xAA, 0xC7,
+  0x56, 0x26, 0xE1, 0x99, 0x0A, 0x4E, 0x1C, 0xA5, 0xCC, 0x02, 0x69, 0x81, 0x10, 0x1B, 0xBE, 0x0C,
+  0x35, 0xA2, 0xA7, 0x97, 0x92, 0xB9, 0x36, 0x0C, 0xB0, 0x40, 0x14, 0x01, 0x2C, 0x30, 0x7C, 0x37,
+  0x31, 0x40, 0xFF, 0x79, 0xA3, 0x99, 0xCF, 0x79, 0x44, 0x03, 0x4F, 0x9E, 0x44, 0xA9, 0xE1, 0xF2,
+  0x2D, 0x4B, 0xCD, 0xFD, 0xD6, 0x58, 0x79, 0xF6, 0x36, 0xDD, 0xA0, 0x97, 0xE5, 0x2C, 0x41, 0x57,
+  0xFD, 0x38, 0xA2, 0xF8, 0x50, 0x86, 0x03, 0x8C, 0xE8, 0x1A, 0x55, 0x10, 0x6E, 0xD2, 0x90, 0x77,
+  0x56, 0xBA, 0x9E, 0x53, 0xAB, 0x6F, 0x10, 0xBE, 0x47, 0xA7, 0x09, 0xFA, 0x47, 0x63, 0x0E, 0x2E,
+  0x44, 0x67, 0x27, 0x63, 0x14, 0xE7, 0x11, 0x8A, 0x28, 0x58, 0x8C, 0x6F, 0xFC, 0xA1, 0x0D, 0x40,
+  0x51, 0xDC, 0x21, 0xD3, 0xCC, 0xEA, 0xFD, 0x69, 0xC3, 0xBB, 0x05, 0x33, 0x39, 0xB8, 0x9D, 0x7C,
+  0x9E, 0x43, 0xF1, 0x24, 0xC1, 0x28, 0xB9, 0xDB, 0x09, 0x8A, 0x44, 0x59, 0x80, 0xC3, 0x54, 0x52,
+  0x92, 0x0C, 0xC6, 0xFE, 0x59, 0xC7, 0x2D, 0x01, 0x8E, 0xEE, 0x6E, 0x77, 0xC9, 0x8D, 0xA5, 0x96,
+  0xE2, 0xD1, 0x84, 0xA2, 0xAF, 0x71, 0xDB, 0x8C, 0x4F, 0xD9, 0xBF, 0x10, 0x4D, 0x0D, 0x77, 0xD6,
+  0xA5, 0xC2, 0x28, 0xB2, 0x0E, 0xEC, 0x6B, 0x34, 0xA8, 0xDF, 0x67, 0x3C, 0x57, 0x30, 0x98, 0x27,
+  0x46, 0xDD, 0x8A, 0xA1, 0x3C, 0x83, 0x26, 0xDB, 0x8E, 0x12, 0x27, 0xBA, 0x9E, 0x2C, 0x75, 0x37,
+  0x81, 0xE0, 0x91, 0x72, 0x54, 0xA4, 0x57, 0x08, 0xFB, 0x10, 0x8B, 0x43, 0x34, 0x61, 0x06, 0x42,
+  0x91, 0x75, 0xB6, 0x29, 0xDB, 0x76, 0xF9, 0x1C, 0x06, 0xC5, 0xB8, 0x7A, 0x86, 0x00, 0xC7, 0x96,
+  0xAD, 0x1F, 0x85, 0x76, 0x5B, 0x50, 0x12, 0xD1, 0xFD, 0x16, 0xDE, 0x1E, 0x87, 0x68, 0x7E, 0x1D,
+  0x5E, 0xE6, 0xFF, 0xDD, 0x26, 0x50, 0xCF, 0xC1, 0x39, 0x3E, 0xE9, 0xDB, 0xAF, 0x94, 0xC4, 0x9D,
+  0x34, 0x03, 0x1F, 0x76, 0x16, 0x44, 0xA3, 0xF3, 0x51, 0xEE, 0xDA, 0x39, 0x97, 0x70, 0xA9, 0x3A,
+  0xB2, 0xBF, 0xE2, 0xEE, 0xF7, 0x66, 0x78, 0xB7, 0x02, 0x95, 0x25, 0x77, 0x08, 0x40, 0xB7, 0xE1,
+  0x64, 0x67, 0xFF, 0x2C, 0x69, 0x4E, 0x98, 0xEE, 0xF1, 0xDD, 0x0F, 0x4A, 0x40, 0xA6, 0x01, 0xCD,
+  0xFC, 0x00, 0x39, 0x45, 0xCC, 0x4C, 0x9B, 0x7C, 0xF0, 0x02, 0x08, 0x68, 0x5E, 0x20, 0x62, 0x18,
+  0xE1, 0x10, 0x85, 0xA9, 0x29, 0xA2, 0x61, 0x26, 0x0C, 0x97, 0x25, 0x7F, 0x8F, 0x0A, 0xEF, 0x9B,
+  0x7D, 0x5D, 0xFC, 0xE1, 0xC0, 0x90, 0xA3, 0xF9, 0x28, 0xB4, 0x69, 0x23, 0x4E, 0x03, 0x1B, 0x08,
+  0x11, 0x88, 0xA8, 0x28, 0x4D, 0x4D, 0xDC, 0x68, 0xA2, 0xA3, 0xA5, 0xCC, 0x11, 0x53, 0x10, 0x57,
+  0xBD, 0xA1, 0x05, 0x83, 0x8E, 0xFC, 0x8B, 0x1A, 0xCD, 0x6F, 0xC7, 0xAC, 0xEB, 0x0B, 0x45, 0xA2,
+  0x66, 0x11, 0x86, 0x76, 0x86, 0x6E, 0xB9, 0xCC, 0xDC, 0x5B, 0x12, 0x1B, 0x1A, 0xC3, 0x51, 0x7A,
+  0x90, 0x2A, 0xEE, 0x0C, 0xDE, 0xC2, 0x99, 0x56, 0xF2, 0x48, 0x2D, 0x3A, 0x96, 0x0A, 0xA9, 0x27,
+  0x31, 0xCB, 0x4A, 0x55, 0x17, 0xB3, 0x2F, 0xE6, 0xB0, 0x37, 0x3A, 0xB9, 0xCD, 0x9C, 0xCD, 0xA4,
+  0x3B, 0xA8, 0xA8, 0xBE, 0x82, 0x0A, 0x57, 0xFE, 0x8E, 0xB9, 0xDC, 0x9A, 0xC1, 0xEE, 0xBA, 0x10,
+  0x0D, 0xBA, 0x75, 0x4E, 0x6C, 0xC9, 0x93, 0x16, 0x8D, 0x54, 0x45, 0xAA, 0xF9, 0x75, 0xBD, 0xDD,
+  0xD4, 0x71, 0xF6, 0xA9, 0xEF, 0xE6, 0x57, 0x0F, 0xEF, 0xB4, 0x0B, 0xB7, 0xAE, 0xDE, 0x08, 0x54,
+  0x0E, 0xB6, 0x07, 0x86, 0xAA, 0x7A, 0x3D, 0x52, 0x56, 0x45, 0x28, 0xC3, 0xB6, 0x7F, 0x1E, 0x85,
+  0x10, 0x72, 0x5C, 0x6B, 0xF5, 0x91, 0x32, 0x12, 0x0B, 0x25, 0xB7, 0x74, 0xD2, 0xBD, 0x8D, 0xF7,
+  0x1B, 0x3C, 0xFD, 0x08, 0x6B, 0x27, 0xBA, 0x4E, 0xF9, 0x11, 0x67, 0xE4, 0x25, 0x46, 0xE7, 0x28,
+  0x36, 0x77, 0x87, 0xB7, 0x12, 0x5B, 0x40, 0xAC, 0xDB, 0x8E, 0x3D, 0x65, 0x01, 0xDD, 0xDF, 0x4C,
+  0x87, 0xF1, 0x06, 0x0F, 0x7F, 0x7F, 0xE4, 0xE7, 0x08, 0x11, 0xAB, 0x68, 0xE6, 0xF2, 0x62, 0xAD,
+  0xE2, 0xAC, 0x04, 0x53, 0x35, 0xCC, 0x43, 0x1D, 0x8C, 0xE4, 0xAC, 0xF3, 0xC2, 0x98, 0x17, 0xB2,
+  0x98, 0x94, 0xC0, 0x1A, 0xA8, 0x89, 0x47, 0xB2, 0x28, 0xF3, 0xA1, 0xDE, 0x88, 0xED, 0xC4, 0x7C,
+  0xFE, 0x79, 0x3A, 0x81, 0x0E, 0xE8, 0x15, 0xB8, 0x0F, 0xF8, 0xEB, 0x6D, 0xA3, 0x79, 0x97, 0x25,
+  0x0E, 0x53, 0x57, 0x60, 0x3B, 0xA2, 0x4C, 0xD0, 0x50, 0x9F, 0x4C, 0x2D, 0xA2, 0x9F, 0x64, 0x72,
+  0x61, 0x93, 0xBF, 0x36, 0xBD, 0xF4, 0x3F, 0x4D, 0xB1, 0x97, 0xBB, 0xAA, 0x65, 0x19, 0x60, 0x84,
+  0x40, 0x10, 0xC4, 0x77, 0x98, 0x8D, 0x25, 0x80, 0x21, 0xBB, 0xF0, 0x0A, 0xF8, 0xBC, 0xFB, 0x7E,
+  0x90, 0xB1, 0xAA, 0x31, 0x55, 0xCD, 0x1B, 0x35, 0xB2, 0xAA, 0x31, 0x05, 0x5A, 0x2E, 0xE1, 0x26,
+  0xDF, 0x90, 0x59, 0x01, 0x99, 0xDB, 0x2E, 0x3B, 0x6B, 0xD3, 0xE7, 0x43, 0x30, 0x49, 0x47, 0xF8,
+  0xE8, 0x49, 0xE4, 0xF6, 0x82, 0xD0, 0x77, 0xF2, 0xF1, 0xFB, 0xEC, 0x8C, 0x15, 0xF0, 0x5B, 0x99,
+  0x58, 0xDA, 0xB6, 0xAD, 0xAE, 0x56, 0xC4, 0xD4, 0xAE, 0x16, 0xBA, 0xA1, 0x35, 0x58, 0xD5, 0xD0,
+  0xD4, 0x3E, 0xC6, 0x24, 0x42, 0x77, 0x83, 0x71, 0xAA, 0xE0, 0x88, 0x57, 0xEC, 0x5A, 0xE3, 0xA8,
+  0xAB, 0x79, 0x9B, 0xF9, 0x78, 0xB1, 0xB6, 0x66, 0xAB, 0xB7, 0xDF, 0xE3, 0x56, 0x61, 0x8A, 0xE4,
+  0x71, 0xE7, 0xB8, 0xC3, 0x0B, 0xB8, 0x90, 0xEB, 0x7C, 0xF5, 0x47, 0x2E, 0x36, 0xDD, 0x52, 0xF9,
+  0xD3, 0x87, 0xB7, 0x01, 0x5D, 0xD7, 0x7A, 0xC5, 0x2E, 0x35, 0x8E, 0xE8, 0x5E, 0xE3, 0x93, 0x3F,
+  0x56, 0xB8, 0x85, 0xC3, 0x8B, 0xF1, 0x21, 0x35, 0xE2, 0x36, 0x62, 0x54, 0x15, 0x2B, 0xFE, 0x2C,
+  0x4C, 0x14, 0x2E, 0x9B, 0x10, 0xA4, 0xD1, 0x52, 0x1B, 0x49, 0x55, 0xBD, 0x4D, 0xC6, 0x58, 0x1D,
+  0x25, 0xF9, 0x0E, 0xC6, 0x6E, 0xBF, 0x12, 0xD5, 0x06, 0x3C, 0x9E, 0x4A, 0x0D, 0xB9, 0x23, 0x3F,
+  0x6D, 0xD0, 0xEB, 0xEF, 0x40, 0x9C, 0x45, 0xA3, 0xF9, 0x54, 0x69, 0x36, 0xDB, 0x0E, 0x60, 0x46,
+  0x1A, 0xAD, 0xAE, 0x57, 0x04, 0xFE, 0xD1, 0x32, 0xAC, 0x91, 0xF4, 0xFB, 0x6F, 0xAC, 0xB5, 0xED,
+  0x64, 0x15, 0x78, 0xA7, 0x9B, 0xD8, 0x0D, 0x66, 0x15, 0xF9, 0x48, 0x40, 0xB1, 0xDA, 0x4E, 0x11,
+  0x99, 0xEE, 0x8D, 0xF6, 0x86, 0x51, 0x74, 0xCB, 0x28, 0x64, 0xDC, 0xA1, 0x5C, 0x9B, 0xA7, 0x7B,
+  0x04, 0x27, 0x81, 0x1B, 0xDE, 0x4A, 0xCD, 0x5D, 0xD8, 0x38, 0x82, 0x84, 0x8A, 0x0F, 0xA4, 0x77,
+  0xF0, 0x8F, 0xC5, 0x1A, 0x9E, 0xA2, 0xEC, 0x4C, 0x0F, 0x8B, 0x64, 0x81, 0x89, 0xE9, 0x4D, 0x66,
+  0x3A, 0x18, 0x9D, 0x43, 0x8D, 0x0F, 0x20, 0xA3, 0xA9, 0xDF, 0xD5, 0x1A, 0xDC, 0x73, 0xE9, 0x05,
+  0x43, 0x76, 0x0D, 0x47, 0x61, 0x7E, 0xD4, 0x86, 0x51, 0x59, 0x56, 0x57, 0x02, 0xB7, 0x43, 0x9D,
+  0x0F, 0x1F, 0xC2, 0xE5, 0x54, 0xA0, 0xE3, 0x36, 0xBF, 0x03, 0x92, 0xB0, 0xD6, 0x2E, 0xDB, 0xE1,
+  0xE9, 0x03, 0xCE, 0x3C, 0x94, 0x6B, 0xFA, 0xC1, 0x06, 0x2B, 0xF1, 0x21, 0x4F, 0x80, 0xDD, 0xEE,
+  0x80, 0x33, 0x1E, 0x6B, 0x76, 0x06, 0x9A, 0x77, 0x21, 0xB4, 0xBC, 0xE7, 0x55, 0x02, 0x79, 0x48,
+  0xB6, 0xF0, 0x24, 0x2C, 0xBC, 0x37, 0x70, 0xCE, 0xA9, 0xF1, 0x99, 0x26, 0xD8, 0x61, 0xF1, 0x89,
+  0xA0, 0xF8, 0x84, 0x8B, 0x8F, 0x15, 0x82, 0xD1, 0x5E, 0xFE, 0x28, 0xDE, 0x37, 0xC6, 0x9F, 0x5F,
+  0x06, 0x92, 0xDD, 0x4E, 0x32, 0xF9, 0xE4, 0xA3, 0xEB, 0x90, 0x78, 0xD9, 0x15, 0xA0, 0xFC, 0x12,
+  0xFC, 0x21, 0x2C, 0xD6, 0xED, 0x44, 0x4C, 0x2C, 0x6F, 0x74, 0x8E, 0x15, 0x02, 0xB1, 0x92, 0xC7,
+  0xF0, 0x9E, 0x28, 0xAF, 0x88, 0xCB, 0x9F, 0x6A, 0x53, 0x4D, 0x4D, 0x9A, 0xD9, 0xEA, 0x92, 0xE0,
+  0x47, 0xCC, 0x7D, 0x66, 0xFD, 0x2B, 0x59, 0x3C, 0xFB, 0x85, 0x58, 0x1A, 0xE4, 0x9F, 0x0A, 0xB1,
+  0xED, 0x97, 0x0E, 0x4C, 0x32, 0x20, 0xE0, 0xCD, 0x1C, 0x0C, 0xE2, 0xF3, 0x38, 0x2C, 0xA1, 0xD6,
+  0x28, 0xF7, 0xB1, 0xB4, 0x39, 0x5C, 0xC0, 0x86, 0xD0, 0x35, 0x37, 0x81, 0x52, 0xA4, 0x0C, 0x33,
+  0x55, 0xE6, 0xBA, 0xFE, 0x43, 0x10, 0xFC, 0x91, 0x07, 0x76, 0x86, 0x5D, 0xD2, 0xF8, 0xD1, 0xC5,
+  0xC9, 0xC2, 0x5D, 0x1A, 0xE3, 0x47, 0xFF, 0x0B, 0x0C, 0x79, 0xF5, 0x60, 0xD6, 0x04, 0x01, 0x00,
+};
+
+// index_ov5640.html: 67777 bytes, 8645 gzipped
+static const uint8_t web_index_ov5640_gz[] = {
+  0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xED, 0x5D, 0xEB, 0x72, 0xDB, 0x46,
+  0xB2, 0xFE, 0xEF, 0xA7, 0x80, 0x91, 0xAC, 0x49, 0x96, 0x45, 0x0A, 0xE0, 0x4D, 0x94, 0x2C, 0xD1,
+  0xC7, 0x96, 0x15, 0x3B, 0xB5, 0x76, 0xD6, 0xB1, 0x1C, 0x27, 0xA9, 0x9C, 0x94, 0x03, 0x12, 0x43,
+  0x12, 0x31, 0x08, 0x70, 0x01, 0x50, 0x12, 0xD7, 0xA5, 0xE7, 0x38, 0x0F, 0x74, 0x5E, 0xEC, 0x74,
+  0xCF, 0x0C, 0x6E, 0x24, 0x2E, 0x03, 0x40, 0x84, 0x94, 0xDD, 0x63, 0x57, 0x89, 0xB8, 0xCC, 0xF4,
+  0x74, 0xF7, 0xD7, 0xDD, 0xD3, 0x73, 0x01, 0x70, 0xFA, 0x58, 0xB7, 0xA7, 0xDE, 0x66, 0x45, 0xA4,
+  0x85, 0xB7, 0x34, 0xC7, 0x8F, 0x4E, 0xD9, 0x8F, 0x04, 0xFF, 0x4E, 0x17, 0x44, 0xD3, 0xD9, 0x21,
+  0x3D, 0x5D, 0x12, 0x4F, 0x93, 0xA6, 0x0B, 0xCD, 0x71, 0x89, 0x77, 0x26, 0xAF, 0xBD, 0x59, 0x7B,
+  0x24, 0x6F, 0xDF, 0xB6, 0xB4, 0x25, 0x39, 0x93, 0xAF, 0x0C, 0x72, 0xBD, 0xB2, 0x1D, 0x4F, 0x96,
+  0xA6, 0xB6, 0xE5, 0x11, 0x0B, 0x8A, 0x5F, 0x1B, 0xBA, 0xB7, 0x38, 0xD3, 0xC9, 0x95, 0x31, 0x25,
+  0x6D, 0x7A, 0x72, 0x60, 0x58, 0x86, 0x67, 0x68, 0x66, 0xDB, 0x9D, 0x6A, 0x26, 0x39, 0x53, 0xA3,
+  0xB4, 0x3C, 0xC3, 0x33, 0xC9, 0xF8, 0xE2, 0xF2, 0x7D, 0xAF, 0x2B, 0xFD, 0xE3, 0xD3, 0x60, 0xD8,
+  0x57, 0x4E, 0x0F, 0xD9, 0xB5, 0xB0, 0x8C, 0xEB, 0x6D, 0xA2, 0xE7, 0xF8, 0x6F, 0x62, 0xEB, 0x1B,
+  0xE9, 0x6B, 0xEC, 0x12, 0xFE, 0x9B, 0x01, 0x13, 0xED, 0x99, 0xB6, 0x34, 0xCC, 0xCD, 0x89, 0xF4,
+  0xC2, 0x81, 0x36, 0x0F, 0xDE, 0x10, 0xF3, 0x8A, 0x78, 0xC6, 0x54, 0x3B, 0x70, 0x35, 0xCB, 0x6D,
+  0xBB, 0xC4, 0x31, 0x66, 0xCF, 0x76, 0x2A, 0x4E, 0xB4, 0xE9, 0x97, 0xB9, 0x63, 0xAF, 0x2D, 0xFD,
+  0x44, 0xFA, 0x46, 0x1D, 0xE1, 0xFF, 0xDD, 0x42, 0x53, 0xDB, 0xB4, 0x1D, 0xB8, 0x7F, 0xF1, 0x1D,
+  0xFE, 0x7F, 0x96, 0xDC, 0xBA, 0x6B, 0xFC, 0x8B, 0x9C, 0x48, 0xEA, 0x70, 0x75, 0x13, 0xBB, 0x7F,
+  0xFB, 0x28, 0x76, 0xBA, 0xE8, 0xA6, 0x71, 0xCF, 0xEB, 0x8F, 0xB2, 0xEB, 0xBB, 0x64, 0xEA, 0x19,
+  0xB6, 0xD5, 0x59, 0x6A, 0x86, 0x95, 0x40, 0x49, 0x37, 0xDC, 0x95, 0xA9, 0x81, 0x0E, 0x66, 0x26,
+  0xC9, 0xA4, 0xF3, 0xCD, 0x92, 0x58, 0xEB, 0x83, 0x1C, 0x6A, 0x48, 0xA4, 0xAD, 0x1B, 0x0E, 0x2B,
+  0x75, 0x82, 0x7A, 0x58, 0x2F, 0xAD, 0x5C, 0xB2, 0x59, 0x7C, 0x59, 0xB6, 0x45, 0x9E, 0x25, 0x37,
+  0x74, 0xED, 0x68, 0x2B, 0x2C, 0x80, 0xBF, 0xBB, 0x45, 0x96, 0x86, 0xC5, 0x8C, 0xEA, 0x44, 0xEA,
+  0xF5, 0x95, 0xD5, 0x4D, 0x0E, 0x94, 0xBD, 0x21, 0xFE, 0xDF, 0x2D, 0xB4, 0xD2, 0x74, 0xDD, 0xB0,
+  0xE6, 0x27, 0xD2, 0x28, 0x91, 0x84, 0xED, 0xE8, 0xC4, 0x69, 0x3B, 0x9A, 0x6E, 0xAC, 0xDD, 0x13,
+  0xA9, 0x9F, 0x54, 0x66, 0xA9, 0x39, 0x73, 0xE0, 0xC5, 0xB3, 0x81, 0xD9, 0xB6, 0xAA, 0x64, 0x14,
+  0x71, 0x8C, 0xF9, 0xC2, 0x03, 0x48, 0x77, 0xCA, 0x6C, 0x2B, 0x8D, 0xBB, 0x50, 0x1E, 0x9E, 0x99,
+  0x7A, 0x4B, 0xD6, 0x9A, 0x66, 0x1A, 0x73, 0xAB, 0x6D, 0x78, 0x64, 0x09, 0xE2, 0xB8, 0x9E, 0x43,
+  0xBC, 0xE9, 0x22, 0x8B, 0x95, 0x99, 0x31, 0x5F, 0x3B, 0x24, 0x81, 0x91, 0x40, 0x6F, 0x19, 0x02,
+  0xC3, 0xCD, 0xDD, 0x5B, 0xED, 0x6B, 0x32, 0xF9, 0x62, 0x78, 0x6D, 0xAE, 0x93, 0x09, 0x99, 0xD9,
+  0x0E, 0x49, 0x2C, 0xE9, 0x97, 0x30, 0xED, 0xE9, 0x97, 0xB6, 0xEB, 0x69, 0x8E, 0x27, 0x42, 0x50,
+  0x9B, 0x79, 0xC4, 0xC9, 0xA7, 0x47, 0xD0, 0x2A, 0xF2, 0xA9, 0xA5, 0x37, 0xCB, 0x0B, 0x18, 0x96,
+  0x69, 0x58, 0x44, 0x9C, 0xBD, 0xB4, 0x76, 0xE3, 0xE4, 0x58, 0x29, 0x01, 0x60, 0x8C, 0xE5, 0x3C,
+  0xCB, 0x4A, 0xA8, 0xAC, 0xBB, 0x8D, 0x71, 0xBF, 0x51, 0x15, 0xE5, 0x6F, 0xBB, 0x37, 0x17, 0x84,
+  0x99, 0xA9, 0xB6, 0xF6, 0xEC, 0xEA, 0x1E, 0x31, 0xCA, 0xB1, 0xF5, 0xFF, 0x5A, 0x12, 0xDD, 0xD0,
+  0xA4, 0x66, 0xC4, 0x9D, 0x47, 0x0A, 0xD8, 0x54, 0x4B, 0xD2, 0x2C, 0x5D, 0x6A, 0xDA, 0x8E, 0x01,
+  0x8E, 0xA0, 0xD1, 0x70, 0x63, 0xC2, 0x15, 0xE8, 0x38, 0x56, 0xA4, 0x95, 0x20, 0x72, 0x86, 0xCF,
+  0x44, 0x35, 0x92, 0xEC, 0x36, 0x82, 0x21, 0x47, 0xC8, 0x81, 0x12, 0x64, 0xCC, 0xC5, 0x4B, 0x04,
+  0x33, 0xA6, 0xD8, 0x9B, 0x76, 0x26, 0x76, 0x7E, 0x21, 0x1F, 0x43, 0xE8, 0x66, 0xA7, 0x4D, 0x28,
+  0x7A, 0xB5, 0x90, 0xDA, 0x12, 0x46, 0xC9, 0x56, 0x72, 0x1D, 0x4E, 0x34, 0x19, 0xF2, 0x6D, 0xA3,
+  0x28, 0x20, 0x6E, 0xB2, 0xA8, 0x61, 0xEC, 0x60, 0xFF, 0x57, 0x37, 0x69, 0x92, 0xA4, 0x46, 0x91,
+  0x62, 0x91, 0xA4, 0x40, 0x34, 0x29, 0x14, 0x51, 0x84, 0xA3, 0x4A, 0xA1, 0xC8, 0x52, 0x24, 0xBA,
+  0x14, 0x88, 0x30, 0x42, 0x51, 0x86, 0xC1, 0x99, 0x9F, 0x6F, 0x7C, 0x33, 0x59, 0x7B, 0x9E, 0x6D,
+  0xB9, 0x95, 0xBA, 0xA8, 0x34, 0x3F, 0xFB, 0x73, 0xED, 0x7A, 0xC6, 0x6C, 0xD3, 0xE6, 0x2E, 0x0D,
+  0x7E, 0xB6, 0xD2, 0x20, 0x85, 0x9C, 0x10, 0xEF, 0x9A, 0x90, 0xEC, 0x74, 0xC3, 0xD2, 0xAE, 0x20,
+  0xEE, 0xCC, 0xE7, 0x66, 0x92, 0xED, 0x4D, 0xD7, 0x8E, 0x8B, 0x79, 0xDB, 0xCA, 0x36, 0x80, 0xB0,
+  0xF3, 0x2C, 0x27, 0x6E, 0x0A, 0x36, 0xD4, 0x9E, 0x4E, 0x12, 0xDA, 0xB2, 0xD7, 0x1E, 0xEA, 0x38,
+  0x11, 0x09, 0x1B, 0xC4, 0x31, 0xBC, 0x4D, 0xE2, 0x3D, 0xEE, 0x89, 0x4A, 0x7A, 0x5C, 0x56, 0xC4,
+  0xF9, 0x3A, 0x99, 0x2E, 0xC8, 0xF4, 0x0B, 0xD1, 0x9F, 0xE6, 0xA6, 0x61, 0x79, 0xE9, 0x61, 0xC7,
+  0xB0, 0x56, 0x6B, 0xAF, 0x8D, 0xE9, 0xD4, 0x6A, 0x2F, 0x98, 0x53, 0x83, 0xF4, 0x45, 0xEC, 0x76,
+  0xB3, 0x92, 0x8A, 0xC1, 0xEA, 0x26, 0x5B, 0x09, 0x51, 0x66, 0xC7, 0xA6, 0x36, 0x21, 0x66, 0x16,
+  0xCB, 0xDC, 0x19, 0x52, 0xC2, 0x2E, 0x8F, 0x55, 0xE9, 0xB9, 0xDB, 0x56, 0x2E, 0xDA, 0x3F, 0xFA,
+  0x9B, 0xB0, 0x1E, 0xE9, 0xF1, 0x41, 0xEC, 0x92, 0x4B, 0x4C, 0x70, 0xB0, 0xAD, 0x6B, 0x2B, 0x2D,
+  0x35, 0x19, 0x87, 0x12, 0xD7, 0xC0, 0x55, 0x66, 0x93, 0x8E, 0x66, 0xCD, 0x09, 0x44, 0x87, 0x9B,
+  0x03, 0xFF, 0x30, 0x7B, 0xA8, 0x20, 0xA4, 0x10, 0x0C, 0xDE, 0x83, 0xEC, 0xA1, 0x09, 0x0B, 0x11,
+  0x07, 0x52, 0x87, 0x1D, 0x94, 0xC8, 0x53, 0x22, 0x88, 0x67, 0x32, 0xA2, 0x76, 0xD3, 0x93, 0xF7,
+  0x44, 0x5F, 0x8A, 0x5B, 0x5B, 0x62, 0xEA, 0x9F, 0x1B, 0x2C, 0xFC, 0x41, 0xE0, 0x6C, 0x96, 0x37,
+  0x8C, 0x9C, 0xCD, 0x7A, 0x4A, 0xAF, 0x9F, 0x9B, 0x4B, 0x25, 0x4A, 0xB9, 0x35, 0x94, 0x7C, 0x96,
+  0x11, 0x68, 0xF2, 0xB1, 0x38, 0x59, 0xD8, 0x57, 0xC4, 0x49, 0x00, 0x62, 0x8B, 0xDD, 0xFE, 0x71,
+  0x5F, 0x17, 0xA0, 0xA6, 0x41, 0x57, 0x70, 0x45, 0x72, 0xC9, 0x75, 0xD5, 0x69, 0x57, 0xCD, 0x27,
+  0xD7, 0x01, 0x6B, 0xD0, 0x26, 0x26, 0xD1, 0x33, 0x22, 0xB7, 0x4E, 0x66, 0xDA, 0xDA, 0xF4, 0x72,
+  0xF4, 0xAD, 0x29, 0xF8, 0x3F, 0xAB, 0x45, 0xEA, 0x5E, 0xBF, 0xE1, 0x1C, 0xC8, 0x19, 0x75, 0x89,
+  0xDF, 0x13, 0xDA, 0xF4, 0xBB, 0x55, 0x6D, 0xB5, 0x22, 0x1A, 0x94, 0x9A, 0x92, 0xB4, 0xD1, 0xAA,
+  0x50, 0x3A, 0x9D, 0x1C, 0xD3, 0x84, 0xC6, 0xA8, 0xB9, 0xA6, 0x18, 0x24, 0x4A, 0x85, 0x64, 0x3E,
+  0x99, 0xD9, 0xD3, 0xB5, 0x9B, 0xD9, 0x77, 0x15, 0xA3, 0x77, 0xE2, 0xAB, 0xCC, 0x35, 0x0D, 0x6A,
+  0xD8, 0x6B, 0xCB, 0x42, 0x44, 0xDB, 0x9E, 0x03, 0x62, 0x26, 0x34, 0x24, 0xA6, 0xB8, 0x52, 0xDE,
+  0x19, 0x53, 0x6C, 0xDA, 0x3C, 0xCD, 0x96, 0x03, 0x2A, 0x19, 0x31, 0x44, 0x72, 0x6D, 0x10, 0xCA,
+  0x27, 0x55, 0x4D, 0x2F, 0xDE, 0x62, 0xBD, 0x4C, 0xCA, 0x19, 0xFC, 0xC6, 0x54, 0xE8, 0xE0, 0x58,
+  0x73, 0xCE, 0x7C, 0xA2, 0x35, 0x95, 0x03, 0xE5, 0xA0, 0x07, 0x7F, 0x5A, 0x45, 0x8D, 0x8B, 0xAB,
+  0xB7, 0xDB, 0x15, 0x98, 0xDA, 0x18, 0xE4, 0x4F, 0xA1, 0xA4, 0x85, 0xB1, 0x5C, 0x2C, 0xC4, 0x3D,
+  0x29, 0x3E, 0x97, 0xA2, 0x76, 0x72, 0x7A, 0x98, 0x14, 0x93, 0x2E, 0x6E, 0x88, 0x09, 0xD6, 0x52,
+  0x14, 0xE2, 0xA5, 0xFD, 0xAF, 0x36, 0xEB, 0x5E, 0xFF, 0xE3, 0xAD, 0x3D, 0xA2, 0x8A, 0x7F, 0x6B,
+  0x4B, 0x2F, 0xAC, 0x17, 0xF7, 0xBE, 0x6D, 0x43, 0x49, 0x47, 0xBD, 0xCD, 0xF3, 0x19, 0xE0, 0xD0,
+  0x82, 0x8C, 0xD3, 0x81, 0x81, 0x57, 0x6A, 0xCE, 0x13, 0x29, 0x53, 0x42, 0x07, 0x33, 0xC3, 0x34,
+  0xDB, 0xA6, 0x7D, 0x9D, 0x9F, 0x89, 0x64, 0x5B, 0xF2, 0x8E, 0x9D, 0xE6, 0x9B, 0x7C, 0x59, 0x6E,
+  0xD7, 0x10, 0xB9, 0xFE, 0x12, 0xDC, 0xFE, 0xA7, 0x75, 0x2D, 0x11, 0xD7, 0x28, 0xD7, 0x51, 0x94,
+  0xB0, 0xC7, 0x6A, 0x0D, 0x09, 0x99, 0x12, 0xCB, 0x04, 0x33, 0x47, 0x75, 0xEE, 0xB5, 0xE1, 0x4D,
+  0x17, 0x25, 0x06, 0x55, 0x2B, 0xDB, 0x35, 0xD8, 0xF2, 0x8D, 0x43, 0x4C, 0x0D, 0x33, 0xF8, 0x52,
+  0xA3, 0xF1, 0xDC, 0x81, 0x49, 0xB4, 0xBA, 0x88, 0x24, 0x54, 0x75, 0x0F, 0x67, 0x26, 0xA5, 0xC3,
+  0x72, 0x87, 0xF4, 0x58, 0x9D, 0x6C, 0xD6, 0x39, 0xE9, 0x7E, 0xDC, 0x33, 0xBA, 0x55, 0x23, 0xBA,
+  0x1F, 0xB4, 0xE7, 0x0E, 0xD9, 0x08, 0x08, 0x73, 0xC0, 0x7F, 0x4F, 0xD8, 0x5C, 0x69, 0xF9, 0x49,
+  0x00, 0xDA, 0x01, 0x70, 0x2B, 0xEA, 0xF4, 0x5D, 0x81, 0xA6, 0xD3, 0x9B, 0x14, 0xB1, 0xC7, 0x60,
+  0x26, 0x50, 0x96, 0x05, 0xC2, 0x4D, 0x46, 0x17, 0x9A, 0x6C, 0xAA, 0x7E, 0xEF, 0x9B, 0x78, 0xD3,
+  0x24, 0x33, 0x2F, 0x65, 0xA1, 0x83, 0xE6, 0xA9, 0xBD, 0xEC, 0xE8, 0xD6, 0x8E, 0xCC, 0x13, 0xE4,
+  0x46, 0x8E, 0x60, 0xC2, 0x2E, 0xDD, 0xFA, 0x12, 0x29, 0x63, 0xF4, 0x2C, 0x4C, 0x3C, 0x1D, 0x12,
+  0x3F, 0x7D, 0xA6, 0x30, 0x43, 0x99, 0x25, 0xEF, 0xF2, 0x01, 0x1E, 0xF2, 0x4B, 0xB3, 0x3B, 0x4C,
+  0x5C, 0x47, 0xC8, 0x28, 0x9C, 0x3D, 0xA1, 0x8C, 0x33, 0x5E, 0x42, 0x5D, 0x56, 0xEA, 0x00, 0x39,
+  0x1A, 0x8B, 0xFA, 0xC5, 0xBD, 0x32, 0x2B, 0xC2, 0xEC, 0xCE, 0xD1, 0x64, 0x4F, 0xEF, 0x2D, 0x35,
+  0x48, 0x7B, 0xD1, 0x5C, 0x35, 0xA0, 0xE8, 0x94, 0x34, 0xF7, 0xC8, 0x7C, 0xA2, 0x3A, 0x54, 0x72,
+  0x9A, 0x9C, 0x9A, 0xB6, 0x9B, 0xED, 0x57, 0xDA, 0x04, 0xF4, 0xB7, 0xF6, 0x12, 0x1A, 0xE2, 0xB3,
+  0x9A, 0x83, 0x54, 0xE3, 0x1E, 0x94, 0xEE, 0xBA, 0x33, 0x7D, 0x2A, 0xDB, 0x1D, 0xB7, 0x74, 0xAE,
+  0x2A, 0x89, 0x91, 0x36, 0x73, 0xFE, 0xCD, 0x23, 0x37, 0x30, 0xDE, 0xC4, 0xB5, 0xBA, 0x13, 0x69,
+  0x4A, 0x92, 0xC3, 0x68, 0xAC, 0x93, 0x53, 0x45, 0x26, 0x01, 0x33, 0x71, 0x58, 0x18, 0xBA, 0x4E,
+  0xAC, 0xBC, 0xBD, 0x0E, 0xD9, 0xA1, 0x52, 0xBB, 0xAA, 0x88, 0x64, 0x37, 0x1D, 0x4A, 0xA5, 0x38,
+  0x10, 0x71, 0x0D, 0x0D, 0x73, 0x66, 0x61, 0x93, 0x43, 0x24, 0x02, 0xA1, 0x93, 0xA9, 0xED, 0xB0,
+  0x45, 0xDC, 0x94, 0x81, 0x7F, 0xB9, 0x91, 0x15, 0x12, 0xFF, 0xBD, 0xAE, 0xD0, 0x91, 0xB9, 0xD1,
+  0x41, 0xDD, 0x77, 0x5C, 0xE1, 0xDD, 0x71, 0xDA, 0x4C, 0x7A, 0x3C, 0x61, 0xCB, 0x64, 0xB5, 0x9B,
+  0x09, 0x23, 0xAA, 0x0C, 0xF4, 0x80, 0xA5, 0x76, 0x01, 0xDD, 0xE2, 0x8A, 0x2E, 0xAD, 0x74, 0xF8,
+  0x6A, 0x13, 0x5F, 0x18, 0x6C, 0xA7, 0xAD, 0xB7, 0xDC, 0xE1, 0xE2, 0x1B, 0xB5, 0x80, 0xED, 0x76,
+  0x53, 0x55, 0x73, 0x4F, 0xF9, 0x63, 0x06, 0x93, 0x41, 0x47, 0xEC, 0x6F, 0xB7, 0x8A, 0x97, 0x2A,
+  0x1B, 0x42, 0x4E, 0x0F, 0x23, 0xFB, 0xE3, 0x4E, 0x0F, 0xC3, 0xAD, 0x7C, 0xA7, 0xB8, 0x49, 0x2E,
+  0xBA, 0x8D, 0x8E, 0xB7, 0x33, 0x35, 0x35, 0xD7, 0x3D, 0x93, 0x71, 0xB3, 0x97, 0x1C, 0xDF, 0x55,
+  0x77, 0xAA, 0x1B, 0x57, 0x92, 0xA1, 0x9F, 0xC9, 0xA6, 0x3D, 0xB7, 0xB7, 0xEE, 0xD1, 0xFB, 0x0C,
+  0x65, 0xE8, 0xED, 0xCF, 0xE4, 0xD8, 0x8A, 0xA3, 0x4C, 0x6B, 0x85, 0x97, 0xE4, 0xF1, 0x93, 0x6F,
+  0x8E, 0x8F, 0x8E, 0x86, 0xCF, 0x9E, 0x58, 0x13, 0x77, 0xC5, 0xFF, 0x7E, 0x64, 0x0B, 0xB4, 0x2E,
+  0xF1, 0x3C, 0xB0, 0x39, 0xF7, 0xF4, 0x90, 0x52, 0xDB, 0xE2, 0xE0, 0x10, 0x58, 0x48, 0x61, 0x8A,
+  0x67, 0x83, 0x49, 0x7C, 0xF9, 0x45, 0x5C, 0x48, 0x70, 0x26, 0x9A, 0x93, 0x50, 0x84, 0x16, 0x63,
+  0x63, 0x0D, 0x1A, 0x43, 0x64, 0x0A, 0xC6, 0xC4, 0xBE, 0xD9, 0x66, 0x9D, 0x4A, 0xC3, 0x91, 0xE2,
+  0xA5, 0x88, 0x9E, 0x46, 0x10, 0xAA, 0xD1, 0xEA, 0xB8, 0xCE, 0x0A, 0x65, 0x12, 0x0B, 0xC5, 0x74,
+  0x8F, 0x85, 0x6F, 0xA6, 0xE6, 0x17, 0x1F, 0x74, 0xD9, 0x47, 0xC3, 0xB2, 0x3D, 0xD6, 0x93, 0xA4,
+  0x34, 0x15, 0x13, 0x95, 0xD7, 0x89, 0xAC, 0x16, 0x32, 0x29, 0x40, 0xB5, 0x6D, 0x4A, 0x9D, 0x5D,
+  0xCB, 0xA6, 0xB4, 0x0D, 0xA8, 0x5F, 0x59, 0x1E, 0xFF, 0x72, 0xFE, 0xF6, 0xEF, 0xD2, 0xBB, 0x37,
+  0xFF, 0x4A, 0x44, 0x28, 0x8F, 0x29, 0x0C, 0xCE, 0x02, 0x2D, 0x47, 0xF0, 0xF0, 0x75, 0x22, 0x73,
+  0x64, 0x28, 0x05, 0x4C, 0x86, 0x4C, 0x62, 0xCD, 0xBD, 0xC5, 0x99, 0xAC, 0xCA, 0xB8, 0xBB, 0xC5,
+  0x3F, 0xEB, 0xCA, 0x12, 0x06, 0x6E, 0x7A, 0x70, 0xA5, 0x99, 0x6B, 0x3C, 0x52, 0x44, 0x64, 0xDD,
+  0x35, 0xAD, 0xC4, 0x62, 0x3C, 0xA2, 0x04, 0x3A, 0x8E, 0x44, 0xE0, 0xB8, 0x96, 0xE5, 0xF1, 0x25,
+  0xF1, 0x4E, 0x0F, 0xD9, 0xAD, 0x1C, 0xD4, 0xB2, 0xDB, 0x06, 0x17, 0x66, 0xE6, 0x90, 0x65, 0x42,
+  0x59, 0xC0, 0xCF, 0x1C, 0x6D, 0x49, 0x50, 0x2B, 0x42, 0xC8, 0x47, 0x51, 0x0F, 0x6A, 0xCA, 0xE3,
+  0x0F, 0x84, 0x66, 0x19, 0xC0, 0x86, 0x10, 0xF0, 0xA7, 0x3C, 0x85, 0x8F, 0xB5, 0x1F, 0xD8, 0x33,
+  0x5F, 0xB2, 0x6B, 0x6B, 0xCC, 0xCC, 0x05, 0xF4, 0xFE, 0xB8, 0xDD, 0x96, 0x06, 0xEF, 0xDE, 0x4B,
+  0xED, 0xB6, 0x40, 0x61, 0x7B, 0x45, 0xDD, 0xC9, 0xC7, 0xBF, 0x27, 0xF3, 0x01, 0x05, 0xA1, 0xF8,
+  0xB0, 0x23, 0x79, 0xFC, 0xE3, 0xE5, 0x2F, 0xAF, 0x5F, 0x34, 0xBB, 0x83, 0xA1, 0x72, 0xA3, 0x1E,
+  0x77, 0x95, 0xD6, 0xE9, 0x21, 0xAB, 0x57, 0xBC, 0x81, 0xAE, 0x3C, 0x7E, 0x2F, 0x7D, 0xF7, 0xE6,
+  0x55, 0x53, 0x55, 0x46, 0x95, 0x89, 0xA9, 0xF2, 0xF8, 0xE7, 0x1F, 0x43, 0xCE, 0x86, 0x4A, 0x15,
+  0x62, 0x60, 0xFA, 0x3F, 0x02, 0x5F, 0x8C, 0x54, 0xBF, 0x5F, 0x88, 0x14, 0xAA, 0xBC, 0x57, 0x4E,
+  0xE5, 0xEA, 0x31, 0xB4, 0x4B, 0x65, 0x50, 0xFA, 0xA3, 0x1B, 0x75, 0x30, 0xEC, 0x97, 0x97, 0x41,
+  0x1D, 0xA1, 0x76, 0x81, 0x91, 0xE6, 0x68, 0xD8, 0xAF, 0x4A, 0xEB, 0x08, 0x69, 0x81, 0x42, 0x8E,
+  0xBA, 0xA0, 0x8F, 0xEE, 0xA8, 0x82, 0x6A, 0xD5, 0xA1, 0x3C, 0xA6, 0x90, 0x1F, 0x23, 0x29, 0x65,
+  0x54, 0x58, 0xB5, 0xDD, 0x92, 0xAA, 0x1D, 0xC8, 0xE3, 0x9F, 0x50, 0xB5, 0x68, 0x19, 0x20, 0x43,
+  0x15, 0xF3, 0x50, 0xFB, 0x10, 0xA5, 0x28, 0xAD, 0x2E, 0xDA, 0xAD, 0xD2, 0xAD, 0xA2, 0xDA, 0x9E,
+  0x3C, 0x46, 0x75, 0x20, 0xA5, 0xA3, 0x2A, 0x0E, 0xA0, 0x82, 0x37, 0x51, 0x9E, 0x80, 0x9D, 0x9B,
+  0xA3, 0xE1, 0xA8, 0x02, 0x25, 0x70, 0xA5, 0xCB, 0x4F, 0x40, 0x6A, 0x04, 0x9A, 0xAA, 0xE4, 0x47,
+  0x2A, 0xF8, 0x11, 0x12, 0x1A, 0xF6, 0x95, 0x9B, 0x7E, 0x15, 0xAB, 0x01, 0xBF, 0x78, 0x83, 0x84,
+  0x80, 0xC8, 0x4D, 0xAF, 0x8A, 0x96, 0xC0, 0x29, 0xCE, 0xBF, 0xFF, 0xAE, 0xD9, 0x07, 0xC9, 0xBA,
+  0xC7, 0xC3, 0xF2, 0x74, 0xC0, 0x21, 0x80, 0x0F, 0xE4, 0xA5, 0x34, 0x09, 0x70, 0x84, 0x1F, 0x51,
+  0x26, 0xA4, 0xD3, 0xED, 0x57, 0x90, 0x09, 0x2C, 0x1B, 0xEA, 0x23, 0x8D, 0xD2, 0x24, 0xC0, 0xA0,
+  0xDF, 0x50, 0x66, 0x90, 0x90, 0x7A, 0x54, 0x41, 0x31, 0x60, 0xCE, 0x3F, 0xA2, 0x86, 0x81, 0x08,
+  0x46, 0xCE, 0x0A, 0x31, 0x58, 0x1E, 0x83, 0x53, 0x60, 0xB4, 0x29, 0x6F, 0x7E, 0xC0, 0x0B, 0x95,
+  0x4A, 0x1D, 0x52, 0x97, 0x2F, 0xCF, 0x0C, 0xD8, 0xF1, 0xF1, 0xF0, 0xE6, 0x78, 0x28, 0x46, 0x00,
+  0x33, 0x0F, 0xEC, 0x2D, 0xB3, 0x72, 0x93, 0xEC, 0xD4, 0x25, 0x2B, 0x2D, 0xF9, 0xE7, 0x5A, 0x33,
+  0x61, 0x9C, 0x55, 0x38, 0x29, 0xE1, 0xF5, 0x40, 0x27, 0xEC, 0x40, 0x2C, 0x1F, 0x89, 0x70, 0x12,
+  0x6C, 0x78, 0x93, 0xC7, 0x7D, 0x81, 0xBC, 0x2F, 0x36, 0x30, 0xA0, 0x75, 0x63, 0xFC, 0xD3, 0x64,
+  0x14, 0x2D, 0x0F, 0xD3, 0x50, 0xF0, 0x86, 0x9E, 0x1C, 0x89, 0x1A, 0xA5, 0x12, 0x9E, 0x04, 0x5E,
+  0xB5, 0x1B, 0x79, 0x3C, 0xEC, 0xE5, 0x26, 0x8A, 0xE5, 0xC1, 0x98, 0xD0, 0xB9, 0x22, 0x8B, 0xB8,
+  0x6E, 0x61, 0x3C, 0xC2, 0xAA, 0xF2, 0xF8, 0x65, 0x70, 0x5C, 0x05, 0x95, 0x76, 0xAF, 0x02, 0x2C,
+  0x11, 0x76, 0x18, 0x32, 0xED, 0x1E, 0x87, 0x26, 0x44, 0xE6, 0x6E, 0x81, 0xD9, 0x27, 0x2E, 0x38,
+  0xAC, 0x75, 0x34, 0xD7, 0x2B, 0x8C, 0x8A, 0x5F, 0x11, 0xFA, 0x09, 0x7E, 0x74, 0x6F, 0x88, 0x04,
+  0xAC, 0xFC, 0x1B, 0xE0, 0xE1, 0x6A, 0xDE, 0x9A, 0xCD, 0x5A, 0x16, 0x46, 0x24, 0xAC, 0x0A, 0x69,
+  0x49, 0x70, 0x5C, 0x09, 0x95, 0x2A, 0xE1, 0x2B, 0xC2, 0x0E, 0xC7, 0xC5, 0x0F, 0x61, 0xFD, 0x3D,
+  0xE1, 0xD2, 0xDF, 0x27, 0x2E, 0x0B, 0xCD, 0x59, 0x95, 0x0A, 0x5F, 0x41, 0x4D, 0x40, 0xC5, 0x3F,
+  0xBC, 0x37, 0x57, 0x09, 0x99, 0xF9, 0x37, 0xF0, 0x15, 0x9D, 0x58, 0xB6, 0xE1, 0x16, 0x9F, 0x75,
+  0xE0, 0xF5, 0xE4, 0xF1, 0x2B, 0xD2, 0xFE, 0x01, 0x8F, 0xAA, 0xC0, 0xF1, 0x62, 0xED, 0xD9, 0x15,
+  0x00, 0xF1, 0x79, 0x61, 0x70, 0x28, 0x1C, 0x8D, 0xD1, 0x9E, 0xD0, 0x18, 0xED, 0x11, 0x0D, 0x8D,
+  0x7C, 0x36, 0xC9, 0x15, 0x31, 0x0B, 0xC3, 0xE1, 0x57, 0x94, 0xC7, 0x17, 0x37, 0x2B, 0xDB, 0xC5,
+  0x47, 0xB8, 0xDE, 0xE2, 0x79, 0x25, 0x27, 0x19, 0x54, 0xC0, 0x24, 0x60, 0x88, 0xFB, 0xC8, 0x80,
+  0xA3, 0x32, 0xD8, 0x13, 0x2A, 0x83, 0x3D, 0xA2, 0x32, 0xD7, 0x0C, 0x6B, 0x4A, 0x0C, 0x13, 0x1F,
+  0x27, 0x29, 0x0A, 0x4C, 0xA4, 0xAE, 0x3C, 0x7E, 0x1D, 0x9E, 0x54, 0x01, 0x46, 0xA9, 0x80, 0x4B,
+  0x94, 0x9F, 0xB8, 0xBF, 0x0C, 0x60, 0x28, 0xBE, 0x27, 0x6C, 0x54, 0x75, 0x9F, 0xBD, 0xCA, 0x8A,
+  0x4C, 0x0D, 0xCD, 0xFC, 0x4C, 0x66, 0x33, 0x18, 0x06, 0x15, 0xEF, 0x5A, 0x62, 0xD5, 0xA1, 0x7F,
+  0x61, 0xE7, 0xD2, 0x05, 0x3D, 0x2F, 0x3C, 0x8F, 0xBA, 0x45, 0xAE, 0xFC, 0x64, 0xEA, 0xF6, 0x98,
+  0x30, 0x71, 0x7A, 0xF4, 0x07, 0x3B, 0xE0, 0xB3, 0xFC, 0xB0, 0xF5, 0x07, 0x32, 0xA7, 0xDB, 0x19,
+  0xAA, 0x8C, 0x9E, 0x5F, 0x3B, 0xDA, 0x86, 0xBE, 0x1B, 0xA2, 0xCA, 0x58, 0xFE, 0x03, 0xD1, 0xA5,
+  0x8F, 0x86, 0xE5, 0x55, 0x99, 0x59, 0x78, 0xED, 0x10, 0x62, 0x55, 0xA3, 0x32, 0x80, 0x21, 0x12,
+  0x1C, 0x54, 0x23, 0x32, 0xC4, 0xB5, 0x85, 0x95, 0xA1, 0x3D, 0x84, 0x41, 0xBC, 0x76, 0x3D, 0x29,
+  0xDE, 0xA1, 0x5C, 0x4F, 0xA0, 0x5F, 0xFE, 0xF9, 0xA5, 0x74, 0x41, 0x37, 0xE0, 0x17, 0x0E, 0x57,
+  0x6C, 0x6F, 0xA0, 0x88, 0xA1, 0x87, 0x4B, 0x48, 0xD8, 0xE6, 0xCE, 0xDA, 0x5E, 0xB2, 0x03, 0x89,
+  0xAE, 0xEF, 0x25, 0x88, 0xE7, 0x33, 0x48, 0xB7, 0x52, 0xC9, 0x11, 0x69, 0xC5, 0x64, 0xDC, 0x63,
+  0x2A, 0x36, 0xBD, 0x2E, 0x9E, 0x86, 0x4D, 0xAF, 0x01, 0x26, 0xFD, 0x0A, 0x9F, 0xCD, 0xD0, 0x25,
+  0xC0, 0xAB, 0x16, 0xA0, 0xB0, 0xD5, 0xFB, 0x01, 0x8A, 0xCA, 0x7B, 0xDF, 0x40, 0x81, 0xB5, 0x7C,
+  0xC6, 0x7E, 0xB4, 0x8C, 0x53, 0xD1, 0x8A, 0xF2, 0xF8, 0x9D, 0x66, 0xAD, 0xA1, 0x93, 0xA9, 0x0B,
+  0xB0, 0xA0, 0xE1, 0x7B, 0x73, 0x2F, 0x2E, 0xF7, 0x7D, 0x43, 0x07, 0x8C, 0x2C, 0x6D, 0xBD, 0xF8,
+  0x70, 0x87, 0xD7, 0x63, 0x21, 0xF1, 0x1D, 0x1C, 0x15, 0x4E, 0x0C, 0x7C, 0x0A, 0x7B, 0xCE, 0x08,
+  0xD8, 0x50, 0xAA, 0x7C, 0x32, 0x70, 0xB9, 0xB6, 0xAC, 0x4D, 0x95, 0x4C, 0xE0, 0xDC, 0xB4, 0xD7,
+  0xFA, 0xA6, 0x4A, 0x1A, 0xF0, 0x8F, 0xD9, 0xCC, 0x98, 0x92, 0x4A, 0xCB, 0x0B, 0xF6, 0x92, 0x3C,
+  0x88, 0x8E, 0x97, 0x4C, 0x4B, 0x8C, 0xE4, 0xA6, 0x80, 0xE2, 0xC5, 0x79, 0xAD, 0x1D, 0x2F, 0xB4,
+  0x79, 0x4F, 0x91, 0x01, 0xA5, 0xBD, 0xF7, 0x78, 0x4E, 0xA6, 0x9F, 0xA9, 0xF1, 0x94, 0x01, 0x8B,
+  0xD5, 0x0C, 0x22, 0xBA, 0x3F, 0xFC, 0xBE, 0xAF, 0xF1, 0x5D, 0xC8, 0x51, 0x7C, 0x74, 0x87, 0x4B,
+  0xE0, 0xC1, 0xF0, 0xAE, 0xD7, 0xBD, 0xDB, 0x01, 0x1E, 0x12, 0xDF, 0x2F, 0x3E, 0xDD, 0x32, 0xD0,
+  0x40, 0x34, 0xFA, 0x01, 0xD7, 0x19, 0x0A, 0x04, 0xEC, 0xEA, 0x8E, 0xD4, 0xBD, 0x3F, 0x4F, 0xEA,
+  0x3E, 0x00, 0x57, 0x9A, 0x97, 0x88, 0x78, 0x73, 0x8C, 0x78, 0xAF, 0xCF, 0xEB, 0x41, 0x68, 0x7E,
+  0x6F, 0xA1, 0x6E, 0x7E, 0xAF, 0xA1, 0x4E, 0xE2, 0x9B, 0x13, 0x7D, 0x2D, 0x94, 0xCC, 0x60, 0x79,
+  0x45, 0x36, 0x97, 0x55, 0x25, 0xC8, 0xA9, 0x37, 0x55, 0xA2, 0x9C, 0xCF, 0x46, 0x3C, 0xC8, 0x0D,
+  0xC3, 0x55, 0x91, 0xC1, 0xDD, 0x2E, 0xEB, 0xF6, 0x6F, 0xF6, 0xE8, 0x34, 0x8E, 0x76, 0xFD, 0x79,
+  0xBE, 0xD4, 0x0A, 0x83, 0xC1, 0xEB, 0x01, 0x16, 0xEF, 0x5E, 0xD4, 0x99, 0x2E, 0xF8, 0xED, 0xDE,
+  0x8F, 0x1F, 0x05, 0x52, 0xDF, 0x77, 0xAC, 0x33, 0x89, 0x55, 0x3C, 0xD8, 0x61, 0x25, 0x79, 0xFC,
+  0x96, 0x58, 0xAE, 0x74, 0x6E, 0x3B, 0xFC, 0x85, 0x9C, 0xB5, 0xA0, 0x46, 0x5B, 0xBE, 0x1F, 0xC8,
+  0x98, 0xD0, 0xF7, 0x8D, 0xD7, 0x62, 0x69, 0x38, 0x8E, 0xED, 0x14, 0x86, 0x8C, 0xD7, 0x83, 0x61,
+  0x45, 0xFB, 0x1D, 0x3D, 0xAA, 0x05, 0x2E, 0xBF, 0xD5, 0xFB, 0x41, 0x2C, 0x90, 0xF9, 0xBE, 0x41,
+  0xBB, 0x9A, 0x99, 0xC6, 0xAA, 0x30, 0x64, 0xB4, 0x96, 0x3C, 0xFE, 0xD4, 0xFE, 0x0E, 0x7E, 0x6B,
+  0x81, 0x8B, 0xB5, 0x78, 0x3F, 0x60, 0x71, 0x69, 0xEF, 0x1B, 0xAA, 0xC9, 0xAA, 0x78, 0x38, 0x84,
+  0x3A, 0xF2, 0xF8, 0xE5, 0xFB, 0x7A, 0x72, 0x3F, 0x6C, 0x4C, 0x10, 0xA1, 0x4A, 0x78, 0x50, 0xA1,
+  0xEE, 0x7D, 0xA6, 0xAB, 0x04, 0x1A, 0xD7, 0xC8, 0xF8, 0xCF, 0x35, 0xA1, 0x71, 0xBD, 0xBA, 0xAF,
+  0xEE, 0xE8, 0xFA, 0x21, 0xE0, 0x43, 0x9F, 0x82, 0x9D, 0x68, 0x4E, 0x89, 0x4D, 0x63, 0xAC, 0x22,
+  0x6E, 0x1A, 0x83, 0x23, 0xE9, 0xA5, 0x56, 0x4F, 0x87, 0x14, 0xB4, 0x5B, 0x87, 0x0B, 0x85, 0x42,
+  0xD6, 0x81, 0x53, 0xF4, 0xD9, 0x2E, 0xFE, 0x7E, 0xD4, 0x3C, 0x40, 0xF8, 0x33, 0x46, 0x74, 0x49,
+  0x9D, 0x78, 0x6D, 0xD7, 0x33, 0x4C, 0x13, 0x12, 0x71, 0xE2, 0x49, 0x97, 0x78, 0x28, 0xF8, 0x50,
+  0x51, 0x84, 0x8A, 0xFF, 0x28, 0xA1, 0xE7, 0x10, 0x6D, 0x29, 0x8F, 0x2F, 0xF1, 0xCD, 0xB1, 0x40,
+  0x0B, 0xCF, 0xF2, 0x89, 0x09, 0x3F, 0x7E, 0x44, 0x1F, 0x34, 0xC4, 0x27, 0x07, 0xE3, 0x2F, 0x7A,
+  0x06, 0x35, 0xB3, 0x87, 0xAD, 0xC7, 0xA7, 0xF4, 0xA5, 0x95, 0xBC, 0x18, 0x7D, 0xC6, 0xF6, 0x9A,
+  0x3F, 0x34, 0x39, 0xB1, 0x4D, 0xFD, 0x59, 0x64, 0xB1, 0xE9, 0x32, 0x78, 0x0A, 0x10, 0xAB, 0x00,
+  0x4E, 0x3E, 0x85, 0x1C, 0x65, 0x2F, 0x1C, 0x9F, 0x3C, 0x7B, 0x50, 0x13, 0x5F, 0x9D, 0x94, 0xA1,
+  0xED, 0x94, 0x27, 0x16, 0x1D, 0x32, 0x0F, 0x0C, 0x2F, 0xE9, 0x41, 0xD6, 0xC4, 0xE7, 0x17, 0x3F,
+  0x90, 0xB9, 0xE1, 0x02, 0x8F, 0x12, 0xE0, 0x74, 0x48, 0x1F, 0xFD, 0x62, 0xB6, 0x25, 0xF6, 0x58,
+  0x61, 0xB4, 0x49, 0xFE, 0xCC, 0x78, 0xE2, 0x53, 0xA2, 0x85, 0xC2, 0xD5, 0xF6, 0x33, 0x9D, 0x71,
+  0x8A, 0x79, 0x56, 0xF8, 0xB8, 0xDD, 0x5E, 0xF4, 0xF1, 0x21, 0x36, 0xC9, 0x17, 0xED, 0xF4, 0x70,
+  0xD1, 0xCF, 0x7B, 0x62, 0x25, 0xF7, 0x09, 0x44, 0x90, 0xB4, 0xF4, 0x03, 0x88, 0xA8, 0xA5, 0x31,
+  0x70, 0x73, 0x20, 0xBD, 0xD3, 0xDC, 0x2F, 0x07, 0xD2, 0x27, 0x1C, 0x8F, 0xD7, 0xF8, 0x1C, 0x22,
+  0xF2, 0xAE, 0xE9, 0xBA, 0x93, 0xFA, 0x2C, 0x62, 0x3F, 0xF6, 0x2C, 0xE2, 0xD0, 0x7F, 0x16, 0x71,
+  0x18, 0x6E, 0x7E, 0xB9, 0xE9, 0x29, 0xCA, 0xE8, 0x0E, 0x9F, 0x47, 0xBC, 0x13, 0x99, 0x96, 0xA0,
+  0x4D, 0x41, 0x99, 0xFA, 0xBE, 0x4C, 0x91, 0x4D, 0xA2, 0x37, 0xB3, 0xD9, 0x43, 0x93, 0x88, 0x4F,
+  0x53, 0x97, 0x17, 0x49, 0xE9, 0xD6, 0xFD, 0xD0, 0x28, 0x35, 0xEE, 0xBB, 0x7A, 0x66, 0x34, 0x31,
+  0x1A, 0x0E, 0x32, 0x83, 0x61, 0xC4, 0xE9, 0x5F, 0xDF, 0xA5, 0xD3, 0xCF, 0x2B, 0x38, 0xFD, 0x7C,
+  0xC7, 0xE9, 0x6B, 0xF4, 0x76, 0x9F, 0xF1, 0x7F, 0x37, 0x8F, 0xF7, 0xE5, 0x2A, 0xE0, 0xF5, 0x89,
+  0x72, 0x29, 0xCA, 0x9D, 0xFA, 0x7D, 0xAE, 0x93, 0x04, 0xC6, 0xF0, 0xFA, 0x2E, 0x9D, 0x24, 0xC5,
+  0x74, 0x4B, 0xD9, 0x29, 0x0F, 0x3B, 0xE3, 0x7A, 0xFA, 0x25, 0x9A, 0x4D, 0x45, 0x01, 0xE5, 0xAD,
+  0xE3, 0x23, 0x62, 0xBD, 0x3E, 0x4F, 0x9D, 0xEE, 0x02, 0x1E, 0xF1, 0xE7, 0xD3, 0xF7, 0x9C, 0x98,
+  0xAD, 0x20, 0x0F, 0x2E, 0x9C, 0x98, 0xBD, 0x7F, 0xFB, 0xB6, 0x58, 0x2E, 0x16, 0x6D, 0xE5, 0x81,
+  0xE4, 0x62, 0x99, 0x53, 0x23, 0x9B, 0x15, 0xDC, 0x40, 0xAE, 0x4B, 0x99, 0x6E, 0x58, 0x5D, 0x1E,
+  0xBF, 0xA4, 0xC7, 0x52, 0x44, 0x63, 0x85, 0x8C, 0x57, 0x78, 0xE4, 0xB7, 0x3D, 0x77, 0x12, 0xB2,
+  0xB0, 0x8D, 0x8D, 0x20, 0xAD, 0x8C, 0xF9, 0x92, 0x88, 0x78, 0xE2, 0x42, 0x55, 0xF6, 0x09, 0xA1,
+  0x54, 0x78, 0xE5, 0x90, 0xD2, 0xB0, 0xF1, 0xBA, 0xF2, 0xF8, 0xBD, 0x43, 0xA4, 0x57, 0xC6, 0x95,
+  0xB8, 0x6C, 0x91, 0x7D, 0x43, 0x01, 0x11, 0x31, 0x2D, 0x6F, 0x6F, 0xE8, 0x49, 0xDC, 0x24, 0x84,
+  0x6B, 0x6F, 0xA2, 0xBB, 0x6B, 0x92, 0x77, 0xF9, 0x74, 0xAB, 0x51, 0xE8, 0xC9, 0xE3, 0x5E, 0x35,
+  0x0A, 0x7D, 0x79, 0xDC, 0xAF, 0x46, 0x61, 0x00, 0x7A, 0xE8, 0x0C, 0xAA, 0xD1, 0x18, 0xCA, 0xE3,
+  0x61, 0x35, 0x0A, 0x47, 0xA0, 0xCB, 0xAA, 0x5C, 0x40, 0xE6, 0x32, 0x2A, 0x40, 0x21, 0x7F, 0xCF,
+  0xD3, 0x5D, 0x39, 0xCF, 0x72, 0x6D, 0x96, 0x76, 0x1E, 0x5E, 0x57, 0x1E, 0xBF, 0x5B, 0x9B, 0x9E,
+  0xB1, 0x32, 0x0D, 0x18, 0xB6, 0x37, 0xFB, 0x52, 0x5B, 0xEA, 0x0E, 0xBA, 0xAD, 0x1A, 0x33, 0x4C,
+  0x9F, 0x0F, 0xB1, 0x57, 0xDB, 0xF4, 0xFC, 0x24, 0x4C, 0x1D, 0x45, 0x1F, 0x31, 0x7E, 0x10, 0xE1,
+  0xCC, 0xB1, 0x6D, 0xAF, 0x34, 0x1C, 0x7E, 0x65, 0x48, 0xF3, 0xE1, 0xA8, 0x74, 0x34, 0x0B, 0xC9,
+  0x94, 0x31, 0x74, 0x65, 0x2F, 0xE1, 0x4C, 0x2D, 0x16, 0xCE, 0xEA, 0x73, 0x1F, 0x77, 0x53, 0x3E,
+  0x65, 0xE0, 0x75, 0x61, 0xB4, 0xBA, 0x81, 0x11, 0xE2, 0x12, 0x01, 0x93, 0x9A, 0x0A, 0xB8, 0x8F,
+  0x3A, 0xA8, 0xD3, 0x7B, 0x7C, 0x36, 0x0A, 0xBE, 0x18, 0x2A, 0xEA, 0x3D, 0xF2, 0x83, 0xC9, 0x05,
+  0x00, 0x77, 0x7D, 0x50, 0x1E, 0x11, 0xBF, 0x36, 0xE4, 0x03, 0xF8, 0x7A, 0xAE, 0x4A, 0x7E, 0x14,
+  0x21, 0x56, 0xCE, 0x91, 0xAA, 0x3B, 0x4D, 0xA2, 0x2B, 0x76, 0x2B, 0x67, 0x16, 0xFD, 0xCA, 0x99,
+  0xC5, 0xC3, 0xEB, 0x0B, 0x57, 0xF8, 0x46, 0x37, 0x62, 0x95, 0x4B, 0x22, 0x59, 0x5D, 0x6E, 0x34,
+  0x6C, 0x97, 0x69, 0xAD, 0x99, 0xBF, 0xCF, 0xC0, 0xEE, 0xB2, 0x4F, 0xF1, 0x45, 0xB9, 0x9C, 0x81,
+  0x40, 0x20, 0xEB, 0x83, 0x1B, 0x05, 0x20, 0x63, 0xA5, 0x87, 0x01, 0xBC, 0x32, 0x87, 0x30, 0x88,
+  0xC4, 0x3D, 0xB5, 0x55, 0x6E, 0x44, 0x10, 0xD0, 0x2B, 0xD9, 0xDB, 0xDD, 0x7B, 0xFA, 0xDF, 0x4F,
+  0x0E, 0x1E, 0xFD, 0x5A, 0xD3, 0xE0, 0x24, 0xDD, 0x40, 0x3E, 0xAF, 0x0E, 0xEF, 0x25, 0x7C, 0x44,
+  0x56, 0x02, 0xA9, 0xC1, 0xD1, 0xAE, 0x9B, 0x78, 0x6C, 0x9C, 0x5F, 0x60, 0xF9, 0x6F, 0xCF, 0xB3,
+  0x3B, 0xD7, 0x86, 0x55, 0x7C, 0x76, 0xE7, 0x67, 0xC3, 0xD2, 0xED, 0xEB, 0x62, 0x13, 0x3C, 0xD1,
+  0x86, 0xFE, 0x02, 0x13, 0x3C, 0x34, 0x3D, 0xC0, 0x25, 0xDB, 0xB6, 0x43, 0xDC, 0x72, 0xE9, 0x01,
+  0xAD, 0x7D, 0x83, 0x0B, 0xAC, 0x40, 0xC2, 0x95, 0xE8, 0x02, 0xF0, 0xBE, 0x33, 0xB5, 0x5F, 0x4E,
+  0xA2, 0xB9, 0x1A, 0xE7, 0x40, 0x2C, 0x57, 0xEB, 0x27, 0x4C, 0x37, 0xDF, 0xFB, 0x0C, 0xFA, 0xAF,
+  0xBB, 0xF2, 0x6C, 0xEE, 0x5D, 0x9E, 0xBB, 0xE8, 0x80, 0x88, 0xA5, 0x97, 0xB6, 0x2C, 0xAC, 0x1B,
+  0xDA, 0xD5, 0x85, 0xA5, 0xD7, 0x6A, 0x55, 0xAC, 0xF5, 0xD2, 0x18, 0x74, 0x87, 0xDD, 0xDE, 0xC3,
+  0x32, 0x2B, 0x14, 0xA8, 0x82, 0x51, 0xA9, 0xC7, 0x83, 0x07, 0x34, 0xA4, 0xB1, 0x67, 0x33, 0xB6,
+  0xAE, 0x59, 0xCE, 0xB4, 0x78, 0xF5, 0x1B, 0xFA, 0xD0, 0x9E, 0x4B, 0xEA, 0x8D, 0x57, 0x41, 0xE3,
+  0x05, 0xA7, 0x66, 0x22, 0x58, 0x0C, 0x1F, 0x96, 0x69, 0x71, 0x89, 0x36, 0xE5, 0x25, 0xEA, 0x3F,
+  0x1C, 0xD3, 0xF2, 0x6C, 0x4F, 0x33, 0x4B, 0x5B, 0x16, 0xAB, 0x0D, 0x86, 0xF5, 0x11, 0x0F, 0xA4,
+  0x4B, 0x90, 0xB3, 0x56, 0xE3, 0xF2, 0xDB, 0x2F, 0x1F, 0xB8, 0x46, 0xFD, 0xFE, 0xC3, 0xB2, 0x2E,
+  0x26, 0x52, 0xA5, 0xD0, 0x35, 0x1C, 0x3D, 0xA0, 0xD0, 0xB5, 0xF6, 0xF0, 0x6A, 0xE9, 0xD0, 0xC5,
+  0xAA, 0x63, 0xE8, 0xA2, 0x47, 0xF5, 0x9B, 0x58, 0xC0, 0x41, 0x79, 0x1B, 0x1B, 0x1C, 0x77, 0x1F,
+  0x58, 0x04, 0x63, 0x32, 0x55, 0x32, 0xB2, 0xFE, 0x43, 0x09, 0x62, 0x53, 0x4D, 0xF8, 0x95, 0x4F,
+  0x3B, 0xD9, 0x3C, 0xAB, 0x0B, 0x63, 0x38, 0x76, 0x50, 0xEB, 0x8C, 0x8D, 0xDF, 0xF8, 0x9D, 0x2F,
+  0xD4, 0x06, 0x52, 0x3D, 0xA4, 0xF9, 0x99, 0x89, 0x61, 0x59, 0x65, 0x61, 0xE2, 0x75, 0xE5, 0xF1,
+  0x4B, 0x76, 0x50, 0xEF, 0x92, 0x3A, 0x6F, 0xFC, 0xEE, 0xD7, 0xD3, 0x7D, 0xA9, 0xEA, 0x86, 0x69,
+  0x6B, 0x12, 0xC3, 0x09, 0x3E, 0x47, 0x20, 0xF3, 0x3D, 0xAA, 0xE1, 0xE7, 0x09, 0x1E, 0xCE, 0x94,
+  0xC6, 0x5C, 0x5B, 0xE2, 0xB3, 0x8C, 0x45, 0x27, 0x35, 0x5E, 0x63, 0xB5, 0x62, 0x73, 0x1A, 0xF1,
+  0x96, 0x1E, 0xF6, 0xAC, 0xC6, 0x38, 0xFE, 0x12, 0x3B, 0x60, 0xBC, 0x3D, 0x31, 0x34, 0x17, 0x9F,
+  0xFB, 0x85, 0x63, 0xE9, 0x25, 0x1C, 0x4B, 0xEF, 0xCD, 0x75, 0xF0, 0x16, 0xCE, 0x24, 0x87, 0x88,
+  0xEE, 0x67, 0x0B, 0x29, 0xA4, 0x3D, 0x3E, 0x40, 0xB7, 0xF1, 0xF1, 0xE7, 0x3D, 0xE0, 0x18, 0x77,
+  0xAF, 0x0D, 0xFA, 0x23, 0x45, 0x96, 0x58, 0x56, 0xCC, 0x9F, 0xF2, 0x75, 0xBF, 0xD0, 0x6D, 0x6D,
+  0x6A, 0xC0, 0x60, 0x92, 0x03, 0x44, 0xF9, 0x0D, 0x18, 0xA4, 0xF6, 0x5B, 0x65, 0xB7, 0xD9, 0xAE,
+  0x46, 0x54, 0x5F, 0x1D, 0x4A, 0xA2, 0x21, 0xC4, 0x5E, 0xBB, 0xC7, 0xCA, 0xC7, 0x9F, 0x57, 0xEE,
+  0x0E, 0x92, 0x5E, 0x87, 0x98, 0xAC, 0x08, 0x35, 0x51, 0x11, 0xB8, 0xBB, 0xEF, 0x6E, 0x65, 0xEA,
+  0xFA, 0x32, 0xA9, 0x62, 0x32, 0x75, 0x2B, 0xC8, 0xD4, 0xAD, 0x49, 0xA6, 0x9E, 0x2F, 0x53, 0x57,
+  0x4C, 0xA6, 0x5E, 0x05, 0x99, 0x7A, 0x35, 0xC9, 0xD4, 0xF7, 0x65, 0xEA, 0x89, 0xC9, 0xD4, 0xAF,
+  0x20, 0x53, 0xBF, 0x26, 0x99, 0x06, 0xBE, 0x4C, 0x7D, 0x31, 0x99, 0x06, 0x15, 0x64, 0x1A, 0xD4,
+  0x24, 0xD3, 0xD0, 0x97, 0x69, 0x20, 0x26, 0xD3, 0xB0, 0x82, 0x4C, 0xC3, 0x9A, 0x64, 0x3A, 0xF2,
+  0x65, 0x1A, 0x8A, 0xC9, 0x74, 0x54, 0x41, 0xA6, 0xA3, 0x9A, 0x64, 0x1A, 0xF9, 0x32, 0x1D, 0x89,
+  0xC9, 0x34, 0xAA, 0x20, 0xD3, 0xA8, 0x26, 0x99, 0x8E, 0x7D, 0x99, 0x46, 0x62, 0x32, 0x1D, 0x57,
+  0x90, 0xE9, 0xB8, 0x26, 0x99, 0x70, 0x37, 0x15, 0x13, 0xEA, 0x58, 0xB0, 0xD3, 0x55, 0x2A, 0x48,
+  0xA5, 0xD5, 0x25, 0x55, 0x90, 0x4A, 0xA8, 0xA2, 0xB9, 0x44, 0x95, 0x64, 0x62, 0x52, 0x97, 0x58,
+  0x61, 0x36, 0x21, 0x98, 0x4E, 0xA8, 0x55, 0xF2, 0x89, 0x69, 0x5D, 0x62, 0x05, 0x09, 0x85, 0x2A,
+  0x98, 0x51, 0xA8, 0x55, 0x52, 0x0A, 0xBD, 0x2E, 0xB1, 0x82, 0x9C, 0x42, 0x15, 0x4C, 0x2A, 0xD4,
+  0x2A, 0x59, 0x05, 0xA9, 0x4B, 0xAC, 0x20, 0xAD, 0x50, 0x05, 0xF3, 0x0A, 0xB5, 0x4A, 0x62, 0x31,
+  0xAB, 0x4B, 0xAC, 0x20, 0xB3, 0x50, 0x05, 0x53, 0x0B, 0xB5, 0x42, 0x6E, 0x71, 0xAC, 0xEC, 0x5F,
+  0x2C, 0xE2, 0xF1, 0x21, 0x72, 0x38, 0x68, 0x13, 0x7A, 0xE0, 0x88, 0x57, 0xC2, 0x27, 0xE2, 0x98,
+  0x42, 0xCE, 0x6D, 0x6B, 0x66, 0xCC, 0x83, 0x49, 0x86, 0x07, 0xF3, 0x6C, 0x8C, 0x1B, 0x79, 0xFF,
+  0xA7, 0xF0, 0x44, 0xC3, 0xE5, 0xAB, 0x8B, 0x62, 0xD3, 0x0C, 0xD1, 0x56, 0xFE, 0x42, 0x93, 0x0C,
+  0xC0, 0x76, 0x37, 0xFA, 0x32, 0x72, 0xA1, 0x79, 0x05, 0x5A, 0xA9, 0xC8, 0x8C, 0xC2, 0x20, 0x3A,
+  0xA3, 0x30, 0x14, 0x9E, 0x51, 0x60, 0xCC, 0xED, 0x67, 0x2E, 0x01, 0x68, 0xF7, 0xD8, 0x1B, 0xD4,
+  0xC5, 0x85, 0xEE, 0x95, 0x17, 0x7A, 0x50, 0x44, 0xE8, 0x5E, 0x19, 0xA1, 0x4B, 0x3C, 0xD3, 0x2A,
+  0xA8, 0x27, 0xE0, 0xF7, 0x3B, 0xE3, 0x86, 0xE8, 0xD2, 0xAF, 0xE2, 0xAA, 0x52, 0xCB, 0xAB, 0xEA,
+  0xA8, 0x88, 0xAA, 0xD4, 0x3D, 0xDA, 0xC7, 0xC0, 0x97, 0xFB, 0x27, 0x71, 0xB9, 0x07, 0xE5, 0xE5,
+  0xEE, 0x15, 0x91, 0x7B, 0xB0, 0x47, 0xB9, 0xFB, 0xBE, 0xDC, 0x9F, 0xC4, 0xE5, 0xEE, 0x97, 0x97,
+  0xBB, 0x5F, 0x44, 0xEE, 0xFE, 0x1E, 0xE5, 0xC6, 0xAF, 0xD5, 0xFE, 0xF4, 0x49, 0xFA, 0xB8, 0x70,
+  0x88, 0xBB, 0xC8, 0x9F, 0x89, 0x63, 0x35, 0xCA, 0xF6, 0xED, 0x83, 0x1A, 0xC6, 0x6E, 0xC8, 0x61,
+  0x2F, 0x2A, 0x53, 0x57, 0x44, 0xA6, 0x9E, 0xD0, 0x27, 0x4A, 0x92, 0x65, 0x4A, 0x1E, 0xB9, 0xA9,
+  0xA2, 0x42, 0xED, 0x2F, 0x86, 0x8D, 0xE4, 0xF1, 0x9B, 0x75, 0x81, 0xFE, 0x6D, 0x54, 0xDE, 0x9E,
+  0x95, 0x22, 0xF6, 0x3C, 0xDA, 0xA3, 0x3D, 0x1F, 0x53, 0x99, 0x21, 0x2F, 0x73, 0x05, 0x60, 0x3F,
+  0xAE, 0x60, 0xC9, 0x6A, 0x1D, 0x96, 0x8C, 0x5F, 0x28, 0x46, 0x71, 0x7E, 0x42, 0x81, 0x24, 0xC8,
+  0x58, 0x0A, 0x74, 0x46, 0x47, 0x05, 0xD1, 0x1C, 0x95, 0x8C, 0x4E, 0xC8, 0xE3, 0xDE, 0xE0, 0xC4,
+  0xA1, 0x07, 0x2A, 0xE0, 0x53, 0x09, 0x05, 0x0C, 0xCB, 0x2B, 0xA0, 0x50, 0xE6, 0x82, 0x3C, 0xEE,
+  0x4F, 0x01, 0x0A, 0x53, 0xC0, 0x65, 0xF8, 0x0E, 0xDC, 0x0C, 0x83, 0xAE, 0x30, 0x03, 0x35, 0xA8,
+  0x61, 0x8D, 0x04, 0x23, 0xAD, 0xEA, 0x5B, 0x34, 0x48, 0x54, 0x0C, 0xD0, 0xAE, 0x5A, 0x1E, 0xD0,
+  0x42, 0xF1, 0xA9, 0xBB, 0xCF, 0x04, 0xAB, 0xAB, 0xF8, 0x16, 0x5D, 0x5C, 0x01, 0x4A, 0x79, 0x05,
+  0xA8, 0x85, 0x14, 0xA0, 0x3C, 0xAC, 0x64, 0x7C, 0xB8, 0xFB, 0xD9, 0xD2, 0x7C, 0x6D, 0x0D, 0xCB,
+  0xF7, 0x66, 0xDD, 0x22, 0xCA, 0xDA, 0xAB, 0xF7, 0xF7, 0x42, 0xC9, 0xA5, 0x5F, 0xA5, 0xF8, 0xD6,
+  0xD7, 0xAC, 0x38, 0xD0, 0xAB, 0x10, 0x07, 0x06, 0xB5, 0xF4, 0x6C, 0xC7, 0x09, 0x92, 0x15, 0x0C,
+  0xF0, 0xC7, 0xE5, 0xDD, 0xA1, 0x10, 0xC2, 0xC8, 0xEB, 0xFE, 0x20, 0x1E, 0xC4, 0x14, 0xC1, 0x3E,
+  0x99, 0x2C, 0x02, 0xF1, 0xA0, 0x02, 0xC4, 0x47, 0xB5, 0x40, 0x3C, 0x4A, 0x90, 0xAC, 0x20, 0xC4,
+  0xA3, 0xF2, 0x10, 0x17, 0x1A, 0x5A, 0xAA, 0xFB, 0xCC, 0x49, 0x71, 0xB6, 0x3B, 0xA2, 0x88, 0xE8,
+  0xFB, 0xEC, 0xB3, 0x00, 0xEE, 0x57, 0x00, 0xB8, 0xDA, 0xFA, 0xEC, 0xFE, 0x22, 0xF9, 0x51, 0xD2,
+  0xC7, 0x8E, 0xF3, 0xED, 0xE0, 0xA8, 0x7C, 0x2C, 0x2F, 0xD4, 0xF1, 0xED, 0x35, 0x95, 0x85, 0xD6,
+  0x21, 0xEB, 0xD9, 0x95, 0x3E, 0xC3, 0x04, 0xD4, 0x0A, 0x26, 0xD0, 0xAB, 0xC5, 0xC7, 0xBB, 0xF2,
+  0xF8, 0x53, 0x41, 0xA1, 0xAA, 0xCC, 0x1F, 0x94, 0xDE, 0x1F, 0x52, 0xDF, 0xD4, 0xFB, 0x74, 0x79,
+  0x53, 0x7C, 0xEA, 0xFD, 0xFC, 0xDD, 0x2F, 0xC5, 0xA6, 0xDE, 0xA3, 0xAD, 0xD4, 0x37, 0xF5, 0x5E,
+  0xC3, 0xCB, 0xD3, 0x40, 0x30, 0x7C, 0x15, 0xD2, 0xD4, 0x70, 0x69, 0x93, 0xA0, 0x18, 0xE9, 0xBD,
+  0x7F, 0x1A, 0xA8, 0x28, 0xF2, 0x8C, 0x72, 0xBC, 0x7C, 0x96, 0xF5, 0xF4, 0x32, 0xC2, 0x42, 0xD9,
+  0xB7, 0x79, 0x74, 0x86, 0xFC, 0x93, 0x3F, 0x15, 0x9E, 0x05, 0x4E, 0x7B, 0xD7, 0x48, 0xE7, 0xA8,
+  0x20, 0xED, 0xBD, 0xBF, 0x62, 0x60, 0xBC, 0x05, 0x94, 0x4A, 0xF1, 0x51, 0xF1, 0x5C, 0x78, 0x9E,
+  0x9C, 0x56, 0x2B, 0x12, 0xCD, 0x7B, 0xD1, 0xA9, 0x16, 0xF1, 0x68, 0xCE, 0xD8, 0xDB, 0x4F, 0x34,
+  0x47, 0xDA, 0x31, 0xD9, 0x0B, 0x64, 0x35, 0xAC, 0x6E, 0x31, 0x05, 0x4C, 0xCA, 0x0C, 0x64, 0x39,
+  0x93, 0x89, 0x1A, 0xB8, 0x13, 0x15, 0x74, 0xA9, 0x06, 0xBA, 0x5B, 0xE8, 0xA7, 0x04, 0x7E, 0x5A,
+  0xBE, 0x6C, 0xDC, 0xEF, 0xD5, 0x30, 0x37, 0x81, 0xEA, 0x8A, 0x49, 0x54, 0x10, 0xD3, 0x6E, 0x79,
+  0x4C, 0x8B, 0x19, 0x75, 0x77, 0x8F, 0x56, 0xDD, 0xA3, 0x0A, 0xE8, 0x09, 0x43, 0xDA, 0xAB, 0x00,
+  0x69, 0xAF, 0x16, 0x48, 0x63, 0x12, 0x15, 0x84, 0xB4, 0x57, 0x1E, 0xD2, 0x6E, 0x21, 0x48, 0x7B,
+  0x7B, 0x84, 0xB4, 0x4F, 0x15, 0xD0, 0x17, 0x86, 0xB4, 0x5F, 0x01, 0xD2, 0x7E, 0x2D, 0x90, 0xC6,
+  0x24, 0x2A, 0x08, 0x69, 0xBF, 0x3C, 0xA4, 0xBD, 0x42, 0x90, 0xF6, 0xF7, 0x08, 0xE9, 0x80, 0x2A,
+  0x60, 0x20, 0x0C, 0xE9, 0xA0, 0x02, 0xA4, 0x83, 0x5A, 0x20, 0x8D, 0x49, 0x54, 0x10, 0xD2, 0x41,
+  0x79, 0x48, 0xFB, 0x85, 0x20, 0x1D, 0xEC, 0x11, 0xD2, 0x21, 0x55, 0xC0, 0x50, 0x18, 0xD2, 0x61,
+  0x05, 0x48, 0x87, 0xB5, 0x40, 0x1A, 0x93, 0xA8, 0x20, 0xA4, 0xC3, 0xF2, 0x90, 0x0E, 0x0A, 0x41,
+  0x3A, 0xDC, 0x23, 0xA4, 0x47, 0x54, 0x01, 0x47, 0xC2, 0x90, 0x1E, 0x55, 0x80, 0xF4, 0xA8, 0x16,
+  0x48, 0x63, 0x12, 0x15, 0x84, 0xF4, 0xA8, 0x3C, 0xA4, 0xC3, 0x42, 0x90, 0x1E, 0xED, 0x11, 0xD2,
+  0x11, 0x55, 0xC0, 0x48, 0x18, 0xD2, 0x51, 0x05, 0x48, 0x47, 0xB5, 0x40, 0x1A, 0x93, 0xA8, 0x20,
+  0xA4, 0xA3, 0xF2, 0x90, 0x1E, 0x15, 0x82, 0x74, 0xB4, 0x47, 0x48, 0x8F, 0xA9, 0x02, 0x8E, 0x85,
+  0x21, 0x3D, 0xAE, 0x00, 0xE9, 0x71, 0x2D, 0x90, 0x2A, 0x51, 0x89, 0x0A, 0x42, 0xAA, 0x14, 0x84,
+  0x54, 0x2B, 0x3B, 0x30, 0x55, 0x8A, 0x0E, 0x4C, 0xEB, 0x9B, 0xBF, 0xD3, 0xAE, 0x27, 0x25, 0x3E,
+  0xF8, 0xF3, 0xE2, 0xE7, 0x97, 0xE9, 0x13, 0xFB, 0xA9, 0xB3, 0x78, 0xB1, 0xB6, 0x1E, 0xFA, 0x34,
+  0x5E, 0xEC, 0xEB, 0xBC, 0xC0, 0xB8, 0x1A, 0x7C, 0x8A, 0x7C, 0x47, 0xF8, 0x6C, 0x4B, 0x63, 0x95,
+  0x0B, 0x58, 0x5A, 0xAF, 0xAF, 0x0C, 0xCB, 0x58, 0x1A, 0xE7, 0x72, 0x3F, 0xC1, 0x03, 0x89, 0xC3,
+  0x58, 0x1C, 0x65, 0xFF, 0x20, 0xB4, 0xA6, 0xC3, 0x2A, 0xC4, 0xC3, 0x47, 0x5F, 0x39, 0x16, 0x8C,
+  0x1F, 0xA0, 0x83, 0xB4, 0x8D, 0xF1, 0x77, 0x18, 0x40, 0x90, 0xC7, 0x1E, 0x13, 0xEA, 0xB5, 0xB0,
+  0x50, 0xBD, 0x2A, 0x42, 0x75, 0xEB, 0x11, 0xAA, 0xCF, 0x84, 0x7A, 0x29, 0x2C, 0x54, 0xBF, 0x8A,
+  0x50, 0xFD, 0x5C, 0xA1, 0x1E, 0x42, 0xA0, 0x23, 0x53, 0xFA, 0x8D, 0xF2, 0xC2, 0xA1, 0xEE, 0xE2,
+  0xFC, 0xF0, 0xC5, 0xEB, 0x73, 0x89, 0x2E, 0x69, 0xDA, 0x66, 0xC1, 0x88, 0x17, 0x6F, 0xF4, 0x2F,
+  0x15, 0xF3, 0x28, 0xEB, 0x91, 0xA8, 0x17, 0x7E, 0x48, 0x3E, 0x2F, 0xE0, 0xF1, 0x9A, 0x45, 0x42,
+  0xDE, 0x40, 0xE9, 0x95, 0x99, 0x21, 0x0C, 0x98, 0xDC, 0x53, 0xD0, 0xA3, 0xE4, 0xBB, 0xA1, 0x0E,
+  0x2E, 0x8A, 0xE9, 0xA0, 0x5B, 0x5E, 0x07, 0x4A, 0x41, 0x1D, 0x74, 0xF7, 0xAB, 0x03, 0x8C, 0x92,
+  0x17, 0xE7, 0xD2, 0xFB, 0xBF, 0x4B, 0x17, 0x37, 0x2B, 0xDB, 0x5D, 0x3B, 0x24, 0x37, 0xAA, 0xF0,
+  0x7A, 0x5B, 0x5F, 0x92, 0x1F, 0x0C, 0x7A, 0xA2, 0x81, 0x65, 0x90, 0xDE, 0x05, 0xCC, 0x14, 0xF9,
+  0x8E, 0x05, 0xEC, 0x07, 0x02, 0x7E, 0x20, 0x80, 0xB4, 0x50, 0xDC, 0xE4, 0x15, 0xE3, 0x12, 0xAA,
+  0x0A, 0x6E, 0xAF, 0x16, 0x14, 0x30, 0x39, 0xA3, 0xEC, 0xDD, 0x69, 0x77, 0x40, 0xB9, 0x1C, 0x04,
+  0xE2, 0x7D, 0xFA, 0x78, 0x29, 0x26, 0xD8, 0xA0, 0x12, 0x74, 0xD3, 0x54, 0xE8, 0x0A, 0x75, 0x0A,
+  0xC9, 0x85, 0x4E, 0x0F, 0x21, 0xC6, 0xEE, 0xEA, 0x26, 0x45, 0x65, 0xA7, 0x33, 0x63, 0x0E, 0x06,
+  0x9B, 0xAC, 0x4B, 0xAA, 0x43, 0xF6, 0x56, 0x53, 0xFC, 0x24, 0x68, 0x7B, 0x0A, 0x61, 0x1E, 0xB0,
+  0x47, 0xEF, 0xF2, 0x35, 0xBB, 0xD4, 0xE6, 0x24, 0xBC, 0x2E, 0xB1, 0x20, 0x9E, 0x15, 0x9C, 0x35,
+  0x46, 0x50, 0xBB, 0x22, 0xFC, 0xFB, 0xA5, 0xD2, 0xC2, 0x21, 0xB3, 0x33, 0xF9, 0x9B, 0x80, 0x26,
+  0x7F, 0xFC, 0x0E, 0x8B, 0xC8, 0x92, 0x6E, 0x5F, 0x5B, 0xA6, 0xAD, 0x61, 0xE0, 0xD7, 0x56, 0x1E,
+  0x70, 0xDA, 0xF9, 0x73, 0x85, 0x6F, 0xB8, 0xD2, 0xF0, 0x69, 0x2D, 0x4D, 0xEC, 0x33, 0xB8, 0x53,
+  0xD3, 0x76, 0xFD, 0x61, 0x1B, 0x1E, 0x06, 0xDF, 0x3B, 0xFD, 0xDF, 0xFF, 0xC9, 0xDB, 0x2A, 0x60,
+  0x2C, 0xE7, 0x11, 0x05, 0xC8, 0x92, 0xEB, 0x4C, 0xCF, 0x64, 0xE0, 0xD4, 0xB1, 0x5D, 0xD7, 0x76,
+  0x8C, 0xB9, 0x91, 0xD2, 0x37, 0xA7, 0x69, 0xFB, 0x30, 0x49, 0xDD, 0x5B, 0x85, 0x13, 0xBA, 0xFD,
+  0x53, 0x77, 0xEA, 0x18, 0x2B, 0x6F, 0xFC, 0x48, 0xB7, 0xA7, 0xEB, 0x25, 0xB1, 0xBC, 0x8E, 0xA6,
+  0xEB, 0x17, 0x57, 0x70, 0xF0, 0x16, 0xBF, 0xC5, 0x07, 0x9A, 0x6F, 0x36, 0x5E, 0xFD, 0xE3, 0x1D,
+  0x76, 0xC3, 0x78, 0x0D, 0xF4, 0x45, 0xF4, 0xC6, 0x81, 0x34, 0x5B, 0x5B, 0xAC, 0x27, 0x6C, 0x12,
+  0x2C, 0xDB, 0x92, 0xBE, 0x02, 0xC5, 0x2B, 0xCD, 0x91, 0x26, 0x9A, 0x4B, 0xDE, 0xD8, 0xAE, 0x27,
+  0x9D, 0x49, 0x01, 0x45, 0xD3, 0x9E, 0xD2, 0x7D, 0x1B, 0x1D, 0x26, 0x17, 0x2F, 0xC9, 0x04, 0xFF,
+  0xC9, 0x31, 0xA1, 0x68, 0x50, 0xEB, 0xA9, 0xD4, 0x38, 0x19, 0xA9, 0x0D, 0xB4, 0xBF, 0xA0, 0x89,
+  0x19, 0x81, 0x30, 0x0F, 0xE5, 0x9A, 0x6B, 0xC7, 0x3C, 0x90, 0xA6, 0x93, 0xD6, 0x57, 0xCA, 0x3D,
+  0xBD, 0x8C, 0xD7, 0x5A, 0x5C, 0x98, 0x8E, 0xB7, 0x20, 0x56, 0x33, 0xE4, 0xCC, 0x21, 0xEE, 0xCA,
+  0xB6, 0x5C, 0xC2, 0x98, 0x63, 0xFF, 0x8C, 0x59, 0x78, 0xBD, 0xE3, 0x7A, 0x9A, 0xB7, 0x76, 0xA5,
+  0xC7, 0x67, 0x67, 0x52, 0x57, 0x51, 0xA2, 0xC5, 0x24, 0x68, 0x66, 0xBB, 0xDC, 0x81, 0xB4, 0x75,
+  0xE1, 0x23, 0xB9, 0xF1, 0x5A, 0xCF, 0x82, 0x3A, 0xB7, 0x12, 0x31, 0x5D, 0x12, 0x23, 0x12, 0x54,
+  0xC0, 0xF7, 0xC6, 0x35, 0x5B, 0x71, 0x06, 0x9B, 0xBA, 0xE6, 0x69, 0xAD, 0xAF, 0x31, 0xBC, 0xA0,
+  0x55, 0xE0, 0xE4, 0x40, 0xA2, 0xB7, 0x9E, 0x45, 0x6E, 0xDD, 0xB6, 0x3A, 0xA0, 0x43, 0x90, 0x37,
+  0xA8, 0x4D, 0x1C, 0x27, 0xCE, 0x31, 0xAD, 0xDD, 0x56, 0x0F, 0x24, 0xBC, 0x13, 0xAF, 0x1B, 0x61,
+  0xF2, 0x91, 0x7F, 0xCD, 0x57, 0x5A, 0x36, 0xD9, 0x04, 0x92, 0x8C, 0xDC, 0x6D, 0x0C, 0x22, 0x08,
+  0x38, 0x1F, 0xC8, 0x1C, 0x34, 0x36, 0x3F, 0xE0, 0xF1, 0xE7, 0x80, 0x06, 0x9F, 0x03, 0x16, 0xB7,
+  0x22, 0xA8, 0x1D, 0x1E, 0x82, 0x4B, 0xBB, 0xB6, 0x49, 0xC0, 0x2A, 0xE6, 0xCD, 0x06, 0xFF, 0xD6,
+  0x2B, 0x58, 0x54, 0x43, 0xB9, 0x69, 0x3C, 0x05, 0x02, 0x1D, 0xCF, 0xBE, 0xF4, 0x1C, 0xC3, 0x9A,
+  0x37, 0xD5, 0x61, 0x2B, 0xA4, 0x46, 0x6F, 0x23, 0xC9, 0xAD, 0xFB, 0xF4, 0x3A, 0x6D, 0x64, 0xFB,
+  0x46, 0x93, 0x5F, 0x7F, 0xDA, 0x68, 0x35, 0x38, 0xF3, 0xF4, 0x1C, 0xCC, 0xAD, 0xC9, 0x0E, 0x9E,
+  0x50, 0x1E, 0x5B, 0xD2, 0xE9, 0x29, 0x6F, 0x86, 0x95, 0xC2, 0x8B, 0x50, 0x88, 0xFE, 0x6C, 0xDD,
+  0x0A, 0x4C, 0xF1, 0x8F, 0x6F, 0xBF, 0xFA, 0x36, 0x7B, 0x7B, 0x08, 0x5C, 0x3F, 0xC7, 0x10, 0xFC,
+  0xED, 0x57, 0xF8, 0x7B, 0xFB, 0x84, 0x46, 0xDD, 0x6F, 0xBF, 0xE2, 0xCF, 0xED, 0x13, 0x68, 0x09,
+  0x8E, 0x69, 0x7B, 0xB7, 0x7F, 0x50, 0x3D, 0xEC, 0x6A, 0x6F, 0x9E, 0xAA, 0xBD, 0x40, 0x6D, 0x85,
+  0x79, 0x9A, 0x67, 0x30, 0xF5, 0x47, 0xE8, 0xBF, 0xCD, 0xA9, 0xAD, 0x03, 0x3C, 0x1E, 0x58, 0xB2,
+  0x0F, 0xBA, 0x09, 0x90, 0xF8, 0x8A, 0x52, 0x7C, 0xD0, 0x8D, 0x19, 0x2D, 0x29, 0x71, 0x57, 0x09,
+  0x0D, 0xC4, 0x2F, 0xB9, 0xD2, 0x1C, 0x97, 0x7C, 0x6F, 0x79, 0x4D, 0x2F, 0xE6, 0x14, 0x29, 0x1A,
+  0x1F, 0x8F, 0x63, 0x22, 0xE0, 0x3F, 0xA8, 0x07, 0xE5, 0x1A, 0x1C, 0xB4, 0xC0, 0xD8, 0xF8, 0xEF,
+  0x96, 0xD9, 0xBC, 0x2E, 0x64, 0x36, 0x4D, 0xAA, 0xB6, 0xA0, 0xCD, 0x56, 0x11, 0x13, 0x02, 0xB6,
+  0x22, 0x06, 0x44, 0x1D, 0x22, 0x54, 0x19, 0xBB, 0x98, 0xE2, 0x10, 0xBF, 0x4C, 0xCD, 0x2F, 0xCD,
+  0x1B, 0xF8, 0xB3, 0x1D, 0xB3, 0x76, 0xB0, 0xC2, 0x42, 0xCF, 0xF1, 0x0F, 0x00, 0x84, 0x3F, 0xA9,
+  0x86, 0x02, 0x54, 0xDF, 0x9B, 0x66, 0x93, 0x7D, 0x60, 0x0E, 0x6C, 0x64, 0x0D, 0xF1, 0xD0, 0xDD,
+  0x60, 0x64, 0xB2, 0x6D, 0xEF, 0xF3, 0x81, 0xB4, 0x72, 0x80, 0x31, 0xFA, 0x2D, 0x15, 0x38, 0x06,
+  0x42, 0xC4, 0x62, 0xBF, 0xB9, 0x1C, 0xAC, 0x4C, 0xF3, 0x39, 0xA3, 0x0A, 0x2C, 0xB0, 0x03, 0x30,
+  0x99, 0x35, 0x9A, 0x2E, 0xFC, 0xBD, 0x7D, 0x02, 0x8D, 0xC0, 0x21, 0xFC, 0xBD, 0x7D, 0x82, 0x4D,
+  0xA1, 0x51, 0x61, 0x8B, 0xB7, 0x4F, 0xA0, 0x45, 0x38, 0x81, 0xBF, 0x50, 0x06, 0xDB, 0xC5, 0x52,
+  0xF8, 0x0B, 0x77, 0x68, 0xFB, 0x78, 0x93, 0x1E, 0xB0, 0x0B, 0xFC, 0x34, 0x4B, 0x40, 0xF6, 0x76,
+  0xFD, 0x26, 0x7D, 0xDB, 0xF9, 0xE7, 0x1B, 0x10, 0x87, 0x1E, 0x6C, 0x20, 0x06, 0x59, 0x3A, 0x9E,
+  0xE3, 0xCF, 0xC6, 0x07, 0x18, 0x2F, 0xF0, 0x23, 0xB8, 0x46, 0xDF, 0x08, 0x8B, 0x97, 0xD8, 0x01,
+  0x96, 0xA2, 0xEF, 0xEF, 0xA4, 0xA5, 0xD8, 0x11, 0x5C, 0xE3, 0x6F, 0x7D, 0x3C, 0x90, 0xF8, 0x7B,
+  0x05, 0x73, 0x95, 0x13, 0xBE, 0xF7, 0xEF, 0xB9, 0x7B, 0x83, 0x02, 0x32, 0xD6, 0x50, 0x2B, 0xC1,
+  0xD9, 0xE6, 0xF6, 0x09, 0xC1, 0x7B, 0x94, 0x49, 0x38, 0xDE, 0xF0, 0x63, 0xB8, 0x0E, 0xFC, 0xE1,
+  0x1D, 0x9F, 0x61, 0x7A, 0x61, 0x13, 0x5E, 0x80, 0x12, 0x1E, 0xDE, 0xE7, 0xCC, 0xC3, 0xD9, 0x26,
+  0x38, 0xC3, 0xDA, 0xB4, 0x2E, 0x17, 0x03, 0x4E, 0x37, 0xE1, 0x29, 0xDC, 0x45, 0x59, 0x10, 0x00,
+  0x2E, 0xD3, 0xED, 0x13, 0x2E, 0x13, 0xA2, 0xC8, 0x8E, 0xE2, 0xAA, 0x86, 0xBF, 0xE8, 0x47, 0x1E,
+  0x0F, 0xD8, 0x9F, 0x7C, 0xEF, 0x24, 0x66, 0x4B, 0x3A, 0x1B, 0xF3, 0xB8, 0x8F, 0x01, 0x00, 0x3C,
+  0x0A, 0xAE, 0x13, 0xB3, 0xA3, 0x79, 0xE0, 0x10, 0x90, 0x37, 0x11, 0xB7, 0x83, 0x11, 0x25, 0x70,
+  0xF3, 0x9D, 0x5B, 0x1D, 0x0B, 0xDC, 0x82, 0x12, 0x6C, 0x9D, 0xF0, 0xB0, 0x81, 0x84, 0x98, 0x94,
+  0x3B, 0xB4, 0xD8, 0xE5, 0x34, 0x72, 0xEC, 0x6E, 0x0A, 0x45, 0x1E, 0x0A, 0xE3, 0x35, 0xF0, 0x62,
+  0x1A, 0x35, 0xDA, 0x6B, 0x44, 0x68, 0x75, 0x07, 0x83, 0x90, 0xDA, 0x56, 0xA4, 0x63, 0x63, 0x4A,
+  0x54, 0x48, 0x07, 0xF3, 0xF3, 0xB0, 0x2B, 0x9C, 0x82, 0x39, 0x48, 0x0D, 0x7F, 0x40, 0xD9, 0x38,
+  0xD9, 0x89, 0x70, 0x50, 0x83, 0x4F, 0x20, 0x48, 0xCF, 0x19, 0x8F, 0x27, 0x61, 0xF8, 0x94, 0xA4,
+  0x09, 0x24, 0x3B, 0x5F, 0x9E, 0xC5, 0x88, 0xD1, 0xD4, 0x3F, 0xA0, 0xC4, 0xAE, 0x61, 0xA2, 0xB0,
+  0x75, 0x89, 0x6D, 0xB7, 0x6B, 0xDB, 0x16, 0x49, 0x6E, 0x35, 0x16, 0x2F, 0x79, 0x43, 0xFC, 0x4C,
+  0x27, 0x33, 0x6D, 0x6D, 0x7A, 0x61, 0x35, 0x87, 0x40, 0xA2, 0x6B, 0xF1, 0xB0, 0xC5, 0x92, 0xFC,
+  0xDC, 0xAE, 0x3B, 0xA3, 0xAB, 0xF0, 0x7B, 0x85, 0xC7, 0xDB, 0xBD, 0x02, 0x58, 0xA5, 0xE3, 0x35,
+  0x1B, 0x17, 0x8E, 0x63, 0x3B, 0xBF, 0x35, 0x9E, 0x62, 0xA1, 0xA7, 0x8D, 0xDF, 0x4F, 0x24, 0x1A,
+  0x4F, 0x5B, 0xF1, 0xE0, 0x1E, 0x09, 0x9F, 0x87, 0x87, 0xD2, 0x0B, 0xCF, 0xD3, 0x00, 0x00, 0x9C,
+  0x63, 0x59, 0xA0, 0x7E, 0x24, 0x8D, 0x27, 0x81, 0xB6, 0x83, 0x46, 0xC9, 0xBE, 0x77, 0x0F, 0x1A,
+  0xC1, 0xC4, 0xD2, 0x85, 0x2A, 0x7E, 0x92, 0x49, 0x49, 0x75, 0xFE, 0xB9, 0x26, 0xCE, 0xE6, 0x92,
+  0x2A, 0xCC, 0x76, 0x5E, 0x40, 0xA8, 0x6C, 0x74, 0xC2, 0x71, 0x52, 0x83, 0xE5, 0x3C, 0x1D, 0x20,
+  0x75, 0x01, 0x6D, 0x00, 0xC6, 0xA1, 0xCD, 0xFB, 0xB9, 0x21, 0xC7, 0x1D, 0xFA, 0xB9, 0x33, 0x0E,
+  0xC6, 0x76, 0x92, 0x05, 0x25, 0x6C, 0xEB, 0x0B, 0xD9, 0xAC, 0x57, 0xA0, 0xFE, 0x30, 0x6D, 0xDA,
+  0x4A, 0xE4, 0xB8, 0x76, 0x48, 0x07, 0x4A, 0x9E, 0xF3, 0x8E, 0x53, 0xED, 0x25, 0x14, 0x0A, 0x21,
+  0xA0, 0xD6, 0x89, 0x9E, 0xF8, 0x6C, 0xA7, 0xD0, 0xED, 0xA3, 0xE4, 0xB3, 0x84, 0x94, 0x93, 0x33,
+  0xC8, 0x95, 0x07, 0xAE, 0x4D, 0x1D, 0x7B, 0xAB, 0x85, 0xAD, 0x74, 0x10, 0x92, 0xC1, 0x30, 0x32,
+  0xAC, 0x57, 0x90, 0x7C, 0x92, 0x78, 0x70, 0x08, 0x6C, 0xC1, 0xBF, 0xB9, 0xB4, 0x3D, 0xB2, 0x15,
+  0x31, 0x0C, 0xCB, 0xF0, 0x0C, 0xCD, 0xFC, 0x14, 0x5A, 0xE3, 0x5E, 0xDD, 0xBF, 0x59, 0xC9, 0xFF,
+  0x77, 0x72, 0x3E, 0xB1, 0x3C, 0x65, 0xC7, 0x42, 0x82, 0x78, 0x10, 0x5A, 0x49, 0x54, 0x0F, 0xB1,
+  0xB0, 0xF0, 0x28, 0xEE, 0xB9, 0x8F, 0x1F, 0xD3, 0xA3, 0x47, 0x01, 0x68, 0x7E, 0xF4, 0x38, 0x93,
+  0xC2, 0x1B, 0x5B, 0x00, 0xEF, 0xD2, 0xDE, 0xA2, 0xE1, 0x13, 0x8F, 0x50, 0xD8, 0x0A, 0xFC, 0x2B,
+  0x48, 0x6F, 0xD0, 0x16, 0xFE, 0x3F, 0xEA, 0x3F, 0xA0, 0xA8, 0xBF, 0xBF, 0x10, 0x2F, 0x3E, 0xEA,
+  0x61, 0xF5, 0x92, 0xF3, 0xE9, 0xA7, 0x90, 0x68, 0x27, 0x27, 0xC9, 0x41, 0xE8, 0x0E, 0x06, 0xFB,
+  0x30, 0x98, 0xB9, 0x60, 0xE1, 0xF9, 0xE5, 0xE6, 0x7B, 0xBD, 0xD9, 0x08, 0xDE, 0x68, 0xD4, 0x68,
+  0x61, 0x5C, 0x32, 0x8D, 0xE9, 0x97, 0x20, 0x2C, 0x85, 0x96, 0x07, 0x29, 0x0D, 0x66, 0xFF, 0x38,
+  0xB0, 0x36, 0xA6, 0xDC, 0x54, 0x5F, 0x7D, 0x78, 0xF1, 0xEE, 0xF3, 0x8B, 0x8F, 0x1F, 0x3F, 0x48,
+  0x6B, 0xB0, 0x59, 0x75, 0xF8, 0x19, 0xD3, 0x16, 0x18, 0x04, 0x38, 0x9F, 0x81, 0x3F, 0xF7, 0x33,
+  0x25, 0xAA, 0xFC, 0xF6, 0xFB, 0x6F, 0xDD, 0xDF, 0xA1, 0xEA, 0xD7, 0xFF, 0xB6, 0x1A, 0x4C, 0x10,
+  0x24, 0xF5, 0x14, 0x68, 0xE1, 0xF1, 0xD7, 0xC6, 0x53, 0xDF, 0xE0, 0x9B, 0xE9, 0x1C, 0x06, 0xAF,
+  0xD7, 0x6D, 0xB4, 0x40, 0xD4, 0xDB, 0x03, 0x20, 0xC5, 0xD2, 0x41, 0xE8, 0x73, 0x9A, 0x38, 0x55,
+  0x61, 0x40, 0x03, 0xEA, 0x33, 0xF8, 0x39, 0x95, 0xD4, 0x23, 0xF8, 0x7D, 0xFA, 0x34, 0x34, 0x91,
+  0x92, 0xCD, 0x35, 0x9E, 0x1A, 0xB4, 0x31, 0x18, 0x9D, 0x34, 0x8D, 0x53, 0xD0, 0xE4, 0xF3, 0xC6,
+  0x41, 0xE3, 0xA4, 0xD1, 0x80, 0x6B, 0x7E, 0xF3, 0xB7, 0x31, 0x71, 0x6E, 0x9F, 0x05, 0x12, 0xB2,
+  0xDE, 0x15, 0x6E, 0x84, 0xEA, 0x8F, 0x66, 0x75, 0x2F, 0xD9, 0x2C, 0xD7, 0x59, 0x3A, 0x26, 0xEC,
+  0x6D, 0xD6, 0x73, 0xDA, 0x21, 0x46, 0xEB, 0x64, 0x00, 0xC4, 0x42, 0x43, 0xE0, 0x6B, 0xA9, 0xA4,
+  0x69, 0x77, 0xAB, 0xEB, 0x0E, 0xA0, 0x4D, 0xAD, 0xA5, 0xB5, 0xE3, 0xC2, 0x62, 0x34, 0xB0, 0x70,
+  0x02, 0x8D, 0x9D, 0xE1, 0x66, 0x26, 0x11, 0x5A, 0x3A, 0x42, 0x65, 0x27, 0xE1, 0x51, 0xEE, 0x2F,
+  0xD7, 0x61, 0x88, 0xCD, 0x05, 0x11, 0x9B, 0x47, 0x10, 0x9B, 0xDF, 0x2D, 0x62, 0x9C, 0x74, 0x65,
+  0xD4, 0x7C, 0x3A, 0x39, 0xC8, 0xE5, 0xD6, 0xE7, 0xA0, 0x71, 0xB4, 0xE6, 0x49, 0x68, 0x95, 0x81,
+  0x89, 0xC5, 0x2E, 0x18, 0x14, 0x11, 0xE7, 0xCD, 0xC7, 0x77, 0x6F, 0x31, 0xDA, 0x24, 0x43, 0x16,
+  0x20, 0xB6, 0x9D, 0x5C, 0x25, 0x50, 0xC0, 0xA0, 0x18, 0x9B, 0xF9, 0xD8, 0x0A, 0x9B, 0x52, 0x38,
+  0x83, 0x90, 0x63, 0x08, 0x7C, 0xC2, 0x40, 0xCC, 0x77, 0x71, 0x92, 0xC0, 0x77, 0xDE, 0xB0, 0x56,
+  0x86, 0x2D, 0x60, 0x05, 0x21, 0x10, 0x19, 0xE5, 0x1D, 0x87, 0x89, 0xCC, 0x65, 0xD4, 0xEE, 0x22,
+  0xD4, 0x5F, 0x5D, 0xD1, 0xA0, 0xE6, 0x0F, 0xD5, 0xC3, 0xD8, 0xE6, 0xE6, 0x6A, 0x87, 0x0F, 0xE8,
+  0x85, 0x14, 0xC4, 0xBF, 0x2A, 0x97, 0x60, 0xE0, 0x7C, 0x22, 0xA0, 0x00, 0x95, 0x4D, 0x02, 0x15,
+  0x3A, 0x81, 0x20, 0x44, 0x83, 0x7E, 0x89, 0x2C, 0x85, 0xC2, 0x46, 0x98, 0x42, 0x12, 0x0F, 0xFE,
+  0x54, 0x85, 0x10, 0x11, 0xFF, 0xB3, 0x55, 0xE9, 0x74, 0x36, 0x45, 0xE8, 0x24, 0xF1, 0xC3, 0xA7,
+  0x46, 0x84, 0xC8, 0xF0, 0x0F, 0x1D, 0xA5, 0x52, 0xD9, 0x14, 0xA0, 0x92, 0xA8, 0x1B, 0x3E, 0x15,
+  0x23, 0x26, 0x13, 0xFF, 0x24, 0x4E, 0x3A, 0x9D, 0x4D, 0x11, 0x3A, 0x49, 0xFC, 0xF0, 0x99, 0x9F,
+  0x4C, 0xC7, 0x60, 0x45, 0xA0, 0x32, 0x4F, 0x55, 0x9F, 0xAB, 0xD1, 0xCC, 0x9A, 0x4F, 0x14, 0x65,
+  0x51, 0xE0, 0x45, 0xB6, 0x29, 0xF8, 0xD1, 0xE1, 0x1E, 0xA6, 0xEC, 0xEE, 0x23, 0x0A, 0xBD, 0x37,
+  0x4D, 0xB1, 0x28, 0xB4, 0x32, 0x4D, 0x3F, 0xFC, 0x04, 0x75, 0x52, 0xC2, 0x0F, 0x5D, 0x32, 0xA3,
+  0xF3, 0xAD, 0x99, 0xFA, 0xA7, 0x25, 0x18, 0xDD, 0x5D, 0x10, 0x91, 0xC6, 0x72, 0x6D, 0x0A, 0x59,
+  0x12, 0x94, 0xE3, 0x64, 0xA2, 0x86, 0x44, 0x97, 0xE3, 0x36, 0xAE, 0x58, 0xE8, 0xDA, 0xB8, 0x29,
+  0x14, 0xE8, 0x94, 0xB0, 0x58, 0x6E, 0x06, 0x25, 0x53, 0x88, 0xAC, 0x1C, 0xB1, 0xF4, 0x0E, 0xCA,
+  0xA5, 0x09, 0x82, 0xF3, 0xCF, 0x62, 0xA2, 0xF8, 0x5F, 0x1D, 0x4F, 0xE2, 0x83, 0xCE, 0x5A, 0x67,
+  0x81, 0xC2, 0xBF, 0xEE, 0x9C, 0x86, 0xC8, 0x4A, 0xB4, 0xCB, 0xF5, 0xBF, 0x7F, 0x9C, 0xD0, 0xED,
+  0x96, 0x9C, 0xEC, 0xAF, 0xDF, 0x39, 0xB4, 0x2B, 0x22, 0xE0, 0x1A, 0xC1, 0xCA, 0x3C, 0xCF, 0xEE,
+  0xC2, 0x6A, 0x19, 0xDE, 0x31, 0xD5, 0xAC, 0x2B, 0x2D, 0xE6, 0x1D, 0x53, 0x18, 0xFE, 0x7A, 0x84,
+  0x93, 0x6E, 0xCA, 0xAC, 0x80, 0xCC, 0x79, 0x64, 0x67, 0x1D, 0xBA, 0x65, 0x0D, 0x27, 0x42, 0x0C,
+  0x72, 0xCD, 0x4E, 0x62, 0xB7, 0x17, 0x84, 0xBE, 0x26, 0x84, 0xDF, 0x67, 0x67, 0xAC, 0x40, 0xD0,
+  0xCA, 0xC4, 0xD6, 0x37, 0x1D, 0x6D, 0xB5, 0x82, 0xE0, 0x75, 0xBE, 0x30, 0x4C, 0xBD, 0xC9, 0xAA,
+  0x46, 0x4C, 0x04, 0xF7, 0x26, 0x10, 0xBA, 0x6A, 0xC5, 0xA9, 0x82, 0xC0, 0xE7, 0xEC, 0x5A, 0xB3,
+  0xD1, 0xD5, 0xFD, 0x35, 0x23, 0x5E, 0xAC, 0xA3, 0x3B, 0xDA, 0xF5, 0xF7, 0xB8, 0xA9, 0xA1, 0x89,
+  0x8D, 0x1E, 0x28, 0x07, 0x0A, 0x2F, 0xE0, 0x39, 0x9B, 0x20, 0xCB, 0x44, 0xBA, 0xB8, 0xF8, 0xFB,
+  0xD3, 0x87, 0xB7, 0x21, 0x5D, 0xCF, 0x7E, 0xC5, 0x2E, 0x35, 0x1B, 0x74, 0x57, 0xC4, 0xE1, 0x9F,
+  0x2B, 0x1C, 0x0A, 0xF8, 0xA0, 0x44, 0xD4, 0x88, 0x1B, 0x1E, 0x50, 0x55, 0xAC, 0xF8, 0xB3, 0x28,
+  0x51, 0xB8, 0x6C, 0x91, 0x6B, 0x09, 0x28, 0x91, 0x66, 0x52, 0x55, 0x7F, 0x3B, 0x04, 0x56, 0x47,
+  0x49, 0xBE, 0x5B, 0x9B, 0xE6, 0xAF, 0x44, 0x73, 0x00, 0x8F, 0xA7, 0x52, 0x53, 0x56, 0xE4, 0xA7,
+  0x4D, 0x7A, 0xFD, 0x1D, 0x88, 0xB3, 0x68, 0xB6, 0x9E, 0xAA, 0xAD, 0x56, 0xC7, 0x05, 0xCC, 0x48,
+  0xB3, 0xDD, 0xF5, 0x8B, 0xC0, 0x0F, 0x2D, 0xC3, 0x1A, 0x49, 0xBF, 0xFF, 0xC6, 0x5E, 0x3B, 0x6E,
+  0x56, 0x81, 0x77, 0x86, 0x85, 0x93, 0x38, 0x59, 0x45, 0x2E, 0x09, 0x28, 0x56, 0xDF, 0x29, 0x22,
+  0xD3, 0x5D, 0x1C, 0x7C, 0xFA, 0x43, 0xA2, 0x8B, 0xDB, 0x52, 0x33, 0x3A, 0xA3, 0xC3, 0x97, 0x11,
+  0x09, 0x1A, 0x7A, 0xD3, 0xF7, 0xF8, 0xDB, 0xA8, 0x71, 0x80, 0xCB, 0x82, 0x01, 0xFC, 0x00, 0x1E,
+  0xD0, 0x71, 0xC8, 0xD2, 0xBE, 0x22, 0x3B, 0xF8, 0x63, 0xF1, 0xC0, 0xF8, 0x17, 0x86, 0xCE, 0xA6,
+  0x69, 0x42, 0xBB, 0xC5, 0x59, 0x21, 0xDC, 0x20, 0x82, 0x5B, 0x28, 0x70, 0x3F, 0x45, 0xB3, 0xC1,
+  0x76, 0xAF, 0xD0, 0x5E, 0xE1, 0x36, 0x74, 0x9B, 0x85, 0x7D, 0x9D, 0x55, 0x93, 0xB5, 0xBE, 0x55,
+  0x39, 0xA8, 0xAD, 0x1B, 0xAE, 0x36, 0x31, 0xF3, 0x9B, 0xE6, 0xE5, 0x74, 0x3E, 0xFD, 0x0D, 0x05,
+  0xFC, 0x2B, 0x50, 0xD5, 0x73, 0xE8, 0x3C, 0x61, 0x84, 0x2C, 0xB1, 0xF2, 0xA8, 0xFA, 0x6C, 0x65,
+  0x12, 0x9E, 0x69, 0x30, 0x78, 0x8A, 0x53, 0x66, 0x93, 0xC7, 0x05, 0xA6, 0x95, 0xA3, 0x97, 0xA1,
+  0x46, 0xFC, 0x14, 0xCC, 0x19, 0x2C, 0x54, 0x7A, 0x4E, 0x45, 0x90, 0x4E, 0x62, 0x77, 0x13, 0x27,
+  0xA5, 0xFF, 0xBA, 0x33, 0xB8, 0x01, 0xE7, 0x31, 0x0D, 0x3C, 0x79, 0x12, 0xA7, 0x86, 0xDB, 0x58,
+  0x58, 0x07, 0x12, 0xB4, 0xC6, 0xCA, 0xB3, 0xD7, 0x87, 0x87, 0x2B, 0x0B, 0x9C, 0x25, 0xE8, 0x0A,
+  0x1E, 0xC7, 0x14, 0x1F, 0xE9, 0x23, 0x80, 0x11, 0x43, 0xA7, 0x0A, 0xC2, 0x5D, 0x69, 0xF2, 0xCE,
+  0x7A, 0xFF, 0x73, 0x6A, 0xF5, 0x4D, 0xC2, 0x37, 0x25, 0xB6, 0x40, 0xFF, 0x68, 0xCC, 0xE1, 0x85,
+  0xF8, 0x18, 0x7A, 0x8B, 0xE2, 0x3C, 0x46, 0x11, 0x05, 0xDB, 0xE2, 0x9B, 0xAD, 0xF8, 0x53, 0x8A,
+  0x73, 0xCD, 0xB0, 0xCE, 0x89, 0x81, 0xE9, 0x5F, 0x2B, 0x72, 0x97, 0x36, 0x0F, 0x84, 0x70, 0xC3,
+  0x60, 0x2B, 0x6B, 0x3D, 0xE4, 0xF0, 0x90, 0x16, 0x4D, 0x21, 0x43, 0x9B, 0xD8, 0x25, 0x93, 0xC9,
+  0xFD, 0xF5, 0xE4, 0x33, 0x52, 0x4B, 0x52, 0x0A, 0x25, 0x77, 0x3D, 0x41, 0x75, 0xD0, 0x56, 0xE1,
+  0x30, 0xDE, 0x71, 0xEE, 0x2C, 0x78, 0x47, 0x11, 0x62, 0x13, 0xF2, 0x5F, 0xE3, 0x33, 0x26, 0x77,
+  0x39, 0x3F, 0xAD, 0xE2, 0xE4, 0x74, 0xE2, 0x2C, 0x72, 0xC5, 0xA9, 0xE9, 0x0C, 0x9A, 0x6C, 0xCB,
+  0xDD, 0x36, 0xD1, 0xF5, 0x64, 0x69, 0x78, 0x09, 0x04, 0x1B, 0x6A, 0xA3, 0xC8, 0x2C, 0x77, 0xD4,
+  0x3F, 0x58, 0x8C, 0xA1, 0x0B, 0x80, 0x40, 0x28, 0xB6, 0x80, 0x3F, 0x65, 0x7B, 0xC8, 0x9F, 0x43,
+  0x3F, 0x88, 0xCB, 0xF2, 0x88, 0xE5, 0xD6, 0xC6, 0x9C, 0x47, 0x91, 0x1D, 0x65, 0x94, 0x44, 0x7C,
+  0x4F, 0x99, 0xBF, 0x8F, 0x2B, 0xBE, 0x5E, 0x18, 0xDD, 0x91, 0xF2, 0x87, 0x43, 0xA0, 0x9E, 0x8B,
+  0xA3, 0x4C, 0xE9, 0xDB, 0xAF, 0x94, 0xC4, 0xAD, 0x34, 0x03, 0xFF, 0x74, 0x17, 0x44, 0xA7, 0x23,
+  0x22, 0x6F, 0xED, 0x9E, 0x48, 0xB8, 0x19, 0x27, 0xB6, 0x87, 0xEC, 0xF6, 0x8F, 0x56, 0x74, 0x47,
+  0xD6, 0xD6, 0x2A, 0x28, 0x17, 0x7B, 0x67, 0x35, 0x54, 0x64, 0xDD, 0x93, 0xD7, 0x15, 0x5A, 0xFB,
+  0x4C, 0x5A, 0x32, 0xDC, 0x8E, 0x1D, 0xC1, 0x4A, 0xA1, 0x40, 0xDB, 0x74, 0x2F, 0xA4, 0x48, 0x93,
+  0x09, 0x39, 0x5F, 0xE0, 0xDD, 0x50, 0x22, 0xEC, 0x89, 0xB7, 0xFC, 0xA8, 0xC5, 0xF5, 0x04, 0x26,
+  0xA2, 0xFB, 0x51, 0x90, 0x19, 0x11, 0xAE, 0x09, 0x33, 0x1C, 0x63, 0x26, 0xC0, 0xB4, 0xCD, 0x95,
+  0x9D, 0xBF, 0x51, 0x90, 0x2F, 0x86, 0x04, 0x60, 0xFD, 0xE9, 0x42, 0x36, 0x1D, 0xA8, 0x20, 0x89,
+  0x06, 0x36, 0x10, 0x21, 0x10, 0x53, 0x51, 0x21, 0x88, 0x32, 0x97, 0xA8, 0xC3, 0xA0, 0xEE, 0xAF,
+  0xE5, 0x32, 0xDB, 0x22, 0xBF, 0x51, 0xAB, 0xFE, 0xFD, 0x80, 0xF5, 0xBB, 0x91, 0x50, 0xD6, 0x2A,
+  0xC2, 0xD0, 0xCE, 0x5A, 0x79, 0x2E, 0x33, 0x77, 0xB6, 0x6A, 0x18, 0x59, 0x34, 0xA7, 0xF4, 0xCE,
+  0x24, 0x65, 0x67, 0xB5, 0x3C, 0xBA, 0xB4, 0x95, 0xBC, 0x34, 0x1E, 0x5F, 0xBC, 0x8E, 0xA8, 0x27,
+  0x71, 0x59, 0x2B, 0x55, 0x5D, 0xCC, 0xBE, 0x58, 0x44, 0xC1, 0x64, 0x3D, 0x73, 0x54, 0x43, 0xB7,
+  0xB1, 0x52, 0x7D, 0x85, 0x15, 0xCE, 0x83, 0x6D, 0xCB, 0xB9, 0x35, 0xC3, 0x2D, 0xCE, 0x11, 0x1A,
+  0x74, 0x94, 0x24, 0xB6, 0x2A, 0xC0, 0x07, 0x54, 0x91, 0xAA, 0x48, 0x35, 0xBF, 0xAE, 0xFF, 0xEC,
+  0xCA, 0x36, 0xFB, 0xD4, 0x77, 0xF3, 0xAB, 0x47, 0xB7, 0x3B, 0x37, 0x22, 0xEA, 0x72, 0x3D, 0x7B,
+  0x75, 0x49, 0xAF, 0x6E, 0xF9, 0xF5, 0x35, 0x9D, 0x24, 0xEA, 0xE0, 0x7D, 0x7F, 0xFC, 0x11, 0x65,
+  0x35, 0x3E, 0xAF, 0x7E, 0x89, 0x33, 0x48, 0x12, 0xA3, 0xD3, 0xD8, 0x1A, 0x6B, 0xE2, 0xAD, 0xC4,
+  0x16, 0xE8, 0x58, 0xCE, 0x75, 0xA6, 0x2C, 0xFC, 0x07, 0xDB, 0x8B, 0xD1, 0xF9, 0xF1, 0xF0, 0x8F,
+  0x47, 0x41, 0x8F, 0x1F, 0x83, 0xA8, 0x95, 0xCB, 0x8B, 0xBD, 0xDA, 0x66, 0x25, 0x0C, 0xD1, 0xCC,
+  0x5D, 0x5C, 0x8C, 0xFB, 0xAC, 0xAB, 0xC3, 0x00, 0x14, 0x81, 0x2F, 0x25, 0xCA, 0x85, 0x6A, 0xE2,
+  0x61, 0x25, 0xCE, 0x7C, 0xA4, 0xEF, 0x62, 0x7B, 0xD3, 0x9F, 0x7F, 0x9E, 0x4E, 0xA0, 0xBB, 0xC2,
+  0x81, 0x15, 0x38, 0xCF, 0x75, 0xB3, 0x75, 0x9B, 0x25, 0x0E, 0x53, 0x57, 0x08, 0xA4, 0x28, 0x13,
+  0x34, 0xEE, 0x26, 0x53, 0x8B, 0xE9, 0x27, 0x99, 0x5C, 0xD4, 0xFE, 0x2E, 0x2C, 0x7F, 0x20, 0x90,
+  0xA6, 0xD8, 0xB3, 0x5D, 0xD5, 0xB2, 0x5C, 0x30, 0x46, 0x20, 0x8C, 0xA8, 0x3B, 0xCC, 0x6E, 0x25,
+  0x7B, 0x11, 0xBB, 0xF0, 0x0B, 0x44, 0xD0, 0x3A, 0x5F, 0x43, 0xFD, 0xA5, 0x8F, 0x16, 0xBB, 0x86,
+  0x49, 0x5F, 0x60, 0x56, 0x90, 0x04, 0x66, 0x99, 0x3B, 0xDC, 0x8E, 0xF8, 0x08, 0xCF, 0x18, 0x73,
+  0x2A, 0xD0, 0x34, 0x91, 0x3D, 0x1B, 0x42, 0xEB, 0xB2, 0x3D, 0xAC, 0x9E, 0x14, 0xC9, 0x45, 0x33,
+  0x9D, 0x1B, 0x8A, 0x4D, 0x59, 0xB1, 0x08, 0x11, 0xA0, 0xBB, 0xDB, 0x57, 0x47, 0x87, 0x4B, 0xBC,
+  0xC7, 0x86, 0x72, 0xAD, 0x40, 0xA5, 0x58, 0x89, 0xA7, 0x81, 0xA1, 0x42, 0xD3, 0x13, 0xEC, 0xDD,
+  0xE4, 0x7A, 0x4B, 0xD7, 0xE9, 0x49, 0xF5, 0x6E, 0x42, 0x1D, 0x45, 0xC1, 0x7F, 0x88, 0x29, 0x54,
+  0x24, 0xC9, 0xD6, 0x3A, 0x89, 0x6A, 0xDD, 0x1F, 0x5C, 0xE4, 0xD4, 0xF8, 0x4C, 0xF3, 0x80, 0xA8,
+  0xCA, 0x88, 0xA0, 0xCA, 0x08, 0x57, 0x19, 0x56, 0x08, 0xB3, 0xE6, 0xFC, 0x91, 0x4E, 0x10, 0x12,
+  0x7E, 0x7E, 0x19, 0x4A, 0x76, 0x3D, 0xC9, 0xE4, 0x93, 0x8F, 0x22, 0x22, 0xE2, 0x65, 0x57, 0x80,
+  0xF2, 0x4B, 0xE8, 0x34, 0xA3, 0x62, 0x5D, 0x4F, 0xC4, 0xC4, 0xF2, 0x47, 0x21, 0x58, 0x21, 0x14,
+  0x2B, 0x79, 0xAC, 0xE2, 0x8B, 0xF2, 0x8A, 0x78, 0xFC, 0x51, 0x47, 0xCD, 0xD2, 0xA5, 0x99, 0xA3,
+  0x2D, 0x09, 0x7E, 0xD9, 0x3E, 0x60, 0x36, 0xB8, 0x92, 0xC5, 0x73, 0x50, 0x88, 0x75, 0x10, 0xC1,
+  0xA9, 0x10, 0xDB, 0x41, 0xE9, 0xD0, 0x8C, 0x43, 0x02, 0x6C, 0xBC, 0x30, 0x96, 0x06, 0xDB, 0x63,
+  0x5D, 0xD6, 0xEF, 0xEB, 0x94, 0xFB, 0xAD, 0xDE, 0x3D, 0x5A, 0xC0, 0x21, 0x53, 0x7B, 0x6E, 0x01,
+  0xA5, 0x58, 0x19, 0x66, 0xAA, 0xAC, 0xF3, 0x0F, 0x1E, 0x98, 0xE1, 0x8F, 0xC7, 0xB0, 0x33, 0x9C,
+  0x14, 0x1C, 0x3F, 0x3A, 0x3D, 0x5C, 0x78, 0x4B, 0x73, 0xFC, 0xE8, 0xFF, 0x00, 0xDF, 0x19, 0xEB,
+  0xA3, 0xC1, 0x08, 0x01, 0x00,
+};
+
+// setup.html: 9819 bytes, 2881 gzipped
+static const uint8_t web_setup_gz[] = {
+  0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xED, 0x5A, 0x6D, 0x6F, 0xDB, 0xC8,
+  0x11, 0xFE, 0xEE, 0x5F, 0xB1, 0x31, 0xD2, 0x90, 0x44, 0x24, 0xD2, 0x76, 0x7A, 0x45, 0xAA, 0xB7,
+  0xC0, 0xF1, 0x39, 0x81, 0x73, 0xB9, 0xD8, 0xB0, 0x6C, 0xA4, 0x05, 0x82, 0x26, 0x2B, 0x71, 0x25,
+  0xAD, 0x4D, 0x91, 0x3C, 0x72, 0x69, 0x45, 0xB0, 0x05, 0xDC, 0x5F, 0x28, 0xD0, 0x5F, 0x78, 0xBF,
+  0xA4, 0x33, 0xFB, 0x42, 0x2E, 0x65, 0x49, 0x7E, 0x4B, 0xDB, 0x2F, 0x3D, 0xE0, 0x62, 0x73, 0xB9,
+  0x3B, 0x33, 0x3B, 0xF3, 0xCC, 0x33, 0xB3, 0x4B, 0x77, 0x9E, 0x85, 0xC9, 0x50, 0xCC, 0x53, 0x46,
+  0x26, 0x62, 0x1A, 0xF5, 0x3A, 0xFA, 0x5F, 0x46, 0xC3, 0x5E, 0x67, 0xCA, 0x04, 0x25, 0xC3, 0x09,
+  0xCD, 0x72, 0x26, 0xBA, 0x5F, 0xB6, 0x0B, 0x31, 0x6A, 0xBE, 0xFE, 0xB2, 0xAD, 0xC7, 0x63, 0x3A,
+  0x65, 0x30, 0x78, 0xC5, 0xD9, 0x2C, 0x4D, 0x32, 0xF1, 0x65, 0x9B, 0x0C, 0x93, 0x58, 0xB0, 0x18,
+  0x67, 0xCE, 0x78, 0x28, 0x26, 0xDD, 0x90, 0x5D, 0xF1, 0x21, 0x6B, 0xCA, 0x87, 0x06, 0x8F, 0xB9,
+  0xE0, 0x34, 0x6A, 0xE6, 0x43, 0x1A, 0xB1, 0xEE, 0x2E, 0x8A, 0x11, 0x5C, 0x44, 0xAC, 0xF7, 0xA9,
+  0x10, 0x19, 0x3F, 0x98, 0x0F, 0x23, 0x46, 0xFA, 0x4C, 0x14, 0x69, 0x27, 0x50, 0xE3, 0x9D, 0x40,
+  0x19, 0x31, 0x48, 0xC2, 0x39, 0xC9, 0xC5, 0x3C, 0x42, 0x6D, 0x23, 0x50, 0xD1, 0x1C, 0xD1, 0x29,
+  0x8F, 0xE6, 0xAD, 0xFD, 0x0C, 0xE4, 0x35, 0x72, 0x1A, 0xE7, 0xCD, 0x9C, 0x65, 0x7C, 0xD4, 0x4E,
+  0x69, 0x18, 0xF2, 0x78, 0xDC, 0xDA, 0xDD, 0x4B, 0xBF, 0x83, 0x7C, 0xB2, 0xD5, 0x99, 0xEC, 0xD9,
+  0xE2, 0x9B, 0xE4, 0x67, 0x69, 0x91, 0xD1, 0x03, 0x6F, 0xB7, 0x3A, 0x69, 0xEF, 0x3C, 0x67, 0x44,
+  0x4C, 0x78, 0x4E, 0x52, 0x3A, 0x86, 0xDF, 0x12, 0xDC, 0xC7, 0x88, 0x8F, 0x8B, 0x8C, 0x91, 0xCF,
+  0xFC, 0x8F, 0xDF, 0xFF, 0xF9, 0x8E, 0x13, 0x1A, 0x87, 0xE4, 0x53, 0x12, 0x32, 0x32, 0xA6, 0x82,
+  0xCD, 0x28, 0xD8, 0xC3, 0x84, 0x00, 0x55, 0xB9, 0x4F, 0x0E, 0x61, 0xCF, 0x19, 0xAC, 0xAF, 0xDE,
+  0x4D, 0x92, 0x5C, 0x90, 0x24, 0x23, 0xA3, 0x22, 0x8A, 0xC8, 0xF9, 0xE9, 0x47, 0xE2, 0x32, 0x7F,
+  0xEC, 0x93, 0xCE, 0x10, 0x04, 0xF4, 0xD8, 0x77, 0x3A, 0x4D, 0x23, 0xE6, 0xC7, 0xE3, 0x2C, 0xB9,
+  0xF4, 0x79, 0xD2, 0x09, 0xE4, 0x30, 0xCE, 0x57, 0x13, 0x26, 0x42, 0xA4, 0x79, 0x2B, 0x08, 0xD6,
+  0x4C, 0xF4, 0x7C, 0x72, 0x06, 0xBA, 0xF6, 0x4F, 0x8E, 0xC8, 0x25, 0x9B, 0x13, 0xB0, 0x3A, 0x49,
+  0x05, 0x4F, 0x62, 0x1A, 0x49, 0x23, 0x8B, 0x9C, 0x85, 0x84, 0x8F, 0xC8, 0x3C, 0x29, 0xB2, 0xD2,
+  0xA0, 0x8C, 0xFD, 0x56, 0xF0, 0x8C, 0xE5, 0x84, 0x0B, 0x9F, 0x7C, 0x64, 0xF4, 0x8A, 0x91, 0xF7,
+  0xFA, 0xD5, 0x20, 0xA2, 0xF1, 0x25, 0xEE, 0x39, 0x63, 0xD1, 0x9C, 0x24, 0x31, 0x09, 0x61, 0xE2,
+  0x50, 0x90, 0x5F, 0x3F, 0x9C, 0x1C, 0xBE, 0x07, 0xAF, 0x67, 0x0C, 0x7C, 0x1D, 0x8F, 0xA5, 0x6C,
+  0x15, 0x4E, 0x32, 0xA5, 0x69, 0x8A, 0x43, 0x30, 0xD9, 0xDA, 0xB5, 0x4F, 0x4E, 0xD9, 0x30, 0x99,
+  0x4E, 0x59, 0x1C, 0xB2, 0xB0, 0x85, 0x76, 0xC8, 0xB7, 0x45, 0x1A, 0x25, 0x34, 0x04, 0x07, 0x4D,
+  0xD1, 0x7B, 0x2E, 0x93, 0xCE, 0xD2, 0x4B, 0x3C, 0x92, 0x27, 0x72, 0x92, 0x16, 0x3C, 0xA4, 0x31,
+  0x39, 0x39, 0xEE, 0x9F, 0x91, 0x51, 0x06, 0xD0, 0xCA, 0xD1, 0x2A, 0xDB, 0xAD, 0xB3, 0x09, 0x1F,
+  0x4E, 0xC8, 0x28, 0xC9, 0x66, 0x34, 0x0B, 0x73, 0x58, 0x24, 0xC0, 0x50, 0xD8, 0xB9, 0xDC, 0x1E,
+  0xCB, 0x45, 0xEE, 0x77, 0x82, 0x14, 0x02, 0x0A, 0x33, 0xA6, 0x84, 0x87, 0xDD, 0xED, 0x34, 0x4B,
+  0xAE, 0x78, 0x0E, 0x33, 0xDE, 0xC1, 0xC8, 0x76, 0x6F, 0x8B, 0x90, 0xCE, 0xE4, 0x55, 0xEF, 0x33,
+  0x6F, 0xBE, 0xE3, 0x10, 0xFB, 0x57, 0x72, 0x20, 0xA2, 0x03, 0x16, 0xF5, 0xFA, 0xFD, 0xA3, 0x9F,
+  0x5B, 0xA4, 0xC3, 0xE3, 0xB4, 0x10, 0x72, 0x69, 0x9E, 0xF3, 0x70, 0x5B, 0x21, 0x5C, 0xFF, 0x1E,
+  0x00, 0x1E, 0xD5, 0xE4, 0xCE, 0x20, 0x0B, 0xD4, 0x3F, 0x95, 0x80, 0x13, 0x9A, 0xE7, 0xB3, 0x24,
+  0x0B, 0x6B, 0x42, 0x52, 0x3D, 0x68, 0x04, 0x55, 0xCF, 0x98, 0x6E, 0xF6, 0xF3, 0x4A, 0xE1, 0xDA,
+  0xDE, 0x73, 0xED, 0xC1, 0x25, 0x93, 0xDF, 0x2F, 0x81, 0x0D, 0x70, 0x56, 0x53, 0xAE, 0xBD, 0x66,
+  0x74, 0x97, 0x8F, 0x2A, 0x91, 0x54, 0x82, 0xB6, 0x5E, 0xEF, 0xFC, 0x69, 0x9B, 0xA4, 0x11, 0x1D,
+  0xB2, 0x49, 0x12, 0x81, 0x8E, 0xEE, 0xF6, 0x32, 0xEA, 0x50, 0xF4, 0x3A, 0x44, 0xDA, 0x76, 0xA3,
+  0x61, 0xF9, 0x94, 0x46, 0x51, 0xAF, 0xCA, 0x87, 0x5A, 0xC2, 0x48, 0x3B, 0xED, 0x44, 0xD8, 0xFD,
+  0xEB, 0x9E, 0xBF, 0xFB, 0x97, 0xD7, 0xFE, 0xAE, 0xFF, 0xD3, 0x4E, 0xEB, 0xD5, 0xCE, 0xCE, 0x8E,
+  0x01, 0xF8, 0xDA, 0xD4, 0xB9, 0x5F, 0x66, 0x68, 0x30, 0xCD, 0x38, 0x48, 0x48, 0x51, 0x69, 0x85,
+  0x26, 0x25, 0xE6, 0x45, 0x24, 0xDA, 0xDA, 0xAA, 0x17, 0x63, 0xD1, 0x0E, 0x14, 0x44, 0xB5, 0x10,
+  0x9F, 0x9C, 0x6B, 0xE4, 0x9A, 0x0C, 0x83, 0xDD, 0x25, 0xB3, 0x4D, 0x29, 0x45, 0x5C, 0xE4, 0x29,
+  0x66, 0xF2, 0xF7, 0x6F, 0x4D, 0x58, 0xD9, 0xFC, 0xE5, 0xF0, 0xEF, 0xA5, 0x59, 0x9D, 0x40, 0x79,
+  0x66, 0x15, 0x70, 0x50, 0xCB, 0x2F, 0x6C, 0x5E, 0x0B, 0x1D, 0x4D, 0xF9, 0x57, 0xD0, 0x6C, 0x42,
+  0x57, 0x3E, 0x6E, 0x86, 0xA0, 0xA6, 0xB6, 0x25, 0x20, 0x2B, 0x6F, 0x7C, 0xAD, 0xD0, 0x6C, 0x0D,
+  0xAC, 0x8A, 0x9E, 0x1B, 0xB2, 0x11, 0x2D, 0x22, 0x21, 0xFD, 0xA5, 0x5D, 0xF9, 0xEB, 0xFE, 0x01,
+  0x01, 0x66, 0x85, 0xDD, 0xE6, 0x6D, 0x45, 0x30, 0x92, 0x2F, 0xC6, 0x3C, 0x37, 0x91, 0x56, 0x3C,
+  0xB1, 0xC4, 0x08, 0xDE, 0xA6, 0x7D, 0xF7, 0xD5, 0x0A, 0x19, 0x62, 0x43, 0x60, 0x5E, 0x3D, 0x05,
+  0xE5, 0x8C, 0xAF, 0x45, 0x16, 0x95, 0x89, 0x68, 0x8D, 0xDC, 0x01, 0x63, 0x03, 0x15, 0x8C, 0x59,
+  0x53, 0xE2, 0xA4, 0x09, 0xCB, 0x4A, 0xC4, 0x04, 0x4A, 0xD4, 0x6A, 0x17, 0x1C, 0x1B, 0x3E, 0x4D,
+  0x8B, 0x41, 0xC4, 0x87, 0x35, 0x2A, 0x54, 0x06, 0x4B, 0x31, 0x08, 0xD3, 0x2C, 0x29, 0xC0, 0x05,
+  0x00, 0xBC, 0xA3, 0x11, 0x91, 0x6C, 0x03, 0xDC, 0xD7, 0xB0, 0x29, 0x4D, 0xA2, 0x90, 0x0A, 0xC1,
+  0xA6, 0xA9, 0x58, 0xF2, 0x1A, 0x30, 0x37, 0x0A, 0x9B, 0x71, 0x31, 0xB9, 0x9D, 0x2D, 0xE0, 0xC9,
+  0x1C, 0x68, 0x7A, 0x23, 0x74, 0x8E, 0x30, 0xD1, 0xAE, 0xC0, 0x4E, 0x77, 0x9A, 0xD7, 0x5D, 0xC7,
+  0xF5, 0x9B, 0xAF, 0xD3, 0xDC, 0xF8, 0xAE, 0x36, 0xA4, 0xE8, 0x27, 0x2E, 0xA6, 0x03, 0x96, 0xAD,
+  0xF6, 0x81, 0x21, 0x1D, 0x95, 0x3C, 0x8A, 0x95, 0x79, 0xA9, 0x4F, 0x63, 0x84, 0xFC, 0xB4, 0xB3,
+  0x03, 0xAA, 0xE5, 0xEE, 0xC1, 0xD1, 0x64, 0x46, 0x63, 0x41, 0x22, 0x0E, 0xD5, 0x45, 0xB9, 0xEC,
+  0x8A, 0x53, 0xB5, 0x2B, 0x70, 0xCD, 0xF7, 0x79, 0x83, 0x44, 0x2B, 0x2A, 0x0F, 0xD6, 0x15, 0x16,
+  0xE7, 0x58, 0x6B, 0xE5, 0xD4, 0x09, 0xCD, 0x97, 0xEA, 0xCC, 0x2A, 0x1F, 0xA0, 0xA1, 0x83, 0x42,
+  0x08, 0x04, 0x9C, 0xDC, 0x8B, 0x7A, 0xD8, 0x06, 0xBF, 0x0D, 0x21, 0x64, 0x97, 0x80, 0x15, 0x50,
+  0x65, 0x36, 0x71, 0x1C, 0x47, 0x73, 0xD7, 0xDB, 0xEE, 0xF5, 0x51, 0x7D, 0xB9, 0x33, 0x1C, 0xED,
+  0x04, 0x6A, 0x61, 0xEF, 0x7E, 0x02, 0x4F, 0x4C, 0x41, 0x29, 0xA5, 0xBD, 0x20, 0xFB, 0x69, 0x6A,
+  0xCB, 0xE9, 0x04, 0x58, 0x7E, 0xE0, 0xE7, 0x04, 0xED, 0xEC, 0x84, 0xFC, 0x4A, 0x46, 0x64, 0x9A,
+  0x8F, 0xA1, 0xDF, 0x09, 0xE0, 0x11, 0x06, 0xF3, 0x61, 0xC6, 0x53, 0xD1, 0xDB, 0xA2, 0xF9, 0x3C,
+  0x1E, 0x02, 0xD5, 0xC5, 0xAA, 0x8C, 0xA1, 0x5D, 0xAE, 0x47, 0xAE, 0xC1, 0x16, 0x91, 0xCD, 0xE5,
+  0x4F, 0x82, 0xAD, 0x08, 0x50, 0x58, 0xB6, 0x4B, 0xBA, 0x84, 0xCE, 0x28, 0x90, 0xCD, 0x88, 0x89,
+  0xE1, 0xC4, 0x75, 0x82, 0x19, 0x1F, 0x71, 0xC7, 0x6B, 0x5B, 0x93, 0x66, 0xE5, 0x9C, 0x6C, 0xD7,
+  0xBF, 0xC8, 0xD1, 0x4A, 0xF5, 0x1A, 0xFA, 0xBB, 0x02, 0xEA, 0xB2, 0xF0, 0xC7, 0x4C, 0x1C, 0x46,
+  0x0C, 0x7F, 0x7D, 0x3B, 0x3F, 0x0A, 0x5D, 0x07, 0x2B, 0x9B, 0xE3, 0xF9, 0x10, 0xD3, 0x82, 0xC1,
+  0xE2, 0x99, 0x8F, 0x03, 0xE4, 0xE6, 0x86, 0x38, 0x4E, 0x7B, 0xCB, 0x56, 0xBF, 0x77, 0x4B, 0xBD,
+  0xA9, 0xEB, 0x75, 0x13, 0x8A, 0xCA, 0x84, 0xBD, 0xFB, 0x99, 0xA0, 0x01, 0x6F, 0x59, 0x51, 0xF8,
+  0x26, 0x09, 0xC0, 0x90, 0xC2, 0x87, 0xB4, 0x35, 0x16, 0x6D, 0x14, 0xA4, 0x59, 0xB2, 0x26, 0x48,
+  0x8F, 0xDD, 0xDC, 0xDC, 0xB9, 0xBA, 0x64, 0xC5, 0xDA, 0xFA, 0x72, 0xF4, 0x1E, 0x12, 0x2A, 0x72,
+  0xAA, 0x89, 0xA8, 0x86, 0xEF, 0x21, 0xC3, 0x4A, 0xD2, 0x9A, 0x10, 0x6B, 0xFC, 0xE6, 0x06, 0x92,
+  0x4E, 0x07, 0x27, 0x08, 0xC8, 0xA7, 0xE3, 0xB3, 0xC3, 0x16, 0xC9, 0x21, 0x4D, 0x22, 0xD6, 0xD4,
+  0x00, 0x2E, 0xDB, 0x9E, 0x0A, 0x5A, 0xC0, 0x35, 0xF4, 0x8A, 0x72, 0xC8, 0xF2, 0x88, 0xB5, 0xC8,
+  0x12, 0x94, 0x41, 0xD6, 0x02, 0x7A, 0x2F, 0x88, 0x2B, 0x54, 0x5B, 0xC0, 0x9F, 0x8C, 0x65, 0x02,
+  0xF5, 0x95, 0x65, 0x59, 0x92, 0xC1, 0x50, 0x9B, 0x2C, 0xB6, 0x16, 0xCB, 0x68, 0x45, 0x21, 0x9F,
+  0x01, 0x83, 0x1A, 0xB1, 0x2A, 0xFE, 0x12, 0x3F, 0xDD, 0xFB, 0x01, 0xAE, 0x5D, 0xAE, 0x32, 0x7D,
+  0xD0, 0xA6, 0x95, 0x66, 0x8E, 0xBD, 0x7A, 0x45, 0x42, 0x34, 0xC0, 0x7C, 0x38, 0x9C, 0x4C, 0x12,
+  0xE8, 0xC4, 0x1C, 0x64, 0x2D, 0x18, 0x51, 0xD5, 0x39, 0x6F, 0x5D, 0x3B, 0x07, 0xEA, 0x7C, 0xD2,
+  0x3C, 0x83, 0x14, 0x77, 0x5A, 0x00, 0x99, 0x14, 0x72, 0x9B, 0xE2, 0x76, 0x02, 0x04, 0xAB, 0xB3,
+  0x68, 0x10, 0x3C, 0x6C, 0xB4, 0xC8, 0x87, 0xFE, 0xF1, 0x27, 0x0C, 0x1D, 0xF8, 0x95, 0x8F, 0xE6,
+  0xEE, 0x35, 0xDA, 0xDD, 0x30, 0x26, 0x2C, 0x3C, 0xB2, 0x90, 0xB0, 0x5E, 0x6B, 0x2C, 0x64, 0x3B,
+  0xD8, 0xC9, 0xE3, 0x98, 0x65, 0x67, 0xEC, 0xBB, 0x80, 0x7D, 0x39, 0xB2, 0xEB, 0x94, 0x4E, 0x0B,
+  0x7D, 0x73, 0x0A, 0x91, 0xC5, 0x01, 0x53, 0x5D, 0x1D, 0x39, 0x62, 0x68, 0x67, 0x7D, 0x80, 0xC8,
+  0x4A, 0x57, 0x1B, 0xDA, 0xAA, 0xB9, 0xDB, 0x24, 0x4A, 0xF7, 0xDE, 0xF9, 0x55, 0x39, 0x5D, 0xE7,
+  0xC6, 0xA6, 0xB5, 0x4B, 0x29, 0x55, 0xAD, 0x2D, 0xF3, 0x62, 0xD3, 0xEA, 0x5B, 0x29, 0x55, 0xAD,
+  0xAF, 0x92, 0x62, 0x23, 0x58, 0x6E, 0x65, 0x54, 0x25, 0xC1, 0xCA, 0x08, 0x10, 0xF1, 0x49, 0x56,
+  0x32, 0xF7, 0x21, 0x79, 0xE5, 0x21, 0xA9, 0xC8, 0x54, 0x5A, 0xC1, 0xB6, 0xEB, 0xD9, 0xEE, 0x3F,
+  0x84, 0x2F, 0x1D, 0xA5, 0x86, 0xF6, 0x78, 0xA3, 0xF4, 0x5D, 0xA3, 0x72, 0x42, 0xC3, 0xDA, 0x45,
+  0x09, 0x41, 0x63, 0xB2, 0x50, 0x30, 0xD3, 0xDC, 0xEB, 0xE3, 0xA3, 0xA1, 0x5E, 0xE8, 0x5C, 0xDD,
+  0x67, 0x99, 0x9F, 0x5C, 0x7A, 0x7A, 0x93, 0x0F, 0x02, 0xEE, 0xB7, 0xB2, 0x5E, 0x22, 0x0A, 0xC9,
+  0x08, 0x48, 0x04, 0x8F, 0x77, 0xCF, 0xAF, 0x33, 0xB0, 0x9F, 0x8A, 0x22, 0x5F, 0xC0, 0xEF, 0xA8,
+  0x6E, 0xF1, 0xAD, 0xAD, 0xA5, 0x67, 0x70, 0xB8, 0xCE, 0x62, 0x72, 0x9D, 0x5C, 0xB6, 0x46, 0x34,
+  0xCA, 0x59, 0x83, 0xA8, 0x99, 0x2D, 0xB3, 0xA4, 0x21, 0xCD, 0x5D, 0xA8, 0xF9, 0x8B, 0xAD, 0x07,
+  0x5A, 0xE4, 0x54, 0x16, 0xE9, 0x33, 0xB8, 0x4A, 0x2B, 0x08, 0x08, 0x79, 0x29, 0x25, 0x2B, 0xC1,
+  0x96, 0x19, 0x22, 0x2B, 0x36, 0x5A, 0x51, 0xA3, 0xBF, 0x27, 0xD8, 0x83, 0x1E, 0x92, 0xA4, 0xA9,
+  0x6C, 0x61, 0xBE, 0x48, 0xFA, 0x32, 0xC8, 0x26, 0x16, 0x6B, 0x5D, 0xB3, 0xA3, 0xAC, 0x69, 0xD9,
+  0x4B, 0x94, 0x69, 0x9B, 0xE9, 0x40, 0xB5, 0x36, 0xD2, 0xE8, 0x87, 0x98, 0x0C, 0xBD, 0x0B, 0x9E,
+  0xE0, 0xCB, 0xC3, 0xB9, 0x1B, 0x27, 0x04, 0xF9, 0x13, 0xEF, 0x7A, 0xE2, 0x31, 0xF3, 0x7C, 0xDF,
+  0x77, 0x2A, 0x86, 0xAD, 0xF3, 0x0F, 0x12, 0x14, 0x54, 0x9E, 0x0F, 0x09, 0x8F, 0x73, 0x92, 0x15,
+  0x50, 0x5C, 0x54, 0xD7, 0x3F, 0xA0, 0xC3, 0x4B, 0xE8, 0x8B, 0x8B, 0x38, 0x6C, 0xC3, 0xB9, 0x0B,
+  0x99, 0x6D, 0x82, 0x97, 0x29, 0x97, 0x2C, 0x26, 0x45, 0x2C, 0x78, 0x84, 0x27, 0x25, 0x8C, 0x58,
+  0xC4, 0xF2, 0xE5, 0x1D, 0xA1, 0x16, 0x38, 0xA3, 0xA3, 0x48, 0x57, 0xAE, 0x50, 0x3B, 0x82, 0x4E,
+  0x8A, 0xB8, 0x11, 0x83, 0x6C, 0x07, 0x9B, 0x77, 0xDA, 0xF0, 0xA3, 0x43, 0xF6, 0xF0, 0xE7, 0xCB,
+  0x97, 0x26, 0x4E, 0x55, 0xEA, 0xAE, 0x4F, 0x5E, 0xDC, 0x58, 0xA0, 0xFC, 0xFC, 0x46, 0x4A, 0xEF,
+  0x4A, 0xA0, 0x48, 0x3D, 0xED, 0xDA, 0xDA, 0x0B, 0x2B, 0x85, 0xEC, 0xEE, 0x45, 0x25, 0xD1, 0x85,
+  0x0F, 0x27, 0x20, 0x6C, 0x7B, 0x9F, 0x75, 0xC1, 0x85, 0x29, 0x8B, 0xF1, 0xAE, 0xC9, 0xF1, 0x4C,
+  0x50, 0x2F, 0x34, 0x9E, 0x6D, 0x2C, 0x29, 0x70, 0x2B, 0x91, 0x31, 0x9B, 0x11, 0xA8, 0xBA, 0x53,
+  0x9E, 0x33, 0x17, 0x0F, 0x8E, 0xDD, 0x1E, 0xBA, 0xE3, 0x8C, 0x4F, 0x19, 0x1C, 0x22, 0x70, 0xA4,
+  0x41, 0x76, 0xE1, 0x14, 0xEC, 0x79, 0x2A, 0xEC, 0x15, 0x58, 0x94, 0xD6, 0x56, 0xA5, 0x72, 0xB1,
+  0xA2, 0x46, 0x64, 0x4C, 0x57, 0x90, 0x47, 0xA0, 0x61, 0x5F, 0x9D, 0x4F, 0x10, 0x11, 0xA5, 0x18,
+  0x83, 0x80, 0xBB, 0xB9, 0xB1, 0x5C, 0xB2, 0x82, 0x1C, 0x97, 0x58, 0xAA, 0xF2, 0xAF, 0x1D, 0x71,
+  0xB7, 0xEE, 0x72, 0xCF, 0xB7, 0x43, 0x23, 0x1D, 0x4F, 0x5E, 0xBC, 0x20, 0xA5, 0xF7, 0xBB, 0xE8,
+  0x7D, 0xAD, 0x92, 0x41, 0x71, 0x79, 0x0C, 0xAB, 0x39, 0xA7, 0xAC, 0x94, 0xF0, 0x8C, 0x1C, 0x9D,
+  0xA8, 0x7C, 0x85, 0x08, 0xF3, 0x54, 0x35, 0x9B, 0x9E, 0x09, 0x26, 0x83, 0x2C, 0x7D, 0x9A, 0x06,
+  0xCD, 0x99, 0x3E, 0xE9, 0xAB, 0x54, 0xD7, 0xAA, 0xC8, 0x9B, 0x6A, 0x4B, 0x30, 0x16, 0x27, 0x82,
+  0x58, 0x9B, 0xAA, 0xB8, 0xF1, 0x69, 0xDC, 0x54, 0x59, 0x21, 0x79, 0xC9, 0x31, 0x94, 0x02, 0x09,
+  0xDC, 0xBF, 0xAB, 0x69, 0x74, 0x3F, 0xF4, 0xBD, 0x55, 0xDC, 0x63, 0xB5, 0x8E, 0xFF, 0xB3, 0xD6,
+  0xEF, 0xFF, 0xFD, 0xCF, 0x0F, 0xEB, 0x7F, 0x9E, 0x58, 0x3A, 0xCA, 0x8B, 0xF0, 0x5B, 0x84, 0x01,
+  0x18, 0x7B, 0xC7, 0xB3, 0x5C, 0xD5, 0x8F, 0xDB, 0x0B, 0x88, 0xAB, 0x6E, 0x7F, 0xE7, 0x24, 0x85,
+  0xEE, 0x89, 0xC3, 0x3C, 0x76, 0x05, 0xB5, 0x02, 0x12, 0xBE, 0x64, 0x14, 0xB5, 0xCD, 0xAC, 0x48,
+  0xF1, 0x3A, 0x4A, 0x5E, 0xC9, 0x79, 0xF6, 0x61, 0x33, 0x2D, 0xE9, 0x64, 0xB9, 0x42, 0x95, 0x7D,
+  0x4F, 0x91, 0xFE, 0xF0, 0xC6, 0x07, 0x44, 0x56, 0x9D, 0x0F, 0x3C, 0xAC, 0x6A, 0x7E, 0x4C, 0xFA,
+  0x3E, 0xAD, 0x97, 0x40, 0xCE, 0x50, 0xDE, 0xB6, 0x3F, 0x43, 0x60, 0x57, 0x39, 0xC7, 0x7B, 0x11,
+  0xE9, 0x70, 0xE3, 0xE9, 0xB3, 0x09, 0x53, 0xD9, 0xA9, 0xEA, 0xB8, 0x2B, 0xEF, 0x97, 0xF4, 0x01,
+  0x83, 0x8F, 0xC7, 0x20, 0xB1, 0xF4, 0xAA, 0x47, 0xFE, 0xF8, 0xFD, 0x5F, 0x10, 0x06, 0x90, 0x35,
+  0xE5, 0x31, 0x9F, 0xD2, 0x48, 0x76, 0xA5, 0x78, 0x0A, 0x09, 0x4A, 0x1A, 0x58, 0x53, 0x5D, 0xF1,
+  0xFD, 0x29, 0xCB, 0xD3, 0x5B, 0x55, 0xA0, 0x5C, 0xF8, 0xDF, 0x3D, 0x82, 0xE1, 0x7F, 0xD8, 0x21,
+  0xA0, 0x7A, 0xE3, 0x43, 0xC7, 0xBC, 0x90, 0xE6, 0xDB, 0xAF, 0x94, 0xC9, 0x66, 0x0F, 0xA6, 0x4B,
+  0x36, 0x14, 0x6B, 0x55, 0x6C, 0x8D, 0x9E, 0x72, 0xA6, 0x8D, 0xA1, 0x87, 0xA1, 0xA8, 0x24, 0xCB,
+  0x65, 0x18, 0x95, 0xB2, 0x2B, 0x30, 0x19, 0x4B, 0x2B, 0x34, 0xD5, 0xF1, 0x54, 0x22, 0x4A, 0x46,
+  0xBC, 0x62, 0x6C, 0xA8, 0x22, 0x69, 0x82, 0x9F, 0x5D, 0x48, 0x72, 0xA9, 0xEE, 0x13, 0x29, 0xB9,
+  0x48, 0xB0, 0x2D, 0xC3, 0x42, 0xDA, 0x26, 0x71, 0x32, 0x83, 0xC6, 0x8E, 0x0D, 0x2F, 0xAD, 0xCC,
+  0x52, 0x5A, 0x1F, 0x51, 0xD7, 0xFA, 0x0A, 0x98, 0x9B, 0x7A, 0x86, 0x65, 0xE8, 0x94, 0xE5, 0x7F,
+  0x6F, 0x65, 0xFD, 0x97, 0x91, 0x4E, 0xF1, 0x1B, 0xA3, 0x6B, 0x3C, 0x50, 0xEF, 0x01, 0xCA, 0x3E,
+  0x60, 0x4F, 0x36, 0x02, 0x7B, 0x77, 0x76, 0x02, 0x3F, 0xA8, 0x1B, 0xD8, 0x5B, 0x6E, 0x07, 0x56,
+  0xB4, 0x04, 0x8F, 0x74, 0xDF, 0x72, 0x77, 0x80, 0x97, 0xC9, 0xBA, 0xBD, 0x6B, 0x93, 0x7E, 0x32,
+  0x12, 0xFB, 0x27, 0xE0, 0xD7, 0x29, 0xC5, 0x1E, 0x9B, 0x42, 0xE9, 0x45, 0xE8, 0xE0, 0x14, 0x13,
+  0x73, 0xCC, 0x7F, 0xC7, 0x32, 0xCA, 0xE0, 0xA3, 0x76, 0x8F, 0xF3, 0x60, 0xBB, 0x20, 0xF7, 0x0A,
+  0x61, 0x81, 0x04, 0xD4, 0x0D, 0x0C, 0x66, 0x9D, 0x76, 0x0D, 0x7D, 0x3A, 0xFE, 0xE6, 0x5A, 0x5C,
+  0xDD, 0x6B, 0x67, 0x54, 0x35, 0x0E, 0x03, 0x96, 0x8B, 0x26, 0x1B, 0x81, 0xC5, 0x40, 0x36, 0x05,
+  0xDE, 0x4E, 0x29, 0x3E, 0x33, 0x05, 0xDB, 0xCA, 0x31, 0x53, 0xC2, 0x21, 0xB0, 0x56, 0x55, 0x84,
+  0xA7, 0xB2, 0x7C, 0xDA, 0x61, 0xAD, 0xA3, 0x4A, 0xA5, 0xFE, 0x80, 0xE6, 0x78, 0x4B, 0xA6, 0x05,
+  0xB5, 0xAD, 0xB7, 0x32, 0x87, 0x83, 0x7F, 0xC8, 0x6F, 0x01, 0x6F, 0x5A, 0x5F, 0x82, 0x2F, 0x41,
+  0x00, 0x39, 0x9F, 0x0B, 0x17, 0x97, 0x78, 0x9E, 0x59, 0xE9, 0xE0, 0x84, 0x56, 0x10, 0x60, 0xD0,
+  0x71, 0xC8, 0x16, 0xA1, 0xA7, 0xB8, 0xD8, 0xBC, 0x9F, 0x9F, 0x7E, 0xD4, 0x2B, 0xFD, 0x04, 0x38,
+  0x95, 0xC7, 0xF6, 0x44, 0xDD, 0x1D, 0xB3, 0xF1, 0xB9, 0x2C, 0xEA, 0xDF, 0x9E, 0x5F, 0xE3, 0xD4,
+  0x45, 0xA0, 0xB6, 0x91, 0x07, 0xCF, 0xAF, 0x59, 0x8C, 0x9F, 0x83, 0xCE, 0x4F, 0x8F, 0x0E, 0x92,
+  0x29, 0xA4, 0x2B, 0x04, 0xC3, 0xAD, 0xF6, 0xB8, 0x08, 0xCC, 0x97, 0x81, 0xAF, 0xCA, 0x0D, 0xDF,
+  0x56, 0x08, 0x87, 0x29, 0x4B, 0xBC, 0xAB, 0xF4, 0x6D, 0x62, 0x5C, 0x72, 0x37, 0xE5, 0x36, 0x88,
+  0x53, 0x7E, 0xB3, 0x72, 0x5A, 0x65, 0x63, 0x24, 0x81, 0xBF, 0x96, 0x8E, 0x09, 0x84, 0xA9, 0x65,
+  0x87, 0xAC, 0x46, 0xC9, 0xC6, 0xFB, 0x68, 0xF2, 0x12, 0x79, 0x3E, 0x28, 0x61, 0x5E, 0x42, 0x74,
+  0x48, 0xDF, 0x86, 0x18, 0xCB, 0x00, 0x46, 0x92, 0xE3, 0xCC, 0x77, 0x67, 0xC7, 0x56, 0xBA, 0x22,
+  0x3B, 0x9F, 0xA4, 0x4E, 0x23, 0x5A, 0xB7, 0xF0, 0x75, 0x55, 0x16, 0x25, 0x2C, 0xB7, 0xE8, 0x3F,
+  0x4A, 0xAF, 0x6C, 0xDA, 0x57, 0x26, 0xFA, 0xD6, 0xD6, 0x3A, 0xCD, 0x0F, 0xC9, 0xFA, 0x43, 0x94,
+  0x8F, 0xB9, 0x89, 0x29, 0x6A, 0x93, 0xCB, 0xBA, 0x0B, 0x8C, 0x15, 0x0D, 0xCE, 0xD3, 0x0E, 0x28,
+  0x35, 0x0B, 0x6E, 0xF5, 0x88, 0xAB, 0xCD, 0xC0, 0x03, 0xCC, 0xAD, 0x83, 0x89, 0xA0, 0x19, 0x90,
+  0xA6, 0xFB, 0x18, 0x1B, 0xFA, 0xB8, 0x16, 0xF5, 0xEF, 0x9F, 0x54, 0x25, 0xEC, 0x3E, 0x37, 0x0B,
+  0x52, 0xE9, 0x57, 0x9A, 0x6E, 0x3A, 0xF9, 0xDE, 0xF3, 0x6E, 0x41, 0x1D, 0x71, 0x31, 0x55, 0x1E,
+  0x74, 0x72, 0x3F, 0x51, 0x1B, 0xC7, 0x92, 0x72, 0xA0, 0x49, 0x1B, 0xDA, 0x38, 0xF3, 0x69, 0xFD,
+  0xCF, 0xFE, 0x6E, 0x89, 0x1D, 0x99, 0x17, 0x0F, 0x91, 0xFD, 0x4E, 0x15, 0x26, 0x10, 0x27, 0x55,
+  0x80, 0x73, 0x9C, 0x15, 0x37, 0x1C, 0x8F, 0x09, 0x76, 0xE5, 0x6E, 0x59, 0x54, 0x14, 0xAA, 0xAB,
+  0x6F, 0x15, 0xF1, 0x05, 0x6C, 0xE3, 0x18, 0xAA, 0xE1, 0xFE, 0xC9, 0x5B, 0x79, 0x38, 0x2D, 0x83,
+  0x2A, 0x09, 0x7D, 0xAD, 0xC2, 0x04, 0x97, 0xA4, 0x6F, 0x45, 0xEC, 0x78, 0x55, 0x36, 0xC8, 0x0A,
+  0x61, 0x9F, 0xB2, 0x86, 0x90, 0x65, 0x82, 0xE9, 0x85, 0xAE, 0xA3, 0x8E, 0xBF, 0x55, 0x81, 0x1F,
+  0xF8, 0xF2, 0x4F, 0xA1, 0xC0, 0x58, 0xFD, 0xA6, 0x7A, 0x21, 0x8F, 0x7B, 0x96, 0x16, 0xEB, 0x8D,
+  0xBD, 0x49, 0xB4, 0x5C, 0xFD, 0x81, 0x51, 0xE5, 0x32, 0x9C, 0x24, 0xBF, 0x58, 0xFB, 0x53, 0x9A,
+  0x41, 0xE5, 0xF8, 0xC8, 0x46, 0x72, 0xEE, 0xEB, 0xF4, 0xBB, 0x35, 0x43, 0x7F, 0x6B, 0x84, 0x17,
+  0x1A, 0xCD, 0x76, 0x87, 0x3B, 0x1B, 0x6D, 0x3A, 0x2B, 0x62, 0xD3, 0x8F, 0x7F, 0xE5, 0x02, 0x1B,
+  0x91, 0x5E, 0x9A, 0x8D, 0x3C, 0x58, 0xE1, 0x03, 0xD7, 0x43, 0x53, 0x71, 0x30, 0xE1, 0x51, 0xE8,
+  0x0E, 0xEC, 0x4B, 0x05, 0xF8, 0x7F, 0xC6, 0xE3, 0x30, 0x99, 0xF9, 0x34, 0x0C, 0x0F, 0xE1, 0xDC,
+  0x25, 0x3E, 0x22, 0xB9, 0xC2, 0x36, 0x5C, 0x07, 0x73, 0x10, 0x10, 0x0D, 0x5E, 0xEF, 0xF6, 0x20,
+  0xC0, 0xEA, 0xB3, 0x64, 0x7B, 0x65, 0x5C, 0xDA, 0x12, 0xE6, 0x9D, 0xC0, 0x7C, 0xD1, 0xEC, 0x04,
+  0x58, 0x2D, 0xF0, 0xA7, 0xFC, 0x2B, 0xB2, 0x7F, 0x03, 0x95, 0x05, 0x90, 0x39, 0x5B, 0x26, 0x00,
+  0x00,
+};
+
+static const web_asset_t web_assets[] = {
+  {"index_ov2640", "text/html", web_index_ov2640_gz, 6465, "\"439b9bc543a78503\""},
+  {"index_ov3660", "text/html", web_index_ov3660_gz, 8432, "\"85f4c4ac89926a62\""},
+  {"index_ov5640", "text/html", web_index_ov5640_gz, 8645, "\"01d8beb0420b4b0e\""},
+  {"setup", "text/html", web_setup_gz, 2881, "\"0b3a38f8bfd7c13c\""},
+};
+#define WEB_ASSET_COUNT (sizeof(web_assets) / sizeof(web_assets[0]))
+
+#endif // WEB_ASSETS_H
@@ -0,0 +1,143 @@
+#include "wifi_fsm.h"
+
+// Wrap-safe "now is at or past t"
+static bool reached(uint32_t now_ms, uint32_t t) {
+  return (int32_t)(now_ms - t) >= 0;
+}
+
+static uint32_t start_connect(wifi_fsm_t *fsm, uint32_t now_ms) {
+  fsm->state = WIFI_FSM_CONNECTING;
+  fsm->deadline_ms = now_ms + fsm->timeout_ms;
+  // The radio cannot associate while it is scanning; begin once the scan is done
+  if (fsm->scanning) {
+    fsm->begin_pending = true;
+    return 0;
+  }
+  fsm->connects++;
+  return WIFI_FSM_ACT_BEGIN;
+}
+
+// Give up on the current attempt and schedule the next one
+static void fail(wifi_fsm_t *fsm, uint32_t now_ms) {
+  fsm->state = WIFI_FSM_FAILED;
+  fsm->retry_at_ms = now_ms + fsm->retry_ms;
+  fsm->retry_ms = fsm->retry_ms < WIFI_FSM_RETRY_MAX_MS / 2 ? fsm->retry_ms * 2 : WIFI_FSM_RETRY_MAX_MS;
+}
+
+static uint32_t start_scan(wifi_fsm_t *fsm, uint32_t now_ms) {
+  fsm->scan_pending = false;
+  fsm->scanning = true;
+  fsm->scan_deadline_ms = now_ms + fsm->scan_timeout_ms;
+  return WIFI_FSM_ACT_SCAN;
+}
+
+void wifi_fsm_init(wifi_fsm_t *fsm, uint32_t connect_timeout_ms, uint32_t scan_timeout_ms, bool connected, uint32_t creds,
+                   uint32_t now_ms) {
+  *fsm = wifi_fsm_t();
+  fsm->timeout_ms = connect_timeout_ms;
+  fsm->scan_timeout_ms = scan_timeout_ms;
+  // The boot-time connection attempt counts as request 1
+  fsm->token = 1;
+  fsm->creds = creds;
+  fsm->connects = 1;
+  fsm->retry_ms = WIFI_FSM_RETRY_MIN_MS;
+  fsm->state = WIFI_FSM_CONNECTED;
+  if (!connected) fail(fsm, now_ms);
+}
+
+uint32_t wifi_fsm_step(wifi_fsm_t *fsm, wifi_fsm_event_t ev, uint32_t now_ms, uint32_t creds) {
+  uint32_t act = 0;
+  switch (ev) {
+    case WIFI_FSM_EV_CONNECT:
+      // Same credentials already being joined or joined: keep the current request
+      if (creds == fsm->creds && (fsm->state == WIFI_FSM_CONNECTING || fsm->state == WIFI_FSM_CONNECTED)) break;
+      fsm->token++;
+      fsm->creds = creds;
+      fsm->retry_ms = WIFI_FSM_RETRY_MIN_MS;
+      act |= start_connect(fsm, now_ms);
+      break;
+
+    case WIFI_FSM_EV_SCAN:
+      if (fsm->scanning) break;
+      if (fsm->state == WIFI_FSM_CONNECTING) {
+        fsm->scan_pending = true;
+      } else {
+        act |= start_scan(fsm, now_ms);
+      }
+      break;
+
+    case WIFI_FSM_EV_GOT_IP:
+      fsm->state = WIFI_FSM_CONNECTED;
+      fsm->retry_ms = WIFI_FSM_RETRY_MIN_MS;
+      act |= WIFI_FSM_ACT_CONNECTED;
+      if (fsm->scan_pending && !fsm->scanning) act |= start_scan(fsm, now_ms);
+      break;
+
+    case WIFI_FSM_EV_DISCONNECTED:
+      // While associating, failed tries are retried by the driver until the deadline.
+      // A dropped link is rejoined explicitly rather than left to auto-reconnect.
+      if (fsm->state == WIFI_FSM_CONNECTED) {
+        fsm->drops++;
+        act |= start_connect(fsm, now_ms);
+      }
+      break;
+
+    case WIFI_FSM_EV_SCAN_DONE:
+      if (!fsm->scanning) break;
+      fsm->scanning = false;
+      act |= WIFI_FSM_ACT_COLLECT;
+      if (fsm->begin_pending) {
+        fsm->begin_pending = false;
+        fsm->deadline_ms = now_ms + fsm->timeout_ms;
+        fsm->connects++;
+        act |= WIFI_FSM_ACT_BEGIN;
+      }
+      break;
+
+    case WIFI_FSM_EV_TICK:
+      if (fsm->scanning && reached(now_ms, fsm->scan_deadline_ms)) {
+        // No completion event: treat the scan as done with whatever it found
+        act |= wifi_fsm_step(fsm, WIFI_FSM_EV_SCAN_DONE, now_ms, 0);
+      }
+      if (fsm->state == WIFI_FSM_CONNECTING && !fsm->begin_pending && reached(now_ms, fsm->deadline_ms)) {
+        fsm->failures++;
+        fail(fsm, now_ms);
+      } else if (fsm->state == WIFI_FSM_FAILED && reached(now_ms, fsm->retry_at_ms)) {
+        act |= start_connect(fsm, now_ms);
+      }
+      if (fsm->scan_pending && !fsm->scanning && fsm->state != WIFI_FSM_CONNECTING) act |= start_scan(fsm, now_ms);
+      break;
+  }
+  return act;
+}
+
+wifi_fsm_token_status_t wifi_fsm_token_status(const wifi_fsm_t *fsm, uint32_t token) {
+  if (token == 0 || token > fsm->token) return WIFI_FSM_TOKEN_UNKNOWN;
+  if (token < fsm->token) return WIFI_FSM_TOKEN_SUPERSEDED;
+  switch (fsm->state) {
+    case WIFI_FSM_CONNECTED: return WIFI_FSM_TOKEN_CONNECTED;
+    case WIFI_FSM_FAILED:    return WIFI_FSM_TOKEN_FAILED;
+    default:                 return WIFI_FSM_TOKEN_PENDING;
+  }
+}
+
+const char *wifi_fsm_state_name(wifi_fsm_state_t state) {
+  switch (state) {
+    case WIFI_FSM_IDLE:       return "idle";
+    case WIFI_FSM_CONNECTING: return "connecting";
+    case WIFI_FSM_CONNECTED:  return "connected";
+    case WIFI_FSM_FAILED:     return "failed";
+  }
+  return "?";
+}
+
+const char *wifi_fsm_token_status_name(wifi_fsm_token_status_t status) {
+  switch (status) {
+    case WIFI_FSM_TOKEN_PENDING:    return "pending";
+    case WIFI_FSM_TOKEN_CONNECTED:  return "connected";
+    case WIFI_FSM_TOKEN_FAILED:     return "failed";
+    case WIFI_FSM_TOKEN_SUPERSEDED: return "superseded";
+    case WIFI_FSM_TOKEN_UNKNOWN:    return "unknown";
+  }
+  return "?";
+}
@@ -0,0 +1,79 @@
+#ifndef WIFI_FSM_H
+#define WIFI_FSM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// State-transition core of the Wi-Fi manager. It has no Arduino or ESP-IDF
+// dependencies: the manager feeds it Wi-Fi events, connect/scan requests and
+// periodic ticks (with the time passed in), and carries out the returned actions.
+// Connect requests are identified by a token so HTTP handlers can return at once
+// and clients can poll the outcome; a request for the credentials already being
+// joined (or already joined) gets the existing token instead of a new attempt.
+// A failed join is retried on its own after a backoff that doubles per failure.
+
+// Backoff between automatic retries from FAILED
+#define WIFI_FSM_RETRY_MIN_MS 5000
+#define WIFI_FSM_RETRY_MAX_MS 300000
+
+typedef enum {
+  WIFI_FSM_IDLE = 0,     // before wifi_fsm_init
+  WIFI_FSM_CONNECTING,   // association in progress until GOT_IP or the deadline
+  WIFI_FSM_CONNECTED,
+  WIFI_FSM_FAILED,       // deadline passed; retried at retry_at_ms or by the next request
+} wifi_fsm_state_t;
+
+typedef enum {
+  WIFI_FSM_EV_CONNECT = 0,  // request: join the network described by `creds`
+  WIFI_FSM_EV_SCAN,         // request: refresh the scan cache
+  WIFI_FSM_EV_GOT_IP,
+  WIFI_FSM_EV_DISCONNECTED,
+  WIFI_FSM_EV_SCAN_DONE,
+  WIFI_FSM_EV_TICK,
+} wifi_fsm_event_t;
+
+// Actions returned by wifi_fsm_step (bit mask)
+#define WIFI_FSM_ACT_BEGIN 0x01      // (re)start association with the stored credentials
+#define WIFI_FSM_ACT_SCAN 0x02       // start an asynchronous scan
+#define WIFI_FSM_ACT_COLLECT 0x04    // read the finished scan into the cache
+#define WIFI_FSM_ACT_CONNECTED 0x08  // link is up: keep the SoftAP, start dependent services
+
+typedef enum {
+  WIFI_FSM_TOKEN_PENDING = 0,
+  WIFI_FSM_TOKEN_CONNECTED,
+  WIFI_FSM_TOKEN_FAILED,
+  WIFI_FSM_TOKEN_SUPERSEDED,  // a later request replaced this one
+  WIFI_FSM_TOKEN_UNKNOWN,
+} wifi_fsm_token_status_t;
+
+typedef struct {
+  wifi_fsm_state_t state;
+  uint32_t token;          // latest connect request (0 = none)
+  uint32_t creds;          // credential version the latest request was made for
+  uint32_t deadline_ms;    // CONNECTING gives up at this time
+  uint32_t timeout_ms;
+  bool scanning;
+  uint32_t scan_deadline_ms;
+  uint32_t scan_timeout_ms;
+  bool scan_pending;       // scan requested while associating; started afterwards
+  bool begin_pending;      // connect requested while scanning; started afterwards
+  uint32_t retry_at_ms;    // FAILED starts the next attempt at this time
+  uint32_t retry_ms;       // backoff before the next retry
+  uint32_t connects;       // associations started
+  uint32_t failures;       // attempts that hit the deadline
+  uint32_t drops;          // CONNECTED -> disconnected transitions
+} wifi_fsm_t;
+
+// `connected` seeds the state from the boot-time connection attempt
+void wifi_fsm_init(wifi_fsm_t *fsm, uint32_t connect_timeout_ms, uint32_t scan_timeout_ms, bool connected, uint32_t creds,
+                   uint32_t now_ms);
+
+// Apply one event at `now_ms`; `creds` is only used by WIFI_FSM_EV_CONNECT.
+// Returns the WIFI_FSM_ACT_* bits the caller must carry out.
+uint32_t wifi_fsm_step(wifi_fsm_t *fsm, wifi_fsm_event_t ev, uint32_t now_ms, uint32_t creds);
+
+wifi_fsm_token_status_t wifi_fsm_token_status(const wifi_fsm_t *fsm, uint32_t token);
+const char *wifi_fsm_state_name(wifi_fsm_state_t state);
+const char *wifi_fsm_token_status_name(wifi_fsm_token_status_t status);
+
+#endif // WIFI_FSM_H
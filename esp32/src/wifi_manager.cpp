@@ -0,0 +1,378 @@
+#include "wifi_manager.h"
+#include "wifi_fsm.h"
+#include "wifi_settings.h"
+#include "uploader_settings.h"
+#include "uploader.h"
+#include "frame_clock.h"
+#include "boot_graph.h"
+#include <WiFi.h>
+
+typedef struct {
+  char ssid[33];
+  int8_t rssi;
+  uint8_t channel;
+  uint8_t auth;  // wifi_auth_mode_t
+} wifi_scan_entry_t;
+
+static wifi_fsm_t fsm;
+static portMUX_TYPE fsm_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t manager_task = NULL;
+
+static wifi_scan_entry_t scan_cache[WIFI_SCAN_MAX];
+static int scan_count = 0;
+static uint32_t scan_at_ms = 0;
+static bool scan_valid = false;
+static portMUX_TYPE scan_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t fsm_apply(wifi_fsm_event_t ev, uint32_t creds) {
+  portENTER_CRITICAL(&fsm_mux);
+  uint32_t act = wifi_fsm_step(&fsm, ev, millis(), creds);
+  portEXIT_CRITICAL(&fsm_mux);
+  return act;
+}
+
+// Apply an event from another context and hand the resulting actions to the manager task
+static void fsm_post(wifi_fsm_event_t ev, uint32_t creds) {
+  uint32_t act = fsm_apply(ev, creds);
+  if (act && manager_task) xTaskNotify(manager_task, act, eSetBits);
+}
+
+static void on_wifi_event(arduino_event_id_t event, arduino_event_info_t info) {
+  (void)info;
+  switch (event) {
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP: fsm_post(WIFI_FSM_EV_GOT_IP, 0); break;
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED: fsm_post(WIFI_FSM_EV_DISCONNECTED, 0); break;
+    case ARDUINO_EVENT_WIFI_SCAN_DONE: fsm_post(WIFI_FSM_EV_SCAN_DONE, 0); break;
+    default: break;
+  }
+}
+
+// Select the static address, the cached lease (`use_lease`) or DHCP for the next join.
+// Returns true when DHCP is used, i.e. the join will produce a lease worth caching.
+static bool apply_ip_config(const wifi_settings_t *s, bool use_lease) {
+  IPAddress ip, gw, mask, dns;
+  if (s->static_ip[0]) {
+    if (ip.fromString(s->static_ip) && gw.fromString(s->static_gw) && mask.fromString(s->static_mask)) {
+      if (!dns.fromString(s->static_dns)) dns = gw;
+      WiFi.config(ip, gw, mask, dns);
+      return false;
+    }
+    Serial.printf("[wifi] static address '%s' incomplete, using DHCP\n", s->static_ip);
+  } else if (use_lease && s->fast_ip) {
+    WiFi.config(IPAddress(s->fast_ip), IPAddress(s->fast_gw), IPAddress(s->fast_mask), IPAddress(s->fast_dns));
+    return false;
+  }
+  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  return true;
+}
+
+static bool parse_bssid(const char *str, uint8_t *bssid) {
+  return sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &bssid[0], &bssid[1], &bssid[2], &bssid[3], &bssid[4], &bssid[5]) == 6;
+}
+
+// Note the access point, channel and (for DHCP joins) the lease of the current link in `s`
+static void remember_join(wifi_settings_t *s, bool dhcp) {
+  s->fast_id = wifi_settings_credentials_id();
+  strlcpy(s->fast_bssid, WiFi.BSSIDstr().c_str(), sizeof(s->fast_bssid));
+  s->fast_channel = WiFi.channel();
+  if (dhcp) {
+    s->fast_ip = (uint32_t)WiFi.localIP();
+    s->fast_gw = (uint32_t)WiFi.gatewayIP();
+    s->fast_mask = (uint32_t)WiFi.subnetMask();
+    s->fast_dns = (uint32_t)WiFi.dnsIP();
+  }
+}
+
+static bool join_dhcp = true;  // addressing used by the join in progress
+static bool lease_pinned = false;  // fast join runs on the cached lease until DHCP takes over
+
+static void begin_connect() {
+  wifi_settings_t s;
+  wifi_settings_snapshot(&s);
+  if (!s.ssid[0]) {
+    Serial.println("[wifi] no stored credentials, nothing to join");
+    return;
+  }
+  Serial.printf("[wifi] joining '%s' (pass_len=%d)\n", s.ssid, (int)strlen(s.pass));
+  // Keep AP active during connect attempts
+  WiFi.disconnect(false); // don't erase stored AP config
+  WiFi.mode(WIFI_AP_STA);
+  join_dhcp = apply_ip_config(&s, false);
+  WiFi.begin(s.ssid, s.pass);
+}
+
+static void begin_scan() {
+  // Scanning needs the station interface; keep the SoftAP up next to it
+  if (!(WiFi.getMode() & WIFI_MODE_STA)) WiFi.mode(WIFI_AP_STA);
+  // Async: completion arrives as ARDUINO_EVENT_WIFI_SCAN_DONE
+  int rc = WiFi.scanNetworks(true, false);
+  if (rc == WIFI_SCAN_FAILED) {
+    Serial.println("[wifi] scan could not be started");
+    fsm_post(WIFI_FSM_EV_SCAN_DONE, 0);
+  }
+}
+
+static void collect_scan() {
+  int n = WiFi.scanComplete();
+  wifi_scan_entry_t found[WIFI_SCAN_MAX];
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    String ssid = WiFi.SSID(i);
+    if (ssid.length() == 0) continue;
+    // One entry per SSID, keeping the strongest access point
+    int j = 0;
+    while (j < count && strcmp(found[j].ssid, ssid.c_str()) != 0) j++;
+    if (j == count) {
+      if (count == WIFI_SCAN_MAX) continue;
+      count++;
+    } else if (found[j].rssi >= WiFi.RSSI(i)) {
+      continue;
+    }
+    strlcpy(found[j].ssid, ssid.c_str(), sizeof(found[j].ssid));
+    found[j].rssi = (int8_t)WiFi.RSSI(i);
+    found[j].channel = (uint8_t)WiFi.channel(i);
+    found[j].auth = (uint8_t)WiFi.encryptionType(i);
+  }
+  WiFi.scanDelete();
+
+  portENTER_CRITICAL(&scan_mux);
+  memcpy(scan_cache, found, count * sizeof(found[0]));
+  scan_count = count;
+  scan_at_ms = millis();
+  scan_valid = n >= 0;
+  portEXIT_CRITICAL(&scan_mux);
+  Serial.printf("[wifi] scan found %d networks (%d listed)\n", n, count);
+}
+
+// Boot stages own the SoftAP and uploader start-up until they have run
+static bool boot_finished(boot_stage_t stage) {
+  boot_status_t st = boot_status(stage);
+  return st != BOOT_PENDING && st != BOOT_RUNNING;
+}
+
+static void on_connected() {
+  Serial.printf("[wifi] connected: %s\n", WiFi.localIP().toString().c_str());
+  // re-enable SoftAP so provisioning UI remains available
+  if (boot_finished(BOOT_SOFTAP) && !(WiFi.getMode() & WIFI_MODE_AP)) {
+    WiFi.mode(WIFI_AP_STA);
+    WiFi.softAP(WIFI_AP_NAME);
+    Serial.printf("[wifi] SoftAP '%s' ensured for provisioning\n", WIFI_AP_NAME);
+  }
+  // Keep the fast-join data current (nothing is written when it did not change)
+  wifi_settings_t s;
+  wifi_settings_snapshot(&s);
+  if (s.ssid[0]) {
+    remember_join(&s, join_dhcp);
+    wifi_settings_update(&s);
+  }
+  // Frame capture times need wall-clock time; SNTP keeps it in sync from here on
+  frame_clock_begin(uploader_get_ntp_server().c_str());
+  // Joined after boot (late provisioning or a failed boot join): start the uploader here,
+  // as long as the camera it captures from came up
+  if (uploader_is_configured() && boot_finished(BOOT_UPLOADER) && boot_status(BOOT_CAMERA) == BOOT_DONE) startUploaderTask();
+}
+
+// The cached lease only saves the DHCP round trip at boot; hand the interface back to
+// DHCP so the lease is confirmed (usually the same address) and renewed from then on.
+// GOT_IP follows and on_connected() caches the fresh lease.
+static void renew_lease() {
+  lease_pinned = false;
+  join_dhcp = true;
+  Serial.println("[wifi] switching from the cached lease back to DHCP");
+  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+}
+
+static void managerTask(void *pvParameters) {
+  (void)pvParameters;
+  while (true) {
+    uint32_t act = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &act, pdMS_TO_TICKS(WIFI_MANAGER_TICK_MS));
+    wifi_fsm_state_t before = fsm.state;
+    act |= fsm_apply(WIFI_FSM_EV_TICK, 0);
+    if (before == WIFI_FSM_CONNECTING && fsm.state == WIFI_FSM_FAILED) {
+      Serial.printf("[wifi] join attempt %u timed out, SoftAP stays active, retrying in %u s\n", (unsigned)fsm.token,
+                    (unsigned)((fsm.retry_at_ms - millis()) / 1000));
+    }
+
+    if (act & WIFI_FSM_ACT_COLLECT) collect_scan();
+    if (act & WIFI_FSM_ACT_BEGIN) begin_connect();
+    if (act & WIFI_FSM_ACT_SCAN) begin_scan();
+    if (act & WIFI_FSM_ACT_CONNECTED) on_connected();
+    if (lease_pinned && fsm.state == WIFI_FSM_CONNECTED) renew_lease();
+  }
+}
+
+static bool wait_connected(uint32_t timeout_ms) {
+  uint32_t start = millis();
+  while (WiFi.status() != WL_CONNECTED && millis() - start < timeout_ms) {
+    delay(20);
+  }
+  return WiFi.status() == WL_CONNECTED;
+}
+
+// Running mean over the last (up to) 16 samples
+static void add_sample(uint32_t *avg, uint32_t *n, uint32_t v) {
+  if (*n < 16) (*n)++;
+  *avg = (uint32_t)((int32_t)*avg + ((int32_t)v - (int32_t)*avg) / (int32_t)*n);
+}
+
+bool wifi_manager_boot_connect(const char *fallback_ssid, const char *fallback_pass) {
+  uint32_t start = millis();
+  wifi_settings_t s;
+  wifi_settings_snapshot(&s);
+  bool stored = s.ssid[0] != 0;
+  const char *ssid = stored ? s.ssid : fallback_ssid;
+  const char *pass = stored ? s.pass : fallback_pass;
+  WiFi.mode(WIFI_STA);
+
+  // Fast path: straight to the last access point on its channel, no scan; with the
+  // cached lease (or a static address) DHCP is skipped as well
+  uint8_t bssid[6];
+  uint32_t path = WIFI_JOIN_NONE;
+  bool dhcp = true;
+  if (stored && s.fast_id == wifi_settings_credentials_id() && s.fast_channel > 0 && parse_bssid(s.fast_bssid, bssid)) {
+    dhcp = apply_ip_config(&s, WIFI_FAST_REUSE_LEASE);
+    lease_pinned = !dhcp && !s.static_ip[0];
+    Serial.printf("Fast join '%s' via %s on channel %u%s\n", ssid, s.fast_bssid, (unsigned)s.fast_channel, dhcp ? "" : " (no DHCP)");
+    WiFi.begin(ssid, pass, s.fast_channel, bssid, true);
+    if (wait_connected(WIFI_FAST_CONNECT_TIMEOUT_MS)) {
+      path = WIFI_JOIN_FAST;
+    } else {
+      Serial.printf("Fast join failed after %u ms, falling back to a full scan\n", (unsigned)(millis() - start));
+      lease_pinned = false;
+      WiFi.disconnect(false);
+    }
+  }
+
+  if (path == WIFI_JOIN_NONE) {
+    Serial.printf("Connecting using %s SSID: '%s' (len=%d) pass_len=%d\n", stored ? "stored" : "hard-coded", ssid, (int)strlen(ssid), (int)strlen(pass));
+    dhcp = apply_ip_config(&s, false);
+    WiFi.begin(ssid, pass);
+    if (wait_connected(WIFI_BOOT_CONNECT_TIMEOUT_MS)) path = WIFI_JOIN_FULL;
+  }
+
+  uint32_t join_ms = millis() - start;
+  if (path == WIFI_JOIN_NONE) {
+    Serial.printf("WiFi join failed after %u ms\n", (unsigned)join_ms);
+    return false;
+  }
+  Serial.printf("WiFi joined via %s path in %u ms (%u ms since boot)\n", path == WIFI_JOIN_FAST ? "fast" : "full", (unsigned)join_ms, (unsigned)millis());
+
+  // Cache data for the next boot and the timings, in one commit
+  if (stored) remember_join(&s, dhcp);
+  s.boot_path = path;
+  s.boot_ms = millis();
+  s.boot_join_ms = join_ms;
+  if (path == WIFI_JOIN_FAST) {
+    add_sample(&s.boot_fast_avg, &s.boot_fast_n, join_ms);
+  } else {
+    add_sample(&s.boot_full_avg, &s.boot_full_n, join_ms);
+  }
+  wifi_settings_update(&s);
+  join_dhcp = dhcp;
+  return true;
+}
+
+void wifi_manager_begin(bool connected) {
+  if (manager_task) return;
+  wifi_fsm_init(&fsm, WIFI_CONNECT_TIMEOUT_MS, WIFI_SCAN_TIMEOUT_MS, connected, wifi_settings_credentials_id(), millis());
+  WiFi.onEvent(on_wifi_event);
+  xTaskCreatePinnedToCore(managerTask, "wifi_mgr", 4 * 1024, NULL, 1, &manager_task, 1);
+}
+
+uint32_t wifi_manager_connect() {
+  if (!manager_task) return 0;
+  portENTER_CRITICAL(&fsm_mux);
+  uint32_t act = wifi_fsm_step(&fsm, WIFI_FSM_EV_CONNECT, millis(), wifi_settings_credentials_id());
+  uint32_t token = fsm.token;
+  portEXIT_CRITICAL(&fsm_mux);
+  if (act) xTaskNotify(manager_task, act, eSetBits);
+  return token;
+}
+
+void wifi_manager_scan(bool force) {
+  portENTER_CRITICAL(&scan_mux);
+  bool stale = !scan_valid || millis() - scan_at_ms >= WIFI_SCAN_TTL_MS;
+  portEXIT_CRITICAL(&scan_mux);
+  if (manager_task && (force || stale)) fsm_post(WIFI_FSM_EV_SCAN, 0);
+}
+
+void wifi_manager_to_json(cJSON *obj, uint32_t token) {
+  portENTER_CRITICAL(&fsm_mux);
+  wifi_fsm_t s = fsm;
+  portEXIT_CRITICAL(&fsm_mux);
+  if (token == 0) token = s.token;
+  wifi_fsm_token_status_t ts = wifi_fsm_token_status(&s, token);
+
+  cJSON_AddStringToObject(obj, "state", wifi_fsm_state_name(s.state));
+  cJSON_AddNumberToObject(obj, "token", token);
+  cJSON_AddStringToObject(obj, "result", wifi_fsm_token_status_name(ts));
+  if (s.state == WIFI_FSM_FAILED) {
+    int32_t wait = (int32_t)(s.retry_at_ms - millis());
+    cJSON_AddNumberToObject(obj, "retry_in_ms", wait > 0 ? wait : 0);
+  }
+  cJSON_AddBoolToObject(obj, "connected", WiFi.status() == WL_CONNECTED);
+  if (WiFi.status() == WL_CONNECTED) {
+    cJSON_AddStringToObject(obj, "ip", WiFi.localIP().toString().c_str());
+    cJSON_AddStringToObject(obj, "ssid", WiFi.SSID().c_str());
+    cJSON_AddNumberToObject(obj, "rssi", WiFi.RSSI());
+  }
+  cJSON_AddBoolToObject(obj, "scanning", s.scanning);
+  cJSON_AddNumberToObject(obj, "connects", s.connects);
+  cJSON_AddNumberToObject(obj, "failures", s.failures);
+  cJSON_AddNumberToObject(obj, "drops", s.drops);
+
+  // Boot-time join timings, kept across reboots
+  wifi_settings_t ws;
+  wifi_settings_snapshot(&ws);
+  cJSON *boot = cJSON_AddObjectToObject(obj, "boot");
+  cJSON_AddStringToObject(boot, "path", ws.boot_path == WIFI_JOIN_FAST ? "fast" : ws.boot_path == WIFI_JOIN_FULL ? "full" : "none");
+  cJSON_AddNumberToObject(boot, "connected_at_ms", ws.boot_ms);
+  cJSON_AddNumberToObject(boot, "join_ms", ws.boot_join_ms);
+  cJSON_AddNumberToObject(boot, "fast_avg_ms", ws.boot_fast_avg);
+  cJSON_AddNumberToObject(boot, "fast_samples", ws.boot_fast_n);
+  cJSON_AddNumberToObject(boot, "full_avg_ms", ws.boot_full_avg);
+  cJSON_AddNumberToObject(boot, "full_samples", ws.boot_full_n);
+}
+
+void wifi_manager_scan_to_json(cJSON *obj) {
+  wifi_scan_entry_t entries[WIFI_SCAN_MAX];
+  portENTER_CRITICAL(&scan_mux);
+  int count = scan_count;
+  bool valid = scan_valid;
+  uint32_t age = millis() - scan_at_ms;
+  memcpy(entries, scan_cache, count * sizeof(entries[0]));
+  portEXIT_CRITICAL(&scan_mux);
+
+  cJSON_AddBoolToObject(obj, "scanning", fsm.scanning);
+  if (valid) cJSON_AddNumberToObject(obj, "age_ms", age);
+  cJSON *list = cJSON_AddArrayToObject(obj, "networks");
+  for (int i = 0; i < count; i++) {
+    cJSON *n = cJSON_CreateObject();
+    cJSON_AddStringToObject(n, "ssid", entries[i].ssid);
+    cJSON_AddNumberToObject(n, "rssi", entries[i].rssi);
+    cJSON_AddNumberToObject(n, "channel", entries[i].channel);
+    cJSON_AddBoolToObject(n, "secure", entries[i].auth != WIFI_AUTH_OPEN);
+    cJSON_AddItemToArray(list, n);
+  }
+}
+
+void wifi_manager_metrics(metrics_out_t *out) {
+  portENTER_CRITICAL(&fsm_mux);
+  uint32_t connects = fsm.connects, failures = fsm.failures, drops = fsm.drops;
+  portEXIT_CRITICAL(&fsm_mux);
+  bool connected = WiFi.status() == WL_CONNECTED;
+
+  metrics_family(out, "wifi_connected", "gauge", "1 while the station has an IP address");
+  metrics_printf(out, METRICS_PREFIX "wifi_connected %d\n", connected ? 1 : 0);
+  if (connected) {
+    metrics_family(out, "wifi_rssi_dbm", "gauge", "Signal strength of the joined access point");
+    metrics_printf(out, METRICS_PREFIX "wifi_rssi_dbm %d\n", (int)WiFi.RSSI());
+  }
+  metrics_family(out, "wifi_connects_total", "counter", "Associations started (boot, requests and reconnects)");
+  metrics_printf(out, METRICS_PREFIX "wifi_connects_total %u\n", (unsigned)connects);
+  metrics_family(out, "wifi_connect_failures_total", "counter", "Association attempts that timed out");
+  metrics_printf(out, METRICS_PREFIX "wifi_connect_failures_total %u\n", (unsigned)failures);
+  metrics_family(out, "wifi_disconnects_total", "counter", "Links lost after being connected");
+  metrics_printf(out, METRICS_PREFIX "wifi_disconnects_total %u\n", (unsigned)drops);
+}
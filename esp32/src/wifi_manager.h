@@ -0,0 +1,52 @@
+#ifndef WIFI_MANAGER_H
+#define WIFI_MANAGER_H
+
+#include <Arduino.h>
+#include "cJSON.h"
+#include "metrics.h"
+
+// Event-driven Wi-Fi station manager. HTTP handlers only post requests and
+// return at once; one task carries out associations and asynchronous scans as
+// the Wi-Fi events come in (see wifi_fsm.h for the transitions). Scan results
+// are cached, so /wifi/scan never waits for the radio.
+
+#define WIFI_AP_NAME "NutriCycle-Setup"
+#define WIFI_CONNECT_TIMEOUT_MS 15000
+#define WIFI_SCAN_TIMEOUT_MS 10000
+#define WIFI_SCAN_TTL_MS 30000   // older cached results trigger a background rescan
+#define WIFI_SCAN_MAX 20         // distinct SSIDs kept (strongest signal wins)
+#define WIFI_MANAGER_TICK_MS 500
+
+// Boot-time join. The fast path joins the last access point on its channel without a
+// scan and, with WIFI_FAST_REUSE_LEASE, starts on the last DHCP lease as a static address
+// until the manager task hands the interface back to DHCP (which confirms or replaces
+// the lease); if it is not up within WIFI_FAST_CONNECT_TIMEOUT_MS a full scan-and-join follows.
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 3000
+#define WIFI_FAST_REUSE_LEASE 1
+#define WIFI_BOOT_CONNECT_TIMEOUT_MS 15000
+
+// Path of the last boot-time join (wifi_settings_t::boot_path)
+#define WIFI_JOIN_NONE 0
+#define WIFI_JOIN_FAST 1
+#define WIFI_JOIN_FULL 2
+
+// Join at boot with the stored credentials (or the fallback ones when none are stored),
+// fast path first. Records the timing; returns true once connected.
+bool wifi_manager_boot_connect(const char *fallback_ssid, const char *fallback_pass);
+
+// Start the manager after the boot-time connection attempt (`connected` = its outcome)
+void wifi_manager_begin(bool connected);
+
+// Join the stored network in the background. Returns a token to poll with
+// wifi_manager_to_json; repeated requests for the same credentials share one.
+uint32_t wifi_manager_connect();
+
+// Refresh the scan cache in the background if it is older than WIFI_SCAN_TTL_MS (or `force`)
+void wifi_manager_scan(bool force);
+
+// State, link details and the outcome of `token` (0 = latest request)
+void wifi_manager_to_json(cJSON *obj, uint32_t token);
+void wifi_manager_scan_to_json(cJSON *obj);
+void wifi_manager_metrics(metrics_out_t *out);
+
+#endif // WIFI_MANAGER_H
@@ -1,97 +1,83 @@
 #include "wifi_settings.h"
-#include <Preferences.h>
 
-static Preferences prefs;
-static const char *NS = "wifi";
+#define SETTINGS_STRUCT wifi_settings_t
+static const setting_field_t fields[] = {
+  WIFI_SETTINGS(SETTING_STR_FIELD, SETTING_U32_FIELD, SETTING_BOOL_FIELD)
+};
+#undef SETTINGS_STRUCT
 
-// Simple percent-encoding (URL encode) helpers to avoid storing problematic raw control characters
-static String pct_encode(const String &s) {
-  String out;
-  out.reserve(s.length() * 3);
-  for (size_t i = 0; i < s.length(); ++i) {
-    char c = s[i];
-    if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '-' || c == '_' || c == '.' || c == '~') {
-      out += c;
-    } else {
-      char buf[4];
-      snprintf(buf, sizeof(buf), "%%%02X", (unsigned char)c);
-      out += buf;
-    }
+static wifi_settings_t cache;
+static settings_store_t store = {"wifi", fields, sizeof(fields) / sizeof(fields[0]), &cache, sizeof(cache)};
+
+void wifi_settings_init() {
+  settings_load(&store);
+}
+
+void wifi_settings_snapshot(wifi_settings_t *out) {
+  settings_read(&store, 0, out, sizeof(*out));
+}
+
+void wifi_settings_update(const wifi_settings_t *values) {
+  settings_store_values(&store, values);
+}
+
+uint32_t wifi_settings_credentials_id() {
+  wifi_settings_t s;
+  wifi_settings_snapshot(&s);
+  // FNV-1a over "ssid\0pass"
+  uint32_t h = 2166136261u;
+  for (const char *p = s.ssid;; p++) {
+    h = (h ^ (uint8_t)*p) * 16777619u;
+    if (!*p) break;
   }
-  return out;
+  for (const char *p = s.pass; *p; p++) h = (h ^ (uint8_t)*p) * 16777619u;
+  return h;
 }
 
-static String pct_decode(const String &s) {
-  String out;
-  out.reserve(s.length());
-  for (size_t i = 0; i < s.length(); ++i) {
-    char c = s[i];
-    if (c == '%' && i + 2 < s.length()) {
-      char hi = s[i+1];
-      char lo = s[i+2];
-      int v = 0;
-      auto hex = [](char ch)->int { if (ch >= '0' && ch <= '9') return ch - '0'; if (ch >= 'A' && ch <= 'F') return 10 + ch - 'A'; if (ch >= 'a' && ch <= 'f') return 10 + ch - 'a'; return 0; };
-      v = (hex(hi) << 4) | hex(lo);
-      out += (char)v;
-      i += 2;
-    } else if (c == '+') {
-      out += ' ';
-    } else {
-      out += c;
-    }
+int wifi_settings_apply_json(const cJSON *obj, uint8_t flags, char *err, size_t err_len) {
+  cJSON *req = cJSON_Duplicate(obj, true);
+  if (!req) {
+    if (err) snprintf(err, err_len, "out of memory");
+    return -1;
+  }
+  // Accept SSID even when password is empty/missing (open Wi‑Fi networks or when user leaves password blank).
+  // Without an SSID the credentials are left alone.
+  cJSON *jssid = cJSON_GetObjectItem(req, "ssid");
+  if (!jssid || !cJSON_IsString(jssid)) {
+    cJSON_DeleteItemFromObject(req, "ssid");
+    cJSON_DeleteItemFromObject(req, "password");
+  } else if (!cJSON_IsString(cJSON_GetObjectItem(req, "password"))) {
+    cJSON_DeleteItemFromObject(req, "password");
+    cJSON_AddStringToObject(req, "password", "");
   }
-  return out;
+  int changed = settings_apply_json(&store, req, flags, err, err_len);
+  cJSON_Delete(req);
+  return changed;
 }
 
-void wifi_settings_init() {
-  prefs.begin(NS, false);
+void wifi_settings_to_json(cJSON *obj) {
+  settings_to_json(&store, obj, SETTING_JSON);
+  cJSON_AddBoolToObject(obj, "provisioned", wifi_is_provisioned());
 }
 
 String wifi_get_ssid() {
-  String enc = prefs.getString("ssid", "");
-  if (enc.length() == 0) return String("");
-  String dec = pct_decode(enc);
-  return dec;
+  char v[sizeof(cache.ssid)];
+  settings_read(&store, offsetof(wifi_settings_t, ssid), v, sizeof(v));
+  return String(v);
 }
 
 String wifi_get_pass() {
-  String enc = prefs.getString("pass", "");
-  if (enc.length() == 0) return String("");
-  String dec = pct_decode(enc);
-  return dec;
+  char v[sizeof(cache.pass)];
+  settings_read(&store, offsetof(wifi_settings_t, pass), v, sizeof(v));
+  return String(v);
 }
 
 bool wifi_is_provisioned() {
-  String s = wifi_get_ssid();
-  return s.length() > 0;
-}
-
-void wifi_set_credentials(const char *ssid, const char *pass) {
-  // Log incoming values (lengths and quoted) to diagnose hidden/whitespace issues
-  if (ssid) {
-    Serial.printf("wifi_set_credentials called with ssid='%s' len=%d\n", ssid, (int)strlen(ssid));
-  } else {
-    Serial.println("wifi_set_credentials called with ssid=<null>");
-  }
-  if (pass) {
-    Serial.printf("wifi_set_credentials called with pass_len=%d\n", (int)strlen(pass));
-  } else {
-    Serial.println("wifi_set_credentials called with pass=<null>");
-  }
-
-  if (ssid && strlen(ssid) > 0) {
-    String enc = pct_encode(String(ssid));
-    prefs.putString("ssid", enc);
-    Serial.printf("wifi_set_credentials: stored encoded_ssid='%s' len=%d\n", enc.c_str(), (int)enc.length());
-  }
-  if (pass) {
-    String encp = pct_encode(String(pass));
-    prefs.putString("pass", encp);
-    Serial.printf("wifi_set_credentials: stored encoded_pass_len=%d\n", (int)encp.length());
-  }
+  char first;
+  settings_read(&store, offsetof(wifi_settings_t, ssid), &first, 1);
+  return first != 0;
 }
 
 void wifi_clear_credentials() {
-  prefs.remove("ssid");
-  prefs.remove("pass");
+  settings_reset(&store);
 }
@@ -2,12 +2,55 @@
 #define WIFI_SETTINGS_H
 
 #include <Arduino.h>
+#include "cJSON.h"
+#include "settings_registry.h"
+
+// Station settings, NVS namespace "wifi" (see uploader_settings.h for the list format).
+// Credentials are stored percent-encoded; the password is never reported back.
+// static_* select a fixed address instead of DHCP ("" = DHCP). The fast_* values
+// describe the last successful join (access point, channel and, for DHCP, the lease)
+// and are only used while fast_id matches the stored credentials. The boot_* values
+// record how long boot-time joins took on the fast and the full path.
+#define WIFI_SETTINGS(STR, U32, BOOL) \
+  STR(ssid, "ssid", "ssid", 33, NULL, SETTING_JSON | SETTING_PROVISION | SETTING_KEEP_IF_EMPTY | SETTING_PCT_ENCODED) \
+  STR(pass, "pass", "password", 65, NULL, SETTING_JSON | SETTING_PROVISION | SETTING_PCT_ENCODED | SETTING_SECRET | SETTING_WRITE_ONLY) \
+  STR(static_ip, "static_ip", "static_ip", 16, NULL, SETTING_JSON | SETTING_PROVISION) \
+  STR(static_gw, "static_gw", "static_gateway", 16, NULL, SETTING_JSON | SETTING_PROVISION) \
+  STR(static_mask, "static_mask", "static_netmask", 16, NULL, SETTING_JSON | SETTING_PROVISION) \
+  STR(static_dns, "static_dns", "static_dns", 16, NULL, SETTING_JSON | SETTING_PROVISION) \
+  U32(fast_id, "fast_id", NULL, 0, 0, UINT32_MAX, 0) \
+  STR(fast_bssid, "fast_bssid", NULL, 18, NULL, 0) \
+  U32(fast_channel, "fast_ch", NULL, 0, 0, 14, 0) \
+  U32(fast_ip, "fast_ip", NULL, 0, 0, UINT32_MAX, 0) \
+  U32(fast_gw, "fast_gw", NULL, 0, 0, UINT32_MAX, 0) \
+  U32(fast_mask, "fast_mask", NULL, 0, 0, UINT32_MAX, 0) \
+  U32(fast_dns, "fast_dns", NULL, 0, 0, UINT32_MAX, 0) \
+  U32(boot_path, "boot_path", NULL, 0, 0, 2, 0) \
+  U32(boot_ms, "boot_ms", NULL, 0, 0, UINT32_MAX, 0) \
+  U32(boot_join_ms, "boot_join_ms", NULL, 0, 0, UINT32_MAX, 0) \
+  U32(boot_fast_avg, "boot_fast_avg", NULL, 0, 0, UINT32_MAX, 0) \
+  U32(boot_fast_n, "boot_fast_n", NULL, 0, 0, UINT32_MAX, 0) \
+  U32(boot_full_avg, "boot_full_avg", NULL, 0, 0, UINT32_MAX, 0) \
+  U32(boot_full_n, "boot_full_n", NULL, 0, 0, UINT32_MAX, 0)
+
+typedef struct {
+  WIFI_SETTINGS(SETTING_STR_MEMBER, SETTING_U32_MEMBER, SETTING_BOOL_MEMBER)
+} wifi_settings_t;
 
 void wifi_settings_init();
+void wifi_settings_snapshot(wifi_settings_t *out);
+// Store a modified snapshot (e.g. the fast-join cache) in one commit
+void wifi_settings_update(const wifi_settings_t *values);
+// Hash of the stored ssid/password; identifies which network cached join data belongs to
+uint32_t wifi_settings_credentials_id();
+// Store the members of `obj` allowed by `flags` (as for uploader_settings_apply_json)
+// in one commit. Credentials change only with an ssid; a missing password then
+// means an open network.
+int wifi_settings_apply_json(const cJSON *obj, uint8_t flags, char *err, size_t err_len);
+void wifi_settings_to_json(cJSON *obj);
 String wifi_get_ssid();
 String wifi_get_pass();
 bool wifi_is_provisioned();
-void wifi_set_credentials(const char *ssid, const char *pass);
 void wifi_clear_credentials();
 
 #endif // WIFI_SETTINGS_H
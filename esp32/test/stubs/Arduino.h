@@ -0,0 +1,83 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Host stand-in for the parts of the Arduino core and FreeRTOS the tested modules
+// use. Each test is one translation unit, so definitions live in the headers.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+
+using std::max;
+using std::min;
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+static inline unsigned long millis() {
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return (unsigned long)duration_cast<milliseconds>(steady_clock::now() - start).count();
+}
+
+static inline void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static inline bool psramFound() {
+  return false;
+}
+
+struct HostSerial {
+  int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vprintf(fmt, ap);
+    va_end(ap);
+    return n;
+  }
+  void println(const char *s) { puts(s); }
+};
+inline HostSerial Serial;
+
+// FreeRTOS: tests are single-threaded, so locks and critical sections are no-ops
+typedef uint32_t TickType_t;
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef int BaseType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffUL
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+typedef struct {
+  int owner;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+static inline void portENTER_CRITICAL(portMUX_TYPE *m) { (void)m; }
+static inline void portEXIT_CRITICAL(portMUX_TYPE *m) { (void)m; }
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex() { return malloc(1); }
+static inline SemaphoreHandle_t xSemaphoreCreateBinary() { return malloc(1); }
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t wait) {
+  (void)s;
+  (void)wait;
+  return pdTRUE;
+}
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+  (void)s;
+  return pdTRUE;
+}
+static inline void vSemaphoreDelete(SemaphoreHandle_t s) { free(s); }
+static inline void vTaskDelay(TickType_t ticks) { delay(ticks); }
+
+#endif // HOST_ARDUINO_H
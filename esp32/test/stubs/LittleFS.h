@@ -0,0 +1,96 @@
+#ifndef HOST_LITTLEFS_H
+#define HOST_LITTLEFS_H
+
+// File-backed stand-in for LittleFS: paths map to files under `root` on the host,
+// so tests can inspect, truncate or corrupt what the module wrote.
+
+#include "Arduino.h"
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+class File {
+ public:
+  File() {}
+
+  explicit operator bool() const { return impl_ && (impl_->fp || impl_->dir); }
+  bool isDirectory() const { return impl_ && impl_->dir; }
+  const char *name() const { return impl_ ? impl_->name.c_str() : ""; }
+
+  size_t write(const uint8_t *buf, size_t len) { return impl_ && impl_->fp ? fwrite(buf, 1, len, impl_->fp) : 0; }
+  size_t read(uint8_t *buf, size_t len) { return impl_ && impl_->fp ? fread(buf, 1, len, impl_->fp) : 0; }
+  bool seek(uint32_t pos) { return impl_ && impl_->fp && fseek(impl_->fp, pos, SEEK_SET) == 0; }
+  size_t size() {
+    if (!impl_ || !impl_->fp) return 0;
+    long pos = ftell(impl_->fp);
+    fseek(impl_->fp, 0, SEEK_END);
+    long end = ftell(impl_->fp);
+    fseek(impl_->fp, pos, SEEK_SET);
+    return (size_t)end;
+  }
+  void close() { impl_.reset(); }
+
+  File openNextFile() {
+    File f;
+    if (!isDirectory() || impl_->next >= impl_->entries.size()) return f;
+    const std::filesystem::path &p = impl_->entries[impl_->next++];
+    f.impl_ = std::make_shared<Impl>();
+    f.impl_->fp = fopen(p.c_str(), "rb");
+    f.impl_->name = p.filename().string();
+    return f;
+  }
+
+ private:
+  friend class HostFS;
+  struct Impl {
+    FILE *fp = nullptr;
+    bool dir = false;
+    std::string name;
+    std::vector<std::filesystem::path> entries;
+    size_t next = 0;
+    ~Impl() {
+      if (fp) fclose(fp);
+    }
+  };
+  std::shared_ptr<Impl> impl_;
+};
+
+class HostFS {
+ public:
+  std::filesystem::path root;
+
+  std::string host_path(const char *path) const { return (root / (path[0] == '/' ? path + 1 : path)).string(); }
+
+  bool begin() {
+    std::error_code ec;
+    std::filesystem::create_directories(root, ec);
+    return !ec;
+  }
+  bool format() {
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    return begin();
+  }
+  bool exists(const char *path) const { return std::filesystem::exists(host_path(path)); }
+  bool mkdir(const char *path) { return std::filesystem::create_directory(host_path(path)); }
+  bool remove(const char *path) { return ::remove(host_path(path).c_str()) == 0; }
+
+  File open(const char *path, const char *mode = "r") {
+    File f;
+    f.impl_ = std::make_shared<File::Impl>();
+    std::string p = host_path(path);
+    f.impl_->name = std::filesystem::path(p).filename().string();
+    if (std::filesystem::is_directory(p)) {
+      f.impl_->dir = true;
+      for (const auto &e : std::filesystem::directory_iterator(p)) f.impl_->entries.push_back(e.path());
+      return f;
+    }
+    std::string m = mode;
+    f.impl_->fp = fopen(p.c_str(), m == "r" ? "rb" : m == "w" ? "wb" : m == "a" ? "ab" : "r+b");
+    return f;
+  }
+};
+
+inline HostFS LittleFS;
+
+#endif // HOST_LITTLEFS_H
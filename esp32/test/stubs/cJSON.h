@@ -0,0 +1,17 @@
+#ifndef HOST_CJSON_H
+#define HOST_CJSON_H
+
+// The JSON reporting functions are not under test; building them is enough
+typedef struct cJSON {
+  int unused;
+} cJSON;
+
+static inline cJSON *cJSON_CreateObject() { return nullptr; }
+static inline cJSON *cJSON_AddObjectToObject(cJSON *, const char *) { return nullptr; }
+static inline cJSON *cJSON_AddArrayToObject(cJSON *, const char *) { return nullptr; }
+static inline cJSON *cJSON_AddNumberToObject(cJSON *, const char *, double) { return nullptr; }
+static inline cJSON *cJSON_AddBoolToObject(cJSON *, const char *, bool) { return nullptr; }
+static inline cJSON *cJSON_AddStringToObject(cJSON *, const char *, const char *) { return nullptr; }
+static inline bool cJSON_AddItemToArray(cJSON *, cJSON *) { return true; }
+
+#endif // HOST_CJSON_H
@@ -0,0 +1,84 @@
+#ifndef HOST_ESP_CAMERA_H
+#define HOST_ESP_CAMERA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+// Types and tables from esp32-camera, same order and values
+
+typedef enum {
+  PIXFORMAT_RGB565,
+  PIXFORMAT_YUV422,
+  PIXFORMAT_YUV420,
+  PIXFORMAT_GRAYSCALE,
+  PIXFORMAT_JPEG,
+  PIXFORMAT_RGB888,
+  PIXFORMAT_RAW,
+  PIXFORMAT_RGB444,
+  PIXFORMAT_RGB555,
+} pixformat_t;
+
+typedef enum {
+  FRAMESIZE_96X96,
+  FRAMESIZE_QQVGA,
+  FRAMESIZE_128X128,
+  FRAMESIZE_QCIF,
+  FRAMESIZE_HQVGA,
+  FRAMESIZE_240X240,
+  FRAMESIZE_QVGA,
+  FRAMESIZE_320X320,
+  FRAMESIZE_CIF,
+  FRAMESIZE_HVGA,
+  FRAMESIZE_VGA,
+  FRAMESIZE_SVGA,
+  FRAMESIZE_XGA,
+  FRAMESIZE_HD,
+  FRAMESIZE_SXGA,
+  FRAMESIZE_UXGA,
+  FRAMESIZE_FHD,
+  FRAMESIZE_P_HD,
+  FRAMESIZE_P_3MP,
+  FRAMESIZE_QXGA,
+  FRAMESIZE_QHD,
+  FRAMESIZE_WQXGA,
+  FRAMESIZE_P_FHD,
+  FRAMESIZE_QSXGA,
+  FRAMESIZE_5MP,
+  FRAMESIZE_INVALID
+} framesize_t;
+
+typedef struct {
+  uint16_t width;
+  uint16_t height;
+} resolution_info_t;
+
+static const resolution_info_t resolution[FRAMESIZE_INVALID] = {
+    {96, 96},     {160, 120},   {128, 128},   {176, 144},   {240, 176},   {240, 240},   {320, 240},
+    {320, 320},   {400, 296},   {480, 320},   {640, 480},   {800, 600},   {1024, 768},  {1280, 720},
+    {1280, 1024}, {1600, 1200}, {1920, 1080}, {720, 1280},  {864, 1536},  {2048, 1536}, {2560, 1440},
+    {2560, 1600}, {1080, 1920}, {2560, 1920}, {2592, 1944},
+};
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t width;
+  size_t height;
+  pixformat_t format;
+  struct timeval timestamp;
+} camera_fb_t;
+
+typedef struct {
+  framesize_t framesize;
+  uint8_t quality;
+} camera_status_t;
+
+typedef struct _sensor {
+  camera_status_t status;
+} sensor_t;
+
+// Defined by the tests that need a sensor
+sensor_t *esp_camera_sensor_get();
+
+#endif // HOST_ESP_CAMERA_H
@@ -0,0 +1,32 @@
+#ifndef HOST_SUPPORT_H
+#define HOST_SUPPORT_H
+
+// Definitions behind async_log.h and metrics.h for host tests. Include once, in
+// the test's own translation unit, before the module source.
+
+#include "async_log.h"
+#include "metrics.h"
+
+volatile uint8_t alog_levels[ALOG_MODULE_COUNT] = {};  // ALOG_NONE: tests stay quiet
+
+void alog_write(alog_module_t module, alog_level_t level, const char *fmt, ...) {
+  (void)module;
+  (void)level;
+  (void)fmt;
+}
+
+std::atomic<uint32_t> metric_counters[METRIC_COUNT];
+
+void metrics_printf(metrics_out_t *out, const char *fmt, ...) {
+  (void)out;
+  (void)fmt;
+}
+
+void metrics_family(metrics_out_t *out, const char *name, const char *type, const char *help) {
+  (void)out;
+  (void)name;
+  (void)type;
+  (void)help;
+}
+
+#endif // HOST_SUPPORT_H
@@ -0,0 +1,238 @@
+// Strip-wise BMP encoder checked byte for byte against a whole-frame frame2bmp().
+// frame2bmp() and fmt2rgb888() below follow esp32-camera's to_bmp.c: a 54-byte
+// header with a negative height (rows top-down) and BGR rows without padding.
+// The JPEG decoder is a fake that emits a known image in MCU blocks.
+
+#include <unity.h>
+#include "bmp_stream.cpp"
+#include <vector>
+
+static int mcu = 16;  // block size the fake decoder emits
+
+static uint8_t test_pixel(int x, int y, int c) {
+  return (uint8_t)(x * 7 + y * 13 + c * 101);
+}
+
+// Emits the image in MCU blocks, left to right and top to bottom, like the real decoder.
+// The "JPEG" carries its size in the first four bytes.
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void *arg) {
+  (void)scale;
+  std::vector<uint8_t> src(len);
+  if (reader(arg, 0, src.data(), len) != len || len < 4) return ESP_FAIL;
+  int w = src[0] | src[1] << 8, h = src[2] | src[3] << 8;
+  if (!writer(arg, 0, 0, w, h, NULL)) return ESP_FAIL;
+  std::vector<uint8_t> block(mcu * mcu * 3);
+  for (int y = 0; y < h; y += mcu) {
+    for (int x = 0; x < w; x += mcu) {
+      int bw = min(mcu, w - x), bh = min(mcu, h - y);
+      uint8_t *d = block.data();
+      for (int iy = 0; iy < bh; iy++) {
+        for (int ix = 0; ix < bw; ix++) {
+          for (int c = 0; c < 3; c++) *d++ = test_pixel(x + ix, y + iy, c);  // RGB
+        }
+      }
+      if (!writer(arg, x, y, bw, bh, block.data())) return ESP_FAIL;
+    }
+  }
+  writer(arg, w, h, 0, 0, NULL);
+  return ESP_OK;
+}
+
+// BGR888 output, as in esp32-camera
+bool fmt2rgb888(const uint8_t *src, size_t len, pixformat_t format, uint8_t *out) {
+  if (format == PIXFORMAT_RGB565) {
+    for (size_t i = 0; i < len / 2; i++) {
+      uint8_t hb = *src++, lb = *src++;
+      *out++ = (lb & 0x1F) << 3;
+      *out++ = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+      *out++ = hb & 0xF8;
+    }
+  } else if (format == PIXFORMAT_GRAYSCALE) {
+    for (size_t i = 0; i < len; i++, src++) {
+      *out++ = *src;
+      *out++ = *src;
+      *out++ = *src;
+    }
+  } else if (format == PIXFORMAT_RGB888) {
+    memcpy(out, src, len);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+typedef struct {
+  const camera_fb_t *fb;
+  uint8_t *pixels;
+} ref_ctx_t;
+
+static size_t frame_read(void *arg, size_t index, uint8_t *buf, size_t len) {
+  const camera_fb_t *fb = ((ref_ctx_t *)arg)->fb;
+  len = min(len, fb->len - index);
+  if (buf) memcpy(buf, fb->buf + index, len);
+  return len;
+}
+
+static bool frame_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+  ref_ctx_t *c = (ref_ctx_t *)arg;
+  if (!data) return true;
+  for (int iy = 0; iy < h; iy++) {
+    uint8_t *o = c->pixels + ((size_t)(y + iy) * c->fb->width + x) * 3;
+    for (int ix = 0; ix < w; ix++, o += 3, data += 3) {
+      o[0] = data[2];
+      o[1] = data[1];
+      o[2] = data[0];
+    }
+  }
+  return true;
+}
+
+// The whole-frame reference: one buffer for header and pixels
+bool frame2bmp(camera_fb_t *fb, uint8_t **out, size_t *out_len) {
+  size_t pixels = fb->width * fb->height * 3;
+  uint8_t *bmp = (uint8_t *)calloc(1, BMP_STREAM_HEADER_LEN + pixels);
+  bmp[0] = 'B';
+  bmp[1] = 'M';
+  struct __attribute__((packed)) {
+    uint32_t filesize, reserved, fileoffset_to_pixelarray, dibheadersize;
+    int32_t width, height;
+    uint16_t planes, bitsperpixel;
+    uint32_t compression, imagesize, ypixelpermeter, xpixelpermeter, numcolorspallette, mostimpcolor;
+  } h = {(uint32_t)(BMP_STREAM_HEADER_LEN + pixels), 0, BMP_STREAM_HEADER_LEN, 40, (int32_t)fb->width, -(int32_t)fb->height,
+         1, 24, 0, (uint32_t)pixels, 0x0B13, 0x0B13, 0, 0};
+  memcpy(bmp + 2, &h, sizeof(h));
+  ref_ctx_t c = {fb, bmp + BMP_STREAM_HEADER_LEN};
+  bool ok = fb->format == PIXFORMAT_JPEG ? esp_jpg_decode(fb->len, JPG_SCALE_NONE, frame_read, frame_write, &c) == ESP_OK
+                                         : fmt2rgb888(fb->buf, fb->len, fb->format, bmp + BMP_STREAM_HEADER_LEN);
+  *out = bmp;
+  *out_len = BMP_STREAM_HEADER_LEN + pixels;
+  return ok;
+}
+
+static bool collect(void *arg, const uint8_t *data, size_t len) {
+  std::vector<uint8_t> *v = (std::vector<uint8_t> *)arg;
+  v->insert(v->end(), data, data + len);
+  return true;
+}
+
+static std::vector<uint8_t> source(int w, int h, pixformat_t format) {
+  std::vector<uint8_t> src;
+  if (format == PIXFORMAT_JPEG) {
+    src = {(uint8_t)w, (uint8_t)(w >> 8), (uint8_t)h, (uint8_t)(h >> 8)};
+    src.resize(600, 0xAB);
+  } else {
+    src.resize((size_t)w * h * (format == PIXFORMAT_GRAYSCALE ? 1 : 2));
+    for (size_t i = 0; i < src.size(); i++) src[i] = (uint8_t)(i * 31 + 7);
+  }
+  return src;
+}
+
+static void check_same_as_frame2bmp(int w, int h, pixformat_t format) {
+  std::vector<uint8_t> src = source(w, h, format);
+  camera_fb_t fb = {src.data(), src.size(), (size_t)w, (size_t)h, format, {0, 0}};
+
+  uint8_t *ref = NULL;
+  size_t ref_len = 0;
+  TEST_ASSERT_TRUE(frame2bmp(&fb, &ref, &ref_len));
+  std::vector<uint8_t> got;
+  TEST_ASSERT_TRUE(bmp_stream_encode(&fb, collect, &got));
+  TEST_ASSERT_EQUAL(ref_len, bmp_stream_size(&fb));
+  TEST_ASSERT_EQUAL(ref_len, got.size());
+  TEST_ASSERT_EQUAL_MEMORY(ref, got.data(), ref_len);
+  free(ref);
+}
+
+void setUp(void) {
+  mcu = 16;
+}
+
+void tearDown(void) {}
+
+static void test_rgb565(void) {
+  check_same_as_frame2bmp(320, 240, PIXFORMAT_RGB565);
+  check_same_as_frame2bmp(800, 600, PIXFORMAT_RGB565);
+}
+
+static void test_grayscale(void) {
+  check_same_as_frame2bmp(320, 240, PIXFORMAT_GRAYSCALE);
+  check_same_as_frame2bmp(96, 96, PIXFORMAT_GRAYSCALE);
+}
+
+static void test_jpeg_mcu_rows(void) {
+  check_same_as_frame2bmp(1600, 1200, PIXFORMAT_JPEG);
+  mcu = 8;  // 4:4:4 / 4:2:2 MCU height
+  check_same_as_frame2bmp(800, 600, PIXFORMAT_JPEG);
+}
+
+// Widths whose rows are not a multiple of four bytes, heights that leave a short last strip
+static void test_odd_sizes(void) {
+  const int sizes[][2] = {{1, 1}, {3, 5}, {101, 37}, {175, 17}, {33, 16}};
+  for (const auto &s : sizes) {
+    check_same_as_frame2bmp(s[0], s[1], PIXFORMAT_RGB565);
+    check_same_as_frame2bmp(s[0], s[1], PIXFORMAT_GRAYSCALE);
+    check_same_as_frame2bmp(s[0], s[1], PIXFORMAT_JPEG);
+  }
+}
+
+// Like frame2bmp, rows are not padded to four bytes: the size is exactly 54 + w*h*3
+static void test_row_padding(void) {
+  std::vector<uint8_t> src = source(5, 3, PIXFORMAT_GRAYSCALE);
+  camera_fb_t fb = {src.data(), src.size(), 5, 3, PIXFORMAT_GRAYSCALE, {0, 0}};
+  std::vector<uint8_t> got;
+  TEST_ASSERT_TRUE(bmp_stream_encode(&fb, collect, &got));
+  TEST_ASSERT_EQUAL(BMP_STREAM_HEADER_LEN + 5 * 3 * 3, got.size());
+  uint32_t image_size = got[34] | got[35] << 8 | got[36] << 16 | (uint32_t)got[37] << 24;
+  TEST_ASSERT_EQUAL(5 * 3 * 3, image_size);
+  // Row 1 starts right after the 15 bytes of row 0
+  TEST_ASSERT_EQUAL(src[5], got[BMP_STREAM_HEADER_LEN + 15]);
+}
+
+// Negative height: the first row in the file is the top row of the frame
+static void test_row_order(void) {
+  const int w = 4, h = 40;  // three strips
+  std::vector<uint8_t> src(w * h);
+  for (int y = 0; y < h; y++) memset(&src[y * w], y, w);
+  camera_fb_t fb = {src.data(), src.size(), w, h, PIXFORMAT_GRAYSCALE, {0, 0}};
+  std::vector<uint8_t> got;
+  TEST_ASSERT_TRUE(bmp_stream_encode(&fb, collect, &got));
+  int32_t height = (int32_t)(got[22] | got[23] << 8 | got[24] << 16 | (uint32_t)got[25] << 24);
+  TEST_ASSERT_EQUAL(-h, height);
+  for (int y = 0; y < h; y++) TEST_ASSERT_EQUAL(y, got[BMP_STREAM_HEADER_LEN + y * w * 3]);
+}
+
+static bool abort_after_header(void *arg, const uint8_t *data, size_t len) {
+  (void)data;
+  int *calls = (int *)arg;
+  (*calls)++;
+  return len == BMP_STREAM_HEADER_LEN;
+}
+
+static void test_sink_abort(void) {
+  std::vector<uint8_t> src = source(64, 64, PIXFORMAT_JPEG);
+  camera_fb_t fb = {src.data(), src.size(), 64, 64, PIXFORMAT_JPEG, {0, 0}};
+  int calls = 0;
+  TEST_ASSERT_FALSE(bmp_stream_encode(&fb, abort_after_header, &calls));
+  TEST_ASSERT_EQUAL(2, calls);
+}
+
+static void test_decoded_size_mismatch(void) {
+  std::vector<uint8_t> src = source(64, 48, PIXFORMAT_JPEG);
+  camera_fb_t fb = {src.data(), src.size(), 64, 64, PIXFORMAT_JPEG, {0, 0}};
+  std::vector<uint8_t> got;
+  TEST_ASSERT_FALSE(bmp_stream_encode(&fb, collect, &got));
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_rgb565);
+  RUN_TEST(test_grayscale);
+  RUN_TEST(test_jpeg_mcu_rows);
+  RUN_TEST(test_odd_sizes);
+  RUN_TEST(test_row_padding);
+  RUN_TEST(test_row_order);
+  RUN_TEST(test_sink_abort);
+  RUN_TEST(test_decoded_size_mismatch);
+  return UNITY_END();
+}
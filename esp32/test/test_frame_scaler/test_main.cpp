@@ -0,0 +1,285 @@
+// Upload-profile scaling: which decoder scale is picked for a source and target
+// size, when the source is passed through, and what reaches the encoder. The
+// decoder and encoder are fakes: the "JPEG" carries its size in the first four
+// bytes, and the encoder writes a small header with the size and quality it got.
+
+#include <unity.h>
+#include "frame_scaler.cpp"
+#include <vector>
+
+static sensor_t sensor;
+static sensor_t *sensor_ptr = &sensor;
+sensor_t *esp_camera_sensor_get() {
+  return sensor_ptr;
+}
+
+static int decode_scale = -1;   // scale of the last decode
+static bool decode_fails = false;
+static size_t encode_extra = 0;  // payload bytes after the encoder header
+static bool pixels_ok = false;   // encoder input matched the decoded image
+
+static uint8_t test_pixel(int x, int y, int c) {
+  return (uint8_t)(x * 3 + y * 5 + c * 77);
+}
+
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void *arg) {
+  decode_scale = scale;
+  uint8_t src[4];
+  if (decode_fails || len < 4 || reader(arg, 0, src, 4) != 4) return ESP_FAIL;
+  int w = (src[0] | src[1] << 8) >> scale, h = (src[2] | src[3] << 8) >> scale;
+  if (!writer(arg, 0, 0, w, h, NULL)) return ESP_FAIL;
+  const int mcu = 8;
+  std::vector<uint8_t> block(mcu * mcu * 3);
+  for (int y = 0; y < h; y += mcu) {
+    for (int x = 0; x < w; x += mcu) {
+      int bw = min(mcu, w - x), bh = min(mcu, h - y);
+      uint8_t *d = block.data();
+      for (int iy = 0; iy < bh; iy++) {
+        for (int ix = 0; ix < bw; ix++) {
+          for (int c = 0; c < 3; c++) *d++ = test_pixel(x + ix, y + iy, c);
+        }
+      }
+      if (!writer(arg, x, y, bw, bh, block.data())) return ESP_FAIL;
+    }
+  }
+  writer(arg, w, h, 0, 0, NULL);
+  return ESP_OK;
+}
+
+// Header: width, height (little endian), quality; then encode_extra filler bytes
+bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void *arg) {
+  pixels_ok = format == PIXFORMAT_RGB888 && src_len == (size_t)width * height * 3;
+  for (int y = 0; pixels_ok && y < height; y++) {
+    for (int x = 0; x < width; x++, src += 3) {
+      // BGR in memory
+      if (src[0] != test_pixel(x, y, 2) || src[1] != test_pixel(x, y, 1) || src[2] != test_pixel(x, y, 0)) {
+        pixels_ok = false;
+        break;
+      }
+    }
+  }
+  uint8_t head[5] = {(uint8_t)width, (uint8_t)(width >> 8), (uint8_t)height, (uint8_t)(height >> 8), quality};
+  if (cb(arg, 0, head, sizeof(head)) != sizeof(head)) return false;
+  std::vector<uint8_t> fill(encode_extra, 0x5A);
+  if (encode_extra && cb(arg, sizeof(head), fill.data(), fill.size()) != fill.size()) return false;
+  return true;
+}
+
+static uint8_t source[64];
+
+static const uint8_t *make_jpeg(uint16_t w, uint16_t h) {
+  memset(source, 0xAB, sizeof(source));
+  source[0] = (uint8_t)w;
+  source[1] = (uint8_t)(w >> 8);
+  source[2] = (uint8_t)h;
+  source[3] = (uint8_t)(h >> 8);
+  return source;
+}
+
+static bool run(uint16_t w, uint16_t h, int framesize, int quality, scaled_frame_t *out) {
+  decode_scale = -1;
+  pixels_ok = false;
+  return frame_scaler_run(make_jpeg(w, h), sizeof(source), w, h, framesize, quality, out);
+}
+
+static void assert_passthrough(const scaled_frame_t *out, uint16_t w, uint16_t h) {
+  TEST_ASSERT_FALSE(out->scaled);
+  TEST_ASSERT_TRUE(out->buf == source);
+  TEST_ASSERT_EQUAL(sizeof(source), out->len);
+  TEST_ASSERT_EQUAL(w, out->width);
+  TEST_ASSERT_EQUAL(h, out->height);
+}
+
+static void assert_scaled(const scaled_frame_t *out, uint16_t w, uint16_t h, uint8_t quality) {
+  TEST_ASSERT_TRUE(out->scaled);
+  TEST_ASSERT_TRUE(pixels_ok);
+  TEST_ASSERT_EQUAL(w, out->width);
+  TEST_ASSERT_EQUAL(h, out->height);
+  TEST_ASSERT_EQUAL(5 + encode_extra, out->len);
+  TEST_ASSERT_EQUAL(w, out->buf[0] | out->buf[1] << 8);
+  TEST_ASSERT_EQUAL(h, out->buf[2] | out->buf[3] << 8);
+  TEST_ASSERT_EQUAL(quality, out->buf[4]);
+}
+
+void setUp(void) {
+  sensor.status.quality = 10;
+  sensor_ptr = &sensor;
+  decode_fails = false;
+  encode_extra = 100;
+  passthrough = 0;
+  failures = 0;
+  profile_count = 0;
+}
+
+void tearDown(void) {}
+
+// Before frame_scaler_init() every frame is passed through; runs first
+static void test_without_buffer_passes_through(void) {
+  scaled_frame_t out;
+  TEST_ASSERT_TRUE(run(1600, 1200, FRAMESIZE_QQVGA, 12, &out));
+  assert_passthrough(&out, 1600, 1200);
+  TEST_ASSERT_EQUAL(-1, decode_scale);
+  TEST_ASSERT_EQUAL(1, passthrough);
+  TEST_ASSERT_TRUE(frame_scaler_init(64 * 1024));
+}
+
+static void test_uxga_to_qqvga_uses_eighth(void) {
+  scaled_frame_t out;
+  TEST_ASSERT_TRUE(run(1600, 1200, FRAMESIZE_QQVGA, 12, &out));
+  TEST_ASSERT_EQUAL(JPG_SCALE_8X, decode_scale);
+  assert_scaled(&out, 200, 150, encoder_quality(12));
+  TEST_ASSERT_EQUAL(1, profile_count);
+  TEST_ASSERT_EQUAL(8, profiles[0].scale);
+  TEST_ASSERT_EQUAL(1, profiles[0].frames);
+  TEST_ASSERT_EQUAL(sizeof(source), profiles[0].in_bytes);
+  TEST_ASSERT_EQUAL(out.len, profiles[0].out_bytes);
+}
+
+// The scale is the largest that keeps both sides at least the target's
+static void test_scale_choice(void) {
+  const struct {
+    uint16_t w, h;
+    int framesize;
+    int scale;
+    uint16_t ow, oh;
+  } cases[] = {
+      {1600, 1200, FRAMESIZE_QVGA, JPG_SCALE_4X, 400, 300},
+      {1600, 1200, FRAMESIZE_VGA, JPG_SCALE_2X, 800, 600},
+      {1600, 1200, FRAMESIZE_SVGA, JPG_SCALE_2X, 800, 600},
+      {800, 600, FRAMESIZE_QVGA, JPG_SCALE_2X, 400, 300},
+      {800, 600, FRAMESIZE_96X96, JPG_SCALE_4X, 200, 150},
+      {640, 480, FRAMESIZE_QQVGA, JPG_SCALE_4X, 160, 120},
+      {2560, 1920, FRAMESIZE_QVGA, JPG_SCALE_8X, 320, 240},
+  };
+  for (const auto &c : cases) {
+    scaled_frame_t out;
+    TEST_ASSERT_TRUE(run(c.w, c.h, c.framesize, 12, &out));
+    TEST_ASSERT_EQUAL(c.scale, decode_scale);
+    assert_scaled(&out, c.ow, c.oh, encoder_quality(12));
+  }
+}
+
+// A target of another aspect ratio is covered on both sides, never cropped:
+// HD to QVGA stops at 1/2 because 1/4 would be 180 lines high
+static void test_aspect_ratio_clamp(void) {
+  scaled_frame_t out;
+  TEST_ASSERT_TRUE(run(1280, 720, FRAMESIZE_QVGA, 12, &out));
+  TEST_ASSERT_EQUAL(JPG_SCALE_2X, decode_scale);
+  assert_scaled(&out, 640, 360, encoder_quality(12));
+
+  // Portrait target from a landscape source: the width decides
+  TEST_ASSERT_TRUE(run(1600, 1200, FRAMESIZE_P_HD, 12, &out));
+  assert_passthrough(&out, 1600, 1200);
+  TEST_ASSERT_TRUE(run(1600, 1200, FRAMESIZE_240X240, 12, &out));
+  TEST_ASSERT_EQUAL(JPG_SCALE_4X, decode_scale);
+  assert_scaled(&out, 400, 300, encoder_quality(12));
+}
+
+// No downscale and no coarser quality: the sensor's JPEG is used as is
+static void test_same_size_passes_through(void) {
+  scaled_frame_t out;
+  TEST_ASSERT_TRUE(run(640, 480, FRAMESIZE_VGA, 10, &out));
+  assert_passthrough(&out, 640, 480);
+  TEST_ASSERT_TRUE(run(640, 480, FRAMESIZE_VGA, 4, &out));
+  assert_passthrough(&out, 640, 480);
+  // A target larger than the source cannot be met; the source goes out unchanged
+  TEST_ASSERT_TRUE(run(320, 240, FRAMESIZE_UXGA, 10, &out));
+  assert_passthrough(&out, 320, 240);
+  TEST_ASSERT_EQUAL(-1, decode_scale);
+  TEST_ASSERT_EQUAL(3, passthrough);
+}
+
+// A coarser quality than the sensor's is re-encoded at full size up to VGA
+static void test_quality_only_reencode(void) {
+  scaled_frame_t out;
+  TEST_ASSERT_TRUE(run(640, 480, FRAMESIZE_VGA, 30, &out));
+  TEST_ASSERT_EQUAL(JPG_SCALE_NONE, decode_scale);
+  assert_scaled(&out, 640, 480, encoder_quality(30));
+  TEST_ASSERT_EQUAL(1, profiles[0].scale);
+
+  // Above VGA the full-size RGB frame is too big; passed through
+  TEST_ASSERT_TRUE(run(800, 600, FRAMESIZE_SVGA, 30, &out));
+  assert_passthrough(&out, 800, 600);
+
+  // Without a sensor its quality counts as the worst
+  sensor_ptr = NULL;
+  TEST_ASSERT_TRUE(run(640, 480, FRAMESIZE_VGA, 30, &out));
+  assert_passthrough(&out, 640, 480);
+}
+
+static void test_invalid_framesize_passes_through(void) {
+  scaled_frame_t out;
+  TEST_ASSERT_TRUE(run(1600, 1200, -1, 12, &out));
+  assert_passthrough(&out, 1600, 1200);
+  TEST_ASSERT_TRUE(run(1600, 1200, FRAMESIZE_INVALID, 12, &out));
+  assert_passthrough(&out, 1600, 1200);
+  TEST_ASSERT_EQUAL(-1, decode_scale);
+  TEST_ASSERT_EQUAL(2, passthrough);
+}
+
+// An encoded frame that does not fit the output buffer falls back to the source
+static void test_overflow_passes_through(void) {
+  scaled_frame_t out;
+  encode_extra = out_cap;
+  TEST_ASSERT_TRUE(run(1600, 1200, FRAMESIZE_QQVGA, 12, &out));
+  TEST_ASSERT_EQUAL(JPG_SCALE_8X, decode_scale);
+  assert_passthrough(&out, 1600, 1200);
+  TEST_ASSERT_EQUAL(1, passthrough);
+  TEST_ASSERT_EQUAL(0, failures);
+  TEST_ASSERT_EQUAL(0, profile_count);
+
+  encode_extra = out_cap - 5;
+  TEST_ASSERT_TRUE(run(1600, 1200, FRAMESIZE_QQVGA, 12, &out));
+  assert_scaled(&out, 200, 150, encoder_quality(12));
+}
+
+static void test_decode_failure(void) {
+  scaled_frame_t out;
+  decode_fails = true;
+  TEST_ASSERT_FALSE(run(1600, 1200, FRAMESIZE_QQVGA, 12, &out));
+  TEST_ASSERT_EQUAL(1, failures);
+  // `out` still describes the source
+  assert_passthrough(&out, 1600, 1200);
+}
+
+// Sensor 0 (best) .. 63 (worst) maps onto encoder 100 .. 10
+static void test_quality_mapping(void) {
+  TEST_ASSERT_EQUAL(100, encoder_quality(0));
+  TEST_ASSERT_EQUAL(72, encoder_quality(20));
+  TEST_ASSERT_EQUAL(10, encoder_quality(63));
+  TEST_ASSERT_EQUAL(100, encoder_quality(-5));
+  TEST_ASSERT_EQUAL(10, encoder_quality(99));
+  for (int q = 1; q <= 63; q++) TEST_ASSERT_TRUE(encoder_quality(q) <= encoder_quality(q - 1));
+}
+
+// The RGB buffer grows for a larger decode and is reused for a smaller one
+static void test_rgb_buffer_reuse(void) {
+  scaled_frame_t out;
+  TEST_ASSERT_TRUE(run(1600, 1200, FRAMESIZE_QQVGA, 12, &out));
+  TEST_ASSERT_TRUE(run(1600, 1200, FRAMESIZE_VGA, 12, &out));
+  size_t cap = rgb_cap;
+  TEST_ASSERT_EQUAL(800 * 600 * 3, cap);
+  TEST_ASSERT_TRUE(run(1600, 1200, FRAMESIZE_QQVGA, 12, &out));
+  assert_scaled(&out, 200, 150, encoder_quality(12));
+  TEST_ASSERT_EQUAL(cap, rgb_cap);
+  TEST_ASSERT_EQUAL(2, profile_count);
+  TEST_ASSERT_EQUAL(2, profiles[0].frames);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_without_buffer_passes_through);
+  RUN_TEST(test_uxga_to_qqvga_uses_eighth);
+  RUN_TEST(test_scale_choice);
+  RUN_TEST(test_aspect_ratio_clamp);
+  RUN_TEST(test_same_size_passes_through);
+  RUN_TEST(test_quality_only_reencode);
+  RUN_TEST(test_invalid_framesize_passes_through);
+  RUN_TEST(test_overflow_passes_through);
+  RUN_TEST(test_decode_failure);
+  RUN_TEST(test_quality_mapping);
+  RUN_TEST(test_rgb_buffer_reuse);
+  return UNITY_END();
+}
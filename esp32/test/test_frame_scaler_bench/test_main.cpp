@@ -0,0 +1,110 @@
+// Cost of the upload scaler's decode / scale / encode per source and target
+// framesize, on the board: pio test -e esp32s3cam
+//
+// This runs on the device rather than natively because the decoder is the chip's
+// ROM tjpgd behind esp_jpg_decode(), and the timings that matter are the S3's
+// with PSRAM buffers. Source JPEGs are encoded from a generated test image with
+// fmt2jpg(), so no camera is needed. Decode and encode times come from the same
+// per-profile counters GET /uploader/status reports.
+
+#include <unity.h>
+#include "frame_scaler.cpp"
+#include "img_converters.h"
+
+#define BENCH_RUNS 5
+#define BENCH_OUT_CAP (512 * 1024)
+#define BENCH_SOURCE_QUALITY 12  // sensor scale, as streamed
+#define BENCH_UPLOAD_QUALITY 12
+
+// Smooth gradients with a few hard edges and some noise, so the entropy is closer
+// to a camera frame than a flat test card
+static uint8_t *make_source(uint16_t w, uint16_t h, size_t *len) {
+  size_t rgb_len = (size_t)w * h * 3;
+  uint8_t *rgb = (uint8_t *)heap_caps_malloc(rgb_len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!rgb) return NULL;
+  uint32_t seed = 0x2545F491;
+  uint8_t *p = rgb;
+  for (uint16_t y = 0; y < h; y++) {
+    for (uint16_t x = 0; x < w; x++) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      uint8_t noise = seed & 0x0F;
+      bool edge = ((x / 64) + (y / 48)) & 1;
+      *p++ = (uint8_t)(x * 255 / w) ^ (edge ? 0x40 : 0) ^ noise;
+      *p++ = (uint8_t)(y * 255 / h) + noise;
+      *p++ = (uint8_t)((x + y) * 128 / (w + h)) + (edge ? 0x60 : 0);
+    }
+  }
+  uint8_t *jpg = NULL;
+  bool ok = fmt2jpg(rgb, rgb_len, w, h, PIXFORMAT_RGB888, encoder_quality(BENCH_SOURCE_QUALITY), &jpg, len);
+  free(rgb);
+  return ok ? jpg : NULL;
+}
+
+static void bench(framesize_t source, framesize_t target) {
+  uint16_t w = resolution[source].width, h = resolution[source].height;
+  size_t len = 0;
+  uint8_t *jpg = make_source(w, h, &len);
+  TEST_ASSERT_NOT_NULL(jpg);
+
+  profile_count = 0;
+  int64_t total_us = 0;
+  scaled_frame_t out;
+  for (int i = 0; i < BENCH_RUNS; i++) {
+    int64_t t0 = esp_timer_get_time();
+    TEST_ASSERT_TRUE(frame_scaler_run(jpg, len, w, h, target, BENCH_UPLOAD_QUALITY, &out));
+    total_us += esp_timer_get_time() - t0;
+    TEST_ASSERT_TRUE(out.scaled);
+  }
+  free(jpg);
+
+  const scaler_profile_t *p = &profiles[0];
+  TEST_ASSERT_EQUAL(1, profile_count);
+  TEST_ASSERT_EQUAL(BENCH_RUNS, p->frames);
+  char line[200];
+  snprintf(line, sizeof(line),
+           "%ux%u (%u B) -> %ux%u (%u B) 1/%u: decode %u us (max %u), encode %u us (max %u), total %u us",
+           w, h, (unsigned)len, p->out_w, p->out_h, (unsigned)(p->out_bytes / p->frames), p->scale,
+           (unsigned)(p->decode_us / p->frames), (unsigned)p->decode_max_us, (unsigned)(p->encode_us / p->frames),
+           (unsigned)p->encode_max_us, (unsigned)(total_us / BENCH_RUNS));
+  TEST_MESSAGE(line);
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+static void test_benchmark_uxga(void) {
+  bench(FRAMESIZE_UXGA, FRAMESIZE_SVGA);
+  bench(FRAMESIZE_UXGA, FRAMESIZE_QVGA);
+  bench(FRAMESIZE_UXGA, FRAMESIZE_QQVGA);
+}
+
+static void test_benchmark_hd(void) {
+  bench(FRAMESIZE_HD, FRAMESIZE_QVGA);
+  bench(FRAMESIZE_HD, FRAMESIZE_QQVGA);
+}
+
+static void test_benchmark_svga(void) {
+  bench(FRAMESIZE_SVGA, FRAMESIZE_QVGA);
+  bench(FRAMESIZE_SVGA, FRAMESIZE_QQVGA);
+}
+
+static void test_benchmark_vga(void) {
+  bench(FRAMESIZE_VGA, FRAMESIZE_QVGA);
+  bench(FRAMESIZE_VGA, FRAMESIZE_QQVGA);
+}
+
+void setup() {
+  delay(2000);  // let the serial monitor attach
+  UNITY_BEGIN();
+  TEST_ASSERT_TRUE(frame_scaler_init(BENCH_OUT_CAP));
+  RUN_TEST(test_benchmark_uxga);
+  RUN_TEST(test_benchmark_hd);
+  RUN_TEST(test_benchmark_svga);
+  RUN_TEST(test_benchmark_vga);
+  UNITY_END();
+}
+
+void loop() {}
@@ -0,0 +1,317 @@
+// Segment log of the persistent upload queue, run on the host against the
+// file-backed LittleFS stand-in (test/stubs/LittleFS.h). Includes a throughput
+// benchmark of append, drain and the index rebuild at mount.
+
+#include <unity.h>
+#include "esp_timer.h"
+#include "host_support.h"
+#include "upload_queue.cpp"
+
+#define FRAME_BYTES 1000
+#define SEG_BYTES 4096     // four 1000-byte records per segment
+#define BUDGET_BYTES (64 * 1024)
+
+// Drop the in-RAM state as a reboot would; the files stay
+static void queue_reboot() {
+  free(segs);
+  free(recs);
+  free(io_buf);
+  segs = NULL;
+  recs = NULL;
+  io_buf = NULL;
+  io_cap = 0;
+  seg_count = seg_cap = rec_count = 0;
+  attempted = ready = false;
+  active_seg = 0;
+  next_seg = 1;
+  next_lsn = 1;
+  max_frames = UPLOAD_QUEUE_MAX_FRAMES;
+  memset(&stats, 0, sizeof(stats));
+}
+
+static void fill_frame(uint8_t *buf, size_t len, uint32_t seq) {
+  for (size_t i = 0; i < len; i++) buf[i] = (uint8_t)(seq * 31 + i * 7);
+}
+
+static bool append_frame(uint32_t seq, size_t len = FRAME_BYTES) {
+  static uint8_t buf[32 * 1024];
+  fill_frame(buf, len, seq);
+  struct timeval ts = {(time_t)(1700000000 + seq), (suseconds_t)(seq * 1000)};
+  return upload_queue_append(buf, len, seq, &ts);
+}
+
+// Peek the next frame, check its payload and metadata, then ack it
+static uint32_t drain_one(size_t len = FRAME_BYTES) {
+  upload_queue_frame_t f;
+  TEST_ASSERT_TRUE(upload_queue_peek(&f));
+  TEST_ASSERT_EQUAL(len, f.len);
+  static uint8_t expect[32 * 1024];
+  fill_frame(expect, len, f.seq);
+  TEST_ASSERT_EQUAL_MEMORY(expect, f.buf, len);
+  TEST_ASSERT_EQUAL(1700000000 + f.seq, f.timestamp.tv_sec);
+  TEST_ASSERT_EQUAL(f.seq * 1000, f.timestamp.tv_usec);
+  upload_queue_ack(&f);
+  return f.seq;
+}
+
+static std::string seg_file(uint32_t id) {
+  char path[32];
+  seg_path(path, sizeof(path), id);
+  return LittleFS.host_path(path);
+}
+
+static size_t seg_files() {
+  size_t n = 0;
+  for (const auto &e : std::filesystem::directory_iterator(LittleFS.host_path(QUEUE_DIR))) n += e.path().extension() == ".seg";
+  return n;
+}
+
+void setUp(void) {
+  queue_reboot();
+  LittleFS.root = std::filesystem::temp_directory_path() / "upload_queue_test";
+  LittleFS.format();
+}
+
+void tearDown(void) {
+  std::error_code ec;
+  std::filesystem::remove_all(LittleFS.root, ec);
+}
+
+static void test_append_drain_fifo(void) {
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  for (uint32_t seq = 1; seq <= 5; seq++) TEST_ASSERT_TRUE(append_frame(seq));
+  TEST_ASSERT_EQUAL(5, upload_queue_count());
+  for (uint32_t seq = 1; seq <= 5; seq++) TEST_ASSERT_EQUAL(seq, drain_one());
+  TEST_ASSERT_EQUAL(0, upload_queue_count());
+  upload_queue_frame_t f;
+  TEST_ASSERT_FALSE(upload_queue_peek(&f));
+  // Fully drained segments are deleted
+  TEST_ASSERT_EQUAL(0, seg_files());
+}
+
+static void test_newest_first(void) {
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_NEWEST_FIRST));
+  for (uint32_t seq = 1; seq <= 5; seq++) TEST_ASSERT_TRUE(append_frame(seq));
+  for (uint32_t seq = 5; seq >= 1; seq--) TEST_ASSERT_EQUAL(seq, drain_one());
+}
+
+static void test_replay_after_reboot(void) {
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  for (uint32_t seq = 1; seq <= 10; seq++) TEST_ASSERT_TRUE(append_frame(seq));
+  for (uint32_t seq = 1; seq <= 3; seq++) TEST_ASSERT_EQUAL(seq, drain_one());
+
+  queue_reboot();
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  TEST_ASSERT_EQUAL(7, upload_queue_count());
+  TEST_ASSERT_EQUAL(0, stats.corrupt);
+  // Appends after the reboot go to a new segment and keep the order
+  TEST_ASSERT_TRUE(append_frame(11));
+  for (uint32_t seq = 4; seq <= 11; seq++) TEST_ASSERT_EQUAL(seq, drain_one());
+}
+
+static void test_torn_tail(void) {
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  for (uint32_t seq = 1; seq <= 3; seq++) TEST_ASSERT_TRUE(append_frame(seq));
+  // Power lost in the middle of the third record's payload
+  std::filesystem::path seg = seg_file(1);
+  std::filesystem::resize_file(seg, std::filesystem::file_size(seg) - FRAME_BYTES / 2);
+
+  queue_reboot();
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  TEST_ASSERT_EQUAL(2, upload_queue_count());
+  TEST_ASSERT_EQUAL(1, stats.corrupt);
+  TEST_ASSERT_TRUE(append_frame(4));
+  TEST_ASSERT_EQUAL(1, drain_one());
+  TEST_ASSERT_EQUAL(2, drain_one());
+  TEST_ASSERT_EQUAL(4, drain_one());
+}
+
+static void test_torn_header(void) {
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  for (uint32_t seq = 1; seq <= 2; seq++) TEST_ASSERT_TRUE(append_frame(seq));
+  // Only part of the second record header made it
+  std::filesystem::path seg = seg_file(1);
+  std::filesystem::resize_file(seg, sizeof(seg_header_t) + sizeof(rec_header_t) + FRAME_BYTES + 5);
+
+  queue_reboot();
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  TEST_ASSERT_EQUAL(1, upload_queue_count());
+  TEST_ASSERT_EQUAL(1, drain_one());
+}
+
+static void corrupt_payload(uint32_t seg, int record) {
+  FILE *fp = fopen(seg_file(seg).c_str(), "r+b");
+  TEST_ASSERT_NOT_NULL(fp);
+  long off = sizeof(seg_header_t) + record * (sizeof(rec_header_t) + FRAME_BYTES) + sizeof(rec_header_t) + 10;
+  fseek(fp, off, SEEK_SET);
+  int ch = fgetc(fp);
+  fseek(fp, off, SEEK_SET);
+  fputc(ch ^ 0x40, fp);
+  fclose(fp);
+}
+
+static void test_crc_mismatch_at_mount(void) {
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  for (uint32_t seq = 1; seq <= 3; seq++) TEST_ASSERT_TRUE(append_frame(seq));
+  corrupt_payload(1, 1);
+
+  queue_reboot();
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  // The bad record is skipped; the one after it is still found
+  TEST_ASSERT_EQUAL(2, upload_queue_count());
+  TEST_ASSERT_EQUAL(1, stats.corrupt);
+  TEST_ASSERT_EQUAL(1, drain_one());
+  TEST_ASSERT_EQUAL(3, drain_one());
+}
+
+static void test_crc_mismatch_at_drain(void) {
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  for (uint32_t seq = 1; seq <= 3; seq++) TEST_ASSERT_TRUE(append_frame(seq));
+  corrupt_payload(1, 0);
+  // Corrupted after it was indexed: peek drops it instead of handing it out
+  TEST_ASSERT_EQUAL(2, drain_one());
+  TEST_ASSERT_EQUAL(1, stats.corrupt);
+  TEST_ASSERT_EQUAL(3, drain_one());
+}
+
+static void test_version1_segment(void) {
+  // A segment written before records carried a CRC is still drained
+  LittleFS.mkdir(QUEUE_DIR);
+  FILE *fp = fopen(seg_file(7).c_str(), "wb");
+  seg_header_t sh = {SEG_MAGIC, 1, 0, 7, 0};
+  fwrite(&sh, sizeof(sh), 1, fp);
+  uint8_t payload[FRAME_BYTES];
+  for (uint32_t seq = 1; seq <= 2; seq++) {
+    rec_header_t h = {REC_MAGIC, REC_LIVE, 0, FRAME_BYTES, seq, seq, 1700000000 + seq, seq * 1000, 0};
+    fill_frame(payload, sizeof(payload), seq);
+    fwrite(&h, REC_V1_BYTES, 1, fp);
+    fwrite(payload, sizeof(payload), 1, fp);
+  }
+  fclose(fp);
+
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  TEST_ASSERT_EQUAL(2, upload_queue_count());
+  TEST_ASSERT_TRUE(append_frame(3));
+  TEST_ASSERT_EQUAL(1, drain_one());
+  TEST_ASSERT_EQUAL(2, drain_one());
+  TEST_ASSERT_EQUAL(3, drain_one());
+}
+
+static void test_segment_rollover(void) {
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  for (uint32_t seq = 1; seq <= 10; seq++) TEST_ASSERT_TRUE(append_frame(seq));
+  // Three records fit in a segment next to its header
+  TEST_ASSERT_EQUAL(4, seg_count);
+  TEST_ASSERT_EQUAL(4, seg_files());
+  for (int i = 0; i < seg_count; i++) TEST_ASSERT_LESS_OR_EQUAL(SEG_BYTES, segs[i].file_bytes);
+
+  // Draining the first segment's records deletes its file
+  for (uint32_t seq = 1; seq <= 3; seq++) TEST_ASSERT_EQUAL(seq, drain_one());
+  TEST_ASSERT_EQUAL(3, seg_files());
+  TEST_ASSERT_FALSE(std::filesystem::exists(seg_file(1)));
+
+  queue_reboot();
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  TEST_ASSERT_EQUAL(7, upload_queue_count());
+  for (uint32_t seq = 4; seq <= 10; seq++) TEST_ASSERT_EQUAL(seq, drain_one());
+  TEST_ASSERT_EQUAL(0, seg_files());
+}
+
+static void test_budget_evicts_oldest_segment(void) {
+  // Room for two full segments
+  TEST_ASSERT_TRUE(upload_queue_begin(2 * SEG_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  for (uint32_t seq = 1; seq <= 9; seq++) TEST_ASSERT_TRUE(append_frame(seq));
+  TEST_ASSERT_LESS_OR_EQUAL(2 * SEG_BYTES, disk_bytes());
+  TEST_ASSERT_GREATER_THAN(0, stats.evicted);
+  TEST_ASSERT_EQUAL(9, upload_queue_count() + stats.evicted);
+  // Whole segments go, oldest first: what is left is the newest frames in order
+  for (uint32_t seq = 10 - upload_queue_count(); seq <= 9; seq++) TEST_ASSERT_EQUAL(seq, drain_one());
+}
+
+static void test_frame_limit(void) {
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  upload_queue_set_max_frames(4);
+  for (uint32_t seq = 1; seq <= 6; seq++) TEST_ASSERT_TRUE(append_frame(seq));
+  TEST_ASSERT_EQUAL(4, upload_queue_count());
+  TEST_ASSERT_EQUAL(3, drain_one());
+}
+
+static void test_rejects_oversized(void) {
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  TEST_ASSERT_FALSE(append_frame(1, FRAME_BYTES + 1));  // larger than the read buffer
+  TEST_ASSERT_EQUAL(1, stats.rejected);
+  TEST_ASSERT_EQUAL(0, upload_queue_count());
+}
+
+static void test_compaction_keeps_order(void) {
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  for (uint32_t seq = 1; seq <= 9; seq++) TEST_ASSERT_TRUE(append_frame(seq));
+  // Leave one live record in each of the first two (sealed) segments
+  upload_queue_frame_t f;
+  for (int i = 0; i < rec_count;) {
+    if (recs[i].seq % 3 != 0 && recs[i].seq <= 6) {
+      f.lsn = recs[i].lsn;
+      upload_queue_ack(&f);
+    } else {
+      i++;
+    }
+  }
+  TEST_ASSERT_EQUAL(5, upload_queue_count());
+  while (upload_queue_compact_step()) {
+  }
+  TEST_ASSERT_EQUAL(2, stats.compacted);
+  TEST_ASSERT_FALSE(std::filesystem::exists(seg_file(1)));
+  TEST_ASSERT_FALSE(std::filesystem::exists(seg_file(2)));
+
+  queue_reboot();
+  TEST_ASSERT_TRUE(upload_queue_begin(BUDGET_BYTES, SEG_BYTES, FRAME_BYTES, UPLOAD_QUEUE_FIFO));
+  uint32_t expect[] = {3, 6, 7, 8, 9};
+  for (uint32_t seq : expect) TEST_ASSERT_EQUAL(seq, drain_one());
+}
+
+// Not a pass/fail test: prints append, drain and mount throughput on this host.
+// Host file I/O is far faster than LittleFS on flash; compare runs, not devices.
+static void test_benchmark_throughput(void) {
+  const size_t frame = 24 * 1024;  // a QVGA-ish JPEG
+  const int frames = 200;
+  const size_t budget = 8 * 1024 * 1024;
+  TEST_ASSERT_TRUE(upload_queue_begin(budget, 64 * 1024, frame, UPLOAD_QUEUE_FIFO));
+
+  int64_t t0 = esp_timer_get_time();
+  for (int i = 0; i < frames; i++) TEST_ASSERT_TRUE(append_frame(i, frame));
+  int64_t t1 = esp_timer_get_time();
+  queue_reboot();
+  TEST_ASSERT_TRUE(upload_queue_begin(budget, 64 * 1024, frame, UPLOAD_QUEUE_FIFO));
+  int64_t t2 = esp_timer_get_time();
+  TEST_ASSERT_EQUAL(frames, upload_queue_count());
+  upload_queue_frame_t f;
+  while (upload_queue_peek(&f)) upload_queue_ack(&f);
+  int64_t t3 = esp_timer_get_time();
+
+  double mb = (double)frames * frame / (1024 * 1024);
+  char line[160];
+  snprintf(line, sizeof(line), "append %.1f MB/s, mount %.1f MB/s, drain %.1f MB/s (%d x %u bytes)", mb / ((t1 - t0) / 1e6),
+           mb / ((t2 - t1) / 1e6), mb / ((t3 - t2) / 1e6), frames, (unsigned)frame);
+  TEST_MESSAGE(line);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_append_drain_fifo);
+  RUN_TEST(test_newest_first);
+  RUN_TEST(test_replay_after_reboot);
+  RUN_TEST(test_torn_tail);
+  RUN_TEST(test_torn_header);
+  RUN_TEST(test_crc_mismatch_at_mount);
+  RUN_TEST(test_crc_mismatch_at_drain);
+  RUN_TEST(test_version1_segment);
+  RUN_TEST(test_segment_rollover);
+  RUN_TEST(test_budget_evicts_oldest_segment);
+  RUN_TEST(test_frame_limit);
+  RUN_TEST(test_rejects_oversized);
+  RUN_TEST(test_compaction_keeps_order);
+  RUN_TEST(test_benchmark_throughput);
+  return UNITY_END();
+}
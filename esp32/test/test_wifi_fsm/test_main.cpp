@@ -0,0 +1,238 @@
+// Transitions of the Wi-Fi manager's state machine. The FSM is pure C, so each
+// test drives it with events and explicit times and checks state and actions.
+
+#include <unity.h>
+#include "wifi_fsm.cpp"
+
+#define CONNECT_MS 15000
+#define SCAN_MS 10000
+
+static wifi_fsm_t fsm;
+
+void setUp(void) {
+  wifi_fsm_init(&fsm, CONNECT_MS, SCAN_MS, true, 1, 0);
+}
+
+void tearDown(void) {}
+
+static uint32_t step(wifi_fsm_event_t ev, uint32_t now_ms, uint32_t creds = 0) {
+  return wifi_fsm_step(&fsm, ev, now_ms, creds);
+}
+
+static void test_init_connected(void) {
+  TEST_ASSERT_EQUAL(WIFI_FSM_CONNECTED, fsm.state);
+  TEST_ASSERT_EQUAL(1, fsm.token);
+  TEST_ASSERT_EQUAL(1, fsm.connects);
+  TEST_ASSERT_EQUAL(WIFI_FSM_TOKEN_CONNECTED, wifi_fsm_token_status(&fsm, 1));
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_TICK, 100000));
+}
+
+static void test_connect_then_got_ip(void) {
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_BEGIN, step(WIFI_FSM_EV_CONNECT, 100, 2));
+  TEST_ASSERT_EQUAL(WIFI_FSM_CONNECTING, fsm.state);
+  TEST_ASSERT_EQUAL(2, fsm.token);
+  TEST_ASSERT_EQUAL(WIFI_FSM_TOKEN_PENDING, wifi_fsm_token_status(&fsm, 2));
+  TEST_ASSERT_EQUAL(WIFI_FSM_TOKEN_SUPERSEDED, wifi_fsm_token_status(&fsm, 1));
+  TEST_ASSERT_EQUAL(WIFI_FSM_TOKEN_UNKNOWN, wifi_fsm_token_status(&fsm, 3));
+  TEST_ASSERT_EQUAL(WIFI_FSM_TOKEN_UNKNOWN, wifi_fsm_token_status(&fsm, 0));
+
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_CONNECTED, step(WIFI_FSM_EV_GOT_IP, 2000));
+  TEST_ASSERT_EQUAL(WIFI_FSM_CONNECTED, fsm.state);
+  TEST_ASSERT_EQUAL(WIFI_FSM_TOKEN_CONNECTED, wifi_fsm_token_status(&fsm, 2));
+  TEST_ASSERT_EQUAL(2, fsm.connects);
+}
+
+// The same credentials while joining or joined share the request
+static void test_connect_dedup(void) {
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_CONNECT, 0, 1));
+  TEST_ASSERT_EQUAL(1, fsm.token);
+  step(WIFI_FSM_EV_CONNECT, 0, 2);
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_CONNECT, 10, 2));
+  TEST_ASSERT_EQUAL(2, fsm.token);
+  TEST_ASSERT_EQUAL(2, fsm.connects);
+  // New credentials replace the attempt in progress
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_BEGIN, step(WIFI_FSM_EV_CONNECT, 20, 3));
+  TEST_ASSERT_EQUAL(3, fsm.token);
+}
+
+static void test_timeout_fails(void) {
+  step(WIFI_FSM_EV_CONNECT, 1000, 2);
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_TICK, 1000 + CONNECT_MS - 1));
+  TEST_ASSERT_EQUAL(WIFI_FSM_CONNECTING, fsm.state);
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_TICK, 1000 + CONNECT_MS));
+  TEST_ASSERT_EQUAL(WIFI_FSM_FAILED, fsm.state);
+  TEST_ASSERT_EQUAL(1, fsm.failures);
+  TEST_ASSERT_EQUAL(WIFI_FSM_TOKEN_FAILED, wifi_fsm_token_status(&fsm, 2));
+  // A new request for the same credentials starts over from FAILED
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_BEGIN, step(WIFI_FSM_EV_CONNECT, 20000, 2));
+  TEST_ASSERT_EQUAL(3, fsm.token);
+}
+
+// Disconnects while associating are the driver's retries, not new attempts
+static void test_disconnect_while_connecting(void) {
+  step(WIFI_FSM_EV_CONNECT, 0, 2);
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_DISCONNECTED, 500));
+  TEST_ASSERT_EQUAL(WIFI_FSM_CONNECTING, fsm.state);
+  TEST_ASSERT_EQUAL(0, fsm.drops);
+  TEST_ASSERT_EQUAL(2, fsm.connects);
+}
+
+// A dropped link is rejoined at once, with a fresh deadline
+static void test_drop_rejoins(void) {
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_BEGIN, step(WIFI_FSM_EV_DISCONNECTED, 50000));
+  TEST_ASSERT_EQUAL(WIFI_FSM_CONNECTING, fsm.state);
+  TEST_ASSERT_EQUAL(1, fsm.drops);
+  TEST_ASSERT_EQUAL(2, fsm.connects);
+  TEST_ASSERT_EQUAL(50000 + CONNECT_MS, fsm.deadline_ms);
+  TEST_ASSERT_EQUAL(WIFI_FSM_TOKEN_PENDING, wifi_fsm_token_status(&fsm, 1));
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_CONNECTED, step(WIFI_FSM_EV_GOT_IP, 52000));
+  TEST_ASSERT_EQUAL(WIFI_FSM_TOKEN_CONNECTED, wifi_fsm_token_status(&fsm, 1));
+}
+
+// A drop during a scan waits for the scan before joining
+static void test_drop_while_scanning(void) {
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_SCAN, step(WIFI_FSM_EV_SCAN, 0));
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_DISCONNECTED, 100));
+  TEST_ASSERT_TRUE(fsm.begin_pending);
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_COLLECT | WIFI_FSM_ACT_BEGIN, step(WIFI_FSM_EV_SCAN_DONE, 3000));
+  TEST_ASSERT_FALSE(fsm.begin_pending);
+  TEST_ASSERT_EQUAL(3000 + CONNECT_MS, fsm.deadline_ms);
+}
+
+static uint32_t fail_at(uint32_t start_ms) {
+  uint32_t at = start_ms + CONNECT_MS;
+  step(WIFI_FSM_EV_TICK, at);
+  TEST_ASSERT_EQUAL(WIFI_FSM_FAILED, fsm.state);
+  return at;
+}
+
+// FAILED retries on its own, backing off from RETRY_MIN to RETRY_MAX
+static void test_failed_retries_with_backoff(void) {
+  step(WIFI_FSM_EV_CONNECT, 0, 2);
+  uint32_t t = fail_at(0);
+  uint32_t expect = WIFI_FSM_RETRY_MIN_MS;
+  for (int i = 0; i < 10; i++) {
+    TEST_ASSERT_EQUAL(t + expect, fsm.retry_at_ms);
+    TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_TICK, t + expect - 1));
+    TEST_ASSERT_EQUAL(WIFI_FSM_ACT_BEGIN, step(WIFI_FSM_EV_TICK, t + expect));
+    TEST_ASSERT_EQUAL(WIFI_FSM_CONNECTING, fsm.state);
+    TEST_ASSERT_EQUAL(2, fsm.token);  // a retry is not a new request
+    t = fail_at(t + expect);
+    expect = expect * 2 < WIFI_FSM_RETRY_MAX_MS ? expect * 2 : WIFI_FSM_RETRY_MAX_MS;
+  }
+  TEST_ASSERT_EQUAL(WIFI_FSM_RETRY_MAX_MS, fsm.retry_at_ms - t);
+  TEST_ASSERT_EQUAL(11, fsm.failures);
+  TEST_ASSERT_EQUAL(12, fsm.connects);
+
+  // Success resets the backoff
+  step(WIFI_FSM_EV_TICK, fsm.retry_at_ms);
+  step(WIFI_FSM_EV_GOT_IP, fsm.retry_at_ms + 100);
+  step(WIFI_FSM_EV_DISCONNECTED, 2000000);
+  t = fail_at(2000000);
+  TEST_ASSERT_EQUAL(t + WIFI_FSM_RETRY_MIN_MS, fsm.retry_at_ms);
+}
+
+// A new request resets the backoff
+static void test_request_resets_backoff(void) {
+  step(WIFI_FSM_EV_CONNECT, 0, 2);
+  uint32_t t = fail_at(0);
+  step(WIFI_FSM_EV_TICK, t + WIFI_FSM_RETRY_MIN_MS);
+  t = fail_at(t + WIFI_FSM_RETRY_MIN_MS);
+  TEST_ASSERT_EQUAL(t + 2 * WIFI_FSM_RETRY_MIN_MS, fsm.retry_at_ms);
+  step(WIFI_FSM_EV_CONNECT, t + 1, 3);
+  t = fail_at(t + 1);
+  TEST_ASSERT_EQUAL(t + WIFI_FSM_RETRY_MIN_MS, fsm.retry_at_ms);
+}
+
+// Not connected at boot: the first retry follows after RETRY_MIN
+static void test_init_failed_retries(void) {
+  wifi_fsm_init(&fsm, CONNECT_MS, SCAN_MS, false, 1, 7000);
+  TEST_ASSERT_EQUAL(WIFI_FSM_FAILED, fsm.state);
+  TEST_ASSERT_EQUAL(WIFI_FSM_TOKEN_FAILED, wifi_fsm_token_status(&fsm, 1));
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_TICK, 7000 + WIFI_FSM_RETRY_MIN_MS - 1));
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_BEGIN, step(WIFI_FSM_EV_TICK, 7000 + WIFI_FSM_RETRY_MIN_MS));
+  TEST_ASSERT_EQUAL(2, fsm.connects);
+}
+
+// A retry due during a scan is deferred to the end of the scan
+static void test_retry_waits_for_scan(void) {
+  step(WIFI_FSM_EV_CONNECT, 0, 2);
+  uint32_t t = fail_at(0);
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_SCAN, step(WIFI_FSM_EV_SCAN, t + 1));
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_TICK, t + WIFI_FSM_RETRY_MIN_MS));
+  TEST_ASSERT_EQUAL(WIFI_FSM_CONNECTING, fsm.state);
+  TEST_ASSERT_TRUE(fsm.begin_pending);
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_TICK, t + 9000));
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_COLLECT | WIFI_FSM_ACT_BEGIN, step(WIFI_FSM_EV_SCAN_DONE, t + 9500));
+  TEST_ASSERT_EQUAL(t + 9500 + CONNECT_MS, fsm.deadline_ms);
+}
+
+// A scan requested while joining starts once the join is over
+static void test_scan_deferred_while_connecting(void) {
+  step(WIFI_FSM_EV_CONNECT, 0, 2);
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_SCAN, 10));
+  TEST_ASSERT_TRUE(fsm.scan_pending);
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_CONNECTED | WIFI_FSM_ACT_SCAN, step(WIFI_FSM_EV_GOT_IP, 2000));
+  TEST_ASSERT_TRUE(fsm.scanning);
+  TEST_ASSERT_FALSE(fsm.scan_pending);
+  // A second request while scanning is ignored
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_SCAN, 2100));
+}
+
+static void test_scan_deferred_until_failed(void) {
+  step(WIFI_FSM_EV_CONNECT, 0, 2);
+  step(WIFI_FSM_EV_SCAN, 10);
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_SCAN, step(WIFI_FSM_EV_TICK, CONNECT_MS));
+  TEST_ASSERT_EQUAL(WIFI_FSM_FAILED, fsm.state);
+  TEST_ASSERT_TRUE(fsm.scanning);
+}
+
+// A scan without a completion event ends at its deadline
+static void test_scan_timeout(void) {
+  step(WIFI_FSM_EV_SCAN, 0);
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_TICK, SCAN_MS - 1));
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_COLLECT, step(WIFI_FSM_EV_TICK, SCAN_MS));
+  TEST_ASSERT_FALSE(fsm.scanning);
+  // A late completion event is ignored
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_SCAN_DONE, SCAN_MS + 10));
+}
+
+// Deadlines hold across the 49-day wrap of millis()
+static void test_time_wraps(void) {
+  uint32_t start = 0xFFFFFFFFu - 1000;
+  step(WIFI_FSM_EV_CONNECT, start, 2);
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_TICK, start + 2000));
+  TEST_ASSERT_EQUAL(WIFI_FSM_CONNECTING, fsm.state);
+  step(WIFI_FSM_EV_TICK, start + CONNECT_MS);
+  TEST_ASSERT_EQUAL(WIFI_FSM_FAILED, fsm.state);
+  TEST_ASSERT_EQUAL(0, step(WIFI_FSM_EV_TICK, start + CONNECT_MS + WIFI_FSM_RETRY_MIN_MS - 1));
+  TEST_ASSERT_EQUAL(WIFI_FSM_ACT_BEGIN, step(WIFI_FSM_EV_TICK, start + CONNECT_MS + WIFI_FSM_RETRY_MIN_MS));
+}
+
+static void test_names(void) {
+  TEST_ASSERT_EQUAL_STRING("failed", wifi_fsm_state_name(WIFI_FSM_FAILED));
+  TEST_ASSERT_EQUAL_STRING("superseded", wifi_fsm_token_status_name(WIFI_FSM_TOKEN_SUPERSEDED));
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_init_connected);
+  RUN_TEST(test_connect_then_got_ip);
+  RUN_TEST(test_connect_dedup);
+  RUN_TEST(test_timeout_fails);
+  RUN_TEST(test_disconnect_while_connecting);
+  RUN_TEST(test_drop_rejoins);
+  RUN_TEST(test_drop_while_scanning);
+  RUN_TEST(test_failed_retries_with_backoff);
+  RUN_TEST(test_request_resets_backoff);
+  RUN_TEST(test_init_failed_retries);
+  RUN_TEST(test_retry_waits_for_scan);
+  RUN_TEST(test_scan_deferred_while_connecting);
+  RUN_TEST(test_scan_deferred_until_failed);
+  RUN_TEST(test_scan_timeout);
+  RUN_TEST(test_time_wraps);
+  RUN_TEST(test_names);
+  return UNITY_END();
+}
@@ -0,0 +1,75 @@
+"""Compress the pages in web/ into src/web_assets.h.
+
+Runs before every PlatformIO build (extra_scripts = pre:...) and can also be run
+by hand: python tools/build_web_assets.py. Each page is gzipped (fixed mtime, so
+the output only changes with the content) and gets a strong ETag from the hash
+of the compressed bytes. The header is rewritten only when it changes.
+"""
+import gzip
+import hashlib
+import os
+
+ASSETS = [
+    # (file in web/, URI or name used by the firmware, content type)
+    ("index_ov2640.html", "index_ov2640", "text/html"),
+    ("index_ov3660.html", "index_ov3660", "text/html"),
+    ("index_ov5640.html", "index_ov5640", "text/html"),
+    ("setup.html", "setup", "text/html"),
+]
+
+try:
+    Import("env")  # noqa: F821 (provided by PlatformIO/SCons)
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+WEB_DIR = os.path.join(PROJECT_DIR, "web")
+OUT = os.path.join(PROJECT_DIR, "src", "web_assets.h")
+
+
+def c_array(name, data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append("  " + ", ".join("0x%02X" % b for b in data[i:i + 16]) + ",")
+    return "static const uint8_t %s[] = {\n%s\n};\n" % (name, "\n".join(lines))
+
+
+def build():
+    out = [
+        "// Generated by tools/build_web_assets.py from web/ - do not edit.\n",
+        "#ifndef WEB_ASSETS_H\n#define WEB_ASSETS_H\n\n#include <stdint.h>\n#include <stddef.h>\n\n",
+        "typedef struct {\n"
+        "  const char *name;\n"
+        "  const char *type;\n"
+        "  const uint8_t *gz;  // gzip-compressed body\n"
+        "  size_t gz_len;\n"
+        "  const char *etag;   // quoted, strong\n"
+        "} web_asset_t;\n\n",
+    ]
+    table = []
+    for filename, name, ctype in ASSETS:
+        with open(os.path.join(WEB_DIR, filename), "rb") as f:
+            raw = f.read()
+        gz = gzip.compress(raw, compresslevel=9, mtime=0)
+        etag = hashlib.sha256(gz).hexdigest()[:16]
+        ident = "web_%s_gz" % name
+        out.append("// %s: %d bytes, %d gzipped\n" % (filename, len(raw), len(gz)))
+        out.append(c_array(ident, gz))
+        out.append("\n")
+        table.append('  {"%s", "%s", %s, %d, "\\"%s\\""},\n' % (name, ctype, ident, len(gz), etag))
+    out.append("static const web_asset_t web_assets[] = {\n%s};\n" % "".join(table))
+    out.append("#define WEB_ASSET_COUNT (sizeof(web_assets) / sizeof(web_assets[0]))\n\n")
+    out.append("#endif // WEB_ASSETS_H\n")
+    text = "".join(out)
+
+    old = None
+    if os.path.exists(OUT):
+        with open(OUT, "r") as f:
+            old = f.read()
+    if text != old:
+        with open(OUT, "w") as f:
+            f.write(text)
+        print("web assets: wrote %s" % os.path.relpath(OUT, PROJECT_DIR))
+
+
+build()